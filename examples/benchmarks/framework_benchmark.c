@@ -78,6 +78,9 @@ int main(int argc, char const *argv[]) {
               .on_request = route_perform, .public_folder = public_folder,
               .log = fio_cli_get_bool("-log"));
 
+  /* Batch IO events (optional) */
+  fio_poll_batch_set(fio_cli_get_i("-batch"));
+
   /* Start the facil.io reactor */
   fio_start(.threads = fio_cli_get_i("-t"), .workers = fio_cli_get_i("-w"));
 
@@ -126,6 +129,8 @@ static void cli_init(int argc, char const *argv[]) {
                             "System dependent default."),
                 FIO_CLI_INT("-workers -w The number of processes to use. "
                             "System dependent default."),
+                FIO_CLI_INT("-batch -B The number of IO events handled by each "
+                            "task (defaults to 0, a task per event)."),
                 FIO_CLI_PRINT_HEADER("Address Binding:"),
                 FIO_CLI_INT("-port -p The port number to listen to "
                             "(set to 0 for Unix Sockets."),
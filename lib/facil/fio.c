@@ -41,7 +41,13 @@ Feel free to copy, use and enjoy according to the license provided.
 #define FIO_ENGINE_POLL 0
 #endif
 
-#if !FIO_ENGINE_POLL && !FIO_ENGINE_EPOLL && !FIO_ENGINE_KQUEUE
+/* io_uring is opt-in (requires Linux 5.11 or later) */
+#ifndef FIO_ENGINE_URING
+#define FIO_ENGINE_URING 0
+#endif
+
+#if !FIO_ENGINE_POLL && !FIO_ENGINE_EPOLL && !FIO_ENGINE_KQUEUE &&             \
+    !FIO_ENGINE_URING
 #if defined(__linux__)
 #define FIO_ENGINE_EPOLL 1
 #elif defined(__APPLE__) || defined(__unix__)
@@ -57,6 +63,36 @@ Feel free to copy, use and enjoy according to the license provided.
 #elif FIO_ENGINE_KQUEUE
 
 #include <sys/event.h>
+
+#elif FIO_ENGINE_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#ifndef FIO_EPOLL_EDGE
+/**
+ * If true (1), the epoll engine uses a single epoll instance with edge
+ * triggered registrations (no re-arming system calls) and `EPOLLEXCLUSIVE`
+ * for listening sockets, rather than nested one-shot epoll instances.
+ */
+#define FIO_EPOLL_EDGE 0
+#endif
+#if !FIO_ENGINE_EPOLL
+#undef FIO_EPOLL_EDGE
+#define FIO_EPOLL_EDGE 0
+#endif
+
+/* pin workers / threads to CPU cores when requested (Linux only) */
+#ifndef FIO_CPU_AFFINITY
+#if defined(__linux__)
+#define FIO_CPU_AFFINITY 1
+#else
+#define FIO_CPU_AFFINITY 0
+#endif
+#endif
+
+#if FIO_CPU_AFFINITY
+#include <sched.h>
 #endif
 
 /* for kqueue and epoll only */
@@ -64,6 +100,16 @@ Feel free to copy, use and enjoy according to the license provided.
 #define FIO_POLL_MAX_EVENTS 64
 #endif
 
+/* the maximum allowed value for `fio_poll_batch_set` */
+#ifndef FIO_POLL_MAX_BATCH
+#define FIO_POLL_MAX_BATCH 1024
+#endif
+
+/* io_uring submission queue size (completion queue is twice as big) */
+#ifndef FIO_URING_ENTRIES
+#define FIO_URING_ENTRIES 1024
+#endif
+
 #ifndef FIO_POLL_TICK
 #define FIO_POLL_TICK 1000
 #endif
@@ -72,6 +118,74 @@ Feel free to copy, use and enjoy according to the license provided.
 #define FIO_USE_URGENT_QUEUE 1
 #endif
 
+#ifndef FIO_DEFER_BACKGROUND_WEIGHT
+/**
+ * Background tasks (see `fio_defer_priority`) run when the other queues are
+ * empty. To prevent starvation, a thread also performs a single background
+ * task after every `FIO_DEFER_BACKGROUND_WEIGHT` higher priority tasks.
+ */
+#define FIO_DEFER_BACKGROUND_WEIGHT 16
+#endif
+
+#ifndef FIO_DEFER_BLOCKING_THREADS
+/**
+ * The default number of threads (per worker process) performing blocking tasks
+ * (see `fio_defer_blocking` and `fio_start`'s `blocking_threads`).
+ */
+#define FIO_DEFER_BLOCKING_THREADS 4
+#endif
+
+#ifndef FIO_UDP_MMSG
+/** Use `recvmmsg` / `sendmmsg` (and UDP GSO) for UDP sockets (Linux). */
+#if defined(__linux__)
+#define FIO_UDP_MMSG 1
+#else
+#define FIO_UDP_MMSG 0
+#endif
+#endif
+
+#ifndef FIO_UDP_BATCH
+/** The number of datagrams read (or sent) by a single system call. */
+#define FIO_UDP_BATCH 32
+#endif
+
+#ifndef FIO_UDP_DATAGRAM_SIZE
+/** The size of each read buffer (longer datagrams are truncated). */
+#define FIO_UDP_DATAGRAM_SIZE 2048
+#endif
+
+#ifndef FIO_FAIR_ON_DATA
+/**
+ * Limits forced `on_data` events (i.e., pipelined data waiting in a protocol's
+ * buffer) to a single event per connection per reactor cycle, so a busy
+ * connection yields to newly polled IO events. Set to 0 to disable.
+ */
+#define FIO_FAIR_ON_DATA 1
+#endif
+
+#ifndef FIO_METRICS
+/**
+ * Collects runtime metrics (see `fio_metrics`) using per-thread counters that
+ * are merged when read. Set to 0 to disable.
+ */
+#define FIO_METRICS 1
+#endif
+
+#ifndef FIO_TRACE
+/**
+ * Records trace events (reactor polling, tasks and the time they waited in the
+ * queue, `on_data` callbacks and `fio_flush` calls) into per-thread ring
+ * buffers, see `fio_trace_dump`. Costs a clock reading per event, so it's off
+ * by default.
+ */
+#define FIO_TRACE 0
+#endif
+
+#ifndef FIO_TRACE_RING_SIZE
+/** The number of (most recent) trace events kept by each thread. */
+#define FIO_TRACE_RING_SIZE 4096
+#endif
+
 #ifndef DEBUG_SPINLOCK
 #define DEBUG_SPINLOCK 0
 #endif
@@ -140,6 +254,11 @@ struct fio_packet_s {
   } data;
   uintptr_t offset;
   uintptr_t length;
+  /* the file window mapped by `fio_sock_write_from_mmap` (if any) */
+  void *map;
+  uintptr_t map_len;
+  /* the number of bytes accounted for in the connection's `packet_bytes` */
+  uintptr_t queued;
 };
 
 /** Connection data (fd_data) */
@@ -150,6 +269,11 @@ typedef struct {
   fio_packet_s **packet_last;
   /** The number of pending packets that are in the queue. */
   size_t packet_count;
+  /** The number of buffered bytes in the queue (files aren't counted). */
+  size_t packet_bytes;
+  /** The queue's high / low watermarks (see `fio_watermarks`). */
+  size_t watermark_high;
+  size_t watermark_low;
   /* Data sent so far */
   size_t sent;
   /* fd protocol */
@@ -170,8 +294,26 @@ typedef struct {
   uint8_t open;
   /** indicated that the connection should be closed. */
   uint8_t close;
+  /** the reactor cycle of the last `on_data` event (see FIO_FAIR_ON_DATA) */
+  uint8_t turn;
+  /** the watermark policy (`fio_watermark_policy_e`) */
+  uint8_t watermark_policy;
+  /** set once the high watermark was exceeded, until `low` is reached */
+  uint8_t congested;
   /** peer address length */
   uint8_t addr_len;
+#if FIO_EPOLL_EDGE
+  /** set once the fd was added to the epoll instance */
+  uint8_t poll_registered;
+  /** set for listening sockets (registered using `EPOLLEXCLUSIVE`) */
+  uint8_t poll_exclusive;
+  /** set when data might be waiting in the kernel's buffer */
+  volatile uint8_t poll_readable;
+  /** set when a write might have filled the kernel's buffer */
+  volatile uint8_t poll_blocked;
+  /** unlocked while waiting for an edge (0 == read, 1 == write) */
+  fio_lock_i poll_wait[2];
+#endif
   /** peer address length */
   uint8_t addr[48];
   /** RW hooks. */
@@ -182,10 +324,25 @@ typedef struct {
   fio_uuid_links_s links;
 } fio_fd_data_s;
 
+/* the number of timeout review buckets (one per second, a power of 2) */
+#define FIO_TIMEOUT_BUCKETS 512
+/* the timeout enforced for connections without a timeout (see `fio_touch`) */
+#define FIO_TIMEOUT_DEFAULT 300
+
+/* a connection's timeout bucket links (`fd + 1` values, 0 == none) */
+typedef struct {
+  uint32_t next;
+  uint32_t prev;
+  /* the bucket's index + 1 (0 == not in a bucket) */
+  uint16_t bucket;
+} fio_timeout_link_s;
+
 typedef struct {
   struct timespec last_cycle;
   /* connection capacity */
   uint32_t capa;
+  /* initialized connections (`info` grows in FIO_FD_DATA_CHUNK steps) */
+  uint32_t volatile ready;
   /* connections counted towards shutdown (NOT while running) */
   uint32_t connection_count;
   /* thread list */
@@ -196,10 +353,14 @@ typedef struct {
   uint16_t threads;
   /* timeout review loop flag */
   uint8_t need_review;
+  /* the reactor cycle (wraps around, see FIO_FAIR_ON_DATA) */
+  uint8_t turn;
   /* spinning down process */
   uint8_t volatile active;
   /* worker process flag - true also for single process */
   uint8_t is_worker;
+  /* the worker's index (kept when the worker is respawned) */
+  uint16_t worker_id;
   /* polling and global lock */
   fio_lock_i lock;
   /* The highest active fd with a protocol object */
@@ -208,7 +369,20 @@ typedef struct {
   pid_t parent;
 #if FIO_ENGINE_POLL
   struct pollfd *poll;
+#elif FIO_ENGINE_URING
+  /* armed io_uring poll requests (bit 0 == read, bit 1 == write), with the
+   * connection's generation (uuid counter) in the upper byte */
+  uint16_t *uring;
 #endif
+  /* timeout review buckets (a coarse timer wheel, see `fio_timeout_schedule`)
+   * the extra bucket holds the connections currently under review */
+  uint32_t timeout_wheel[FIO_TIMEOUT_BUCKETS + 1];
+  /* the buckets' connection links (separate from `info`, which is reset) */
+  fio_timeout_link_s *timeouts;
+  /* the last second reviewed */
+  time_t timeout_reviewed;
+  /* timeout buckets lock */
+  fio_lock_i timeout_lock;
   fio_fd_data_s info[];
 } fio_data_s;
 
@@ -220,6 +394,14 @@ int FIO_LOG_LEVEL = FIO_LOG_LEVEL_INFO;
 #endif
 static fio_data_s *fio_data = NULL;
 
+/* forced `on_data` events postponed to the next reactor cycle */
+static struct {
+  intptr_t *uuids;
+  size_t count;
+  size_t capa;
+  fio_lock_i lock;
+} fio_on_data_postponed = {.lock = FIO_LOCK_INIT};
+
 /* used for protocol locking by task type. */
 typedef struct {
   fio_lock_i locks[3];
@@ -257,6 +439,8 @@ Packet allocation (for socket's user-buffer)
 ***************************************************************************** */
 
 static inline void fio_packet_free(fio_packet_s *packet) {
+  if (packet->map)
+    munmap(packet->map, packet->map_len);
   packet->dealloc(packet->data.buffer);
   fio_free(packet);
 }
@@ -270,6 +454,36 @@ static inline fio_packet_s *fio_packet_alloc(void) {
 Core Connection Data Clearing
 ***************************************************************************** */
 
+/* initializes the connection data up to (and including) `fd`'s chunk */
+static void fio_fd_data_grow___(uint32_t fd) {
+  if (fd >= fio_data->capa)
+    return;
+  uint32_t end = (fd / FIO_FD_DATA_CHUNK + 1) * FIO_FD_DATA_CHUNK;
+  if (end > fio_data->capa)
+    end = fio_data->capa;
+  fio_lock(&fio_data->lock);
+  const uint32_t start = fio_data->ready;
+  for (uint32_t i = start; i < end; ++i) {
+    fd_data(i) = (fio_fd_data_s){
+        .rw_hooks = (fio_rw_hook_s *)&FIO_DEFAULT_RW_HOOKS,
+        .counter = 1,
+        .packet_last = &fd_data(i).packet,
+    };
+#if FIO_ENGINE_POLL
+    fio_data->poll[i].fd = -1;
+#endif
+  }
+  if (end > start)
+    fio_atomic_add(&fio_data->ready, end - start); /* after the data is set */
+  fio_unlock(&fio_data->lock);
+}
+
+/* makes sure the connection data for `fd` was initialized */
+static inline void fio_fd_data_grow(intptr_t fd) {
+  if ((uint32_t)fd >= fio_data->ready)
+    fio_fd_data_grow___((uint32_t)fd);
+}
+
 /* set the minimal max_protocol_fd */
 static void fio_max_fd_min(uint32_t fd) {
   if (fio_data->max_protocol_fd > fd)
@@ -290,6 +504,83 @@ static void fio_max_fd_shrink(void) {
   fio_unlock(&fio_data->lock);
 }
 
+/* *****************************************************************************
+Timeout review buckets
+
+Connections are placed in the bucket of the second they're expected to expire
+at (`active + timeout`). `fio_touch` only updates the `active` value, so touched
+connections are moved to their new bucket once their old bucket is reviewed.
+
+Lock `timeout_lock` before calling the `___` functions.
+***************************************************************************** */
+
+#if (FIO_TIMEOUT_BUCKETS & (FIO_TIMEOUT_BUCKETS - 1)) ||                       \
+    FIO_TIMEOUT_BUCKETS <= FIO_TIMEOUT_DEFAULT
+#error FIO_TIMEOUT_BUCKETS must be a power of 2, larger than any timeout.
+#endif
+
+/* the second at which a connection expires */
+static inline time_t fio_timeout_deadline(intptr_t fd) {
+  time_t timeout = fd_data(fd).timeout;
+  if (!timeout)
+    timeout = FIO_TIMEOUT_DEFAULT; /* enforced timout settings */
+  return fd_data(fd).active + timeout;
+}
+
+/* removes a connection from it's bucket (if any) */
+static inline void fio_timeout_unlink___(intptr_t fd) {
+  fio_timeout_link_s *l = fio_data->timeouts + fd;
+  if (!l->bucket)
+    return;
+  if (l->prev)
+    fio_data->timeouts[l->prev - 1].next = l->next;
+  else
+    fio_data->timeout_wheel[l->bucket - 1] = l->next;
+  if (l->next)
+    fio_data->timeouts[l->next - 1].prev = l->prev;
+  *l = (fio_timeout_link_s){.bucket = 0};
+}
+
+/* adds a connection to the head of a bucket */
+static inline void fio_timeout_link___(intptr_t fd, size_t bucket) {
+  fio_timeout_link_s *l = fio_data->timeouts + fd;
+  *l = (fio_timeout_link_s){
+      .next = fio_data->timeout_wheel[bucket],
+      .bucket = (uint16_t)(bucket + 1),
+  };
+  if (l->next)
+    fio_data->timeouts[l->next - 1].prev = (uint32_t)fd + 1;
+  fio_data->timeout_wheel[bucket] = (uint32_t)fd + 1;
+}
+
+/* places a connection in the bucket for `deadline` (an unreviewed second) */
+static inline void fio_timeout_place___(intptr_t fd, time_t deadline) {
+  fio_timeout_unlink___(fd);
+  if (!fd_data(fd).protocol)
+    return; /* only connections with a protocol are reviewed */
+  if (deadline <= fio_data->timeout_reviewed)
+    deadline = fio_data->timeout_reviewed + 1;
+  else if (deadline > fio_data->timeout_reviewed + FIO_TIMEOUT_BUCKETS)
+    deadline = fio_data->timeout_reviewed + FIO_TIMEOUT_BUCKETS;
+  fio_timeout_link___(fd, (size_t)deadline & (FIO_TIMEOUT_BUCKETS - 1));
+}
+
+/* (re)places a connection in the bucket matching it's timeout */
+static void fio_timeout_schedule(intptr_t fd) {
+  fio_lock(&fio_data->timeout_lock);
+  fio_timeout_place___(fd, fio_timeout_deadline(fd));
+  fio_unlock(&fio_data->timeout_lock);
+}
+
+/* removes a connection from the timeout review */
+static void fio_timeout_cancel(intptr_t fd) {
+  if (!fio_data->timeouts[fd].bucket)
+    return;
+  fio_lock(&fio_data->timeout_lock);
+  fio_timeout_unlink___(fd);
+  fio_unlock(&fio_data->timeout_lock);
+}
+
 /* resets connection data, marking it as either open or closed. */
 static inline int fio_clear_fd(intptr_t fd, uint8_t is_open) {
   fio_packet_s *packet;
@@ -297,6 +588,8 @@ static inline int fio_clear_fd(intptr_t fd, uint8_t is_open) {
   fio_rw_hook_s *rw_hooks;
   void *rw_udata;
   fio_uuid_links_s links;
+  if (is_open)
+    fio_fd_data_grow(fd);
   fio_lock(&(fd_data(fd).sock_lock));
   links = fd_data(fd).links;
   packet = fd_data(fd).packet;
@@ -312,6 +605,8 @@ static inline int fio_clear_fd(intptr_t fd, uint8_t is_open) {
       .packet_last = &fd_data(fd).packet,
   };
   fio_unlock(&(fd_data(fd).sock_lock));
+  /* after the reset, so the review wouldn't place the connection again */
+  fio_timeout_cancel(fd);
   if (rw_hooks && rw_hooks->cleanup)
     rw_hooks->cleanup(rw_udata);
   while (packet) {
@@ -379,7 +674,7 @@ inline static void protocol_unlock(fio_protocol_s *pr,
 /** returns 1 if the UUID is valid and 0 if it isn't. */
 #define uuid_is_valid(uuid)                                                    \
   ((intptr_t)(uuid) != -1 &&                                                   \
-   ((uint32_t)fio_uuid2fd((uuid))) < fio_data->capa &&                         \
+   ((uint32_t)fio_uuid2fd((uuid))) < fio_data->ready &&                        \
    ((uintptr_t)(uuid)&0xFF) == uuid_data((uuid)).counter)
 
 /* public API. */
@@ -405,6 +700,7 @@ UUID validation and state
 intptr_t fio_fd2uuid(int fd) {
   if (fd < 0 || (size_t)fd >= fio_data->capa)
     return -1;
+  fio_fd_data_grow(fd);
   if (!fd_data(fd).open) {
     fio_lock(&fd_data(fd).protocol_lock);
     fio_clear_fd(fd, 1);
@@ -820,11 +1116,20 @@ Section Start Marker
 #endif
 #endif
 
+#ifndef FIO_DEFER_WORK_STEALING
+/* thread pool threads push tasks to their own queue, idle threads steal. */
+#define FIO_DEFER_WORK_STEALING 1
+#endif
+
 /* task node data */
 typedef struct {
   void (*func)(void *, void *);
   void *arg1;
   void *arg2;
+#if FIO_TRACE
+  /* the time the task was queued (see `FIO_TRACE`) */
+  uint64_t queued_at;
+#endif
 } fio_defer_task_s;
 
 /* task queue block */
@@ -847,6 +1152,8 @@ typedef struct { /* a lock for the state machine, used for multi-threading
   fio_defer_queue_block_s *writer;
   /* static, built-in, queue */
   fio_defer_queue_block_s static_queue;
+  /* the number of tasks in the queue (see `fio_metrics`) */
+  size_t count;
 } fio_task_queue_s;
 
 /* the state machine - this holds all the data about the task queue and pool */
@@ -858,6 +1165,343 @@ static fio_task_queue_s task_queue_urgent = {
     .reader = &task_queue_urgent.static_queue,
     .writer = &task_queue_urgent.static_queue};
 
+static fio_task_queue_s task_queue_background = {
+    .reader = &task_queue_background.static_queue,
+    .writer = &task_queue_background.static_queue};
+
+/* performed by a separate thread pool (see `fio_defer_blocking`) */
+static fio_task_queue_s task_queue_blocking = {
+    .reader = &task_queue_blocking.static_queue,
+    .writer = &task_queue_blocking.static_queue};
+
+#if FIO_DEFER_WORK_STEALING
+/* per-thread queues, owned by the (single) active thread pool */
+static struct {
+  size_t count;
+  fio_task_queue_s *queues;
+} fio_defer_local = {.count = 0};
+
+/* the calling thread's queue (NULL for threads outside the thread pool) */
+static __thread fio_task_queue_s *fio_defer_local_queue;
+
+#define FIO_DEFER_QUEUE_NORMAL                                                 \
+  (fio_defer_local_queue ? fio_defer_local_queue : &task_queue_normal)
+#else
+#define FIO_DEFER_QUEUE_NORMAL (&task_queue_normal)
+#endif
+
+/* *****************************************************************************
+Runtime Metrics (per-thread counters, merged on read)
+***************************************************************************** */
+
+typedef enum {
+  FIO_METRIC_ACCEPTED,
+  FIO_METRIC_CLOSED,
+  FIO_METRIC_TASKS,
+  FIO_METRIC_BYTES_READ,
+  FIO_METRIC_BYTES_WRITTEN,
+  FIO_METRIC_PUBLISHED,
+  FIO_METRIC_DELIVERED,
+  FIO_METRIC_COUNT,
+} fio_metric_e;
+
+/* a thread's counters, only written by the thread (no atomics required) */
+typedef struct fio_metrics_thread_s fio_metrics_thread_s;
+struct fio_metrics_thread_s {
+  fio_metrics_thread_s *next;
+  size_t count[FIO_METRIC_COUNT];
+};
+
+static struct {
+  fio_metrics_thread_s *list;
+  /* the counters of threads that exited */
+  size_t retired[FIO_METRIC_COUNT];
+  /* folds a thread's counters into `retired` when the thread exits */
+  pthread_key_t key;
+  uint8_t key_valid;
+  fio_lock_i lock;
+} fio_metrics_data = {.lock = FIO_LOCK_INIT};
+
+#if FIO_METRICS
+static __thread fio_metrics_thread_s *fio_metrics_local;
+
+static void fio_metrics_thread_cleanup(void *c_) {
+  fio_metrics_thread_s *c = c_;
+  fio_lock(&fio_metrics_data.lock);
+  fio_metrics_thread_s **pos = &fio_metrics_data.list;
+  while (*pos && *pos != c)
+    pos = &(*pos)->next;
+  if (*pos) {
+    *pos = c->next;
+    for (size_t i = 0; i < FIO_METRIC_COUNT; ++i)
+      fio_metrics_data.retired[i] += c->count[i];
+  }
+  fio_unlock(&fio_metrics_data.lock);
+  free(c);
+  fio_metrics_local = NULL;
+}
+
+static fio_metrics_thread_s *fio_metrics_thread_new(void) {
+  /* system memory, as the counters are freed by the thread's TLS cleanup */
+  fio_metrics_thread_s *c = calloc(1, sizeof(*c));
+  FIO_ASSERT_ALLOC(c);
+  fio_lock(&fio_metrics_data.lock);
+  if (!fio_metrics_data.key_valid &&
+      !pthread_key_create(&fio_metrics_data.key, fio_metrics_thread_cleanup))
+    fio_metrics_data.key_valid = 1;
+  c->next = fio_metrics_data.list;
+  fio_metrics_data.list = c;
+  fio_unlock(&fio_metrics_data.lock);
+  if (fio_metrics_data.key_valid)
+    pthread_setspecific(fio_metrics_data.key, c);
+  fio_metrics_local = c;
+  return c;
+}
+
+static inline void fio_metric_add(fio_metric_e metric, size_t n) {
+  fio_metrics_thread_s *c = fio_metrics_local;
+  if (!c)
+    c = fio_metrics_thread_new();
+  c->count[metric] += n;
+}
+
+/* a worker process reports its own metrics, the parent's threads are gone */
+static void fio_metrics_on_fork(void) {
+  fio_metrics_data.lock = FIO_LOCK_INIT;
+  fio_metrics_thread_s *c = fio_metrics_data.list;
+  while (c) {
+    fio_metrics_thread_s *tmp = c;
+    c = c->next;
+    if (tmp != fio_metrics_local)
+      free(tmp);
+  }
+  fio_metrics_data.list = fio_metrics_local;
+  if (fio_metrics_local) {
+    fio_metrics_local->next = NULL;
+    memset(fio_metrics_local->count, 0, sizeof(fio_metrics_local->count));
+  }
+  memset(fio_metrics_data.retired, 0, sizeof(fio_metrics_data.retired));
+}
+
+#else
+#define fio_metric_add(metric, n) ((void)0)
+#define fio_metrics_on_fork()
+#endif /* FIO_METRICS */
+
+/* *****************************************************************************
+Tracing (per-thread event rings, see `fio_trace_dump`)
+***************************************************************************** */
+
+#if FIO_TRACE
+typedef enum {
+  FIO_TRACE_POLL,
+  FIO_TRACE_TASK,
+  FIO_TRACE_ON_DATA,
+  FIO_TRACE_FLUSH,
+} fio_trace_e;
+
+typedef struct {
+  /* nanoseconds (CLOCK_MONOTONIC) */
+  uint64_t start;
+  uint64_t duration;
+  /* the number of events (poll), queue wait (task) or the fd */
+  uint64_t arg;
+  /* the function performed (if any) */
+  uintptr_t func;
+  fio_trace_e type;
+} fio_trace_event_s;
+
+/* a thread's ring, only written by the thread (old events are overwritten) */
+typedef struct fio_trace_ring_s fio_trace_ring_s;
+struct fio_trace_ring_s {
+  fio_trace_ring_s *next;
+  /* a sequential thread number */
+  size_t tid;
+  volatile size_t head;
+  fio_trace_event_s events[FIO_TRACE_RING_SIZE];
+};
+
+/* rings are kept after their thread exits, so its events can be reviewed */
+static struct {
+  fio_trace_ring_s *list;
+  size_t count;
+  fio_lock_i lock;
+} fio_trace_data = {.lock = FIO_LOCK_INIT};
+
+static __thread fio_trace_ring_s *fio_trace_local;
+
+static inline uint64_t fio_trace_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000000000) + t.tv_nsec;
+}
+
+static fio_trace_ring_s *fio_trace_ring_new(void) {
+  fio_trace_ring_s *ring = calloc(1, sizeof(*ring));
+  FIO_ASSERT_ALLOC(ring);
+  fio_lock(&fio_trace_data.lock);
+  ring->tid = ++fio_trace_data.count;
+  ring->next = fio_trace_data.list;
+  fio_trace_data.list = ring;
+  fio_unlock(&fio_trace_data.lock);
+  fio_trace_local = ring;
+  return ring;
+}
+
+static void fio_trace_add(fio_trace_e type, uintptr_t func, uint64_t start,
+                          uint64_t arg) {
+  const uint64_t end = fio_trace_now();
+  fio_trace_ring_s *ring = fio_trace_local;
+  if (!ring)
+    ring = fio_trace_ring_new();
+  ring->events[ring->head & (FIO_TRACE_RING_SIZE - 1)] = (fio_trace_event_s){
+      .start = start,
+      .duration = end - start,
+      .arg = arg,
+      .func = func,
+      .type = type,
+  };
+  ++ring->head;
+}
+
+/* a worker's trace starts when it's forked (the parent's threads are gone) */
+static void fio_trace_on_fork(void) {
+  fio_trace_data.lock = FIO_LOCK_INIT;
+  fio_trace_ring_s *ring = fio_trace_data.list;
+  while (ring) {
+    fio_trace_ring_s *tmp = ring;
+    ring = ring->next;
+    if (tmp != fio_trace_local)
+      free(tmp);
+  }
+  fio_trace_data.list = fio_trace_local;
+  fio_trace_data.count = 0;
+  if (fio_trace_local) {
+    fio_trace_local->next = NULL;
+    fio_trace_local->head = 0;
+    fio_trace_local->tid = ++fio_trace_data.count;
+  }
+}
+
+#define FIO_TRACE_BEGIN(name) const uint64_t name = fio_trace_now()
+#define FIO_TRACE_END(name, type, func, arg)                                   \
+  fio_trace_add((type), (uintptr_t)(func), (name), (uint64_t)(arg))
+/* writes the whole buffer, unless an error occurs */
+static int fio_trace_write(int fd, char *data, size_t len) {
+  while (len) {
+    ssize_t w = write(fd, data, len);
+    if (w > 0) {
+      data += w;
+      len -= w;
+    } else if (w < 0 && errno == EINTR) {
+      continue;
+    } else {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/** Writes the trace events to `fd` (Chrome's trace event JSON format). */
+ssize_t fio_trace_dump(int fd) {
+  static const char *names[] = {"poll", "task", "on_data", "flush"};
+  static const char *args[] = {"events", "queued_us", "fd", "fd"};
+  char buf[16384];
+  size_t len = 0;
+  ssize_t count = 0;
+  const int pid = (int)getpid();
+  len += snprintf(buf, sizeof(buf), "{\"traceEvents\":[");
+  fio_lock(&fio_trace_data.lock);
+  for (fio_trace_ring_s *ring = fio_trace_data.list; ring; ring = ring->next) {
+    const size_t head = ring->head;
+    size_t i = (head > FIO_TRACE_RING_SIZE ? head - FIO_TRACE_RING_SIZE : 0);
+    for (; i < head; ++i) {
+      fio_trace_event_s e = ring->events[i & (FIO_TRACE_RING_SIZE - 1)];
+      if (sizeof(buf) - len < 256) {
+        if (fio_trace_write(fd, buf, len))
+          goto error;
+        len = 0;
+      }
+      len += snprintf(buf + len, sizeof(buf) - len,
+                      "%s\n{\"name\":\"%s\",\"cat\":\"fio\",\"ph\":\"X\","
+                      "\"pid\":%d,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f,"
+                      "\"args\":{",
+                      (count ? "," : ""), names[e.type], pid, ring->tid,
+                      e.start / 1000.0, e.duration / 1000.0);
+      if (e.type == FIO_TRACE_TASK)
+        len += snprintf(buf + len, sizeof(buf) - len, "\"%s\":%.3f",
+                        args[e.type], e.arg / 1000.0);
+      else
+        len += snprintf(buf + len, sizeof(buf) - len, "\"%s\":%lu",
+                        args[e.type], (unsigned long)e.arg);
+      if (e.func)
+        len += snprintf(buf + len, sizeof(buf) - len, ",\"func\":\"%p\"",
+                        (void *)e.func);
+      buf[len++] = '}';
+      buf[len++] = '}';
+      ++count;
+    }
+  }
+  fio_unlock(&fio_trace_data.lock);
+  len += snprintf(buf + len, sizeof(buf) - len,
+                  "\n],\"displayTimeUnit\":\"ns\"}\n");
+  if (fio_trace_write(fd, buf, len))
+    return -1;
+  return count;
+error:
+  fio_unlock(&fio_trace_data.lock);
+  return -1;
+}
+
+#else
+#define FIO_TRACE_BEGIN(name)
+#define FIO_TRACE_END(name, type, func, arg) ((void)0)
+#define fio_trace_on_fork()
+
+ssize_t fio_trace_dump(int fd) {
+  (void)fd;
+  errno = ENOTSUP;
+  return -1;
+}
+#endif /* FIO_TRACE */
+
+/** Returns the calling process's runtime metrics. */
+fio_metrics_s fio_metrics(void) {
+  fio_metrics_s r = {.memory = fio_malloc_stats()};
+  size_t count[FIO_METRIC_COUNT];
+  fio_lock(&fio_metrics_data.lock);
+  memcpy(count, fio_metrics_data.retired, sizeof(count));
+  for (fio_metrics_thread_s *c = fio_metrics_data.list; c; c = c->next) {
+    for (size_t i = 0; i < FIO_METRIC_COUNT; ++i)
+      count[i] += c->count[i];
+  }
+  fio_unlock(&fio_metrics_data.lock);
+  r.accepted = count[FIO_METRIC_ACCEPTED];
+  r.closed = count[FIO_METRIC_CLOSED];
+  r.tasks = count[FIO_METRIC_TASKS];
+  r.bytes_read = count[FIO_METRIC_BYTES_READ];
+  r.bytes_written = count[FIO_METRIC_BYTES_WRITTEN];
+  r.published = count[FIO_METRIC_PUBLISHED];
+  r.delivered = count[FIO_METRIC_DELIVERED];
+  /* queue depths and connection states are reviewed (unlocked) when read */
+  r.tasks_pending = task_queue_normal.count + task_queue_urgent.count +
+                    task_queue_background.count + task_queue_blocking.count;
+#if FIO_DEFER_WORK_STEALING
+  for (size_t i = 0; i < fio_defer_local.count; ++i)
+    r.tasks_pending += fio_defer_local.queues[i].count;
+#endif
+  if (!fio_data)
+    return r;
+  for (size_t i = 0; i <= fio_data->max_protocol_fd; ++i) {
+    if (!fd_data(i).open || !fd_data(i).protocol)
+      continue;
+    ++r.open;
+    r.packets_pending += fd_data(i).packet_count;
+    r.bytes_pending += fd_data(i).packet_bytes;
+  }
+  return r;
+}
+
 /* *****************************************************************************
 Internal Task API
 ***************************************************************************** */
@@ -878,6 +1522,9 @@ static size_t fio_defer_count_alloc, fio_defer_count_dealloc;
 
 static inline void fio_defer_push_task_fn(fio_defer_task_s task,
                                           fio_task_queue_s *queue) {
+#if FIO_TRACE
+  task.queued_at = fio_trace_now();
+#endif
   fio_lock(&queue->lock);
 
   /* test if full */
@@ -900,6 +1547,7 @@ static inline void fio_defer_push_task_fn(fio_defer_task_s task,
 
   /* place task and finish */
   queue->writer->tasks[queue->writer->write++] = task;
+  ++queue->count;
   /* cycle buffer */
   if (queue->writer->write == DEFER_QUEUE_BLOCK_COUNT) {
     queue->writer->write = 0;
@@ -917,7 +1565,7 @@ critical_error:
   do {                                                                         \
     fio_defer_push_task_fn(                                                    \
         (fio_defer_task_s){.func = func_, .arg1 = arg1_, .arg2 = arg2_},       \
-        &task_queue_normal);                                                   \
+        FIO_DEFER_QUEUE_NORMAL);                                               \
     fio_defer_thread_signal();                                                 \
   } while (0)
 
@@ -931,6 +1579,14 @@ critical_error:
   fio_defer_push_task(func_, arg1_, arg2_)
 #endif
 
+#define fio_defer_push_background(func_, arg1_, arg2_)                         \
+  do {                                                                         \
+    fio_defer_push_task_fn(                                                    \
+        (fio_defer_task_s){.func = func_, .arg1 = arg1_, .arg2 = arg2_},       \
+        &task_queue_background);                                               \
+    fio_defer_thread_signal();                                                 \
+  } while (0)
+
 static inline fio_defer_task_s fio_defer_pop_task(fio_task_queue_s *queue) {
   fio_defer_task_s ret = (fio_defer_task_s){.func = NULL};
   fio_defer_queue_block_s *to_free = NULL;
@@ -942,6 +1598,7 @@ static inline fio_defer_task_s fio_defer_pop_task(fio_task_queue_s *queue) {
     goto finish;
   /* collect task */
   ret = queue->reader->tasks[queue->reader->read++];
+  --queue->count;
   /* cycle */
   if (queue->reader->read == DEFER_QUEUE_BLOCK_COUNT) {
     queue->reader->read = 0;
@@ -990,9 +1647,18 @@ static inline void fio_defer_clear_tasks_for_queue(fio_task_queue_s *queue) {
   }
   queue->static_queue = (fio_defer_queue_block_s){.next = NULL};
   queue->reader = queue->writer = &queue->static_queue;
+  queue->count = 0;
   fio_unlock(&queue->lock);
 }
 
+/* performs a task that was popped from a queue */
+static inline void fio_defer_perform_task(fio_defer_task_s task) {
+  fio_metric_add(FIO_METRIC_TASKS, 1);
+  FIO_TRACE_BEGIN(trace);
+  task.func(task.arg1, task.arg2);
+  FIO_TRACE_END(trace, FIO_TRACE_TASK, task.func, trace - task.queued_at);
+}
+
 /**
  * Performs a single task from the queue, returning -1 if the queue was empty.
  */
@@ -1001,14 +1667,70 @@ fio_defer_perform_single_task_for_queue(fio_task_queue_s *queue) {
   fio_defer_task_s task = fio_defer_pop_task(queue);
   if (!task.func)
     return -1;
-  task.func(task.arg1, task.arg2);
+  fio_defer_perform_task(task);
+  return 0;
+}
+
+/* tests if a queue has any tasks (without locking) */
+static inline int fio_defer_queue_has_tasks(fio_task_queue_s *queue) {
+  return queue->reader != queue->writer ||
+         queue->reader->write != queue->reader->read || queue->reader->state;
+}
+
+#if FIO_DEFER_WORK_STEALING
+/* steals a task from another thread's queue, skipping busy queues */
+static inline fio_defer_task_s fio_defer_steal_task(void) {
+  static __thread size_t pos = 0;
+  const size_t count = fio_defer_local.count;
+  for (size_t i = 0; i < count; ++i) {
+    fio_task_queue_s *queue = fio_defer_local.queues + ((pos + i) % count);
+    if (queue == fio_defer_local_queue || !fio_defer_queue_has_tasks(queue) ||
+        fio_is_locked(&queue->lock))
+      continue;
+    fio_defer_task_s task = fio_defer_pop_task(queue);
+    if (task.func) {
+      pos += i;
+      return task;
+    }
+  }
+  return (fio_defer_task_s){.func = NULL};
+}
+#endif
+
+/**
+ * Performs a single task from the normal priority queues (the thread's own
+ * queue, the shared queue or another thread's queue, in that order).
+ *
+ * Returns -1 if there were no tasks.
+ */
+static inline int fio_defer_perform_single_normal_task(void) {
+#if FIO_DEFER_WORK_STEALING
+  if (fio_defer_local_queue &&
+      fio_defer_perform_single_task_for_queue(fio_defer_local_queue) == 0)
+    return 0;
+  if (fio_defer_perform_single_task_for_queue(&task_queue_normal) == 0)
+    return 0;
+  fio_defer_task_s task = fio_defer_steal_task();
+  if (!task.func)
+    return -1;
+  fio_defer_perform_task(task);
   return 0;
+#else
+  return fio_defer_perform_single_task_for_queue(&task_queue_normal);
+#endif
 }
 
 static inline void fio_defer_clear_tasks(void) {
   fio_defer_clear_tasks_for_queue(&task_queue_normal);
 #if FIO_USE_URGENT_QUEUE
   fio_defer_clear_tasks_for_queue(&task_queue_urgent);
+#endif
+  fio_defer_clear_tasks_for_queue(&task_queue_background);
+  fio_defer_clear_tasks_for_queue(&task_queue_blocking);
+#if FIO_DEFER_WORK_STEALING
+  for (size_t i = 0; i < fio_defer_local.count; ++i) {
+    fio_defer_clear_tasks_for_queue(fio_defer_local.queues + i);
+  }
 #endif
 }
 
@@ -1016,6 +1738,13 @@ static void fio_defer_on_fork(void) {
   task_queue_normal.lock = FIO_LOCK_INIT;
 #if FIO_USE_URGENT_QUEUE
   task_queue_urgent.lock = FIO_LOCK_INIT;
+#endif
+  task_queue_background.lock = FIO_LOCK_INIT;
+#if FIO_DEFER_WORK_STEALING
+  /* threads (and their queues) don't survive `fork` */
+  fio_defer_local.count = 0;
+  fio_defer_local.queues = NULL;
+  fio_defer_local_queue = NULL;
 #endif
 }
 
@@ -1035,48 +1764,84 @@ call_error:
   return -1;
 }
 
-/** Performs all deferred functions until the queue had been depleted. */
-void fio_defer_perform(void) {
+/** Defers a task using the requested priority class. */
+int fio_defer_priority(fio_task_priority_e priority,
+                       void (*func)(void *, void *), void *arg1, void *arg2) {
+  if (!func)
+    return -1;
+  switch (priority) {
+  case FIO_TASK_PRIORITY_URGENT:
+    fio_defer_push_urgent(func, arg1, arg2);
+    fio_defer_thread_signal();
+    return 0;
+  case FIO_TASK_PRIORITY_NORMAL:
+    fio_defer_push_task(func, arg1, arg2);
+    return 0;
+  case FIO_TASK_PRIORITY_BACKGROUND:
+    fio_defer_push_background(func, arg1, arg2);
+    return 0;
+  }
+  return -1;
+}
+
+/* performs an urgent or normal task, returning -1 if there were none */
+static inline int fio_defer_perform_single_foreground_task(void) {
 #if FIO_USE_URGENT_QUEUE
-  while (fio_defer_perform_single_task_for_queue(&task_queue_urgent) == 0 ||
-         fio_defer_perform_single_task_for_queue(&task_queue_normal) == 0)
-    ;
-#else
-  while (fio_defer_perform_single_task_for_queue(&task_queue_normal) == 0)
-    ;
+  if (fio_defer_perform_single_task_for_queue(&task_queue_urgent) == 0)
+    return 0;
 #endif
-  //   for (;;) {
-  // #if FIO_USE_URGENT_QUEUE
-  //     fio_defer_task_s task = fio_defer_pop_task(&task_queue_urgent);
-  //     if (!task.func)
-  //       task = fio_defer_pop_task(&task_queue_normal);
-  // #else
-  //     fio_defer_task_s task = fio_defer_pop_task(&task_queue_normal);
-  // #endif
-  //     if (!task.func)
-  //       return;
-  //     task.func(task.arg1, task.arg2);
-  //   }
+  return fio_defer_perform_single_normal_task();
+}
+
+/** Performs all deferred functions until the queue had been depleted. */
+void fio_defer_perform(void) {
+  /* higher priority tasks performed since the last background task */
+  static __thread size_t since_background = 0;
+  for (;;) {
+    if (fio_defer_perform_single_foreground_task() == 0) {
+      /* starvation protection: background tasks get a weighted share */
+      if (++since_background < FIO_DEFER_BACKGROUND_WEIGHT)
+        continue;
+      since_background = 0;
+      fio_defer_perform_single_task_for_queue(&task_queue_background);
+      continue;
+    }
+    since_background = 0;
+    if (fio_defer_perform_single_task_for_queue(&task_queue_background))
+      return;
+  }
 }
 
 /** Returns true if there are deferred functions waiting for execution. */
 int fio_defer_has_queue(void) {
 #if FIO_USE_URGENT_QUEUE
-  return task_queue_urgent.reader != task_queue_urgent.writer ||
-         task_queue_urgent.reader->write != task_queue_urgent.reader->read ||
-         task_queue_normal.reader != task_queue_normal.writer ||
-         task_queue_normal.reader->write != task_queue_normal.reader->read;
-#else
-  return task_queue_normal.reader != task_queue_normal.writer ||
-         task_queue_normal.reader->write != task_queue_normal.reader->read;
+  if (fio_defer_queue_has_tasks(&task_queue_urgent))
+    return 1;
+#endif
+  if (fio_defer_queue_has_tasks(&task_queue_normal) ||
+      fio_defer_queue_has_tasks(&task_queue_background))
+    return 1;
+#if FIO_DEFER_WORK_STEALING
+  for (size_t i = 0; i < fio_defer_local.count; ++i) {
+    if (fio_defer_queue_has_tasks(fio_defer_local.queues + i))
+      return 1;
+  }
 #endif
+  return 0;
 }
 
 /** Clears the queue. */
 void fio_defer_clear_queue(void) { fio_defer_clear_tasks(); }
 
-/* Thread pool task */
-static void *fio_defer_cycle(void *ignr) {
+/* pins pool threads when requested (see `fio_start`) */
+static void fio_affinity_thread_start(void);
+
+/* Thread pool task (`queue` is the thread's own queue, if any) */
+static void *fio_defer_cycle(void *queue) {
+#if FIO_DEFER_WORK_STEALING
+  fio_defer_local_queue = queue;
+#endif
+  fio_affinity_thread_start();
   fio_defer_on_thread_start();
   for (;;) {
     fio_defer_perform();
@@ -1085,12 +1850,17 @@ static void *fio_defer_cycle(void *ignr) {
     fio_defer_thread_wait();
   }
   fio_defer_on_thread_end();
-  return ignr;
+#if FIO_DEFER_WORK_STEALING
+  fio_defer_local_queue = NULL;
+#endif
+  return queue;
 }
 
 /* thread pool type */
 typedef struct {
   size_t thread_count;
+  /* per-thread queues (NULL if the pool isn't using work stealing) */
+  fio_task_queue_s *queues;
   void *threads[];
 } fio_defer_thread_pool_s;
 
@@ -1099,6 +1869,20 @@ static void fio_defer_thread_pool_join(fio_defer_thread_pool_s *pool) {
   for (size_t i = 0; i < pool->thread_count; ++i) {
     fio_thread_join(pool->threads[i]);
   }
+#if FIO_DEFER_WORK_STEALING
+  if (pool->queues) {
+    /* move any remaining tasks to the shared queue */
+    const size_t count = fio_defer_local.count;
+    fio_defer_local.count = 0;
+    for (size_t i = 0; i < count; ++i) {
+      fio_defer_task_s task;
+      while ((task = fio_defer_pop_task(pool->queues + i)).func)
+        fio_defer_push_task_fn(task, &task_queue_normal);
+    }
+    fio_defer_local.queues = NULL;
+    free(pool->queues);
+  }
+#endif
   free(pool);
 }
 
@@ -1110,8 +1894,26 @@ static fio_defer_thread_pool_s *fio_defer_thread_pool_new(size_t count) {
       malloc(sizeof(*pool) + (count * sizeof(void *)));
   FIO_ASSERT_ALLOC(pool);
   pool->thread_count = count;
+  pool->queues = NULL;
+#if FIO_DEFER_WORK_STEALING
+  if (!fio_defer_local.count && count > 1) {
+    /* only a single pool may use per-thread queues */
+    pool->queues = malloc(sizeof(*pool->queues) * count);
+    FIO_ASSERT_ALLOC(pool->queues);
+    for (size_t i = 0; i < count; ++i) {
+      pool->queues[i] = (fio_task_queue_s){
+          .lock = FIO_LOCK_INIT,
+          .reader = &pool->queues[i].static_queue,
+          .writer = &pool->queues[i].static_queue,
+      };
+    }
+    fio_defer_local.queues = pool->queues;
+    fio_defer_local.count = count;
+  }
+#endif
   for (size_t i = 0; i < count; ++i) {
-    pool->threads[i] = fio_thread_new(fio_defer_cycle, NULL);
+    pool->threads[i] = fio_thread_new(
+        fio_defer_cycle, (pool->queues ? (pool->queues + i) : NULL));
     if (!pool->threads[i]) {
       pool->thread_count = i;
       goto error;
@@ -1126,10 +1928,124 @@ error:
 }
 
 /* *****************************************************************************
-Section Start Marker
-
-
-
+Blocking Task Pool (see `fio_defer_blocking`)
+***************************************************************************** */
+
+static struct {
+  /* protects the `idle` count and signals idle threads */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  /* the number of threads requested (see `fio_start`) */
+  size_t requested;
+  size_t count;
+  /* the number of threads waiting for tasks */
+  size_t idle;
+  void **threads;
+  volatile uint8_t running;
+} fio_blocking_pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .requested = FIO_DEFER_BLOCKING_THREADS,
+};
+
+/* Blocking pool thread - sleeps until a task is available */
+static void *fio_defer_blocking_cycle(void *arg) {
+  pthread_mutex_lock(&fio_blocking_pool.lock);
+  for (;;) {
+    fio_defer_task_s task = fio_defer_pop_task(&task_queue_blocking);
+    if (task.func) {
+      pthread_mutex_unlock(&fio_blocking_pool.lock);
+      fio_defer_perform_task(task);
+      pthread_mutex_lock(&fio_blocking_pool.lock);
+      continue;
+    }
+    if (!fio_blocking_pool.running)
+      break;
+    ++fio_blocking_pool.idle;
+    pthread_cond_wait(&fio_blocking_pool.cond, &fio_blocking_pool.lock);
+    --fio_blocking_pool.idle;
+  }
+  pthread_mutex_unlock(&fio_blocking_pool.lock);
+  return arg;
+}
+
+/* stops the blocking task pool once the queued tasks were performed */
+static void fio_defer_blocking_stop(void) {
+  if (!fio_blocking_pool.threads)
+    return;
+  pthread_mutex_lock(&fio_blocking_pool.lock);
+  fio_blocking_pool.running = 0;
+  pthread_cond_broadcast(&fio_blocking_pool.cond);
+  pthread_mutex_unlock(&fio_blocking_pool.lock);
+  for (size_t i = 0; i < fio_blocking_pool.count; ++i)
+    fio_thread_join(fio_blocking_pool.threads[i]);
+  free(fio_blocking_pool.threads);
+  fio_blocking_pool.threads = NULL;
+  fio_blocking_pool.count = 0;
+  /* tasks scheduled while the pool was stopping are left for the reactor */
+  fio_defer_task_s task;
+  while ((task = fio_defer_pop_task(&task_queue_blocking)).func)
+    fio_defer_push_task_fn(task, &task_queue_normal);
+}
+
+/* starts the blocking task pool (in worker processes) */
+static void fio_defer_blocking_start(void) {
+  const size_t count = fio_blocking_pool.requested;
+  if (!count || fio_blocking_pool.threads)
+    return;
+  fio_blocking_pool.threads = malloc(sizeof(void *) * count);
+  FIO_ASSERT_ALLOC(fio_blocking_pool.threads);
+  fio_blocking_pool.running = 1;
+  for (fio_blocking_pool.count = 0; fio_blocking_pool.count < count;
+       ++fio_blocking_pool.count) {
+    void *thread = fio_thread_new(fio_defer_blocking_cycle, NULL);
+    if (!thread)
+      break;
+    fio_blocking_pool.threads[fio_blocking_pool.count] = thread;
+  }
+  if (fio_blocking_pool.count < count) {
+    FIO_LOG_ERROR("couldn't spawn the blocking task threads (%zu/%zu).",
+                  fio_blocking_pool.count, count);
+    if (!fio_blocking_pool.count)
+      fio_defer_blocking_stop();
+  }
+}
+
+static void fio_defer_blocking_on_fork(void) {
+  /* threads don't survive `fork` */
+  free(fio_blocking_pool.threads);
+  fio_blocking_pool.threads = NULL;
+  fio_blocking_pool.count = 0;
+  fio_blocking_pool.idle = 0;
+  fio_blocking_pool.running = 0;
+  pthread_mutex_init(&fio_blocking_pool.lock, NULL);
+  pthread_cond_init(&fio_blocking_pool.cond, NULL);
+  task_queue_blocking.lock = FIO_LOCK_INIT;
+}
+
+/**
+ * Defers a blocking task to the blocking task pool.
+ */
+int fio_defer_blocking(void (*func)(void *, void *), void *arg1, void *arg2) {
+  if (!func)
+    return -1;
+  if (!fio_blocking_pool.running)
+    return fio_defer(func, arg1, arg2);
+  fio_defer_push_task_fn(
+      (fio_defer_task_s){.func = func, .arg1 = arg1, .arg2 = arg2},
+      &task_queue_blocking);
+  pthread_mutex_lock(&fio_blocking_pool.lock);
+  if (fio_blocking_pool.idle)
+    pthread_cond_signal(&fio_blocking_pool.cond);
+  pthread_mutex_unlock(&fio_blocking_pool.lock);
+  return 0;
+}
+
+/* *****************************************************************************
+Section Start Marker
+
+
+
 
 
 
@@ -1149,17 +2065,27 @@ Section Start Marker
 
 ***************************************************************************** */
 
-typedef struct {
-  fio_ls_embd_s node;
+struct fio_timer_s {
   struct timespec due;
   size_t interval; /*in ms */
   size_t repetitions;
   void (*task)(void *);
   void *arg;
   void (*on_finish)(void *);
-} fio_timer_s;
+  /* the timer's position in the heap, or FIO_TIMER_NOT_SCHEDULED */
+  size_t pos;
+  /* set by `fio_timer_cancel` */
+  volatile uint8_t cancelled;
+};
 
-static fio_ls_embd_s fio_timers = FIO_LS_INIT(fio_timers);
+#define FIO_TIMER_NOT_SCHEDULED ((size_t)-1)
+
+/* the timers are kept in a 4-ary min-heap, ordered by due time */
+static struct {
+  fio_timer_s **heap;
+  size_t count;
+  size_t capa;
+} fio_timers = {.heap = NULL};
 
 static fio_lock_i fio_timer_lock = FIO_LOCK_INIT;
 
@@ -1171,12 +2097,12 @@ static inline void fio_mark_time(void) {
 /** Calculates the due time for a task, given it's interval */
 static struct timespec fio_timer_calc_due(size_t interval) {
   struct timespec now = fio_last_tick();
-  if (interval > 1000) {
+  if (interval >= 1000) {
     now.tv_sec += interval / 1000;
-    interval -= interval / 1000;
+    interval %= 1000;
   }
   now.tv_nsec += (interval * 1000000UL);
-  if (now.tv_nsec > 1000000000L) {
+  if (now.tv_nsec >= 1000000000L) {
     now.tv_nsec -= 1000000000L;
     now.tv_sec += 1;
   }
@@ -1186,14 +2112,19 @@ static struct timespec fio_timer_calc_due(size_t interval) {
 /** Returns the number of miliseconds until the next event, up to FIO_POLL_TICK
  */
 static size_t fio_timer_calc_first_interval(void) {
-  if (fio_defer_has_queue())
+  if (fio_defer_has_queue() || fio_on_data_postponed.count)
     return 0;
-  if (fio_ls_embd_is_empty(&fio_timers)) {
+  if (!fio_timers.count) {
     return FIO_POLL_TICK;
   }
   struct timespec now = fio_last_tick();
-  struct timespec due =
-      FIO_LS_EMBD_OBJ(fio_timer_s, node, fio_timers.next)->due;
+  fio_lock(&fio_timer_lock);
+  if (!fio_timers.count) {
+    fio_unlock(&fio_timer_lock);
+    return FIO_POLL_TICK;
+  }
+  struct timespec due = fio_timers.heap[0]->due;
+  fio_unlock(&fio_timer_lock);
   if (due.tv_sec < now.tv_sec ||
       (due.tv_sec == now.tv_sec && due.tv_nsec <= now.tv_nsec))
     return 0;
@@ -1222,62 +2153,134 @@ static int fio_timer_compare(struct timespec a, struct timespec b) {
   return -1;
 }
 
-/** Places a timer in an ordered linked list. */
-static void fio_timer_add_order(fio_timer_s *timer) {
+/* places the timer at heap position `i` (call within lock). */
+static inline void fio_timer_heap_set(size_t i, fio_timer_s *timer) {
+  fio_timers.heap[i] = timer;
+  timer->pos = i;
+}
+
+/* moves a timer towards the root of the heap (call within lock). */
+static void fio_timer_heap_sift_up(size_t i) {
+  fio_timer_s *timer = fio_timers.heap[i];
+  while (i) {
+    const size_t parent = (i - 1) >> 2;
+    if (fio_timer_compare(timer->due, fio_timers.heap[parent]->due) <= 0)
+      break;
+    fio_timer_heap_set(i, fio_timers.heap[parent]);
+    i = parent;
+  }
+  fio_timer_heap_set(i, timer);
+}
+
+/* moves a timer towards the leaves of the heap (call within lock). */
+static void fio_timer_heap_sift_down(size_t i) {
+  fio_timer_s *timer = fio_timers.heap[i];
+  for (;;) {
+    const size_t first = (i << 2) + 1;
+    if (first >= fio_timers.count)
+      break;
+    size_t end = first + 4;
+    if (end > fio_timers.count)
+      end = fio_timers.count;
+    size_t min = first;
+    for (size_t child = first + 1; child < end; ++child) {
+      if (fio_timer_compare(fio_timers.heap[child]->due,
+                            fio_timers.heap[min]->due) > 0)
+        min = child;
+    }
+    if (fio_timer_compare(fio_timers.heap[min]->due, timer->due) <= 0)
+      break;
+    fio_timer_heap_set(i, fio_timers.heap[min]);
+    i = min;
+  }
+  fio_timer_heap_set(i, timer);
+}
+
+/* removes a timer from the heap (call within lock). */
+static void fio_timer_heap_remove(fio_timer_s *timer) {
+  const size_t i = timer->pos;
+  timer->pos = FIO_TIMER_NOT_SCHEDULED;
+  --fio_timers.count;
+  if (i == fio_timers.count)
+    return;
+  fio_timer_heap_set(i, fio_timers.heap[fio_timers.count]);
+  fio_timer_heap_sift_down(i);
+  fio_timer_heap_sift_up(i);
+}
+
+/** Places a timer in the timer heap (call within lock). */
+static void fio_timer_add_order_unsafe(fio_timer_s *timer) {
   timer->due = fio_timer_calc_due(timer->interval);
-  // fio_ls_embd_s *pos = &fio_timers;
-  fio_lock(&fio_timer_lock);
-  FIO_LS_EMBD_FOR(&fio_timers, node) {
-    fio_timer_s *t2 = FIO_LS_EMBD_OBJ(fio_timer_s, node, node);
-    if (fio_timer_compare(timer->due, t2->due) >= 0) {
-      fio_ls_embd_push(node, &timer->node);
-      goto finish;
+  if (fio_timers.count == fio_timers.capa) {
+    size_t capa = fio_timers.capa ? (fio_timers.capa << 1) : 64;
+    fio_timer_s **tmp = realloc(fio_timers.heap, capa * sizeof(*tmp));
+    if (!tmp) {
+      fio_unlock(&fio_timer_lock);
+      FIO_ASSERT_ALLOC(tmp);
     }
+    fio_timers.heap = tmp;
+    fio_timers.capa = capa;
   }
-  fio_ls_embd_push(&fio_timers, &timer->node);
-finish:
-  fio_unlock(&fio_timer_lock);
+  fio_timers.heap[fio_timers.count] = timer;
+  fio_timer_heap_sift_up(fio_timers.count++);
+}
+
+/** Calls the timer's `on_finish` callback and frees the timer. */
+static void fio_timer_finish(void *timer_, void *ignr) {
+  fio_timer_s *timer = timer_;
+  if (timer->on_finish)
+    timer->on_finish(timer->arg);
+  free(timer);
+  (void)ignr;
 }
 
 /** Performs a timer task and re-adds it to the queue (or cleans it up) */
 static void fio_timer_perform_single(void *timer_, void *ignr) {
   fio_timer_s *timer = timer_;
+  if (timer->cancelled)
+    goto finish;
   timer->task(timer->arg);
+  if (timer->cancelled)
+    goto finish;
   if (!timer->repetitions || fio_atomic_sub(&timer->repetitions, 1))
     goto reschedule;
-  if (timer->on_finish)
-    timer->on_finish(timer->arg);
-  free(timer);
+finish:
+  fio_timer_finish(timer, ignr);
   return;
-  (void)ignr;
 reschedule:
-  fio_timer_add_order(timer);
+  fio_lock(&fio_timer_lock);
+  if (timer->cancelled) {
+    fio_unlock(&fio_timer_lock);
+    goto finish;
+  }
+  fio_timer_add_order_unsafe(timer);
+  fio_unlock(&fio_timer_lock);
 }
 
 /** schedules all timers that are due to be performed. */
 static void fio_timer_schedule(void) {
   struct timespec now = fio_last_tick();
   fio_lock(&fio_timer_lock);
-  while (fio_ls_embd_any(&fio_timers) &&
-         fio_timer_compare(
-             FIO_LS_EMBD_OBJ(fio_timer_s, node, fio_timers.next)->due, now) >=
-             0) {
-    fio_ls_embd_s *tmp = fio_ls_embd_remove(fio_timers.next);
-    fio_defer(fio_timer_perform_single, FIO_LS_EMBD_OBJ(fio_timer_s, node, tmp),
-              NULL);
+  while (fio_timers.count &&
+         fio_timer_compare(fio_timers.heap[0]->due, now) >= 0) {
+    fio_timer_s *timer = fio_timers.heap[0];
+    fio_timer_heap_remove(timer);
+    fio_defer(fio_timer_perform_single, timer, NULL);
   }
   fio_unlock(&fio_timer_lock);
 }
 
 static void fio_timer_clear_all(void) {
   fio_lock(&fio_timer_lock);
-  while (fio_ls_embd_any(&fio_timers)) {
-    fio_timer_s *timer =
-        FIO_LS_EMBD_OBJ(fio_timer_s, node, fio_ls_embd_pop(&fio_timers));
+  while (fio_timers.count) {
+    fio_timer_s *timer = fio_timers.heap[--fio_timers.count];
     if (timer->on_finish)
       timer->on_finish(timer->arg);
     free(timer);
   }
+  free(fio_timers.heap);
+  fio_timers.heap = NULL;
+  fio_timers.capa = 0;
   fio_unlock(&fio_timer_lock);
 }
 
@@ -1293,8 +2296,22 @@ static void fio_timer_clear_all(void) {
  */
 int fio_run_every(size_t milliseconds, size_t repetitions, void (*task)(void *),
                   void *arg, void (*on_finish)(void *)) {
+  return fio_run_every2(milliseconds, repetitions, task, arg, on_finish)
+             ? 0
+             : -1;
+}
+
+/**
+ * Same as `fio_run_every`, but returns a handle that can be used to cancel the
+ * timer using `fio_timer_cancel`.
+ *
+ * Returns NULL on error.
+ */
+fio_timer_s *fio_run_every2(size_t milliseconds, size_t repetitions,
+                            void (*task)(void *), void *arg,
+                            void (*on_finish)(void *)) {
   if (!task || (milliseconds == 0 && !repetitions))
-    return -1;
+    return NULL;
   fio_timer_s *timer = malloc(sizeof(*timer));
   FIO_ASSERT_ALLOC(timer);
   fio_mark_time();
@@ -1305,9 +2322,36 @@ int fio_run_every(size_t milliseconds, size_t repetitions, void (*task)(void *),
       .task = task,
       .arg = arg,
       .on_finish = on_finish,
+      .pos = FIO_TIMER_NOT_SCHEDULED,
   };
-  fio_timer_add_order(timer);
-  return 0;
+  fio_lock(&fio_timer_lock);
+  fio_timer_add_order_unsafe(timer);
+  fio_unlock(&fio_timer_lock);
+  return timer;
+}
+
+/**
+ * Cancels a timer, so the task will not be performed again.
+ *
+ * The `on_finish` handler will be called (possibly asynchronously).
+ */
+void fio_timer_cancel(fio_timer_s *timer) {
+  if (!timer)
+    return;
+  fio_lock(&fio_timer_lock);
+  if (timer->cancelled) {
+    fio_unlock(&fio_timer_lock);
+    return;
+  }
+  timer->cancelled = 1;
+  if (timer->pos == FIO_TIMER_NOT_SCHEDULED) {
+    /* the task is running, `fio_timer_perform_single` will finish the timer */
+    fio_unlock(&fio_timer_lock);
+    return;
+  }
+  fio_timer_heap_remove(timer);
+  fio_unlock(&fio_timer_lock);
+  fio_defer(fio_timer_finish, timer, NULL);
 }
 
 /* *****************************************************************************
@@ -1339,6 +2383,7 @@ Section Start Marker
 ***************************************************************************** */
 
 volatile uint8_t fio_signal_children_flag = 0;
+volatile uint8_t fio_hot_restart_flag = 0;
 
 /*
  * Zombie Reaping
@@ -1373,6 +2418,9 @@ static void sig_int_handler(int sig) {
   case SIGUSR1:
     fio_signal_children_flag = 1;
     break;
+  case SIGUSR2:
+    fio_hot_restart_flag = 1;
+    break;
 #endif
   case SIGINT:  /* fallthrough */
   case SIGTERM: /* fallthrough */
@@ -1383,7 +2431,7 @@ static void sig_int_handler(int sig) {
   }
 }
 
-/* setup handling for the SIGUSR1, SIGPIPE, SIGINT and SIGTERM signals. */
+/* setup handling for the SIGUSR1, SIGUSR2, SIGPIPE, SIGINT and SIGTERM. */
 static void fio_signal_handler_setup(void) {
   /* setup signal handling */
   struct sigaction act, old;
@@ -1408,6 +2456,10 @@ static void fio_signal_handler_setup(void) {
     perror("couldn't set signal handler");
     return;
   };
+  if (sigaction(SIGUSR2, &act, &old)) {
+    perror("couldn't set signal handler");
+    return;
+  };
 #endif
 
   act.sa_handler = SIG_IGN;
@@ -1426,6 +2478,7 @@ static void fio_signal_handler_reset(void) {
   sigaction(SIGTERM, &act, &old);
 #if !FIO_DISABLE_HOT_RESTART
   sigaction(SIGUSR1, &act, &old);
+  sigaction(SIGUSR2, &act, &old);
 #endif
   sigaction(SIGPIPE, &act, &old);
 }
@@ -1546,6 +2599,202 @@ void fio_expected_concurrency(int16_t *threads, int16_t *processes) {
 
 static fio_lock_i fio_fork_lock = FIO_LOCK_INIT;
 
+/* *****************************************************************************
+CPU affinity (worker / thread placement)
+***************************************************************************** */
+
+#if FIO_CPU_AFFINITY
+
+static struct {
+  /* the CPUs available to the process, grouped by CPU package (socket) */
+  uint16_t cpus[CPU_SETSIZE];
+  uint16_t count;
+  /* the worker's slice of `cpus` */
+  uint16_t start;
+  uint16_t len;
+  uint8_t pin_workers;
+  uint8_t pin_threads;
+  /* the worker's index, set by the sentinel thread before forking */
+  uint16_t worker;
+  /* pool threads are pinned in order */
+  size_t volatile thread_count;
+} fio_affinity;
+
+/* returns the CPU's package (socket) id, or 0 if unknown */
+static int fio_affinity_package(int cpu) {
+  char buf[96];
+  int package = 0;
+  snprintf(buf, sizeof(buf),
+           "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+  FILE *f = fopen(buf, "r");
+  if (!f)
+    return 0;
+  if (fscanf(f, "%d", &package) != 1)
+    package = 0;
+  fclose(f);
+  return package;
+}
+
+/* collects the CPUs available to the (root) process, before forking */
+static void fio_affinity_collect(uint8_t pin_workers, uint8_t pin_threads) {
+  fio_affinity.count = 0;
+  fio_affinity.pin_workers = pin_workers;
+  fio_affinity.pin_threads = pin_threads;
+  if (!pin_workers && !pin_threads)
+    return;
+  int packages[CPU_SETSIZE];
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set)) {
+    FIO_LOG_WARNING("CPU affinity detection failed, workers won't be pinned.");
+    return;
+  }
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (!CPU_ISSET(cpu, &set))
+      continue;
+    /* insertion sort (by package) keeps a socket's cores together */
+    int package = fio_affinity_package(cpu);
+    size_t pos = fio_affinity.count++;
+    while (pos && packages[pos - 1] > package) {
+      packages[pos] = packages[pos - 1];
+      fio_affinity.cpus[pos] = fio_affinity.cpus[pos - 1];
+      --pos;
+    }
+    packages[pos] = package;
+    fio_affinity.cpus[pos] = (uint16_t)cpu;
+  }
+}
+
+/* writes to the (copy on write) pages in the range, so they're local */
+static void fio_affinity_localize_pages(void *start, void *end) {
+  long page = sysconf(_SC_PAGESIZE);
+  if (page <= 0)
+    page = 4096;
+  for (uintptr_t pos = (uintptr_t)start; pos < (uintptr_t)end; pos += page) {
+    volatile uint8_t *tmp = (volatile uint8_t *)pos;
+    *tmp = *tmp;
+  }
+}
+
+/* writes to the (copy on write) state pages, so they're local to the worker */
+static void fio_affinity_localize_state(void) {
+  /* only the slots in use (i.e., listening sockets) are copied, the rest are
+   * written (allocated) by the worker once a connection is initialized */
+  uint32_t used = fio_data->max_protocol_fd + 1;
+  if (used > fio_data->ready)
+    used = fio_data->ready;
+  fio_affinity_localize_pages(fio_data, fio_data->info + used);
+#if FIO_ENGINE_POLL
+  fio_affinity_localize_pages(fio_data->poll, fio_data->poll + used);
+#elif FIO_ENGINE_URING
+  fio_affinity_localize_pages(fio_data->uring, fio_data->uring + used);
+#endif
+}
+
+/* pins the worker process to it's share of the CPUs (call before threads) */
+static void fio_affinity_worker_start(void) {
+  fio_affinity.thread_count = 0;
+  if (!fio_affinity.count)
+    return;
+  size_t workers = fio_data->workers;
+  size_t index = fio_data->workers > 1 ? fio_affinity.worker : 0;
+  if (workers <= fio_affinity.count) {
+    fio_affinity.start = (uint16_t)((index * fio_affinity.count) / workers);
+    fio_affinity.len =
+        (uint16_t)((((index + 1) * fio_affinity.count) / workers) -
+                   fio_affinity.start);
+  } else {
+    fio_affinity.start = (uint16_t)(index % fio_affinity.count);
+    fio_affinity.len = 1;
+  }
+  if (!fio_affinity.pin_workers || workers == 1)
+    return;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < fio_affinity.len; ++i)
+    CPU_SET(fio_affinity.cpus[fio_affinity.start + i], &set);
+  if (sched_setaffinity(0, sizeof(set), &set)) {
+    FIO_LOG_WARNING("(%d) couldn't pin worker to CPU %u-%u", getpid(),
+                    fio_affinity.cpus[fio_affinity.start],
+                    fio_affinity.cpus[fio_affinity.start + fio_affinity.len -
+                                      1]);
+    return;
+  }
+  FIO_LOG_DEBUG("(%d) worker pinned to %u CPU(s) starting at CPU %u",
+                getpid(), fio_affinity.len,
+                fio_affinity.cpus[fio_affinity.start]);
+  /* new memory is placed on the local NUMA node (first touch) */
+  fio_affinity_localize_state();
+}
+
+/* pins a pool thread to a single core within the worker's share */
+static void fio_affinity_thread_start(void) {
+  if (!fio_affinity.pin_threads || !fio_affinity.len)
+    return;
+  size_t index = fio_atomic_add(&fio_affinity.thread_count, 1) - 1;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(fio_affinity.cpus[fio_affinity.start + (index % fio_affinity.len)],
+          &set);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+    FIO_LOG_WARNING("(%d) couldn't pin thread to a CPU", getpid());
+}
+
+#else /* FIO_CPU_AFFINITY */
+
+static void fio_affinity_collect(uint8_t pin_workers, uint8_t pin_threads) {
+  if (pin_workers || pin_threads)
+    FIO_LOG_WARNING("CPU affinity is unsupported on this system.");
+}
+static void fio_affinity_worker_start(void) {}
+static void fio_affinity_thread_start(void) {}
+
+#endif /* FIO_CPU_AFFINITY */
+
+/* *****************************************************************************
+Batched event dispatching
+***************************************************************************** */
+
+/* the number of events per polling cycle when batching (0 == disabled) */
+static size_t volatile fio_poll_batch = 0;
+
+/**
+ * Sets the number of IO events collected in each polling cycle and enables
+ * batched event dispatching.
+ */
+void fio_poll_batch_set(size_t count) {
+  if (count > FIO_POLL_MAX_BATCH)
+    count = FIO_POLL_MAX_BATCH;
+  fio_poll_batch = count;
+}
+
+/** Returns the batch size set by `fio_poll_batch_set` (0 == disabled). */
+size_t fio_poll_batch_get(void) { return fio_poll_batch; }
+
+/* a list of connections waiting for the same event type */
+typedef struct {
+  size_t count;
+  intptr_t uuids[];
+} fio_poll_batch_s;
+
+FIO_FUNC void deferred_on_data_batch(void *batch_, void *ignr) {
+  fio_poll_batch_s *batch = batch_;
+  for (size_t i = 0; i < batch->count; ++i) {
+    deferred_on_data((void *)batch->uuids[i], NULL);
+  }
+  fio_free(batch);
+  (void)ignr;
+}
+
+FIO_FUNC void deferred_on_ready_batch(void *batch_, void *ignr) {
+  fio_poll_batch_s *batch = batch_;
+  for (size_t i = 0; i < batch->count; ++i) {
+    deferred_on_ready((void *)batch->uuids[i], NULL);
+  }
+  fio_free(batch);
+  (void)ignr;
+}
+
 /* *****************************************************************************
 Section Start Marker
 
@@ -1577,12 +2826,12 @@ Section Start Marker
 
 
 ***************************************************************************** */
-#if FIO_ENGINE_EPOLL
+#if FIO_ENGINE_EPOLL && !FIO_EPOLL_EDGE
 
 /**
  * Returns a C string detailing the IO engine selected during compilation.
  *
- * Valid values are "kqueue", "epoll" and "poll".
+ * Valid values are "kqueue", "epoll", "io_uring" and "poll".
  */
 char const *fio_engine(void) { return "epoll"; }
 
@@ -1668,45 +2917,659 @@ static inline void fio_poll_add(intptr_t fd) {
 }
 
 FIO_FUNC inline void fio_poll_remove_fd(intptr_t fd) {
-  struct epoll_event chevent = {.events = (EPOLLOUT | EPOLLIN), .data.fd = fd};
-  epoll_ctl(evio_fd[1], EPOLL_CTL_DEL, fd, &chevent);
-  epoll_ctl(evio_fd[2], EPOLL_CTL_DEL, fd, &chevent);
+  struct epoll_event chevent = {.events = (EPOLLOUT | EPOLLIN), .data.fd = fd};
+  epoll_ctl(evio_fd[1], EPOLL_CTL_DEL, fd, &chevent);
+  epoll_ctl(evio_fd[2], EPOLL_CTL_DEL, fd, &chevent);
+}
+
+/* `fio_poll`, with a single task per event type (see `fio_poll_batch_set`) */
+static size_t fio_poll_batched(size_t limit) {
+  int timeout_millisec = fio_timer_calc_first_interval();
+  struct epoll_event internal[2];
+  struct epoll_event events[FIO_POLL_MAX_BATCH];
+  int total = 0;
+  /* wait for events and handle them */
+  int internal_count = epoll_wait(evio_fd[0], internal, 2, timeout_millisec);
+  if (internal_count == 0)
+    return internal_count;
+  for (int j = 0; j < internal_count; ++j) {
+    int active_count = epoll_wait(internal[j].data.fd, events, limit, 0);
+    if (active_count <= 0)
+      continue;
+    fio_poll_batch_s *batch = fio_malloc(
+        sizeof(*batch) + (sizeof(batch->uuids[0]) * (size_t)active_count));
+    FIO_ASSERT_ALLOC(batch);
+    batch->count = 0;
+    for (int i = 0; i < active_count; i++) {
+      if (events[i].events & (~(EPOLLIN | EPOLLOUT))) {
+        // errors are hendled as disconnections (on_close)
+        fio_force_close_in_poll(fd2uuid(events[i].data.fd));
+      } else {
+        batch->uuids[batch->count++] = fd2uuid(events[i].data.fd);
+      }
+    }
+    total += active_count;
+    if (!batch->count) {
+      fio_free(batch);
+    } else if (internal[j].data.fd == evio_fd[2]) {
+      fio_defer_push_urgent(deferred_on_ready_batch, batch, NULL);
+    } else {
+      fio_defer_push_task(deferred_on_data_batch, batch, NULL);
+    }
+  }
+  return total;
+}
+
+static size_t fio_poll(void) {
+  const size_t batch = fio_poll_batch;
+  if (batch)
+    return fio_poll_batched(batch);
+  int timeout_millisec = fio_timer_calc_first_interval();
+  struct epoll_event internal[2];
+  struct epoll_event events[FIO_POLL_MAX_EVENTS];
+  int total = 0;
+  /* wait for events and handle them */
+  int internal_count = epoll_wait(evio_fd[0], internal, 2, timeout_millisec);
+  if (internal_count == 0)
+    return internal_count;
+  for (int j = 0; j < internal_count; ++j) {
+    int active_count =
+        epoll_wait(internal[j].data.fd, events, FIO_POLL_MAX_EVENTS, 0);
+    if (active_count > 0) {
+      for (int i = 0; i < active_count; i++) {
+        if (events[i].events & (~(EPOLLIN | EPOLLOUT))) {
+          // errors are hendled as disconnections (on_close)
+          fio_force_close_in_poll(fd2uuid(events[i].data.fd));
+        } else {
+          // no error, then it's an active event(s)
+          if (events[i].events & EPOLLOUT) {
+            fio_defer_push_urgent(deferred_on_ready,
+                                  (void *)fd2uuid(events[i].data.fd), NULL);
+          }
+          if (events[i].events & EPOLLIN)
+            fio_defer_push_task(deferred_on_data,
+                                (void *)fd2uuid(events[i].data.fd), NULL);
+        }
+      } // end for loop
+      total += active_count;
+    }
+  }
+  return total;
+}
+
+#endif
+/* *****************************************************************************
+Section Start Marker
+
+
+
+
+
+
+
+
+
+
+
+
+
+              Polling State Machine - epoll (edge triggered)
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+***************************************************************************** */
+#if FIO_EPOLL_EDGE
+
+/**
+ * Returns a C string detailing the IO engine selected during compilation.
+ *
+ * Valid values are "kqueue", "epoll", "io_uring" and "poll".
+ */
+char const *fio_engine(void) { return "epoll"; }
+
+/*
+ * Each fd is registered once, for both read and write edges (EPOLLET), so
+ * re-arming an event doesn't require a system call.
+ *
+ * The one-shot semantics the rest of the library expects are kept by the
+ * `poll_wait` locks: an edge is only dispatched if the connection is waiting
+ * for it, otherwise it's recorded (`poll_readable`) and dispatched once the
+ * connection re-arms the event. Data left in the kernel's buffer by a
+ * protocol that didn't read everything is detected by `fio_read`.
+ *
+ * Writes are reported once the kernel's buffer was filled (`poll_blocked`),
+ * otherwise re-arming a write event dispatches it immediately.
+ */
+
+static int evio_fd = -1;
+
+static void fio_poll_close(void) {
+  if (evio_fd != -1) {
+    close(evio_fd);
+    evio_fd = -1;
+  }
+}
+
+static void fio_poll_init(void) {
+  fio_poll_close();
+  evio_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (evio_fd == -1) {
+    FIO_LOG_FATAL("couldn't open epoll.\n");
+    exit(errno);
+  }
+}
+
+/* adds the fd to the epoll instance, returns 1 if it wasn't added already */
+static inline int fio_poll_register(intptr_t fd) {
+  if (fd_data(fd).poll_registered ||
+      fio_atomic_xchange(&fd_data(fd).poll_registered, 1))
+    return 0;
+  struct epoll_event chevent = {
+      .events = (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET),
+      .data.fd = fd,
+  };
+  /* the registration reports the fd's current state as an edge */
+  fd_data(fd).poll_readable = 0;
+  fd_data(fd).poll_blocked = 1;
+#ifdef EPOLLEXCLUSIVE
+  if (fd_data(fd).poll_exclusive) {
+    /* a listening socket shared by the workers wakes a single worker */
+    chevent.events = (EPOLLIN | EPOLLET | EPOLLEXCLUSIVE);
+  }
+#endif
+  int ret;
+  do {
+    errno = 0;
+    ret = epoll_ctl(evio_fd, EPOLL_CTL_ADD, fd, &chevent);
+  } while (ret == -1 && errno == EINTR);
+#ifdef EPOLLEXCLUSIVE
+  if (ret == -1 && errno == EINVAL && (chevent.events & EPOLLEXCLUSIVE)) {
+    /* older kernels (before 4.5) */
+    chevent.events = (EPOLLIN | EPOLLET);
+    ret = epoll_ctl(evio_fd, EPOLL_CTL_ADD, fd, &chevent);
+  }
+#endif
+  if (ret == -1 && errno == EEXIST) {
+#ifdef EPOLLEXCLUSIVE
+    chevent.events &= ~(uint32_t)EPOLLEXCLUSIVE;
+#endif
+    ret = epoll_ctl(evio_fd, EPOLL_CTL_MOD, fd, &chevent);
+  }
+  if (ret == -1) {
+    fd_data(fd).poll_registered = 0;
+    return -1;
+  }
+  return 1;
+}
+
+/* pushes the event's task (or adds the connection to the event's batch) */
+static inline void fio_poll_dispatch(intptr_t fd, int write,
+                                     fio_poll_batch_s *batch) {
+  if (batch) {
+    batch->uuids[batch->count++] = fd2uuid(fd);
+  } else if (write) {
+    fio_defer_push_urgent(deferred_on_ready, (void *)fd2uuid(fd), NULL);
+  } else {
+    fio_defer_push_task(deferred_on_data, (void *)fd2uuid(fd), NULL);
+  }
+}
+
+/* dispatches a read edge, or records it if the connection isn't waiting */
+static inline void fio_poll_edge_read(intptr_t fd, fio_poll_batch_s *batch) {
+  fd_data(fd).poll_readable = 1;
+  if (!fio_trylock(&fd_data(fd).poll_wait[0]))
+    fio_poll_dispatch(fd, 0, batch);
+}
+
+/* dispatches a write edge, or records it if the connection isn't waiting */
+static inline void fio_poll_edge_write(intptr_t fd, fio_poll_batch_s *batch) {
+  fd_data(fd).poll_blocked = 0;
+  if (!fio_trylock(&fd_data(fd).poll_wait[1]))
+    fio_poll_dispatch(fd, 1, batch);
+}
+
+static inline void fio_poll_add_read(intptr_t fd) {
+  if (fio_poll_register(fd) == -1)
+    return;
+  fio_unlock(&fd_data(fd).poll_wait[0]);
+  /* the edge might have been recorded (or data left unread) meanwhile */
+  if (fd_data(fd).poll_readable && !fio_trylock(&fd_data(fd).poll_wait[0]))
+    fio_poll_dispatch(fd, 0, NULL);
+}
+
+static inline void fio_poll_add_write(intptr_t fd) {
+  if (fio_poll_register(fd) == -1)
+    return;
+  fio_unlock(&fd_data(fd).poll_wait[1]);
+  /* no edge is expected unless the kernel's buffer was filled */
+  if (!fd_data(fd).poll_blocked && !fio_trylock(&fd_data(fd).poll_wait[1]))
+    fio_poll_dispatch(fd, 1, NULL);
+}
+
+static inline void fio_poll_add(intptr_t fd) {
+  /* edges reported during the registration are recorded, not dispatched */
+  fio_trylock(&fd_data(fd).poll_wait[0]);
+  fio_trylock(&fd_data(fd).poll_wait[1]);
+  switch (fio_poll_register(fd)) {
+  case -1:
+    return;
+  case 0:
+    /* already registered, so the fd's state isn't reported again */
+    fd_data(fd).poll_readable = 1;
+    fd_data(fd).poll_blocked = 0;
+    break;
+  }
+  fio_poll_add_read(fd);
+  fio_poll_add_write(fd);
+}
+
+FIO_FUNC inline void fio_poll_remove_fd(intptr_t fd) {
+  struct epoll_event chevent = {.events = (EPOLLOUT | EPOLLIN), .data.fd = fd};
+  fio_trylock(&fd_data(fd).poll_wait[0]);
+  fio_trylock(&fd_data(fd).poll_wait[1]);
+  if (fio_atomic_xchange(&fd_data(fd).poll_registered, 0))
+    epoll_ctl(evio_fd, EPOLL_CTL_DEL, fd, &chevent);
+}
+
+/* marks a connection as (possibly) having data in the kernel's buffer */
+static inline void fio_poll_readable(intptr_t fd) {
+  fd_data(fd).poll_readable = 1;
+}
+
+static size_t fio_poll(void) {
+  const size_t limit = fio_poll_batch;
+  int timeout_millisec = fio_timer_calc_first_interval();
+  struct epoll_event events[FIO_POLL_MAX_BATCH > FIO_POLL_MAX_EVENTS
+                                ? FIO_POLL_MAX_BATCH
+                                : FIO_POLL_MAX_EVENTS];
+  fio_poll_batch_s *batch[2] = {NULL, NULL};
+  /* wait for events and handle them */
+  int active_count = epoll_wait(evio_fd, events,
+                                (limit ? (int)limit : FIO_POLL_MAX_EVENTS),
+                                timeout_millisec);
+  if (active_count <= 0)
+    return 0;
+  if (limit) {
+    for (size_t j = 0; j < 2; ++j) {
+      batch[j] = fio_malloc(sizeof(*batch[j]) + (sizeof(batch[j]->uuids[0]) *
+                                                 (size_t)active_count));
+      FIO_ASSERT_ALLOC(batch[j]);
+      batch[j]->count = 0;
+    }
+  }
+  for (int i = 0; i < active_count; i++) {
+    const intptr_t fd = events[i].data.fd;
+    if (events[i].events & (~(EPOLLIN | EPOLLOUT))) {
+      // errors are hendled as disconnections (on_close)
+      fio_force_close_in_poll(fd2uuid(fd));
+      continue;
+    }
+    if (events[i].events & EPOLLOUT)
+      fio_poll_edge_write(fd, batch[1]);
+    if (events[i].events & EPOLLIN)
+      fio_poll_edge_read(fd, batch[0]);
+  }
+  if (limit) {
+    if (batch[1]->count)
+      fio_defer_push_urgent(deferred_on_ready_batch, batch[1], NULL);
+    else
+      fio_free(batch[1]);
+    if (batch[0]->count)
+      fio_defer_push_task(deferred_on_data_batch, batch[0], NULL);
+    else
+      fio_free(batch[0]);
+  }
+  return active_count;
+}
+
+#else
+/* the other engines poll the kernel's state when an event is re-armed */
+#define fio_poll_readable(fd) ((void)(fd))
+#endif
+/* *****************************************************************************
+Section Start Marker
+
+
+
+
+
+
+
+
+
+
+
+
+
+                       Polling State Machine - io_uring
+
+
+
+
+
+
+
+
+
+
+
+
+
+
+***************************************************************************** */
+#if FIO_ENGINE_URING
+
+/**
+ * Returns a C string detailing the IO engine selected during compilation.
+ *
+ * Valid values are "kqueue", "epoll", "io_uring" and "poll".
+ */
+char const *fio_engine(void) { return "io_uring"; }
+
+/*
+ * The io_uring engine uses one-shot IORING_OP_POLL_ADD requests, mirroring the
+ * EPOLLONESHOT semantics of the epoll engine (protocols re-arm after each
+ * event).
+ *
+ * Requests are queued in the submission ring and submitted in a single
+ * `io_uring_enter` call by the reactor, together with the wait for events.
+ * When the reactor is already waiting, the requests are submitted immediately.
+ *
+ * liburing isn't required, the raw system calls are used.
+ */
+
+/* user_data tag for requests that don't report events (poll removal) */
+#define FIO_URING_TAG_IGNORE ((uint64_t)1 << 63)
+/*
+ * user_data for poll requests: the connection's generation (uuid counter), the
+ * fd and the direction. A request might complete after the fd was closed and
+ * reused, so the generation routes (or drops) the event.
+ */
+#define FIO_URING_DATA(fd, gen, is_write)                                      \
+  ((((uint64_t)(gen)&0xFF) << 40) | ((uint64_t)(fd) << 1) | (is_write))
+
+static struct {
+  int fd;
+  uint8_t volatile waiting;
+  fio_lock_i lock;
+  /* submission ring */
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_entries;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  /* completion ring */
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  /* mapped memory */
+  void *sq_ring;
+  size_t sq_ring_len;
+  void *cq_ring;
+  size_t cq_ring_len;
+  size_t sqes_len;
+} evio_uring = {.fd = -1, .lock = FIO_LOCK_INIT};
+
+static inline int fio_uring_enter(unsigned to_submit, unsigned min_complete,
+                                  unsigned flags, void *arg, size_t arg_len) {
+  return (int)syscall(__NR_io_uring_enter, evio_uring.fd, to_submit,
+                      min_complete, flags, arg, arg_len);
+}
+
+/* submits any SQEs the kernel didn't consume yet (call within lock). */
+static inline void fio_uring_submit_unsafe(void) {
+  unsigned pending = *evio_uring.sq_tail -
+                     __atomic_load_n(evio_uring.sq_head, __ATOMIC_ACQUIRE);
+  if (!pending)
+    return;
+  while (fio_uring_enter(pending, 0, 0, NULL, 0) == -1 && errno == EINTR)
+    ;
+}
+
+/* queues a poll related request (call within lock). */
+static void fio_uring_push_unsafe(uint8_t opcode, int fd, uint32_t events,
+                                  uint64_t addr, uint64_t user_data) {
+  unsigned tail = *evio_uring.sq_tail;
+  if (tail - __atomic_load_n(evio_uring.sq_head, __ATOMIC_ACQUIRE) >=
+      *evio_uring.sq_entries) {
+    /* ring is full - flush it */
+    fio_uring_submit_unsafe();
+    if (tail - __atomic_load_n(evio_uring.sq_head, __ATOMIC_ACQUIRE) >=
+        *evio_uring.sq_entries) {
+      FIO_LOG_ERROR("io_uring submission queue overflow (fd %d)", fd);
+      return;
+    }
+  }
+  const unsigned index = tail & *evio_uring.sq_mask;
+  struct io_uring_sqe *sqe = evio_uring.sqes + index;
+  *sqe = (struct io_uring_sqe){
+      .opcode = opcode,
+      .fd = fd,
+      .addr = addr,
+      .user_data = user_data,
+  };
+#if __BIG_ENDIAN__
+  /* the kernel reads the 32 bit poll mask as two swapped 16 bit halves */
+  events = (events << 16) | (events >> 16);
+#endif
+  sqe->poll32_events = events;
+  evio_uring.sq_array[index] = index;
+  __atomic_store_n(evio_uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+  if (evio_uring.waiting)
+    fio_uring_submit_unsafe();
+}
+
+static void fio_poll_close(void) {
+  if (evio_uring.sqes)
+    munmap(evio_uring.sqes, evio_uring.sqes_len);
+  if (evio_uring.cq_ring)
+    munmap(evio_uring.cq_ring, evio_uring.cq_ring_len);
+  if (evio_uring.sq_ring)
+    munmap(evio_uring.sq_ring, evio_uring.sq_ring_len);
+  if (evio_uring.fd != -1)
+    close(evio_uring.fd);
+  evio_uring.sqes = NULL;
+  evio_uring.cq_ring = NULL;
+  evio_uring.sq_ring = NULL;
+  evio_uring.fd = -1;
+}
+
+static void fio_poll_init(void) {
+  fio_poll_close();
+  evio_uring.lock = FIO_LOCK_INIT;
+  evio_uring.waiting = 0;
+  struct io_uring_params params = {.flags = 0};
+  evio_uring.fd =
+      (int)syscall(__NR_io_uring_setup, FIO_URING_ENTRIES, &params);
+  if (evio_uring.fd == -1) {
+    FIO_LOG_FATAL("couldn't initialize io_uring.");
+    exit(errno);
+  }
+  if (!(params.features & IORING_FEAT_EXT_ARG)) {
+    FIO_LOG_FATAL("io_uring engine requires IORING_FEAT_EXT_ARG (Linux 5.11)");
+    fio_poll_close();
+    exit(ENOSYS);
+  }
+  evio_uring.sq_ring_len =
+      params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+  evio_uring.cq_ring_len =
+      params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+  evio_uring.sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  evio_uring.sq_ring =
+      mmap(NULL, evio_uring.sq_ring_len, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, evio_uring.fd, IORING_OFF_SQ_RING);
+  evio_uring.cq_ring =
+      mmap(NULL, evio_uring.cq_ring_len, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, evio_uring.fd, IORING_OFF_CQ_RING);
+  evio_uring.sqes =
+      mmap(NULL, evio_uring.sqes_len, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, evio_uring.fd, IORING_OFF_SQES);
+  if (evio_uring.sq_ring == MAP_FAILED || evio_uring.cq_ring == MAP_FAILED ||
+      evio_uring.sqes == MAP_FAILED) {
+    if (evio_uring.sq_ring == MAP_FAILED)
+      evio_uring.sq_ring = NULL;
+    if (evio_uring.cq_ring == MAP_FAILED)
+      evio_uring.cq_ring = NULL;
+    if (evio_uring.sqes == MAP_FAILED)
+      evio_uring.sqes = NULL;
+    FIO_LOG_FATAL("couldn't map io_uring memory.");
+    fio_poll_close();
+    exit(errno);
+  }
+#define FIO_URING_RING_PTR(ring, offset)                                       \
+  ((unsigned *)((uintptr_t)evio_uring.ring + (offset)))
+  evio_uring.sq_head = FIO_URING_RING_PTR(sq_ring, params.sq_off.head);
+  evio_uring.sq_tail = FIO_URING_RING_PTR(sq_ring, params.sq_off.tail);
+  evio_uring.sq_mask = FIO_URING_RING_PTR(sq_ring, params.sq_off.ring_mask);
+  evio_uring.sq_entries =
+      FIO_URING_RING_PTR(sq_ring, params.sq_off.ring_entries);
+  evio_uring.sq_array = FIO_URING_RING_PTR(sq_ring, params.sq_off.array);
+  evio_uring.cq_head = FIO_URING_RING_PTR(cq_ring, params.cq_off.head);
+  evio_uring.cq_tail = FIO_URING_RING_PTR(cq_ring, params.cq_off.tail);
+  evio_uring.cq_mask = FIO_URING_RING_PTR(cq_ring, params.cq_off.ring_mask);
+  evio_uring.cqes = (struct io_uring_cqe *)FIO_URING_RING_PTR(
+      cq_ring, params.cq_off.cqes);
+#undef FIO_URING_RING_PTR
+  /* a new ring has no armed requests (i.e., after `fork`) */
+  if (fio_data && fio_data->uring)
+    memset(fio_data->uring, 0, fio_data->ready * sizeof(*fio_data->uring));
+}
+
+/* cancels any armed requests, must be called with the lock */
+static inline void fio_uring_cancel_unsafe(intptr_t fd) {
+  const uint16_t state = fio_data->uring[fd];
+  if ((state & 1))
+    fio_uring_push_unsafe(IORING_OP_POLL_REMOVE, -1, 0,
+                          FIO_URING_DATA(fd, state >> 8, 0),
+                          FIO_URING_TAG_IGNORE);
+  if ((state & 2))
+    fio_uring_push_unsafe(IORING_OP_POLL_REMOVE, -1, 0,
+                          FIO_URING_DATA(fd, state >> 8, 1),
+                          FIO_URING_TAG_IGNORE);
+  fio_data->uring[fd] = 0;
+}
+
+/* arms a request for the fd's current connection, must be called with lock */
+static inline void fio_uring_arm_unsafe(intptr_t fd, uint8_t is_write) {
+  const uint8_t gen = fd_data(fd).counter;
+  if ((fio_data->uring[fd] & 3) && (fio_data->uring[fd] >> 8) != gen)
+    fio_uring_cancel_unsafe(fd); /* left over from a previous connection */
+  if ((fio_data->uring[fd] & (1 << is_write)))
+    return;
+  fio_data->uring[fd] =
+      (uint16_t)(((uint16_t)gen << 8) | (fio_data->uring[fd] & 3) |
+                 (1 << is_write));
+  fio_uring_push_unsafe(IORING_OP_POLL_ADD, fd,
+                        (is_write ? POLLOUT : POLLIN) | POLLRDHUP, 0,
+                        FIO_URING_DATA(fd, gen, is_write));
+}
+
+static inline void fio_poll_add_read(intptr_t fd) {
+  fio_lock(&evio_uring.lock);
+  fio_uring_arm_unsafe(fd, 0);
+  fio_unlock(&evio_uring.lock);
+}
+
+static inline void fio_poll_add_write(intptr_t fd) {
+  fio_lock(&evio_uring.lock);
+  fio_uring_arm_unsafe(fd, 1);
+  fio_unlock(&evio_uring.lock);
+}
+
+static inline void fio_poll_add(intptr_t fd) {
+  fio_poll_add_read(fd);
+  fio_poll_add_write(fd);
+}
+
+/* must be called BEFORE the fd is closed (io_uring holds a file reference). */
+FIO_FUNC inline void fio_poll_remove_fd(intptr_t fd) {
+  fio_lock(&evio_uring.lock);
+  fio_uring_cancel_unsafe(fd);
+  fio_unlock(&evio_uring.lock);
 }
 
 static size_t fio_poll(void) {
+  if (evio_uring.fd == -1)
+    return -1;
   int timeout_millisec = fio_timer_calc_first_interval();
-  struct epoll_event internal[2];
-  struct epoll_event events[FIO_POLL_MAX_EVENTS];
-  int total = 0;
-  /* wait for events and handle them */
-  int internal_count = epoll_wait(evio_fd[0], internal, 2, timeout_millisec);
-  if (internal_count == 0)
-    return internal_count;
-  for (int j = 0; j < internal_count; ++j) {
-    int active_count =
-        epoll_wait(internal[j].data.fd, events, FIO_POLL_MAX_EVENTS, 0);
-    if (active_count > 0) {
-      for (int i = 0; i < active_count; i++) {
-        if (events[i].events & (~(EPOLLIN | EPOLLOUT))) {
-          // errors are hendled as disconnections (on_close)
-          fio_force_close_in_poll(fd2uuid(events[i].data.fd));
-        } else {
-          // no error, then it's an active event(s)
-          if (events[i].events & EPOLLOUT) {
-            fio_defer_push_urgent(deferred_on_ready,
-                                  (void *)fd2uuid(events[i].data.fd), NULL);
-          }
-          if (events[i].events & EPOLLIN)
-            fio_defer_push_task(deferred_on_data,
-                                (void *)fd2uuid(events[i].data.fd), NULL);
-        }
-      } // end for loop
-      total += active_count;
+  struct __kernel_timespec timeout = {
+      .tv_sec = (timeout_millisec / 1000),
+      .tv_nsec = ((timeout_millisec % 1000) * 1000000),
+  };
+  struct io_uring_getevents_arg arg = {
+      .ts = (uint64_t)(uintptr_t)&timeout,
+  };
+  /* submit all queued requests and wait for events in a single call */
+  fio_lock(&evio_uring.lock);
+  unsigned pending = *evio_uring.sq_tail -
+                     __atomic_load_n(evio_uring.sq_head, __ATOMIC_ACQUIRE);
+  evio_uring.waiting = 1;
+  fio_unlock(&evio_uring.lock);
+  if (fio_uring_enter(pending, 1,
+                      (IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG), &arg,
+                      sizeof(arg)) == -1 &&
+      errno != ETIME && errno != EINTR && errno != EBUSY) {
+    evio_uring.waiting = 0;
+    return -1;
+  }
+  evio_uring.waiting = 0;
+
+  /* handle the events */
+  size_t total = 0;
+  unsigned head = *evio_uring.cq_head;
+  const unsigned tail = __atomic_load_n(evio_uring.cq_tail, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    struct io_uring_cqe *cqe = evio_uring.cqes + (head & *evio_uring.cq_mask);
+    const uint64_t user_data = cqe->user_data;
+    const int res = cqe->res;
+    ++head;
+    if ((user_data & FIO_URING_TAG_IGNORE) || res == -ECANCELED)
+      continue;
+    const intptr_t fd = (intptr_t)((user_data >> 1) & 0x7FFFFFFFFF);
+    const uint8_t gen = (uint8_t)(user_data >> 40);
+    const uint8_t is_write = (uint8_t)(user_data & 1);
+    fio_lock(&evio_uring.lock);
+    if ((fio_data->uring[fd] >> 8) != gen ||
+        !(fio_data->uring[fd] & (1 << is_write))) {
+      /* a stale request (canceled, or armed for a previous connection) */
+      fio_unlock(&evio_uring.lock);
+      continue;
+    }
+    fio_data->uring[fd] &= ~(1 << is_write);
+    fio_unlock(&evio_uring.lock);
+    ++total;
+    /* the uuid the request was armed for (tasks test the uuid's validity) */
+    const intptr_t uuid = (intptr_t)(((uintptr_t)fd << 8) | gen);
+    if (res < 0 || (res & (~(POLLIN | POLLOUT)))) {
+      // errors are hendled as disconnections (on_close)
+      if (uuid_is_valid(uuid))
+        fio_force_close_in_poll(uuid);
+    } else if (is_write) {
+      fio_defer_push_urgent(deferred_on_ready, (void *)uuid, NULL);
+    } else {
+      fio_defer_push_task(deferred_on_data, (void *)uuid, NULL);
     }
   }
+  __atomic_store_n(evio_uring.cq_head, head, __ATOMIC_RELEASE);
   return total;
 }
 
+#undef FIO_URING_TAG_IGNORE
+#undef FIO_URING_DATA
+
 #endif
 /* *****************************************************************************
 Section Start Marker
@@ -1744,16 +3607,34 @@ Section Start Marker
 /**
  * Returns a C string detailing the IO engine selected during compilation.
  *
- * Valid values are "kqueue", "epoll" and "poll".
+ * Valid values are "kqueue", "epoll", "io_uring" and "poll".
  */
 char const *fio_engine(void) { return "kqueue"; }
 
 static int evio_fd = -1;
 
+/*
+ * Re-arming a one-shot filter is deferred to the next `kevent` wait, so a busy
+ * reactor submits all its changes along with the wait (a single system call).
+ *
+ * Changes made while the reactor is blocked in `kevent` are submitted
+ * immediately, otherwise they would be delayed until the wait returns.
+ */
+static struct {
+  fio_lock_i lock;
+  /* set while the reactor is blocked in `kevent` */
+  uint8_t waiting;
+  size_t count;
+  struct kevent changes[FIO_POLL_MAX_EVENTS * 2];
+} fio_kqueue_changes = {.lock = FIO_LOCK_INIT};
+
 static void fio_poll_close(void) { close(evio_fd); }
 
 static void fio_poll_init(void) {
   fio_poll_close();
+  fio_kqueue_changes.lock = FIO_LOCK_INIT;
+  fio_kqueue_changes.waiting = 0;
+  fio_kqueue_changes.count = 0;
   evio_fd = kqueue();
   if (evio_fd == -1) {
     FIO_LOG_FATAL("couldn't open kqueue.\n");
@@ -1761,26 +3642,38 @@ static void fio_poll_init(void) {
   }
 }
 
+/* submits changes to the kqueue (or schedules them for the next wait) */
+static inline void fio_poll_change(struct kevent *chevent, size_t count) {
+  fio_lock(&fio_kqueue_changes.lock);
+  if (!fio_kqueue_changes.waiting &&
+      fio_kqueue_changes.count + count <=
+          (sizeof(fio_kqueue_changes.changes) /
+           sizeof(fio_kqueue_changes.changes[0]))) {
+    memcpy(fio_kqueue_changes.changes + fio_kqueue_changes.count, chevent,
+           sizeof(*chevent) * count);
+    fio_kqueue_changes.count += count;
+    fio_unlock(&fio_kqueue_changes.lock);
+    return;
+  }
+  fio_unlock(&fio_kqueue_changes.lock);
+  do {
+    errno = 0;
+    kevent(evio_fd, chevent, count, NULL, 0, NULL);
+  } while (errno == EINTR);
+}
+
 static inline void fio_poll_add_read(intptr_t fd) {
   struct kevent chevent[1];
   EV_SET(chevent, fd, EVFILT_READ, EV_ADD | EV_ENABLE | EV_CLEAR | EV_ONESHOT,
          0, 0, ((void *)fd));
-  do {
-    errno = 0;
-    kevent(evio_fd, chevent, 1, NULL, 0, NULL);
-  } while (errno == EINTR);
-  return;
+  fio_poll_change(chevent, 1);
 }
 
 static inline void fio_poll_add_write(intptr_t fd) {
   struct kevent chevent[1];
   EV_SET(chevent, fd, EVFILT_WRITE, EV_ADD | EV_ENABLE | EV_CLEAR | EV_ONESHOT,
          0, 0, ((void *)fd));
-  do {
-    errno = 0;
-    kevent(evio_fd, chevent, 1, NULL, 0, NULL);
-  } while (errno == EINTR);
-  return;
+  fio_poll_change(chevent, 1);
 }
 
 static inline void fio_poll_add(intptr_t fd) {
@@ -1789,11 +3682,7 @@ static inline void fio_poll_add(intptr_t fd) {
          0, 0, ((void *)fd));
   EV_SET(chevent + 1, fd, EVFILT_WRITE,
          EV_ADD | EV_ENABLE | EV_CLEAR | EV_ONESHOT, 0, 0, ((void *)fd));
-  do {
-    errno = 0;
-    kevent(evio_fd, chevent, 2, NULL, 0, NULL);
-  } while (errno == EINTR);
-  return;
+  fio_poll_change(chevent, 2);
 }
 
 FIO_FUNC inline void fio_poll_remove_fd(intptr_t fd) {
@@ -1803,6 +3692,17 @@ FIO_FUNC inline void fio_poll_remove_fd(intptr_t fd) {
   EV_SET(chevent, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
   EV_SET(chevent + 1, fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
   EV_SET(chevent + 2, fd, EVFILT_TIMER, EV_DELETE, 0, 0, NULL);
+  /* drop any pending changes for the fd, so they aren't submitted later */
+  fio_lock(&fio_kqueue_changes.lock);
+  for (size_t i = 0; i < fio_kqueue_changes.count;) {
+    if (fio_kqueue_changes.changes[i].ident == (uintptr_t)fd) {
+      fio_kqueue_changes.changes[i] =
+          fio_kqueue_changes.changes[--fio_kqueue_changes.count];
+      continue;
+    }
+    ++i;
+  }
+  fio_unlock(&fio_kqueue_changes.lock);
   do {
     errno = 0;
     kevent(evio_fd, chevent, 3, NULL, 0, NULL);
@@ -1815,15 +3715,30 @@ static size_t fio_poll(void) {
   int timeout_millisec = fio_timer_calc_first_interval();
   struct kevent events[FIO_POLL_MAX_EVENTS];
 
+  struct kevent changes[sizeof(fio_kqueue_changes.changes) /
+                        sizeof(fio_kqueue_changes.changes[0])];
+  size_t change_count;
+
   const struct timespec timeout = {
       .tv_sec = (timeout_millisec / 1000),
       .tv_nsec = ((timeout_millisec & (~1023UL)) * 1000000)};
-  /* wait for events and handle them */
-  int active_count =
-      kevent(evio_fd, NULL, 0, events, FIO_POLL_MAX_EVENTS, &timeout);
+  /* collect the pending changes, later changes are submitted directly */
+  fio_lock(&fio_kqueue_changes.lock);
+  change_count = fio_kqueue_changes.count;
+  memcpy(changes, fio_kqueue_changes.changes, sizeof(*changes) * change_count);
+  fio_kqueue_changes.count = 0;
+  fio_kqueue_changes.waiting = 1;
+  fio_unlock(&fio_kqueue_changes.lock);
+  /* submit the changes, wait for events and handle them */
+  int active_count = kevent(evio_fd, changes, change_count, events,
+                            FIO_POLL_MAX_EVENTS, &timeout);
+  fio_kqueue_changes.waiting = 0;
 
   if (active_count > 0) {
     for (int i = 0; i < active_count; i++) {
+      /* a failed change (i.e., the fd was closed), not an IO event */
+      if ((events[i].flags & EV_ERROR) && events[i].data)
+        continue;
       // test for event(s) type
       if (events[i].filter == EVFILT_WRITE) {
         // we can only write if there's no error in the socket
@@ -1849,6 +3764,9 @@ static size_t fio_poll(void) {
   } else if (active_count < 0) {
     if (errno == EINTR)
       return 0;
+    /* a failed change might have prevented the following changes */
+    for (size_t i = 0; i < change_count; ++i)
+      kevent(evio_fd, changes + i, 1, NULL, 0, NULL);
     return -1;
   }
   return active_count;
@@ -1892,7 +3810,7 @@ Section Start Marker
 /**
  * Returns a C string detailing the IO engine selected during compilation.
  *
- * Valid values are "kqueue", "epoll" and "poll".
+ * Valid values are "kqueue", "epoll", "io_uring" and "poll".
  */
 char const *fio_engine(void) { return "poll"; }
 
@@ -1946,7 +3864,7 @@ static inline void fio_poll_remove_write(int fd) {
 /** returns non-zero if events were scheduled, 0 if idle */
 static size_t fio_poll(void) {
   /* shrink fd poll range */
-  size_t end = fio_data->capa;
+  size_t end = fio_data->ready;
   size_t start = 0;
   struct pollfd *list = NULL;
   fio_lock(&fio_data->lock);
@@ -2157,12 +4075,56 @@ static void deferred_on_ready(void *arg, void *arg2) {
   (void)arg2;
 }
 
+#if FIO_FAIR_ON_DATA
+/* postpones a forced `on_data` event until the next reactor cycle */
+static void fio_on_data_postpone(intptr_t uuid) {
+  fio_lock(&fio_on_data_postponed.lock);
+  if (fio_on_data_postponed.count == fio_on_data_postponed.capa) {
+    fio_on_data_postponed.capa =
+        (fio_on_data_postponed.capa ? (fio_on_data_postponed.capa << 1) : 64);
+    fio_on_data_postponed.uuids = fio_realloc(
+        fio_on_data_postponed.uuids,
+        fio_on_data_postponed.capa * sizeof(*fio_on_data_postponed.uuids));
+    FIO_ASSERT_ALLOC(fio_on_data_postponed.uuids);
+  }
+  fio_on_data_postponed.uuids[fio_on_data_postponed.count++] = uuid;
+  fio_unlock(&fio_on_data_postponed.lock);
+}
+#endif
+
+/* schedules the postponed events (after the newly polled events) */
+static void fio_on_data_resume(void) {
+  if (!fio_on_data_postponed.count)
+    return;
+  fio_lock(&fio_on_data_postponed.lock);
+  intptr_t *uuids = fio_on_data_postponed.uuids;
+  size_t count = fio_on_data_postponed.count;
+  fio_on_data_postponed.uuids = NULL;
+  fio_on_data_postponed.count = fio_on_data_postponed.capa = 0;
+  fio_unlock(&fio_on_data_postponed.lock);
+  for (size_t i = 0; i < count; ++i)
+    fio_defer_push_task(deferred_on_data, (void *)uuids[i], (void *)1);
+  fio_free(uuids);
+}
+
 static void deferred_on_data(void *uuid, void *arg2) {
   if (fio_is_closed((intptr_t)uuid)) {
     return;
   }
   if (!uuid_data(uuid).protocol)
     goto no_protocol;
+#if FIO_FAIR_ON_DATA
+  if (arg2 && uuid_data(uuid).turn == fio_data->turn && fio_data->active) {
+    /* the connection had its turn this cycle, let other connections run */
+    fio_on_data_postpone((intptr_t)uuid);
+    return;
+  }
+#endif
+  if (uuid_data(uuid).congested &&
+      uuid_data(uuid).watermark_policy == FIO_WATERMARK_SUSPEND) {
+    /* the event remains scheduled until the queue drains (see `low`) */
+    return;
+  }
   fio_protocol_s *pr = protocol_try_lock(fio_uuid2fd(uuid), FIO_PR_LOCK_TASK);
   if (!pr) {
     if (errno == EBADF) {
@@ -2171,7 +4133,14 @@ static void deferred_on_data(void *uuid, void *arg2) {
     goto postpone;
   }
   fio_unlock(&uuid_data(uuid).scheduled);
+  uuid_data(uuid).turn = fio_data->turn;
+#if FIO_EPOLL_EDGE
+  /* `fio_read` (or a new edge) reports any data left in the kernel's buffer */
+  uuid_data(uuid).poll_readable = 0;
+#endif
+  FIO_TRACE_BEGIN(trace);
   pr->on_data((intptr_t)uuid, pr);
+  FIO_TRACE_END(trace, FIO_TRACE_ON_DATA, pr->on_data, fio_uuid2fd(uuid));
   protocol_unlock(pr, FIO_PR_LOCK_TASK);
   if (!fio_trylock(&uuid_data(uuid).scheduled)) {
     fio_poll_add_read(fio_uuid2fd((intptr_t)uuid));
@@ -2313,14 +4282,8 @@ static void fio_tcp_addr_cpy(int fd, int family, struct sockaddr *addrinfo) {
   }
 }
 
-/**
- * `fio_accept` accepts a new socket connection from a server socket - see the
- * server flag on `fio_socket`.
- *
- * NOTE: this function does NOT attach the socket to the IO reactor -see
- * `fio_attach`.
- */
-intptr_t fio_accept(intptr_t srv_uuid) {
+/* accepts a connection without setting any socket options */
+static intptr_t fio_accept___(intptr_t srv_uuid) {
   struct sockaddr_in6 addrinfo[2]; /* grab a slice of stack (aligned) */
   socklen_t addrlen = sizeof(addrinfo);
   int client;
@@ -2338,24 +4301,6 @@ intptr_t fio_accept(intptr_t srv_uuid) {
     return -1;
   }
 #endif
-  // avoid the TCP delay algorithm.
-  {
-    int optval = 1;
-    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(optval));
-  }
-  // handle socket buffers.
-  {
-    int optval = 0;
-    socklen_t size = (socklen_t)sizeof(optval);
-    if (!getsockopt(client, SOL_SOCKET, SO_SNDBUF, &optval, &size) &&
-        optval <= 131072) {
-      optval = 131072;
-      setsockopt(client, SOL_SOCKET, SO_SNDBUF, &optval, sizeof(optval));
-      optval = 131072;
-      setsockopt(client, SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval));
-    }
-  }
-
   fio_lock(&fd_data(client).protocol_lock);
   fio_clear_fd(client, 1);
   fio_unlock(&fd_data(client).protocol_lock);
@@ -2370,10 +4315,28 @@ intptr_t fio_accept(intptr_t srv_uuid) {
     fio_tcp_addr_cpy(client, ((struct sockaddr *)addrinfo)->sa_family,
                      (struct sockaddr *)addrinfo);
   }
-
+  fio_metric_add(FIO_METRIC_ACCEPTED, 1);
   return fd2uuid(client);
 }
 
+/**
+ * `fio_accept` accepts a new socket connection from a server socket - see the
+ * server flag on `fio_socket`.
+ *
+ * NOTE: this function does NOT attach the socket to the IO reactor -see
+ * `fio_attach`.
+ */
+intptr_t fio_accept(intptr_t srv_uuid) {
+  intptr_t client = fio_accept___(srv_uuid);
+  if (client != -1) {
+    // avoid the TCP delay algorithm.
+    int optval = 1;
+    setsockopt(fio_uuid2fd(client), IPPROTO_TCP, TCP_NODELAY, &optval,
+               sizeof(optval));
+  }
+  return client;
+}
+
 /* Creates a Unix socket - returning it's uuid (or -1) */
 static intptr_t fio_unix_socket(const char *address, uint8_t server) {
   /* Unix socket */
@@ -2432,7 +4395,7 @@ static intptr_t fio_unix_socket(const char *address, uint8_t server) {
 
 /* Creates a TCP/IP socket - returning it's uuid (or -1) */
 static intptr_t fio_tcp_socket(const char *address, const char *port,
-                               uint8_t server) {
+                               uint8_t server, uint8_t reuse_port) {
   /* TCP/IP socket */
   // setup the address
   struct addrinfo hints = {0};
@@ -2464,6 +4427,15 @@ static intptr_t fio_tcp_socket(const char *address, const char *port,
       int optval = 1;
       setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
     }
+#ifdef SO_REUSEPORT
+    if (reuse_port) {
+      // allow a number of sockets (processes) to share the same port
+      int optval = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
+    }
+#else
+    (void)reuse_port;
+#endif
     // bind the address to the socket
     int bound = 0;
     for (struct addrinfo *i = addrinfo; i != NULL; i = i->ai_next) {
@@ -2505,7 +4477,7 @@ socket_okay:
   fio_lock(&fd_data(fd).protocol_lock);
   fio_clear_fd(fd, 1);
   fio_unlock(&fd_data(fd).protocol_lock);
-  fio_tcp_addr_cpy(fd, addrinfo->ai_family, (void *)addrinfo);
+  fio_tcp_addr_cpy(fd, addrinfo->ai_family, addrinfo->ai_addr);
   freeaddrinfo(addrinfo);
   return fd2uuid(fd);
 }
@@ -2543,12 +4515,282 @@ intptr_t fio_socket(const char *address, const char *port, uint8_t server) {
   } else {
     do {
       errno = 0;
-      uuid = fio_tcp_socket(address, port, server);
+      uuid = fio_tcp_socket(address, port, server, 0);
     } while (errno == EINTR);
   }
   return uuid;
 }
 
+/* *****************************************************************************
+UDP (Datagram) Sockets
+***************************************************************************** */
+
+#if FIO_UDP_MMSG
+#include <netinet/udp.h>
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+/* the maximum number of segments in a single GSO buffer (kernel limit) */
+#define FIO_UDP_GSO_SEGMENTS 64
+/* the maximum length of a single GSO buffer */
+#define FIO_UDP_GSO_MAX 65000
+/* cleared if the kernel doesn't support UDP GSO */
+static volatile uint8_t fio_udp_gso = 1;
+#endif
+
+/* PUBLIC API: opens a UDP server or client socket */
+intptr_t fio_udp_socket(const char *address, const char *port, uint8_t server) {
+  if (!port || (!address && !server)) {
+    FIO_LOG_ERROR("(fio_udp_socket) address or port are missing.");
+    errno = EINVAL;
+    return -1;
+  }
+  struct addrinfo hints = {0};
+  struct addrinfo *addrinfo;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_PASSIVE;
+  if (getaddrinfo(address, port, &hints, &addrinfo)) {
+    return -1;
+  }
+  int fd = -1;
+  for (struct addrinfo *i = addrinfo; i; i = i->ai_next) {
+    fd = socket(i->ai_family, i->ai_socktype, i->ai_protocol);
+    if (fd == -1)
+      continue;
+    if (fio_set_non_block(fd) < 0)
+      goto failed;
+    if (server) {
+      int optval = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+      if (bind(fd, i->ai_addr, i->ai_addrlen))
+        goto failed;
+    } else if (connect(fd, i->ai_addr, i->ai_addrlen)) {
+      goto failed;
+    }
+    fio_lock(&fd_data(fd).protocol_lock);
+    fio_clear_fd(fd, 1);
+    fio_unlock(&fd_data(fd).protocol_lock);
+    fio_tcp_addr_cpy(fd, i->ai_family, i->ai_addr);
+    freeaddrinfo(addrinfo);
+    return fd2uuid(fd);
+  failed:
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(addrinfo);
+  return -1;
+}
+
+/* reads a batch of datagrams, returns the number of datagrams read (or -1) */
+static ssize_t fio_udp_recv_batch(int fd, fio_datagram_s *d,
+                                  uint8_t (*buf)[FIO_UDP_DATAGRAM_SIZE]) {
+#if FIO_UDP_MMSG
+  struct mmsghdr h[FIO_UDP_BATCH];
+  struct iovec io[FIO_UDP_BATCH];
+  for (size_t i = 0; i < FIO_UDP_BATCH; ++i) {
+    io[i] = (struct iovec){.iov_base = buf[i], .iov_len = FIO_UDP_DATAGRAM_SIZE};
+    h[i] = (struct mmsghdr){
+        .msg_hdr =
+            {
+                .msg_name = d[i].addr,
+                .msg_namelen = sizeof(d[i].addr),
+                .msg_iov = io + i,
+                .msg_iovlen = 1,
+            },
+    };
+  }
+  int count = recvmmsg(fd, h, FIO_UDP_BATCH, MSG_DONTWAIT, NULL);
+  for (int i = 0; i < count; ++i) {
+    d[i].data = (fio_str_info_s){.data = (char *)buf[i], .len = h[i].msg_len};
+    d[i].addr_len = h[i].msg_hdr.msg_namelen;
+  }
+  return count;
+#else
+  ssize_t count = 0;
+  while (count < FIO_UDP_BATCH) {
+    socklen_t addr_len = sizeof(d[count].addr);
+    ssize_t len = recvfrom(fd, buf[count], FIO_UDP_DATAGRAM_SIZE, 0,
+                           (struct sockaddr *)d[count].addr, &addr_len);
+    if (len < 0)
+      return (count ? count : -1);
+    d[count].data = (fio_str_info_s){.data = (char *)buf[count], .len = len};
+    d[count].addr_len = addr_len;
+    ++count;
+  }
+  return count;
+#endif
+}
+
+/* PUBLIC API: reads the waiting datagrams */
+ssize_t fio_udp_read(intptr_t uuid,
+                     void (*on_datagram)(intptr_t uuid, fio_datagram_s *dgram,
+                                         void *udata),
+                     void *udata) {
+  static __thread uint8_t buf[FIO_UDP_BATCH][FIO_UDP_DATAGRAM_SIZE];
+  fio_datagram_s d[FIO_UDP_BATCH];
+  if (!uuid_is_valid(uuid) || !uuid_data(uuid).open) {
+    errno = EBADF;
+    return -1;
+  }
+  const int old_errno = errno;
+  size_t total = 0;
+  size_t bytes = 0;
+  for (;;) {
+    const ssize_t count = fio_udp_recv_batch(fio_uuid2fd(uuid), d, buf);
+    if (count < 0) {
+      if (errno == EINTR || errno == ECONNREFUSED)
+        continue; /* ECONNREFUSED reports (and clears) an earlier ICMP error */
+      if (errno == EWOULDBLOCK || errno == EAGAIN)
+        break;
+      fio_force_close(uuid);
+      return -1;
+    }
+    if (!count)
+      break;
+    for (ssize_t i = 0; i < count; ++i) {
+      bytes += d[i].data.len;
+      on_datagram(uuid, d + i, udata);
+    }
+    total += count;
+    if (total >= (FIO_UDP_BATCH << 3)) {
+      /* let other connections run, the rest is read by a new event */
+      fio_force_event(uuid, FIO_EVENT_ON_DATA);
+      break;
+    }
+  }
+  errno = old_errno;
+  if (total) {
+    fio_metric_add(FIO_METRIC_BYTES_READ, bytes);
+    fio_touch(uuid);
+  }
+  return (ssize_t)total;
+}
+
+#if FIO_UDP_MMSG
+/* counts the datagrams that can share a single GSO buffer */
+static size_t fio_udp_gso_count(fio_datagram_s *d, size_t count) {
+  if (!fio_udp_gso || count < 2 || !d[0].data.len)
+    return 1;
+  const size_t seg = d[0].data.len;
+  size_t total = seg;
+  size_t i = 1;
+  while (i < count && i < FIO_UDP_GSO_SEGMENTS &&
+         d[i].data.len && d[i].data.len <= seg &&
+         total + d[i].data.len <= FIO_UDP_GSO_MAX &&
+         d[i].addr_len == d[0].addr_len &&
+         !memcmp(d[i].addr, d[0].addr, d[0].addr_len)) {
+    total += d[i].data.len;
+    if (d[i++].data.len < seg)
+      break; /* only the last segment can be shorter */
+  }
+  return i;
+}
+#endif
+
+/* PUBLIC API: sends a number of datagrams */
+ssize_t fio_udp_send(intptr_t uuid, fio_datagram_s *dgrams, size_t count) {
+  if (!uuid_is_valid(uuid) || !uuid_data(uuid).open) {
+    errno = EBADF;
+    return -1;
+  }
+  const int fd = fio_uuid2fd(uuid);
+  size_t sent = 0;
+  size_t bytes = 0;
+  uint8_t retry = 1;
+#if FIO_UDP_MMSG
+  struct mmsghdr h[FIO_UDP_BATCH];
+  struct iovec io[FIO_UDP_GSO_SEGMENTS];
+  /* control buffers, aligned for `struct cmsghdr` (uint64_t backed) */
+  uint64_t ctrl[FIO_UDP_BATCH][(CMSG_SPACE(sizeof(uint16_t)) + 7) >> 3];
+  size_t groups[FIO_UDP_BATCH];
+  while (sent < count) {
+    /* each message is a datagram, or a GSO buffer made of a few datagrams */
+    size_t msgs = 0;
+    size_t iovs = 0;
+    size_t pos = sent;
+    while (msgs < FIO_UDP_BATCH && pos < count) {
+      const size_t n = fio_udp_gso_count(dgrams + pos, count - pos);
+      if (iovs + n > FIO_UDP_GSO_SEGMENTS)
+        break;
+      h[msgs] = (struct mmsghdr){
+          .msg_hdr =
+              {
+                  .msg_name = (dgrams[pos].addr_len ? dgrams[pos].addr : NULL),
+                  .msg_namelen = dgrams[pos].addr_len,
+                  .msg_iov = io + iovs,
+                  .msg_iovlen = n,
+              },
+      };
+      for (size_t i = 0; i < n; ++i) {
+        io[iovs + i] = (struct iovec){.iov_base = dgrams[pos + i].data.data,
+                                      .iov_len = dgrams[pos + i].data.len};
+      }
+      if (n > 1) {
+        h[msgs].msg_hdr.msg_control = ctrl[msgs];
+        h[msgs].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+        struct cmsghdr *c = CMSG_FIRSTHDR(&h[msgs].msg_hdr);
+        c->cmsg_level = SOL_UDP;
+        c->cmsg_type = UDP_SEGMENT;
+        c->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t seg = (uint16_t)dgrams[pos].data.len;
+        memcpy(CMSG_DATA(c), &seg, sizeof(seg));
+      }
+      groups[msgs++] = n;
+      iovs += n;
+      pos += n;
+    }
+    const int r = sendmmsg(fd, h, msgs, MSG_DONTWAIT);
+    if (r <= 0) {
+      if (errno == EINTR)
+        continue;
+      if (iovs > msgs && fio_udp_gso &&
+          (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT)) {
+        /* UDP GSO isn't supported, send the datagrams one by one */
+        fio_udp_gso = 0;
+        continue;
+      }
+      if (errno == ECONNREFUSED && retry) {
+        retry = 0;
+        continue;
+      }
+      break;
+    }
+    for (int i = 0; i < r; ++i) {
+      sent += groups[i];
+      bytes += h[i].msg_len;
+    }
+  }
+#else
+  while (sent < count) {
+    const ssize_t r =
+        sendto(fd, dgrams[sent].data.data, dgrams[sent].data.len, 0,
+               (dgrams[sent].addr_len ? (struct sockaddr *)dgrams[sent].addr
+                                      : NULL),
+               dgrams[sent].addr_len);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == ECONNREFUSED && retry) {
+        retry = 0;
+        continue;
+      }
+      break;
+    }
+    bytes += r;
+    ++sent;
+  }
+#endif
+  if (bytes) {
+    fio_metric_add(FIO_METRIC_BYTES_WRITTEN, bytes);
+    fio_touch(uuid);
+  }
+  if (!sent && count && errno != EWOULDBLOCK && errno != EAGAIN &&
+      errno != ENOBUFS)
+    return -1;
+  return (ssize_t)sent;
+}
+
 /* *****************************************************************************
 Internal socket flushing related functions
 ***************************************************************************** */
@@ -2557,6 +4799,15 @@ Internal socket flushing related functions
 #define BUFFER_FILE_READ_SIZE 49152
 #endif
 
+#ifndef FIO_MMAP_FILE_WINDOW
+/**
+ * When `sendfile` can't be used (i.e., TLS connections), files larger than
+ * `BUFFER_FILE_READ_SIZE` are mapped to memory in windows of this size (a power
+ * of 2) and written directly from the page cache. Set to 0 to use `pread`.
+ */
+#define FIO_MMAP_FILE_WINDOW (4UL * 1024 * 1024)
+#endif
+
 #ifndef USE_SENDFILE
 
 #if defined(__linux__) /* linux sendfile works  */
@@ -2576,6 +4827,19 @@ Internal socket flushing related functions
 
 static void fio_sock_perform_close_fd(intptr_t fd) { close(fd); }
 
+/* called (with the `sock_lock`) once a congested queue drains below `low` */
+static void fio_sock_congestion_clear_unsafe(uintptr_t fd) {
+  fd_data(fd).congested = 0;
+  if (fd_data(fd).watermark_policy == FIO_WATERMARK_SUSPEND) {
+    /* resume reading, `deferred_on_data` left the event scheduled */
+    fio_trylock(&fd_data(fd).scheduled);
+    fio_defer_push_task(deferred_on_data, (void *)fd2uuid(fd), (void *)1);
+  }
+  /* an empty queue is reported by `deferred_on_ready` in any case */
+  if (fd_data(fd).packet && fd_data(fd).protocol)
+    fio_defer_push_task(deferred_on_ready_usr, (void *)fd2uuid(fd), NULL);
+}
+
 static inline void fio_sock_packet_rotate_unsafe(uintptr_t fd) {
   fio_packet_s *packet = fd_data(fd).packet;
   fd_data(fd).packet = packet->next;
@@ -2586,6 +4850,10 @@ static inline void fio_sock_packet_rotate_unsafe(uintptr_t fd) {
     fd_data(fd).packet_last = &fd_data(fd).packet;
     fio_atomic_sub(&fd_data(fd).packet_count, 1);
   }
+  fd_data(fd).packet_bytes -= packet->queued;
+  if (fd_data(fd).congested &&
+      fd_data(fd).packet_bytes <= fd_data(fd).watermark_low)
+    fio_sock_congestion_clear_unsafe(fd);
   fio_packet_free(packet);
 }
 
@@ -2594,6 +4862,7 @@ static int fio_sock_write_buffer(int fd, fio_packet_s *packet) {
       fd2uuid(fd), fd_data(fd).rw_udata,
       ((uint8_t *)packet->data.buffer + packet->offset), packet->length);
   if (written > 0) {
+    fio_metric_add(FIO_METRIC_BYTES_WRITTEN, written);
     packet->length -= written;
     packet->offset += written;
     if (!packet->length) {
@@ -2603,6 +4872,46 @@ static int fio_sock_write_buffer(int fd, fio_packet_s *packet) {
   return written;
 }
 
+/* the maximum number of buffer packets gathered by a single `writev` call */
+#ifndef FIO_WRITEV_MAX
+#if defined(IOV_MAX) && IOV_MAX < 1024
+#define FIO_WRITEV_MAX IOV_MAX
+#else
+#define FIO_WRITEV_MAX 1024
+#endif
+#endif
+
+/* sends a number of successive buffer packets, starting with `packet` */
+static int fio_sock_writev_buffers(int fd, fio_packet_s *packet) {
+  struct iovec iov[FIO_WRITEV_MAX];
+  int count = 0;
+  do {
+    iov[count++] = (struct iovec){
+        .iov_base = ((uint8_t *)packet->data.buffer + packet->offset),
+        .iov_len = packet->length,
+    };
+    packet = packet->next;
+  } while (packet && packet->write_func == fio_sock_write_buffer &&
+           count < FIO_WRITEV_MAX);
+  ssize_t written = fd_data(fd).rw_hooks->writev(
+      fd2uuid(fd), fd_data(fd).rw_udata, iov, count);
+  if (written <= 0)
+    return (int)written;
+  fio_metric_add(FIO_METRIC_BYTES_WRITTEN, written);
+  const ssize_t total = written;
+  while (count--) {
+    packet = fd_data(fd).packet;
+    if ((uintptr_t)written < packet->length) {
+      packet->length -= written;
+      packet->offset += written;
+      break;
+    }
+    written -= packet->length;
+    fio_sock_packet_rotate_unsafe(fd);
+  }
+  return (total > INT_MAX ? INT_MAX : (int)total);
+}
+
 static int fio_sock_write_from_fd(int fd, fio_packet_s *packet) {
   ssize_t asked = 0;
   ssize_t sent = 0;
@@ -2621,6 +4930,8 @@ static int fio_sock_write_from_fd(int fd, fio_packet_s *packet) {
       goto read_error;
     sent = fd_data(fd).rw_hooks->write(fd2uuid(fd), fd_data(fd).rw_udata, buff,
                                        asked);
+    if (sent > 0)
+      fio_metric_add(FIO_METRIC_BYTES_WRITTEN, sent);
   } while (sent == asked && packet->length);
   if (sent >= 0) {
     packet->offset += sent;
@@ -2643,6 +4954,67 @@ read_error:
   return -1;
 }
 
+#if FIO_MMAP_FILE_WINDOW
+#ifdef MAP_POPULATE /* pre-fault the window instead of faulting page by page */
+#define FIO_MMAP_POPULATE MAP_POPULATE
+#else
+#define FIO_MMAP_POPULATE 0
+#endif
+
+static int fio_sock_write_from_mmap(int fd, fio_packet_s *packet) {
+  ssize_t total = 0;
+  while (packet->length) {
+    /* windows are aligned to their size (a multiple of the page size) */
+    const uintptr_t window = packet->offset & ~(FIO_MMAP_FILE_WINDOW - 1);
+    const uintptr_t pos = packet->offset - window;
+    if (!packet->map) {
+      struct stat st;
+      if (fstat(packet->data.fd, &st))
+        goto fallback;
+      if ((uintptr_t)st.st_size <= packet->offset)
+        break; /* EOF (the file was truncated) */
+      /* mapping pages beyond EOF raises SIGBUS, so the window is limited */
+      packet->map_len = (uintptr_t)st.st_size - window;
+      if (packet->map_len > FIO_MMAP_FILE_WINDOW)
+        packet->map_len = FIO_MMAP_FILE_WINDOW;
+      packet->map = mmap(NULL, packet->map_len, PROT_READ,
+                         MAP_SHARED | FIO_MMAP_POPULATE, packet->data.fd,
+                         (off_t)window);
+      if (packet->map == MAP_FAILED) {
+        packet->map = NULL;
+        goto fallback;
+      }
+#ifdef MADV_SEQUENTIAL
+      madvise(packet->map, packet->map_len, MADV_SEQUENTIAL);
+#endif
+    }
+    uintptr_t len = packet->map_len - pos;
+    if (len > packet->length)
+      len = packet->length;
+    ssize_t sent = fd_data(fd).rw_hooks->write(
+        fd2uuid(fd), fd_data(fd).rw_udata, (char *)packet->map + pos, len);
+    if (sent <= 0)
+      return (total ? total : sent);
+    fio_metric_add(FIO_METRIC_BYTES_WRITTEN, sent);
+    packet->offset += sent;
+    packet->length -= sent;
+    total += sent;
+    if (pos + sent >= packet->map_len) {
+      /* the window was consumed, the next one is mapped on demand */
+      munmap(packet->map, packet->map_len);
+      packet->map = NULL;
+    }
+    if ((uintptr_t)sent < len)
+      return total;
+  }
+  fio_sock_packet_rotate_unsafe(fd);
+  return (total ? total : 1);
+fallback:
+  packet->write_func = fio_sock_write_from_fd;
+  return (total ? total : fio_sock_write_from_fd(fd, packet));
+}
+#endif
+
 #if USE_SENDFILE && defined(__linux__) /* linux sendfile API */
 
 static int fio_sock_sendfile_from_fd(int fd, fio_packet_s *packet) {
@@ -2651,8 +5023,10 @@ static int fio_sock_sendfile_from_fd(int fd, fio_packet_s *packet) {
       sendfile64(fd, packet->data.fd, (off_t *)&packet->offset, packet->length);
   if (sent < 0)
     return -1;
+  fio_metric_add(FIO_METRIC_BYTES_WRITTEN, sent);
   packet->length -= sent;
-  if (!packet->length)
+  /* a zero value marks EOF (the file was truncated) */
+  if (!packet->length || !sent)
     fio_sock_packet_rotate_unsafe(fd);
   return sent;
 }
@@ -2673,6 +5047,9 @@ static int fio_sock_sendfile_from_fd(int fd, fio_packet_s *packet) {
 #endif
     if (ret < 0)
       goto error;
+    if (!act_sent) /* EOF (the file was truncated) */
+      break;
+    fio_metric_add(FIO_METRIC_BYTES_WRITTEN, act_sent);
     packet->length -= act_sent;
     packet->offset += act_sent;
   }
@@ -2680,16 +5057,17 @@ static int fio_sock_sendfile_from_fd(int fd, fio_packet_s *packet) {
   return act_sent;
 error:
   if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+    fio_metric_add(FIO_METRIC_BYTES_WRITTEN, act_sent);
     packet->length -= act_sent;
     packet->offset += act_sent;
   }
   return -1;
 }
 
+#elif FIO_MMAP_FILE_WINDOW
+#define fio_sock_sendfile_from_fd fio_sock_write_from_mmap
 #else
-static int (*sock_sendfile_from_fd)(int fd, struct packet_s *packet) =
-    sock_write_from_fd;
-
+#define fio_sock_sendfile_from_fd fio_sock_write_from_fd
 #endif
 
 /* *****************************************************************************
@@ -2740,6 +5118,13 @@ ssize_t fio_read(intptr_t uuid, void *buffer, size_t count) {
 retry_int:
   ret = rw_read(uuid, udata, buffer, count);
   if (ret > 0) {
+#if FIO_EPOLL_EDGE
+    /* a short socket read drains the kernel's buffer (hooks might buffer) */
+    if ((size_t)ret == count ||
+        uuid_data(uuid).rw_hooks != &FIO_DEFAULT_RW_HOOKS)
+      fio_poll_readable(fio_uuid2fd(uuid));
+#endif
+    fio_metric_add(FIO_METRIC_BYTES_READ, ret);
     fio_touch(uuid);
     return ret;
   }
@@ -2772,19 +5157,33 @@ ssize_t fio_write2_fn(intptr_t uuid, fio_write_args_s options) {
     packet->write_func = (uuid_data(uuid).rw_hooks == &FIO_DEFAULT_RW_HOOKS)
                              ? fio_sock_sendfile_from_fd
                              : fio_sock_write_from_fd;
+#if FIO_MMAP_FILE_WINDOW
+    if (packet->write_func == fio_sock_write_from_fd &&
+        options.length > BUFFER_FILE_READ_SIZE)
+      packet->write_func = fio_sock_write_from_mmap;
+#endif
     packet->dealloc =
         (options.after.dealloc ? options.after.dealloc
                                : (void (*)(void *))fio_sock_perform_close_fd);
   } else {
     packet->write_func = fio_sock_write_buffer;
     packet->dealloc = (options.after.dealloc ? options.after.dealloc : free);
+    packet->queued = options.length;
   }
   /* add packet to outgoing list */
   uint8_t was_empty = 1;
+  uint8_t congested = 0;
   fio_lock(&uuid_data(uuid).sock_lock);
   if (!uuid_is_valid(uuid)) {
     goto locked_error;
   }
+  if (uuid_data(uuid).congested &&
+      uuid_data(uuid).watermark_policy == FIO_WATERMARK_DROP) {
+    fio_unlock(&uuid_data(uuid).sock_lock);
+    fio_packet_free(packet);
+    errno = ENOBUFS;
+    return -1;
+  }
   if (uuid_data(uuid).packet)
     was_empty = 0;
   if (options.urgent == 0) {
@@ -2801,8 +5200,22 @@ ssize_t fio_write2_fn(intptr_t uuid, fio_write_args_s options) {
     }
   }
   fio_atomic_add(&uuid_data(uuid).packet_count, 1);
+  uuid_data(uuid).packet_bytes += packet->queued;
+  if (uuid_data(uuid).watermark_high && !uuid_data(uuid).congested &&
+      uuid_data(uuid).packet_bytes > uuid_data(uuid).watermark_high) {
+    /* reading is suspended by `deferred_on_data` */
+    uuid_data(uuid).congested = 1;
+    congested = 1;
+  }
   fio_unlock(&uuid_data(uuid).sock_lock);
 
+  if (congested && uuid_data(uuid).watermark_policy == FIO_WATERMARK_CLOSE) {
+    FIO_LOG_DEBUG("closing slow connection %p (%zu bytes pending)",
+                  (void *)uuid, uuid_data(uuid).packet_bytes);
+    fio_force_close(uuid);
+    errno = ENOBUFS;
+    return -1;
+  }
   if (was_empty) {
     touchfd(fio_uuid2fd(uuid));
     fio_defer_push_urgent(deferred_on_ready, (void *)uuid, NULL);
@@ -2834,6 +5247,47 @@ size_t fio_pending(intptr_t uuid) {
   return uuid_data(uuid).packet_count;
 }
 
+/**
+ * Returns the number of buffered bytes waiting in the socket's queue (files
+ * sent using `fio_sendfile` aren't counted).
+ */
+size_t fio_pending_bytes(intptr_t uuid) {
+  if (!uuid_is_valid(uuid))
+    return 0;
+  return uuid_data(uuid).packet_bytes;
+}
+
+/** Sets the connection's outgoing queue watermarks (see `fio_watermarks`). */
+int fio_watermarks FIO_IGNORE_MACRO(intptr_t uuid,
+                                    fio_watermarks_s watermarks) {
+  if (!uuid_is_valid(uuid)) {
+    errno = EBADF;
+    return -1;
+  }
+  if (watermarks.policy > FIO_WATERMARK_CLOSE) {
+    errno = EINVAL;
+    return -1;
+  }
+  if (watermarks.low >= watermarks.high)
+    watermarks.low = watermarks.high >> 1;
+  fio_lock(&uuid_data(uuid).sock_lock);
+  if (!uuid_is_valid(uuid))
+    goto locked_error;
+  uuid_data(uuid).watermark_high = watermarks.high;
+  uuid_data(uuid).watermark_low = watermarks.low;
+  uuid_data(uuid).watermark_policy = (uint8_t)watermarks.policy;
+  /* the new watermarks take effect with the next `fio_write2` */
+  if (uuid_data(uuid).congested &&
+      (!watermarks.high || uuid_data(uuid).packet_bytes <= watermarks.low))
+    fio_sock_congestion_clear_unsafe(fio_uuid2fd(uuid));
+  fio_unlock(&uuid_data(uuid).sock_lock);
+  return 0;
+locked_error:
+  fio_unlock(&uuid_data(uuid).sock_lock);
+  errno = EBADF;
+  return -1;
+}
+
 /**
  * `fio_close` marks the connection for disconnection once all the data was
  * sent. The actual disconnection will be managed by the `fio_flush` function.
@@ -2873,6 +5327,8 @@ void fio_force_close(intptr_t uuid) {
   packet = uuid_data(uuid).packet;
   uuid_data(uuid).packet = NULL;
   uuid_data(uuid).packet_last = &uuid_data(uuid).packet;
+  uuid_data(uuid).packet_bytes = 0;
+  uuid_data(uuid).congested = 0;
   uuid_data(uuid).sent = 0;
   fio_unlock(&uuid_data(uuid).sock_lock);
   while (packet) {
@@ -2888,9 +5344,15 @@ void fio_force_close(intptr_t uuid) {
     fio_poll_add_write(fio_uuid2fd(uuid));
     return;
   }
+  if (uuid_data(uuid).open && uuid_data(uuid).protocol)
+    fio_metric_add(FIO_METRIC_CLOSED, 1);
   fio_lock(&uuid_data(uuid).protocol_lock);
   fio_clear_fd(fio_uuid2fd(uuid), 0);
   fio_unlock(&uuid_data(uuid).protocol_lock);
+#if FIO_ENGINE_URING
+  /* io_uring poll requests keep the file open, so cancel them first */
+  fio_poll_remove_fd(fio_uuid2fd(uuid));
+#endif
   close(fio_uuid2fd(uuid));
 #if FIO_ENGINE_POLL
   fio_poll_remove_fd(fio_uuid2fd(uuid));
@@ -2899,16 +5361,8 @@ void fio_force_close(intptr_t uuid) {
     fio_atomic_sub(&fio_data->connection_count, 1);
 }
 
-/**
- * `fio_flush` attempts to write any remaining data in the internal buffer to
- * the underlying file descriptor and closes the underlying file descriptor once
- * if it's marked for closure (and all the data was sent).
- *
- * Return values: 1 will be returned if data remains in the buffer. 0
- * will be returned if the buffer was fully drained. -1 will be returned on an
- * error or when the connection is closed.
- */
-ssize_t fio_flush(intptr_t uuid) {
+/* `fio_flush` (without the trace point) */
+static inline ssize_t fio_flush___(intptr_t uuid) {
   if (!uuid_is_valid(uuid)) {
     errno = EBADF;
     return -1;
@@ -2918,10 +5372,21 @@ ssize_t fio_flush(intptr_t uuid) {
   /* start critical section */
   if (fio_trylock(&uuid_data(uuid).sock_lock))
     goto would_block;
+#if FIO_EPOLL_EDGE
+  /* until the write is known to succeed, a write edge is expected */
+  uuid_data(uuid).poll_blocked = 1;
+#endif
 
   if (uuid_data(uuid).packet) {
-    tmp = uuid_data(uuid).packet->write_func(fio_uuid2fd(uuid),
-                                             uuid_data(uuid).packet);
+    if (uuid_data(uuid).packet->write_func == fio_sock_write_buffer &&
+        uuid_data(uuid).packet->next &&
+        uuid_data(uuid).packet->next->write_func == fio_sock_write_buffer) {
+      /* gather successive buffers into a single system call */
+      tmp = fio_sock_writev_buffers(fio_uuid2fd(uuid), uuid_data(uuid).packet);
+    } else {
+      tmp = uuid_data(uuid).packet->write_func(fio_uuid2fd(uuid),
+                                               uuid_data(uuid).packet);
+    }
     if (tmp == 0) {
       errno = ECONNRESET;
       fio_unlock(&uuid_data(uuid).sock_lock);
@@ -2939,6 +5404,9 @@ ssize_t fio_flush(intptr_t uuid) {
       goto flushed;
     }
   }
+#if FIO_EPOLL_EDGE
+  uuid_data(uuid).poll_blocked = 0;
+#endif
 
   /* end critical section */
   fio_unlock(&uuid_data(uuid).sock_lock);
@@ -2971,6 +5439,22 @@ flushed:
   return 1;
 }
 
+/**
+ * `fio_flush` attempts to write any remaining data in the internal buffer to
+ * the underlying file descriptor and closes the underlying file descriptor once
+ * if it's marked for closure (and all the data was sent).
+ *
+ * Return values: 1 will be returned if data remains in the buffer. 0
+ * will be returned if the buffer was fully drained. -1 will be returned on an
+ * error or when the connection is closed.
+ */
+ssize_t fio_flush(intptr_t uuid) {
+  FIO_TRACE_BEGIN(trace);
+  const ssize_t ret = fio_flush___(uuid);
+  FIO_TRACE_END(trace, FIO_TRACE_FLUSH, 0, fio_uuid2fd(uuid));
+  return ret;
+}
+
 /** `fio_flush_all` attempts flush all the open connections. */
 size_t fio_flush_all(void) {
   if (!fio_data)
@@ -2997,6 +5481,28 @@ static ssize_t fio_hooks_default_write(intptr_t uuid, void *udata,
   return write(fio_uuid2fd(uuid), buf, count);
   (void)(udata);
 }
+static ssize_t fio_hooks_default_writev(intptr_t uuid, void *udata,
+                                        const struct iovec *iov, int iovcnt) {
+  return writev(fio_uuid2fd(uuid), iov, iovcnt);
+  (void)(udata);
+}
+
+/* used by hooks that don't implement `writev` (i.e., TLS) */
+static ssize_t fio_hooks_fallback_writev(intptr_t uuid, void *udata,
+                                         const struct iovec *iov, int iovcnt) {
+  ssize_t (*write_fn)(intptr_t, void *, const void *, size_t) =
+      uuid_data(uuid).rw_hooks->write;
+  ssize_t total = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    ssize_t written = write_fn(uuid, udata, iov[i].iov_base, iov[i].iov_len);
+    if (written <= 0)
+      return (total ? total : written);
+    total += written;
+    if ((size_t)written < iov[i].iov_len)
+      break;
+  }
+  return total;
+}
 
 static ssize_t fio_hooks_default_before_close(intptr_t uuid, void *udata) {
   return 0;
@@ -3018,6 +5524,7 @@ const fio_rw_hook_s FIO_DEFAULT_RW_HOOKS = {
     .flush = fio_hooks_default_flush,
     .before_close = fio_hooks_default_before_close,
     .cleanup = fio_hooks_default_cleanup,
+    .writev = fio_hooks_default_writev,
 };
 
 /**
@@ -3043,6 +5550,10 @@ int fio_rw_hook_replace_unsafe(intptr_t uuid, fio_rw_hook_s *rw_hooks,
     rw_hooks->before_close = fio_hooks_default_before_close;
   if (!rw_hooks->cleanup)
     rw_hooks->cleanup = fio_hooks_default_cleanup;
+  if (!rw_hooks->writev)
+    rw_hooks->writev = (rw_hooks->write == fio_hooks_default_write)
+                           ? fio_hooks_default_writev
+                           : fio_hooks_fallback_writev;
   /* protect against some fulishness... but not all of it. */
   was_locked = fio_trylock(&fd_data(fd).sock_lock);
   if (fd2uuid(fd) == uuid) {
@@ -3069,6 +5580,10 @@ int fio_rw_hook_set(intptr_t uuid, fio_rw_hook_s *rw_hooks, void *udata) {
     rw_hooks->before_close = fio_hooks_default_before_close;
   if (!rw_hooks->cleanup)
     rw_hooks->cleanup = fio_hooks_default_cleanup;
+  if (!rw_hooks->writev)
+    rw_hooks->writev = (rw_hooks->write == fio_hooks_default_write)
+                           ? fio_hooks_default_writev
+                           : fio_hooks_fallback_writev;
   intptr_t fd = fio_uuid2fd(uuid);
   fio_rw_hook_s *old_rw_hooks;
   void *old_udata;
@@ -3091,6 +5606,138 @@ invalid_uuid:
   return -1;
 }
 
+/* *****************************************************************************
+Shared Read Buffers
+***************************************************************************** */
+
+typedef struct fio_rbuf_container_s fio_rbuf_container_s;
+struct fio_rbuf_container_s {
+  /* the next unused buffer in the pool */
+  fio_rbuf_container_s *next;
+  volatile uintptr_t ref;
+  fio_rbuf_s rbuf;
+};
+
+#define fio_rbuf2container(rbuf_)                                              \
+  ((fio_rbuf_container_s *)((uintptr_t)(rbuf_) -                               \
+                            (uintptr_t)(&((fio_rbuf_container_s *)0)->rbuf)))
+
+static struct {
+  fio_rbuf_container_s *head;
+  size_t count;
+  fio_lock_i lock;
+} fio_rbuf_pool = {.lock = FIO_LOCK_INIT};
+
+/**
+ * Returns a new read buffer with (at least) `capa` bytes of capacity.
+ */
+fio_rbuf_s *fio_rbuf_new(size_t capa) {
+  fio_rbuf_container_s *c = NULL;
+  if (!capa)
+    capa = FIO_RBUF_SIZE;
+  if (capa <= FIO_RBUF_SIZE) {
+    capa = FIO_RBUF_SIZE;
+    fio_lock(&fio_rbuf_pool.lock);
+    c = fio_rbuf_pool.head;
+    if (c) {
+      fio_rbuf_pool.head = c->next;
+      --fio_rbuf_pool.count;
+    }
+    fio_unlock(&fio_rbuf_pool.lock);
+  }
+  if (!c) {
+    c = fio_malloc(sizeof(*c) + capa);
+    FIO_ASSERT_ALLOC(c);
+  }
+  *c = (fio_rbuf_container_s){
+      .ref = 1,
+      .rbuf = {.capa = capa, .data = (char *)(c + 1)},
+  };
+  return &c->rbuf;
+}
+
+/** Increases the buffer's reference count, returning the buffer. */
+fio_rbuf_s *fio_rbuf_dup(fio_rbuf_s *rbuf) {
+  fio_atomic_add(&fio_rbuf2container(rbuf)->ref, 1);
+  return rbuf;
+}
+
+/** Decreases the buffer's reference count, returning it to the pool if 0. */
+void fio_rbuf_free(fio_rbuf_s *rbuf) {
+  if (!rbuf)
+    return;
+  fio_rbuf_container_s *c = fio_rbuf2container(rbuf);
+  if (fio_atomic_sub(&c->ref, 1))
+    return;
+  if (rbuf->capa == FIO_RBUF_SIZE) {
+    fio_lock(&fio_rbuf_pool.lock);
+    if (fio_rbuf_pool.count < FIO_RBUF_POOL_LIMIT) {
+      c->next = fio_rbuf_pool.head;
+      fio_rbuf_pool.head = c;
+      ++fio_rbuf_pool.count;
+      c = NULL;
+    }
+    fio_unlock(&fio_rbuf_pool.lock);
+  }
+  fio_free(c);
+}
+
+/** Same as `fio_rbuf_free`, using the buffer's `data` pointer. */
+void fio_rbuf_free2(void *data) {
+  if (!data)
+    return;
+  fio_rbuf_free(&(((fio_rbuf_container_s *)data) - 1)->rbuf);
+}
+
+/** Returns TRUE (1) if the buffer is referenced by more than its owner. */
+int fio_rbuf_is_shared(fio_rbuf_s *rbuf) {
+  return fio_rbuf2container(rbuf)->ref > 1;
+}
+
+/** Reads available data from the `uuid` into the buffer's free space. */
+ssize_t fio_rbuf_read(intptr_t uuid, fio_rbuf_s *rbuf) {
+  ssize_t i = fio_read(uuid, rbuf->data + rbuf->len, rbuf->capa - rbuf->len);
+  if (i > 0)
+    rbuf->len += i;
+  return i;
+}
+
+/** Removes `len` bytes from the beginning of the buffer. */
+void fio_rbuf_consume(fio_rbuf_s **prbuf, size_t len) {
+  fio_rbuf_s *rbuf = *prbuf;
+  if (len > rbuf->len)
+    len = rbuf->len;
+  if (!len)
+    return;
+  if (fio_rbuf_is_shared(rbuf)) {
+    /* the data is referenced elsewhere, copy the leftovers */
+    fio_rbuf_s *tmp = fio_rbuf_new(rbuf->capa);
+    tmp->len = rbuf->len - len;
+    if (tmp->len)
+      memcpy(tmp->data, rbuf->data + len, tmp->len);
+    fio_rbuf_free(rbuf);
+    *prbuf = tmp;
+    return;
+  }
+  rbuf->len -= len;
+  if (rbuf->len)
+    memmove(rbuf->data, rbuf->data + len, rbuf->len);
+}
+
+/* releases the pooled buffers */
+static void fio_rbuf_pool_clear(void) {
+  fio_lock(&fio_rbuf_pool.lock);
+  fio_rbuf_container_s *c = fio_rbuf_pool.head;
+  fio_rbuf_pool.head = NULL;
+  fio_rbuf_pool.count = 0;
+  fio_unlock(&fio_rbuf_pool.lock);
+  while (c) {
+    fio_rbuf_container_s *tmp = c;
+    c = c->next;
+    fio_free(tmp);
+  }
+}
+
 /* *****************************************************************************
 Section Start Marker
 
@@ -3158,6 +5805,7 @@ static int fio_attach__internal(void *uuid_, void *protocol_) {
   uuid_data(uuid).protocol = protocol;
   touchfd(fio_uuid2fd(uuid));
   fio_unlock(&uuid_data(uuid).protocol_lock);
+  fio_timeout_schedule(fio_uuid2fd(uuid));
   if (old_pr) {
     /* protocol replacement */
     fio_defer_push_task(deferred_on_close, (void *)uuid, old_pr);
@@ -3205,6 +5853,7 @@ void fio_timeout_set(intptr_t uuid, uint8_t timeout) {
   if (uuid_is_valid(uuid)) {
     touchfd(fio_uuid2fd(uuid));
     uuid_data(uuid).timeout = timeout;
+    fio_timeout_schedule(fio_uuid2fd(uuid));
   } else {
     FIO_LOG_DEBUG("Called fio_timeout_set for invalid uuid %p", (void *)uuid);
   }
@@ -3423,19 +6072,32 @@ Initialize the library
 static void fio_pubsub_on_fork(void);
 
 /* Called within a child process after it starts. */
+static void fio_dns_on_fork(void);
+static void fio_hot_restart_on_fork(void);
+static void fio_defer_blocking_on_fork(void);
 static void fio_on_fork(void) {
+  fio_hot_restart_on_fork();
   fio_data->lock = FIO_LOCK_INIT;
+  fio_rbuf_pool.lock = FIO_LOCK_INIT;
   fio_defer_on_fork();
+  fio_defer_blocking_on_fork();
   fio_malloc_after_fork();
   fio_poll_init();
   fio_state_callback_on_fork();
   fio_pubsub_on_fork();
   fio_timer_lock = FIO_LOCK_INIT;
+  fio_data->timeout_lock = FIO_LOCK_INIT;
+  fio_dns_on_fork();
+  fio_on_data_postponed.lock = FIO_LOCK_INIT;
+  fio_on_data_postponed.count = 0; /* the connections are closed */
   fio_max_fd_shrink();
-  const size_t limit = fio_data->capa;
+  const size_t limit = fio_data->ready;
   for (size_t i = 0; i < limit; ++i) {
     fd_data(i).sock_lock = FIO_LOCK_INIT;
     fd_data(i).protocol_lock = FIO_LOCK_INIT;
+#if FIO_EPOLL_EDGE
+    fd_data(i).poll_registered = 0; /* the epoll instance is new */
+#endif
     if (fd_data(i).protocol) {
       fd_data(i).protocol->rsv = 0;
       fio_force_close(fd2uuid(i));
@@ -3446,9 +6108,12 @@ static void fio_on_fork(void) {
   fio_defer_perform();
   fio_data->active = old_active;
   fio_data->is_worker = 1;
+  fio_metrics_on_fork();
+  fio_trace_on_fork();
 }
 
 static void fio_mem_destroy(void);
+static void fio_dns_cache_clear(void);
 static void __attribute__((destructor)) fio_lib_destroy(void) {
   uint8_t add_eol = fio_is_master();
   fio_data->active = 0;
@@ -3459,6 +6124,9 @@ static void __attribute__((destructor)) fio_lib_destroy(void) {
   fio_defer_perform();
   fio_poll_close();
   fio_timer_clear_all();
+  fio_rbuf_pool_clear();
+  fio_dns_cache_clear();
+  fio_free(fio_on_data_postponed.uuids);
   fio_free(fio_data);
   /* memory library destruction must be last */
   fio_mem_destroy();
@@ -3512,8 +6180,10 @@ static void __attribute__((constructor)) fio_lib_init(void) {
                   "*    %zu bytes per connection + %zu for state handling.",
                   capa, (size_t)rlim.rlim_max,
                   (sizeof(*fio_data) + (capa * (sizeof(*fio_data->poll))) +
-                   (capa * (sizeof(*fio_data->info)))),
-                  (sizeof(*fio_data->poll) + sizeof(*fio_data->info)),
+                   (capa * (sizeof(*fio_data->info))) +
+                   (capa * (sizeof(*fio_data->timeouts)))),
+                  (sizeof(*fio_data->poll) + sizeof(*fio_data->info) +
+                   sizeof(*fio_data->timeouts)),
                   sizeof(*fio_data));
 #else
     FIO_LOG_STATE("facil.io " FIO_VERSION_STRING " capacity initialization:\n"
@@ -3521,8 +6191,10 @@ static void __attribute__((constructor)) fio_lib_init(void) {
                   "*    Allocating %zu bytes for state handling.\n"
                   "*    %zu bytes per connection + %zu for state handling.",
                   capa, (size_t)rlim.rlim_max,
-                  (sizeof(*fio_data) + (capa * (sizeof(*fio_data->info)))),
-                  (sizeof(*fio_data->info)), sizeof(*fio_data));
+                  (sizeof(*fio_data) + (capa * (sizeof(*fio_data->info))) +
+                   (capa * (sizeof(*fio_data->timeouts)))),
+                  (sizeof(*fio_data->info) + sizeof(*fio_data->timeouts)),
+                  sizeof(*fio_data));
 #endif
 #endif
   }
@@ -3530,27 +6202,48 @@ static void __attribute__((constructor)) fio_lib_init(void) {
 #if FIO_ENGINE_POLL
   /* allocate and initialize main data structures by detected capacity */
   fio_data = fio_mmap(sizeof(*fio_data) + (capa * (sizeof(*fio_data->poll))) +
-                      (capa * (sizeof(*fio_data->info))));
+                      (capa * (sizeof(*fio_data->info))) +
+                      (capa * (sizeof(*fio_data->timeouts))));
   FIO_ASSERT_ALLOC(fio_data);
   fio_data->capa = capa;
   fio_data->poll =
       (void *)((uintptr_t)(fio_data + 1) + (sizeof(fio_data->info[0]) * capa));
+  fio_data->timeouts = (void *)(fio_data->poll + capa);
+#elif FIO_ENGINE_URING
+  /* allocate and initialize main data structures by detected capacity */
+  fio_data = fio_mmap(sizeof(*fio_data) + (capa * (sizeof(*fio_data->info))) +
+                      (capa * (sizeof(*fio_data->timeouts))) +
+                      (capa * (sizeof(*fio_data->uring))));
+  FIO_ASSERT_ALLOC(fio_data);
+  fio_data->capa = capa;
+  /* the links are placed before the (16 bit) io_uring state */
+  fio_data->timeouts =
+      (void *)((uintptr_t)(fio_data + 1) + (sizeof(fio_data->info[0]) * capa));
+  fio_data->uring = (void *)(fio_data->timeouts + capa);
 #else
   /* allocate and initialize main data structures by detected capacity */
-  fio_data = fio_mmap(sizeof(*fio_data) + (capa * (sizeof(*fio_data->info))));
+  fio_data = fio_mmap(sizeof(*fio_data) + (capa * (sizeof(*fio_data->info))) +
+                      (capa * (sizeof(*fio_data->timeouts))));
   FIO_ASSERT_ALLOC(fio_data);
   fio_data->capa = capa;
+  fio_data->timeouts = (void *)(fio_data->info + capa);
 #endif
   fio_data->parent = getpid();
   fio_data->connection_count = 0;
   fio_mark_time();
+  fio_data->timeout_reviewed = fio_data->last_cycle.tv_sec;
 
-  for (ssize_t i = 0; i < capa; ++i) {
-    fio_clear_fd(i, 0);
-#if FIO_ENGINE_POLL
-    fio_data->poll[i].fd = -1;
-#endif
+  /* the connection data is initialized on demand (see `fio_fd_data_grow`) */
+  fio_data->ready = 0;
+#if FIO_FD_DATA_HUGEPAGES && defined(MADV_HUGEPAGE)
+  {
+    const uintptr_t huge = ((uintptr_t)1 << 21) - 1;
+    const uintptr_t start = ((uintptr_t)fio_data->info + huge) & (~huge);
+    const uintptr_t end = (uintptr_t)(fio_data->info + capa) & (~huge);
+    if (end > start)
+      madvise((void *)start, end - start, MADV_HUGEPAGE);
   }
+#endif
 
   /* call initialization callbacks */
   fio_state_callback_force(FIO_CALL_ON_INITIALIZE);
@@ -3588,42 +6281,68 @@ Section Start Marker
 ***************************************************************************** */
 
 static void fio_cluster_signal_children(void);
+static void fio_hot_restart_start(char *const *argv);
+static void fio_hot_restart_ready(void);
 
-static void fio_review_timeout(void *arg, void *ignr) {
-  // TODO: Fix review for connections with no protocol?
-  (void)ignr;
+/* reviews a connection from an expired bucket */
+static void fio_review_timeout_fd(intptr_t fd, time_t review) {
   fio_protocol_s *tmp;
-  time_t review = fio_data->last_cycle.tv_sec;
-  intptr_t fd = (intptr_t)arg;
-
-  uint16_t timeout = fd_data(fd).timeout;
-  if (!timeout)
-    timeout = 300; /* enforced timout settings */
-  if (!fd_data(fd).protocol || (fd_data(fd).active + timeout >= review))
-    goto finish;
+  time_t deadline = fio_timeout_deadline(fd);
+  if (deadline >= review)
+    goto reschedule; /* touched since it was placed in the bucket */
   tmp = protocol_try_lock(fd, FIO_PR_LOCK_STATE);
   if (!tmp) {
     if (errno == EBADF)
-      goto finish;
-    goto reschedule;
+      return;
+    goto retry;
   }
-  if (prt_meta(tmp).locks[FIO_PR_LOCK_TASK] ||
-      prt_meta(tmp).locks[FIO_PR_LOCK_WRITE])
-    goto unlock;
-  fio_defer_push_task(deferred_ping, (void *)fio_fd2uuid((int)fd), NULL);
-unlock:
+  if (!prt_meta(tmp).locks[FIO_PR_LOCK_TASK] &&
+      !prt_meta(tmp).locks[FIO_PR_LOCK_WRITE])
+    fio_defer_push_task(deferred_ping, (void *)fio_fd2uuid((int)fd), NULL);
   protocol_unlock(tmp, FIO_PR_LOCK_STATE);
-finish:
-  do {
-    fd++;
-  } while (!fd_data(fd).protocol && (fd <= fio_data->max_protocol_fd));
+retry:
+  /* review again on the next cycle (unless the connection was touched) */
+  deadline = review + 1;
+reschedule:
+  fio_lock(&fio_data->timeout_lock);
+  fio_timeout_place___(fd, deadline);
+  fio_unlock(&fio_data->timeout_lock);
+}
 
-  if (fio_data->max_protocol_fd < fd) {
-    fio_data->need_review = 1;
-    return;
+/* reviews the buckets of any seconds that passed since the last review */
+static void fio_review_timeout(void *arg, void *ignr) {
+  const time_t review = fio_data->last_cycle.tv_sec;
+  fio_lock(&fio_data->timeout_lock);
+  if (fio_data->timeout_reviewed + FIO_TIMEOUT_BUCKETS < review) {
+    /* the reactor wasn't cycling for a while, review every bucket once */
+    fio_data->timeout_reviewed = review - FIO_TIMEOUT_BUCKETS;
+  }
+  fio_unlock(&fio_data->timeout_lock);
+  while (fio_data->timeout_reviewed < review) {
+    fio_lock(&fio_data->timeout_lock);
+    ++fio_data->timeout_reviewed;
+    /* move the bucket's connections to the review bucket */
+    const size_t bucket =
+        (size_t)fio_data->timeout_reviewed & (FIO_TIMEOUT_BUCKETS - 1);
+    uint32_t pos = fio_data->timeout_wheel[FIO_TIMEOUT_BUCKETS] =
+        fio_data->timeout_wheel[bucket];
+    fio_data->timeout_wheel[bucket] = 0;
+    while (pos) {
+      fio_data->timeouts[pos - 1].bucket = FIO_TIMEOUT_BUCKETS + 1;
+      pos = fio_data->timeouts[pos - 1].next;
+    }
+    /* review the connections one at a time (they might be closed meanwhile) */
+    while ((pos = fio_data->timeout_wheel[FIO_TIMEOUT_BUCKETS])) {
+      fio_timeout_unlink___(pos - 1);
+      fio_unlock(&fio_data->timeout_lock);
+      fio_review_timeout_fd(pos - 1, review);
+      fio_lock(&fio_data->timeout_lock);
+    }
+    fio_unlock(&fio_data->timeout_lock);
   }
-reschedule:
-  fio_defer_push_task(fio_review_timeout, (void *)fd, NULL);
+  fio_data->need_review = 1;
+  (void)arg;
+  (void)ignr;
 }
 
 /* reactor pattern cycling - common actions */
@@ -3638,7 +6357,18 @@ static void fio_cycle_schedule_events(void) {
     fio_signal_children_flag = 0;
     fio_cluster_signal_children();
   }
+  if (fio_hot_restart_flag) {
+    fio_hot_restart_flag = 0;
+    if (fio_is_master())
+      fio_hot_restart();
+    else
+      kill(fio_parent_pid(), SIGUSR2);
+  }
+  ++fio_data->turn;
+  FIO_TRACE_BEGIN(trace);
   int events = fio_poll();
+  FIO_TRACE_END(trace, FIO_TRACE_POLL, 0, (events > 0 ? events : 0));
+  fio_on_data_resume();
   if (events < 0) {
     return;
   }
@@ -3654,7 +6384,7 @@ static void fio_cycle_schedule_events(void) {
   if (fio_data->need_review && fio_data->last_cycle.tv_sec != last_to_review) {
     last_to_review = fio_data->last_cycle.tv_sec;
     fio_data->need_review = 0;
-    fio_defer_push_task(fio_review_timeout, (void *)0, NULL);
+    fio_defer_push_background(fio_review_timeout, (void *)0, NULL);
   }
 }
 
@@ -3683,6 +6413,7 @@ static void fio_cycle(void *ignr, void *ignr2) {
 static void fio_worker_startup(void) {
   /* Call the on_start callbacks for worker processes. */
   if (fio_data->workers == 1 || fio_data->is_worker) {
+    fio_affinity_worker_start(); /* before any listening sockets are opened */
     fio_state_callback_force(FIO_CALL_ON_START);
     fio_state_callback_clear(FIO_CALL_ON_START);
   }
@@ -3698,6 +6429,10 @@ static void fio_worker_startup(void) {
     fio_data->threads = 1;
   }
 
+  /* blocking tasks are performed by the worker's own thread pool */
+  if (fio_data->is_worker)
+    fio_defer_blocking_start();
+
   /* require timeout review */
   fio_data->need_review = 1;
 
@@ -3712,6 +6447,9 @@ static void fio_worker_startup(void) {
   }
 }
 
+/* the number of running sentinel threads (each watches a worker process) */
+static volatile size_t fio_sentinel_count;
+
 /* performs all clean-up / shutdown requirements except for the exit sequence */
 static void fio_worker_cleanup(void) {
   /* switch to winding down */
@@ -3733,12 +6471,17 @@ static void fio_worker_cleanup(void) {
     }
   }
   fio_defer_perform();
+  fio_defer_blocking_stop();
+  fio_defer_perform();
   fio_state_callback_force(FIO_CALL_ON_FINISH);
   fio_defer_perform();
   if (!fio_data->is_worker) {
     kill(0, SIGINT);
     while (wait(NULL) != -1)
       ;
+    /* the sentinel threads might still be reading the process state */
+    while (fio_sentinel_count)
+      fio_throttle_thread(500000);
   }
   fio_defer_perform();
   fio_signal_handler_reset();
@@ -3751,6 +6494,8 @@ static void fio_worker_cleanup(void) {
 
 static void fio_sentinel_task(void *arg1, void *arg2);
 static void *fio_sentinel_worker_thread(void *arg) {
+  /* decrements `fio_sentinel_count` when done (in the root process) */
+  /* `arg` is the worker's index, kept when the worker is respawned */
   errno = 0;
   pid_t child = fio_fork();
   /* release fork lock. */
@@ -3760,6 +6505,7 @@ static void *fio_sentinel_worker_thread(void *arg) {
     perror("\n           errno");
     kill(fio_parent_pid(), SIGINT);
     fio_stop();
+    fio_atomic_sub(&fio_sentinel_count, 1);
     return NULL;
   } else if (child) {
     int status;
@@ -3785,11 +6531,16 @@ static void *fio_sentinel_worker_thread(void *arg) {
         FIO_LOG_WARNING("Child worker (%d) shutdown. Respawning worker.",
                         child);
       }
-      fio_defer_push_task(fio_sentinel_task, NULL, NULL);
+      fio_defer_push_task(fio_sentinel_task, arg, NULL);
       fio_unlock(&fio_fork_lock);
     }
 #endif
+    fio_atomic_sub(&fio_sentinel_count, 1);
   } else {
+    fio_data->worker_id = (uint16_t)(uintptr_t)arg;
+#if FIO_CPU_AFFINITY
+    fio_affinity.worker = (uint16_t)(uintptr_t)arg;
+#endif
     fio_on_fork();
     fio_state_callback_force(FIO_CALL_AFTER_FORK);
     fio_state_callback_force(FIO_CALL_IN_CHILD);
@@ -3798,7 +6549,6 @@ static void *fio_sentinel_worker_thread(void *arg) {
     exit(0);
   }
   return NULL;
-  (void)arg;
 }
 
 static void fio_sentinel_task(void *arg1, void *arg2) {
@@ -3806,14 +6556,13 @@ static void fio_sentinel_task(void *arg1, void *arg2) {
     return;
   fio_state_callback_force(FIO_CALL_BEFORE_FORK);
   fio_lock(&fio_fork_lock); /* will wait for worker thread to release lock. */
-  void *thrd =
-      fio_thread_new(fio_sentinel_worker_thread, (void *)&fio_fork_lock);
+  fio_atomic_add(&fio_sentinel_count, 1);
+  void *thrd = fio_thread_new(fio_sentinel_worker_thread, arg1);
   fio_thread_free(thrd);
   fio_lock(&fio_fork_lock);   /* will wait for worker thread to release lock. */
   fio_unlock(&fio_fork_lock); /* release lock for next fork. */
   fio_state_callback_force(FIO_CALL_AFTER_FORK);
   fio_state_callback_force(FIO_CALL_IN_MASTER);
-  (void)arg1;
   (void)arg2;
 }
 
@@ -3834,8 +6583,14 @@ void fio_start FIO_IGNORE_MACRO(struct fio_start_args args) {
 
   fio_data->workers = (uint16_t)args.workers;
   fio_data->threads = (uint16_t)args.threads;
+  fio_blocking_pool.requested =
+      (args.blocking_threads > 0
+           ? (size_t)args.blocking_threads
+           : (args.blocking_threads ? 0 : FIO_DEFER_BLOCKING_THREADS));
   fio_data->active = 1;
   fio_data->is_worker = 0;
+  fio_affinity_collect(args.pin_workers, args.pin_threads);
+  fio_hot_restart_start(args.argv);
 
   fio_state_callback_force(FIO_CALL_PRE_START);
 
@@ -3851,9 +6606,10 @@ void fio_start FIO_IGNORE_MACRO(struct fio_start_args args) {
 
   if (args.workers > 1) {
     for (int i = 0; i < args.workers && fio_data->active; ++i) {
-      fio_sentinel_task(NULL, NULL);
+      fio_sentinel_task((void *)(uintptr_t)i, NULL);
     }
   }
+  fio_hot_restart_ready();
   fio_worker_startup();
   fio_worker_cleanup();
 }
@@ -4401,8 +7157,88 @@ typedef struct {
   size_t port_len;
   size_t addr_len;
   void *tls;
+  uint32_t send_buffer;
+  uint32_t recv_buffer;
+  uint16_t accept_batch;
+  uint16_t defer_accept;
+  uint16_t fast_open;
+  uint16_t busy_poll;
+  uint8_t reuse_port;
+  uint8_t tcp_delay;
+  /* set once a hot restart handed the socket off to a new process */
+  uint8_t handed_off;
+  fio_ls_embd_s node;
 } fio_listen_protocol_s;
 
+/* the listening sockets opened by this process (handed off by hot restarts) */
+static fio_ls_embd_s fio_listen_list = FIO_LS_INIT(fio_listen_list);
+static fio_lock_i fio_listen_list_lock = FIO_LOCK_INIT;
+
+/* sets the listening socket's options (inherited by accepted connections) */
+static void fio_listen_sockopt(fio_listen_protocol_s *pr) {
+  const int fd = fio_uuid2fd(pr->uuid);
+  int optval;
+  if (pr->send_buffer) {
+    optval = (int)pr->send_buffer;
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &optval, sizeof(optval)))
+      FIO_LOG_WARNING("(fio_listen) couldn't set SO_SNDBUF: %s",
+                      strerror(errno));
+  }
+  if (pr->recv_buffer) {
+    optval = (int)pr->recv_buffer;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &optval, sizeof(optval)))
+      FIO_LOG_WARNING("(fio_listen) couldn't set SO_RCVBUF: %s",
+                      strerror(errno));
+  }
+  if (!pr->port_len)
+    return; /* Unix sockets don't support the TCP/IP options */
+  if (pr->defer_accept) {
+#ifdef TCP_DEFER_ACCEPT
+    optval = pr->defer_accept;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &optval, sizeof(optval)))
+      FIO_LOG_WARNING("(fio_listen) couldn't set TCP_DEFER_ACCEPT: %s",
+                      strerror(errno));
+#else
+    FIO_LOG_WARNING("(fio_listen) defer_accept is unsupported on this system.");
+#endif
+  }
+  if (pr->fast_open) {
+#ifdef TCP_FASTOPEN
+    optval = pr->fast_open;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &optval, sizeof(optval)))
+      FIO_LOG_WARNING("(fio_listen) couldn't set TCP_FASTOPEN: %s",
+                      strerror(errno));
+#else
+    FIO_LOG_WARNING("(fio_listen) fast_open is unsupported on this system.");
+#endif
+  }
+  if (pr->busy_poll) {
+#ifdef SO_BUSY_POLL
+    optval = pr->busy_poll;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &optval, sizeof(optval)))
+      FIO_LOG_WARNING("(fio_listen) couldn't set SO_BUSY_POLL: %s",
+                      strerror(errno));
+#else
+    FIO_LOG_WARNING("(fio_listen) busy_poll is unsupported on this system.");
+#endif
+  }
+}
+
+/* accepts a connection, setting the per-connection socket options */
+static inline intptr_t fio_listen_accept(fio_listen_protocol_s *pr,
+                                         intptr_t uuid) {
+  if (!fio_data->active)
+    return -1; /* shutting down, leave it to a process sharing the socket */
+  intptr_t client = fio_accept___(uuid);
+  if (client != -1 && pr->port_len && !pr->tcp_delay) {
+    // avoid the TCP delay algorithm.
+    int optval = 1;
+    setsockopt(fio_uuid2fd(client), IPPROTO_TCP, TCP_NODELAY, &optval,
+               sizeof(optval));
+  }
+  return client;
+}
+
 static void fio_listen_cleanup_task(void *pr_) {
   fio_listen_protocol_s *pr = pr_;
   if (pr->tls)
@@ -4414,16 +7250,70 @@ static void fio_listen_cleanup_task(void *pr_) {
   if (pr->addr &&
       (!pr->port || *pr->port == 0 ||
        (pr->port[0] == '0' && pr->port[1] == 0)) &&
-      fio_is_master()) {
+      fio_is_master() && !pr->handed_off) {
     /* delete Unix sockets */
     unlink(pr->addr);
   }
+  fio_lock(&fio_listen_list_lock);
+  fio_ls_embd_remove(&pr->node);
+  fio_unlock(&fio_listen_list_lock);
   free(pr_);
 }
 
+/* opens a listening socket that shares the port with other processes */
+static intptr_t fio_listen_reuse_port_socket(const char *address,
+                                             const char *port) {
+  intptr_t uuid;
+  do {
+    errno = 0;
+    uuid = fio_tcp_socket(address, port, 1, 1);
+  } while (errno == EINTR);
+#if defined(SO_INCOMING_CPU) && defined(CPU_COUNT)
+  if (uuid != -1) {
+    /* a process pinned to a single CPU prefers connections handled by it */
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (!sched_getaffinity(0, sizeof(cpus), &cpus) && CPU_COUNT(&cpus) == 1) {
+      for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &cpus))
+          continue;
+        setsockopt(fio_uuid2fd(uuid), SOL_SOCKET, SO_INCOMING_CPU, &cpu,
+                   sizeof(cpu));
+        break;
+      }
+    }
+  }
+#endif
+  return uuid;
+}
+
+/* the root process shouldn't keep a `reuse_port` socket when forking */
+static void fio_listen_on_pre_start(void *pr_) {
+  fio_listen_protocol_s *pr = pr_;
+  if (fio_data->workers > 1) {
+    /* otherwise the kernel will route connections to the root process */
+    fio_force_close(pr->uuid);
+  }
+}
+
 static void fio_listen_on_startup(void *pr_) {
   fio_state_callback_remove(FIO_CALL_ON_SHUTDOWN, fio_listen_cleanup_task, pr_);
   fio_listen_protocol_s *pr = pr_;
+  if (pr->reuse_port && fio_data->workers > 1) {
+    /* each worker process listens on it's own socket */
+    pr->uuid = fio_listen_reuse_port_socket(pr->addr_len ? pr->addr : NULL,
+                                            pr->port);
+    if (pr->uuid == -1) {
+      FIO_LOG_ERROR("(%d) couldn't open a reuse_port socket for port %s",
+                    getpid(), pr->port);
+      fio_listen_cleanup_task(pr);
+      return;
+    }
+    fio_listen_sockopt(pr);
+  }
+#if FIO_EPOLL_EDGE
+  uuid_data(pr->uuid).poll_exclusive = 1;
+#endif
   fio_attach(pr->uuid, &pr->pr);
   if (pr->port_len)
     FIO_LOG_DEBUG("(%d) started listening on port %s", getpid(), pr->port);
@@ -4437,37 +7327,427 @@ static void fio_listen_on_close(intptr_t uuid, fio_protocol_s *pr_) {
   (void)uuid;
 }
 
-static void fio_listen_on_data(intptr_t uuid, fio_protocol_s *pr_) {
-  fio_listen_protocol_s *pr = (fio_listen_protocol_s *)pr_;
-  for (int i = 0; i < 4; ++i) {
-    intptr_t client = fio_accept(uuid);
-    if (client == -1)
-      return;
-    pr->on_open(client, pr->udata);
+static void fio_listen_on_data(intptr_t uuid, fio_protocol_s *pr_) {
+  fio_listen_protocol_s *pr = (fio_listen_protocol_s *)pr_;
+  for (size_t i = 0; i < pr->accept_batch; ++i) {
+    intptr_t client = fio_listen_accept(pr, uuid);
+    if (client == -1)
+      return;
+    pr->on_open(client, pr->udata);
+  }
+  /* the batch was exhausted, more connections might be waiting */
+  fio_poll_readable(fio_uuid2fd(uuid));
+}
+
+static void fio_listen_on_data_tls(intptr_t uuid, fio_protocol_s *pr_) {
+  fio_listen_protocol_s *pr = (fio_listen_protocol_s *)pr_;
+  for (size_t i = 0; i < pr->accept_batch; ++i) {
+    intptr_t client = fio_listen_accept(pr, uuid);
+    if (client == -1)
+      return;
+    fio_tls_accept(client, pr->tls, pr->udata);
+    pr->on_open(client, pr->udata);
+  }
+  /* the batch was exhausted, more connections might be waiting */
+  fio_poll_readable(fio_uuid2fd(uuid));
+}
+
+static void fio_listen_on_data_tls_alpn(intptr_t uuid, fio_protocol_s *pr_) {
+  fio_listen_protocol_s *pr = (fio_listen_protocol_s *)pr_;
+  for (size_t i = 0; i < pr->accept_batch; ++i) {
+    intptr_t client = fio_listen_accept(pr, uuid);
+    if (client == -1)
+      return;
+    fio_tls_accept(client, pr->tls, pr->udata);
+  }
+  /* the batch was exhausted, more connections might be waiting */
+  fio_poll_readable(fio_uuid2fd(uuid));
+}
+
+/* *****************************************************************************
+Hot Restart - handing off the listening sockets to a new binary
+***************************************************************************** */
+#if !FIO_DISABLE_HOT_RESTART
+
+/* names the new process's end of the Unix socket (a file descriptor) */
+#define FIO_HOT_RESTART_ENV "FIO_HOT_RESTART_FD"
+/* the size of every message sent to the new process */
+#define FIO_HOT_RESTART_RECORD 512
+
+/* a listening socket inherited from the old process */
+typedef struct {
+  int fd;
+  /* the message: a type byte, followed by the "port\0address\0" strings */
+  char data[FIO_HOT_RESTART_RECORD];
+} fio_hot_restart_socket_s;
+
+static struct {
+  /* the argv used to start the new binary (see `fio_start`) */
+  char *const *argv;
+  /* the listening sockets inherited by a new process */
+  fio_hot_restart_socket_s *inherited;
+  size_t count;
+  /* the new process's end of the Unix socket, until it's ready */
+  int fd;
+  /* the old process's end of the Unix socket, while a restart is running */
+  intptr_t uuid;
+  uint8_t loaded;
+  uint8_t ready;
+} fio_hot_restart_data = {.fd = -1, .uuid = -1};
+
+/* sends a single message (and, optionally, a file descriptor) */
+static int fio_hot_restart_send(int sock, char type, const char *port,
+                                const char *address, int fd) {
+  char buf[FIO_HOT_RESTART_RECORD] = {0};
+  const size_t port_len = port ? strlen(port) : 0;
+  const size_t addr_len = address ? strlen(address) : 0;
+  if (port_len + addr_len + 3 > FIO_HOT_RESTART_RECORD) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  buf[0] = type;
+  if (port_len)
+    memcpy(buf + 1, port, port_len);
+  if (addr_len)
+    memcpy(buf + 2 + port_len, address, addr_len);
+  struct iovec iov = {.iov_base = buf, .iov_len = sizeof(buf)};
+  union {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+  if (fd != -1) {
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+  ssize_t written;
+  do {
+    written = sendmsg(sock, &msg, 0);
+  } while (written == -1 && errno == EINTR);
+  return (written == (ssize_t)sizeof(buf)) ? 0 : -1;
+}
+
+/* receives the listening sockets (sent before the new process started) */
+static void fio_hot_restart_receive(int sock) {
+  for (;;) {
+    fio_hot_restart_socket_s s = {.fd = -1};
+    struct iovec iov = {.iov_base = s.data, .iov_len = sizeof(s.data)};
+    union {
+      struct cmsghdr align;
+      char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control.buf,
+        .msg_controllen = sizeof(control.buf),
+    };
+    ssize_t len = recvmsg(sock, &msg, MSG_DONTWAIT);
+    if (len <= 0)
+      return;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+        cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(&s.fd, CMSG_DATA(cmsg), sizeof(int));
+    while (len < (ssize_t)sizeof(s.data)) {
+      /* the remainder of a stream message, if it was split */
+      ssize_t tmp = recv(sock, s.data + len, sizeof(s.data) - len, 0);
+      if (tmp <= 0) {
+        if (tmp == -1 && errno == EINTR)
+          continue;
+        break;
+      }
+      len += tmp;
+    }
+    if (len < (ssize_t)sizeof(s.data) || s.data[0] != 'L' || s.fd == -1) {
+      if (s.fd != -1)
+        close(s.fd);
+      if (s.data[0] != 'L')
+        return; /* the end marker */
+      continue;
+    }
+    s.data[sizeof(s.data) - 1] = 0;
+    fio_hot_restart_socket_s *tmp =
+        realloc(fio_hot_restart_data.inherited,
+                sizeof(*tmp) * (fio_hot_restart_data.count + 1));
+    FIO_ASSERT_ALLOC(tmp);
+    fio_hot_restart_data.inherited = tmp;
+    fio_hot_restart_data.inherited[fio_hot_restart_data.count++] = s;
+  }
+}
+
+/* collects any listening sockets passed on by an old process (once) */
+static void fio_hot_restart_load(void) {
+  if (fio_hot_restart_data.loaded)
+    return;
+  fio_hot_restart_data.loaded = 1;
+  char *env = getenv(FIO_HOT_RESTART_ENV);
+  if (!env)
+    return;
+  char *end = env;
+  const int fd = (int)fio_atol(&end);
+  const int valid = !*end && end != env;
+  unsetenv(FIO_HOT_RESTART_ENV); /* don't pass it on to other processes */
+  int type = 0;
+  socklen_t type_len = sizeof(type);
+  if (!valid || fd < 3 ||
+      getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &type_len) ||
+      type != SOCK_STREAM) {
+    FIO_LOG_WARNING("(hot restart) invalid " FIO_HOT_RESTART_ENV
+                    " value, ignored.");
+    return;
+  }
+  fio_hot_restart_data.fd = fd;
+  fio_hot_restart_receive(fd);
+  FIO_LOG_DEBUG("(hot restart) inherited %zu listening sockets.",
+                fio_hot_restart_data.count);
+}
+
+/* returns an inherited listening socket for the address, if any */
+static intptr_t fio_hot_restart_inherited(const char *address,
+                                          const char *port) {
+  fio_hot_restart_load();
+  if (!port)
+    port = "";
+  if (!address)
+    address = "";
+  for (size_t i = 0; i < fio_hot_restart_data.count; ++i) {
+    fio_hot_restart_socket_s *s = fio_hot_restart_data.inherited + i;
+    const char *s_port = s->data + 1;
+    const char *s_addr = s_port + strlen(s_port) + 1;
+    if (s->fd == -1 || strcmp(port, s_port) || strcmp(address, s_addr))
+      continue;
+    const int fd = s->fd;
+    s->fd = -1;
+    fio_set_non_block(fd);
+    return fio_fd2uuid(fd);
+  }
+  return -1;
+}
+
+/* called by `fio_start`, closes any inherited sockets that weren't reused */
+static void fio_hot_restart_start(char *const *argv) {
+  fio_hot_restart_data.argv = argv;
+  fio_hot_restart_load();
+  for (size_t i = 0; i < fio_hot_restart_data.count; ++i) {
+    fio_hot_restart_socket_s *s = fio_hot_restart_data.inherited + i;
+    if (s->fd == -1)
+      continue;
+    FIO_LOG_WARNING("(hot restart) the listening socket for %s wasn't "
+                    "reopened, closing it.",
+                    (s->data[1] ? s->data + 1 : s->data + 2));
+    close(s->fd);
+  }
+  free(fio_hot_restart_data.inherited);
+  fio_hot_restart_data.inherited = NULL;
+  fio_hot_restart_data.count = 0;
+}
+
+/* forked processes don't take part in the handoff */
+static void fio_hot_restart_on_fork(void) {
+  if (fio_hot_restart_data.fd != -1)
+    close(fio_hot_restart_data.fd);
+  fio_hot_restart_data.fd = -1;
+  fio_hot_restart_data.uuid = -1;
+}
+
+/* the old process: waits for the new process to be ready */
+static void fio_hot_restart_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  char buf[16];
+  ssize_t len;
+  while ((len = fio_read(uuid, buf, sizeof(buf))) > 0) {
+    if (fio_hot_restart_data.ready || !memchr(buf, 'R', len))
+      continue;
+    fio_hot_restart_data.ready = 1;
+    FIO_LOG_INFO("(%d) hot restart: the new process is running, shutting "
+                 "down and draining connections.",
+                 getpid());
+    /* Unix sockets now belong to the new process */
+    fio_lock(&fio_listen_list_lock);
+    FIO_LS_EMBD_FOR(&fio_listen_list, node) {
+      FIO_LS_EMBD_OBJ(fio_listen_protocol_s, node, node)->handed_off = 1;
+    }
+    fio_unlock(&fio_listen_list_lock);
+    fio_close(uuid);
+    fio_stop();
+  }
+  (void)pr;
+}
+
+static void fio_hot_restart_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  if (uuid != fio_hot_restart_data.uuid)
+    return; /* the socket was closed by `fio_on_fork` */
+  fio_hot_restart_data.uuid = -1;
+  if (!fio_hot_restart_data.ready)
+    FIO_LOG_ERROR("(%d) hot restart failed, the new process exited before it "
+                  "was running.",
+                  getpid());
+  (void)pr;
+}
+
+static fio_protocol_s fio_hot_restart_protocol = {
+    .on_data = fio_hot_restart_on_data,
+    .on_close = fio_hot_restart_on_close,
+    .on_shutdown = mock_on_shutdown_eternal,
+    .ping = mock_ping_eternal,
+};
+
+/* called by `fio_start`, tells the old process to stop (once we're running) */
+static void fio_hot_restart_ready(void) {
+  if (fio_hot_restart_data.fd == -1 || !fio_data->active)
+    return;
+  ssize_t written;
+  do {
+    written = write(fio_hot_restart_data.fd, "R", 1);
+  } while (written == -1 && errno == EINTR);
+  /* closing now could deliver a hang-up before the "R" is read, so the socket
+   * is kept until the old process closes it */
+  fio_set_non_block(fio_hot_restart_data.fd);
+  fio_attach(fio_fd2uuid(fio_hot_restart_data.fd), &fio_hot_restart_protocol);
+  fio_hot_restart_data.fd = -1;
+  FIO_LOG_INFO("(hot restart) running, the old process will shut down.");
+}
+
+/* reads the process's original command line (Linux) */
+static char **fio_hot_restart_cmdline(char **pbuf) {
+  int fd = open("/proc/self/cmdline", O_RDONLY);
+  if (fd == -1)
+    return NULL;
+  size_t len = 0, capa = 4096;
+  char *buf = malloc(capa + 1);
+  FIO_ASSERT_ALLOC(buf);
+  ssize_t r;
+  while ((r = read(fd, buf + len, capa - len)) > 0 ||
+         (r == -1 && errno == EINTR)) {
+    if (r == -1)
+      continue;
+    len += r;
+    if (len == capa) {
+      capa <<= 1;
+      buf = realloc(buf, capa + 1);
+      FIO_ASSERT_ALLOC(buf);
+    }
   }
+  close(fd);
+  buf[len] = 0;
+  size_t argc = 0;
+  for (size_t i = 0; i < len; ++i)
+    argc += !buf[i];
+  if (!len || !argc) {
+    free(buf);
+    return NULL;
+  }
+  char **argv = malloc(sizeof(*argv) * (argc + 1));
+  FIO_ASSERT_ALLOC(argv);
+  char *pos = buf;
+  for (size_t i = 0; i < argc; ++i) {
+    argv[i] = pos;
+    pos += strlen(pos) + 1;
+  }
+  argv[argc] = NULL;
+  *pbuf = buf;
+  return argv;
 }
 
-static void fio_listen_on_data_tls(intptr_t uuid, fio_protocol_s *pr_) {
-  fio_listen_protocol_s *pr = (fio_listen_protocol_s *)pr_;
-  for (int i = 0; i < 4; ++i) {
-    intptr_t client = fio_accept(uuid);
-    if (client == -1)
-      return;
-    fio_tls_accept(client, pr->tls, pr->udata);
-    pr->on_open(client, pr->udata);
+/* public API. */
+int fio_hot_restart(void) {
+  if (!fio_data->active || !fio_is_master() ||
+      fio_hot_restart_data.uuid != -1 || fio_hot_restart_data.ready) {
+    FIO_LOG_WARNING("(hot restart) ignored, not running or already running.");
+    errno = EINVAL;
+    return -1;
+  }
+  char *cmdline = NULL;
+  char **argv = (char **)fio_hot_restart_data.argv;
+  if (!argv && !(argv = fio_hot_restart_cmdline(&cmdline))) {
+    FIO_LOG_ERROR("(hot restart) unknown command line, set `fio_start`'s "
+                  "`argv`.");
+    errno = ENOENT;
+    return -1;
+  }
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+    FIO_LOG_ERROR("(hot restart) couldn't open a Unix socket pair: %s",
+                  strerror(errno));
+    goto error;
+  }
+  /* the messages are buffered by the socket until the new process reads them */
+  fio_lock(&fio_listen_list_lock);
+  FIO_LS_EMBD_FOR(&fio_listen_list, node) {
+    fio_listen_protocol_s *pr =
+        FIO_LS_EMBD_OBJ(fio_listen_protocol_s, node, node);
+    if (fio_is_closed(pr->uuid))
+      continue; /* a `reuse_port` socket, opened by each worker */
+    if (fio_hot_restart_send(fds[0], 'L', (pr->port_len ? pr->port : NULL),
+                             (pr->addr_len ? pr->addr : NULL),
+                             fio_uuid2fd(pr->uuid)))
+      FIO_LOG_WARNING("(hot restart) couldn't pass on the socket for %s: %s",
+                      (pr->port_len ? pr->port : pr->addr), strerror(errno));
+  }
+  fio_unlock(&fio_listen_list_lock);
+  fio_hot_restart_send(fds[0], 'E', NULL, NULL, -1);
+
+  char env[16];
+  snprintf(env, sizeof(env), "%d", fds[1]);
+  setenv(FIO_HOT_RESTART_ENV, env, 1);
+  pid_t child = fork();
+  if (!child) {
+    /* fork again, so the new process isn't a child of the old process */
+    if (fork())
+      _exit(0);
+    setpgid(0, 0);
+    for (int i = 3; i < (int)fio_data->capa; ++i) {
+      if (i != fds[1])
+        close(i);
+    }
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  unsetenv(FIO_HOT_RESTART_ENV);
+  close(fds[1]);
+  if (child == -1) {
+    FIO_LOG_ERROR("(hot restart) couldn't fork: %s", strerror(errno));
+    close(fds[0]);
+    goto error;
   }
+  while (waitpid(child, NULL, 0) == -1 && errno == EINTR)
+    ;
+  FIO_LOG_INFO("(%d) hot restart: starting %s", getpid(), argv[0]);
+  fio_hot_restart_data.uuid = fio_fd2uuid(fds[0]);
+  fio_set_non_block(fds[0]);
+  fio_attach(fio_hot_restart_data.uuid, &fio_hot_restart_protocol);
+  if (cmdline)
+    free(argv);
+  free(cmdline);
+  return 0;
+error:
+  if (cmdline)
+    free(argv);
+  free(cmdline);
+  return -1;
 }
 
-static void fio_listen_on_data_tls_alpn(intptr_t uuid, fio_protocol_s *pr_) {
-  fio_listen_protocol_s *pr = (fio_listen_protocol_s *)pr_;
-  for (int i = 0; i < 4; ++i) {
-    intptr_t client = fio_accept(uuid);
-    if (client == -1)
-      return;
-    fio_tls_accept(client, pr->tls, pr->udata);
-  }
+#else /* FIO_DISABLE_HOT_RESTART */
+
+#define fio_hot_restart_inherited(address, port) ((intptr_t)-1)
+static void fio_hot_restart_start(char *const *argv) { (void)argv; }
+static void fio_hot_restart_ready(void) {}
+static void fio_hot_restart_on_fork(void) {}
+
+/* public API. */
+int fio_hot_restart(void) {
+  errno = ENOTSUP;
+  return -1;
 }
 
+#endif /* FIO_DISABLE_HOT_RESTART */
+
 /* stub for editor - unused */
 void fio_listen____(void);
 /**
@@ -4500,7 +7780,18 @@ intptr_t fio_listen FIO_IGNORE_MACRO(struct fio_listen_args args) {
       goto error;
     }
   }
-  const intptr_t uuid = fio_socket(args.address, args.port, 1);
+#ifndef SO_REUSEPORT
+  if (args.reuse_port)
+    FIO_LOG_WARNING("(fio_listen) reuse_port is unsupported on this system.");
+  args.reuse_port = 0;
+#endif
+  if (!port_len || args.port[0] == '-')
+    args.reuse_port = 0; /* Unix sockets can't share an address */
+  intptr_t uuid = fio_hot_restart_inherited(args.address, args.port);
+  if (uuid == -1)
+    uuid = (args.reuse_port
+                ? fio_listen_reuse_port_socket(args.address, args.port)
+                : fio_socket(args.address, args.port, 1));
   if (uuid == -1)
     goto error;
 
@@ -4531,18 +7822,32 @@ intptr_t fio_listen FIO_IGNORE_MACRO(struct fio_listen_args args) {
       .port_len = port_len,
       .addr = (char *)(pr + 1),
       .port = ((char *)(pr + 1) + addr_len + 1),
+      .send_buffer = args.send_buffer,
+      .recv_buffer = args.recv_buffer,
+      .accept_batch = (args.accept_batch ? args.accept_batch : 16),
+      .defer_accept = args.defer_accept,
+      .fast_open = args.fast_open,
+      .busy_poll = args.busy_poll,
+      .reuse_port = args.reuse_port,
+      .tcp_delay = args.tcp_delay,
   };
 
   if (addr_len)
     memcpy(pr->addr, args.address, addr_len + 1);
   if (port_len)
     memcpy(pr->port, args.port, port_len + 1);
+  fio_listen_sockopt(pr);
+  fio_lock(&fio_listen_list_lock);
+  fio_ls_embd_push(&fio_listen_list, &pr->node);
+  fio_unlock(&fio_listen_list_lock);
 
   if (fio_is_running()) {
     fio_attach(pr->uuid, &pr->pr);
   } else {
     fio_state_callback_add(FIO_CALL_ON_START, fio_listen_on_startup, pr);
     fio_state_callback_add(FIO_CALL_ON_SHUTDOWN, fio_listen_cleanup_task, pr);
+    if (pr->reuse_port)
+      fio_state_callback_add(FIO_CALL_PRE_START, fio_listen_on_pre_start, pr);
   }
 
   if (args.port)
@@ -4651,6 +7956,264 @@ static void fio_connect_on_ready_tls_alpn(intptr_t uuid, fio_protocol_s *pr_) {
   (void)uuid;
 }
 
+/* *****************************************************************************
+Asynchronous DNS resolution (for `fio_connect`)
+
+Host names are resolved by a helper thread, so a slow lookup doesn't block the
+reactor. The connection's socket (and uuid) is reserved right away and
+connected once the address is known (the result is reported using `fio_defer`).
+
+`getaddrinfo` doesn't report the records' TTL, so resolved addresses are cached
+for `FIO_DNS_CACHE_TTL` seconds.
+***************************************************************************** */
+
+#ifndef FIO_DNS_CACHE_TTL
+/** The number of seconds a resolved address is cached. */
+#define FIO_DNS_CACHE_TTL 60
+#endif
+#ifndef FIO_DNS_CACHE_LIMIT
+/** The maximum number of host names cached (the cache is cleared when full). */
+#define FIO_DNS_CACHE_LIMIT 256
+#endif
+#ifndef FIO_DNS_ADDR_LIMIT
+/** The maximum number of addresses cached for each host name. */
+#define FIO_DNS_ADDR_LIMIT 4
+#endif
+
+typedef struct {
+  time_t expires;
+  size_t count;
+  socklen_t len[FIO_DNS_ADDR_LIMIT];
+  union {
+    struct sockaddr sa;
+    struct sockaddr_in in4;
+    struct sockaddr_in6 in6;
+  } addr[FIO_DNS_ADDR_LIMIT];
+} fio_dns_s;
+
+#define FIO_FORCE_MALLOC_TMP 1
+#define FIO_SET_NAME fio_dns_set
+#define FIO_SET_OBJ_TYPE fio_dns_s
+#define FIO_SET_KEY_TYPE fio_str_s
+#define FIO_SET_KEY_COPY(k1, k2)                                               \
+  (k1) = FIO_STR_INIT;                                                         \
+  fio_str_concat(&(k1), &(k2))
+#define FIO_SET_KEY_COMPARE(k1, k2) fio_str_iseq(&(k1), &(k2))
+#define FIO_SET_KEY_DESTROY(key) fio_str_free(&(key))
+#include <fio.h>
+
+static fio_dns_set_s fio_dns_cache_data = FIO_SET_INIT;
+static fio_lock_i fio_dns_cache_lock = FIO_LOCK_INIT;
+
+/* a host name that needs resolving, in "host:port" format */
+typedef struct {
+  intptr_t uuid;
+  fio_connect_protocol_s *pr;
+  fio_dns_s dns;
+  size_t host_len;
+  char *port;
+  char host[];
+} fio_dns_request_s;
+
+/* Returns 1 if the address is a host name (rather than an IP address). */
+static int fio_dns_is_host_name(const char *address, const char *port) {
+  if (!address || !port)
+    return 0;
+  char *pos = (char *)port;
+  if (fio_atol(&pos) <= 0 || *pos)
+    return 0; /* Unix socket or invalid port, let `fio_socket` handle these */
+  union {
+    struct in_addr in4;
+    struct in6_addr in6;
+  } tmp;
+  return inet_pton(AF_INET, address, &tmp) != 1 &&
+         inet_pton(AF_INET6, address, &tmp) != 1;
+}
+
+/* Copies a cached (unexpired) address to `dns`. Returns -1 on a cache miss. */
+static int fio_dns_cache_find(fio_dns_s *dns, const char *host,
+                              size_t host_len) {
+  fio_str_s key = FIO_STR_INIT_STATIC2(host, host_len);
+  const uint64_t hash = fio_dns_set_hash(host, host_len);
+  fio_lock(&fio_dns_cache_lock);
+  *dns = fio_dns_set_find(&fio_dns_cache_data, hash, key);
+  fio_unlock(&fio_dns_cache_lock);
+  if (!dns->count || dns->expires <= fio_last_tick().tv_sec)
+    return -1;
+  return 0;
+}
+
+/* Resolves `host` (blocking), caching the result. Returns -1 on error. */
+static int fio_dns_lookup(fio_dns_s *dns, const char *host, size_t host_len,
+                          const char *port) {
+  struct addrinfo hints = {0};
+  struct addrinfo *addrinfo;
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  *dns = (fio_dns_s){.count = 0};
+  /* the host name is followed by ":port", which should be ignored */
+  char name[NI_MAXHOST];
+  if (host_len - strlen(port) - 1 >= sizeof(name))
+    return -1;
+  memcpy(name, host, host_len - strlen(port) - 1);
+  name[host_len - strlen(port) - 1] = 0;
+  if (getaddrinfo(name, port, &hints, &addrinfo))
+    return -1;
+  for (struct addrinfo *i = addrinfo; i && dns->count < FIO_DNS_ADDR_LIMIT;
+       i = i->ai_next) {
+    if ((i->ai_family != AF_INET && i->ai_family != AF_INET6) ||
+        i->ai_addrlen > sizeof(dns->addr[0]))
+      continue;
+    memcpy(dns->addr + dns->count, i->ai_addr, i->ai_addrlen);
+    dns->len[dns->count] = i->ai_addrlen;
+    ++dns->count;
+  }
+  freeaddrinfo(addrinfo);
+  if (!dns->count)
+    return -1;
+  dns->expires = fio_last_tick().tv_sec + FIO_DNS_CACHE_TTL;
+  fio_str_s key = FIO_STR_INIT_STATIC2(host, host_len);
+  const uint64_t hash = fio_dns_set_hash(host, host_len);
+  fio_lock(&fio_dns_cache_lock);
+  if (fio_dns_set_count(&fio_dns_cache_data) >= FIO_DNS_CACHE_LIMIT)
+    fio_dns_set_free(&fio_dns_cache_data);
+  fio_dns_set_insert(&fio_dns_cache_data, hash, key, *dns, NULL);
+  fio_unlock(&fio_dns_cache_lock);
+  return 0;
+}
+
+/* Connects a reserved socket to the first address that accepts it. */
+static int fio_dns_connect(int fd, fio_dns_s *dns) {
+  int family = AF_INET; /* reserved sockets start out as IPv4 sockets */
+  for (size_t i = 0; i < dns->count; ++i) {
+    if (dns->addr[i].sa.sa_family != family) {
+      /* replace the socket, keeping the file descriptor (and uuid) */
+      int tmp = socket(dns->addr[i].sa.sa_family, SOCK_STREAM, IPPROTO_TCP);
+      if (tmp == -1)
+        continue;
+      if (fio_set_non_block(tmp) < 0 || dup2(tmp, fd) == -1) {
+        close(tmp);
+        continue;
+      }
+      close(tmp);
+      family = dns->addr[i].sa.sa_family;
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    errno = 0;
+    if (connect(fd, &dns->addr[i].sa, dns->len[i]) == 0 ||
+        errno == EINPROGRESS) {
+      fio_tcp_addr_cpy(fd, family, &dns->addr[i].sa);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/* Reports the lookup's result, attaching (or failing) the connection. */
+static void fio_dns_on_resolved(void *req_, void *ignr) {
+  fio_dns_request_s *req = req_;
+  if (!fio_is_valid(req->uuid)) {
+    /* the connection was closed while resolving */
+    fio_connect_on_close(req->uuid, &req->pr->pr);
+  } else if (!req->dns.count ||
+             fio_dns_connect(fio_uuid2fd(req->uuid), &req->dns)) {
+    FIO_LOG_DEBUG("(fio_connect) couldn't connect to %.*s",
+                  (int)req->host_len, req->host);
+    fio_force_close(req->uuid);
+    fio_connect_on_close(req->uuid, &req->pr->pr);
+  } else {
+    fio_attach(req->uuid, &req->pr->pr);
+  }
+  free(req);
+  (void)ignr;
+}
+
+/* The helper thread's task. */
+static void *fio_dns_resolve_task(void *req_) {
+  fio_dns_request_s *req = req_;
+  fio_dns_lookup(&req->dns, req->host, req->host_len, req->port);
+  fio_defer(fio_dns_on_resolved, req, NULL);
+  return NULL;
+}
+
+/*
+ * Reserves a socket for a host name connection. If the host name was resolved
+ * recently, the socket is connected, otherwise a request is returned (using
+ * `preq`) and the socket will be connected once `fio_dns_resolve` is done.
+ */
+static intptr_t fio_dns_socket(const char *address, const char *port,
+                               fio_dns_request_s **preq) {
+  const size_t addr_len = strlen(address);
+  const size_t port_len = strlen(port);
+  fio_dns_request_s *req =
+      malloc(sizeof(*req) + addr_len + port_len + 2); /* "host:port\0" */
+  FIO_ASSERT_ALLOC(req);
+  memcpy(req->host, address, addr_len);
+  req->host[addr_len] = ':';
+  req->port = req->host + addr_len + 1;
+  memcpy(req->port, port, port_len + 1);
+  req->host_len = addr_len + port_len + 1;
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (fd == -1)
+    goto error;
+  if (fio_set_non_block(fd) < 0) {
+    close(fd);
+    goto error;
+  }
+  {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+  if (!fio_dns_cache_find(&req->dns, req->host, req->host_len)) {
+    if (fio_dns_connect(fd, &req->dns)) {
+      close(fd);
+      goto error;
+    }
+    free(req);
+    req = NULL;
+  }
+  fio_lock(&fd_data(fd).protocol_lock);
+  fio_clear_fd(fd, 1);
+  fio_unlock(&fd_data(fd).protocol_lock);
+  if (req)
+    req->uuid = fd2uuid(fd);
+  *preq = req;
+  return fd2uuid(fd);
+error:
+  free(req);
+  return -1;
+}
+
+/* Resolves the request's host name using a helper thread. */
+static void fio_dns_resolve(fio_dns_request_s *req,
+                            fio_connect_protocol_s *pr) {
+  req->pr = pr;
+  void *thrd = fio_thread_new(fio_dns_resolve_task, req);
+  if (!thrd) {
+    FIO_LOG_WARNING("(fio_connect) couldn't spawn a DNS thread, resolving "
+                    "%.*s in the reactor",
+                    (int)req->host_len, req->host);
+    fio_dns_resolve_task(req);
+    return;
+  }
+  fio_thread_free(thrd);
+}
+
+/* resets the DNS cache lock, in case a helper thread held it while forking */
+static void fio_dns_on_fork(void) { fio_dns_cache_lock = FIO_LOCK_INIT; }
+
+/* clears the DNS cache */
+static void fio_dns_cache_clear(void) {
+  fio_lock(&fio_dns_cache_lock);
+  fio_dns_set_free(&fio_dns_cache_data);
+  fio_unlock(&fio_dns_cache_lock);
+}
+
+/* *****************************************************************************
+Connecting to remote servers
+***************************************************************************** */
+
 /* stub for sublime text function navigation */
 intptr_t fio_connect___(struct fio_connect_args args);
 
@@ -4660,7 +8223,11 @@ intptr_t fio_connect FIO_IGNORE_MACRO(struct fio_connect_args args) {
     errno = EINVAL;
     goto error;
   }
-  const intptr_t uuid = fio_socket(args.address, args.port, 0);
+  fio_dns_request_s *req = NULL;
+  const intptr_t uuid =
+      (fio_dns_is_host_name(args.address, args.port)
+           ? fio_dns_socket(args.address, args.port, &req)
+           : fio_socket(args.address, args.port, 0));
   if (uuid == -1)
     goto error;
   fio_timeout_set(uuid, args.timeout);
@@ -4686,6 +8253,11 @@ intptr_t fio_connect FIO_IGNORE_MACRO(struct fio_connect_args args) {
       .on_connect = args.on_connect,
       .on_fail = args.on_fail,
   };
+  if (req) {
+    /* attached once the host name is resolved */
+    fio_dns_resolve(req, pr);
+    return uuid;
+  }
   fio_attach(uuid, &pr->pr);
   return uuid;
 error:
@@ -5065,8 +8637,14 @@ static channel_s *fio_channel_copy(channel_s *src) {
   dest->lock = FIO_LOCK_INIT;
   return dest;
 }
-/** Frees a channel (reference counting). */
-static void fio_channel_free(channel_s *ch) {
+/**
+ * Frees a channel (reference counting).
+ *
+ * Lookups pass a stack allocated key (with an extra reference) to the Set, so
+ * this is kept out of line, where the compiler can't mistake the key for a
+ * heap object.
+ */
+static __attribute__((noinline)) void fio_channel_free(channel_s *ch) {
   if (!ch)
     return;
   if (fio_atomic_sub(&ch->ref, 1))
@@ -5086,7 +8664,10 @@ static int fio_channel_cmp(channel_s *ch1, channel_s *ch2) {
 }
 /* pub/sub channels and core data sets have a long life, so avoid fio_malloc */
 #define FIO_FORCE_MALLOC_TMP 1
+/* channel names might be long (i.e., "user/1234/room/5678"), use wide lanes */
 #define FIO_SET_NAME fio_ch_set
+#define FIO_SET_HASH_FN(data, len)                                             \
+  fio_risky_hash_wide((data), (len), FIO_HASH_SECRET_SEED64_1)
 #define FIO_SET_OBJ_TYPE channel_s *
 #define FIO_SET_OBJ_COMPARE(o1, o2) fio_channel_cmp((o1), (o2))
 #define FIO_SET_OBJ_DESTROY(obj) fio_channel_free((obj))
@@ -5098,19 +8679,29 @@ static int fio_channel_cmp(channel_s *ch1, channel_s *ch2) {
 #define FIO_ARY_TYPE fio_msg_metadata_fn
 #include <fio.h>
 
+#define FIO_FORCE_MALLOC_TMP 1
+#define FIO_ARY_NAME fio_ch_ary
+#define FIO_ARY_TYPE channel_s *
+#include <fio.h>
+
 #define FIO_FORCE_MALLOC_TMP 1
 #define FIO_SET_NAME fio_engine_set
 #define FIO_SET_OBJ_TYPE fio_pubsub_engine_s *
 #define FIO_SET_OBJ_COMPARE(k1, k2) ((k1) == (k2))
 #include <fio.h>
 
+/*
+ * Channels are looked up for every published message, while subscriptions
+ * change far less often, so lookups share the collection (read lock) and only
+ * changes are exclusive (write lock).
+ */
 struct fio_collection_s {
   fio_ch_set_s channels;
-  fio_lock_i lock;
+  fio_rwlock_s lock;
 };
 
 #define COLLECTION_INIT                                                        \
-  { .channels = FIO_SET_INIT, .lock = FIO_LOCK_INIT }
+  { .channels = FIO_SET_INIT, .lock = FIO_RWLOCK_INIT }
 
 static struct {
   fio_collection_s filters;
@@ -5303,9 +8894,9 @@ Cluster forking handler
 ***************************************************************************** */
 
 static void fio_pubsub_on_fork(void) {
-  fio_postoffice.filters.lock = FIO_LOCK_INIT;
-  fio_postoffice.pubsub.lock = FIO_LOCK_INIT;
-  fio_postoffice.patterns.lock = FIO_LOCK_INIT;
+  fio_postoffice.filters.lock = (fio_rwlock_s)FIO_RWLOCK_INIT;
+  fio_postoffice.pubsub.lock = (fio_rwlock_s)FIO_RWLOCK_INIT;
+  fio_postoffice.patterns.lock = (fio_rwlock_s)FIO_RWLOCK_INIT;
   fio_postoffice.engines.lock = FIO_LOCK_INIT;
   fio_postoffice.meta.lock = FIO_LOCK_INIT;
   FIO_SET_FOR_LOOP(&fio_postoffice.filters.channels, pos) {
@@ -5334,6 +8925,140 @@ static void fio_pubsub_on_fork(void) {
   }
 }
 
+/* *****************************************************************************
+Pattern Index - a prefix trie of the glob patterns' literal prefix
+***************************************************************************** */
+
+/*
+ * Glob patterns are stored in the trie node matching their literal prefix (the
+ * part before the first wildcard), so publishing only tests the patterns along
+ * the channel name's path. Patterns with custom match functions (and patterns
+ * starting with a wildcard) are stored in the root node and always tested.
+ *
+ * The index is protected by the `fio_postoffice.patterns.lock` (matching
+ * requires read access and changing the index requires write access).
+ */
+
+typedef struct fio_pattern_node_s fio_pattern_node_s;
+
+#define FIO_FORCE_MALLOC_TMP 1
+#define FIO_ARY_NAME fio_pattern_node_ary
+#define FIO_ARY_TYPE fio_pattern_node_s *
+#include <fio.h>
+
+struct fio_pattern_node_s {
+  fio_pattern_node_ary_s children;
+  fio_ch_ary_s patterns;
+  uint8_t ch;
+};
+
+static fio_pattern_node_s fio_pattern_index = {
+    .children = FIO_ARY_INIT, .patterns = FIO_ARY_INIT};
+
+static int fio_glob_match(fio_str_info_s pat, fio_str_info_s ch);
+
+/* returns the child node for the byte `ch` (or NULL) */
+static inline fio_pattern_node_s *
+fio_pattern_node_child(fio_pattern_node_s *node, uint8_t ch) {
+  FIO_ARY_FOR(&node->children, pos) {
+    if ((*pos)->ch == ch)
+      return *pos;
+  }
+  return NULL;
+}
+
+/* reads the next byte of a glob pattern's literal prefix (0 when done) */
+static inline int fio_pattern_prefix_next(channel_s *ch, size_t *i,
+                                          uint8_t *c) {
+  if (ch->match != fio_glob_match || *i >= ch->name_len)
+    return 0;
+  *c = (uint8_t)ch->name[*i];
+  if (*c == '*' || *c == '?' || *c == '[')
+    return 0;
+  if (*c == '\\') {
+    if (++(*i) >= ch->name_len)
+      return 0;
+    *c = (uint8_t)ch->name[*i];
+  }
+  ++(*i);
+  return 1;
+}
+
+/* frees all of a node's children (the node itself isn't freed) */
+static void fio_pattern_index_clear(fio_pattern_node_s *node) {
+  FIO_ARY_FOR(&node->children, pos) {
+    fio_pattern_index_clear(*pos);
+    free(*pos);
+  }
+  fio_pattern_node_ary_free(&node->children);
+  fio_ch_ary_free(&node->patterns);
+}
+
+/** Adds a pattern channel to the index (call within the patterns lock). */
+static void fio_pattern_index_add(channel_s *ch) {
+  fio_pattern_node_s *node = &fio_pattern_index;
+  uint8_t c;
+  for (size_t i = 0; fio_pattern_prefix_next(ch, &i, &c);) {
+    fio_pattern_node_s *child = fio_pattern_node_child(node, c);
+    if (!child) {
+      child = malloc(sizeof(*child));
+      FIO_ASSERT_ALLOC(child);
+      *child = (fio_pattern_node_s){
+          .children = FIO_ARY_INIT, .patterns = FIO_ARY_INIT, .ch = c};
+      fio_pattern_node_ary_push(&node->children, child);
+    }
+    node = child;
+  }
+  fio_ch_ary_push(&node->patterns, ch);
+}
+
+/** Removes a pattern channel from the index (call within the patterns lock). */
+static void fio_pattern_index_remove(channel_s *ch) {
+  /* the last node to keep and the branch to be pruned */
+  fio_pattern_node_s *keep = &fio_pattern_index, *prune = NULL;
+  fio_pattern_node_s *node = &fio_pattern_index;
+  uint8_t c;
+  for (size_t i = 0; fio_pattern_prefix_next(ch, &i, &c);) {
+    fio_pattern_node_s *child = fio_pattern_node_child(node, c);
+    if (!child)
+      return;
+    if (node == &fio_pattern_index || fio_ch_ary_count(&node->patterns) ||
+        fio_pattern_node_ary_count(&node->children) > 1) {
+      keep = node;
+      prune = child;
+    }
+    node = child;
+  }
+  if (fio_ch_ary_remove2(&node->patterns, ch, NULL))
+    return;
+  if (node == &fio_pattern_index || fio_ch_ary_count(&node->patterns) ||
+      fio_pattern_node_ary_count(&node->children))
+    return;
+  fio_pattern_node_ary_remove2(&keep->children, prune, NULL);
+  fio_pattern_index_clear(prune);
+  free(prune);
+}
+
+/* calls `task` for every pattern matching the channel (within the lock) */
+static void fio_pattern_index_match(fio_str_info_s channel,
+                                    void (*task)(channel_s *, void *),
+                                    void *arg) {
+  fio_pattern_node_s *node = &fio_pattern_index;
+  size_t i = 0;
+  for (;;) {
+    FIO_ARY_FOR(&node->patterns, pos) {
+      channel_s *p = *pos;
+      if (p->match((fio_str_info_s){.data = p->name, .len = p->name_len},
+                   channel))
+        task(p, arg);
+    }
+    if (i == channel.len ||
+        !(node = fio_pattern_node_child(node, (uint8_t)channel.data[i])))
+      return;
+    ++i;
+  }
+}
+
 /* *****************************************************************************
 Channel Subscription Management
 ***************************************************************************** */
@@ -5345,11 +9070,11 @@ static void pubsub_on_channel_destroy(channel_s *ch);
 static inline channel_s *fio_filter_dup_lock_internal(channel_s *ch,
                                                       uint64_t hashed,
                                                       fio_collection_s *c) {
-  fio_lock(&c->lock);
+  fio_rwlock_write(&c->lock);
   ch = fio_ch_set_insert(&c->channels, hashed, ch);
   fio_channel_dup(ch);
   fio_lock(&ch->lock);
-  fio_unlock(&c->lock);
+  fio_rwlock_write_unlock(&c->lock);
   return ch;
 }
 
@@ -5372,8 +9097,7 @@ static channel_s *fio_channel_dup_lock(fio_str_info_s name) {
       .parent = &fio_postoffice.pubsub,
       .ref = 8, /* avoid freeing stack memory */
   };
-  uint64_t hashed_name = FIO_HASH_FN(
-      name.data, name.len, &fio_postoffice.pubsub, &fio_postoffice.pubsub);
+  uint64_t hashed_name = fio_ch_set_hash(name.data, name.len);
   channel_s *ch_p =
       fio_filter_dup_lock_internal(&ch, hashed_name, &fio_postoffice.pubsub);
   if (fio_ls_embd_is_empty(&ch_p->subscriptions)) {
@@ -5392,10 +9116,16 @@ static channel_s *fio_channel_match_dup_lock(fio_str_info_s name,
       .match = match,
       .ref = 8, /* avoid freeing stack memory */
   };
-  uint64_t hashed_name = FIO_HASH_FN(
-      name.data, name.len, &fio_postoffice.pubsub, &fio_postoffice.pubsub);
-  channel_s *ch_p =
-      fio_filter_dup_lock_internal(&ch, hashed_name, &fio_postoffice.patterns);
+  uint64_t hashed_name = fio_ch_set_hash(name.data, name.len);
+  fio_collection_s *c = &fio_postoffice.patterns;
+  fio_rwlock_write(&c->lock);
+  const size_t count = fio_ch_set_count(&c->channels);
+  channel_s *ch_p = fio_ch_set_insert(&c->channels, hashed_name, &ch);
+  if (fio_ch_set_count(&c->channels) != count)
+    fio_pattern_index_add(ch_p);
+  fio_channel_dup(ch_p);
+  fio_lock(&ch_p->lock);
+  fio_rwlock_write_unlock(&c->lock);
   if (fio_ls_embd_is_empty(&ch_p->subscriptions)) {
     pubsub_on_channel_create(ch_p);
   }
@@ -5460,16 +9190,17 @@ void fio_unsubscribe(subscription_s *s) {
   /* check if channel is done for */
   if (fio_ls_embd_is_empty(&ch->subscriptions)) {
     fio_collection_s *c = ch->parent;
-    uint64_t hashed = FIO_HASH_FN(
-        ch->name, ch->name_len, &fio_postoffice.pubsub, &fio_postoffice.pubsub);
+    uint64_t hashed = fio_ch_set_hash(ch->name, ch->name_len);
     /* lock collection */
-    fio_lock(&c->lock);
+    fio_rwlock_write(&c->lock);
     /* test again within lock */
     if (fio_ls_embd_is_empty(&ch->subscriptions)) {
+      if (c == &fio_postoffice.patterns)
+        fio_pattern_index_remove(ch);
       fio_ch_set_remove(&c->channels, hashed, ch, NULL);
       removed = (c != &fio_postoffice.filters);
     }
-    fio_unlock(&c->lock);
+    fio_rwlock_write_unlock(&c->lock);
   }
   fio_unlock(&ch->lock);
   if (removed) {
@@ -5581,7 +9312,7 @@ int fio_pubsub_is_attached(fio_pubsub_engine_s *engine) {
  * exclusive subscription process.
  */
 void fio_pubsub_reattach(fio_pubsub_engine_s *eng) {
-  fio_lock(&fio_postoffice.pubsub.lock);
+  fio_rwlock_read(&fio_postoffice.pubsub.lock);
   FIO_SET_FOR_LOOP(&fio_postoffice.pubsub.channels, pos) {
     if (!pos->hash)
       continue;
@@ -5590,8 +9321,8 @@ void fio_pubsub_reattach(fio_pubsub_engine_s *eng) {
         (fio_str_info_s){.data = pos->obj->name, .len = pos->obj->name_len},
         NULL);
   }
-  fio_unlock(&fio_postoffice.pubsub.lock);
-  fio_lock(&fio_postoffice.patterns.lock);
+  fio_rwlock_read_unlock(&fio_postoffice.pubsub.lock);
+  fio_rwlock_read(&fio_postoffice.patterns.lock);
   FIO_SET_FOR_LOOP(&fio_postoffice.patterns.channels, pos) {
     if (!pos->hash)
       continue;
@@ -5600,7 +9331,7 @@ void fio_pubsub_reattach(fio_pubsub_engine_s *eng) {
         (fio_str_info_s){.data = pos->obj->name, .len = pos->obj->name_len},
         pos->obj->match);
   }
-  fio_unlock(&fio_postoffice.patterns.lock);
+  fio_rwlock_read_unlock(&fio_postoffice.patterns.lock);
 }
 
 /* *****************************************************************************
@@ -5638,14 +9369,14 @@ void *fio_message_metadata(fio_msg_s *msg, intptr_t type_id) {
 static channel_s *fio_channel_find_dup_internal(channel_s *ch_tmp,
                                                 uint64_t hashed,
                                                 fio_collection_s *c) {
-  fio_lock(&c->lock);
-  channel_s *ch = fio_ch_set_find(&c->channels, hashed, ch_tmp);
+  fio_rwlock_read(&c->lock);
+  channel_s *ch = fio_ch_set_find_shared(&c->channels, hashed, ch_tmp);
   if (!ch) {
-    fio_unlock(&c->lock);
+    fio_rwlock_read_unlock(&c->lock);
     return NULL;
   }
   fio_channel_dup(ch);
-  fio_unlock(&c->lock);
+  fio_rwlock_read_unlock(&c->lock);
   return ch;
 }
 
@@ -5660,8 +9391,7 @@ static channel_s *fio_filter_find_dup(uint32_t filter) {
 /** Finds a pubsub channel, increasing it's reference count if it exists. */
 static channel_s *fio_channel_find_dup(fio_str_info_s name) {
   channel_s tmp = {.name = name.data, .name_len = name.len};
-  uint64_t hashed_name = FIO_HASH_FN(
-      name.data, name.len, &fio_postoffice.pubsub, &fio_postoffice.pubsub);
+  uint64_t hashed_name = fio_ch_set_hash(name.data, name.len);
   channel_s *ch =
       fio_channel_find_dup_internal(&tmp, hashed_name, &fio_postoffice.pubsub);
   return ch;
@@ -5696,14 +9426,13 @@ void fio_message_defer(fio_msg_s *msg_) {
   cl->marker = 1;
 }
 
-/* performs the actual callback */
-static void fio_perform_subscription_callback(void *s_, void *msg_) {
-  subscription_s *s = s_;
-  if (fio_trylock(&s->lock)) {
-    fio_defer_push_task(fio_perform_subscription_callback, s_, msg_);
-    return;
-  }
-  fio_msg_internal_s *msg = (fio_msg_internal_s *)msg_;
+/**
+ * Performs the callback while the subscription is locked, unlocking it.
+ *
+ * Returns 1 if the message was deferred (`fio_message_defer`).
+ */
+static inline uint8_t fio_subscription_deliver(subscription_s *s,
+                                               fio_msg_internal_s *msg) {
   fio_msg_client_s m = {
       .msg =
           {
@@ -5720,27 +9449,89 @@ static void fio_perform_subscription_callback(void *s_, void *msg_) {
   if (s->on_message) {
     /* the on_message callback is removed when a subscription is canceled. */
     s->on_message(&m.msg);
+    if (!m.marker)
+      fio_metric_add(FIO_METRIC_DELIVERED, 1);
   }
   fio_unlock(&s->lock);
-  if (m.marker) {
-    fio_defer_push_task(fio_perform_subscription_callback, s_, msg_);
+  return m.marker;
+}
+
+/* performs the actual callback */
+static void fio_perform_subscription_callback(void *s_, void *msg_) {
+  subscription_s *s = s_;
+  if (fio_trylock(&s->lock)) {
+    fio_defer_push_background(fio_perform_subscription_callback, s_, msg_);
+    return;
+  }
+  fio_msg_internal_s *msg = (fio_msg_internal_s *)msg_;
+  if (fio_subscription_deliver(s, msg)) {
+    fio_defer_push_background(fio_perform_subscription_callback, s_, msg_);
     return;
   }
   fio_msg_internal_free(msg);
   fio_subscription_free(s);
 }
 
+/* a batch of subscriptions sharing a delivery task (and a message reference) */
+typedef struct {
+  fio_msg_internal_s *msg;
+  size_t count;
+  subscription_s *subs[];
+} fio_subscription_batch_s;
+
+/* performs the callback for a batch of subscriptions */
+static void fio_perform_subscription_batch(void *b_, void *ignr_) {
+  fio_subscription_batch_s *b = b_;
+  for (size_t i = 0; i < b->count; ++i) {
+    subscription_s *s = b->subs[i];
+    /* busy or deferred subscriptions fall back to a task of their own */
+    if (fio_trylock(&s->lock) || fio_subscription_deliver(s, b->msg)) {
+      fio_defer_push_background(fio_perform_subscription_callback, s,
+                                fio_msg_internal_dup(b->msg));
+      continue;
+    }
+    fio_subscription_free(s);
+  }
+  fio_msg_internal_free(b->msg);
+  fio_free(b);
+  (void)ignr_;
+}
+
+/* schedules the delivery of a message to a batch of subscriptions */
+static void fio_publish2batch(subscription_s **subs, size_t count,
+                              fio_msg_internal_s *msg) {
+  if (count == 1) {
+    fio_defer_push_background(fio_perform_subscription_callback, subs[0],
+                              fio_msg_internal_dup(msg));
+    return;
+  }
+  fio_subscription_batch_s *b =
+      fio_malloc(sizeof(*b) + (count * sizeof(*subs)));
+  FIO_ASSERT_ALLOC(b);
+  b->msg = fio_msg_internal_dup(msg);
+  b->count = count;
+  memcpy(b->subs, subs, count * sizeof(*subs));
+  fio_defer_push_background(fio_perform_subscription_batch, b, NULL);
+}
+
 /** UNSAFE! publishes a message to a channel, managing the reference counts */
 static void fio_publish2channel(channel_s *ch, fio_msg_internal_s *msg) {
+  subscription_s *subs[FIO_PUBSUB_FANOUT_BATCH];
+  size_t count = 0;
   FIO_LS_EMBD_FOR(&ch->subscriptions, pos) {
     subscription_s *s = FIO_LS_EMBD_OBJ(subscription_s, node, pos);
     if (!s) {
       continue;
     }
     fio_atomic_add(&s->ref, 1);
-    fio_atomic_add(&msg->ref, 1);
-    fio_defer_push_task(fio_perform_subscription_callback, s, msg);
+    subs[count++] = s;
+    if (count == FIO_PUBSUB_FANOUT_BATCH) {
+      fio_publish2batch(subs, count, msg);
+      count = 0;
+    }
   }
+  if (count)
+    fio_publish2batch(subs, count, msg);
   fio_msg_internal_free(msg);
 }
 static void fio_publish2channel_task(void *ch_, void *msg) {
@@ -5759,6 +9550,13 @@ finish:
   fio_channel_free(ch);
 }
 
+/* schedules a message for a matching pattern channel */
+static void fio_publish2pattern(channel_s *ch, void *m) {
+  fio_channel_dup(ch);
+  fio_defer_push_urgent(fio_publish2channel_task, ch,
+                        fio_msg_internal_dup(m));
+}
+
 /** Publishes the message to the current process and frees the strings. */
 static void fio_publish2process(fio_msg_internal_s *m) {
   channel_s *ch;
@@ -5777,21 +9575,9 @@ static void fio_publish2process(fio_msg_internal_s *m) {
   }
   if (m->filter == 0) {
     /* pattern matching match */
-    fio_lock(&fio_postoffice.patterns.lock);
-    FIO_SET_FOR_LOOP(&fio_postoffice.patterns.channels, p) {
-      if (!p->hash) {
-        continue;
-      }
-
-      if (p->obj->match(
-              (fio_str_info_s){.data = p->obj->name, .len = p->obj->name_len},
-              m->channel)) {
-        fio_channel_dup(p->obj);
-        fio_defer_push_urgent(fio_publish2channel_task, p->obj,
-                              fio_msg_internal_dup(m));
-      }
-    }
-    fio_unlock(&fio_postoffice.patterns.lock);
+    fio_rwlock_read(&fio_postoffice.patterns.lock);
+    fio_pattern_index_match(m->channel, fio_publish2pattern, m);
+    fio_rwlock_read_unlock(&fio_postoffice.patterns.lock);
   }
 finish:
   fio_msg_internal_free(m);
@@ -5801,9 +9587,11 @@ finish:
  * Data Structures - Core Structures
  **************************************************************************** */
 
-#define CLUSTER_READ_BUFFER 16384
+#define CLUSTER_READ_BUFFER 65536
 
 #define FIO_SET_NAME fio_sub_hash
+#define FIO_SET_HASH_FN(data, len)                                             \
+  fio_risky_hash_wide((data), (len), FIO_HASH_SECRET_SEED64_1)
 #define FIO_SET_OBJ_TYPE subscription_s *
 #define FIO_SET_KEY_TYPE fio_str_s
 #define FIO_SET_KEY_COPY(k1, k2)                                               \
@@ -5833,13 +9621,77 @@ typedef struct cluster_pr_s {
   uint8_t buffer[CLUSTER_READ_BUFFER];
 } cluster_pr_s;
 
+/*
+ * Outgoing cluster messages are collected in an outbox (one per connection)
+ * and written once per reactor cycle, so a burst of messages costs a single
+ * `fio_write` (and system call) rather than one per message.
+ */
+typedef struct {
+  intptr_t uuid;
+  fio_str_s *data;
+  size_t ref;
+  fio_lock_i lock;
+  uint8_t scheduled;
+} fio_cluster_outbox_s;
+
 static struct cluster_data_s {
   intptr_t uuid;
   fio_ls_s clients;
   fio_lock_i lock;
+  fio_cluster_outbox_s outbox;
   char name[FIO_CLUSTER_NAME_LIMIT + 1];
 } cluster_data = {.clients = FIO_LS_INIT(cluster_data.clients),
-                  .lock = FIO_LOCK_INIT};
+                  .lock = FIO_LOCK_INIT,
+                  .outbox = {.ref = 1, .lock = FIO_LOCK_INIT}};
+
+static fio_cluster_outbox_s *fio_cluster_outbox_new(intptr_t uuid) {
+  fio_cluster_outbox_s *o = fio_malloc(sizeof(*o));
+  FIO_ASSERT_ALLOC(o);
+  *o = (fio_cluster_outbox_s){.uuid = uuid, .ref = 1, .lock = FIO_LOCK_INIT};
+  return o;
+}
+
+static void fio_cluster_outbox_free(fio_cluster_outbox_s *o) {
+  if (o == &cluster_data.outbox || fio_atomic_sub(&o->ref, 1))
+    return;
+  if (o->data)
+    fio_str_free2(o->data);
+  fio_free(o);
+}
+
+/** Writes any pending data (called from the reactor or during shutdown). */
+static void fio_cluster_outbox_send(fio_cluster_outbox_s *o) {
+  fio_lock(&o->lock);
+  if (o->data)
+    fio_str_send_free2(o->uuid, o->data);
+  o->data = NULL;
+  fio_unlock(&o->lock);
+}
+
+static void fio_cluster_outbox_flush(void *o_, void *ignr_) {
+  fio_cluster_outbox_s *o = o_;
+  fio_lock(&o->lock);
+  o->scheduled = 0;
+  fio_unlock(&o->lock);
+  fio_cluster_outbox_send(o);
+  fio_cluster_outbox_free(o);
+  (void)ignr_;
+}
+
+/** Adds a message to the outbox, scheduling a write if none is pending. */
+static void fio_cluster_outbox_push(fio_cluster_outbox_s *o, fio_str_s *msg) {
+  fio_lock(&o->lock);
+  if (!o->data) {
+    o->data = fio_str_new2();
+  }
+  fio_str_concat(o->data, msg);
+  if (!o->scheduled) {
+    o->scheduled = 1;
+    fio_atomic_add(&o->ref, 1);
+    fio_defer_push_task(fio_cluster_outbox_flush, o, NULL);
+  }
+  fio_unlock(&o->lock);
+}
 
 static void fio_cluster_data_cleanup(int delete_file) {
   if (delete_file && cluster_data.name[0]) {
@@ -5849,11 +9701,16 @@ static void fio_cluster_data_cleanup(int delete_file) {
     unlink(cluster_data.name);
   }
   while (fio_ls_any(&cluster_data.clients)) {
-    intptr_t uuid = (intptr_t)fio_ls_pop(&cluster_data.clients);
-    if (uuid > 0) {
-      fio_close(uuid);
+    fio_cluster_outbox_s *o = fio_ls_pop(&cluster_data.clients);
+    if (o->uuid > 0) {
+      fio_close(o->uuid);
     }
+    fio_cluster_outbox_free(o);
   }
+  if (cluster_data.outbox.data)
+    fio_str_free2(cluster_data.outbox.data);
+  cluster_data.outbox = (fio_cluster_outbox_s){.ref = 1,
+                                               .lock = FIO_LOCK_INIT};
   cluster_data.uuid = 0;
   cluster_data.lock = FIO_LOCK_INIT;
   cluster_data.clients = (fio_ls_s)FIO_LS_INIT(cluster_data.clients);
@@ -5911,32 +9768,133 @@ typedef struct cluster_msg_s {
   size_t ref;
 } cluster_msg_s;
 
+#if FIO_CLUSTER_COMPACT_HEADER
+/*
+ * Compact headers start with a flag byte: the message type (4 bits), a filter
+ * flag (0x10) and a "wide lengths" flag (0x20).
+ *
+ * Followed by the channel and message lengths (1 + 2 bytes, or 4 + 4 bytes
+ * when wide) and, when set, the filter (4 bytes).
+ */
+#define FIO_CLUSTER_HEADER_MAX 13
+#define FIO_CLUSTER_HEADER_FILTER 0x10
+#define FIO_CLUSTER_HEADER_WIDE 0x20
+
+/** Returns the length of the header (0 if not enough data was received). */
+static inline size_t fio_cluster_header_len(uint8_t *buf, size_t len) {
+  if (!len)
+    return 0;
+  size_t hlen = (buf[0] & FIO_CLUSTER_HEADER_WIDE) ? 9 : 4;
+  if (buf[0] & FIO_CLUSTER_HEADER_FILTER)
+    hlen += 4;
+  return hlen;
+}
+
+static inline size_t fio_cluster_header_write(uint8_t *buf, uint32_t ch_len,
+                                              uint32_t msg_len, uint32_t type,
+                                              int32_t filter) {
+  size_t pos;
+  buf[0] = (uint8_t)type;
+  if (ch_len <= 0xFF && msg_len <= 0xFFFF) {
+    buf[1] = (uint8_t)ch_len;
+    fio_u2str16(buf + 2, msg_len);
+    pos = 4;
+  } else {
+    buf[0] |= FIO_CLUSTER_HEADER_WIDE;
+    fio_u2str32(buf + 1, ch_len);
+    fio_u2str32(buf + 5, msg_len);
+    pos = 9;
+  }
+  if (filter) {
+    buf[0] |= FIO_CLUSTER_HEADER_FILTER;
+    fio_u2str32(buf + pos, (uint32_t)filter);
+    pos += 4;
+  }
+  return pos;
+}
+
+static inline void fio_cluster_header_read(cluster_pr_s *c, uint8_t *buf) {
+  size_t pos;
+  c->type = buf[0] & 0x0F;
+  if (buf[0] & FIO_CLUSTER_HEADER_WIDE) {
+    c->exp_channel = fio_str2u32(buf + 1);
+    c->exp_msg = fio_str2u32(buf + 5);
+    pos = 9;
+  } else {
+    c->exp_channel = buf[1];
+    c->exp_msg = fio_str2u16(buf + 2);
+    pos = 4;
+  }
+  c->filter = 0;
+  if (buf[0] & FIO_CLUSTER_HEADER_FILTER)
+    c->filter = (int32_t)fio_str2u32(buf + pos);
+}
+
+#else
+#define FIO_CLUSTER_HEADER_MAX 16
+
+static inline size_t fio_cluster_header_len(uint8_t *buf, size_t len) {
+  return 16;
+  (void)buf;
+  (void)len;
+}
+
+static inline size_t fio_cluster_header_write(uint8_t *buf, uint32_t ch_len,
+                                              uint32_t msg_len, uint32_t type,
+                                              int32_t filter) {
+  fio_u2str32(buf, ch_len);
+  fio_u2str32(buf + 4, msg_len);
+  fio_u2str32(buf + 8, type);
+  fio_u2str32(buf + 12, (uint32_t)filter);
+  return 16;
+}
+
+static inline void fio_cluster_header_read(cluster_pr_s *c, uint8_t *buf) {
+  c->exp_channel = fio_str2u32(buf);
+  c->exp_msg = fio_str2u32(buf + 4);
+  c->type = fio_str2u32(buf + 8);
+  c->filter = (int32_t)fio_str2u32(buf + 12);
+}
+#endif
+
 static inline fio_str_s *
 fio_cluster_wrap_message(uint32_t ch_len, uint32_t msg_len, uint32_t type,
                          int32_t filter, void *ch_data, void *msg_data) {
+  uint8_t head[FIO_CLUSTER_HEADER_MAX];
+  const size_t hlen =
+      fio_cluster_header_write(head, ch_len, msg_len, type, filter);
   fio_str_s *buf = fio_str_new2();
-  fio_str_info_s i = fio_str_resize(buf, ch_len + msg_len + 16);
-  fio_u2str32((uint8_t *)i.data, ch_len);
-  fio_u2str32((uint8_t *)(i.data + 4), msg_len);
-  fio_u2str32((uint8_t *)(i.data + 8), type);
-  fio_u2str32((uint8_t *)(i.data + 12), (uint32_t)filter);
+  fio_str_info_s i = fio_str_resize(buf, ch_len + msg_len + hlen);
+  memcpy(i.data, head, hlen);
   if (ch_len && ch_data) {
-    memcpy((i.data + 16), ch_data, ch_len);
+    memcpy((i.data + hlen), ch_data, ch_len);
   }
   if (msg_len && msg_data) {
-    memcpy((i.data + 16 + ch_len), msg_data, msg_len);
+    memcpy((i.data + hlen + ch_len), msg_data, msg_len);
   }
   return buf;
 }
 
 static inline void fio_cluster_protocol_free(void *pr) { fio_free(pr); }
 
+/** Writes all the pending outgoing data without waiting for the reactor. */
+static void fio_cluster_flush(void) {
+  fio_lock(&cluster_data.lock);
+  FIO_LS_FOR(&cluster_data.clients, pos) {
+    fio_cluster_outbox_send((fio_cluster_outbox_s *)pos->obj);
+  }
+  fio_unlock(&cluster_data.lock);
+  fio_cluster_outbox_send(&cluster_data.outbox);
+}
+
 static uint8_t fio_cluster_on_shutdown(intptr_t uuid, fio_protocol_s *pr_) {
   cluster_pr_s *p = (cluster_pr_s *)pr_;
   p->sender(
       fio_cluster_wrap_message(0, 0, FIO_CLUSTER_MSG_SHUTDOWN, 0, NULL, NULL),
       -1);
-  return 255;
+  fio_cluster_flush();
+  /* the root waits for the workers to hang up (or they'd see a crash) */
+  return (fio_data->is_worker ? 255 : 8);
   (void)pr_;
   (void)uuid;
 }
@@ -5951,12 +9909,11 @@ static void fio_cluster_on_data(intptr_t uuid, fio_protocol_s *pr_) {
   i = 0;
   do {
     if (!c->exp_channel && !c->exp_msg) {
-      if (c->length - i < 16)
+      const size_t hlen =
+          fio_cluster_header_len(c->buffer + i, (size_t)(c->length - i));
+      if (!hlen || (size_t)(c->length - i) < hlen)
         break;
-      c->exp_channel = fio_str2u32(c->buffer + i);
-      c->exp_msg = fio_str2u32(c->buffer + i + 4);
-      c->type = fio_str2u32(c->buffer + i + 8);
-      c->filter = (int32_t)fio_str2u32(c->buffer + i + 12);
+      fio_cluster_header_read(c, c->buffer + i);
       if (c->exp_channel) {
         if (c->exp_channel >= (1024 * 1024 * 16)) {
           FIO_LOG_FATAL("(%d) cluster message name too long (16Mb limit): %u\n",
@@ -5981,7 +9938,7 @@ static void fio_cluster_on_data(intptr_t uuid, fio_protocol_s *pr_) {
           (int8_t)(c->type == FIO_CLUSTER_MSG_JSON ||
                    c->type == FIO_CLUSTER_MSG_ROOT_JSON),
           0);
-      i += 16;
+      i += hlen;
     }
     if (c->exp_channel) {
       if (c->exp_channel + i > c->length) {
@@ -6035,8 +9992,8 @@ static void fio_cluster_on_close(intptr_t uuid, fio_protocol_s *pr_) {
     /* a child was lost, respawning is handled elsewhere. */
     fio_lock(&cluster_data.lock);
     FIO_LS_FOR(&cluster_data.clients, pos) {
-      if (pos->obj == (void *)uuid) {
-        fio_ls_remove(pos);
+      if (((fio_cluster_outbox_s *)pos->obj)->uuid == uuid) {
+        fio_cluster_outbox_free(fio_ls_remove(pos));
         break;
       }
     }
@@ -6095,10 +10052,9 @@ static void fio_mock_on_message(fio_msg_s *msg) { (void)msg; }
 static void fio_cluster_server_sender(fio_str_s *data, intptr_t avoid_uuid) {
   fio_lock(&cluster_data.lock);
   FIO_LS_FOR(&cluster_data.clients, pos) {
-    if ((intptr_t)pos->obj != -1) {
-      if ((intptr_t)pos->obj != avoid_uuid) {
-        fio_str_send_free2((intptr_t)pos->obj, fio_str_dup(data));
-      }
+    fio_cluster_outbox_s *o = (fio_cluster_outbox_s *)pos->obj;
+    if (o->uuid != -1 && o->uuid != avoid_uuid) {
+      fio_cluster_outbox_push(o, data);
     }
   }
   fio_unlock(&cluster_data.lock);
@@ -6128,9 +10084,8 @@ static void fio_cluster_server_handler(struct cluster_pr_s *pr) {
         pr->msg->channel.data, pr->msg->channel.len, 0); // don't free
     fio_lock(&pr->lock);
     fio_sub_hash_insert(&pr->pubsub,
-                        FIO_HASH_FN(pr->msg->channel.data, pr->msg->channel.len,
-                                    &fio_postoffice.pubsub,
-                                    &fio_postoffice.pubsub),
+                        fio_sub_hash_hash(pr->msg->channel.data,
+                                          pr->msg->channel.len),
                         tmp, s, NULL);
     fio_unlock(&pr->lock);
     break;
@@ -6140,9 +10095,8 @@ static void fio_cluster_server_handler(struct cluster_pr_s *pr) {
         pr->msg->channel.data, pr->msg->channel.len, 0); // don't free
     fio_lock(&pr->lock);
     fio_sub_hash_remove(&pr->pubsub,
-                        FIO_HASH_FN(pr->msg->channel.data, pr->msg->channel.len,
-                                    &fio_postoffice.pubsub,
-                                    &fio_postoffice.pubsub),
+                        fio_sub_hash_hash(pr->msg->channel.data,
+                                          pr->msg->channel.len),
                         tmp, NULL);
     fio_unlock(&pr->lock);
     break;
@@ -6157,9 +10111,8 @@ static void fio_cluster_server_handler(struct cluster_pr_s *pr) {
         pr->msg->channel.data, pr->msg->channel.len, 0); // don't free
     fio_lock(&pr->lock);
     fio_sub_hash_insert(&pr->patterns,
-                        FIO_HASH_FN(pr->msg->channel.data, pr->msg->channel.len,
-                                    &fio_postoffice.pubsub,
-                                    &fio_postoffice.pubsub),
+                        fio_sub_hash_hash(pr->msg->channel.data,
+                                          pr->msg->channel.len),
                         tmp, s, NULL);
     fio_unlock(&pr->lock);
     break;
@@ -6170,9 +10123,8 @@ static void fio_cluster_server_handler(struct cluster_pr_s *pr) {
         pr->msg->channel.data, pr->msg->channel.len, 0); // don't free
     fio_lock(&pr->lock);
     fio_sub_hash_remove(&pr->patterns,
-                        FIO_HASH_FN(pr->msg->channel.data, pr->msg->channel.len,
-                                    &fio_postoffice.pubsub,
-                                    &fio_postoffice.pubsub),
+                        fio_sub_hash_hash(pr->msg->channel.data,
+                                          pr->msg->channel.len),
                         tmp, NULL);
     fio_unlock(&pr->lock);
     break;
@@ -6202,7 +10154,7 @@ static void fio_cluster_listen_accept(intptr_t uuid, fio_protocol_s *protocol) {
                fio_cluster_protocol_alloc(client, fio_cluster_server_handler,
                                           fio_cluster_server_sender));
     fio_lock(&cluster_data.lock);
-    fio_ls_push(&cluster_data.clients, (void *)client);
+    fio_ls_push(&cluster_data.clients, fio_cluster_outbox_new(client));
     fio_unlock(&cluster_data.lock);
   }
 }
@@ -6281,7 +10233,8 @@ static void fio_cluster_client_sender(fio_str_s *data, intptr_t ignr_) {
                         data, (void *)ignr_);
     return;
   }
-  fio_str_send_free2(cluster_data.uuid, data);
+  fio_cluster_outbox_push(&cluster_data.outbox, data);
+  fio_str_free2(data);
   (void)ignr_;
 }
 
@@ -6296,25 +10249,28 @@ static void fio_cluster_client_sender(fio_str_s *data, intptr_t ignr_) {
  * Should either call `facil_attach` or close the connection.
  */
 static void fio_cluster_on_connect(intptr_t uuid, void *udata) {
+  fio_lock(&cluster_data.outbox.lock);
+  cluster_data.outbox.uuid = uuid;
+  fio_unlock(&cluster_data.outbox.lock);
   cluster_data.uuid = uuid;
 
   /* inform root about all existing channels */
-  fio_lock(&fio_postoffice.pubsub.lock);
+  fio_rwlock_read(&fio_postoffice.pubsub.lock);
   FIO_SET_FOR_LOOP(&fio_postoffice.pubsub.channels, pos) {
     if (!pos->hash) {
       continue;
     }
     fio_cluster_inform_root_about_channel(pos->obj, 1);
   }
-  fio_unlock(&fio_postoffice.pubsub.lock);
-  fio_lock(&fio_postoffice.patterns.lock);
+  fio_rwlock_read_unlock(&fio_postoffice.pubsub.lock);
+  fio_rwlock_read(&fio_postoffice.patterns.lock);
   FIO_SET_FOR_LOOP(&fio_postoffice.patterns.channels, pos) {
     if (!pos->hash) {
       continue;
     }
     fio_cluster_inform_root_about_channel(pos->obj, 1);
   }
-  fio_unlock(&fio_postoffice.patterns.lock);
+  fio_rwlock_read_unlock(&fio_postoffice.patterns.lock);
 
   fio_attach(uuid, fio_cluster_protocol_alloc(uuid, fio_cluster_client_handler,
                                               fio_cluster_client_sender));
@@ -6342,6 +10298,262 @@ static void fio_connect2cluster(void *ignore) {
   (void)ignore;
 }
 
+/* *****************************************************************************
+ * Shared Memory Rings (optional transport for forwarded messages)
+ **************************************************************************** */
+
+#if FIO_PUBSUB_RING && defined(__linux__)
+#include <sys/eventfd.h>
+
+/*
+ * Every process (the root is slot 0, workers use their index + 1) owns a ring
+ * it's the only producer of (writes are serialized by a process local lock).
+ * All the other processes read the ring, each at its own cursor, and are woken
+ * up using their `eventfd` when they might be idle.
+ *
+ * A published message is copied once, into the shared memory, and consumers
+ * copy it out into the (reference counted) message they publish locally.
+ */
+
+/* a record in the ring (8 byte aligned, a zero `len` wraps the ring) */
+typedef struct {
+  uint32_t len;
+  uint32_t ch_len;
+  uint32_t msg_len;
+  int32_t filter;
+  uint32_t is_json;
+  uint32_t reserved_;
+} fio_ring_record_s;
+
+/* positions are kept in their own cache lines */
+typedef struct {
+  volatile uint64_t pos;
+  uint8_t pad_[56];
+} fio_ring_pos_s;
+
+static struct {
+  /* each slot's write position */
+  fio_ring_pos_s *write;
+  /* the read positions (slots x slots, indexed by producer, then consumer) */
+  fio_ring_pos_s *read;
+  /* the ring buffers */
+  uint8_t *data;
+  /* each slot's eventfd */
+  int *efd;
+  size_t mem_len;
+  uint16_t slots;
+  uint16_t self;
+  fio_lock_i lock;
+} fio_ring = {.lock = FIO_LOCK_INIT};
+
+#define FIO_RING_MASK (FIO_PUBSUB_RING_SIZE - 1)
+#define FIO_RING_READ(producer, consumer)                                      \
+  fio_ring.read[((producer)*fio_ring.slots) + (consumer)].pos
+
+/* returns the ring's buffer for the slot */
+static inline uint8_t *fio_ring_buffer(uint16_t slot) {
+  return fio_ring.data + ((size_t)slot * FIO_PUBSUB_RING_SIZE);
+}
+
+/* reads the messages waiting in another process' ring */
+static void fio_ring_consume(uint16_t producer) {
+  uint8_t *const buf = fio_ring_buffer(producer);
+  uint64_t pos = FIO_RING_READ(producer, fio_ring.self);
+  uint64_t end = __atomic_load_n(&fio_ring.write[producer].pos,
+                                 __ATOMIC_SEQ_CST);
+  while (pos != end) {
+    while (pos != end) {
+      fio_ring_record_s *r = (fio_ring_record_s *)(buf + (pos & FIO_RING_MASK));
+      if (!r->len) {
+        /* wrap around */
+        pos += FIO_PUBSUB_RING_SIZE - (pos & FIO_RING_MASK);
+        continue;
+      }
+      fio_str_info_s ch = {.data = (char *)(r + 1), .len = r->ch_len};
+      fio_str_info_s msg = {.data = (char *)(r + 1) + r->ch_len,
+                            .len = r->msg_len};
+      fio_publish2process(fio_pubsub_create_message(r->filter, ch, msg,
+                                                    (int8_t)r->is_json, 1));
+      pos += r->len;
+    }
+    /* publish the cursor before testing for new data (see `fio_ring_push`) */
+    __atomic_store_n(&FIO_RING_READ(producer, fio_ring.self), pos,
+                     __ATOMIC_SEQ_CST);
+    end = __atomic_load_n(&fio_ring.write[producer].pos, __ATOMIC_SEQ_CST);
+  }
+}
+
+/* the eventfd was signaled, read all the rings */
+static void fio_ring_on_data(intptr_t uuid, fio_protocol_s *protocol) {
+  uint64_t count;
+  if (read(fio_uuid2fd(uuid), &count, sizeof(count)) < 0 && errno != EAGAIN)
+    return;
+  for (uint16_t i = 0; i < fio_ring.slots; ++i) {
+    if (i != fio_ring.self)
+      fio_ring_consume(i);
+  }
+  (void)protocol;
+}
+
+static void fio_ring_on_close(intptr_t uuid, fio_protocol_s *protocol) {
+  free(protocol);
+  (void)uuid;
+}
+
+/* starts reading the rings, using a copy of the slot's eventfd */
+static void fio_ring_listen(uint16_t slot) {
+  fio_ring.self = slot;
+  for (uint16_t i = 0; i < fio_ring.slots; ++i) {
+    /* skip anything published before we (re)started */
+    FIO_RING_READ(i, slot) = fio_ring.write[i].pos;
+  }
+  int fd = dup(fio_ring.efd[slot]);
+  if (fd == -1) {
+    FIO_LOG_ERROR("(%d) couldn't listen to the pub/sub ring (%s), using the "
+                  "cluster socket",
+                  getpid(), strerror(errno));
+    return;
+  }
+  fio_protocol_s *p = malloc(sizeof(*p));
+  FIO_ASSERT_ALLOC(p);
+  *p = (fio_protocol_s){
+      .on_data = fio_ring_on_data,
+      .on_shutdown = mock_on_shutdown_eternal,
+      .ping = mock_ping_eternal,
+      .on_close = fio_ring_on_close,
+  };
+  fio_attach_fd(fd, p);
+}
+
+/**
+ * Writes a message to the process' ring, waking up idle readers.
+ *
+ * Returns -1 if the message should be sent through the cluster socket.
+ */
+static int fio_ring_push(int32_t filter, fio_str_info_s ch, fio_str_info_s msg,
+                         uint8_t is_json) {
+  if (!fio_ring.data)
+    return -1;
+  const uint64_t len =
+      (sizeof(fio_ring_record_s) + ch.len + msg.len + 7) & (~(uint64_t)7);
+  if (len > (FIO_PUBSUB_RING_SIZE >> 2))
+    return -1;
+  uint8_t *const buf = fio_ring_buffer(fio_ring.self);
+  fio_lock(&fio_ring.lock);
+  const uint64_t pos = fio_ring.write[fio_ring.self].pos;
+  uint64_t start = pos;
+  if (FIO_PUBSUB_RING_SIZE - (pos & FIO_RING_MASK) < len)
+    start += FIO_PUBSUB_RING_SIZE - (pos & FIO_RING_MASK);
+  /* test that the slowest reader left room for the message */
+  for (uint16_t i = 0; i < fio_ring.slots; ++i) {
+    if (i != fio_ring.self &&
+        start + len - __atomic_load_n(&FIO_RING_READ(fio_ring.self, i),
+                                      __ATOMIC_SEQ_CST) >
+            FIO_PUBSUB_RING_SIZE) {
+      fio_unlock(&fio_ring.lock);
+      return -1;
+    }
+  }
+  if (start != pos)
+    ((fio_ring_record_s *)(buf + (pos & FIO_RING_MASK)))->len = 0;
+  fio_ring_record_s *r = (fio_ring_record_s *)(buf + (start & FIO_RING_MASK));
+  *r = (fio_ring_record_s){
+      .len = (uint32_t)len,
+      .ch_len = (uint32_t)ch.len,
+      .msg_len = (uint32_t)msg.len,
+      .filter = filter,
+      .is_json = is_json,
+  };
+  if (ch.len)
+    memcpy(r + 1, ch.data, ch.len);
+  if (msg.len)
+    memcpy((uint8_t *)(r + 1) + ch.len, msg.data, msg.len);
+  __atomic_store_n(&fio_ring.write[fio_ring.self].pos, start + len,
+                   __ATOMIC_SEQ_CST);
+  /* readers that were done with the older data might be idle */
+  for (uint16_t i = 0; i < fio_ring.slots; ++i) {
+    if (i != fio_ring.self &&
+        __atomic_load_n(&FIO_RING_READ(fio_ring.self, i), __ATOMIC_SEQ_CST) ==
+            pos) {
+      const uint64_t one = 1;
+      if (write(fio_ring.efd[i], &one, sizeof(one)) < 0) {
+        /* the counter is saturated, the reader was already signaled */
+      }
+    }
+  }
+  fio_unlock(&fio_ring.lock);
+  return 0;
+}
+
+/* unmaps the rings and closes the eventfds */
+static void fio_ring_destroy(void *ignr_) {
+  if (fio_ring.efd) {
+    for (uint16_t i = 0; i < fio_ring.slots; ++i) {
+      if (fio_ring.efd[i] != -1)
+        close(fio_ring.efd[i]);
+    }
+    free(fio_ring.efd);
+  }
+  if (fio_ring.write)
+    munmap((void *)fio_ring.write, fio_ring.mem_len);
+  fio_ring.write = NULL;
+  fio_ring.read = NULL;
+  fio_ring.data = NULL;
+  fio_ring.efd = NULL;
+  fio_ring.slots = 0;
+  (void)ignr_;
+}
+
+/* allocates the rings before the workers are spawned (root process) */
+static void fio_ring_init(void *ignr_) {
+  (void)ignr_;
+  if (fio_data->workers <= 1 || fio_ring.data)
+    return;
+  FIO_ASSERT(!(FIO_PUBSUB_RING_SIZE & FIO_RING_MASK),
+             "FIO_PUBSUB_RING_SIZE must be a power of 2");
+  fio_ring.slots = fio_data->workers + 1;
+  fio_ring.mem_len =
+      (sizeof(fio_ring_pos_s) * (fio_ring.slots + 1) * fio_ring.slots) +
+      ((size_t)FIO_PUBSUB_RING_SIZE * fio_ring.slots);
+  void *mem = mmap(NULL, fio_ring.mem_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  uint8_t ok = (mem != MAP_FAILED);
+  fio_ring.efd = malloc(sizeof(*fio_ring.efd) * fio_ring.slots);
+  FIO_ASSERT_ALLOC(fio_ring.efd);
+  for (uint16_t i = 0; i < fio_ring.slots; ++i) {
+    fio_ring.efd[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ok &= (fio_ring.efd[i] != -1);
+  }
+  if (!ok) {
+    FIO_LOG_WARNING("couldn't allocate the pub/sub rings (%s), using the "
+                    "cluster socket.",
+                    strerror(errno));
+    if (mem != MAP_FAILED)
+      munmap(mem, fio_ring.mem_len);
+    fio_ring_destroy(NULL);
+    return;
+  }
+  /* pages are allocated on first access, zeroed */
+  fio_ring.write = mem;
+  fio_ring.read = fio_ring.write + fio_ring.slots;
+  fio_ring.data =
+      (uint8_t *)(fio_ring.read + (fio_ring.slots * fio_ring.slots));
+  fio_ring_listen(0);
+}
+
+/* starts reading the rings in a worker process */
+static void fio_ring_init_child(void *ignr_) {
+  if (fio_ring.data) {
+    fio_ring.lock = FIO_LOCK_INIT;
+    fio_ring_listen(fio_data->worker_id + 1);
+  }
+  (void)ignr_;
+}
+
+#else
+#define fio_ring_push(...) (-1)
+#endif
+
 static void fio_send2cluster(int32_t filter, fio_str_info_s ch,
                              fio_str_info_s msg, uint8_t is_json) {
   if (!fio_is_running()) {
@@ -6352,6 +10564,9 @@ static void fio_send2cluster(int32_t filter, fio_str_info_s ch,
     /* nowhere to send to */
     return;
   }
+  if (!fio_ring_push(filter, ch, msg, is_json)) {
+    return;
+  }
   if (fio_is_master()) {
     fio_cluster_server_sender(
         fio_cluster_wrap_message(
@@ -6455,6 +10670,7 @@ static void fio_cluster_at_exit(void *ignore) {
   }
   fio_ch_set_free(&fio_postoffice.filters.channels);
   fio_ch_set_free(&fio_postoffice.patterns.channels);
+  fio_pattern_index_clear(&fio_pattern_index);
   fio_ch_set_free(&fio_postoffice.pubsub.channels);
 
   /* clear engines */
@@ -6479,6 +10695,11 @@ static void fio_pubsub_initialize(void) {
   fio_state_callback_add(FIO_CALL_IN_CHILD, fio_connect2cluster, NULL);
   fio_state_callback_add(FIO_CALL_ON_FINISH, fio_cluster_cleanup, NULL);
   fio_state_callback_add(FIO_CALL_AT_EXIT, fio_cluster_at_exit, NULL);
+#if FIO_PUBSUB_RING && defined(__linux__)
+  fio_state_callback_add(FIO_CALL_PRE_START, fio_ring_init, NULL);
+  fio_state_callback_add(FIO_CALL_IN_CHILD, fio_ring_init_child, NULL);
+  fio_state_callback_add(FIO_CALL_AT_EXIT, fio_ring_destroy, NULL);
+#endif
 }
 
 /* *****************************************************************************
@@ -6520,6 +10741,7 @@ static inline void fio_publish2process2(int32_t filter, fio_str_info_s ch_name,
  * equal to 0 or missing.
  */
 void fio_publish FIO_IGNORE_MACRO(fio_publish_args_s args) {
+  fio_metric_add(FIO_METRIC_PUBLISHED, 1);
   if (args.filter && !args.engine) {
     args.engine = FIO_PUBSUB_CLUSTER;
   } else if (!args.engine) {
@@ -6742,7 +10964,11 @@ Allocator default settings
 #define FIO_MEMORY_BLOCK_SLICES (FIO_MEMORY_BLOCK_SIZE >> 4) /* 16B slices */
 
 /* must be divisable by 16 bytes, bigger than min(sizeof(block_s), 16) */
+#if FIO_MEMORY_SLABS
+#define FIO_MEMORY_BLOCK_HEADER_SIZE 48 /* fits `slab_s` */
+#else
 #define FIO_MEMORY_BLOCK_HEADER_SIZE 32
+#endif
 
 /* allocation counter position (start) */
 #define FIO_MEMORY_BLOCK_START_POS (FIO_MEMORY_BLOCK_HEADER_SIZE >> 4)
@@ -6775,6 +11001,10 @@ void *fio_realloc2(void *ptr, size_t new_size, size_t copy_length) {
 
 void *fio_mmap(size_t size) { return calloc(size, 1); }
 
+fio_malloc_stats_s fio_malloc_stats(void) {
+  return (fio_malloc_stats_s){.system = 0};
+}
+
 void fio_malloc_after_fork(void) {}
 void fio_mem_destroy(void) {}
 void fio_mem_init(void) {}
@@ -6971,9 +11201,42 @@ struct block_node_s {
   fio_ls_embd_s node; /* next block */
 };
 
+#if FIO_MEMORY_SLABS
+/* the number of size classes (slabs are used up to FIO_MEMORY_SLAB_LIMIT) */
+#define FIO_MEMORY_SLAB_CLASSES 12
+/* the largest size class, in bytes */
+#define FIO_MEMORY_SLAB_LIMIT 1024
+
+/* size classes, in 16 byte units (up to 33% rounding) */
+static const uint16_t slab_units[FIO_MEMORY_SLAB_CLASSES] = {
+    1, 2, 3, 4, 6, 8, 12, 16, 24, 32, 48, 64};
+
+/* A block dedicated to a single size class. Starts a 32Kib memory block */
+typedef struct slab_s slab_s;
+struct slab_s {
+  block_s blk;        /* `blk.max` is the size of a slice (16 byte units) */
+  fio_ls_embd_s node; /* partial list node (overlaps `block_node_s`) */
+  void *free;         /* freed slices, a singly linked list */
+  uint16_t used;      /* the number of slices in use */
+  uint8_t cls;        /* the size class */
+  uint8_t owned;      /* set while an arena allocates from the slab */
+  uint8_t listed;     /* set while the slab is in the partial list */
+  fio_lock_i lock;    /* protects the free list and flags */
+};
+
+/* per size class partial slabs (slabs with free slices no arena owns) */
+static struct {
+  fio_ls_embd_s partial;
+  fio_lock_i lock;
+} memory_slabs[FIO_MEMORY_SLAB_CLASSES];
+#endif
+
 /* a per-CPU core "arena" for memory allocations  */
 typedef struct {
   block_s *block;
+#if FIO_MEMORY_SLABS
+  slab_s *slabs[FIO_MEMORY_SLAB_CLASSES];
+#endif
   fio_lock_i lock;
 } arena_s;
 
@@ -6981,9 +11244,14 @@ typedef struct {
 static struct {
   fio_ls_embd_s available; /* free list for memory blocks */
   // intptr_t count;          /* free list counter */
-  size_t cores;    /* the number of detected CPU cores*/
-  fio_lock_i lock; /* a global lock */
-  uint8_t forked;  /* a forked collection indicator. */
+  size_t cores;      /* the number of detected CPU cores*/
+  size_t roots;      /* system allocations (FIO_MEMORY_BLOCKS_PER_ALLOCATION) */
+  size_t pool;       /* the number of blocks in the memory pool */
+  size_t slabs;      /* the number of blocks used as slabs */
+  size_t slab_bytes; /* memory held by slab allocations */
+  size_t big;        /* memory held by big allocations */
+  fio_lock_i lock;   /* a global lock */
+  uint8_t forked;    /* a forked collection indicator. */
 } memory = {
     .cores = 1,
     .lock = FIO_LOCK_INIT,
@@ -7052,10 +11320,53 @@ static inline arena_s *arena_lock(arena_s *preffered) {
 
 static __thread arena_s *arena_last_used;
 
+#if FIO_MEMORY_THREAD_CACHE
+/* *****************************************************************************
+Per-Thread Arena (a thread cache, no locks required)
+***************************************************************************** */
+
+/* each thread slices its own block, refilled from the shared block pool */
+static __thread arena_s arena_thread;
+
+/* releases the thread's block when the thread exits */
+static pthread_key_t arena_thread_key;
+static uint8_t arena_thread_key_valid;
+
+static inline void block_free(block_s *blk);
+#if FIO_MEMORY_SLABS
+static void arena_release_slabs(arena_s *arena);
+#endif
+
+static void arena_thread_cleanup(void *ignr_) {
+#if FIO_MEMORY_SLABS
+  arena_release_slabs(&arena_thread);
+#endif
+  if (arena_thread.block)
+    block_free(arena_thread.block);
+  arena_thread.block = NULL;
+  /* allocations during TLS cleanup will register again */
+  arena_last_used = NULL;
+  (void)ignr_;
+}
+
+static void arena_enter(void) {
+  if (arena_last_used)
+    return;
+  arena_last_used = &arena_thread;
+  if (arena_thread_key_valid)
+    pthread_setspecific(arena_thread_key, (void *)&arena_thread);
+}
+
+static inline void arena_exit(void) {}
+
+#else
+
 static void arena_enter(void) { arena_last_used = arena_lock(arena_last_used); }
 
 static inline void arena_exit(void) { fio_unlock(&arena_last_used->lock); }
 
+#endif /* FIO_MEMORY_THREAD_CACHE */
+
 /** Clears any memory locks, in case of a system call to `fork`. */
 void fio_malloc_after_fork(void) {
   arena_last_used = NULL;
@@ -7067,6 +11378,11 @@ void fio_malloc_after_fork(void) {
   for (size_t i = 0; i < memory.cores; ++i) {
     arenas[i].lock = FIO_LOCK_INIT;
   }
+#if FIO_MEMORY_SLABS
+  for (size_t i = 0; i < FIO_MEMORY_SLAB_CLASSES; ++i) {
+    memory_slabs[i].lock = FIO_LOCK_INIT;
+  }
+#endif
 }
 
 /* *****************************************************************************
@@ -7087,6 +11403,7 @@ static inline void block_init(block_s *blk) {
   /* initialization shouldn't effect `parent` or `root_ref`*/
   blk->ref = 1;
   blk->pos = FIO_MEMORY_BLOCK_START_POS;
+  blk->max = 0;
   /* zero out linked list memory (everything else is already zero) */
   ((block_node_s *)blk)->node.next = NULL;
   ((block_node_s *)blk)->node.prev = NULL;
@@ -7094,14 +11411,31 @@ static inline void block_init(block_s *blk) {
   fio_atomic_add(&blk->parent->root_ref, 1);
 }
 
+/* zeroes out a block's memory (the header's `block_s` is preserved). */
+static inline void block_clear(block_s *blk) {
+#if FIO_MEMORY_SLABS && defined(__linux__) && defined(MADV_DONTNEED)
+  /* release the block's memory pages, Linux zeroes them when next touched */
+  if (FIO_MEMORY_BLOCK_SIZE > 4096 &&
+      !madvise((void *)((uintptr_t)blk + 4096), FIO_MEMORY_BLOCK_SIZE - 4096,
+               MADV_DONTNEED)) {
+    memset(blk + 1, 0, (4096 - sizeof(*blk)));
+    return;
+  }
+#endif
+  memset(blk + 1, 0, (FIO_MEMORY_BLOCK_SIZE - sizeof(*blk)));
+}
+
 /* intializes the block header for an available block of memory. */
 static inline void block_free(block_s *blk) {
   if (fio_atomic_sub(&blk->ref, 1))
     return;
 
-  memset(blk + 1, 0, (FIO_MEMORY_BLOCK_SIZE - sizeof(*blk)));
+  if (blk->max)
+    fio_atomic_sub(&memory.slabs, 1);
+  block_clear(blk);
   fio_lock(&memory.lock);
   fio_ls_embd_push(&memory.available, &((block_node_s *)blk)->node);
+  ++memory.pool;
 
   blk = blk->parent;
 
@@ -7118,6 +11452,8 @@ static inline void block_free(block_s *blk) {
         (block_node_s *)((uintptr_t)blk + (i * FIO_MEMORY_BLOCK_SIZE));
     fio_ls_embd_remove(&pos->node);
   }
+  memory.pool -= FIO_MEMORY_BLOCKS_PER_ALLOCATION;
+  --memory.roots;
 
   fio_unlock(&memory.lock);
   sys_free(blk, FIO_MEMORY_BLOCK_SIZE * FIO_MEMORY_BLOCKS_PER_ALLOCATION);
@@ -7136,6 +11472,7 @@ static inline block_s *block_new(void) {
     FIO_ASSERT(((uintptr_t)blk & FIO_MEMORY_BLOCK_MASK) == 0,
                "Memory allocator error! double `fio_free`?\n");
     block_init(blk); /* must be performed within lock */
+    --memory.pool;
     fio_unlock(&memory.lock);
     return blk;
   }
@@ -7153,6 +11490,8 @@ static inline block_s *block_new(void) {
     block_init_root((block_s *)tmp, blk);
     fio_ls_embd_push(&memory.available, &tmp->node);
   }
+  ++memory.roots;
+  memory.pool += FIO_MEMORY_BLOCKS_PER_ALLOCATION - 1;
   fio_unlock(&memory.lock);
   /* return the root block (which isn't in the memory pool). */
   return blk;
@@ -7188,10 +11527,162 @@ static inline void *block_slice(uint16_t units) {
   return (void *)mem;
 }
 
+#if FIO_MEMORY_SLABS
+/* *****************************************************************************
+Size-class slabs (FIO_MEMORY_SLABS)
+
+A slab's reference count is the number of slices in use, plus one for the arena
+that owns it (`owned`) and one for the partial list (`listed`).
+
+Lock order: the size class lock, then the slab lock.
+***************************************************************************** */
+
+/* maps a 16 byte unit count to a size class */
+static inline size_t slab_class(size_t units) {
+  size_t c = 0;
+  while (slab_units[c] < units)
+    ++c;
+  return c;
+}
+
+/* tests if a slab has any slices to offer - called within the slab's lock */
+static inline int slab_has_room(slab_s *s) {
+  return s->free || s->blk.pos + s->blk.max <= FIO_MEMORY_MAX_SLICES_PER_BLOCK;
+}
+
+/* lists (or unlists) a slab no arena owns - the caller holds a reference */
+static void slab_update_list(slab_s *s) {
+  uint8_t drop = 0;
+  fio_lock(&memory_slabs[s->cls].lock);
+  fio_lock(&s->lock);
+  if (!s->owned) {
+    if (!s->listed && s->used && slab_has_room(s)) {
+      fio_ls_embd_push(&memory_slabs[s->cls].partial, &s->node);
+      s->listed = 1;
+      fio_atomic_add(&s->blk.ref, 1);
+    } else if (s->listed && !s->used) {
+      /* an empty slab goes back to the memory pool */
+      fio_ls_embd_remove(&s->node);
+      s->listed = 0;
+      drop = 1;
+    }
+  }
+  fio_unlock(&s->lock);
+  fio_unlock(&memory_slabs[s->cls].lock);
+  if (drop)
+    block_free(&s->blk);
+}
+
+/* collects a partially used slab (or a new one) for an arena to own */
+static slab_s *slab_new(size_t c) {
+  slab_s *s = NULL;
+  fio_ls_embd_s *node;
+  fio_lock(&memory_slabs[c].lock);
+  node = fio_ls_embd_pop(&memory_slabs[c].partial);
+  if (node) {
+    s = FIO_LS_EMBD_OBJ(slab_s, node, node);
+    fio_lock(&s->lock);
+    s->listed = 0;
+    s->owned = 1; /* the partial list's reference now belongs to the arena */
+    fio_unlock(&s->lock);
+  }
+  fio_unlock(&memory_slabs[c].lock);
+  if (s)
+    return s;
+  s = (slab_s *)block_new();
+  if (!s)
+    return NULL;
+  s->blk.max = slab_units[c];
+  s->cls = (uint8_t)c;
+  s->owned = 1;
+  fio_atomic_add(&memory.slabs, 1);
+  return s;
+}
+
+/* allocates a slice from the arena's slab - called within an arena's lock */
+static inline void *slab_slice(size_t c) {
+  slab_s *s = arena_last_used->slabs[c];
+  void *mem;
+  for (;;) {
+    if (!s) {
+      s = slab_new(c);
+      if (!s) {
+        /* no system memory available? */
+        errno = ENOMEM;
+        return NULL;
+      }
+      arena_last_used->slabs[c] = s;
+    }
+    fio_lock(&s->lock);
+    mem = s->free;
+    if (mem) {
+      /* reuse a freed slice */
+      s->free = *(void **)mem;
+      ++s->used;
+      fio_atomic_add(&s->blk.ref, 1);
+      fio_unlock(&s->lock);
+      memset(mem, 0, (size_t)slab_units[c] << 4);
+      break;
+    }
+    if (s->blk.pos + s->blk.max <= FIO_MEMORY_MAX_SLICES_PER_BLOCK) {
+      mem = (void *)((uintptr_t)s + ((uintptr_t)s->blk.pos << 4));
+      s->blk.pos += s->blk.max;
+      ++s->used;
+      fio_atomic_add(&s->blk.ref, 1);
+      fio_unlock(&s->lock);
+      break;
+    }
+    /* the slab is full, freeing a slice will place it in the partial list */
+    s->owned = 0;
+    fio_unlock(&s->lock);
+    block_free(&s->blk);
+    s = arena_last_used->slabs[c] = NULL;
+  }
+  fio_atomic_add(&memory.slab_bytes, (size_t)slab_units[c] << 4);
+  return mem;
+}
+
+/* returns a slice to its slab - called without an arena's lock */
+static inline void slab_slice_free(slab_s *s, void *mem) {
+  uint8_t update;
+  fio_atomic_sub(&memory.slab_bytes, (size_t)s->blk.max << 4);
+  fio_lock(&s->lock);
+  *(void **)mem = s->free;
+  s->free = mem;
+  --s->used;
+  update = !s->owned && (s->listed ? !s->used : s->used != 0);
+  fio_unlock(&s->lock);
+  if (update)
+    slab_update_list(s);
+  block_free(&s->blk);
+}
+
+/* releases an arena's slabs (partially used slabs are listed for reuse) */
+static void arena_release_slabs(arena_s *arena) {
+  for (size_t i = 0; i < FIO_MEMORY_SLAB_CLASSES; ++i) {
+    slab_s *s = arena->slabs[i];
+    if (!s)
+      continue;
+    arena->slabs[i] = NULL;
+    fio_lock(&s->lock);
+    s->owned = 0;
+    fio_unlock(&s->lock);
+    slab_update_list(s);
+    block_free(&s->blk);
+  }
+}
+#endif /* FIO_MEMORY_SLABS */
+
 /* handle's a bock's reference count - called without a lock */
 static inline void block_slice_free(void *mem) {
   /* locate block boundary */
   block_s *blk = (block_s *)((uintptr_t)mem & (~FIO_MEMORY_BLOCK_MASK));
+#if FIO_MEMORY_SLABS
+  if (blk->max) {
+    slab_slice_free((slab_s *)blk, mem);
+    return;
+  }
+#endif
   block_free(blk);
 }
 
@@ -7206,6 +11697,7 @@ static inline void *big_alloc(size_t size) {
   if (!mem)
     goto error;
   *mem = size;
+  fio_atomic_add(&memory.big, size);
   return (void *)(((uintptr_t)mem) + 16);
 error:
   return NULL;
@@ -7214,6 +11706,7 @@ error:
 /* reads size header and frees memory back to the system */
 static inline void big_free(void *ptr) {
   size_t *mem = (void *)(((uintptr_t)ptr) - 16);
+  fio_atomic_sub(&memory.big, *mem);
   sys_free(mem, *mem);
 }
 
@@ -7221,10 +11714,13 @@ static inline void big_free(void *ptr) {
 static inline void *big_realloc(void *ptr, size_t new_size) {
   size_t *mem = (void *)(((uintptr_t)ptr) - 16);
   new_size = sys_round_size(new_size + 16);
-  mem = sys_realloc(mem, *mem, new_size);
+  const size_t old_size = *mem;
+  mem = sys_realloc(mem, old_size, new_size);
   if (!mem)
     goto error;
   *mem = new_size;
+  fio_atomic_sub(&memory.big, old_size);
+  fio_atomic_add(&memory.big, new_size);
   return (void *)(((uintptr_t)mem) + 16);
 error:
   return NULL;
@@ -7279,7 +11775,19 @@ static void fio_mem_init(void) {
   memory.cores = cpu_count;
   arenas = big_alloc(sizeof(*arenas) * cpu_count);
   FIO_ASSERT_ALLOC(arenas);
+#if FIO_MEMORY_SLABS
+  for (size_t i = 0; i < FIO_MEMORY_SLAB_CLASSES; ++i) {
+    memory_slabs[i].partial.next = &memory_slabs[i].partial;
+    memory_slabs[i].partial.prev = &memory_slabs[i].partial;
+    memory_slabs[i].lock = FIO_LOCK_INIT;
+  }
+#endif
   block_free(block_new());
+#if FIO_MEMORY_THREAD_CACHE
+  if (!arena_thread_key_valid &&
+      !pthread_key_create(&arena_thread_key, arena_thread_cleanup))
+    arena_thread_key_valid = 1;
+#endif
   pthread_atfork(NULL, NULL, fio_malloc_after_fork);
 }
 
@@ -7290,10 +11798,17 @@ static void fio_mem_destroy(void) {
   FIO_MEMORY_PRINT_BLOCK_STAT();
 
   for (size_t i = 0; i < memory.cores; ++i) {
+#if FIO_MEMORY_SLABS
+    arena_release_slabs(arenas + i);
+#endif
     if (arenas[i].block)
       block_free(arenas[i].block);
     arenas[i].block = NULL;
   }
+#if FIO_MEMORY_THREAD_CACHE
+  /* the calling thread's block (other threads release theirs on exit) */
+  arena_thread_cleanup(NULL);
+#endif
   if (!memory.forked && fio_ls_embd_any(&memory.available)) {
     FIO_LOG_WARNING("facil.io detected memory traces remaining after cleanup"
                     " - memory leak?");
@@ -7329,6 +11844,14 @@ void *fio_malloc(size_t size) {
   }
   /* ceiling for 16 byte alignement, translated to 16 byte units */
   size = (size >> 4) + (!!(size & 15));
+#if FIO_MEMORY_SLABS
+  if (size <= (FIO_MEMORY_SLAB_LIMIT >> 4)) {
+    arena_enter();
+    void *mem = slab_slice(slab_class(size));
+    arena_exit();
+    return mem;
+  }
+#endif
   arena_enter();
   void *mem = block_slice(size);
   arena_exit();
@@ -7368,6 +11891,16 @@ void *fio_realloc2(void *ptr, size_t new_size, size_t copy_length) {
     /* big reallocation - direct from the system */
     return big_realloc(ptr, new_size);
   }
+#if FIO_MEMORY_SLABS
+  {
+    /* a slab slice can be reused when the size class doesn't change */
+    block_s *blk = (block_s *)((uintptr_t)ptr & (~FIO_MEMORY_BLOCK_MASK));
+    const size_t units = (new_size >> 4) + (!!(new_size & 15));
+    if (blk->max && units <= blk->max &&
+        slab_class(units) == ((slab_s *)blk)->cls)
+      return ptr;
+  }
+#endif
   /* allocated within block - don't even try to expand the allocation */
   /* ceiling for 16 byte alignement, translated to 16 byte units */
   void *new_mem = fio_malloc(new_size);
@@ -7384,6 +11917,21 @@ zero_size:
   return fio_malloc(0);
 }
 
+/** Returns the allocator's memory statistics. */
+fio_malloc_stats_s fio_malloc_stats(void) {
+  fio_malloc_stats_s r;
+  fio_lock(&memory.lock);
+  r.system =
+      memory.roots * FIO_MEMORY_BLOCKS_PER_ALLOCATION * FIO_MEMORY_BLOCK_SIZE;
+  r.blocks = (memory.roots * FIO_MEMORY_BLOCKS_PER_ALLOCATION) - memory.pool;
+  r.pool = memory.pool;
+  fio_unlock(&memory.lock);
+  r.slabs = memory.slabs;
+  r.slab_bytes = memory.slab_bytes;
+  r.big = memory.big;
+  return r;
+}
+
 void *fio_realloc(void *ptr, size_t new_size) {
   const size_t max_old =
       FIO_MEMORY_BLOCK_SIZE - ((uintptr_t)ptr & FIO_MEMORY_BLOCK_MASK);
@@ -7649,17 +12197,167 @@ uint64_t fio_siphash13(const void *data, size_t len, uint64_t key1,
   return fio_siphash_xy(data, len, 1, 3, key1, key2);
 }
 
+/* *****************************************************************************
+SHA / Base64 CPU extensions (detected during startup)
+***************************************************************************** */
+
+#if (FIO_SHA_HW || FIO_BASE64_SIMD) && defined(__GNUC__) &&                   \
+    defined(__x86_64__) && defined(__SSE2__)
+#include <cpuid.h>
+#include <immintrin.h>
+#if FIO_SHA_HW
+#define FIO_SHA_HW_X86 1
+#endif
+#if FIO_BASE64_SIMD
+#define FIO_BASE64_SSSE3 1
+#endif
+/* SHA extensions (with SSE4.1) and SSSE3 support flags */
+static uint8_t fio_cpu_sha_ni;
+static uint8_t fio_cpu_ssse3;
+static void __attribute__((constructor)) fio_cpu_extensions_detect(void) {
+  unsigned int a, b, c, d;
+  if (!__get_cpuid(1, &a, &b, &c, &d))
+    return;
+  fio_cpu_ssse3 = ((c >> 9) & 1);
+  const unsigned int sse4_1 = ((c >> 19) & 1);
+  if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+    return;
+  fio_cpu_sha_ni = (sse4_1 && ((b >> 29) & 1));
+}
+#define FIO_SHA_NI_TARGET __attribute__((target("sha,sse4.1"), noinline))
+#define FIO_SSSE3_TARGET __attribute__((target("ssse3"), noinline))
+
+#elif (FIO_SHA_HW || FIO_BASE64_SIMD) && defined(__GNUC__) &&                 \
+    defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#if FIO_SHA_HW && (defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2))
+/* the Cryptography Extensions are part of the compilation target */
+#define FIO_SHA_HW_ARM 1
+#endif
+#if FIO_BASE64_SIMD
+#define FIO_BASE64_NEON 1
+#endif
+#endif
+
 /* *****************************************************************************
 SHA-1
 ***************************************************************************** */
 
 static const uint8_t sha1_padding[64] = {0x80, 0};
 
+#if FIO_SHA_HW_X86
+/* hashes a 64 byte block using the SHA extensions (4 rounds per group). */
+FIO_SHA_NI_TARGET static void fio_sha1_hw_rounds(uint32_t *digest,
+                                                 const uint8_t *buffer) {
+  const __m128i mask =
+      _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+  __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)digest), 0x1B);
+  __m128i e0 = _mm_set_epi32((int)digest[4], 0, 0, 0);
+  const __m128i abcd_save = abcd;
+  const __m128i e0_save = e0;
+  __m128i e1;
+  __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)buffer), mask);
+  __m128i m1 =
+      _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(buffer + 16)), mask);
+  __m128i m2 =
+      _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(buffer + 32)), mask);
+  __m128i m3 =
+      _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(buffer + 48)), mask);
+
+  /* rounds 0-15 consume the block's words */
+  e0 = _mm_add_epi32(e0, m0);
+  e1 = abcd;
+  abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+  e1 = _mm_sha1nexte_epu32(e1, m1);
+  e0 = abcd;
+  abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+  m0 = _mm_sha1msg1_epu32(m0, m1);
+  e0 = _mm_sha1nexte_epu32(e0, m2);
+  e1 = abcd;
+  abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+  m1 = _mm_sha1msg1_epu32(m1, m2);
+  m0 = _mm_xor_si128(m0, m2);
+
+  /* computes 4 rounds while scheduling the words of the following groups */
+#define FIO_SHA1_NI_GROUP(e_cur, e_next, m, m_1, m_2, m_3, f)                 \
+  e_cur = _mm_sha1nexte_epu32(e_cur, m);                                       \
+  e_next = abcd;                                                               \
+  m_1 = _mm_sha1msg2_epu32(m_1, m);                                            \
+  abcd = _mm_sha1rnds4_epu32(abcd, e_cur, f);                                  \
+  m_3 = _mm_sha1msg1_epu32(m_3, m);                                            \
+  m_2 = _mm_xor_si128(m_2, m);
+
+  FIO_SHA1_NI_GROUP(e1, e0, m3, m0, m1, m2, 0); /* 12-15 */
+  FIO_SHA1_NI_GROUP(e0, e1, m0, m1, m2, m3, 0); /* 16-19 */
+  FIO_SHA1_NI_GROUP(e1, e0, m1, m2, m3, m0, 1);
+  FIO_SHA1_NI_GROUP(e0, e1, m2, m3, m0, m1, 1);
+  FIO_SHA1_NI_GROUP(e1, e0, m3, m0, m1, m2, 1);
+  FIO_SHA1_NI_GROUP(e0, e1, m0, m1, m2, m3, 1);
+  FIO_SHA1_NI_GROUP(e1, e0, m1, m2, m3, m0, 1); /* 36-39 */
+  FIO_SHA1_NI_GROUP(e0, e1, m2, m3, m0, m1, 2);
+  FIO_SHA1_NI_GROUP(e1, e0, m3, m0, m1, m2, 2);
+  FIO_SHA1_NI_GROUP(e0, e1, m0, m1, m2, m3, 2);
+  FIO_SHA1_NI_GROUP(e1, e0, m1, m2, m3, m0, 2);
+  FIO_SHA1_NI_GROUP(e0, e1, m2, m3, m0, m1, 2); /* 56-59 */
+  FIO_SHA1_NI_GROUP(e1, e0, m3, m0, m1, m2, 3);
+  FIO_SHA1_NI_GROUP(e0, e1, m0, m1, m2, m3, 3);
+  FIO_SHA1_NI_GROUP(e1, e0, m1, m2, m3, m0, 3);
+  FIO_SHA1_NI_GROUP(e0, e1, m2, m3, m0, m1, 3);
+  FIO_SHA1_NI_GROUP(e1, e0, m3, m0, m1, m2, 3); /* 76-79 */
+#undef FIO_SHA1_NI_GROUP
+
+  e0 = _mm_sha1nexte_epu32(e0, e0_save);
+  abcd = _mm_add_epi32(abcd, abcd_save);
+  _mm_storeu_si128((__m128i *)digest, _mm_shuffle_epi32(abcd, 0x1B));
+  digest[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+#elif FIO_SHA_HW_ARM
+/* hashes a 64 byte block using the Cryptography Extensions. */
+static void fio_sha1_hw_rounds(uint32_t *digest, const uint8_t *buffer) {
+  uint32x4_t abcd = vld1q_u32(digest);
+  const uint32x4_t abcd_save = abcd;
+  uint32_t e = digest[4];
+  uint32_t e_next;
+  uint32x4_t m[4];
+  for (size_t i = 0; i < 4; ++i)
+    m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(buffer + (i << 4))));
+  static const uint32_t k[4] = {0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC,
+                                0xCA62C1D6};
+  for (size_t g = 0; g < 20; ++g) {
+    const uint32x4_t wk = vaddq_u32(m[g & 3], vdupq_n_u32(k[g / 5]));
+    e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+    if (g < 5)
+      abcd = vsha1cq_u32(abcd, e, wk);
+    else if (g < 10 || g >= 15)
+      abcd = vsha1pq_u32(abcd, e, wk);
+    else
+      abcd = vsha1mq_u32(abcd, e, wk);
+    e = e_next;
+    if (g < 16)
+      m[g & 3] = vsha1su1q_u32(
+          vsha1su0q_u32(m[g & 3], m[(g + 1) & 3], m[(g + 2) & 3]),
+          m[(g + 3) & 3]);
+  }
+  vst1q_u32(digest, vaddq_u32(abcd, abcd_save));
+  digest[4] += e;
+}
+#endif
+
 /**
 Process the buffer once full.
 */
 static inline void fio_sha1_perform_all_rounds(fio_sha1_s *s,
                                                const uint8_t *buffer) {
+#if FIO_SHA_HW_X86
+  if (fio_cpu_sha_ni) {
+    fio_sha1_hw_rounds(s->digest.i, buffer);
+    return;
+  }
+#elif FIO_SHA_HW_ARM
+  fio_sha1_hw_rounds(s->digest.i, buffer);
+  return;
+#endif
   /* collect data */
   uint32_t a = s->digest.i[0];
   uint32_t b = s->digest.i[1];
@@ -7919,11 +12617,113 @@ static uint64_t sha2_512_words[] = {
 #define Omg0_64(x) (fio_rrot64((x), 1) ^ fio_rrot64((x), 8) ^ (((x) >> 7)))
 #define Omg1_64(x) (fio_rrot64((x), 19) ^ fio_rrot64((x), 61) ^ (((x) >> 6)))
 
+#if FIO_SHA_HW_X86
+/* hashes a 64 byte SHA-256 block using the SHA extensions. */
+FIO_SHA_NI_TARGET static void fio_sha256_hw_rounds(uint32_t *digest,
+                                                   const uint8_t *data) {
+  const __m128i mask =
+      _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  /* reorder the state from ABCD / EFGH to ABEF / CDGH */
+  __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)digest), 0xB1);
+  __m128i state1 =
+      _mm_shuffle_epi32(_mm_loadu_si128((__m128i *)(digest + 4)), 0x1B);
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+  const __m128i abef_save = state0;
+  const __m128i cdgh_save = state1;
+  __m128i msg;
+  __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)data), mask);
+  __m128i m1 =
+      _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(data + 16)), mask);
+  __m128i m2 =
+      _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(data + 32)), mask);
+  __m128i m3 =
+      _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(data + 48)), mask);
+
+#define FIO_SHA256_NI_ROUNDS(m, i)                                             \
+  msg = _mm_add_epi32((m), _mm_loadu_si128((__m128i *)(sha2_256_words + i)));  \
+  state1 = _mm_sha256rnds2_epu32(state1, state0, msg);                         \
+  msg = _mm_shuffle_epi32(msg, 0x0E);                                          \
+  state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+  /* computes 4 rounds while scheduling the words of the following groups */
+#define FIO_SHA256_NI_GROUP(m, m_next, m_prev, i)                              \
+  FIO_SHA256_NI_ROUNDS(m, i);                                                  \
+  m_next = _mm_sha256msg2_epu32(                                               \
+      _mm_add_epi32(m_next, _mm_alignr_epi8(m, m_prev, 4)), m);                \
+  m_prev = _mm_sha256msg1_epu32(m_prev, m);
+
+  FIO_SHA256_NI_ROUNDS(m0, 0);
+  FIO_SHA256_NI_ROUNDS(m1, 4);
+  m0 = _mm_sha256msg1_epu32(m0, m1);
+  FIO_SHA256_NI_ROUNDS(m2, 8);
+  m1 = _mm_sha256msg1_epu32(m1, m2);
+  FIO_SHA256_NI_GROUP(m3, m0, m2, 12);
+  FIO_SHA256_NI_GROUP(m0, m1, m3, 16);
+  FIO_SHA256_NI_GROUP(m1, m2, m0, 20);
+  FIO_SHA256_NI_GROUP(m2, m3, m1, 24);
+  FIO_SHA256_NI_GROUP(m3, m0, m2, 28);
+  FIO_SHA256_NI_GROUP(m0, m1, m3, 32);
+  FIO_SHA256_NI_GROUP(m1, m2, m0, 36);
+  FIO_SHA256_NI_GROUP(m2, m3, m1, 40);
+  FIO_SHA256_NI_GROUP(m3, m0, m2, 44);
+  FIO_SHA256_NI_GROUP(m0, m1, m3, 48);
+  FIO_SHA256_NI_GROUP(m1, m2, m0, 52);
+  FIO_SHA256_NI_GROUP(m2, m3, m1, 56);
+  FIO_SHA256_NI_ROUNDS(m3, 60);
+#undef FIO_SHA256_NI_GROUP
+#undef FIO_SHA256_NI_ROUNDS
+
+  state0 = _mm_add_epi32(state0, abef_save);
+  state1 = _mm_add_epi32(state1, cdgh_save);
+  /* reorder the state back to ABCD / EFGH */
+  tmp = _mm_shuffle_epi32(state0, 0x1B);
+  state1 = _mm_shuffle_epi32(state1, 0xB1);
+  _mm_storeu_si128((__m128i *)digest, _mm_blend_epi16(tmp, state1, 0xF0));
+  _mm_storeu_si128((__m128i *)(digest + 4), _mm_alignr_epi8(state1, tmp, 8));
+}
+
+#elif FIO_SHA_HW_ARM
+/* hashes a 64 byte SHA-256 block using the Cryptography Extensions. */
+static void fio_sha256_hw_rounds(uint32_t *digest, const uint8_t *data) {
+  uint32x4_t state0 = vld1q_u32(digest);
+  uint32x4_t state1 = vld1q_u32(digest + 4);
+  const uint32x4_t abcd_save = state0;
+  const uint32x4_t efgh_save = state1;
+  uint32x4_t m[4];
+  for (size_t i = 0; i < 4; ++i)
+    m[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + (i << 4))));
+  for (size_t g = 0; g < 16; ++g) {
+    const uint32x4_t wk =
+        vaddq_u32(m[g & 3], vld1q_u32(sha2_256_words + (g << 2)));
+    const uint32x4_t tmp = state0;
+    if (g < 12)
+      m[g & 3] = vsha256su1q_u32(vsha256su0q_u32(m[g & 3], m[(g + 1) & 3]),
+                                 m[(g + 2) & 3], m[(g + 3) & 3]);
+    state0 = vsha256hq_u32(state0, state1, wk);
+    state1 = vsha256h2q_u32(state1, tmp, wk);
+  }
+  vst1q_u32(digest, vaddq_u32(state0, abcd_save));
+  vst1q_u32(digest + 4, vaddq_u32(state1, efgh_save));
+}
+#endif
+
 /**
 Process the buffer once full.
 */
 static inline void fio_sha2_perform_all_rounds(fio_sha2_s *s,
                                                const uint8_t *data) {
+#if FIO_SHA_HW_X86
+  if (!(s->type & 1) && fio_cpu_sha_ni) {
+    fio_sha256_hw_rounds(s->digest.i32, data);
+    return;
+  }
+#elif FIO_SHA_HW_ARM
+  if (!(s->type & 1)) {
+    fio_sha256_hw_rounds(s->digest.i32, data);
+    return;
+  }
+#endif
   if (s->type & 1) { /* 512 derived type */
     // process values for the 64bit words
     uint64_t a = s->digest.i64[0];
@@ -8396,12 +13196,13 @@ s.length.times {|i| a[s[i]] = i };
 s = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_".bytes;
 s.length.times {|i| a[s[i]] = i }; a.map!{ |i| i.to_i }; a
 
+Note: 'A' is marked as 128 (BITVAL == 0), since 0 marks invalid characters.
 */
 static unsigned base64_decodes[] = {
     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
     0,  0,  0,  0,  0,  62, 63, 62, 0,  63, 52, 53, 54, 55, 56, 57, 58, 59, 60,
-    61, 0,  0,  0,  64, 0,  0,  0,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10,
+    61, 0,  0,  0,  64, 0,  0,  0,  128, 1, 2,  3,  4,  5,  6,  7,  8,  9,  10,
     11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 0,  0,  0,  0,
     63, 0,  26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42,
     43, 44, 45, 46, 47, 48, 49, 50, 51, 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
@@ -8415,12 +13216,207 @@ static unsigned base64_decodes[] = {
 };
 #define BITVAL(x) (base64_decodes[(x)] & 63)
 
+#if FIO_BASE64_SSSE3
+/*
+ * Encodes 12 byte blocks (16 byte reads) and returns the number of bytes
+ * consumed (a multiple of 3).
+ */
+FIO_SSSE3_TARGET static int fio_base64_encode_simd(char *target,
+                                                   const char *data, int len,
+                                                   const char *base64_encodes) {
+  /* maps the "class" of each 6 bit value to it's ASCII offset */
+  const __m128i offsets =
+      (base64_encodes == base64_encodes_url)
+          ? _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                          '0' - 52, '-' - 62, '_' - 63, 'A', 0, 0)
+          : _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                          '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  const __m128i spread =
+      _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+  int i = 0;
+  for (; i + 16 <= len; i += 12) {
+    /* spread 3 bytes to 4 (6 bit) values */
+    const __m128i in =
+        _mm_shuffle_epi8(_mm_loadu_si128((__m128i *)(data + i)), spread);
+    const __m128i v = _mm_or_si128(
+        _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)),
+                        _mm_set1_epi32(0x04000040)),
+        _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)),
+                        _mm_set1_epi32(0x01000010)));
+    /* classes: 0 (26-51), 1-10 (52-61), 11 (62), 12 (63), 13 (0-25) */
+    __m128i c = _mm_subs_epu8(v, _mm_set1_epi8(51));
+    c = _mm_or_si128(c, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), v),
+                                      _mm_set1_epi8(13)));
+    _mm_storeu_si128((__m128i *)target,
+                     _mm_add_epi8(_mm_shuffle_epi8(offsets, c), v));
+    target += 16;
+  }
+  return i;
+}
+
+/* maps 16 Base64 characters (any variant) to their 6 bit values. */
+static inline __m128i fio_base64_decode_map(__m128i in, __m128i *valid) {
+#define FIO_BASE64_IN_RANGE(from, to)                                          \
+  _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8((from)-1)),                   \
+                _mm_cmplt_epi8(in, _mm_set1_epi8((to) + 1)))
+#define FIO_BASE64_IS(ch) _mm_cmpeq_epi8(in, _mm_set1_epi8(ch))
+  const __m128i upper = FIO_BASE64_IN_RANGE('A', 'Z');
+  const __m128i lower = FIO_BASE64_IN_RANGE('a', 'z');
+  const __m128i digit = FIO_BASE64_IN_RANGE('0', '9');
+  const __m128i c62 = _mm_or_si128(
+      _mm_or_si128(FIO_BASE64_IS('+'), FIO_BASE64_IS('-')), FIO_BASE64_IS(','));
+  const __m128i c63 = _mm_or_si128(FIO_BASE64_IS('/'), FIO_BASE64_IS('_'));
+#undef FIO_BASE64_IS
+#undef FIO_BASE64_IN_RANGE
+  *valid = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), digit),
+                        _mm_or_si128(c62, c63));
+  return _mm_or_si128(
+      _mm_or_si128(
+          _mm_and_si128(upper, _mm_sub_epi8(in, _mm_set1_epi8(65))),
+          _mm_and_si128(lower, _mm_sub_epi8(in, _mm_set1_epi8(71)))),
+      _mm_or_si128(_mm_and_si128(digit, _mm_add_epi8(in, _mm_set1_epi8(4))),
+                   _mm_or_si128(_mm_and_si128(c62, _mm_set1_epi8(62)),
+                                _mm_and_si128(c63, _mm_set1_epi8(63)))));
+}
+
+/*
+ * Decodes 16 byte blocks (writing 16 bytes, 12 of them valid) until a block
+ * contains padding, white space or an invalid character. The last 16 bytes
+ * are always left for the scalar decoder.
+ *
+ * Returns the number of bytes consumed (a multiple of 4).
+ */
+FIO_SSSE3_TARGET static int fio_base64_decode_simd(char *target,
+                                                   const char *encoded,
+                                                   int len) {
+  int i = 0;
+  for (; i + 32 <= len; i += 16) {
+    __m128i valid;
+    __m128i v = _mm_loadu_si128((__m128i *)(encoded + i));
+    v = fio_base64_decode_map(v, &valid);
+    if (_mm_movemask_epi8(valid) != 0xFFFF)
+      break;
+    /* pack 4 (6 bit) values to 3 bytes */
+    v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+    v = _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13,
+                                          12, -1, -1, -1, -1));
+    _mm_storeu_si128((__m128i *)target, v);
+    target += 12;
+  }
+  return i;
+}
+
+#elif FIO_BASE64_NEON
+/*
+ * Encodes 48 byte blocks and returns the number of bytes consumed (a multiple
+ * of 3).
+ */
+static int fio_base64_encode_simd(char *target, const char *data, int len,
+                                  const char *base64_encodes) {
+  const uint8x16x4_t map = {{
+      vld1q_u8((const uint8_t *)base64_encodes),
+      vld1q_u8((const uint8_t *)base64_encodes + 16),
+      vld1q_u8((const uint8_t *)base64_encodes + 32),
+      vld1q_u8((const uint8_t *)base64_encodes + 48),
+  }};
+  const uint8x16_t mask = vdupq_n_u8(63);
+  int i = 0;
+  for (; i + 48 <= len; i += 48) {
+    const uint8x16x3_t in = vld3q_u8((const uint8_t *)data + i);
+    uint8x16x4_t out;
+    out.val[0] = vshrq_n_u8(in.val[0], 2);
+    out.val[1] = vandq_u8(
+        vorrq_u8(vshlq_n_u8(in.val[0], 4), vshrq_n_u8(in.val[1], 4)), mask);
+    out.val[2] = vandq_u8(
+        vorrq_u8(vshlq_n_u8(in.val[1], 2), vshrq_n_u8(in.val[2], 6)), mask);
+    out.val[3] = vandq_u8(in.val[2], mask);
+    out.val[0] = vqtbl4q_u8(map, out.val[0]);
+    out.val[1] = vqtbl4q_u8(map, out.val[1]);
+    out.val[2] = vqtbl4q_u8(map, out.val[2]);
+    out.val[3] = vqtbl4q_u8(map, out.val[3]);
+    vst4q_u8((uint8_t *)target, out);
+    target += 64;
+  }
+  return i;
+}
+
+/* maps 16 Base64 characters (any variant) to their 6 bit values. */
+static inline uint8x16_t fio_base64_decode_map(uint8x16_t in,
+                                               uint8x16_t *valid) {
+#define FIO_BASE64_IN_RANGE(from, to)                                          \
+  vandq_u8(vcgeq_u8(in, vdupq_n_u8(from)), vcleq_u8(in, vdupq_n_u8(to)))
+#define FIO_BASE64_IS(ch) vceqq_u8(in, vdupq_n_u8(ch))
+  const uint8x16_t upper = FIO_BASE64_IN_RANGE('A', 'Z');
+  const uint8x16_t lower = FIO_BASE64_IN_RANGE('a', 'z');
+  const uint8x16_t digit = FIO_BASE64_IN_RANGE('0', '9');
+  const uint8x16_t c62 = vorrq_u8(
+      vorrq_u8(FIO_BASE64_IS('+'), FIO_BASE64_IS('-')), FIO_BASE64_IS(','));
+  const uint8x16_t c63 = vorrq_u8(FIO_BASE64_IS('/'), FIO_BASE64_IS('_'));
+#undef FIO_BASE64_IS
+#undef FIO_BASE64_IN_RANGE
+  *valid = vandq_u8(*valid, vorrq_u8(vorrq_u8(vorrq_u8(upper, lower), digit),
+                                     vorrq_u8(c62, c63)));
+  return vorrq_u8(
+      vorrq_u8(vandq_u8(upper, vsubq_u8(in, vdupq_n_u8(65))),
+               vandq_u8(lower, vsubq_u8(in, vdupq_n_u8(71)))),
+      vorrq_u8(vandq_u8(digit, vaddq_u8(in, vdupq_n_u8(4))),
+               vorrq_u8(vandq_u8(c62, vdupq_n_u8(62)),
+                        vandq_u8(c63, vdupq_n_u8(63)))));
+}
+
+/*
+ * Decodes 64 byte blocks until a block contains padding, white space or an
+ * invalid character. The last 16 bytes are always left for the scalar decoder.
+ *
+ * Returns the number of bytes consumed (a multiple of 4).
+ */
+static int fio_base64_decode_simd(char *target, const char *encoded,
+                                  int len) {
+  int i = 0;
+  for (; i + 80 <= len; i += 64) {
+    const uint8x16x4_t in = vld4q_u8((const uint8_t *)encoded + i);
+    uint8x16_t valid = vdupq_n_u8(0xFF);
+    const uint8x16_t a = fio_base64_decode_map(in.val[0], &valid);
+    const uint8x16_t b = fio_base64_decode_map(in.val[1], &valid);
+    const uint8x16_t c = fio_base64_decode_map(in.val[2], &valid);
+    const uint8x16_t d = fio_base64_decode_map(in.val[3], &valid);
+    if (vminvq_u8(valid) != 0xFF)
+      break;
+    uint8x16x3_t out;
+    out.val[0] = vorrq_u8(vshlq_n_u8(a, 2), vshrq_n_u8(b, 4));
+    out.val[1] = vorrq_u8(vshlq_n_u8(b, 4), vshrq_n_u8(c, 2));
+    out.val[2] = vorrq_u8(vshlq_n_u8(c, 6), d);
+    vst3q_u8((uint8_t *)target, out);
+    target += 48;
+  }
+  return i;
+}
+#endif
+
 /*
  * The actual encoding logic. The map can be switched for encoding variations.
  */
 static inline int fio_base64_encode_internal(char *target, const char *data,
                                              int len,
                                              const char *base64_encodes) {
+  int simd = 0;
+#if FIO_BASE64_SSSE3 || FIO_BASE64_NEON
+  /* vector blocks are written forwards, so the buffers mustn't overlap */
+  if (
+#if FIO_BASE64_SSSE3
+      fio_cpu_ssse3 &&
+#endif
+      len >= 48 &&
+      (target >= data + len || target + (((len + 2) / 3) << 2) <= data)) {
+    simd = fio_base64_encode_simd(target, data, len, base64_encodes);
+    target += (simd / 3) << 2;
+    data += simd;
+    len -= simd;
+  }
+#endif
   /* walk backwards, allowing fo inplace decoding (target == data) */
   int groups = len / 3;
   const int mod = len - (groups * 3);
@@ -8455,7 +13451,7 @@ static inline int fio_base64_encode_internal(char *target, const char *data,
     *(writer--) = base64_encodes[(((tmp1 & 3) << 4) | ((tmp2 >> 4) & 15))];
     *(writer--) = base64_encodes[(tmp1 >> 2) & 63];
   }
-  return target_size;
+  return target_size + ((simd / 3) << 2);
 }
 
 /**
@@ -8530,6 +13526,19 @@ int fio_base64_decode(char *target, char *encoded, int base64_len) {
     if (!base64_len) {
       return written;
     }
+#if FIO_BASE64_SSSE3 || FIO_BASE64_NEON
+#if FIO_BASE64_SSSE3
+    if (fio_cpu_ssse3)
+#endif
+    {
+      /* leaves at least 16 bytes, so the next group is always available */
+      const int simd = fio_base64_decode_simd(target, encoded, base64_len);
+      encoded += simd;
+      base64_len -= simd;
+      target += (simd >> 2) * 3;
+      written += (simd >> 2) * 3;
+    }
+#endif
     tmp1 = *(uint8_t *)(encoded++);
     tmp2 = *(uint8_t *)(encoded++);
     tmp3 = *(uint8_t *)(encoded++);
@@ -9169,6 +14178,53 @@ FIO_FUNC void fio_malloc_test(void) {
   FIO_ASSERT(mem[0] == 'a', "fio_realloc memory wasn't copied!\n");
   FIO_ASSERT(arena_last_used, "arena_last_used wasn't initialized!\n");
   fio_free(mem);
+#if FIO_MEMORY_SLABS
+  {
+    /* slab slices are reused and zeroed out */
+    char *s1 = fio_malloc(24);
+    char *s2 = fio_malloc(24);
+    FIO_ASSERT(s1 && s2, "fio_malloc failed to allocate slab memory!\n");
+    FIO_ASSERT(((uintptr_t)s1 & (~FIO_MEMORY_BLOCK_MASK)) ==
+                       ((uintptr_t)s2 & (~FIO_MEMORY_BLOCK_MASK)) &&
+                   ((block_s *)((uintptr_t)s1 & (~FIO_MEMORY_BLOCK_MASK)))
+                       ->max,
+               "slab allocations should share a slab!\n");
+    s1[0] = 'a';
+    s1[31] = 'z';
+    fio_free(s1);
+    mem = fio_malloc(32);
+    FIO_ASSERT(mem == s1, "slab slice wasn't reused (%p != %p)!\n",
+               (void *)mem, (void *)s1);
+    FIO_ASSERT(!mem[0] && !mem[31], "reused slab slice isn't zeroed out!\n");
+    FIO_ASSERT(fio_realloc(mem, 30) == mem,
+               "slab realloc within the size class should keep the slice!\n");
+    fio_free(mem);
+    fio_free(s2);
+  }
+  {
+    /* fill a slab (and then some), then free it all */
+    fio_malloc_stats_s stats = fio_malloc_stats();
+    const size_t count = (FIO_MEMORY_BLOCK_SIZE / 16) + 1;
+    void **slices = fio_malloc(count * sizeof(*slices));
+    FIO_ASSERT(slices, "fio_malloc failed to allocate memory!\n");
+    for (size_t i = 0; i < count; ++i) {
+      slices[i] = fio_malloc(16);
+      FIO_ASSERT(slices[i], "fio_malloc failed to allocate slab memory!\n");
+    }
+    FIO_ASSERT(fio_malloc_stats().slabs > stats.slabs &&
+                   fio_malloc_stats().slab_bytes == stats.slab_bytes +
+                                                        (count << 4),
+               "fio_malloc_stats didn't count slab allocations!\n");
+    for (size_t i = 0; i < count; ++i) {
+      fio_free(slices[i]);
+    }
+    fio_free(slices);
+    FIO_ASSERT(fio_malloc_stats().slabs == stats.slabs &&
+                   fio_malloc_stats().slab_bytes == stats.slab_bytes,
+               "empty slabs weren't returned to the memory pool!\n");
+  }
+  mem = fio_malloc(1);
+#else
   block_s *b = arena_last_used->block;
 
   /* move arena to block's start */
@@ -9177,8 +14233,8 @@ FIO_FUNC void fio_malloc_test(void) {
     FIO_ASSERT(mem, "fio_malloc failed to allocate memory!\n");
     fio_free(mem);
   }
-  /* make sure a block is assigned */
-  fio_free(fio_malloc(1));
+  /* make sure a block is assigned (`mem` was already freed) */
+  mem = fio_malloc(1);
   b = arena_last_used->block;
   size_t count = 1;
   /* count allocations within block */
@@ -9233,6 +14289,7 @@ FIO_FUNC void fio_malloc_test(void) {
 #endif
     ++count;
   } while (arena_last_used->block == b);
+#endif /* FIO_MEMORY_SLABS */
 
   mem2 = mem;
   mem = fio_calloc(FIO_MEMORY_BLOCK_ALLOC_LIMIT - 64, 1);
@@ -9271,9 +14328,20 @@ FIO_FUNC void fio_malloc_test(void) {
   {
     size_t pool_size = 0;
     FIO_LS_EMBD_FOR(&memory.available, node) { ++pool_size; }
+    fio_malloc_stats_s stats = fio_malloc_stats();
+    FIO_ASSERT(stats.pool == pool_size,
+               "fio_malloc_stats pool count error (%zu != %zu)!\n", stats.pool,
+               pool_size);
+    FIO_ASSERT(stats.system == (stats.blocks + stats.pool) *
+                                   FIO_MEMORY_BLOCK_SIZE,
+               "fio_malloc_stats block count error!\n");
     mem = fio_mmap(512);
     FIO_ASSERT(mem, "fio_mmap allocation failed!\n");
+    FIO_ASSERT(fio_malloc_stats().big >= stats.big + 512,
+               "fio_malloc_stats didn't count a big allocation!\n");
     fio_free(mem);
+    FIO_ASSERT(fio_malloc_stats().big == stats.big,
+               "fio_malloc_stats didn't count a big allocation's release!\n");
     size_t new_pool_size = 0;
     FIO_LS_EMBD_FOR(&memory.available, node) { ++new_pool_size; }
     FIO_ASSERT(new_pool_size == pool_size,
@@ -9341,7 +14409,6 @@ FIO_FUNC void fio_timer_test(void) {
   size_t result = 0;
   const size_t total = 5;
   fio_data->active = 1;
-  FIO_ASSERT(fio_timers.next, "Timers not initialized!");
   FIO_ASSERT(fio_run_every(0, 0, fio_timer_test_task, NULL, NULL) == -1,
              "Timers without an interval should be an error.");
   FIO_ASSERT(fio_run_every(1000, 0, NULL, NULL, NULL) == -1,
@@ -9349,18 +14416,18 @@ FIO_FUNC void fio_timer_test(void) {
   FIO_ASSERT(fio_run_every(900, total, fio_timer_test_task, &result,
                            fio_timer_test_task) == 0,
              "Timer creation failure.");
-  FIO_ASSERT(fio_ls_embd_any(&fio_timers),
-             "Timer scheduling failure - no timer in list.");
+  FIO_ASSERT(fio_timers.count == 1,
+             "Timer scheduling failure - no timer in heap.");
   FIO_ASSERT(fio_timer_calc_first_interval() >= 898 &&
                  fio_timer_calc_first_interval() <= 902,
              "next timer calculation error %zu",
              fio_timer_calc_first_interval());
 
-  fio_ls_embd_s *first = fio_timers.next;
+  fio_timer_s *first = fio_timers.heap[0];
   FIO_ASSERT(fio_run_every(10000, total, fio_timer_test_task, &result,
                            fio_timer_test_task) == 0,
              "Timer creation failure (second timer).");
-  FIO_ASSERT(fio_timers.next == first, "Timer Ordering error!");
+  FIO_ASSERT(fio_timers.heap[0] == first, "Timer Ordering error!");
 
   FIO_ASSERT(fio_timer_calc_first_interval() >= 898 &&
                  fio_timer_calc_first_interval() <= 902,
@@ -9381,7 +14448,7 @@ FIO_FUNC void fio_timer_test(void) {
                 (i == total - 1 && result == total + 1)),
                "Timer running and rescheduling error (%zu != %zu)\n", result,
                i + 1);
-    FIO_ASSERT(fio_timers.next == first || i == total - 1,
+    FIO_ASSERT(fio_timers.heap[0] == first || i == total - 1,
                "Timer Ordering error on cycle %zu!", i);
   }
 
@@ -9390,6 +14457,44 @@ FIO_FUNC void fio_timer_test(void) {
   fio_defer_perform();
   FIO_ASSERT(result == total + 2, "Timer # 2 error (%zu != %zu)\n", result,
              total + 2);
+
+  /* cancellation */
+  {
+    size_t cancelled = 0;
+    const size_t existing = fio_timers.count;
+    fio_timer_s *handles[16];
+    for (size_t i = 0; i < 16; ++i) {
+      /* interleave timers that will not be cancelled */
+      FIO_ASSERT(fio_run_every(100 + (i * 7) % 13, 1, fio_timer_test_task,
+                               &result, NULL) == 0,
+                 "Timer creation failure (uncancelled timer).");
+      handles[i] = fio_run_every2(100 + (i * 7) % 13, 0, fio_timer_test_task,
+                                  &cancelled, fio_timer_test_task);
+      FIO_ASSERT(handles[i], "Timer creation failure (cancellation handle).");
+    }
+    for (size_t i = 1; i < fio_timers.count; ++i) {
+      FIO_ASSERT(fio_timer_compare(fio_timers.heap[(i - 1) >> 2]->due,
+                                   fio_timers.heap[i]->due) >= 0,
+                 "Timer heap ordering error at %zu", i);
+    }
+    for (size_t i = 0; i < 16; ++i) {
+      fio_timer_cancel(handles[i]);
+      fio_timer_cancel(handles[i]); /* double cancellation is ignored */
+    }
+    fio_defer_perform();
+    FIO_ASSERT(cancelled == 16,
+               "Timer cancellation should call on_finish (%zu != 16)",
+               cancelled);
+    FIO_ASSERT(fio_timers.count == existing + 16,
+               "Timer cancellation removed wrong timers (%zu != %zu)",
+               fio_timers.count, existing + 16);
+    result = 0;
+    fio_data->last_cycle.tv_sec += 1;
+    fio_timer_schedule();
+    fio_defer_perform();
+    FIO_ASSERT(result == 16 && cancelled == 16,
+               "Cancelled timers performed (%zu, %zu)", result, cancelled);
+  }
   fio_data->active = 0;
   fio_timer_clear_all();
   fio_defer_clear_tasks();
@@ -9437,6 +14542,11 @@ FIO_FUNC void fio_socket_test(void) {
     FIO_ASSERT(uuid_data(client1).packet, "fio_write error, no packet!")
     /* prevent poll from hanging */
     fio_run_every(5, 1, fio_timer_test_task, &timer_junk, fio_timer_test_task);
+    /* test using batched event dispatching */
+    fio_poll_batch_set(FIO_POLL_MAX_BATCH + 1);
+    FIO_ASSERT(fio_poll_batch_get() == FIO_POLL_MAX_BATCH,
+               "fio_poll_batch_set should limit the batch size");
+    fio_poll_batch_set(8);
     errno = EAGAIN;
     for (size_t i = 0; i < 100 && r <= 0 &&
                        (r == 0 || errno == EAGAIN || errno == EWOULDBLOCK);
@@ -9458,6 +14568,7 @@ FIO_FUNC void fio_socket_test(void) {
                tmp_buf);
     fprintf(stderr, "* Unix socket Read/Write cycle passed: %.*s\n", (int)r,
             tmp_buf);
+    fio_poll_batch_set(0);
     fio_data->last_cycle.tv_sec += 10;
     fio_timer_clear_all();
   }
@@ -9488,6 +14599,28 @@ FIO_FUNC void fio_socket_test(void) {
   FIO_ASSERT(client2 != -1,
              "Failed to accept TCP/IP socket connection on port 8765");
   fprintf(stderr, "* TCP/IP client2 addr %s\n", fio_peer_addr(client2).data);
+  {
+    /* queued buffers should be sent using a single (vectored) write */
+    char tmp_buf[28];
+    ssize_t r = -1;
+    fio_write(client1, "Hello", 5);
+    fio_write(client1, " ", 1);
+    fio_write(client1, "World", 5);
+    fio_flush(client1);
+    FIO_ASSERT(!uuid_data(client1).packet,
+               "fio_flush should gather all the queued buffers");
+    errno = EAGAIN;
+    for (size_t i = 0; i < 100 && r <= 0 &&
+                       (r == 0 || errno == EAGAIN || errno == EWOULDBLOCK);
+         ++i) {
+      fio_reschedule_thread();
+      errno = 0;
+      r = fio_read(client2, tmp_buf, 28);
+    }
+    FIO_ASSERT(r == 11 && !memcmp("Hello World", tmp_buf, 11),
+               "TCP/IP writev cycle error (%zd: %.*s)", r, (int)r, tmp_buf);
+    fprintf(stderr, "* TCP/IP writev cycle passed: %.*s\n", (int)r, tmp_buf);
+  }
   fio_force_close(client1);
   fio_force_close(client2);
   fio_force_close(uuid);
@@ -9496,6 +14629,72 @@ FIO_FUNC void fio_socket_test(void) {
   fprintf(stderr, "* passed.\n");
 }
 
+/* *****************************************************************************
+Testing UDP sockets
+***************************************************************************** */
+
+typedef struct {
+  size_t count;
+  uint8_t error;
+  fio_datagram_s last;
+} fio_udp_test_s;
+
+FIO_FUNC void fio_udp_test_on_datagram(intptr_t uuid, fio_datagram_s *d,
+                                       void *udata) {
+  fio_udp_test_s *t = udata;
+  /* datagram `i` is `i` bytes long (the first 64 are 100 bytes long) */
+  const size_t i = t->count++;
+  if (d->data.len != (i < 64 ? 100 : i) ||
+      (uint8_t)d->data.data[d->data.len - 1] != (uint8_t)i)
+    t->error = 1;
+  t->last = *d;
+  (void)uuid;
+}
+
+FIO_FUNC void fio_udp_test(void) {
+  fprintf(stderr, "=== Testing UDP sockets (batched reads / writes)\n");
+  intptr_t srv = fio_udp_socket("127.0.0.1", "8766", 1);
+  FIO_ASSERT(srv != -1, "Failed to open UDP socket on port 8766");
+  intptr_t client = fio_udp_socket("127.0.0.1", "8766", 0);
+  FIO_ASSERT(client != -1, "Failed to open a UDP client socket");
+  fprintf(stderr, "* UDP client addr %s\n", fio_peer_addr(client).data);
+  /* 64 equal datagrams (GSO, when supported) followed by varying lengths */
+  static char data[96][100];
+  fio_datagram_s d[96];
+  for (size_t i = 0; i < 96; ++i) {
+    const size_t len = (i < 64 ? 100 : i);
+    memset(data[i], (int)i, len);
+    d[i] = (fio_datagram_s){.data = {.data = data[i], .len = len}};
+  }
+  FIO_ASSERT(fio_udp_send(client, d, 96) == 96,
+             "fio_udp_send should send all the datagrams");
+  fio_udp_test_s t = {.count = 0};
+  for (size_t i = 0; i < 100 && t.count < 96; ++i) {
+    fio_reschedule_thread();
+    FIO_ASSERT(fio_udp_read(srv, fio_udp_test_on_datagram, &t) >= 0,
+               "fio_udp_read error");
+  }
+  FIO_ASSERT(t.count == 96, "fio_udp_read missed datagrams (%zu/96)",
+             t.count);
+  FIO_ASSERT(!t.error, "fio_udp_read datagram data / order error");
+  FIO_ASSERT(t.last.addr_len, "fio_udp_read should collect the peer address");
+  /* reply to the sender's address */
+  fio_datagram_s reply = t.last;
+  reply.data = (fio_str_info_s){.data = (char *)"pong", .len = 4};
+  FIO_ASSERT(fio_udp_send(srv, &reply, 1) == 1, "UDP reply failed");
+  t = (fio_udp_test_s){.count = 95};
+  for (size_t i = 0; i < 100 && t.count == 95; ++i) {
+    fio_reschedule_thread();
+    fio_udp_read(client, fio_udp_test_on_datagram, &t);
+  }
+  FIO_ASSERT(t.count == 96 && t.last.data.len == 4,
+             "UDP reply wasn't received");
+  fio_force_close(client);
+  fio_force_close(srv);
+  fio_defer_clear_tasks();
+  fprintf(stderr, "* passed.\n");
+}
+
 /* *****************************************************************************
 Testing listening socket
 ***************************************************************************** */
@@ -9525,6 +14724,361 @@ FIO_FUNC void fio_cycle_test(void) {
              "facil.io cycling error?");
   fprintf(stderr, "* passed.\n");
 }
+
+/* *****************************************************************************
+Testing the connection data table's growth
+***************************************************************************** */
+
+FIO_FUNC void fio_fd_data_test(void) {
+  fprintf(stderr, "=== Testing connection data growth (on demand)\n");
+  const uint32_t ready = fio_data->ready;
+  FIO_ASSERT(ready == fio_data->capa || !(ready % FIO_FD_DATA_CHUNK),
+             "connection data should grow in chunks (%u)", ready);
+  const int fd = (int)fio_data->capa - 1;
+  if (ready > (uint32_t)fd) {
+    fprintf(stderr, "* skipped (all %u connections initialized).\n", ready);
+    return;
+  }
+  FIO_ASSERT(!uuid_is_valid(((intptr_t)fd << 8) | 0),
+             "uninitialized connection data shouldn't be valid");
+  int sock = socket(AF_INET, SOCK_STREAM, 0);
+  FIO_ASSERT(sock != -1 && dup2(sock, fd) == fd, "couldn't open fd %d", fd);
+  close(sock);
+  intptr_t uuid = fio_fd2uuid(fd);
+  FIO_ASSERT(uuid != -1 && fio_is_valid(uuid), "fio_fd2uuid failed");
+  FIO_ASSERT(fio_data->ready == fio_data->capa,
+             "connection data didn't grow (%u)", fio_data->ready);
+  FIO_ASSERT(fd_data(fd).rw_hooks == &FIO_DEFAULT_RW_HOOKS &&
+                 fd_data(fd).packet_last == &fd_data(fd).packet,
+             "connection data wasn't initialized");
+  fio_force_close(uuid);
+  fio_defer_perform();
+  fprintf(stderr, "* passed.\n");
+}
+
+/* *****************************************************************************
+Testing the timeout review buckets
+***************************************************************************** */
+
+static size_t fio_timeout_test_pings;
+FIO_FUNC void fio_timeout_test_ping(intptr_t uuid, fio_protocol_s *protocol) {
+  ++fio_timeout_test_pings;
+  fio_touch(uuid);
+  (void)protocol;
+}
+
+/* the bucket (index + 1) a connection should be placed in */
+#define FIO_TIMEOUT_TEST_BUCKET(sec) (((sec) & (FIO_TIMEOUT_BUCKETS - 1)) + 1)
+
+FIO_FUNC void fio_timeout_test(void) {
+  fprintf(stderr, "=== Testing connection timeout review buckets\n");
+  int fds[2];
+  FIO_ASSERT(!pipe(fds), "pipe failed");
+  fio_mark_time();
+  fio_data->timeout_reviewed = fio_data->last_cycle.tv_sec;
+  const time_t start = fio_data->last_cycle.tv_sec;
+  fio_protocol_s pr = {.ping = fio_timeout_test_ping};
+  intptr_t uuid = fio_fd2uuid(fds[0]);
+  fio_attach(uuid, &pr);
+  FIO_ASSERT(fio_data->timeouts[fds[0]].bucket ==
+                 FIO_TIMEOUT_TEST_BUCKET(start + FIO_TIMEOUT_DEFAULT),
+             "connections should be reviewed after the default timeout");
+  fio_timeout_set(uuid, 2);
+  FIO_ASSERT(fio_data->timeouts[fds[0]].bucket ==
+                 FIO_TIMEOUT_TEST_BUCKET(start + 2),
+             "connections should be placed in the timeout's bucket");
+  /* nothing expires before the timeout */
+  fio_data->last_cycle.tv_sec = start + 2;
+  fio_review_timeout(NULL, NULL);
+  fio_defer_perform();
+  FIO_ASSERT(!fio_timeout_test_pings, "connection pinged before timeout");
+  FIO_ASSERT(fio_data->timeouts[fds[0]].bucket ==
+                 FIO_TIMEOUT_TEST_BUCKET(start + 3),
+             "connection should be reviewed again once it expires");
+  /* expired connections are pinged */
+  fio_data->last_cycle.tv_sec = start + 3;
+  fio_review_timeout(NULL, NULL);
+  fio_defer_perform();
+  FIO_ASSERT(fio_timeout_test_pings == 1,
+             "expired connection should be pinged (%zu)",
+             fio_timeout_test_pings);
+  /* touched connections are placed in their new bucket when reviewed */
+  fio_data->last_cycle.tv_sec = start + 4;
+  fio_review_timeout(NULL, NULL);
+  fio_defer_perform();
+  FIO_ASSERT(fio_timeout_test_pings == 1, "touched connection was pinged");
+  FIO_ASSERT(fio_data->timeouts[fds[0]].bucket ==
+                 FIO_TIMEOUT_TEST_BUCKET(start + 5),
+             "touched connection should be moved to a later bucket");
+  /* closed connections are removed */
+  fio_force_close(uuid);
+  fio_defer_perform();
+  FIO_ASSERT(!fio_data->timeouts[fds[0]].bucket &&
+                 !fio_data->timeout_wheel[start & (FIO_TIMEOUT_BUCKETS - 1)],
+             "closed connection should be removed from the buckets");
+  close(fds[1]);
+  fio_mark_time();
+  fio_data->timeout_reviewed = fio_data->last_cycle.tv_sec;
+  fio_timeout_test_pings = 0;
+  fprintf(stderr, "* passed.\n");
+}
+#undef FIO_TIMEOUT_TEST_BUCKET
+
+/* *****************************************************************************
+Testing the outgoing queue's watermarks
+***************************************************************************** */
+
+static size_t fio_watermarks_test_events[2];
+
+FIO_FUNC void fio_watermarks_test_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  ++fio_watermarks_test_events[0];
+  (void)uuid, (void)pr;
+}
+FIO_FUNC void fio_watermarks_test_on_ready(intptr_t uuid, fio_protocol_s *pr) {
+  ++fio_watermarks_test_events[1];
+  (void)uuid, (void)pr;
+}
+
+/* queues 1KB and returns `fio_write`'s result */
+FIO_FUNC ssize_t fio_watermarks_test_write(intptr_t uuid) {
+  static char buffer[1024];
+  return fio_write(uuid, buffer, sizeof(buffer));
+}
+
+FIO_FUNC void fio_watermarks_test(void) {
+  fprintf(stderr, "=== Testing the outgoing queue's watermarks\n");
+  int fds[2];
+  fio_protocol_s pr = {.on_data = fio_watermarks_test_on_data,
+                       .on_ready = fio_watermarks_test_on_ready};
+  for (int policy = FIO_WATERMARK_SUSPEND; policy <= FIO_WATERMARK_CLOSE;
+       ++policy) {
+    FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds), "socketpair failed");
+    FIO_ASSERT(fio_set_non_block(fds[0]) != -1, "non-blocking mode failed");
+    intptr_t uuid = fio_fd2uuid(fds[0]);
+    fio_attach(uuid, &pr);
+    FIO_ASSERT(!fio_watermarks(uuid, .high = 2048, .low = 4096,
+                               .policy = (fio_watermark_policy_e)policy),
+               "fio_watermarks failed");
+    FIO_ASSERT(uuid_data(uuid).watermark_low == 1024,
+               "low watermark should be less than the high watermark");
+    fio_watermarks_test_events[0] = fio_watermarks_test_events[1] = 0;
+    FIO_ASSERT(!fio_watermarks_test_write(uuid) &&
+                   !fio_watermarks_test_write(uuid),
+               "writing up to the high watermark should succeed");
+    FIO_ASSERT(fio_pending_bytes(uuid) == 2048 && !uuid_data(uuid).congested,
+               "pending bytes error (%zu)", fio_pending_bytes(uuid));
+    ssize_t ret = fio_watermarks_test_write(uuid);
+    FIO_ASSERT(uuid_data(uuid).congested ||
+                   (policy == FIO_WATERMARK_CLOSE && !fio_is_valid(uuid)),
+               "exceeding the high watermark should congest the connection");
+    switch (policy) {
+    case FIO_WATERMARK_SUSPEND:
+      FIO_ASSERT(!ret, "the suspend policy shouldn't fail writes");
+      fio_trylock(&uuid_data(uuid).scheduled);
+      deferred_on_data((void *)uuid, (void *)1);
+      FIO_ASSERT(!fio_watermarks_test_events[0],
+                 "on_data should be suspended while congested");
+      break;
+    case FIO_WATERMARK_DROP:
+      FIO_ASSERT(!ret, "the write crossing the watermark shouldn't fail");
+      FIO_ASSERT(fio_watermarks_test_write(uuid) == -1 && errno == ENOBUFS &&
+                     fio_pending_bytes(uuid) == 3072,
+                 "the drop policy should fail writes while congested");
+      break;
+    case FIO_WATERMARK_CLOSE:
+      FIO_ASSERT(ret == -1 && !fio_is_valid(uuid),
+                 "the close policy should close the connection");
+      fio_defer_perform();
+      close(fds[1]);
+      continue;
+    }
+    /* draining the queue resumes the connection */
+    fio_flush_strong(uuid);
+    fio_defer_perform();
+    FIO_ASSERT(!fio_pending_bytes(uuid) && !uuid_data(uuid).congested,
+               "draining should clear the congestion");
+    FIO_ASSERT(fio_watermarks_test_events[1],
+               "on_ready should be called once the queue drains");
+    FIO_ASSERT(policy != FIO_WATERMARK_SUSPEND || fio_watermarks_test_events[0],
+               "on_data should resume once the queue drains");
+    FIO_ASSERT(!fio_watermarks_test_write(uuid), "writing should resume");
+    fio_force_close(uuid);
+    fio_defer_perform();
+    close(fds[1]);
+  }
+  fprintf(stderr, "* passed.\n");
+}
+
+/* *****************************************************************************
+Testing forced `on_data` event fairness
+***************************************************************************** */
+
+FIO_FUNC void fio_fair_on_data_test(void) {
+#if FIO_FAIR_ON_DATA
+  fprintf(stderr, "=== Testing forced on_data events (one per cycle)\n");
+  int fds[2];
+  FIO_ASSERT(!pipe(fds), "pipe failed");
+  fio_protocol_s pr = {.on_data = fio_watermarks_test_on_data};
+  intptr_t uuid = fio_fd2uuid(fds[0]);
+  fio_attach(uuid, &pr);
+  const uint8_t old_active = fio_data->active;
+  fio_data->active = 1;
+  fio_watermarks_test_events[0] = 0;
+  fio_force_event(uuid, FIO_EVENT_ON_DATA);
+  fio_defer_perform();
+  FIO_ASSERT(fio_watermarks_test_events[0] == 1, "forced on_data missing");
+  /* a second forced event during the same cycle waits for the next cycle */
+  fio_force_event(uuid, FIO_EVENT_ON_DATA);
+  fio_defer_perform();
+  FIO_ASSERT(fio_watermarks_test_events[0] == 1 &&
+                 fio_on_data_postponed.count == 1 &&
+                 !fio_timer_calc_first_interval(),
+             "forced on_data should be postponed to the next cycle");
+  ++fio_data->turn;
+  fio_on_data_resume();
+  fio_defer_perform();
+  FIO_ASSERT(fio_watermarks_test_events[0] == 2 &&
+                 !fio_on_data_postponed.count,
+             "postponed on_data should be performed in the next cycle");
+  fio_data->active = old_active;
+  fio_force_close(uuid);
+  fio_defer_perform();
+  close(fds[1]);
+  fprintf(stderr, "* passed.\n");
+#endif
+}
+
+/* *****************************************************************************
+Testing the runtime metrics
+***************************************************************************** */
+
+FIO_FUNC void fio_metrics_test_task(void *a1, void *a2) { (void)a1, (void)a2; }
+
+FIO_FUNC void fio_metrics_test(void) {
+#if FIO_METRICS
+  fprintf(stderr, "=== Testing runtime metrics\n");
+  char buffer[128] = {0};
+  int fds[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds), "socketpair failed");
+  FIO_ASSERT(fio_set_non_block(fds[0]) != -1, "non-blocking mode failed");
+  fio_protocol_s pr = {.on_data = fio_watermarks_test_on_data};
+  intptr_t uuid = fio_fd2uuid(fds[0]);
+  const fio_metrics_s m0 = fio_metrics();
+  fio_attach(uuid, &pr);
+  fio_defer_perform();
+  FIO_ASSERT(write(fds[1], buffer, 100) == 100, "write failed");
+  FIO_ASSERT(fio_read(uuid, buffer, sizeof(buffer)) == 100, "fio_read failed");
+  fio_write(uuid, buffer, 64);
+  fio_metrics_s m = fio_metrics();
+  FIO_ASSERT(m.open == m0.open + 1, "open connections error (%zu != %zu + 1)",
+             m.open, m0.open);
+  FIO_ASSERT(m.packets_pending == m0.packets_pending + 1 &&
+                 m.bytes_pending == m0.bytes_pending + 64,
+             "pending packets error (%zu bytes)", m.bytes_pending);
+  fio_flush_strong(uuid);
+  for (size_t i = 0; i < 16; ++i)
+    fio_defer(fio_metrics_test_task, NULL, NULL);
+  fio_publish(.engine = FIO_PUBSUB_PROCESS, .channel = {0, 7, "metrics"},
+              .message = {0, 4, "test"});
+  m = fio_metrics();
+  FIO_ASSERT(m.tasks_pending >= 16, "pending tasks error (%zu)",
+             m.tasks_pending);
+  fio_defer_perform();
+  fio_force_close(uuid);
+  fio_defer_perform();
+  m = fio_metrics();
+  FIO_ASSERT(m.tasks >= m0.tasks + 16 && !m.tasks_pending,
+             "performed tasks error (%zu)", m.tasks - m0.tasks);
+  FIO_ASSERT(m.bytes_read == m0.bytes_read + 100 &&
+                 m.bytes_written == m0.bytes_written + 64,
+             "bytes read / written error (%zu / %zu)",
+             m.bytes_read - m0.bytes_read, m.bytes_written - m0.bytes_written);
+  FIO_ASSERT(m.closed == m0.closed + 1 && m.open == m0.open,
+             "closed connections error");
+  FIO_ASSERT(m.published == m0.published + 1, "published messages error");
+  FIO_ASSERT(m.memory.system == fio_malloc_stats().system,
+             "memory statistics missing");
+  close(fds[1]);
+  fprintf(stderr, "* passed.\n");
+#endif
+}
+
+/* *****************************************************************************
+Testing the trace points
+***************************************************************************** */
+
+FIO_FUNC void fio_trace_test(void) {
+#if FIO_TRACE
+  fprintf(stderr, "=== Testing trace events (Chrome trace format)\n");
+  fio_defer(fio_metrics_test_task, NULL, NULL);
+  fio_defer_perform();
+  FILE *f = tmpfile();
+  FIO_ASSERT(f, "tmpfile failed");
+  ssize_t count = fio_trace_dump(fileno(f));
+  FIO_ASSERT(count > 0, "trace events missing");
+  long len = ftell(f);
+  FIO_ASSERT(len > 0, "trace wasn't written");
+  char *data = malloc(len + 1);
+  FIO_ASSERT_ALLOC(data);
+  rewind(f);
+  FIO_ASSERT(fread(data, 1, len, f) == (size_t)len, "trace read error");
+  data[len] = 0;
+  fclose(f);
+  FIO_ASSERT(!strncmp(data, "{\"traceEvents\":[\n{\"name\":", 25) &&
+                 strstr(data, "\"name\":\"task\"") &&
+                 strstr(data, "\"queued_us\":") &&
+                 !strcmp(data + len - 26, "],\"displayTimeUnit\":\"ns\"}\n"),
+             "trace format error");
+  free(data);
+  fprintf(stderr, "* passed.\n");
+#else
+  FIO_ASSERT(fio_trace_dump(-1) == -1 && errno == ENOTSUP,
+             "fio_trace_dump should fail when tracing is disabled");
+#endif
+}
+
+/* *****************************************************************************
+Testing the hot restart socket handoff
+***************************************************************************** */
+
+FIO_FUNC void fio_hot_restart_test(void) {
+#if !FIO_DISABLE_HOT_RESTART
+  fprintf(stderr, "=== Testing hot restart socket handoff\n");
+  int fds[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds), "socketpair failed");
+  int listener = socket(AF_INET, SOCK_STREAM, 0);
+  FIO_ASSERT(listener != -1, "socket failed");
+  FIO_ASSERT(!fio_hot_restart_send(fds[0], 'L', "3000", NULL, listener) &&
+                 !fio_hot_restart_send(fds[0], 'L', NULL, "/tmp/fio", -1) &&
+                 !fio_hot_restart_send(fds[0], 'E', NULL, NULL, -1),
+             "couldn't send the hot restart records");
+  fio_hot_restart_data.loaded = 1; /* don't read the environment */
+  fio_hot_restart_receive(fds[1]);
+  FIO_ASSERT(fio_hot_restart_data.count == 1,
+             "records without a socket should be ignored (%zu)",
+             fio_hot_restart_data.count);
+  FIO_ASSERT(fio_hot_restart_inherited(NULL, "3001") == -1 &&
+                 fio_hot_restart_inherited("localhost", "3000") == -1,
+             "inherited socket matched the wrong address");
+  intptr_t uuid = fio_hot_restart_inherited(NULL, "3000");
+  FIO_ASSERT(uuid != -1 && fio_is_valid(uuid), "inherited socket missing");
+  FIO_ASSERT(fio_hot_restart_inherited(NULL, "3000") == -1,
+             "inherited socket should only be reused once");
+  fio_force_close(uuid);
+  fio_defer_perform();
+  free(fio_hot_restart_data.inherited);
+  fio_hot_restart_data.inherited = NULL;
+  fio_hot_restart_data.count = 0;
+  close(listener);
+  close(fds[0]);
+  close(fds[1]);
+  fprintf(stderr, "* passed.\n");
+#else
+  FIO_ASSERT(fio_hot_restart() == -1 && errno == ENOTSUP,
+             "fio_hot_restart should fail when it's disabled");
+#endif
+}
+
 /* *****************************************************************************
 Testing fio_defer task system
 ***************************************************************************** */
@@ -9546,6 +15100,25 @@ FIO_FUNC void sched_sample_task(void *count, void *i_count) {
   }
 }
 
+/* the order in which the priority test tasks were performed */
+static struct {
+  size_t count;
+  char log[(FIO_DEFER_BACKGROUND_WEIGHT * 3) + 3];
+} fio_defer_priority_test_data;
+
+FIO_FUNC void fio_defer_priority_test_task(void *id, void *unused2) {
+  fio_defer_priority_test_data
+      .log[fio_defer_priority_test_data.count++] = (char)(uintptr_t)id;
+  (void)unused2;
+}
+
+/* counts tasks performed outside the main thread and posts a completion */
+FIO_FUNC void fio_defer_blocking_test_task(void *i_count, void *main_thread) {
+  if (!pthread_equal(pthread_self(), *(pthread_t *)main_thread))
+    fio_atomic_add((uintptr_t *)i_count, 1);
+  fio_defer(sample_task, i_count, NULL);
+}
+
 FIO_FUNC void fio_defer_test(void) {
   const size_t cpu_cores = fio_detect_cpu_cores();
   FIO_ASSERT(cpu_cores, "couldn't detect CPU cores!");
@@ -9603,7 +15176,67 @@ FIO_FUNC void fio_defer_test(void) {
   }
   FIO_ASSERT(task_queue_normal.writer == &task_queue_normal.static_queue,
              "defer library didn't release dynamic queue (should be static)");
+#if FIO_DEFER_WORK_STEALING
+  FIO_ASSERT(!fio_defer_local.count && !fio_defer_local.queues,
+             "thread pool didn't release per-thread queues");
+#endif
   fprintf(stderr, "\n* passed.\n");
+
+  fprintf(stderr, "=== Testing task priorities (fio_defer_priority)\n");
+  const size_t weight = FIO_DEFER_BACKGROUND_WEIGHT;
+  fio_defer_priority_test_data.count = 0;
+  FIO_ASSERT(fio_defer_priority(FIO_TASK_PRIORITY_BACKGROUND, NULL, NULL,
+                                NULL) == -1,
+             "fio_defer_priority should fail without a task");
+  for (size_t i = 0; i < 2; ++i)
+    fio_defer_priority(FIO_TASK_PRIORITY_BACKGROUND,
+                       fio_defer_priority_test_task, (void *)'b', NULL);
+  for (size_t i = 0; i < weight * 3; ++i)
+    fio_defer(fio_defer_priority_test_task, (void *)'n', NULL);
+  fio_defer_priority(FIO_TASK_PRIORITY_URGENT, fio_defer_priority_test_task,
+                     (void *)'u', NULL);
+  fio_defer_perform();
+  FIO_ASSERT(!fio_defer_has_queue(), "fio_defer_perform left tasks behind");
+  FIO_ASSERT(fio_defer_priority_test_data.count == (weight * 3) + 3,
+             "not all prioritized tasks were performed (%zu)",
+             fio_defer_priority_test_data.count);
+#if FIO_USE_URGENT_QUEUE
+  FIO_ASSERT(fio_defer_priority_test_data.log[0] == 'u',
+             "urgent task should be performed first");
+#endif
+  /* a single background task after every `weight` higher priority tasks */
+  FIO_ASSERT(fio_defer_priority_test_data.log[weight] == 'b' &&
+                 fio_defer_priority_test_data.log[(weight * 2) + 1] == 'b',
+             "background tasks starved or performed out of turn");
+  fprintf(stderr, "* passed.\n");
+
+  fprintf(stderr, "=== Testing the blocking task pool (fio_defer_blocking)\n");
+  pthread_t main_thread = pthread_self();
+  i_count = 0;
+  FIO_ASSERT(fio_defer_blocking(NULL, NULL, NULL) == -1,
+             "fio_defer_blocking should fail without a task");
+  /* without a running pool, blocking tasks are deferred */
+  fio_defer_blocking(sample_task, &i_count, NULL);
+  FIO_ASSERT(fio_defer_has_queue() && !i_count,
+             "fio_defer_blocking should defer tasks when the pool is stopped");
+  fio_defer_perform();
+  FIO_ASSERT(i_count == 1, "blocking task wasn't performed");
+  const size_t blocking_requested = fio_blocking_pool.requested;
+  fio_blocking_pool.requested = 2;
+  fio_defer_blocking_start();
+  FIO_ASSERT(fio_blocking_pool.count == 2, "blocking task pool didn't start");
+  for (size_t i = 0; i < 1024; ++i)
+    fio_defer_blocking(fio_defer_blocking_test_task, &i_count, &main_thread);
+  fio_defer_blocking_stop();
+  fio_blocking_pool.requested = blocking_requested;
+  FIO_ASSERT(i_count == 1025,
+             "blocking tasks should be performed by the blocking pool (%zu)",
+             (size_t)i_count);
+  FIO_ASSERT(!fio_blocking_pool.threads && !task_queue_blocking.count,
+             "blocking task pool wasn't stopped");
+  fio_defer_perform();
+  FIO_ASSERT(i_count == 2049, "blocking task completions weren't performed");
+  fprintf(stderr, "* passed.\n");
 }
 
 /* *****************************************************************************
@@ -9640,6 +15273,79 @@ FIO_FUNC void fio_ary_test(void) {
              ary_alloc_counter);
 }
 
+/* *****************************************************************************
+Read-Write Lock Testing
+***************************************************************************** */
+
+#define FIO_RWLOCK_TEST_THREADS 4
+#define FIO_RWLOCK_TEST_CYCLES 4096
+
+static struct {
+  fio_rwlock_s lock;
+  volatile size_t a;
+  volatile size_t b;
+  volatile size_t reads;
+  volatile size_t errors;
+} fio_rwlock_test_data = {.lock = FIO_RWLOCK_INIT};
+
+FIO_FUNC void *fio_rwlock_test_task(void *arg) {
+  for (size_t i = 0; i < FIO_RWLOCK_TEST_CYCLES; ++i) {
+    if ((i & 15) == 15) {
+      fio_rwlock_write(&fio_rwlock_test_data.lock);
+      ++fio_rwlock_test_data.a;
+      fio_reschedule_thread();
+      ++fio_rwlock_test_data.b;
+      fio_rwlock_write_unlock(&fio_rwlock_test_data.lock);
+      continue;
+    }
+    fio_rwlock_read(&fio_rwlock_test_data.lock);
+    if (fio_rwlock_test_data.a != fio_rwlock_test_data.b)
+      fio_atomic_add(&fio_rwlock_test_data.errors, 1);
+    fio_atomic_add(&fio_rwlock_test_data.reads, 1);
+    fio_rwlock_read_unlock(&fio_rwlock_test_data.lock);
+  }
+  return arg;
+}
+
+FIO_FUNC void fio_rwlock_test(void) {
+  fprintf(stderr, "=== Testing read-write spinlocks\n");
+  fio_rwlock_s l = FIO_RWLOCK_INIT;
+  fio_rwlock_read(&l);
+  fio_rwlock_read(&l);
+  FIO_ASSERT(l.readers == 2 && !fio_is_locked(&l.writer),
+             "readers should share the lock");
+  fio_rwlock_read_unlock(&l);
+  fio_rwlock_read_unlock(&l);
+  fio_rwlock_write(&l);
+  FIO_ASSERT(!l.readers && fio_is_locked(&l.writer),
+             "writers should own the lock");
+  fio_rwlock_write_unlock(&l);
+  FIO_ASSERT(!l.readers && !fio_is_locked(&l.writer),
+             "the lock should be released");
+
+  void *threads[FIO_RWLOCK_TEST_THREADS];
+  for (size_t i = 0; i < FIO_RWLOCK_TEST_THREADS; ++i) {
+    threads[i] = fio_thread_new(fio_rwlock_test_task, NULL);
+    FIO_ASSERT(threads[i], "couldn't start rwlock test thread");
+  }
+  for (size_t i = 0; i < FIO_RWLOCK_TEST_THREADS; ++i)
+    fio_thread_join(threads[i]);
+  FIO_ASSERT(!fio_rwlock_test_data.errors,
+             "readers observed a partial write (%zu times)",
+             (size_t)fio_rwlock_test_data.errors);
+  FIO_ASSERT(fio_rwlock_test_data.a ==
+                 FIO_RWLOCK_TEST_THREADS * (FIO_RWLOCK_TEST_CYCLES >> 4),
+             "writes were lost (%zu)", (size_t)fio_rwlock_test_data.a);
+  FIO_ASSERT(fio_rwlock_test_data.reads ==
+                 FIO_RWLOCK_TEST_THREADS * (FIO_RWLOCK_TEST_CYCLES -
+                                            (FIO_RWLOCK_TEST_CYCLES >> 4)),
+             "reads were lost (%zu)", (size_t)fio_rwlock_test_data.reads);
+  fprintf(stderr, "* passed.\n");
+}
+
+#undef FIO_RWLOCK_TEST_THREADS
+#undef FIO_RWLOCK_TEST_CYCLES
+
 /* *****************************************************************************
 Set data-structure Testing
 ***************************************************************************** */
@@ -9676,6 +15382,13 @@ FIO_FUNC void fio_set_test(void) {
   FIO_ASSERT(!fio_hash_test_is_fragmented(&h),
              "empty hash shouldn't be considered fragmented");
   FIO_ASSERT(!fio_set_test_last(&s), "empty set shouldn't have a last object");
+  FIO_ASSERT(fio_set_test_hash("name", 4) ==
+                 FIO_HASH_FN("name", 4, FIO_HASH_SECRET_SEED64_1,
+                             FIO_HASH_SECRET_SEED64_2),
+             "the Set's default hashing function should be FIO_HASH_FN");
+  FIO_ASSERT(fio_ch_set_hash("name", 4) ==
+                 fio_risky_hash_wide("name", 4, FIO_HASH_SECRET_SEED64_1),
+             "the Set's hashing function should be FIO_SET_HASH_FN");
   FIO_ASSERT(!fio_hash_test_last(&h).key && !fio_hash_test_last(&h).obj,
              "empty hash shouldn't have a last object");
 
@@ -9686,6 +15399,10 @@ FIO_FUNC void fio_set_test(void) {
     FIO_ASSERT(fio_hash_test_find(&h, i, i), "hash find failed after insert");
     FIO_ASSERT(i == fio_set_test_find(&s, i, i), "set insertion != find");
     FIO_ASSERT(i + 1 == fio_hash_test_find(&h, i, i), "hash insertion != find");
+    FIO_ASSERT(i == fio_set_test_find_shared(&s, i, i),
+               "set insertion != find_shared");
+    FIO_ASSERT(i + 1 == fio_hash_test_find_shared(&h, i, i),
+               "hash insertion != find_shared");
   }
   fprintf(stderr, "* Seeking %lu items\n", FIO_SET_TEST_COUNT);
   for (unsigned long i = 1; i < FIO_SET_TEST_COUNT; ++i) {
@@ -9724,6 +15441,14 @@ FIO_FUNC void fio_set_test(void) {
                "Removal failed in set (still exists).");
     FIO_ASSERT(!(fio_hash_test_find(&h, i, i)),
                "Removal failed in hash (still exists).");
+    FIO_ASSERT(!fio_set_test_find_shared(&s, i, i) &&
+                   !fio_hash_test_find_shared(&h, i, i),
+               "Removal failed (find_shared still finds the object).");
+  }
+  for (unsigned long i = 2; i < FIO_SET_TEST_COUNT; i += 2) {
+    FIO_ASSERT(i == fio_set_test_find_shared(&s, i, i) &&
+                   i + 1 == fio_hash_test_find_shared(&h, i, i),
+               "find_shared failed to skip holes");
   }
   {
     fprintf(stderr, "* Testing for %lu / 2 holes\n", FIO_SET_TEST_COUNT);
@@ -9887,14 +15612,16 @@ FIO_FUNC void fio_set_test(void) {
 Bad Hash (risky hash) tests
 ***************************************************************************** */
 
-FIO_FUNC void fio_riskyhash_speed_test(void) {
+FIO_FUNC void fio_riskyhash_speed_test_fn(const char *name,
+                                          uint64_t (*fn)(const void *, size_t,
+                                                         uint64_t)) {
   /* test based on code from BearSSL with credit to Thomas Pornin */
   uint8_t buffer[8192];
   memset(buffer, 'T', sizeof(buffer));
   /* warmup */
   uint64_t hash = 0;
   for (size_t i = 0; i < 4; i++) {
-    hash += fio_risky_hash(buffer, 8192, 1);
+    hash += fn(buffer, 8192, 1);
     memcpy(buffer, &hash, sizeof(hash));
   }
   /* loop until test runs for more than 2 seconds */
@@ -9902,14 +15629,14 @@ FIO_FUNC void fio_riskyhash_speed_test(void) {
     clock_t start, end;
     start = clock();
     for (size_t i = cycles; i > 0; i--) {
-      hash += fio_risky_hash(buffer, 8192, 1);
+      hash += fn(buffer, 8192, 1);
       __asm__ volatile("" ::: "memory");
     }
     end = clock();
     memcpy(buffer, &hash, sizeof(hash));
     if ((end - start) >= (2 * CLOCKS_PER_SEC) ||
         cycles >= ((uint64_t)1 << 62)) {
-      fprintf(stderr, "%-20s %8.2f MB/s\n", "fio_risky_hash",
+      fprintf(stderr, "%-20s %8.2f MB/s\n", name,
               (double)(sizeof(buffer) * cycles) /
                   (((end - start) * 1000000.0 / CLOCKS_PER_SEC)));
       break;
@@ -9918,6 +15645,11 @@ FIO_FUNC void fio_riskyhash_speed_test(void) {
   }
 }
 
+FIO_FUNC void fio_riskyhash_speed_test(void) {
+  fio_riskyhash_speed_test_fn("fio_risky_hash", fio_risky_hash);
+  fio_riskyhash_speed_test_fn("fio_risky_hash_wide", fio_risky_hash_wide);
+}
+
 FIO_FUNC void fio_riskyhash_test(void) {
   fprintf(stderr, "===================================\n");
 #if NODEBUG
@@ -9937,6 +15669,28 @@ FIO_FUNC void fio_riskyhash_test(void) {
                  fio_risky_hash(fio_str_data(&copy), fio_str_len(&copy), 1),
              "Same string values should have the same risky hash");
   fio_str_free(&copy);
+  {
+    uint8_t buffer[256];
+    for (size_t i = 0; i < sizeof(buffer); ++i)
+      buffer[i] = (uint8_t)(i * 7);
+    for (size_t i = 0; i < 64; ++i) {
+      FIO_ASSERT(fio_risky_hash_wide(buffer, i, 1) ==
+                     fio_risky_hash(buffer, i, 1),
+                 "wide risky hash should match risky hash for short data");
+    }
+    for (size_t len = 64; len <= sizeof(buffer); len += 33) {
+      const uint64_t h = fio_risky_hash_wide(buffer, len, 1);
+      FIO_ASSERT(h != fio_risky_hash_wide(buffer, len, 2),
+                 "wide risky hash should depend on the seed");
+      for (size_t i = 0; i < len; ++i) {
+        buffer[i] ^= 1;
+        FIO_ASSERT(h != fio_risky_hash_wide(buffer, len, 1),
+                   "wide risky hash should depend on every byte (%zu/%zu)", i,
+                   len);
+        buffer[i] ^= 1;
+      }
+    }
+  }
   (void)fio_riskyhash_speed_test;
 #endif
 }
@@ -10119,6 +15873,27 @@ FIO_FUNC void fio_sha1_test(void) {
     i++;
   }
   fprintf(stderr, " SHA-1 passed.\n");
+#if FIO_SHA_HW_X86
+  if (fio_cpu_sha_ni) {
+    /* the SHA extensions must match the portable implementation */
+    uint8_t data[300];
+    for (size_t j = 0; j < sizeof(data); ++j)
+      data[j] = (uint8_t)((j * 131) ^ (j >> 3));
+    for (size_t len = 0; len < sizeof(data); ++len) {
+      fio_sha1_s hw = fio_sha1_init();
+      fio_sha1_write(&hw, data, len);
+      fio_sha1_result(&hw);
+      fio_cpu_sha_ni = 0;
+      sha1 = fio_sha1_init();
+      fio_sha1_write(&sha1, data, len);
+      fio_sha1_result(&sha1);
+      fio_cpu_sha_ni = 1;
+      FIO_ASSERT(!memcmp(hw.digest.str, sha1.digest.str, 20),
+                 "SHA-1 extensions result error (length %zu)", len);
+    }
+    fprintf(stderr, "+ fio SHA-1 (SHA extensions) passed.\n");
+  }
+#endif
 #if NODEBUG
   fio_sha1_speed_test();
 #else
@@ -10312,6 +16087,27 @@ FIO_FUNC void fio_sha2_test(void) {
   if (strcmp(expect, got))
     goto error;
   fprintf(stderr, " SHA-2 passed.\n");
+#if FIO_SHA_HW_X86
+  if (fio_cpu_sha_ni) {
+    /* the SHA extensions must match the portable implementation */
+    uint8_t data[300];
+    for (size_t j = 0; j < sizeof(data); ++j)
+      data[j] = (uint8_t)((j * 131) ^ (j >> 3));
+    for (size_t len = 0; len < sizeof(data); ++len) {
+      fio_sha2_s hw = fio_sha2_init(SHA_256);
+      fio_sha2_write(&hw, data, len);
+      fio_sha2_result(&hw);
+      fio_cpu_sha_ni = 0;
+      s = fio_sha2_init(SHA_256);
+      fio_sha2_write(&s, data, len);
+      fio_sha2_result(&s);
+      fio_cpu_sha_ni = 1;
+      FIO_ASSERT(!memcmp(hw.digest.str, s.digest.str, 32),
+                 "SHA-256 extensions result error (length %zu)", len);
+    }
+    fprintf(stderr, "+ fio SHA-256 (SHA extensions) passed.\n");
+  }
+#endif
 
 #if NODEBUG
   fio_sha2_speed_test(SHA_224, "fio SHA-224");
@@ -10478,6 +16274,41 @@ FIO_FUNC void fio_base64_test(void) {
     i++;
   }
   fprintf(stderr, " Base64 decode passed.\n");
+#if FIO_BASE64_SSSE3
+  if (fio_cpu_ssse3) {
+    /* vector blocks must match the portable implementation */
+    char data[300];
+    char simd[512];
+    for (size_t j = 0; j < sizeof(data); ++j)
+      data[j] = (char)((j * 131) ^ (j >> 3));
+    for (int len = 0; len < (int)sizeof(data); ++len) {
+      for (int url = 0; url < 2; ++url) {
+        int (*encode)(char *, const char *, int) =
+            url ? fio_base64url_encode : fio_base64_encode;
+        const int simd_len = encode(simd, data, len);
+        fio_cpu_ssse3 = 0;
+        const int scalar_len = encode(buffer, data, len);
+        fio_cpu_ssse3 = 1;
+        FIO_ASSERT(simd_len == scalar_len && !memcmp(simd, buffer, simd_len),
+                   "Base64 SSSE3 encoding error (length %d)", len);
+        FIO_ASSERT(fio_base64_decode(buffer, simd, simd_len) == len &&
+                       !memcmp(buffer, data, len),
+                   "Base64 SSSE3 decoding error (length %d)", len);
+      }
+    }
+    /* white space (MIME line breaks) falls back to the scalar decoder */
+    {
+      int len = fio_base64_encode(simd, data, sizeof(data));
+      memmove(simd + 79, simd + 76, len - 76);
+      memcpy(simd + 76, "\r\n ", 3);
+      len += 3;
+      FIO_ASSERT(fio_base64_decode(buffer, simd, len) == (int)sizeof(data) &&
+                     !memcmp(buffer, data, sizeof(data)),
+                 "Base64 SSSE3 decoding error (white space)");
+    }
+    fprintf(stderr, "+ fio Base64 (SSSE3) passed.\n");
+  }
+#endif
 
 #if NODEBUG
   fio_base64_speed_test();
@@ -10577,6 +16408,190 @@ FIO_FUNC void fio_poll_test(void) {
 #define fio_poll_test()
 #endif
 
+/* *****************************************************************************
+io_uring tests
+***************************************************************************** */
+#if FIO_ENGINE_URING
+static size_t fio_uring_test_count;
+FIO_FUNC void fio_uring_test_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  ++fio_uring_test_count;
+  (void)uuid, (void)pr;
+}
+
+FIO_FUNC void fio_uring_test(void) {
+  fprintf(stderr, "=== Testing io_uring events for a reused fd\n");
+  int fds[2];
+  int tmp[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds), "socketpair failed");
+  FIO_ASSERT(fio_set_non_block(fds[0]) != -1, "non-blocking mode failed");
+  fio_protocol_s pr1 = {.on_data = mock_on_data};
+  fio_protocol_s pr2 = {.on_data = fio_uring_test_on_data};
+  intptr_t uuid = fio_fd2uuid(fds[0]);
+  fio_attach(uuid, &pr1);
+  fio_defer_perform();
+  /* the read request completes, but the event isn't collected yet */
+  FIO_ASSERT(write(fds[1], "x", 1) == 1, "write failed");
+  fio_lock(&evio_uring.lock);
+  fio_uring_submit_unsafe();
+  fio_unlock(&evio_uring.lock);
+  /* close the connection and reuse the fd for a new (idle) connection */
+  fio_force_close(uuid);
+  close(fds[1]);
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, tmp), "socketpair failed");
+  if (tmp[1] == fds[0]) {
+    tmp[1] = tmp[0];
+    tmp[0] = fds[0];
+  }
+  if (tmp[0] != fds[0]) {
+    FIO_ASSERT(dup2(tmp[0], fds[0]) == fds[0], "dup2 failed");
+    close(tmp[0]);
+  }
+  FIO_ASSERT(fio_set_non_block(fds[0]) != -1, "non-blocking mode failed");
+  fio_uring_test_count = 0;
+  uuid = fio_fd2uuid(fds[0]);
+  fio_attach(uuid, &pr2);
+  fio_poll();
+  fio_defer_perform();
+  FIO_ASSERT(!fio_uring_test_count,
+             "a stale io_uring event was routed to the new connection");
+  FIO_ASSERT((fio_data->uring[fds[0]] & 1),
+             "a stale io_uring event cleared the new connection's request");
+  fio_force_close(uuid);
+  fio_defer_perform();
+  close(tmp[1]);
+  fprintf(stderr, "* passed.\n");
+}
+#else
+#define fio_uring_test()
+#endif
+
+/* *****************************************************************************
+Test Shared Read Buffers
+***************************************************************************** */
+
+FIO_FUNC void fio_rbuf_test(void) {
+  fprintf(stderr, "=== Testing shared read buffers\n");
+  fio_rbuf_s *rbuf = fio_rbuf_new(0);
+  FIO_ASSERT(rbuf && rbuf->capa == FIO_RBUF_SIZE && !rbuf->len,
+             "fio_rbuf_new should return an empty, pooled, buffer");
+  memcpy(rbuf->data, "Hello World", 11);
+  rbuf->len = 11;
+  fio_rbuf_consume(&rbuf, 6);
+  FIO_ASSERT(rbuf->len == 5 && !memcmp(rbuf->data, "World", 5),
+             "fio_rbuf_consume error (%zu: %.*s)", rbuf->len, (int)rbuf->len,
+             rbuf->data);
+  /* a shared buffer isn't touched, the leftovers are copied */
+  fio_rbuf_s *shared = fio_rbuf_dup(rbuf);
+  FIO_ASSERT(fio_rbuf_is_shared(rbuf), "fio_rbuf_dup should share buffer");
+  fio_rbuf_consume(&rbuf, 1);
+  FIO_ASSERT(rbuf != shared, "shared buffer should be replaced on consume");
+  FIO_ASSERT(shared->len == 5 && !memcmp(shared->data, "World", 5),
+             "shared buffer data shouldn't change");
+  FIO_ASSERT(rbuf->len == 4 && !memcmp(rbuf->data, "orld", 4),
+             "leftover data should be copied to the new buffer");
+  FIO_ASSERT(!fio_rbuf_is_shared(shared) && !fio_rbuf_is_shared(rbuf),
+             "buffers should be owned after consume");
+  fio_rbuf_free2(shared->data);
+  /* the released buffer should be recycled */
+  shared = fio_rbuf_new(16);
+  FIO_ASSERT(shared->capa == FIO_RBUF_SIZE, "small buffers should be pooled");
+  fio_rbuf_free(shared);
+  fio_rbuf_free(rbuf);
+  rbuf = fio_rbuf_new(FIO_RBUF_SIZE + 1);
+  FIO_ASSERT(rbuf->capa == FIO_RBUF_SIZE + 1,
+             "large buffers should have the requested capacity");
+  fio_rbuf_free(rbuf);
+  fio_rbuf_pool_clear();
+  FIO_ASSERT(!fio_rbuf_pool.count && !fio_rbuf_pool.head,
+             "fio_rbuf_pool_clear should empty the pool");
+  fprintf(stderr, "* passed.\n");
+}
+
+/* *****************************************************************************
+Testing asynchronous DNS resolution
+***************************************************************************** */
+
+FIO_FUNC void fio_dns_test_on_connect(intptr_t uuid, void *udata) {
+  (void)uuid;
+  (void)udata;
+}
+FIO_FUNC void fio_dns_test_on_fail(intptr_t uuid, void *udata) {
+  fio_atomic_add((uintptr_t *)udata, 1);
+  (void)uuid;
+}
+
+/* waits (up to ~5 seconds) for the DNS helper thread to report back */
+#define FIO_DNS_TEST_WAIT(cond)                                                \
+  for (size_t i = 0; !(cond) && i < 5000; ++i) {                               \
+    fio_defer_perform();                                                       \
+    fio_throttle_thread(1000000);                                              \
+  }
+
+FIO_FUNC void fio_dns_test(void) {
+  fprintf(stderr, "=== Testing asynchronous DNS resolution (fio_connect)\n");
+  FIO_ASSERT(!fio_dns_is_host_name("127.0.0.1", "8765") &&
+                 !fio_dns_is_host_name("::1", "8765") &&
+                 !fio_dns_is_host_name("localhost", NULL) &&
+                 !fio_dns_is_host_name("localhost", "0") &&
+                 fio_dns_is_host_name("localhost", "8765"),
+             "fio_dns_is_host_name error");
+  fio_dns_cache_clear();
+  fio_dns_s dns;
+  FIO_ASSERT(fio_dns_cache_find(&dns, "localhost:8765", 14),
+             "host names shouldn't be cached before they're resolved");
+  FIO_ASSERT(!fio_dns_lookup(&dns, "localhost:8765", 14, "8765") && dns.count,
+             "couldn't resolve localhost");
+  FIO_ASSERT(!fio_dns_cache_find(&dns, "localhost:8765", 14) && dns.count,
+             "resolved host names should be cached");
+  dns.expires = fio_last_tick().tv_sec;
+  fio_dns_set_insert(&fio_dns_cache_data,
+                     fio_dns_set_hash("localhost:8765", 14),
+                     FIO_STR_INIT_STATIC("localhost:8765"), dns, NULL);
+  FIO_ASSERT(fio_dns_cache_find(&dns, "localhost:8765", 14),
+             "expired host names should be resolved again");
+
+  uintptr_t failed = 0;
+  intptr_t srv = fio_socket(NULL, "8765", 1);
+  FIO_ASSERT(srv != -1, "couldn't open a listening socket on port 8765");
+  /* unknown host names are resolved by a helper thread */
+  intptr_t uuid = fio_connect(.address = "localhost", .port = "8765",
+                              .on_connect = fio_dns_test_on_connect,
+                              .on_fail = fio_dns_test_on_fail,
+                              .udata = &failed);
+  FIO_ASSERT(uuid != -1 && fio_is_valid(uuid) && !uuid_data(uuid).protocol,
+             "host names should be resolved asynchronously");
+  FIO_DNS_TEST_WAIT(uuid_data(uuid).protocol);
+  FIO_ASSERT(uuid_data(uuid).protocol && !failed,
+             "connection should be attached once the host name is resolved");
+  fio_force_close(uuid);
+  fio_defer_perform();
+  FIO_ASSERT(failed == 1, "on_fail should be called if closed early");
+  /* cached host names connect right away */
+  uuid = fio_connect(.address = "localhost", .port = "8765",
+                     .on_connect = fio_dns_test_on_connect,
+                     .on_fail = fio_dns_test_on_fail, .udata = &failed);
+  FIO_ASSERT(uuid != -1 && uuid_data(uuid).protocol,
+             "cached host names should connect right away");
+  fio_force_close(uuid);
+  fio_defer_perform();
+  FIO_ASSERT(failed == 2, "on_fail should be called if closed early");
+  /* closing the connection while resolving */
+  fio_dns_cache_clear();
+  uuid = fio_connect(.address = "localhost", .port = "8765",
+                     .on_connect = fio_dns_test_on_connect,
+                     .on_fail = fio_dns_test_on_fail, .udata = &failed);
+  FIO_ASSERT(uuid != -1, "fio_connect failed");
+  fio_force_close(uuid);
+  FIO_DNS_TEST_WAIT(failed == 3);
+  FIO_ASSERT(failed == 3,
+             "on_fail should be called if closed while resolving");
+  fio_force_close(srv);
+  fio_defer_perform();
+  fio_dns_cache_clear();
+  fprintf(stderr, "* passed.\n");
+}
+#undef FIO_DNS_TEST_WAIT
+
 /* *****************************************************************************
 Test UUID Linking
 ***************************************************************************** */
@@ -10706,8 +16721,97 @@ FIO_FUNC void fio_pubsub_test(void) {
   (void)fio_pubsub_test_on_unsubscribe;
   fprintf(stderr, "* passed.\n");
 }
+
+#define FIO_PATTERN_TEST_SLOTS 128
+#define FIO_PATTERN_TEST_NAME_MAX 24
+
+/* writes a random (valid) glob pattern to `dest`, returning its length */
+FIO_FUNC size_t fio_pattern_index_test_pattern(char *dest) {
+  static const char *tokens[] = {"a",   "b",    "c",     "*",    "?",
+                                 "[ab]", "[^a]", "[b-c]", "\\*", "\\?",
+                                 "\\[", "\\a", "ab",   "ba"};
+  size_t len = 0;
+  size_t count = fio_rand64() % 5;
+  while (count--) {
+    const char *t = tokens[fio_rand64() % (sizeof(tokens) / sizeof(tokens[0]))];
+    const size_t t_len = strlen(t);
+    memcpy(dest + len, t, t_len);
+    len += t_len;
+  }
+  dest[len] = 0;
+  return len;
+}
+
+static channel_s fio_pattern_index_test_pats[FIO_PATTERN_TEST_SLOTS];
+
+FIO_FUNC void fio_pattern_index_test_task(channel_s *ch, void *hits) {
+  ++((size_t *)hits)[ch - fio_pattern_index_test_pats];
+}
+
+FIO_FUNC void fio_pattern_index_test(void) {
+  fprintf(stderr, "=== Testing the pattern index (against fio_glob_match)\n");
+  channel_s *pats = fio_pattern_index_test_pats;
+  static char names[FIO_PATTERN_TEST_SLOTS][FIO_PATTERN_TEST_NAME_MAX];
+  uint8_t active[FIO_PATTERN_TEST_SLOTS] = {0};
+  size_t hits[FIO_PATTERN_TEST_SLOTS];
+  const size_t org_children =
+      fio_pattern_node_ary_count(&fio_pattern_index.children);
+  const size_t org_patterns = fio_ch_ary_count(&fio_pattern_index.patterns);
+  fio_rwlock_write(&fio_postoffice.patterns.lock);
+  for (size_t round = 0; round < 4096; ++round) {
+    /* add or remove a random pattern */
+    const size_t slot = fio_rand64() % FIO_PATTERN_TEST_SLOTS;
+    if (active[slot]) {
+      fio_pattern_index_remove(pats + slot);
+      active[slot] = 0;
+    } else {
+      pats[slot] = (channel_s){
+          .name = names[slot],
+          .name_len = fio_pattern_index_test_pattern(names[slot]),
+          .match = fio_glob_match,
+      };
+      fio_pattern_index_add(pats + slot);
+      active[slot] = 1;
+    }
+    if ((round & 15))
+      continue;
+    /* compare the index to a linear scan */
+    for (size_t i = 0; i < 32; ++i) {
+      static const char alphabet[] = "abc*?[\\";
+      char name[8];
+      fio_str_info_s channel = {.data = name, .len = fio_rand64() % 8};
+      for (size_t j = 0; j < channel.len; ++j)
+        name[j] = alphabet[fio_rand64() % (sizeof(alphabet) - 1)];
+      memset(hits, 0, sizeof(hits));
+      fio_pattern_index_match(channel, fio_pattern_index_test_task, hits);
+      for (size_t j = 0; j < FIO_PATTERN_TEST_SLOTS; ++j) {
+        const size_t expected =
+            active[j] &&
+            fio_glob_match((fio_str_info_s){.data = pats[j].name,
+                                            .len = pats[j].name_len},
+                           channel);
+        FIO_ASSERT(hits[j] == expected,
+                   "pattern index mismatch for \"%s\" and \"%.*s\" (%zu)",
+                   pats[j].name, (int)channel.len, channel.data, hits[j]);
+      }
+    }
+  }
+  for (size_t i = 0; i < FIO_PATTERN_TEST_SLOTS; ++i) {
+    if (active[i])
+      fio_pattern_index_remove(pats + i);
+  }
+  fio_rwlock_write_unlock(&fio_postoffice.patterns.lock);
+  FIO_ASSERT(fio_pattern_node_ary_count(&fio_pattern_index.children) ==
+                     org_children &&
+                 fio_ch_ary_count(&fio_pattern_index.patterns) == org_patterns,
+             "the pattern index wasn't pruned");
+  fprintf(stderr, "* passed.\n");
+}
+#undef FIO_PATTERN_TEST_SLOTS
+#undef FIO_PATTERN_TEST_NAME_MAX
 #else
 #define fio_pubsub_test()
+#define fio_pattern_index_test()
 #endif
 
 /* *****************************************************************************
@@ -10984,13 +17088,25 @@ void fio_test(void) {
   fio_str2u_test();
   fio_llist_test();
   fio_ary_test();
+  fio_rwlock_test();
   fio_set_test();
   fio_defer_test();
   fio_timer_test();
   fio_poll_test();
+  fio_uring_test();
   fio_socket_test();
+  fio_udp_test();
+  fio_dns_test();
+  fio_rbuf_test();
   fio_uuid_link_test();
   fio_cycle_test();
+  fio_fd_data_test();
+  fio_timeout_test();
+  fio_watermarks_test();
+  fio_fair_on_data_test();
+  fio_metrics_test();
+  fio_trace_test();
+  fio_hot_restart_test();
   fio_riskyhash_test();
   fio_siphash_test();
   fio_sha1_test();
@@ -10998,6 +17114,7 @@ void fio_test(void) {
   fio_base64_test();
   fio_test_random();
   fio_pubsub_test();
+  fio_pattern_index_test();
   (void)fio_sentinel_task;
   (void)deferred_on_shutdown;
   (void)fio_poll;
@@ -135,6 +135,26 @@ Version and helper macros
 #define FIO_MAX_SOCK_CAPACITY 131072
 #endif
 
+#ifndef FIO_FD_DATA_CHUNK
+/**
+ * The connection state table is reserved for `FIO_MAX_SOCK_CAPACITY`
+ * connections, but it's initialized (and the memory is used) in chunks of
+ * FIO_FD_DATA_CHUNK connections, as higher file descriptors are opened.
+ */
+#define FIO_FD_DATA_CHUNK 4096
+#endif
+
+#ifndef FIO_FD_DATA_HUGEPAGES
+/**
+ * If true (1), the connection state table is backed by transparent huge pages
+ * (Linux, `madvise`), reducing TLB misses for servers with many connections.
+ *
+ * Memory is then used in 2MB steps, which might cost more than it saves on
+ * small servers.
+ */
+#define FIO_FD_DATA_HUGEPAGES 0
+#endif
+
 #ifndef FIO_CPU_CORES_LIMIT
 /**
  * If facil.io detects more CPU cores than the number of cores stated in the
@@ -181,6 +201,61 @@ Version and helper macros
 #define FIO_PUBSUB_SUPPORT 1
 #endif
 
+#ifndef FIO_CLUSTER_COMPACT_HEADER
+/**
+ * If true (1), messages sent between processes use a compact header (4 bytes
+ * for most messages) instead of the fixed 16 byte header.
+ */
+#define FIO_CLUSTER_COMPACT_HEADER 1
+#endif
+
+#ifndef FIO_PUBSUB_RING
+/**
+ * If true (1), pub/sub messages published to other processes are written to a
+ * shared memory ring (one per process) that all the other processes read,
+ * rather than routed through the root process' Unix socket.
+ *
+ * Linux only (requires `eventfd`). Messages that don't fit in the ring (or
+ * that find it full) are routed through the Unix socket.
+ */
+#define FIO_PUBSUB_RING 0
+#endif
+
+#ifndef FIO_PUBSUB_RING_SIZE
+/** The capacity of each process' shared memory ring (a power of 2). */
+#define FIO_PUBSUB_RING_SIZE (1UL << 20)
+#endif
+
+#ifndef FIO_PUBSUB_FANOUT_BATCH
+/**
+ * The number of a channel's subscriptions handled by each pub/sub delivery
+ * task (the message's reference is pinned once per batch).
+ *
+ * Large batches keep big channels from flooding the task queue, small batches
+ * allow other tasks to run between deliveries. Set to 1 for a task per
+ * subscription.
+ */
+#define FIO_PUBSUB_FANOUT_BATCH 64
+#endif
+
+#ifndef FIO_SHA_HW
+/**
+ * If true (1), SHA-1 and SHA-256 (SHA-224) blocks are hashed using the CPU's
+ * SHA instructions when available (x86 SHA extensions, detected during
+ * startup, or ARMv8 Cryptography Extensions when compiled for them).
+ */
+#define FIO_SHA_HW 1
+#endif
+
+#ifndef FIO_BASE64_SIMD
+/**
+ * If true (1), Base64 encoding and decoding consume 12 (16) byte blocks using
+ * vector instructions when available (SSSE3, detected during startup, or
+ * NEON).
+ */
+#define FIO_BASE64_SIMD 1
+#endif
+
 #ifndef FIO_LOG_LENGTH_LIMIT
 /**
  * Since logging uses stack memory rather than dynamic allocation, it's memory
@@ -216,6 +291,7 @@ Version and helper macros
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #if !defined(__GNUC__) && !defined(__clang__) && !defined(FIO_GNUC_BYPASS)
@@ -373,6 +449,31 @@ void *FIO_ALIGN_NEW fio_mmap(size_t size);
  */
 void fio_malloc_after_fork(void);
 
+/** Memory allocator statistics, see `fio_malloc_stats`. */
+typedef struct {
+  /** Memory collected from the system for the block pool (in bytes). */
+  size_t system;
+  /** The number of memory blocks in use (see FIO_MEMORY_BLOCK_SIZE). */
+  size_t blocks;
+  /** The number of free memory blocks in the memory pool. */
+  size_t pool;
+  /** The number of memory blocks used as slabs (see FIO_MEMORY_SLABS). */
+  size_t slabs;
+  /** Memory held by allocations within slabs (in bytes). */
+  size_t slab_bytes;
+  /** Memory held by big allocations, collected using `mmap` (in bytes). */
+  size_t big;
+} fio_malloc_stats_s;
+
+/**
+ * Returns the memory allocator's statistics.
+ *
+ * Fragmentation can be estimated by comparing the memory held by the blocks in
+ * use (`blocks * FIO_MEMORY_BLOCK_SIZE`) with the application's live data. When
+ * using slabs, `slab_bytes` is the live data held by `slabs` blocks.
+ */
+fio_malloc_stats_s fio_malloc_stats(void);
+
 #undef FIO_ALIGN
 
 /* *****************************************************************************
@@ -678,6 +779,53 @@ struct fio_listen_args {
    *
    * This will be called separately for every process. */
   void (*on_finish)(intptr_t uuid, void *udata);
+  /**
+   * If set, each worker process will listen on it's own socket (using
+   * `SO_REUSEPORT`), allowing the kernel to balance incoming connections
+   * between the worker processes.
+   *
+   * Worker processes pinned to a single CPU will also prefer connections
+   * handled by that CPU (`SO_INCOMING_CPU`), where supported.
+   *
+   * Ignored for Unix sockets and when running a single process.
+   */
+  uint8_t reuse_port;
+  /**
+   * If set, Nagle's algorithm won't be disabled for accepted connections.
+   *
+   * By default, accepted TCP/IP connections set `TCP_NODELAY`.
+   */
+  uint8_t tcp_delay;
+  /**
+   * The maximum number of connections accepted each time the listening socket
+   * is readable. Defaults to 16.
+   */
+  uint16_t accept_batch;
+  /**
+   * The number of seconds the kernel waits for the client's data before
+   * accepting a connection (`TCP_DEFER_ACCEPT`). Defaults to 0 (disabled).
+   */
+  uint16_t defer_accept;
+  /**
+   * The length of the `TCP_FASTOPEN` queue. Defaults to 0 (128, if
+   * supported).
+   */
+  uint16_t fast_open;
+  /**
+   * The number of microseconds to busy poll when reading from the device
+   * queue (`SO_BUSY_POLL`). Defaults to 0 (disabled).
+   */
+  uint16_t busy_poll;
+  /**
+   * The send buffer size for accepted connections (`SO_SNDBUF`), in bytes.
+   * Defaults to 0 (the system's default).
+   */
+  uint32_t send_buffer;
+  /**
+   * The receive buffer size for accepted connections (`SO_RCVBUF`), in bytes.
+   * Defaults to 0 (the system's default).
+   */
+  uint32_t recv_buffer;
 };
 
 /**
@@ -826,6 +974,10 @@ See the `struct fio_connect_args` details for any possible named arguments.
 
 * `.on_fail` called if a connection failed to establish.
 
+Host names are resolved by a helper thread (and cached for
+`FIO_DNS_CACHE_TTL` seconds), so the returned uuid might be connected only
+after `fio_connect` returns.
+
 (experimental: untested)
 */
 intptr_t fio_connect(struct fio_connect_args);
@@ -911,6 +1063,37 @@ struct fio_start_args {
   int16_t threads;
   /** The number of worker processes to run. See `threads`. */
   int16_t workers;
+  /**
+   * Pins each worker process to it's share of the available CPU cores.
+   *
+   * Cores are grouped by CPU socket before being divided between the workers,
+   * so (when possible) a worker's memory and cache stay on a single NUMA node.
+   *
+   * Linux only. Ignored when running a single process.
+   */
+  uint8_t pin_workers;
+  /**
+   * Pins each thread in the thread pool to a single core within the worker's
+   * share of the CPU cores (Linux only).
+   */
+  uint8_t pin_threads;
+  /**
+   * The number of threads (per worker process) performing blocking tasks (see
+   * `fio_defer_blocking`).
+   *
+   * Defaults to `FIO_DEFER_BLOCKING_THREADS` (4). Negative values disable the
+   * blocking task pool (blocking tasks are performed by the thread pool).
+   */
+  int16_t blocking_threads;
+  /**
+   * The command line used to start the new binary during a hot restart (see
+   * `fio_hot_restart`), i.e., `main`'s `argv`. `argv[0]` is searched for using
+   * the `PATH` when it doesn't include a slash.
+   *
+   * Must remain valid while facil.io is running. When NULL, the process's
+   * original command line is used (Linux only).
+   */
+  char *const *argv;
 };
 
 /**
@@ -931,6 +1114,34 @@ void fio_start(struct fio_start_args args);
  */
 void fio_stop(void);
 
+/**
+ * Starts a hot restart (a binary upgrade), restarting the application without
+ * dropping connections or closing the listening sockets.
+ *
+ * The Root process starts a new copy of the binary (see `fio_start`'s `argv`)
+ * and passes it the listening sockets (opened by `fio_listen`) over a Unix
+ * socket. Calling `fio_listen` with the same address and port, in the new
+ * process, reuses the inherited socket instead of opening a new one.
+ *
+ * Once the new process is running, the old Root process stops and its workers
+ * drain their existing connections using the `on_shutdown` callback.
+ *
+ * If the new process exits before it's ready, the old process keeps running.
+ *
+ * The new process starts in its own process group, so signals sent to the
+ * old process group (i.e., a terminal's ^C) will not reach it.
+ *
+ * Listening sockets opened with `reuse_port` aren't passed on (each process
+ * opens its own), so connections waiting on the old sockets might be dropped.
+ *
+ * A hot restart can also be started by sending the `SIGUSR2` signal to any of
+ * the application's processes.
+ *
+ * Returns -1 on error (i.e., when facil.io isn't running or a hot restart is
+ * already in progress) and 0 on success.
+ */
+int fio_hot_restart(void);
+
 /**
  * Returns the number of expected threads / processes to be used by facil.io.
  *
@@ -983,10 +1194,30 @@ struct timespec fio_last_tick(void);
 /**
  * Returns a C string detailing the IO engine selected during compilation.
  *
- * Valid values are "kqueue", "epoll" and "poll".
+ * Valid values are "kqueue", "epoll", "io_uring" and "poll".
  */
 char const *fio_engine(void);
 
+/**
+ * Sets the number of IO events collected in each polling cycle and enables
+ * batched event dispatching.
+ *
+ * When batching, all the connections that became ready during a polling cycle
+ * are handled by a single task (per event type), rather than a task per event.
+ * This reduces task queue overhead on busy servers, at the expense of
+ * concurrency within each polling cycle.
+ *
+ * Setting `0` (the default) disables batching. Values are limited by the
+ * `FIO_POLL_MAX_BATCH` compile time value (defaults to 1024).
+ *
+ * At the moment, only the epoll engine supports batching. Other engines ignore
+ * this setting.
+ */
+void fio_poll_batch_set(size_t count);
+
+/** Returns the batch size set by `fio_poll_batch_set` (0 == disabled). */
+size_t fio_poll_batch_get(void);
+
 /* *****************************************************************************
 Socket / Connection Functions
 ***************************************************************************** */
@@ -1023,6 +1254,67 @@ intptr_t fio_socket(const char *address, const char *port, uint8_t is_server);
  */
 intptr_t fio_accept(intptr_t srv_uuid);
 
+/**
+ * Creates a UDP socket and returns it's unique identifier (or -1 on error).
+ *
+ * Server sockets (`is_server` is `1`) are bound to the `address` and `port`
+ * (a NULL `address` binds all the interfaces). Client sockets are connected
+ * to the remote `address` and `port`, which become the default destination.
+ *
+ * Attach a protocol using `fio_attach` and use `fio_udp_read` in the `on_data`
+ * callback. Remember that the `ping` callback is called once the socket's
+ * timeout expires (see `fio_timeout_set`), the same as for any connection.
+ */
+intptr_t fio_udp_socket(const char *address, const char *port,
+                        uint8_t is_server);
+
+/** A UDP datagram, see `fio_udp_read` and `fio_udp_send`. */
+typedef struct {
+  /** The datagram's payload. */
+  fio_str_info_s data;
+  /** The peer address' length (0 == the connected peer). */
+  uint32_t addr_len;
+  /** The peer's address (a `struct sockaddr`), when `addr_len` is set. */
+  uint8_t addr[128] __attribute__((aligned(8)));
+} fio_datagram_s;
+
+/**
+ * Reads the datagrams waiting on a UDP socket, calling `on_datagram` for each
+ * datagram.
+ *
+ * Datagrams are read in batches (`recvmmsg`, when available), so a burst of
+ * small datagrams doesn't cost a system call per datagram. Datagrams longer
+ * than `FIO_UDP_DATAGRAM_SIZE` are truncated.
+ *
+ * The datagram's data is only valid during the callback. The sender's address
+ * can be used to reply (see `fio_udp_send`).
+ *
+ * If many datagrams are waiting, the reading stops after a few batches and
+ * another `on_data` event is scheduled (so other connections aren't starved).
+ *
+ * Returns the number of datagrams read, or -1 on error.
+ */
+ssize_t fio_udp_read(intptr_t uuid,
+                     void (*on_datagram)(intptr_t uuid, fio_datagram_s *dgram,
+                                         void *udata),
+                     void *udata);
+
+/**
+ * Sends `count` datagrams using a UDP socket, without copying the data.
+ *
+ * Datagrams are sent immediately, in batches (`sendmmsg`, when available).
+ * Successive datagrams sent to the same address with the same length (the
+ * last might be shorter) are sent as a single buffer and split by the kernel
+ * (UDP GSO, Linux), when available.
+ *
+ * Datagrams with `addr_len == 0` are sent to the connected peer.
+ *
+ * Returns the number of datagrams sent, which might be less than `count` if
+ * the socket's buffer is full (the rest can be sent or dropped). Returns -1 on
+ * error.
+ */
+ssize_t fio_udp_send(intptr_t uuid, fio_datagram_s *dgrams, size_t count);
+
 /**
  * Returns 1 if the uuid refers to a valid and open, socket.
  *
@@ -1200,7 +1492,8 @@ inline FIO_FUNC ssize_t fio_write(const intptr_t uuid, const void *buffer,
  *
  * The file will be buffered to the socket chunk by chunk, so that memory
  * consumption is capped. The system's `sendfile` might be used if conditions
- * permit.
+ * permit. Otherwise (i.e., TLS connections), large files are memory mapped and
+ * written directly from the mapped window (see `FIO_MMAP_FILE_WINDOW`).
  *
  * `offset` dictates the starting point for the data to be sent and length sets
  * the maximum amount of data to be sent.
@@ -1219,6 +1512,57 @@ inline FIO_FUNC ssize_t fio_sendfile(intptr_t uuid, intptr_t source_fd,
  */
 size_t fio_pending(intptr_t uuid);
 
+/**
+ * Returns the number of buffered bytes waiting in the socket's queue (files
+ * sent using `fio_sendfile` aren't counted).
+ */
+size_t fio_pending_bytes(intptr_t uuid);
+
+/** The policies available for connections exceeding their high watermark. */
+typedef enum {
+  /** Stops `on_data` events until the queue drains to the `low` watermark. */
+  FIO_WATERMARK_SUSPEND = 0,
+  /** `fio_write2` fails (ENOBUFS) until the queue drains to `low`. */
+  FIO_WATERMARK_DROP,
+  /** The connection is closed (without sending the queued data). */
+  FIO_WATERMARK_CLOSE,
+} fio_watermark_policy_e;
+
+/** The arguments for the `fio_watermarks` function. */
+typedef struct {
+  /** The number of queued bytes above which the `policy` applies (0 = off). */
+  size_t high;
+  /**
+   * The number of queued bytes at which the connection is no longer congested.
+   * Must be less than `high` (otherwise, half of `high` is used).
+   */
+  size_t low;
+  /** The policy for congested connections, defaults to suspending reads. */
+  fio_watermark_policy_e policy;
+} fio_watermarks_s;
+
+/**
+ * Sets byte based high / low watermarks for the connection's outgoing queue
+ * (see `fio_pending_bytes`), protecting the server from slow consumers, i.e.:
+ *
+ *      fio_watermarks(uuid, .high = (1 << 20), .low = (1 << 18),
+ *                     .policy = FIO_WATERMARK_DROP);
+ *
+ * Once a `fio_write2` call causes the queue to exceed the `high` watermark, the
+ * connection is considered congested and the watermark's `policy` applies.
+ *
+ * When a congested connection's queue drains to the `low` watermark, reading
+ * resumes and the protocol's `on_ready` callback is called (even though the
+ * queue might not be empty).
+ *
+ * Watermarks are reset when the connection is closed.
+ *
+ * Returns -1 on error (i.e., an invalid `uuid`) and 0 on success.
+ */
+int fio_watermarks(intptr_t uuid, fio_watermarks_s);
+#define fio_watermarks(uuid, ...)                                              \
+  fio_watermarks((uuid), (fio_watermarks_s){__VA_ARGS__})
+
 /**
  * `fio_flush` attempts to write any remaining data in the internal buffer to
  * the underlying file descriptor and closes the underlying file descriptor once
@@ -1373,6 +1717,20 @@ typedef struct fio_rw_hook_s {
    * This callback is always called, even if `fio_rw_hook_set` fails.
    * */
   void (*cleanup)(void *udata);
+  /**
+   * Implement vectored writing to a file descriptor. Should behave like the
+   * file system `writev` call (see `write` for details).
+   *
+   * This allows `fio_flush` to send a number of queued buffers using a single
+   * system call.
+   *
+   * If missing, a fallback that calls `write` for each buffer is used.
+   *
+   * Note: facil.io library functions MUST NEVER be called by any r/w hook, or a
+   * deadlock might occur.
+   */
+  ssize_t (*writev)(intptr_t uuid, void *udata, const struct iovec *iov,
+                    int iovcnt);
 } fio_rw_hook_s;
 
 /** Sets a socket hook state (a pointer to the struct). */
@@ -1398,6 +1756,84 @@ int fio_rw_hook_replace_unsafe(intptr_t uuid, fio_rw_hook_s *rw_hooks,
 /** The default Read/Write hooks used for system Read/Write (udata == NULL). */
 extern const fio_rw_hook_s FIO_DEFAULT_RW_HOOKS;
 
+/* *****************************************************************************
+Shared Read Buffers
+
+Reference counted buffers for incoming data, allowing protocols to read into a
+buffer and hand parts of it on (i.e., a request's body) without copying.
+
+Buffers of up to `FIO_RBUF_SIZE` bytes are recycled through a shared pool.
+***************************************************************************** */
+
+#ifndef FIO_RBUF_SIZE
+/**
+ * The capacity of pooled read buffers (larger buffers aren't pooled).
+ *
+ * The default fits within a single memory allocator block.
+ */
+#define FIO_RBUF_SIZE 8192
+#endif
+
+#ifndef FIO_RBUF_POOL_LIMIT
+/** The number of unused buffers kept in the pool (per process). */
+#define FIO_RBUF_POOL_LIMIT 256
+#endif
+
+/** A reference counted read buffer, see `fio_rbuf_new`. */
+typedef struct {
+  /** The buffer's capacity (read only). */
+  size_t capa;
+  /** The number of bytes in the buffer (managed by the buffer's owner). */
+  size_t len;
+  /** The buffer's data (read only pointer). */
+  char *data;
+} fio_rbuf_s;
+
+/**
+ * Returns a new read buffer with (at least) `capa` bytes of capacity.
+ *
+ * A `capa` of 0 requests the default (`FIO_RBUF_SIZE`) capacity.
+ *
+ * The buffer's owner is the only one that may change it's contents, while any
+ * other references (see `fio_rbuf_dup`) may only read the existing data.
+ */
+fio_rbuf_s *fio_rbuf_new(size_t capa);
+
+/** Increases the buffer's reference count, returning the buffer. */
+fio_rbuf_s *fio_rbuf_dup(fio_rbuf_s *rbuf);
+
+/** Decreases the buffer's reference count, returning it to the pool if 0. */
+void fio_rbuf_free(fio_rbuf_s *rbuf);
+
+/**
+ * Same as `fio_rbuf_free`, using the buffer's `data` pointer.
+ *
+ * This is designed to be used as a `dealloc` callback, i.e.:
+ *
+ *      fiobj_data_newstr2(fio_rbuf_dup(rbuf)->data, rbuf->len, fio_rbuf_free2);
+ */
+void fio_rbuf_free2(void *data);
+
+/** Returns TRUE (1) if the buffer is referenced by more than its owner. */
+int fio_rbuf_is_shared(fio_rbuf_s *rbuf);
+
+/**
+ * Reads available data from the `uuid` into the buffer's free space, updating
+ * the buffer's `len`.
+ *
+ * Returns the same values as `fio_read`.
+ */
+ssize_t fio_rbuf_read(intptr_t uuid, fio_rbuf_s *rbuf);
+
+/**
+ * Removes `len` bytes from the beginning of the buffer, the remaining data is
+ * moved to the beginning of the buffer.
+ *
+ * If the buffer is shared, the existing data isn't touched. Instead, the
+ * remaining data is copied to a new buffer and `*prbuf` is updated.
+ */
+void fio_rbuf_consume(fio_rbuf_s **prbuf, size_t len);
+
 /* *****************************************************************************
 Concurrency overridable functions
 
@@ -1510,6 +1946,51 @@ Event / Task scheduling
  */
 int fio_defer(void (*task)(void *, void *), void *udata1, void *udata2);
 
+/** Task priority classes, see `fio_defer_priority`. */
+typedef enum {
+  /** The default priority, used by `fio_defer` and most IO events. */
+  FIO_TASK_PRIORITY_NORMAL = 0,
+  /** Performed before any normal task (used for outbound IO). */
+  FIO_TASK_PRIORITY_URGENT,
+  /**
+   * Performed when there are no other tasks, or once every
+   * `FIO_DEFER_BACKGROUND_WEIGHT` higher priority tasks, so it never starves
+   * (used for pub/sub delivery and timeout reviews).
+   */
+  FIO_TASK_PRIORITY_BACKGROUND,
+} fio_task_priority_e;
+
+/**
+ * Same as `fio_defer`, but the task is placed in the queue of the requested
+ * priority class.
+ *
+ * Tasks of the same priority are performed in order (per thread), tasks of
+ * different priorities aren't.
+ *
+ * Returns -1 or error, 0 on success.
+ */
+int fio_defer_priority(fio_task_priority_e priority,
+                       void (*task)(void *, void *), void *udata1,
+                       void *udata2);
+
+/**
+ * Same as `fio_defer`, but the task is performed by a separate pool of threads
+ * (see `fio_start`'s `blocking_threads`), with its own queue.
+ *
+ * Use this for tasks that block (i.e., `pread`, `fsync`, compression or
+ * password hashing), so the thread pool that handles IO events never stalls.
+ * To continue on the thread pool once the work is done, the task should
+ * schedule a completion task (i.e., using `fio_defer` or `fio_defer_io_task`).
+ *
+ * When the blocking task pool isn't running (i.e., before `fio_start`, in the
+ * Root process or once the process is shutting down), the task is scheduled
+ * using `fio_defer`.
+ *
+ * Returns -1 or error, 0 on success.
+ */
+int fio_defer_blocking(void (*task)(void *, void *), void *udata1,
+                       void *udata2);
+
 /**
  * Creates a timer to run a task at the specified interval.
  *
@@ -1523,6 +2004,28 @@ int fio_defer(void (*task)(void *, void *), void *udata1, void *udata2);
 int fio_run_every(size_t milliseconds, size_t repetitions, void (*task)(void *),
                   void *arg, void (*on_finish)(void *));
 
+/** An opaque timer handle, see `fio_run_every2`. */
+typedef struct fio_timer_s fio_timer_s;
+
+/**
+ * Same as `fio_run_every`, but returns a handle that can be used to cancel the
+ * timer using `fio_timer_cancel`.
+ *
+ * Returns NULL on error.
+ *
+ * The handle is valid until the `on_finish` handler is called.
+ */
+fio_timer_s *fio_run_every2(size_t milliseconds, size_t repetitions,
+                            void (*task)(void *), void *arg,
+                            void (*on_finish)(void *));
+
+/**
+ * Cancels a timer, so the task will not be performed again.
+ *
+ * The `on_finish` handler will be called (possibly asynchronously).
+ */
+void fio_timer_cancel(fio_timer_s *timer);
+
 /**
  * Performs all deferred tasks.
  */
@@ -1531,6 +2034,67 @@ void fio_defer_perform(void);
 /** Returns true if there are deferred functions waiting for execution. */
 int fio_defer_has_queue(void);
 
+/* *****************************************************************************
+Runtime Metrics
+***************************************************************************** */
+
+/** The calling process's runtime metrics, see `fio_metrics`. */
+typedef struct {
+  /** The number of connections accepted (`fio_accept`). */
+  size_t accepted;
+  /** The number of connections (with a protocol) that were closed. */
+  size_t closed;
+  /** The number of open connections (with a protocol, including listeners). */
+  size_t open;
+  /** The number of tasks performed (deferred tasks, IO events and timers). */
+  size_t tasks;
+  /** The number of tasks waiting in the queues. */
+  size_t tasks_pending;
+  /** The number of packets waiting in outgoing queues (see `fio_pending`). */
+  size_t packets_pending;
+  /** The number of buffered bytes waiting in the outgoing queues. */
+  size_t bytes_pending;
+  /** The number of bytes read (`fio_read`). */
+  size_t bytes_read;
+  /** The number of bytes written to connections. */
+  size_t bytes_written;
+  /** The number of pub/sub messages published by the process. */
+  size_t published;
+  /** The number of pub/sub messages delivered to the process's subscribers. */
+  size_t delivered;
+  /** The memory allocator's statistics (see `fio_malloc_stats`). */
+  fio_malloc_stats_s memory;
+} fio_metrics_s;
+
+/**
+ * Returns the calling process's runtime metrics (worker processes report their
+ * own metrics).
+ *
+ * Counters are collected by each thread and merged when read, so collecting
+ * them doesn't require atomic operations. The values are a snapshot and might
+ * lag slightly behind the threads that write them.
+ *
+ * Returns zero counters if facil.io was compiled with `FIO_METRICS == 0`
+ * (queue depths and the memory statistics are always reported).
+ */
+fio_metrics_s fio_metrics(void);
+
+/**
+ * Writes the trace events recorded by the calling process's threads to `fd`,
+ * using Chrome's trace event (JSON) format (i.e., for `chrome://tracing` or
+ * Perfetto).
+ *
+ * Tracing requires facil.io to be compiled with `FIO_TRACE` set. Each thread
+ * keeps its most recent `FIO_TRACE_RING_SIZE` events: reactor polling (the
+ * number of events), tasks (the time they waited in the queue), `on_data`
+ * callbacks and `fio_flush` calls (the fd). Functions are identified by their
+ * address (see `addr2line`).
+ *
+ * Returns the number of events written, or -1 on error (`ENOTSUP` if tracing
+ * is disabled).
+ */
+ssize_t fio_trace_dump(int fd);
+
 /* *****************************************************************************
 Startup / State Callbacks (fork, start up, idle, etc')
 ***************************************************************************** */
@@ -1721,9 +2285,10 @@ typedef struct {
    * and each pub/sub message (a message where filter == 0) will be tested
    * against that pattern.
    *
-   * Using pattern subscriptions extensively could become a performance concern,
-   * since channel names are tested against each distinct pattern rather than
-   * leveraging a hashmap for possible name matching.
+   * `FIO_MATCH_GLOB` patterns are indexed by their literal prefix (the part
+   * before the first wildcard), so channel names are only tested against the
+   * patterns that could match. Patterns using custom matching functions (or
+   * starting with a wildcard) are tested against every channel name.
    */
   fio_match_fn match;
   /**
@@ -2037,6 +2602,33 @@ FIO_FUNC inline int fio_is_locked(fio_lock_i *lock);
 /** Busy waits for the spinlock (CAREFUL). */
 FIO_FUNC inline void fio_lock(fio_lock_i *lock);
 
+/**
+ * A read-write spinlock, allowing any number of concurrent readers or a single
+ * writer. This is designed for read-mostly data.
+ *
+ * Writers are preferred, once a writer is waiting, new readers will wait.
+ */
+typedef struct {
+  volatile uint32_t readers;
+  fio_lock_i writer;
+} fio_rwlock_s;
+
+/** The initail value of an unlocked read-write spinlock. */
+#define FIO_RWLOCK_INIT                                                        \
+  { .readers = 0, .writer = FIO_LOCK_INIT }
+
+/** Busy waits for read access (other readers might be reading). */
+FIO_FUNC inline void fio_rwlock_read(fio_rwlock_s *lock);
+
+/** Releases read access. */
+FIO_FUNC inline void fio_rwlock_read_unlock(fio_rwlock_s *lock);
+
+/** Busy waits for exclusive (write) access, until all readers are done. */
+FIO_FUNC inline void fio_rwlock_write(fio_rwlock_s *lock);
+
+/** Releases exclusive (write) access. */
+FIO_FUNC inline void fio_rwlock_write_unlock(fio_rwlock_s *lock);
+
 /**
  * Nanosleep seems to be the most effective and efficient thread rescheduler.
  */
@@ -2415,19 +3007,13 @@ Risky Hash (always available, even if using only the fio.h header)
   (v) += (w);                                                                  \
   (v) *= RISKY_PRIME_0;
 
-/*  Computes a facil.io Risky Hash. */
-FIO_FUNC inline uint64_t fio_risky_hash(const void *data_, size_t len,
-                                        uint64_t seed) {
-  /* reading position */
-  const uint8_t *data = (uint8_t *)data_;
-
-  /* The consumption vectors initialized state */
-  register uint64_t v0 = seed ^ RISKY_PRIME_1;
-  register uint64_t v1 = ~seed + RISKY_PRIME_1;
-  register uint64_t v2 =
-      fio_lrot64(seed, 17) ^ ((~RISKY_PRIME_1) + RISKY_PRIME_0);
-  register uint64_t v3 = fio_lrot64(seed, 33) + (~RISKY_PRIME_1);
-
+/*
+ * Risky Hash core, consumes `len` bytes into the (initialized) vectors and
+ * mixes the result. `total` is the hashed data's length, `len % 32` must match.
+ */
+FIO_FUNC inline uint64_t
+fio_risky_hash___finish(const uint8_t *data, size_t len, uint64_t total,
+                        uint64_t v0, uint64_t v1, uint64_t v2, uint64_t v3) {
   /* consume 256 bit blocks */
   for (size_t i = len >> 5; i; --i) {
     fio_risky_consume(v0, fio_str2u64(data));
@@ -2486,8 +3072,8 @@ FIO_FUNC inline uint64_t fio_risky_hash(const void *data_, size_t len,
   uint64_t result = fio_lrot64(v0, 17) + fio_lrot64(v1, 13) +
                     fio_lrot64(v2, 47) + fio_lrot64(v3, 57);
 
-  len ^= (len << 33);
-  result += len;
+  total ^= (total << 33);
+  result += total;
 
   result += v0 * RISKY_PRIME_1;
   result ^= fio_lrot64(result, 13);
@@ -2503,6 +3089,93 @@ FIO_FUNC inline uint64_t fio_risky_hash(const void *data_, size_t len,
   return result;
 }
 
+/*  Computes a facil.io Risky Hash. */
+FIO_FUNC inline uint64_t fio_risky_hash(const void *data, size_t len,
+                                        uint64_t seed) {
+  /* The consumption vectors initialized state */
+  return fio_risky_hash___finish(
+      (uint8_t *)data, len, len, seed ^ RISKY_PRIME_1, ~seed + RISKY_PRIME_1,
+      fio_lrot64(seed, 17) ^ ((~RISKY_PRIME_1) + RISKY_PRIME_0),
+      fio_lrot64(seed, 33) + (~RISKY_PRIME_1));
+}
+
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__AVX512F__) &&        \
+    defined(__AVX512DQ__) && defined(__AVX512BW__)
+#include <immintrin.h>
+#define FIO_RISKY_HASH_AVX512 1
+#else
+#define FIO_RISKY_HASH_AVX512 0
+#endif
+
+/**
+ * Computes a wide (8 lane) variation of the facil.io Risky Hash, consuming 512
+ * bit blocks using independent vectors, for faster hashing of long data (i.e.,
+ * URLs and pub/sub channel names).
+ *
+ * The result matches `fio_risky_hash` for data shorter than 64 bytes.
+ *
+ * When compiled for AVX-512 (F, DQ and BW), the 8 lanes are consumed using a
+ * single vector register.
+ */
+FIO_FUNC inline uint64_t fio_risky_hash_wide(const void *data_, size_t len,
+                                             uint64_t seed) {
+  const uint8_t *data = (uint8_t *)data_;
+  /* The consumption vectors initialized state (matches fio_risky_hash) */
+  uint64_t v0 = seed ^ RISKY_PRIME_1;
+  uint64_t v1 = ~seed + RISKY_PRIME_1;
+  uint64_t v2 = fio_lrot64(seed, 17) ^ ((~RISKY_PRIME_1) + RISKY_PRIME_0);
+  uint64_t v3 = fio_lrot64(seed, 33) + (~RISKY_PRIME_1);
+  if (len >= 64) {
+    /* the upper lanes, only used for 512 bit blocks */
+    uint64_t v4 = fio_lrot64(seed, 7) ^ RISKY_PRIME_0;
+    uint64_t v5 = ~fio_lrot64(seed, 23) + RISKY_PRIME_0;
+    uint64_t v6 = fio_lrot64(seed, 41) ^ ((~RISKY_PRIME_0) + RISKY_PRIME_1);
+    uint64_t v7 = fio_lrot64(seed, 53) + (~RISKY_PRIME_0);
+#if FIO_RISKY_HASH_AVX512
+    /* consume 512 bit blocks, all 8 lanes at once */
+    __m512i vv = _mm512_set_epi64(v7, v6, v5, v4, v3, v2, v1, v0);
+    const __m512i prime = _mm512_set1_epi64((long long)RISKY_PRIME_0);
+    /* words are read as big endian numbers (see fio_str2u64) */
+    const __m512i bswap = _mm512_broadcast_i32x4(
+        _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7));
+    for (size_t i = len >> 6; i; --i) {
+      const __m512i w = _mm512_shuffle_epi8(
+          _mm512_loadu_si512((const void *)data), bswap);
+      vv = _mm512_add_epi64(vv, w);
+      vv = _mm512_rol_epi64(vv, 33);
+      vv = _mm512_add_epi64(vv, w);
+      vv = _mm512_mullo_epi64(vv, prime);
+      data += 64;
+    }
+    {
+      uint64_t lanes[8];
+      _mm512_storeu_si512((void *)lanes, vv);
+      v0 = lanes[0], v1 = lanes[1], v2 = lanes[2], v3 = lanes[3];
+      v4 = lanes[4], v5 = lanes[5], v6 = lanes[6], v7 = lanes[7];
+    }
+#else
+    /* consume 512 bit blocks */
+    for (size_t i = len >> 6; i; --i) {
+      fio_risky_consume(v0, fio_str2u64(data));
+      fio_risky_consume(v1, fio_str2u64(data + 8));
+      fio_risky_consume(v2, fio_str2u64(data + 16));
+      fio_risky_consume(v3, fio_str2u64(data + 24));
+      fio_risky_consume(v4, fio_str2u64(data + 32));
+      fio_risky_consume(v5, fio_str2u64(data + 40));
+      fio_risky_consume(v6, fio_str2u64(data + 48));
+      fio_risky_consume(v7, fio_str2u64(data + 56));
+      data += 64;
+    }
+#endif
+    /* fold the upper lanes into the Risky Hash vectors */
+    fio_risky_consume(v0, v4);
+    fio_risky_consume(v1, v5);
+    fio_risky_consume(v2, v6);
+    fio_risky_consume(v3, v7);
+  }
+  return fio_risky_hash___finish(data, len & 63, len, v0, v1, v2, v3);
+}
+
 #undef fio_risky_consume
 #undef FIO_RISKY_PRIME_0
 #undef FIO_RISKY_PRIME_1
@@ -2836,6 +3509,9 @@ C++ extern end
  * even a single persistent object will prevent the re-use of the whole memory
  * block from which it was allocated (see FIO_MEMORY_BLOCK_SIZE for size).
  *
+ * Long running processes can set FIO_MEMORY_SLABS, grouping small allocations
+ * by size, so freed "slices" are reused (see `fio_malloc_stats`).
+ *
  * Some more details:
  *
  * Allocation and deallocations and (usually) managed by "blocks".
@@ -2899,6 +3575,33 @@ C++ extern end
 #define FIO_MEMORY_BLOCK_ALLOC_LIMIT (FIO_MEMORY_BLOCK_SIZE >> 1)
 #endif
 
+#ifndef FIO_MEMORY_THREAD_CACHE
+/**
+ * When set (default), each thread allocates from a block it owns, so small
+ * allocations require no locks.
+ *
+ * Blocks are collected from the shared memory pool and the thread's block is
+ * returned when the thread exits. When set to 0, threads share a per-CPU core
+ * set of locked arenas.
+ */
+#define FIO_MEMORY_THREAD_CACHE 1
+#endif
+
+#ifndef FIO_MEMORY_SLABS
+/**
+ * When set, small allocations (up to 1Kb) are grouped by size into "slabs",
+ * blocks dedicated to a single size class, where freed slices are reused.
+ *
+ * This reduces fragmentation for long running processes (a long-lived object
+ * no longer pins a whole block), at the price of a lock per `fio_free` and up
+ * to 33% size rounding. Blocks returned to the memory pool also release their
+ * memory pages to the system (on Linux).
+ *
+ * Defaults to 0 (slices are always allocated at the end of the block).
+ */
+#define FIO_MEMORY_SLABS 0
+#endif
+
 /* *****************************************************************************
 
 
@@ -2969,6 +3672,38 @@ FIO_FUNC inline void fio_lock(fio_lock_i *lock) {
   }
 }
 
+/** Busy waits for read access (other readers might be reading). */
+FIO_FUNC inline void fio_rwlock_read(fio_rwlock_s *lock) {
+  for (;;) {
+    while (fio_is_locked(&lock->writer))
+      fio_reschedule_thread();
+    fio_atomic_add(&lock->readers, 1);
+    if (!fio_is_locked(&lock->writer))
+      return;
+    /* a writer slipped in, step aside */
+    fio_atomic_sub(&lock->readers, 1);
+  }
+}
+
+/** Releases read access. */
+FIO_FUNC inline void fio_rwlock_read_unlock(fio_rwlock_s *lock) {
+  __asm__ volatile("" ::: "memory");
+  fio_atomic_sub(&lock->readers, 1);
+}
+
+/** Busy waits for exclusive (write) access, until all readers are done. */
+FIO_FUNC inline void fio_rwlock_write(fio_rwlock_s *lock) {
+  fio_lock(&lock->writer);
+  while (lock->readers)
+    fio_reschedule_thread();
+  __asm__ volatile("" ::: "memory");
+}
+
+/** Releases exclusive (write) access. */
+FIO_FUNC inline void fio_rwlock_write_unlock(fio_rwlock_s *lock) {
+  fio_unlock(&lock->writer);
+}
+
 #if DEBUG_SPINLOCK
 /** Busy waits for a lock, reports contention. */
 FIO_FUNC inline void fio_lock_dbg(fio_lock_i *lock, const char *file,
@@ -5418,6 +6153,14 @@ Done
  * Note: FIO_SET_HASH_TYPE should, normaly be left alone (uintptr_t is
  *       enough). Also, the hash value 0 is reserved to indicate an empty slot.
  *
+ * The Set doesn't hash objects, the hash value is always provided by the
+ * caller. However, FIO_SET_HASH_FN(data, len) selects the hashing function used
+ * by the Set's `hash` helper (defaults to FIO_HASH_FN), so each Set can use the
+ * hashing function best suited for it's keys. i.e.:
+ *
+ *         #define FIO_SET_HASH_FN(data, len) \
+ *           fio_risky_hash_wide((data), (len), FIO_HASH_SECRET_SEED64_1)
+ *
  * Note: the FIO_SET_OBJ_COMPARE for Sets or the FIO_SET_KEY_COMPARE will be
  *       used to compare against invalid as well as valid objects. Invalid
  *       objects have their bytes all zero. FIO_SET_*_DESTROY should somehow
@@ -5486,6 +6229,12 @@ Done
 #define FIO_SET_HASH_COMPARE(h1, h2) ((h1) == (h2))
 #endif
 
+/** test for a pre-defined hashing function (used by the `hash` helper) */
+#ifndef FIO_SET_HASH_FN
+#define FIO_SET_HASH_FN(data, len)                                             \
+  FIO_HASH_FN((data), (len), FIO_HASH_SECRET_SEED64_1, FIO_HASH_SECRET_SEED64_2)
+#endif
+
 /* Customizable memory management */
 #ifndef FIO_SET_REALLOC /* NULL ptr indicates new allocation */
 #define FIO_SET_REALLOC(ptr, original_size, new_size, valid_data_length)       \
@@ -5575,6 +6324,9 @@ typedef struct FIO_NAME(s) FIO_NAME(s);
 /** Frees all the objects in the set and deallocates any internal resources. */
 FIO_FUNC void FIO_NAME_FREE()(FIO_NAME(s) * set);
 
+/** Hashes `len` bytes using the Set's hashing function (FIO_SET_HASH_FN). */
+FIO_FUNC inline FIO_SET_HASH_TYPE FIO_NAME(hash)(const void *data, size_t len);
+
 #ifdef FIO_SET_KEY_TYPE
 
 /**
@@ -5586,6 +6338,19 @@ FIO_FUNC inline FIO_SET_OBJ_TYPE
     FIO_NAME(find)(FIO_NAME(s) * set, const FIO_SET_HASH_TYPE hash_value,
                    FIO_SET_KEY_TYPE key);
 
+/**
+ * Locates an object in the Hash Map, if it exists, without changing the Hash
+ * Map (`find` might rehash the map or update it's collision state).
+ *
+ * Any number of threads may call `find_shared` concurrently, as long as the
+ * Hash Map isn't changed at the same time (see `fio_rwlock_s`).
+ *
+ * NOTE: This is the function's Hash Map variant. See FIO_SET_KEY_TYPE.
+ */
+FIO_FUNC inline FIO_SET_OBJ_TYPE
+    FIO_NAME(find_shared)(FIO_NAME(s) * set, const FIO_SET_HASH_TYPE hash_value,
+                          FIO_SET_KEY_TYPE key);
+
 /**
  * Inserts an object to the Hash Map, rehashing if required, returning the new
  * object's location using a pointer.
@@ -5629,6 +6394,19 @@ FIO_FUNC inline FIO_SET_OBJ_TYPE
     FIO_NAME(find)(FIO_NAME(s) * set, const FIO_SET_HASH_TYPE hash_value,
                    FIO_SET_OBJ_TYPE obj);
 
+/**
+ * Locates an object in the Set, if it exists, without changing the Set
+ * (`find` might rehash the Set or update it's collision state).
+ *
+ * Any number of threads may call `find_shared` concurrently, as long as the
+ * Set isn't changed at the same time (see `fio_rwlock_s`).
+ *
+ * NOTE: This is the function's pure Set variant (no FIO_SET_KEY_TYPE).
+ */
+FIO_FUNC inline FIO_SET_OBJ_TYPE
+    FIO_NAME(find_shared)(FIO_NAME(s) * set, const FIO_SET_HASH_TYPE hash_value,
+                          FIO_SET_OBJ_TYPE obj);
+
 /**
  * Inserts an object to the Set only if it's missing, rehashing if required,
  * returning the new (or old) object.
@@ -5833,6 +6611,42 @@ FIO_FUNC inline FIO_NAME(_map_s_) *
   return NULL;
   (void)obj; /* in cases where FIO_SET_OBJ_COMPARE does nothing */
 }
+
+/**
+ * Locates an existing object's map position without changing the Set.
+ *
+ * Holes (removed objects) are skipped rather than returned, so seeking isn't
+ * effected by collisions and no rehashing is required.
+ */
+FIO_FUNC inline FIO_NAME(_map_s_) *
+    FIO_NAME(_find_map_pos_shared_)(FIO_NAME(s) * set,
+                                    FIO_SET_HASH_TYPE hash_value,
+                                    FIO_SET_TYPE obj) {
+  if (!set->map)
+    return NULL;
+  if (FIO_SET_HASH_COMPARE(hash_value, FIO_SET_HASH_INVALID))
+    hash_value = FIO_SET_HASH_FORCE;
+  const uintptr_t mask = (1ULL << set->used_bits) - 1;
+  const uintptr_t hash_value_i = FIO_SET_HASH2UINTPTR(hash_value, 0);
+  const uintptr_t hash_alt = FIO_SET_HASH2UINTPTR(hash_value, set->used_bits);
+  const uintptr_t limit =
+      FIO_SET_CUCKOO_STEPS * (set->capa > (FIO_SET_MAX_MAP_SEEK << 2)
+                                  ? FIO_SET_MAX_MAP_SEEK
+                                  : (set->capa >> 2));
+  uintptr_t i = 0;
+  for (;;) {
+    FIO_NAME(_map_s_) *pos = set->map + ((hash_alt + i) & mask);
+    if (FIO_SET_HASH_COMPARE(FIO_SET_HASH_INVALID, pos->hash))
+      return NULL;
+    if (FIO_SET_HASH_COMPARE(pos->hash, hash_value_i) && pos->pos &&
+        FIO_SET_COMPARE(pos->pos->obj, obj))
+      return pos;
+    if (i >= limit)
+      return NULL;
+    i += FIO_SET_CUCKOO_STEPS;
+  }
+  (void)obj; /* in cases where FIO_SET_OBJ_COMPARE does nothing */
+}
 #undef FIO_SET_CUCKOO_STEPS
 
 /** Removes "holes" from the Set's internal Array - MUST re-hash afterwards.
@@ -5961,6 +6775,11 @@ FIO_FUNC void FIO_NAME_FREE()(FIO_NAME(s) * s) {
   *s = (FIO_NAME(s)){.map = NULL};
 }
 
+/** Hashes `len` bytes using the Set's hashing function (FIO_SET_HASH_FN). */
+FIO_FUNC inline FIO_SET_HASH_TYPE FIO_NAME(hash)(const void *data, size_t len) {
+  return (FIO_SET_HASH_TYPE)FIO_SET_HASH_FN(data, len);
+}
+
 #ifdef FIO_SET_KEY_TYPE
 
 /* Hash Map unique implementation */
@@ -5983,6 +6802,25 @@ FIO_FUNC FIO_SET_OBJ_TYPE FIO_NAME(find)(FIO_NAME(s) * set,
   return pos->pos->obj.obj;
 }
 
+/**
+ * Locates an object in the Hash Map, if it exists, without changing the Hash
+ * Map.
+ *
+ * NOTE: This is the function's Hash Map variant. See FIO_SET_KEY_TYPE.
+ */
+FIO_FUNC FIO_SET_OBJ_TYPE
+    FIO_NAME(find_shared)(FIO_NAME(s) * set, const FIO_SET_HASH_TYPE hash_value,
+                          FIO_SET_KEY_TYPE key) {
+  FIO_NAME(_map_s_) *pos = FIO_NAME(_find_map_pos_shared_)(
+      set, hash_value, (FIO_SET_TYPE){.key = key});
+  if (!pos) {
+    FIO_SET_OBJ_TYPE empty;
+    memset(&empty, 0, sizeof(empty));
+    return empty;
+  }
+  return pos->pos->obj.obj;
+}
+
 /**
  * Inserts an object to the Hash Map, rehashing if required, returning the new
  * object's location using a pointer.
@@ -6054,6 +6892,20 @@ FIO_FUNC FIO_SET_OBJ_TYPE FIO_NAME(find)(FIO_NAME(s) * set,
   return pos->pos->obj;
 }
 
+/** Locates an object in the Set, if it exists, without changing the Set. */
+FIO_FUNC FIO_SET_OBJ_TYPE
+    FIO_NAME(find_shared)(FIO_NAME(s) * set, const FIO_SET_HASH_TYPE hash_value,
+                          FIO_SET_OBJ_TYPE obj) {
+  FIO_NAME(_map_s_) *pos =
+      FIO_NAME(_find_map_pos_shared_)(set, hash_value, obj);
+  if (!pos) {
+    FIO_SET_OBJ_TYPE empty;
+    memset(&empty, 0, sizeof(empty));
+    return empty;
+  }
+  return pos->pos->obj;
+}
+
 /**
  * Inserts an object to the Set, rehashing if required, returning the new
  * object's pointer.
@@ -6236,6 +7088,7 @@ restart:
 #undef FIO_SET_HASH2UINTPTR
 #undef FIO_SET_HASH_COMPARE
 #undef FIO_SET_HASH_INVALID
+#undef FIO_SET_HASH_FN
 #undef FIO_SET_KEY_TYPE
 #undef FIO_SET_KEY_COPY
 #undef FIO_SET_KEY_DESTROY
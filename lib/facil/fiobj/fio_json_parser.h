@@ -46,6 +46,14 @@ JSON API
 #define JSON_MAX_DEPTH 32
 #endif
 
+#ifndef JSON_PARSER_SIMD
+/**
+ * When available (SSE2 / AVX2 / NEON), Strings and runs of white space are
+ * scanned using vector instructions, 16 (or 32) bytes at a time.
+ */
+#define JSON_PARSER_SIMD 1
+#endif
+
 /** The JSON parser type. Memory must be initialized to 0 before first uses. */
 typedef struct {
   /** in dictionary flag. */
@@ -186,6 +194,146 @@ static const uint8_t string_seek_stop[] = {
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
     0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
 
+/* *****************************************************************************
+JSON Vector Scanning
+***************************************************************************** */
+
+#if JSON_PARSER_SIMD && defined(__GNUC__) && defined(__x86_64__) &&            \
+    defined(__SSE2__)
+#include <immintrin.h>
+#define JSON_SIMD 1
+
+#if !defined(__AVX2__)
+/* AVX2 isn't part of the compilation target, detect it during startup */
+static uint8_t json_simd_avx2 __attribute__((unused));
+static void __attribute__((constructor)) json_simd_detect(void) {
+  __builtin_cpu_init();
+  json_simd_avx2 = (__builtin_cpu_supports("avx2") != 0);
+}
+#define JSON_SIMD_AVX2_TARGET __attribute__((target("avx2"), noinline))
+#else
+#define json_simd_avx2 1
+#define JSON_SIMD_AVX2_TARGET
+#endif
+
+/* finds the first '"' or '\\', 32 bytes at a time (long Strings). */
+JSON_SIMD_AVX2_TARGET static uint8_t __attribute__((unused))
+json_simd_seek_marker_avx2(uint8_t **pos, const uint8_t *limit) {
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i escape = _mm256_set1_epi8('\\');
+  uint8_t *p = *pos;
+  for (; p + 32 <= limit; p += 32) {
+    const __m256i v = _mm256_loadu_si256((__m256i *)p);
+    const uint32_t found = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, escape)));
+    if (found) {
+      *pos = p + __builtin_ctz(found);
+      return 1;
+    }
+  }
+  *pos = p;
+  return 0;
+}
+
+/* finds the first '"' or '\\', 16 bytes at a time. */
+static inline uint8_t json_simd_seek_marker(uint8_t **pos,
+                                            const uint8_t *limit) {
+  const __m128i quote = _mm_set1_epi8('"');
+  const __m128i escape = _mm_set1_epi8('\\');
+  uint8_t *p = *pos;
+  for (; p + 16 <= limit; p += 16) {
+    const __m128i v = _mm_loadu_si128((__m128i *)p);
+    const uint32_t found = (uint32_t)_mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, escape)));
+    if (found) {
+      *pos = p + __builtin_ctz(found);
+      return 1;
+    }
+    /* most Strings (keys) are short, only long ones pay for the call */
+    if (json_simd_avx2) {
+      *pos = p + 16;
+      return json_simd_seek_marker_avx2(pos, limit);
+    }
+  }
+  *pos = p;
+  return 0;
+}
+
+/* skips white space and commas, 16 bytes at a time. */
+static inline void json_simd_skip_separators(uint8_t **pos,
+                                             const uint8_t *limit) {
+  uint8_t *p = *pos;
+  for (; p + 16 <= limit; p += 16) {
+    const __m128i v = _mm_loadu_si128((__m128i *)p);
+    const __m128i sep = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))),
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                                  _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+    const uint32_t other = (~(uint32_t)_mm_movemask_epi8(sep)) & 0xFFFF;
+    if (other) {
+      *pos = p + __builtin_ctz(other);
+      return;
+    }
+  }
+  *pos = p;
+}
+
+#elif JSON_PARSER_SIMD && defined(__GNUC__) && defined(__aarch64__) &&         \
+    defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_neon.h>
+#define JSON_SIMD 1
+
+/* narrows a 0x00/0xFF byte mask into a nibble per byte */
+#define JSON_SIMD_NIBBLES(eq)                                                  \
+  vget_lane_u64(                                                               \
+      vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0)
+
+/* finds the first '"' or '\\', 16 bytes at a time. */
+static inline uint8_t json_simd_seek_marker(uint8_t **pos,
+                                            const uint8_t *limit) {
+  const uint8x16_t quote = vdupq_n_u8('"');
+  const uint8x16_t escape = vdupq_n_u8('\\');
+  uint8_t *p = *pos;
+  for (; p + 16 <= limit; p += 16) {
+    const uint8x16_t v = vld1q_u8(p);
+    const uint64_t found =
+        JSON_SIMD_NIBBLES(vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, escape)));
+    if (found) {
+      *pos = p + (__builtin_ctzll(found) >> 2);
+      return 1;
+    }
+  }
+  *pos = p;
+  return 0;
+}
+
+/* skips white space and commas, 16 bytes at a time. */
+static inline void json_simd_skip_separators(uint8_t **pos,
+                                             const uint8_t *limit) {
+  uint8_t *p = *pos;
+  for (; p + 16 <= limit; p += 16) {
+    const uint8x16_t v = vld1q_u8(p);
+    const uint8x16_t sep =
+        vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')),
+                          vceqq_u8(v, vdupq_n_u8('\n'))),
+                 vorrq_u8(vorrq_u8(vceqq_u8(v, vdupq_n_u8('\r')),
+                                   vceqq_u8(v, vdupq_n_u8('\t'))),
+                          vceqq_u8(v, vdupq_n_u8(','))));
+    const uint64_t other = ~JSON_SIMD_NIBBLES(sep);
+    if (other) {
+      *pos = p + (__builtin_ctzll(other) >> 2);
+      return;
+    }
+  }
+  *pos = p;
+}
+
+#else
+#define JSON_SIMD 0
+#endif
+
 /* *****************************************************************************
 JSON String Helper - Seeking to the end of a string
 ***************************************************************************** */
@@ -198,6 +346,17 @@ static inline int seek2marker(uint8_t **buffer,
   if (string_seek_stop[**buffer])
     return 1;
 
+#if JSON_SIMD
+  if (json_simd_seek_marker(buffer, limit))
+    return 1;
+  /* less than a vector's length remains */
+  while (*buffer < limit) {
+    if (string_seek_stop[**buffer])
+      return 1;
+    (*buffer)++;
+  }
+  return 0;
+#else
 #if !ALLOW_UNALIGNED_MEMORY_ACCESS || (!__x86_64__ && !__aarch64__)
   /* too short for this mess */
   if ((uintptr_t)limit <= 8 + ((uintptr_t)*buffer & (~(uintptr_t)7)))
@@ -263,6 +422,7 @@ finish:
     (*buffer)++;
   }
   return 0;
+#endif /* JSON_SIMD */
 }
 
 static inline int seek2eos(uint8_t **buffer,
@@ -314,8 +474,14 @@ fio_json_parse(json_parser_s *parser, const char *buffer, size_t length) {
   uint8_t *pos = (uint8_t *)buffer;
   const uint8_t *limit = pos + length;
   do {
-    while (pos < limit && JSON_SEPERATOR[*pos])
+    while (pos < limit && JSON_SEPERATOR[*pos]) {
       ++pos;
+#if JSON_SIMD
+      /* runs of white space (indentation) are skipped a vector at a time */
+      if (pos < limit && JSON_SEPERATOR[*pos])
+        json_simd_skip_separators(&pos, limit);
+#endif
+    }
     if (pos == limit)
       goto stop;
     switch (*pos) {
@@ -641,8 +807,8 @@ fio_json_unescape_str(void *dest, const char *source, size_t length) {
   uint8_t *writer = (uint8_t *)dest;
   /* copy in chuncks unless we hit an escape marker */
   while (reader < stop) {
-#if !__x86_64__ && !__aarch64__
-    /* we can't leverage unaligned memory access, so we read the buffer twice */
+#if JSON_SIMD || (!__x86_64__ && !__aarch64__)
+    /* `memchr` is vectorized (or we can't leverage unaligned memory access) */
     uint8_t *tmp = memchr(reader, '\\', (size_t)(stop - reader));
     if (!tmp) {
       memmove(writer, reader, (size_t)(stop - reader));
@@ -11,6 +11,7 @@ License: MIT
 #include <fiobj_json.h>
 #include <fiobj_mustache.h>
 #include <fiobj_numbers.h>
+#include <fiobj_rope.h>
 #include <fiobj_str.h>
 #include <fiobject.h>
 
@@ -29,6 +30,7 @@ FIO_INLINE void fiobj_test(void) {
   fiobj_test_hash();
   fiobj_test_core();
   fiobj_data_test();
+  fiobj_rope_test();
   fiobj_test_json();
   fiobj_mustache_test();
   fiobj_siphash_test();
@@ -12,6 +12,8 @@ static void fiobj4sock_dealloc(void *o) { fiobj_free((FIOBJ)o); }
 /** send a FIOBJ  object through a socket. */
 static inline __attribute__((unused)) ssize_t fiobj_send_free(intptr_t uuid,
                                                               FIOBJ o) {
+  if (FIOBJ_IS_ROPE(o))
+    return fiobj_rope_send_free(uuid, o);
   fio_str_info_s s = fiobj_obj2cstr(o);
   return fio_write2(uuid, .data.buffer = (void *)(o),
                     .offset = (((intptr_t)s.data) - ((intptr_t)(o))),
@@ -3,6 +3,8 @@ Copyright: Boaz Segev, 2017-2019
 License: MIT
 */
 #include <fio.h>
+#include <fiobj_ary.h>
+#include <fiobj_numbers.h>
 #include <fiobject.h>
 
 #define FIO_ARY_NAME fio_ary__
@@ -21,18 +23,35 @@ Array Type
 typedef struct {
   fiobj_object_header_s head;
   fio_ary___s ary;
+  /* the storage for small Arrays (`ary.arry` points here until promoted) */
+  FIOBJ small[FIOBJ_ARY_SMALL_CAPA];
 } fiobj_ary_s;
 
 #define obj2ary(o) ((fiobj_ary_s *)(o))
 
+#define FIOBJ_ARY_IS_SMALL(a) ((a)->ary.arry == (a)->small)
+
+/* moves the objects from the inline storage to an allocated buffer */
+static void fiobj_ary_promote(fiobj_ary_s *a, size_t capa) {
+  const size_t count = a->ary.end - a->ary.start;
+  const size_t start = a->ary.start;
+  if (capa < count)
+    capa = count;
+  a->ary = (fio_ary___s)FIO_ARY_INIT;
+  fio_ary_____require_on_top(&a->ary, capa);
+  memcpy(a->ary.arry, a->small + start, count * sizeof(*a->small));
+  a->ary.end = count;
+}
+
 /* *****************************************************************************
 VTable
 ***************************************************************************** */
 
 static void fiobj_ary_dealloc(FIOBJ o, void (*task)(FIOBJ, void *), void *arg) {
   FIO_ARY_FOR((&obj2ary(o)->ary), i) { task(*i, arg); }
-  fio_ary___free(&obj2ary(o)->ary);
-  fio_free(FIOBJ2PTR(o));
+  if (!FIOBJ_ARY_IS_SMALL(obj2ary(o)))
+    fio_ary___free(&obj2ary(o)->ary);
+  fiobject___free(FIOBJ2PTR(o));
 }
 
 static size_t fiobj_ary_each1(FIOBJ o, size_t start_at,
@@ -79,7 +98,7 @@ Allocation
 ***************************************************************************** */
 
 static inline FIOBJ fiobj_ary_alloc(size_t capa) {
-  fiobj_ary_s *ary = fio_malloc(sizeof(*ary));
+  fiobj_ary_s *ary = fiobject___alloc(sizeof(*ary));
   if (!ary) {
     perror("ERROR: fiobj array couldn't allocate memory");
     exit(errno);
@@ -89,10 +108,12 @@ static inline FIOBJ fiobj_ary_alloc(size_t capa) {
           {
               .ref = 1,
               .type = FIOBJ_T_ARRAY,
+              .arena = FIOBJECT_ARENA_ACTIVE(),
           },
+      .ary = {.capa = FIOBJ_ARY_SMALL_CAPA, .arry = ary->small},
   };
-  if (capa)
-    fio_ary_____require_on_top(&ary->ary, capa);
+  if (capa > FIOBJ_ARY_SMALL_CAPA)
+    fiobj_ary_promote(ary, capa);
   return (FIOBJ)ary;
 }
 
@@ -139,7 +160,16 @@ FIOBJ fiobj_ary_index(FIOBJ ary, int64_t pos) {
 void fiobj_ary_set(FIOBJ ary, FIOBJ obj, int64_t pos) {
   assert(ary && FIOBJ_TYPE_IS(ary, FIOBJ_T_ARRAY));
   FIOBJ old = FIOBJ_INVALID;
-  fio_ary___set(&obj2ary(ary)->ary, pos, obj, &old);
+  fiobj_ary_s *a = obj2ary(ary);
+  if (FIOBJ_ARY_IS_SMALL(a)) {
+    /* setting past the end might require more room */
+    const size_t count = a->ary.end - a->ary.start;
+    const size_t index = fio_ary_____rel2absolute(&a->ary, pos);
+    if (index >= count &&
+        (count ? a->ary.start : 0) + index + 1 >= FIOBJ_ARY_SMALL_CAPA)
+      fiobj_ary_promote(a, index + 1 + FIO_ARY_PADDING);
+  }
+  fio_ary___set(&a->ary, pos, obj, &old);
   fiobj_free(old);
 }
 
@@ -152,7 +182,19 @@ Array push / shift API
  */
 void fiobj_ary_push(FIOBJ ary, FIOBJ obj) {
   assert(ary && FIOBJ_TYPE_IS(ary, FIOBJ_T_ARRAY));
-  fio_ary___push(&obj2ary(ary)->ary, obj);
+  fiobj_ary_s *a = obj2ary(ary);
+  if (FIOBJ_ARY_IS_SMALL(a) && a->ary.end >= FIOBJ_ARY_SMALL_CAPA) {
+    const size_t count = a->ary.end - a->ary.start;
+    if (count < FIOBJ_ARY_SMALL_CAPA) {
+      /* there's room at the head (after a `shift`), move the objects */
+      memmove(a->small, a->small + a->ary.start, count * sizeof(*a->small));
+      a->ary.start = 0;
+      a->ary.end = count;
+    } else {
+      fiobj_ary_promote(a, (FIOBJ_ARY_SMALL_CAPA << 1) + FIO_ARY_PADDING);
+    }
+  }
+  fio_ary___push(&a->ary, obj);
 }
 
 /** Pops an object from the end of the Array. */
@@ -169,7 +211,19 @@ FIOBJ fiobj_ary_pop(FIOBJ ary) {
  */
 void fiobj_ary_unshift(FIOBJ ary, FIOBJ obj) {
   assert(ary && FIOBJ_TYPE_IS(ary, FIOBJ_T_ARRAY));
-  fio_ary___unshift(&obj2ary(ary)->ary, obj);
+  fiobj_ary_s *a = obj2ary(ary);
+  if (FIOBJ_ARY_IS_SMALL(a) && !a->ary.start) {
+    const size_t count = a->ary.end;
+    if (count < FIOBJ_ARY_SMALL_CAPA) {
+      /* there's room at the end, move the objects to make room at the head */
+      memmove(a->small + 1, a->small, count * sizeof(*a->small));
+      a->small[0] = obj;
+      ++a->ary.end;
+      return;
+    }
+    fiobj_ary_promote(a, (FIOBJ_ARY_SMALL_CAPA << 1) + FIO_ARY_PADDING);
+  }
+  fio_ary___unshift(&a->ary, obj);
 }
 
 /** Shifts an object from the beginning of the Array. */
@@ -266,7 +320,7 @@ void fiobj_test_array(void) {
   }
   FIOBJ a = fiobj_ary_new2(4);
   TEST_ASSERT(FIOBJ_TYPE_IS(a, FIOBJ_T_ARRAY), "Array type isn't an array!\n");
-  TEST_ASSERT(fiobj_ary_capa(a) > 4, "Array capacity ignored!\n");
+  TEST_ASSERT(fiobj_ary_capa(a) >= 4, "Array capacity ignored!\n");
   fiobj_ary_push(a, fiobj_null());
   TEST_ASSERT(fiobj_ary2ptr(a)[0] == fiobj_null(),
               "Array direct access failed!\n");
@@ -328,6 +382,37 @@ void fiobj_test_array(void) {
               fiobj_obj2cstr(fiobj_ary_index(a, 0)).data);
 
   fiobj_free(a);
+
+  /* small (inline) Arrays and their promotion */
+  a = fiobj_ary_new();
+  TEST_ASSERT(FIOBJ_ARY_IS_SMALL(obj2ary(a)), "Array should be small\n");
+  for (intptr_t i = 1; i < FIOBJ_ARY_SMALL_CAPA; ++i)
+    fiobj_ary_push(a, fiobj_num_new(i));
+  fiobj_ary_unshift(a, fiobj_num_new(0));
+  TEST_ASSERT(FIOBJ_ARY_IS_SMALL(obj2ary(a)) &&
+                  fiobj_ary_count(a) == FIOBJ_ARY_SMALL_CAPA,
+              "small Array unshift / push error\n");
+  TEST_ASSERT(fiobj_ary_shift(a) == fiobj_num_new(0),
+              "small Array shift error\n");
+  fiobj_ary_push(a, fiobj_num_new(FIOBJ_ARY_SMALL_CAPA));
+  TEST_ASSERT(FIOBJ_ARY_IS_SMALL(obj2ary(a)),
+              "small Array should reuse room at its head\n");
+  fiobj_ary_push(a, fiobj_num_new(FIOBJ_ARY_SMALL_CAPA + 1));
+  TEST_ASSERT(!FIOBJ_ARY_IS_SMALL(obj2ary(a)) &&
+                  fiobj_ary_count(a) == FIOBJ_ARY_SMALL_CAPA + 1,
+              "small Array promotion error\n");
+  for (intptr_t i = 0; i <= FIOBJ_ARY_SMALL_CAPA; ++i) {
+    TEST_ASSERT(fiobj_ary_index(a, i) == fiobj_num_new(i + 1),
+                "promoted Array value error (%zu)\n", (size_t)i);
+  }
+  fiobj_free(a);
+  a = fiobj_ary_new();
+  fiobj_ary_set(a, fiobj_true(), FIOBJ_ARY_SMALL_CAPA);
+  TEST_ASSERT(!FIOBJ_ARY_IS_SMALL(obj2ary(a)) &&
+                  fiobj_ary_count(a) == FIOBJ_ARY_SMALL_CAPA + 1 &&
+                  fiobj_ary_index(a, -1) == fiobj_true(),
+              "small Array set (past the end) error\n");
+  fiobj_free(a);
   fprintf(stderr, "* passed.\n");
 }
 #endif
@@ -15,6 +15,17 @@ A dynamic Array type for the fiobj_s dynamic type system.
 extern "C" {
 #endif
 
+#ifndef FIOBJ_ARY_SMALL_CAPA
+/**
+ * Arrays with up to this many objects are stored within the Array object,
+ * without a separate allocation. Must be at least 1.
+ *
+ * The objects are moved to a (growing) allocated buffer once more room is
+ * required.
+ */
+#define FIOBJ_ARY_SMALL_CAPA 4
+#endif
+
 /* *****************************************************************************
 Array creation API
 ***************************************************************************** */
@@ -25,6 +25,7 @@ License: MIT
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -43,10 +44,12 @@ typedef struct {
     void (*dealloc)(void *); /* buffer deallocation function */
     size_t fpos;             /* the file reader's position */
   } source;
-  size_t capa; /* total buffer capacity / slice offset */
-  size_t len;  /* length of valid data in buffer */
-  size_t pos;  /* position of reader */
-  int fd;      /* file descriptor (-1 if invalid). */
+  size_t capa;    /* total buffer capacity / slice offset */
+  size_t len;     /* length of valid data in buffer */
+  size_t pos;     /* position of reader */
+  uint8_t *map;   /* read only file mapping (see FIOBJ_DATA_MMAP_MIN) */
+  size_t map_len; /* the length of the file mapping */
+  int fd;         /* file descriptor (-1 if invalid). */
 } fiobj_data_s;
 
 #define obj2io(o) ((fiobj_data_s *)(o))
@@ -173,6 +176,8 @@ static void fiobj_data_dealloc(FIOBJ o, void (*task)(FIOBJ, void *),
     fiobj_free(obj2io(o)->source.parent);
     break;
   default:
+    if (obj2io(o)->map)
+      munmap(obj2io(o)->map, obj2io(o)->map_len);
     close(obj2io(o)->fd);
     fio_free(obj2io(o)->buffer);
     break;
@@ -540,8 +545,53 @@ static fio_str_info_s fiobj_data_read_slice(FIOBJ io, intptr_t length) {
                           (obj2io(io)->pos - pos));
 }
 
+/**
+ * Maps the file (read only), so the data up to (and including) the byte at
+ * `position` is mapped. The file is mapped again if it grew.
+ *
+ * Returns -1 if the file shouldn't (or couldn't) be mapped or is too short.
+ */
+static int fiobj_data_map(FIOBJ io, size_t position) {
+  if (obj2io(io)->map_len > position)
+    return 0;
+  if (!FIOBJ_DATA_MMAP_MIN)
+    return -1;
+  struct stat st;
+  if (fstat(obj2io(io)->fd, &st) || !S_ISREG(st.st_mode) ||
+      (size_t)st.st_size < FIOBJ_DATA_MMAP_MIN ||
+      (size_t)st.st_size <= obj2io(io)->map_len)
+    return -1;
+  if (obj2io(io)->map)
+    munmap(obj2io(io)->map, obj2io(io)->map_len);
+  obj2io(io)->map_len = 0;
+  obj2io(io)->map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED,
+                         obj2io(io)->fd, 0);
+  if (obj2io(io)->map == MAP_FAILED) {
+    obj2io(io)->map = NULL;
+    return -1;
+  }
+  obj2io(io)->map_len = (size_t)st.st_size;
+  madvise(obj2io(io)->map, obj2io(io)->map_len, MADV_SEQUENTIAL);
+  /* the buffered data is no longer used */
+  obj2io(io)->pos = 0;
+  obj2io(io)->len = 0;
+  return (obj2io(io)->map_len > position) - 1;
+}
+
 /** Reads up to `length` bytes */
 static fio_str_info_s fiobj_data_read_file(FIOBJ io, intptr_t length) {
+  if (length > 0 && obj2io(io)->pos == obj2io(io)->len &&
+      !fiobj_data_map(io, obj2io(io)->source.fpos)) {
+    /* read from the file mapping (the data might be shorter) */
+    const size_t pos = obj2io(io)->source.fpos;
+    if ((uintptr_t)length + pos > obj2io(io)->map_len)
+      fiobj_data_map(io, length + pos - 1);
+    if ((uintptr_t)length + pos > obj2io(io)->map_len)
+      length = obj2io(io)->map_len - pos;
+    obj2io(io)->source.fpos += length;
+    return (fio_str_info_s){.data = (char *)obj2io(io)->map + pos,
+                            .len = (uintptr_t)length};
+  }
   uintptr_t fsize = fiobj_data_get_fd_size(io);
 
   if (length <= 0) {
@@ -643,9 +693,28 @@ static fio_str_info_s fiobj_data_read2ch_slice(FIOBJ io, uint8_t token) {
   return tmp;
 }
 
+/* seeks the token in the file mapping (a single `memchr` for most lines) */
+static fio_str_info_s fiobj_data_read2ch_map(FIOBJ io, uint8_t token) {
+  const size_t start = obj2io(io)->source.fpos;
+  uint8_t *pos = obj2io(io)->map + start;
+  while (!swallow_ch(&pos, obj2io(io)->map + obj2io(io)->map_len, token)) {
+    /* the file might have grown since it was mapped */
+    const size_t scanned = obj2io(io)->map_len;
+    if (fiobj_data_map(io, scanned))
+      break;
+    pos = obj2io(io)->map + scanned;
+  }
+  const size_t end = (size_t)(pos - obj2io(io)->map);
+  obj2io(io)->source.fpos = end;
+  return (fio_str_info_s){.data = (char *)obj2io(io)->map + start,
+                          .len = end - start};
+}
+
 static fio_str_info_s fiobj_data_read2ch_file(FIOBJ io, uint8_t token) {
   uint8_t *pos = obj2io(io)->buffer + obj2io(io)->pos;
   uint8_t *lim = obj2io(io)->buffer + obj2io(io)->len;
+  if (pos == lim && !fiobj_data_map(io, obj2io(io)->source.fpos))
+    return fiobj_data_read2ch_map(io, token);
   if (pos != lim && swallow_ch(&pos, lim, token)) {
     /* newline found in existing buffer */
     const uintptr_t delta =
@@ -679,8 +748,9 @@ static fio_str_info_s fiobj_data_read2ch_file(FIOBJ io, uint8_t token) {
       return (fio_str_info_s){.data = (char *)obj2io(io)->buffer,
                               .len = obj2io(io)->len};
     }
+    /* only the new data is scanned */
+    pos = obj2io(io)->buffer + obj2io(io)->len;
     obj2io(io)->len += tmp;
-    pos = obj2io(io)->buffer;
     lim = obj2io(io)->buffer + obj2io(io)->len;
     if (swallow_ch(&pos, lim, token)) {
       const uintptr_t delta =
@@ -1151,6 +1221,41 @@ void fiobj_data_test(void) {
   }
   fiobj_free(sliceio);
 
+  {
+    /* large files are memory mapped (test both sides of an append) */
+    const size_t count = (FIOBJ_DATA_MMAP_MIN >> 3) + 1024;
+    char line[24];
+    fdio = fiobj_data_newtmpfile();
+    for (size_t i = 0; i < count; ++i) {
+      snprintf(line, 24, "%07zu\n", i);
+      fiobj_data_write(fdio, line, 8);
+    }
+    for (size_t i = 0; i < count + 4; ++i) {
+      if (i == count - 2) {
+        /* two more lines are appended while reading */
+        snprintf(line, 24, "%07zu\n%07zu\n", count, count + 1);
+        fiobj_data_write(fdio, line, 16);
+      }
+      snprintf(line, 24, "%07zu\n", i);
+      if (i & 1) {
+        s1 = fiobj_data_gets(fdio);
+      } else {
+        s1 = fiobj_data_read(fdio, 8);
+      }
+      if (i >= count + 2) {
+        if (s1.data) {
+          fprintf(stderr, "* large file EOF `gets` was not EOF?! FAILED!\n");
+          exit(-1);
+        }
+      } else if (s1.len != 8 || memcmp(s1.data, line, 8)) {
+        fprintf(stderr, "* large file `gets` / `read` FAILED at line %zu\n", i);
+        exit(-1);
+      }
+    }
+    fiobj_free(fdio);
+    fprintf(stderr, "* large (mapped) file `gets` and `read` passed.\n");
+  }
+
   fprintf(stderr, "* passed.\n");
 }
 
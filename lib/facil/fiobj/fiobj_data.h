@@ -18,6 +18,15 @@ License: MIT
 
 #include <fiobject.h>
 
+#ifndef FIOBJ_DATA_MMAP_MIN
+/**
+ * File backed Data objects of (at least) this size are memory mapped (read
+ * only) by `fiobj_data_read` and `fiobj_data_gets`, rather than read using
+ * `pread` one buffer at a time. Set to 0 to disable.
+ */
+#define FIOBJ_DATA_MMAP_MIN (1UL << 16)
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
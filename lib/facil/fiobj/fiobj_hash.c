@@ -7,6 +7,7 @@ License: MIT
 
 #include <assert.h>
 #include <fiobj_hash.h>
+#include <fiobj_numbers.h>
 
 #define FIO_SET_CALLOC(size, count) fio_calloc((size), (count))
 #define FIO_SET_REALLOC(ptr, original_size, size, valid_data_length)           \
@@ -39,16 +40,118 @@ License: MIT
 /* *****************************************************************************
 Hash types
 ***************************************************************************** */
+
+/* an inline key-value pair (small Hashes) */
+typedef struct {
+  uint64_t hash;
+  FIOBJ key;
+  FIOBJ obj;
+} fiobj_hash_pair_s;
+
+/* marks a Hash that was promoted to the hashed form */
+#define FIOBJ_HASH_HASHED ((uintptr_t)-1)
+
 typedef struct {
   fiobj_object_header_s head;
-  fio_hash___s hash;
+  /* the number of inline pairs, or FIOBJ_HASH_HASHED */
+  uintptr_t small;
+  union {
+    fio_hash___s hash;
+    fiobj_hash_pair_s pairs[FIOBJ_HASH_SMALL_CAPA];
+  } u;
 } fiobj_hash_s;
 
 #define obj2hash(o) ((fiobj_hash_s *)(FIOBJ2PTR(o)))
 
+#define FIOBJ_HASH_IS_SMALL(h) ((h)->small != FIOBJ_HASH_HASHED)
+
+/* locates an inline pair, a `key` of -1 matches any key with the same hash */
+static inline fiobj_hash_pair_s *fiobj_hash_small_find(fiobj_hash_s *h,
+                                                       uint64_t hash_value,
+                                                       FIOBJ key) {
+  for (uintptr_t i = 0; i < h->small; ++i) {
+    if (h->u.pairs[i].hash == hash_value &&
+        (key == (FIOBJ)-1 || fiobj_iseq(h->u.pairs[i].key, key)))
+      return h->u.pairs + i;
+  }
+  return NULL;
+}
+
+/* moves the inline pairs to a hash map with (at least) `capa` capacity */
+static void fiobj_hash_promote(fiobj_hash_s *h, size_t capa) {
+  fiobj_hash_pair_s pairs[FIOBJ_HASH_SMALL_CAPA];
+  const uintptr_t count = h->small;
+  memcpy(pairs, h->u.pairs, sizeof(*pairs) * count);
+  h->small = FIOBJ_HASH_HASHED;
+  h->u.hash = (fio_hash___s)FIO_SET_INIT;
+  fio_hash___capa_require(&h->u.hash, capa);
+  for (uintptr_t i = 0; i < count; ++i) {
+    fio_hash___insert(&h->u.hash, pairs[i].hash, pairs[i].key, pairs[i].obj,
+                      NULL);
+    fiobj_free(pairs[i].key);
+    fiobj_free(pairs[i].obj);
+  }
+}
+
+/* `fio_hash___insert` for either form, `old` receives the old object */
+static void fiobj_hash_insert(fiobj_hash_s *h, uint64_t hash_value, FIOBJ key,
+                              FIOBJ obj, FIOBJ *old) {
+  if (FIOBJ_HASH_IS_SMALL(h)) {
+    fiobj_hash_pair_s *pos = fiobj_hash_small_find(h, hash_value, key);
+    if (pos) {
+      if (old)
+        *old = pos->obj;
+      else
+        fiobj_free(pos->obj);
+      pos->obj = fiobj_dup(obj);
+      return;
+    }
+    if (h->small < FIOBJ_HASH_SMALL_CAPA) {
+      h->u.pairs[h->small++] = (fiobj_hash_pair_s){
+          .hash = hash_value,
+          .key = fiobj_dup(key),
+          .obj = fiobj_dup(obj),
+      };
+      return;
+    }
+    fiobj_hash_promote(h, FIOBJ_HASH_SMALL_CAPA + 1);
+  }
+  fio_hash___insert(&h->u.hash, hash_value, key, obj, old);
+}
+
+/* `fio_hash___remove` for either form, `old` receives the old object */
+static int fiobj_hash_remove_pair(fiobj_hash_s *h, uint64_t hash_value,
+                                  FIOBJ key, FIOBJ *old) {
+  if (!FIOBJ_HASH_IS_SMALL(h))
+    return fio_hash___remove(&h->u.hash, hash_value, key, old);
+  fiobj_hash_pair_s *pos = fiobj_hash_small_find(h, hash_value, key);
+  if (!pos)
+    return -1;
+  if (old)
+    *old = pos->obj;
+  else
+    fiobj_free(pos->obj);
+  fiobj_free(pos->key);
+  --h->small;
+  memmove(pos, pos + 1,
+          sizeof(*pos) * ((h->u.pairs + h->small) - pos)); /* keep order */
+  return 0;
+}
+
+/* `fio_hash___find` for either form */
+static inline FIOBJ fiobj_hash_find(fiobj_hash_s *h, uint64_t hash_value,
+                                    FIOBJ key) {
+  if (!FIOBJ_HASH_IS_SMALL(h))
+    return fio_hash___find(&h->u.hash, hash_value, key);
+  fiobj_hash_pair_s *pos = fiobj_hash_small_find(h, hash_value, key);
+  return pos ? pos->obj : FIOBJ_INVALID;
+}
+
 void fiobj_hash_rehash(FIOBJ h) {
   assert(h && FIOBJ_TYPE_IS(h, FIOBJ_T_HASH));
-  fio_hash___rehash(&obj2hash(h)->hash);
+  if (FIOBJ_HASH_IS_SMALL(obj2hash(h)))
+    return;
+  fio_hash___rehash(&obj2hash(h)->u.hash);
 }
 
 /* *****************************************************************************
@@ -57,16 +160,25 @@ Hash alloc + VTable
 
 static void fiobj_hash_dealloc(FIOBJ o, void (*task)(FIOBJ, void *),
                                void *arg) {
-  FIO_SET_FOR_LOOP(&obj2hash(o)->hash, i) {
+  fiobj_hash_s *h = obj2hash(o);
+  if (FIOBJ_HASH_IS_SMALL(h)) {
+    for (uintptr_t i = 0; i < h->small; ++i) {
+      task(h->u.pairs[i].obj, arg);
+      fiobj_free(h->u.pairs[i].key);
+    }
+    fiobject___free(FIOBJ2PTR(o));
+    return;
+  }
+  FIO_SET_FOR_LOOP(&h->u.hash, i) {
     if (i->obj.key)
       task((FIOBJ)i->obj.obj, arg);
     fiobj_free((FIOBJ)i->obj.key);
     i->obj.key = FIOBJ_INVALID;
     i->obj.obj = FIOBJ_INVALID;
   }
-  obj2hash(o)->hash.count = 0;
-  fio_hash___free(&obj2hash(o)->hash);
-  fio_free(FIOBJ2PTR(o));
+  h->u.hash.count = 0;
+  fio_hash___free(&h->u.hash);
+  fiobject___free(FIOBJ2PTR(o));
 }
 
 static __thread FIOBJ each_at_key = FIOBJ_INVALID;
@@ -75,8 +187,19 @@ static size_t fiobj_hash_each1(FIOBJ o, size_t start_at,
                                int (*task)(FIOBJ obj, void *arg), void *arg) {
   assert(o && FIOBJ_TYPE_IS(o, FIOBJ_T_HASH));
   FIOBJ old_each_at_key = each_at_key;
-  fio_hash___s *hash = &obj2hash(o)->hash;
+  fiobj_hash_s *h = obj2hash(o);
   size_t count = 0;
+  if (FIOBJ_HASH_IS_SMALL(h)) {
+    for (count = start_at; count < h->small; ++count) {
+      each_at_key = h->u.pairs[count].key;
+      if (task(h->u.pairs[count].obj, arg) == -1) {
+        ++count;
+        break;
+      }
+    }
+    goto end;
+  }
+  fio_hash___s *hash = &h->u.hash;
   if (hash->count == hash->pos) {
     /* no holes in the hash, we can work as we please. */
     for (count = start_at; count < hash->count; ++count) {
@@ -113,8 +236,7 @@ end:
 FIOBJ fiobj_hash_key_in_loop(void) { return each_at_key; }
 
 static size_t fiobj_hash_is_eq(const FIOBJ self, const FIOBJ other) {
-  if (fio_hash___count(&obj2hash(self)->hash) !=
-      fio_hash___count(&obj2hash(other)->hash))
+  if (fiobj_hash_count(self) != fiobj_hash_count(other))
     return 0;
   return 1;
 }
@@ -122,7 +244,9 @@ static size_t fiobj_hash_is_eq(const FIOBJ self, const FIOBJ other) {
 /** Returns the number of elements in the Array. */
 size_t fiobj_hash_count(const FIOBJ o) {
   assert(o && FIOBJ_TYPE_IS(o, FIOBJ_T_HASH));
-  return fio_hash___count(&obj2hash(o)->hash);
+  if (FIOBJ_HASH_IS_SMALL(obj2hash(o)))
+    return obj2hash(o)->small;
+  return fio_hash___count(&obj2hash(o)->u.hash);
 }
 
 intptr_t fiobj_hash2num(const FIOBJ o) { return (intptr_t)fiobj_hash_count(o); }
@@ -158,10 +282,12 @@ Hash API
  * retain order of object insertion.
  */
 FIOBJ fiobj_hash_new(void) {
-  fiobj_hash_s *h = fio_malloc(sizeof(*h));
+  fiobj_hash_s *h = fiobject___alloc(sizeof(*h));
   FIO_ASSERT_ALLOC(h);
-  *h = (fiobj_hash_s){.head = {.ref = 1, .type = FIOBJ_T_HASH},
-                      .hash = FIO_SET_INIT};
+  *h = (fiobj_hash_s){.head = {.ref = 1,
+                               .type = FIOBJ_T_HASH,
+                               .arena = FIOBJECT_ARENA_ACTIVE()},
+                      .small = 0};
   return (FIOBJ)h | FIOBJECT_HASH_FLAG;
 }
 
@@ -173,12 +299,10 @@ FIOBJ fiobj_hash_new(void) {
  * retain order of object insertion.
  */
 FIOBJ fiobj_hash_new2(size_t capa) {
-  fiobj_hash_s *h = fio_malloc(sizeof(*h));
-  FIO_ASSERT_ALLOC(h);
-  *h = (fiobj_hash_s){.head = {.ref = 1, .type = FIOBJ_T_HASH},
-                      .hash = FIO_SET_INIT};
-  fio_hash___capa_require(&h->hash, capa);
-  return (FIOBJ)h | FIOBJECT_HASH_FLAG;
+  FIOBJ o = fiobj_hash_new();
+  if (capa > FIOBJ_HASH_SMALL_CAPA)
+    fiobj_hash_promote(obj2hash(o), capa);
+  return o;
 }
 
 /**
@@ -187,7 +311,9 @@ FIOBJ fiobj_hash_new2(size_t capa) {
  */
 size_t fiobj_hash_capa(const FIOBJ hash) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
-  return fio_hash___capa(&obj2hash(hash)->hash);
+  if (FIOBJ_HASH_IS_SMALL(obj2hash(hash)))
+    return FIOBJ_HASH_SMALL_CAPA;
+  return fio_hash___capa(&obj2hash(hash)->u.hash);
 }
 
 /**
@@ -200,7 +326,7 @@ int fiobj_hash_set(FIOBJ hash, FIOBJ key, FIOBJ obj) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
   if (FIOBJ_TYPE_IS(key, FIOBJ_T_STRING))
     fiobj_str_freeze(key);
-  fio_hash___insert(&obj2hash(hash)->hash, fiobj_obj2hash(key), key, obj, NULL);
+  fiobj_hash_insert(obj2hash(hash), fiobj_obj2hash(key), key, obj, NULL);
   fiobj_free(obj); /* take ownership - free the user's reference. */
   return 0;
 }
@@ -217,13 +343,23 @@ int fiobj_hash_set(FIOBJ hash, FIOBJ key, FIOBJ obj) {
  */
 FIOBJ fiobj_hash_pop(FIOBJ hash, FIOBJ *key) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
+  fiobj_hash_s *h = obj2hash(hash);
   FIOBJ old;
-  if (fio_hash___count(&obj2hash(hash)->hash))
+  if (!fiobj_hash_count(hash))
     return FIOBJ_INVALID;
-  old = fiobj_dup(fio_hash___last(&obj2hash(hash)->hash).obj);
+  if (FIOBJ_HASH_IS_SMALL(h)) {
+    --h->small;
+    old = h->u.pairs[h->small].obj;
+    if (key)
+      *key = h->u.pairs[h->small].key;
+    else
+      fiobj_free(h->u.pairs[h->small].key);
+    return old;
+  }
+  old = fiobj_dup(fio_hash___last(&h->u.hash).obj);
   if (key)
-    *key = fiobj_dup(fio_hash___last(&obj2hash(hash)->hash).key);
-  fio_hash___pop(&obj2hash(hash)->hash);
+    *key = fiobj_dup(fio_hash___last(&h->u.hash).key);
+  fio_hash___pop(&h->u.hash);
   return old;
 }
 
@@ -239,7 +375,7 @@ FIOBJ fiobj_hash_pop(FIOBJ hash, FIOBJ *key) {
 FIOBJ fiobj_hash_replace(FIOBJ hash, FIOBJ key, FIOBJ obj) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
   FIOBJ old = FIOBJ_INVALID;
-  fio_hash___insert(&obj2hash(hash)->hash, fiobj_obj2hash(key), key, obj, &old);
+  fiobj_hash_insert(obj2hash(hash), fiobj_obj2hash(key), key, obj, &old);
   fiobj_free(obj); /* take ownership - free the user's reference. */
   return old;
 }
@@ -250,7 +386,7 @@ FIOBJ fiobj_hash_replace(FIOBJ hash, FIOBJ key, FIOBJ obj) {
 FIOBJ fiobj_hash_remove(FIOBJ hash, FIOBJ key) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
   FIOBJ old = FIOBJ_INVALID;
-  fio_hash___remove(&obj2hash(hash)->hash, fiobj_obj2hash(key), key, &old);
+  fiobj_hash_remove_pair(obj2hash(hash), fiobj_obj2hash(key), key, &old);
   return old;
 }
 
@@ -261,7 +397,7 @@ FIOBJ fiobj_hash_remove(FIOBJ hash, FIOBJ key) {
 FIOBJ fiobj_hash_remove2(FIOBJ hash, uint64_t hash_value) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
   FIOBJ old = FIOBJ_INVALID;
-  fio_hash___remove(&obj2hash(hash)->hash, hash_value, -1, &old);
+  fiobj_hash_remove_pair(obj2hash(hash), hash_value, -1, &old);
   return old;
 }
 
@@ -272,8 +408,8 @@ FIOBJ fiobj_hash_remove2(FIOBJ hash, uint64_t hash_value) {
  * Returns -1 on type error or if the object never existed.
  */
 int fiobj_hash_delete(FIOBJ hash, FIOBJ key) {
-  return fio_hash___remove(&obj2hash(hash)->hash, fiobj_obj2hash(key), key,
-                           NULL);
+  return fiobj_hash_remove_pair(obj2hash(hash), fiobj_obj2hash(key), key,
+                                NULL);
 }
 
 /**
@@ -287,7 +423,7 @@ int fiobj_hash_delete(FIOBJ hash, FIOBJ key) {
  * Returns -1 on type error or if the object never existed.
  */
 int fiobj_hash_delete2(FIOBJ hash, uint64_t key_hash) {
-  return fio_hash___remove(&obj2hash(hash)->hash, key_hash, -1, NULL);
+  return fiobj_hash_remove_pair(obj2hash(hash), key_hash, -1, NULL);
 }
 
 /**
@@ -296,8 +432,7 @@ int fiobj_hash_delete2(FIOBJ hash, uint64_t key_hash) {
  */
 FIOBJ fiobj_hash_get(const FIOBJ hash, FIOBJ key) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
-  return fio_hash___find(&obj2hash(hash)->hash, fiobj_obj2hash(key), key);
-  ;
+  return fiobj_hash_find(obj2hash(hash), fiobj_obj2hash(key), key);
 }
 
 /**
@@ -310,8 +445,7 @@ FIOBJ fiobj_hash_get(const FIOBJ hash, FIOBJ key) {
  */
 FIOBJ fiobj_hash_get2(const FIOBJ hash, uint64_t key_hash) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
-  return fio_hash___find(&obj2hash(hash)->hash, key_hash, -1);
-  ;
+  return fiobj_hash_find(obj2hash(hash), key_hash, -1);
 }
 
 /**
@@ -319,7 +453,7 @@ FIOBJ fiobj_hash_get2(const FIOBJ hash, uint64_t key_hash) {
  */
 int fiobj_hash_haskey(const FIOBJ hash, FIOBJ key) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
-  return fio_hash___find(&obj2hash(hash)->hash, fiobj_obj2hash(key), key) !=
+  return fiobj_hash_find(obj2hash(hash), fiobj_obj2hash(key), key) !=
          FIOBJ_INVALID;
 }
 
@@ -328,7 +462,16 @@ int fiobj_hash_haskey(const FIOBJ hash, FIOBJ key) {
  */
 void fiobj_hash_clear(const FIOBJ hash) {
   assert(hash && FIOBJ_TYPE_IS(hash, FIOBJ_T_HASH));
-  fio_hash___free(&obj2hash(hash)->hash);
+  fiobj_hash_s *h = obj2hash(hash);
+  if (FIOBJ_HASH_IS_SMALL(h)) {
+    for (uintptr_t i = 0; i < h->small; ++i) {
+      fiobj_free(h->u.pairs[i].key);
+      fiobj_free(h->u.pairs[i].obj);
+    }
+  } else {
+    fio_hash___free(&h->u.hash);
+  }
+  h->small = 0;
 }
 
 /* *****************************************************************************
@@ -359,16 +502,16 @@ void fiobj_test_hash(void) {
               "hash compare didn't get value back");
 
   FIOBJ o2 = fiobj_hash_new2(3);
-  TEST_ASSERT(obj2hash(o2)->hash.capa >= 3,
+  TEST_ASSERT(fiobj_hash_capa(o2) >= 3,
               "Hash capacity should be larger than 3! %zu != 4\n",
-              (size_t)obj2hash(o2)->hash.capa);
+              fiobj_hash_capa(o2));
   fiobj_hash_set(o2, str_key, fiobj_true());
   TEST_ASSERT(fiobj_hash_is_eq(o, o2), "Hashes not equal at core! %zu != %zu\n",
               fiobj_hash_count(o), fiobj_hash_count(o2));
   TEST_ASSERT(fiobj_iseq(o, o2), "Hashes not equal!\n");
-  TEST_ASSERT(obj2hash(o2)->hash.capa > 3,
+  TEST_ASSERT(fiobj_hash_capa(o2) > 3,
               "Hash capacity should be larger than 3! %zu != 4\n",
-              (size_t)obj2hash(o2)->hash.capa);
+              fiobj_hash_capa(o2));
 
   fiobj_hash_delete(o, str_key);
 
@@ -378,6 +521,61 @@ void fiobj_test_hash(void) {
       str_key); /* note that a copy will remain in the Hash until rehashing. */
   fiobj_free(o);
   fiobj_free(o2);
+
+  /* small (inline) Hashes and their promotion */
+  o = fiobj_hash_new();
+  FIOBJ keys[FIOBJ_HASH_SMALL_CAPA * 2 + 1];
+  for (size_t i = 0; i < FIOBJ_HASH_SMALL_CAPA * 2 + 1; ++i) {
+    keys[i] = fiobj_str_buf(8);
+    fiobj_str_write(keys[i], "key", 3);
+    fiobj_str_write_i(keys[i], i);
+    fiobj_hash_set(o, keys[i], fiobj_num_new(i));
+    TEST_ASSERT(fiobj_hash_count(o) == i + 1, "Hash count error (%zu)\n", i);
+    TEST_ASSERT(FIOBJ_HASH_IS_SMALL(obj2hash(o)) ==
+                    (i < FIOBJ_HASH_SMALL_CAPA),
+                "Hash promotion error (%zu)\n", i);
+    /* replacing a value shouldn't add a pair */
+    fiobj_hash_set(o, keys[i], fiobj_num_new(i));
+    TEST_ASSERT(fiobj_hash_count(o) == i + 1, "value replacement error\n");
+  }
+  for (size_t i = 0; i < FIOBJ_HASH_SMALL_CAPA * 2 + 1; ++i) {
+    TEST_ASSERT(fiobj_obj2num(fiobj_hash_get(o, keys[i])) == (intptr_t)i,
+                "promoted Hash value error (%zu)\n", i);
+    TEST_ASSERT(fiobj_obj2num(fiobj_hash_get2(o, fiobj_obj2hash(keys[i]))) ==
+                    (intptr_t)i,
+                "promoted Hash value error (hash value, %zu)\n", i);
+  }
+  fiobj_free(o);
+  o = fiobj_hash_new();
+  for (size_t i = 0; i < FIOBJ_HASH_SMALL_CAPA; ++i)
+    fiobj_hash_set(o, keys[i], fiobj_num_new(i));
+  TEST_ASSERT(!fiobj_hash_delete(o, keys[0]) &&
+                  fiobj_hash_delete(o, keys[0]) == -1,
+              "small Hash delete error\n");
+  TEST_ASSERT(fiobj_hash_count(o) == FIOBJ_HASH_SMALL_CAPA - 1 &&
+                  !fiobj_hash_get(o, keys[0]),
+              "small Hash delete count error\n");
+  fiobj_hash_set(o, keys[0], fiobj_true());
+  TEST_ASSERT(fiobj_hash_replace(o, keys[0], fiobj_false()) == fiobj_true(),
+              "small Hash replace error\n");
+  TEST_ASSERT(fiobj_hash_remove2(o, fiobj_obj2hash(keys[0])) == fiobj_false(),
+              "small Hash remove2 error\n");
+  TEST_ASSERT(fiobj_hash_count(o) == FIOBJ_HASH_SMALL_CAPA - 1,
+              "small Hash remove2 count error\n");
+  if (FIOBJ_HASH_SMALL_CAPA > 1) {
+    /* the last pair standing should be the last one inserted */
+    FIOBJ tmp = FIOBJ_INVALID;
+    TEST_ASSERT(fiobj_hash_pop(o, &tmp) ==
+                        fiobj_num_new(FIOBJ_HASH_SMALL_CAPA - 1) &&
+                    tmp == keys[FIOBJ_HASH_SMALL_CAPA - 1],
+                "small Hash pop error\n");
+    fiobj_free(tmp);
+  }
+  fiobj_hash_clear(o);
+  TEST_ASSERT(!fiobj_hash_count(o), "small Hash clear error\n");
+  fiobj_free(o);
+  for (size_t i = 0; i < FIOBJ_HASH_SMALL_CAPA * 2 + 1; ++i)
+    fiobj_free(keys[i]);
   fprintf(stderr, "* passed.\n");
 }
 #endif
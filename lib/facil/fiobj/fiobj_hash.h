@@ -30,6 +30,17 @@ extern "C" {
 /* MUST be a power of 2 */
 #define HASH_INITIAL_CAPACITY 16
 
+#ifndef FIOBJ_HASH_SMALL_CAPA
+/**
+ * Hashes with up to this many key-value pairs are stored within the Hash
+ * object, as an (ordered) array searched linearly, without a hash map.
+ *
+ * Such Hashes are promoted to the hashed form once more pairs are added (or
+ * when a larger capacity is requested). Must be at least 1.
+ */
+#define FIOBJ_HASH_SMALL_CAPA 4
+#endif
+
 /** attempts to rehash the hashmap. */
 void fiobj_hash_rehash(FIOBJ h);
 
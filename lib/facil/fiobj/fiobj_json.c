@@ -8,6 +8,7 @@ License: MIT
 #include <fio.h>
 
 #include <fio_json_parser.h>
+#include <fiobj4fio.h>
 
 #include <assert.h>
 #include <ctype.h>
@@ -39,9 +40,26 @@ typedef struct {
   FIOBJ top;
   FIOBJ target;
   fio_json_stack_s stack;
+  const fiobj_json_stream_settings_s *sax;
   uint8_t is_hash;
 } fiobj_json_parser_s;
 
+/** The streaming parser (the callbacks test for `parser.sax`). */
+struct fiobj_json_stream_s {
+  fiobj_json_parser_s parser;
+  fiobj_json_stream_settings_s settings;
+  /* incomplete data, waiting for the next chunk */
+  char *buf;
+  size_t len;
+  size_t capa;
+  /* unescaped String data */
+  char *str;
+  size_t str_capa;
+  /* set when `buf` starts with an unterminated String */
+  uint8_t in_str;
+  uint8_t error;
+};
+
 /* *****************************************************************************
 FIOBJ Callacks
 ***************************************************************************** */
@@ -66,26 +84,67 @@ static inline void fiobj_json_add2parser(fiobj_json_parser_s *p, FIOBJ o) {
 
 /** a NULL object was detected */
 static void fio_json_on_null(json_parser_s *p) {
+  const fiobj_json_stream_settings_s *sax = ((fiobj_json_parser_s *)p)->sax;
+  if (sax) {
+    sax->on_null(sax->udata);
+    return;
+  }
   fiobj_json_add2parser((fiobj_json_parser_s *)p, fiobj_null());
 }
 /** a TRUE object was detected */
 static void fio_json_on_true(json_parser_s *p) {
+  const fiobj_json_stream_settings_s *sax = ((fiobj_json_parser_s *)p)->sax;
+  if (sax) {
+    sax->on_true(sax->udata);
+    return;
+  }
   fiobj_json_add2parser((fiobj_json_parser_s *)p, fiobj_true());
 }
 /** a FALSE object was detected */
 static void fio_json_on_false(json_parser_s *p) {
+  const fiobj_json_stream_settings_s *sax = ((fiobj_json_parser_s *)p)->sax;
+  if (sax) {
+    sax->on_false(sax->udata);
+    return;
+  }
   fiobj_json_add2parser((fiobj_json_parser_s *)p, fiobj_false());
 }
 /** a Numberl was detected (long long). */
 static void fio_json_on_number(json_parser_s *p, long long i) {
+  const fiobj_json_stream_settings_s *sax = ((fiobj_json_parser_s *)p)->sax;
+  if (sax) {
+    sax->on_number(sax->udata, i);
+    return;
+  }
   fiobj_json_add2parser((fiobj_json_parser_s *)p, fiobj_num_new(i));
 }
 /** a Float was detected (double). */
 static void fio_json_on_float(json_parser_s *p, double f) {
+  const fiobj_json_stream_settings_s *sax = ((fiobj_json_parser_s *)p)->sax;
+  if (sax) {
+    sax->on_float(sax->udata, f);
+    return;
+  }
   fiobj_json_add2parser((fiobj_json_parser_s *)p, fiobj_float_new(f));
 }
 /** a String was detected (int / float). update `pos` to point at ending */
 static void fio_json_on_string(json_parser_s *p, void *start, size_t length) {
+  if (((fiobj_json_parser_s *)p)->sax) {
+    fiobj_json_stream_s *s = (fiobj_json_stream_s *)p;
+    fio_str_info_s str = {.data = start, .len = length};
+    if (memchr(start, '\\', length)) {
+      /* unescape into the stream's buffer, unescaped data is never longer */
+      if (s->str_capa <= length) {
+        s->str_capa = (length + 16) & (~(size_t)15);
+        s->str = fio_realloc2(s->str, s->str_capa, 0);
+        FIO_ASSERT_ALLOC(s->str);
+      }
+      str.data = s->str;
+      str.len = fio_json_unescape_str(s->str, start, length);
+    }
+    s->settings.on_string(s->settings.udata, str, p->key);
+    return;
+  }
   FIOBJ str = fiobj_str_buf(length);
   fiobj_str_resize(
       str, fio_json_unescape_str(fiobj_obj2cstr(str).data, start, length));
@@ -94,6 +153,8 @@ static void fio_json_on_string(json_parser_s *p, void *start, size_t length) {
 /** a dictionary object was detected */
 static int fio_json_on_start_object(json_parser_s *p) {
   fiobj_json_parser_s *pr = (fiobj_json_parser_s *)p;
+  if (pr->sax)
+    return pr->sax->on_start_object(pr->sax->udata);
   if (pr->target) {
     /* push NULL, don't free the objects */
     fio_json_stack_push(&pr->stack, pr->top);
@@ -111,6 +172,10 @@ static int fio_json_on_start_object(json_parser_s *p) {
 /** a dictionary object closure detected */
 static void fio_json_on_end_object(json_parser_s *p) {
   fiobj_json_parser_s *pr = (fiobj_json_parser_s *)p;
+  if (pr->sax) {
+    pr->sax->on_end_object(pr->sax->udata);
+    return;
+  }
   if (pr->key) {
     FIO_LOG_WARNING("(JSON parsing) malformed JSON, "
                     "ignoring dangling Hash key.");
@@ -124,6 +189,8 @@ static void fio_json_on_end_object(json_parser_s *p) {
 /** an array object was detected */
 static int fio_json_on_start_array(json_parser_s *p) {
   fiobj_json_parser_s *pr = (fiobj_json_parser_s *)p;
+  if (pr->sax)
+    return pr->sax->on_start_array(pr->sax->udata);
   if (pr->target)
     return -1;
   FIOBJ ary = fiobj_ary_new();
@@ -136,13 +203,21 @@ static int fio_json_on_start_array(json_parser_s *p) {
 /** an array closure was detected */
 static void fio_json_on_end_array(json_parser_s *p) {
   fiobj_json_parser_s *pr = (fiobj_json_parser_s *)p;
+  if (pr->sax) {
+    pr->sax->on_end_array(pr->sax->udata);
+    return;
+  }
   pr->top = FIOBJ_INVALID;
   fio_json_stack_pop(&pr->stack, &pr->top);
   pr->is_hash = FIOBJ_TYPE_IS(pr->top, FIOBJ_T_HASH);
 }
 /** the JSON parsing is complete */
 static void fio_json_on_json(json_parser_s *p) {
-  // fiobj_json_parser_s *pr = (fiobj_json_parser_s *)p;
+  fiobj_json_parser_s *pr = (fiobj_json_parser_s *)p;
+  if (pr->sax) {
+    pr->sax->on_json(pr->sax->udata);
+    return;
+  }
   // FIO_ARY_FOR(&pr->stack, pos) { fiobj_free((FIOBJ)pos.obj); }
   // fio_json_stack_free(&pr->stack);
   (void)p; /* nothing special... right? */
@@ -153,6 +228,11 @@ static void fio_json_on_error(json_parser_s *p) {
 #if DEBUG
   FIO_LOG_DEBUG("JSON on error called.");
 #endif
+  if (pr->sax) {
+    ((fiobj_json_stream_s *)p)->error = 1;
+    pr->sax->on_error(pr->sax->udata);
+    return;
+  }
   fiobj_free((FIOBJ)fio_json_stack_get(&pr->stack, 0));
   fiobj_free(pr->key);
   fio_json_stack_free(&pr->stack);
@@ -163,26 +243,20 @@ static void fio_json_on_error(json_parser_s *p) {
 JSON formatting
 ***************************************************************************** */
 
-/** Writes a JSON friendly version of the src String */
-static void write_safe_str(FIOBJ dest, const FIOBJ str) {
-  fio_str_info_s s = fiobj_obj2cstr(str);
+/** Writes a JSON friendly (escaped) version of the data, without quotes */
+static void write_safe_data(FIOBJ dest, const uint8_t *restrict src,
+                            size_t len) {
   fio_str_info_s t = fiobj_obj2cstr(dest);
-  t.data[t.len] = '"';
-  t.len++;
-  fiobj_str_resize(dest, t.len);
-  t = fiobj_obj2cstr(dest);
-  const uint8_t *restrict src = (const uint8_t *)s.data;
-  size_t len = s.len;
   uint64_t end = t.len;
   /* make sure we have some room */
   size_t added = 0;
   size_t capa = fiobj_str_capa(dest);
-  if (capa <= end + s.len + 64) {
+  if (capa <= end + len + 64) {
     if (0) {
       capa = (((capa >> 12) + 1) << 12) - 1;
       capa = fiobj_str_capa_assert(dest, capa);
     } else {
-      capa = fiobj_str_capa_assert(dest, (end + s.len + 64));
+      capa = fiobj_str_capa_assert(dest, (end + len + 64));
     }
     fio_str_info_s tmp = fiobj_obj2cstr(dest);
     t = tmp;
@@ -245,6 +319,8 @@ static void write_safe_str(FIOBJ dest, const FIOBJ str) {
     src++;
     len--;
     if (added >= 48 && capa <= end + len + 64) {
+      /* keep the data written so far when the String is reallocated */
+      fiobj_str_resize(dest, end);
       if (0) {
         capa = (((capa >> 12) + 1) << 12) - 1;
         capa = fiobj_str_capa_assert(dest, capa);
@@ -255,18 +331,58 @@ static void write_safe_str(FIOBJ dest, const FIOBJ str) {
       added = 0;
     }
   }
-  t.data[end++] = '"';
   fiobj_str_resize(dest, end);
 }
 
+/** Writes a JSON friendly version of the src String */
+static void write_safe_str(FIOBJ dest, const FIOBJ str) {
+  fio_str_info_s s = fiobj_obj2cstr(str);
+  fiobj_str_write(dest, "\"", 1);
+  write_safe_data(dest, (const uint8_t *)s.data, s.len);
+  fiobj_str_write(dest, "\"", 1);
+}
+
 typedef struct {
   FIOBJ dest;
   FIOBJ parent;
   fio_json_stack_s *stack;
   uintptr_t count;
+  /* when set, `dest` is passed to `flush` once it reaches `chunk` bytes */
+  int (*flush)(void *udata, FIOBJ chunk);
+  void *udata;
+  size_t chunk;
   uint8_t pretty;
+  uint8_t error;
 } obj2json_data_s;
 
+/** Passes the pending data to the `flush` callback, starting a new chunk. */
+static void fiobj_obj2json_flush(obj2json_data_s *data) {
+  if (!fiobj_obj2cstr(data->dest).len)
+    return;
+  if (data->flush(data->udata, data->dest))
+    data->error = 1;
+  data->dest = data->error ? FIOBJ_INVALID : fiobj_str_buf(data->chunk + 64);
+}
+
+/** Writes a String, breaking it into chunks when flushing is possible. */
+static void fiobj_obj2json_str(obj2json_data_s *data, FIOBJ o) {
+  fio_str_info_s s = fiobj_obj2cstr(o);
+  if (!data->flush || s.len <= data->chunk) {
+    write_safe_str(data->dest, o);
+    return;
+  }
+  fiobj_str_write(data->dest, "\"", 1);
+  while (s.len && !data->error) {
+    size_t slice = (s.len > data->chunk ? data->chunk : s.len);
+    write_safe_data(data->dest, (const uint8_t *)s.data, slice);
+    s.data += slice;
+    s.len -= slice;
+    fiobj_obj2json_flush(data);
+  }
+  if (!data->error)
+    fiobj_str_write(data->dest, "\"", 1);
+}
+
 static int fiobj_obj2json_task(FIOBJ o, void *data_) {
   obj2json_data_s *data = data_;
   uint8_t add_seperator = 1;
@@ -285,9 +401,12 @@ static int fiobj_obj2json_task(FIOBJ o, void *data_) {
     break;
 
   case FIOBJ_T_DATA:
+  case FIOBJ_T_ROPE:
   case FIOBJ_T_UNKNOWN:
   case FIOBJ_T_STRING:
-    write_safe_str(data->dest, o);
+    fiobj_obj2json_str(data, o);
+    if (data->error)
+      return -1;
     --data->count;
     break;
 
@@ -362,6 +481,11 @@ static int fiobj_obj2json_task(FIOBJ o, void *data_) {
     }
   }
 
+  if (data->flush && fiobj_obj2cstr(data->dest).len >= data->chunk) {
+    fiobj_obj2json_flush(data);
+    if (data->error)
+      return -1;
+  }
   return 0;
 }
 
@@ -443,11 +567,321 @@ FIOBJ fiobj_obj2json(FIOBJ obj, uint8_t pretty) {
   return fiobj_obj2json2(fiobj_str_buf(128), obj, pretty);
 }
 
+/* *****************************************************************************
+Streaming API
+***************************************************************************** */
+
+/**
+ * Formats an object into JSON, passing `chunk` sized Strings to `flush` (which
+ * takes ownership of the String). Returns -1 if `flush` returned an error.
+ */
+static int fiobj_obj2json_stream(FIOBJ o, uint8_t pretty, size_t chunk,
+                                 int (*flush)(void *udata, FIOBJ chunk),
+                                 void *udata) {
+  fio_json_stack_s stack = FIO_ARY_INIT;
+  obj2json_data_s data = {
+      .dest = fiobj_str_buf(chunk + 64),
+      .stack = &stack,
+      .pretty = pretty,
+      .count = 1,
+      .flush = flush,
+      .udata = udata,
+      .chunk = chunk,
+  };
+  if (!o)
+    fiobj_str_write(data.dest, "null", 4);
+  else if (!FIOBJ_IS_ALLOCATED(o) || !FIOBJECT2VTBL(o)->each)
+    fiobj_obj2json_task(o, &data);
+  else
+    fiobj_each2(o, fiobj_obj2json_task, &data);
+  fio_json_stack_free(&stack);
+  if (data.error)
+    return -1;
+  if (!fiobj_obj2cstr(data.dest).len) {
+    fiobj_free(data.dest);
+    return 0;
+  }
+  return (flush(udata, data.dest) ? -1 : 0);
+}
+
+static int fiobj_json_write_flush(void *uuid, FIOBJ chunk) {
+  return (fiobj_send_free((intptr_t)uuid, chunk) < 0 ? -1 : 0);
+}
+
+/**
+ * Formats an object as JSON and writes it to the socket (`uuid`) using
+ * `fio_write2`, one `FIOBJ_JSON_WRITE_CHUNK` sized packet at a time.
+ */
+ssize_t fiobj_json_write(intptr_t uuid, FIOBJ o, uint8_t pretty) {
+  return fiobj_obj2json_stream(o, pretty, FIOBJ_JSON_WRITE_CHUNK,
+                               fiobj_json_write_flush, (void *)uuid);
+}
+
+/* the default (noop) streaming callbacks */
+static void fiobj_json_stream_noop(void *udata) { (void)udata; }
+static int fiobj_json_stream_noop_start(void *udata) {
+  (void)udata;
+  return 0;
+}
+static void fiobj_json_stream_noop_num(void *udata, long long i) {
+  (void)udata;
+  (void)i;
+}
+static void fiobj_json_stream_noop_float(void *udata, double f) {
+  (void)udata;
+  (void)f;
+}
+static void fiobj_json_stream_noop_str(void *udata, fio_str_info_s str,
+                                       uint8_t is_key) {
+  (void)udata;
+  (void)str;
+  (void)is_key;
+}
+
+/**
+ * Creates a streaming (SAX style) JSON parser that calls the callbacks as the
+ * data is parsed, without building any FIOBJ objects.
+ */
+fiobj_json_stream_s *
+fiobj_json_stream_new FIO_IGNORE_MACRO(fiobj_json_stream_settings_s settings) {
+  if (!settings.on_null)
+    settings.on_null = fiobj_json_stream_noop;
+  if (!settings.on_true)
+    settings.on_true = fiobj_json_stream_noop;
+  if (!settings.on_false)
+    settings.on_false = fiobj_json_stream_noop;
+  if (!settings.on_number)
+    settings.on_number = fiobj_json_stream_noop_num;
+  if (!settings.on_float)
+    settings.on_float = fiobj_json_stream_noop_float;
+  if (!settings.on_string)
+    settings.on_string = fiobj_json_stream_noop_str;
+  if (!settings.on_start_object)
+    settings.on_start_object = fiobj_json_stream_noop_start;
+  if (!settings.on_end_object)
+    settings.on_end_object = fiobj_json_stream_noop;
+  if (!settings.on_start_array)
+    settings.on_start_array = fiobj_json_stream_noop_start;
+  if (!settings.on_end_array)
+    settings.on_end_array = fiobj_json_stream_noop;
+  if (!settings.on_json)
+    settings.on_json = fiobj_json_stream_noop;
+  if (!settings.on_error)
+    settings.on_error = fiobj_json_stream_noop;
+  fiobj_json_stream_s *s = fio_malloc(sizeof(*s));
+  FIO_ASSERT_ALLOC(s);
+  *s = (fiobj_json_stream_s){
+      .parser = {.top = FIOBJ_INVALID},
+      .settings = settings,
+  };
+  s->parser.sax = &s->settings;
+  return s;
+}
+
+/** Frees the streaming parser. */
+void fiobj_json_stream_free(fiobj_json_stream_s *s) {
+  if (!s)
+    return;
+  fio_free(s->buf);
+  fio_free(s->str);
+  fio_free(s);
+}
+
+/** Copies data to the end of the stream's buffer (NUL terminated). */
+static void fiobj_json_stream_append(fiobj_json_stream_s *s, const char *data,
+                                     size_t len) {
+  if (s->capa <= s->len + len) {
+    size_t capa = s->capa ? s->capa : 256;
+    while (capa <= s->len + len)
+      capa <<= 1;
+    s->buf = fio_realloc2(s->buf, capa, s->len);
+    FIO_ASSERT_ALLOC(s->buf);
+    s->capa = capa;
+  }
+  memcpy(s->buf + s->len, data, len);
+  s->len += len;
+  s->buf[s->len] = 0;
+}
+
+/**
+ * Returns the length of the trailing data that might be part of a number (or
+ * a literal) completed by the next chunk, which the parser can't tell apart.
+ */
+static size_t fiobj_json_stream_tail(const char *data, size_t len) {
+  size_t held = 0;
+  while (held < len) {
+    const uint8_t c = (uint8_t)data[len - held - 1];
+    if (c <= 32 || c == ',' || c == ':' || c == '"' || c == '[' || c == ']' ||
+        c == '{' || c == '}')
+      break;
+    ++held;
+  }
+  return held;
+}
+
+/** Parses as many JSON objects as possible, returning the bytes consumed. */
+static size_t fiobj_json_stream_consume(fiobj_json_stream_s *s,
+                                        const char *data, size_t len) {
+  size_t total = 0;
+  size_t consumed;
+  while (total < len &&
+         (consumed = fio_json_parse(&s->parser.p, data + total, len - total)))
+    total += consumed;
+  return total;
+}
+
+/** Feeds a chunk of JSON data to the streaming parser. */
+int fiobj_json_stream_feed(fiobj_json_stream_s *s, const void *data_,
+                           size_t len) {
+  const char *data = data_;
+  if (!s || s->error)
+    return -1;
+  if (!len)
+    return 0;
+  if (s->len) {
+    /* a String can't be completed by a chunk that has no quotes */
+    uint8_t skip = (s->in_str && !memchr(data, '"', len));
+    fiobj_json_stream_append(s, data, len);
+    if (skip)
+      return 0;
+    data = s->buf;
+    len = s->len;
+  }
+  size_t consumed = fiobj_json_stream_consume(
+      s, data, len - fiobj_json_stream_tail(data, len));
+  if (s->error)
+    return -1;
+  if (data == s->buf) {
+    s->len -= consumed;
+    memmove(s->buf, s->buf + consumed, s->len);
+    s->buf[s->len] = 0;
+  } else {
+    fiobj_json_stream_append(s, data + consumed, len - consumed);
+  }
+  s->in_str = (s->len && s->buf[0] == '"' &&
+               !memchr(s->buf + 1, '"', s->len - 1));
+  return 0;
+}
+
+/** Marks the end of the data, parsing any trailing top level number. */
+int fiobj_json_stream_finish(fiobj_json_stream_s *s) {
+  if (!s || s->error)
+    return -1;
+  if (s->len) {
+    /* a trailing delimiter completes any number (or literal) */
+    fiobj_json_stream_append(s, "\n", 1);
+    size_t consumed = fiobj_json_stream_consume(s, s->buf, s->len);
+    if (s->error)
+      return -1;
+    s->len -= consumed;
+    memmove(s->buf, s->buf + consumed, s->len);
+    s->in_str = 0;
+  }
+  return ((s->len || s->parser.p.depth) ? -1 : 0);
+}
+
 /* *****************************************************************************
 Test
 ***************************************************************************** */
 
 #if DEBUG
+typedef struct {
+  size_t primitives;
+  size_t numbers;
+  long long sum;
+  size_t floats;
+  size_t strings;
+  size_t keys;
+  size_t objects;
+  size_t arrays;
+  size_t closures;
+  size_t json;
+  size_t errors;
+  char last[32];
+} fiobj_json_test_sax_s;
+
+static void fiobj_json_test_on_primitive(void *udata) {
+  ++((fiobj_json_test_sax_s *)udata)->primitives;
+}
+static void fiobj_json_test_on_number(void *udata, long long i) {
+  ++((fiobj_json_test_sax_s *)udata)->numbers;
+  ((fiobj_json_test_sax_s *)udata)->sum += i;
+}
+static void fiobj_json_test_on_float(void *udata, double f) {
+  ++((fiobj_json_test_sax_s *)udata)->floats;
+  (void)f;
+}
+static void fiobj_json_test_on_string(void *udata, fio_str_info_s str,
+                                      uint8_t is_key) {
+  fiobj_json_test_sax_s *t = udata;
+  if (is_key) {
+    ++t->keys;
+    return;
+  }
+  ++t->strings;
+  if (str.len >= sizeof(t->last))
+    str.len = sizeof(t->last) - 1;
+  memcpy(t->last, str.data, str.len);
+  t->last[str.len] = 0;
+}
+static int fiobj_json_test_on_object(void *udata) {
+  ++((fiobj_json_test_sax_s *)udata)->objects;
+  return 0;
+}
+static int fiobj_json_test_on_array(void *udata) {
+  ++((fiobj_json_test_sax_s *)udata)->arrays;
+  return 0;
+}
+static void fiobj_json_test_on_closure(void *udata) {
+  ++((fiobj_json_test_sax_s *)udata)->closures;
+}
+static void fiobj_json_test_on_json(void *udata) {
+  ++((fiobj_json_test_sax_s *)udata)->json;
+}
+static void fiobj_json_test_on_error(void *udata) {
+  ++((fiobj_json_test_sax_s *)udata)->errors;
+}
+
+/* parses the data using `chunk` sized slices */
+static int fiobj_json_test_stream(fiobj_json_test_sax_s *t, const char *data,
+                                  size_t len, size_t chunk) {
+  *t = (fiobj_json_test_sax_s){.primitives = 0};
+  fiobj_json_stream_s *s = fiobj_json_stream_new(
+          .on_null = fiobj_json_test_on_primitive,
+          .on_true = fiobj_json_test_on_primitive,
+          .on_false = fiobj_json_test_on_primitive,
+          .on_number = fiobj_json_test_on_number,
+          .on_float = fiobj_json_test_on_float,
+          .on_string = fiobj_json_test_on_string,
+          .on_start_object = fiobj_json_test_on_object,
+          .on_end_object = fiobj_json_test_on_closure,
+          .on_start_array = fiobj_json_test_on_array,
+          .on_end_array = fiobj_json_test_on_closure,
+          .on_json = fiobj_json_test_on_json,
+          .on_error = fiobj_json_test_on_error, .udata = t);
+  int ret = 0;
+  for (size_t pos = 0; pos < len && !ret; pos += chunk)
+    ret = fiobj_json_stream_feed(s, data + pos,
+                                 (len - pos > chunk ? chunk : len - pos));
+  if (!ret)
+    ret = fiobj_json_stream_finish(s);
+  fiobj_json_stream_free(s);
+  return ret;
+}
+
+typedef struct {
+  FIOBJ str;
+  size_t count;
+} fiobj_json_test_sink_s;
+
+static int fiobj_json_test_sink(void *udata, FIOBJ chunk) {
+  fiobj_json_test_sink_s *sink = udata;
+  fiobj_str_join(sink->str, chunk);
+  fiobj_free(chunk);
+  ++sink->count;
+  return 0;
+}
+
 void fiobj_test_json(void) {
   fprintf(stderr, "=== Testing JSON parser (simple test)\n");
 #define TEST_ASSERT(cond, ...)                                                 \
@@ -604,6 +1038,21 @@ void fiobj_test_json(void) {
       (int)fiobj_obj2cstr(o).len, fiobj_obj2cstr(o).data,
       fiobj_obj2cstr(o).data + 3);
   fiobj_free(o);
+  {
+    /* long Strings and white space runs cross the vector scanning blocks */
+    char long_json[] = "[                                \"0123456789012345"
+                       "678901234567890123456789012345678\\\"9\"  ,\n\n"
+                       "                       1]";
+    fiobj_json2obj(&o, long_json, sizeof(long_json));
+    TEST_ASSERT(FIOBJ_TYPE_IS(o, FIOBJ_T_ARRAY) && fiobj_ary_count(o) == 2,
+                "JSON long String array error!\n");
+    fio_str_info_s s = fiobj_obj2cstr(fiobj_ary_index(o, 0));
+    TEST_ASSERT(s.len == 51 && !memcmp(s.data + 48, "8\"9", 3),
+                "JSON long String error (%zu): %s\n", s.len, s.data);
+    TEST_ASSERT(fiobj_obj2num(fiobj_ary_index(o, 1)) == 1,
+                "JSON value after white space run error!\n");
+    fiobj_free(o);
+  }
   size_t consumed = fiobj_json2obj(&o, json_str2, sizeof(json_str2));
   TEST_ASSERT(
       consumed == (sizeof(json_str2) - 1),
@@ -615,9 +1064,80 @@ void fiobj_test_json(void) {
   TEST_ASSERT(FIOBJ_TYPE_IS(tmp, FIOBJ_T_STRING),
               "JSON messy string isn't a string\n");
   fprintf(stderr, "Messy JSON:\n%s\n", fiobj_obj2cstr(tmp).data);
+  fprintf(stderr, "* passed.\n");
+
+  fprintf(stderr, "=== Testing JSON streaming formatting\n");
+  for (uint8_t pretty = 0; pretty < 2; ++pretty) {
+    fiobj_json_test_sink_s sink = {.str = fiobj_str_buf(1)};
+    FIOBJ expected = fiobj_obj2json(o, pretty);
+    TEST_ASSERT(!fiobj_obj2json_stream(o, pretty, 16, fiobj_json_test_sink,
+                                       &sink),
+                "JSON streaming formatting failed!\n");
+    TEST_ASSERT(sink.count > 1, "JSON streaming should use multiple chunks!\n");
+    TEST_ASSERT(fiobj_iseq(sink.str, expected),
+                "JSON streaming formatting error (pretty == %d):\n%s\n",
+                (int)pretty, fiobj_obj2cstr(sink.str).data);
+    fiobj_free(expected);
+    fiobj_free(sink.str);
+  }
+  {
+    /* a long String, written in pieces */
+    FIOBJ ary = fiobj_ary_new();
+    FIOBJ str = fiobj_str_buf(512);
+    for (size_t i = 0; i < 64; ++i)
+      fiobj_str_write(str, "\"\n\x01 long", 8);
+    fiobj_ary_push(ary, str);
+    fiobj_json_test_sink_s sink = {.str = fiobj_str_buf(1)};
+    FIOBJ expected = fiobj_obj2json(ary, 0);
+    TEST_ASSERT(!fiobj_obj2json_stream(ary, 0, 16, fiobj_json_test_sink,
+                                       &sink),
+                "JSON streaming formatting (long String) failed!\n");
+    TEST_ASSERT(fiobj_iseq(sink.str, expected),
+                "JSON streaming formatting (long String) error:\n%s\n",
+                fiobj_obj2cstr(sink.str).data);
+    fiobj_free(expected);
+    fiobj_free(sink.str);
+    fiobj_free(ary);
+  }
   fiobj_free(o);
   fiobj_free(tmp);
   fprintf(stderr, "* passed.\n");
+
+  fprintf(stderr, "=== Testing JSON streaming parser\n");
+  {
+    fiobj_json_test_sax_s t, t2;
+    const size_t chunks[] = {1, 3, 7, 64, sizeof(json_str2)};
+    TEST_ASSERT(!fiobj_json_test_stream(&t, json_str, sizeof(json_str) - 1,
+                                        sizeof(json_str)),
+                "JSON stream parsing failed!\n");
+    TEST_ASSERT(t.keys == 8 && t.strings == 2 && t.numbers == 4 &&
+                    t.sum == 48 && t.floats == 1 && t.primitives == 3 &&
+                    t.objects == 2 && t.arrays == 1 && t.closures == 3 &&
+                    t.json == 1 && !t.errors,
+                "JSON stream parsing events error!\n");
+    TEST_ASSERT(!strcmp(t.last, "I \"wrote\" this."),
+                "JSON stream String unescaping error (%s)!\n", t.last);
+    TEST_ASSERT(!fiobj_json_test_stream(&t, json_str2, sizeof(json_str2) - 1,
+                                        sizeof(json_str2)),
+                "JSON stream parsing (messy) failed!\n");
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i) {
+      TEST_ASSERT(!fiobj_json_test_stream(&t2, json_str2,
+                                          sizeof(json_str2) - 1, chunks[i]),
+                  "JSON stream parsing (%zu byte chunks) failed!\n",
+                  chunks[i]);
+      TEST_ASSERT(!memcmp(&t, &t2, sizeof(t)),
+                  "JSON stream parsing (%zu byte chunks) events error!\n",
+                  chunks[i]);
+    }
+    TEST_ASSERT(!fiobj_json_test_stream(&t, "12 34\n[5]56", 11, 1) &&
+                    t.numbers == 4 && t.sum == 107 && t.json == 4,
+                "JSON stream parsing (multiple objects) error!\n");
+    TEST_ASSERT(fiobj_json_test_stream(&t, "[1,2", 4, 1) == -1 && !t.errors,
+                "JSON stream parsing should fail for incomplete data!\n");
+    TEST_ASSERT(fiobj_json_test_stream(&t, "[1,}", 4, 2) == -1 && t.errors,
+                "JSON stream parsing should fail for invalid data!\n");
+  }
+  fprintf(stderr, "* passed.\n");
 }
 
 #endif
@@ -57,6 +57,103 @@ FIOBJ fiobj_obj2json(FIOBJ, uint8_t pretty);
  */
 FIOBJ fiobj_obj2json2(FIOBJ dest, FIOBJ object, uint8_t pretty);
 
+/* *****************************************************************************
+JSON Streaming API
+***************************************************************************** */
+
+/** The callbacks (and `udata`) used by the streaming (SAX style) parser. */
+typedef struct {
+  /** a NULL object was detected */
+  void (*on_null)(void *udata);
+  /** a TRUE object was detected */
+  void (*on_true)(void *udata);
+  /** a FALSE object was detected */
+  void (*on_false)(void *udata);
+  /** a Number was detected. */
+  void (*on_number)(void *udata, long long i);
+  /** a Float was detected. */
+  void (*on_float)(void *udata, double f);
+  /**
+   * A String was detected (`is_key` is set for Hash keys).
+   *
+   * The (unescaped) data is only valid during the callback.
+   */
+  void (*on_string)(void *udata, fio_str_info_s str, uint8_t is_key);
+  /** a dictionary object was detected, return non-zero to abort parsing. */
+  int (*on_start_object)(void *udata);
+  /** a dictionary object closure was detected */
+  void (*on_end_object)(void *udata);
+  /** an array object was detected, return non-zero to abort parsing. */
+  int (*on_start_array)(void *udata);
+  /** an array closure was detected */
+  void (*on_end_array)(void *udata);
+  /** a complete (top level) JSON object was parsed */
+  void (*on_json)(void *udata);
+  /** a parsing error (or an abort) occurred, the stream is no longer usable */
+  void (*on_error)(void *udata);
+  /** opaque user data passed to the callbacks */
+  void *udata;
+} fiobj_json_stream_settings_s;
+
+/** An opaque streaming parser type. */
+typedef struct fiobj_json_stream_s fiobj_json_stream_s;
+
+/**
+ * Creates a streaming (SAX style) JSON parser that calls the callbacks as the
+ * data is parsed, without building any FIOBJ objects.
+ *
+ * Missing callbacks are ignored. Multiple top level JSON objects (i.e., line
+ * delimited JSON) are parsed one after the other.
+ *
+ * Remember to `fiobj_json_stream_free`.
+ */
+fiobj_json_stream_s *
+fiobj_json_stream_new(fiobj_json_stream_settings_s settings);
+#define fiobj_json_stream_new(...)                                             \
+  fiobj_json_stream_new((fiobj_json_stream_settings_s){__VA_ARGS__})
+
+/**
+ * Feeds a chunk of JSON data to the streaming parser.
+ *
+ * The chunk can end anywhere (even midway through a String). Only incomplete
+ * data is copied by the parser, so memory use is limited by the longest
+ * String (or number), not by the size of the JSON document.
+ *
+ * Returns 0 on success and -1 on error.
+ */
+int fiobj_json_stream_feed(fiobj_json_stream_s *stream, const void *data,
+                           size_t len);
+
+/**
+ * Marks the end of the data, parsing any trailing top level number.
+ *
+ * Returns 0 if all the data was parsed and -1 if the data was incomplete (or
+ * the stream had an error).
+ */
+int fiobj_json_stream_finish(fiobj_json_stream_s *stream);
+
+/** Frees the streaming parser. */
+void fiobj_json_stream_free(fiobj_json_stream_s *stream);
+
+#ifndef FIOBJ_JSON_WRITE_CHUNK
+/** The (approximate) size of the packets written by `fiobj_json_write`. */
+#define FIOBJ_JSON_WRITE_CHUNK 16384
+#endif
+
+/**
+ * Formats an object as JSON and writes it to the socket (`uuid`) using
+ * `fio_write2`, one `FIOBJ_JSON_WRITE_CHUNK` sized packet at a time.
+ *
+ * The JSON string is never assembled as a whole and long Strings are written
+ * in pieces, so the formatting never holds more than a chunk or so in memory.
+ *
+ * To stream large collections without building them first, write each member
+ * (i.e., a database row) with its own call and `fio_write` the separators.
+ *
+ * Returns 0 on success and -1 on error (i.e., the connection was closed).
+ */
+ssize_t fiobj_json_write(intptr_t uuid, FIOBJ object, uint8_t pretty);
+
 #if DEBUG
 void fiobj_test_json(void);
 #endif
@@ -10,6 +10,8 @@ License: MIT
 #include <fiobj_mustache.h>
 #include <fiobj_str.h>
 
+#include <fiobj4fio.h>
+
 #ifndef FIO_IGNORE_MACRO
 /**
  * This is used internally to ignore macros that shadow functions (avoiding
@@ -18,6 +20,73 @@ License: MIT
 #define FIO_IGNORE_MACRO
 #endif
 
+/* *****************************************************************************
+Template cache
+***************************************************************************** */
+
+typedef struct {
+  FIOBJ path;
+  /* the cache's reference (callers get their own, see `mustache_dup`) */
+  mustache_s *m;
+  /* the most recent modification time of the template's files */
+  time_t mtime;
+  /* the files are tested again after this time (in seconds) */
+  time_t expires;
+} fiobj_mustache_entry_s;
+
+static inline void fiobj_mustache_entry_free(fiobj_mustache_entry_s *e) {
+  fiobj_free(e->path);
+  mustache_free(e->m);
+  fio_free(e);
+}
+
+#define FIO_SET_NAME fiobj_mustache_cache
+#define FIO_SET_OBJ_TYPE fiobj_mustache_entry_s *
+#define FIO_SET_OBJ_COMPARE(o1, o2) fiobj_iseq((o1)->path, (o2)->path)
+#define FIO_SET_OBJ_DESTROY(o) fiobj_mustache_entry_free((o))
+#include <fio.h>
+
+static struct {
+  fiobj_mustache_cache_s set;
+  fio_lock_i lock;
+} fiobj_mustache_cache = {
+    .set = FIO_SET_INIT,
+    .lock = FIO_LOCK_INIT,
+};
+
+/** Empties the template cache (cached templates are freed once unused). */
+void fiobj_mustache_cache_clear(void) {
+  fio_lock(&fiobj_mustache_cache.lock);
+  fiobj_mustache_cache_free(&fiobj_mustache_cache.set);
+  fio_unlock(&fiobj_mustache_cache.lock);
+}
+
+static void fiobj_mustache_cache_cleanup(void *ignr_) {
+  fiobj_mustache_cache_clear();
+  (void)ignr_;
+}
+
+static void __attribute__((constructor)) fiobj_mustache_cache_init(void) {
+  fio_state_callback_add(FIO_CALL_AT_EXIT, fiobj_mustache_cache_cleanup, NULL);
+}
+
+/* collects the most recent modification time (missing files are ignored) */
+static int fiobj_mustache_mtime_task(const char *filename, size_t len,
+                                     void *mtime_) {
+  struct stat st;
+  time_t *mtime = mtime_;
+  if (!stat(filename, &st) && st.st_mtime > *mtime)
+    *mtime = st.st_mtime;
+  return 0;
+  (void)len;
+}
+
+static inline time_t fiobj_mustache_mtime(mustache_s *m) {
+  time_t mtime = 0;
+  mustache_each_file(m, fiobj_mustache_mtime_task, &mtime);
+  return mtime;
+}
+
 /**
  * Loads a mustache template, converting it into an opaque instruction array.
  *
@@ -29,7 +98,56 @@ License: MIT
  * The `filename` argument should contain the template's file name.
  */
 mustache_s *fiobj_mustache_load(fio_str_info_s filename) {
-  return mustache_load(.filename = filename.data, .filename_len = filename.len);
+  if (!FIOBJ_MUSTACHE_CACHE || !filename.data || !filename.len)
+    return mustache_load(.filename = filename.data,
+                         .filename_len = filename.len);
+  const time_t now = fio_last_tick().tv_sec;
+  FIOBJ path = fiobj_str_tmp();
+  fiobj_str_write(path, filename.data, filename.len);
+  const uint64_t hash = fiobj_obj2hash(path);
+  fiobj_mustache_entry_s key = {.path = path};
+  fiobj_mustache_entry_s *e;
+  mustache_s *m = NULL;
+  time_t mtime = 0;
+  fio_lock(&fiobj_mustache_cache.lock);
+  e = fiobj_mustache_cache_find(&fiobj_mustache_cache.set, hash, &key);
+  if (e) {
+    m = mustache_dup(e->m);
+    mtime = e->mtime;
+    if (e->expires > now)
+      goto found;
+  }
+  fio_unlock(&fiobj_mustache_cache.lock);
+  if (m) {
+    /* revalidate (the root template and any partials) outside the lock */
+    if (fiobj_mustache_mtime(m) <= mtime) {
+      fio_lock(&fiobj_mustache_cache.lock);
+      e = fiobj_mustache_cache_find(&fiobj_mustache_cache.set, hash, &key);
+      if (e && e->m == m)
+        e->expires = now + FIOBJ_MUSTACHE_CACHE_TTL;
+      goto found;
+    }
+    mustache_free(m);
+  }
+  m = mustache_load(.filename = filename.data, .filename_len = filename.len);
+  if (!m)
+    return NULL;
+  e = fio_malloc(sizeof(*e));
+  FIO_ASSERT_ALLOC(e);
+  *e = (fiobj_mustache_entry_s){
+      .path = fiobj_str_new(filename.data, filename.len),
+      .m = mustache_dup(m),
+      .mtime = fiobj_mustache_mtime(m),
+      .expires = now + FIOBJ_MUSTACHE_CACHE_TTL,
+  };
+  fio_lock(&fiobj_mustache_cache.lock);
+  fiobj_mustache_cache_overwrite(&fiobj_mustache_cache.set, hash, e, NULL);
+  fio_unlock(&fiobj_mustache_cache.lock);
+  return m;
+
+found:
+  fio_unlock(&fiobj_mustache_cache.lock);
+  return m;
 }
 
 /**
@@ -49,6 +167,56 @@ mustache_s *fiobj_mustache_new FIO_IGNORE_MACRO(mustache_load_args_s args) {
 /** Free the mustache template */
 void fiobj_mustache_free(mustache_s *mustache) { mustache_free(mustache); }
 
+/* *****************************************************************************
+Rendering
+***************************************************************************** */
+
+/* the rendering target (`udata1`) */
+typedef struct {
+  FIOBJ dest;
+  /* the output length (including any flushed chunks) */
+  size_t total;
+  /* when set, `dest` is passed to `flush` whenever it reaches `chunk` bytes */
+  int (*flush)(void *udata, FIOBJ chunk);
+  void *udata;
+  size_t chunk;
+  uint8_t error;
+} fiobj_mustache_output_s;
+
+/* the expected output length (the last output or the template's static text) */
+static inline size_t fiobj_mustache_size_hint(mustache_s *m) {
+  size_t hint = __atomic_load_n(&m->size_hint, __ATOMIC_RELAXED);
+  if (hint < mustache_text_length(m))
+    hint = mustache_text_length(m);
+  return hint;
+}
+
+static inline void fiobj_mustache_size_hint_set(mustache_s *m, size_t len) {
+  if (len > UINT32_MAX)
+    len = UINT32_MAX;
+  __atomic_store_n(&m->size_hint, (uint32_t)len, __ATOMIC_RELAXED);
+}
+
+static int fiobj_mustache_output_flush(fiobj_mustache_output_s *out) {
+  if (out->flush(out->udata, out->dest)) {
+    out->dest = FIOBJ_INVALID;
+    out->error = 1;
+    return -1;
+  }
+  out->dest = fiobj_str_buf(out->chunk);
+  return 0;
+}
+
+/* renders the template, the output is flushed in chunks when `flush` is set */
+static int fiobj_mustache_render(mustache_s *m, FIOBJ data,
+                                 fiobj_mustache_output_s *out) {
+  if (mustache_build(m, .udata1 = (void *)out, .udata2 = (void *)data) ||
+      out->error)
+    return -1;
+  fiobj_mustache_size_hint_set(m, out->total);
+  return 0;
+}
+
 /**
  * Renders a template into an existing FIOBJ String (`dest`'s end), using the
  * information in the `data` object.
@@ -56,7 +224,14 @@ void fiobj_mustache_free(mustache_s *mustache) { mustache_free(mustache); }
  * Returns FIOBJ_INVALID if an error occured and a FIOBJ String on success.
  */
 FIOBJ fiobj_mustache_build2(FIOBJ dest, mustache_s *mustache, FIOBJ data) {
-  mustache_build(mustache, .udata1 = (void *)dest, .udata2 = (void *)data);
+  if (!mustache)
+    return dest;
+  fiobj_mustache_output_s out = {.dest = dest};
+  fio_str_info_s i = fiobj_obj2cstr(dest);
+  const size_t hint = fiobj_mustache_size_hint(mustache);
+  if (i.capa < i.len + hint)
+    fiobj_str_capa_assert(dest, i.len + hint);
+  fiobj_mustache_render(mustache, data, &out);
   return dest;
 }
 
@@ -69,8 +244,42 @@ FIOBJ fiobj_mustache_build2(FIOBJ dest, mustache_s *mustache, FIOBJ data) {
 FIOBJ fiobj_mustache_build(mustache_s *mustache, FIOBJ data) {
   if (!mustache)
     return FIOBJ_INVALID;
-  return fiobj_mustache_build2(fiobj_str_buf(mustache->u.read_only.data_length),
-                               mustache, data);
+  fiobj_mustache_output_s out = {
+      .dest = fiobj_str_buf(fiobj_mustache_size_hint(mustache)),
+  };
+  fiobj_mustache_render(mustache, data, &out);
+  return out.dest;
+}
+
+static int fiobj_mustache_write_flush(void *uuid, FIOBJ chunk) {
+  return (fiobj_send_free((intptr_t)uuid, chunk) < 0 ? -1 : 0);
+}
+
+/**
+ * Renders a template straight to the socket (`uuid`) using `fio_write2`, one
+ * `FIOBJ_MUSTACHE_WRITE_CHUNK` sized packet at a time.
+ */
+ssize_t fiobj_mustache_write(intptr_t uuid, mustache_s *mustache, FIOBJ data) {
+  if (!mustache)
+    return -1;
+  size_t capa = fiobj_mustache_size_hint(mustache);
+  if (capa > FIOBJ_MUSTACHE_WRITE_CHUNK)
+    capa = FIOBJ_MUSTACHE_WRITE_CHUNK;
+  fiobj_mustache_output_s out = {
+      .dest = fiobj_str_buf(capa),
+      .flush = fiobj_mustache_write_flush,
+      .udata = (void *)uuid,
+      .chunk = FIOBJ_MUSTACHE_WRITE_CHUNK,
+  };
+  if (fiobj_mustache_render(mustache, data, &out)) {
+    fiobj_free(out.dest);
+    return -1;
+  }
+  if (!fiobj_obj2cstr(out.dest).len) {
+    fiobj_free(out.dest);
+    return 0;
+  }
+  return (fiobj_mustache_write_flush((void *)uuid, out.dest) ? -1 : 0);
 }
 
 /* *****************************************************************************
@@ -169,8 +378,12 @@ static int mustache_on_arg(mustache_section_s *section, const char *name,
  */
 static int mustache_on_text(mustache_section_s *section, const char *data,
                             uint32_t data_len) {
-  FIOBJ dest = (FIOBJ)section->udata1;
-  fiobj_str_write(dest, data, data_len);
+  fiobj_mustache_output_s *out = section->udata1;
+  if (out->error)
+    return -1;
+  out->total += data_len;
+  if (fiobj_str_write(out->dest, data, data_len) >= out->chunk && out->flush)
+    return fiobj_mustache_output_flush(out);
   return 0;
 }
 
@@ -238,6 +451,8 @@ Testing
 ***************************************************************************** */
 
 #if DEBUG
+#include <utime.h>
+
 static inline void mustache_save2file(char const *filename, char const *data,
                                       size_t length) {
   int fd = open(filename, O_CREAT | O_RDWR, 0);
@@ -253,6 +468,13 @@ static inline void mustache_save2file(char const *filename, char const *data,
   close(fd);
 }
 
+static int fiobj_mustache_test_flush(void *dest, FIOBJ chunk) {
+  fio_str_info_s i = fiobj_obj2cstr(chunk);
+  fiobj_str_write((FIOBJ)dest, i.data, i.len);
+  fiobj_free(chunk);
+  return 0;
+}
+
 void fiobj_mustache_test(void) {
 #define TEST_ASSERT(cond, ...)                                                 \
   if (!(cond)) {                                                               \
@@ -298,11 +520,100 @@ void fiobj_mustache_test(void) {
   fiobj_hash_set(ary, key, fiobj_str_new("dot notation success", 20));
   fiobj_free(key);
   key = fiobj_mustache_build(m, data);
-  fiobj_free(data);
   TEST_ASSERT(key, "fiobj_mustache_build failed!\n");
   fprintf(stderr, "%s\n", fiobj_obj2cstr(key).data);
+  TEST_ASSERT(m->size_hint == fiobj_obj2cstr(key).len,
+              "fiobj_mustache_build should update the size hint.\n");
+  {
+    /* chunked output should be the same as the rendered String */
+    FIOBJ chunks = fiobj_str_buf(0);
+    fiobj_mustache_output_s out = {
+        .dest = fiobj_str_buf(0),
+        .flush = fiobj_mustache_test_flush,
+        .udata = (void *)chunks,
+        .chunk = 8,
+    };
+    TEST_ASSERT(!fiobj_mustache_render(m, data, &out),
+                "chunked rendering failed.\n");
+    fiobj_mustache_test_flush((void *)chunks, out.dest);
+    TEST_ASSERT(fiobj_iseq(chunks, key),
+                "chunked rendering output mismatch:\n%s\n",
+                fiobj_obj2cstr(chunks).data);
+    fiobj_free(chunks);
+  }
+  fiobj_free(data);
   fiobj_free(key);
   fiobj_mustache_free(m);
+
+  /* cached templates, reloaded once a file changes */
+  char const *partial_name = "mustache_test_partial.mustache";
+  mustache_save2file(template_name, "{{>mustache_test_partial}}", 26);
+  mustache_save2file(partial_name, "1", 1);
+  m = fiobj_mustache_load((fio_str_info_s){.data = (char *)template_name,
+                                           .len = strlen(template_name)});
+  mustache_s *m2 =
+      fiobj_mustache_load((fio_str_info_s){.data = (char *)template_name,
+                                           .len = strlen(template_name)});
+  TEST_ASSERT(m && m == m2, "fiobj_mustache_load should use the cache.\n");
+  fiobj_mustache_free(m2);
+  unlink(partial_name);
+  mustache_save2file(partial_name, "2", 1);
+  {
+    /* a newer partial, tested once the entry expires */
+    struct utimbuf t = {.actime = time(NULL) + 10, .modtime = time(NULL) + 10};
+    utime(partial_name, &t);
+    FIOBJ path = fiobj_str_new(template_name, strlen(template_name));
+    fiobj_mustache_entry_s tmp = {.path = path};
+    fiobj_mustache_entry_s *e = fiobj_mustache_cache_find(
+        &fiobj_mustache_cache.set, fiobj_obj2hash(path), &tmp);
+    TEST_ASSERT(e, "template cache entry missing.\n");
+    e->expires = 0;
+    fiobj_free(path);
+  }
+  m2 = fiobj_mustache_load((fio_str_info_s){.data = (char *)template_name,
+                                            .len = strlen(template_name)});
+  TEST_ASSERT(m2 && m2 != m,
+              "fiobj_mustache_load should reload modified templates.\n");
+  key = fiobj_mustache_build(m2, FIOBJ_INVALID);
+  TEST_ASSERT(key && fiobj_obj2cstr(key).len == 1 &&
+                  fiobj_obj2cstr(key).data[0] == '2',
+              "reloaded template output error.\n");
+  fiobj_free(key);
+  key = fiobj_mustache_build(m, FIOBJ_INVALID);
+  TEST_ASSERT(key && fiobj_obj2cstr(key).data[0] == '1',
+              "the replaced template should remain valid.\n");
+  fiobj_free(key);
+  fiobj_mustache_free(m);
+  fiobj_mustache_free(m2);
+  fiobj_mustache_cache_clear();
+  unlink(partial_name);
+  unlink(template_name);
+
+  /* partials loaded twice, with data segments past the first 2KB */
+  {
+    char long_text[4096];
+    memset(long_text, 'x', sizeof(long_text));
+    memcpy(long_text + sizeof(long_text) - 53,
+           "{{>mustache_test_partial}}{{>mustache_test_partial2}}", 53);
+    mustache_save2file(partial_name, "{{>mustache_test_partial2}}", 27);
+    mustache_save2file("mustache_test_partial2.mustache", "+", 1);
+    m = fiobj_mustache_new(.filename = "mustache_test_long",
+                           .filename_len = 18, .data = long_text,
+                           .data_len = sizeof(long_text));
+    unlink(partial_name);
+    unlink("mustache_test_partial2.mustache");
+    TEST_ASSERT(m, "long template loading failed.\n");
+    TEST_ASSERT(mustache_text_length(m) == sizeof(long_text) - 53 + 1,
+                "mustache_text_length error (%zu).\n",
+                mustache_text_length(m));
+    key = fiobj_mustache_build(m, FIOBJ_INVALID);
+    TEST_ASSERT(key && fiobj_obj2cstr(key).len == sizeof(long_text) - 51 &&
+                    !memcmp(fiobj_obj2cstr(key).data + sizeof(long_text) - 53,
+                            "++", 2),
+                "long template output error.\n");
+    fiobj_free(key);
+    fiobj_mustache_free(m);
+  }
 }
 
 #endif
@@ -9,15 +9,43 @@ License: MIT
 
 #include <mustache_parser.h>
 
+#ifndef FIOBJ_MUSTACHE_CACHE
+/** When true (the default), `fiobj_mustache_load` caches templates. */
+#define FIOBJ_MUSTACHE_CACHE 1
+#endif
+
+#ifndef FIOBJ_MUSTACHE_CACHE_TTL
+/**
+ * The number of seconds a cached template is used before the modification
+ * times of its files (including partials) are tested again.
+ */
+#define FIOBJ_MUSTACHE_CACHE_TTL 1
+#endif
+
+#ifndef FIOBJ_MUSTACHE_WRITE_CHUNK
+/** The (approximate) size of the packets written by `fiobj_mustache_write`. */
+#define FIOBJ_MUSTACHE_WRITE_CHUNK 16384
+#endif
+
 /**
  * Loads a mustache template, converting it into an opaque instruction array.
  *
  * Returns a pointer to the instruction array or NULL (on error).
  *
  * The `filename` argument should contain the template's file name.
+ *
+ * Templates are cached by file name. A cached template is reloaded once the
+ * modification time of any of its files (the template or its partials)
+ * changes, tested at most once every `FIOBJ_MUSTACHE_CACHE_TTL` seconds.
+ *
+ * The returned template should be freed using `fiobj_mustache_free` (the cache
+ * keeps its own reference).
  */
 mustache_s *fiobj_mustache_load(fio_str_info_s filename);
 
+/** Empties the template cache (cached templates are freed once unused). */
+void fiobj_mustache_cache_clear(void);
+
 /**
  * Loads a mustache template, either from memory of a file, converting it into
  * an opaque instruction array.
@@ -36,7 +64,10 @@ mustache_s *fiobj_mustache_new(mustache_load_args_s args);
 #define fiobj_mustache_new(...)                                                \
   fiobj_mustache_new((mustache_load_args_s){__VA_ARGS__})
 
-/** Free the mustache template */
+/**
+ * Free the mustache template (releases the caller's reference to a cached
+ * template).
+ */
 void fiobj_mustache_free(mustache_s *mustache);
 
 /**
@@ -55,6 +86,17 @@ FIOBJ fiobj_mustache_build(mustache_s *mustache, FIOBJ data);
  */
 FIOBJ fiobj_mustache_build2(FIOBJ dest, mustache_s *mustache, FIOBJ data);
 
+/**
+ * Renders a template straight to the socket (`uuid`) using `fio_write2`, one
+ * `FIOBJ_MUSTACHE_WRITE_CHUNK` sized packet at a time.
+ *
+ * The rendered output is never assembled as a whole.
+ *
+ * Returns 0 on success and -1 on error (i.e., the connection was closed).
+ * Output written before an error isn't retracted.
+ */
+ssize_t fiobj_mustache_write(intptr_t uuid, mustache_s *mustache, FIOBJ data);
+
 #if DEBUG
 void fiobj_mustache_test(void);
 #endif
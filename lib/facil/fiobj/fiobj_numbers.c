@@ -104,7 +104,7 @@ Number API
 
 /** Creates a Number object. Remember to use `fiobj_free`. */
 FIOBJ fiobj_num_new_bignum(intptr_t num) {
-  fiobj_num_s *o = fio_malloc(sizeof(*o));
+  fiobj_num_s *o = fiobject___alloc(sizeof(*o));
   if (!o) {
     perror("ERROR: fiobj number couldn't allocate memory");
     exit(errno);
@@ -113,6 +113,7 @@ FIOBJ fiobj_num_new_bignum(intptr_t num) {
       .head =
           {
               .type = FIOBJ_T_NUMBER,
+              .arena = FIOBJECT_ARENA_ACTIVE(),
               .ref = 1,
           },
       .i = num,
@@ -142,7 +143,7 @@ Float API
 
 /** Creates a Float object. Remember to use `fiobj_free`.  */
 FIOBJ fiobj_float_new(double num) {
-  fiobj_float_s *o = fio_malloc(sizeof(*o));
+  fiobj_float_s *o = fiobject___alloc(sizeof(*o));
   if (!o) {
     perror("ERROR: fiobj float couldn't allocate memory");
     exit(errno);
@@ -151,6 +152,7 @@ FIOBJ fiobj_float_new(double num) {
       .head =
           {
               .type = FIOBJ_T_FLOAT,
+              .arena = FIOBJECT_ARENA_ACTIVE(),
               .ref = 1,
           },
       .f = num,
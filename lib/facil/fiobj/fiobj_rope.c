@@ -0,0 +1,429 @@
+/*
+Copyright: Boaz Segev, 2017-2019
+License: MIT
+*/
+#if defined(__unix__) || defined(__APPLE__) || defined(__linux__)
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <unistd.h>
+#endif
+
+#include <fiobj_rope.h>
+#include <fiobj_str.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include <fio.h>
+
+/* Strings shorter than this are copied rather than referenced */
+#define FIOBJ_ROPE_SHARE_MIN (FIOBJ_ROPE_CHUNK >> 4)
+
+/* *****************************************************************************
+Rope Type
+***************************************************************************** */
+
+typedef struct {
+  /* the (String) object owning the data, if any */
+  FIOBJ obj;
+  /* in-memory data (NULL for file segments) */
+  const char *data;
+  /* the segment's length */
+  uintptr_t len;
+  /* the file segment's offset */
+  uintptr_t offset;
+  /* the file segment's file descriptor */
+  int fd;
+  /* set for the chunks `fiobj_rope_write` copies data to */
+  uint8_t chunk;
+} fiobj_rope_seg_s;
+
+typedef struct {
+  fiobj_object_header_s head;
+  fiobj_rope_seg_s *seg;
+  size_t count;
+  size_t capa;
+  uintptr_t len;
+  /* the joined String value (see `fiobj_obj2cstr`), cleared by every edit */
+  FIOBJ flat;
+} fiobj_rope_s;
+
+#define obj2rope(o) ((fiobj_rope_s *)(FIOBJ2PTR(o)))
+
+#define REQUIRE_MEM(mem)                                                       \
+  do {                                                                         \
+    if ((mem) == NULL) {                                                       \
+      perror("FATAL ERROR: fiobj Rope couldn't allocate memory");              \
+      exit(errno);                                                             \
+    }                                                                          \
+  } while (0)
+
+/* *****************************************************************************
+Rope VTable
+***************************************************************************** */
+
+static void fiobj_rope_dealloc(FIOBJ o, void (*task)(FIOBJ, void *),
+                               void *arg) {
+  /* segments are Strings (never nested), so they're freed right away */
+  fiobj_rope_s *r = obj2rope(o);
+  for (size_t i = 0; i < r->count; ++i) {
+    if (r->seg[i].obj)
+      fiobj_free(r->seg[i].obj);
+    else if (!r->seg[i].data)
+      close(r->seg[i].fd);
+  }
+  fiobj_free(r->flat);
+  fio_free(r->seg);
+  fio_free(r);
+  (void)task;
+  (void)arg;
+}
+
+static fio_str_info_s fiobj_rope2str(const FIOBJ o) {
+  fiobj_rope_s *r = obj2rope(o);
+  if (r->flat)
+    return fiobj_obj2cstr(r->flat);
+  fiobj_arena_s *old = fiobj_arena_enter(NULL);
+  r->flat = fiobj_str_buf(r->len);
+  fiobj_arena_enter(old);
+  fio_str_info_s s = fiobj_obj2cstr(r->flat);
+  for (size_t i = 0; i < r->count; ++i) {
+    if (r->seg[i].data) {
+      memcpy(s.data + s.len, r->seg[i].data, r->seg[i].len);
+      s.len += r->seg[i].len;
+      continue;
+    }
+    ssize_t l = pread(r->seg[i].fd, s.data + s.len, r->seg[i].len,
+                      r->seg[i].offset);
+    if (l > 0)
+      s.len += l;
+  }
+  fiobj_str_resize(r->flat, s.len);
+  return fiobj_obj2cstr(r->flat);
+}
+
+static size_t fiobj_rope_is_eq(const FIOBJ self, const FIOBJ other) {
+  if (obj2rope(self)->len != obj2rope(other)->len)
+    return 0;
+  fio_str_info_s a = fiobj_rope2str(self);
+  fio_str_info_s b = fiobj_rope2str(other);
+  return a.len == b.len && !memcmp(a.data, b.data, a.len);
+}
+
+static intptr_t fiobj_rope2i(const FIOBJ o) {
+  return (intptr_t)obj2rope(o)->len;
+}
+
+static size_t fiobj_rope_is_true(const FIOBJ o) {
+  return obj2rope(o)->len != 0;
+}
+
+uintptr_t fiobject___noop_count(FIOBJ o);
+double fiobject___noop_to_f(FIOBJ o);
+
+const fiobj_object_vtable_s FIOBJECT_VTABLE_ROPE = {
+    .class_name = "Rope",
+    .dealloc = fiobj_rope_dealloc,
+    .to_i = fiobj_rope2i,
+    .to_str = fiobj_rope2str,
+    .is_eq = fiobj_rope_is_eq,
+    .is_true = fiobj_rope_is_true,
+    .to_f = fiobject___noop_to_f,
+    .count = fiobject___noop_count,
+};
+
+/* *****************************************************************************
+Rope API
+***************************************************************************** */
+
+/** Creates a new (empty) Rope object. Remember to use `fiobj_free`. */
+FIOBJ fiobj_rope_new(void) {
+  fiobj_rope_s *r = fio_malloc(sizeof(*r));
+  REQUIRE_MEM(r);
+  *r = (fiobj_rope_s){
+      .head = {.ref = 1, .type = FIOBJ_T_ROPE},
+  };
+  return (FIOBJ)r;
+}
+
+/* adds an (empty) segment, invalidating the joined String value */
+static fiobj_rope_seg_s *fiobj_rope_seg_add(FIOBJ o) {
+  fiobj_rope_s *r = obj2rope(o);
+  if (r->count == r->capa) {
+    const size_t capa = r->capa ? (r->capa << 1) : 8;
+    r->seg = fio_realloc2(r->seg, capa * sizeof(*r->seg),
+                          r->count * sizeof(*r->seg));
+    REQUIRE_MEM(r->seg);
+    r->capa = capa;
+  }
+  r->seg[r->count] = (fiobj_rope_seg_s){.fd = -1};
+  return r->seg + (r->count++);
+}
+
+/* clears the cached joined String value (called before edits) */
+static inline void fiobj_rope_edit(FIOBJ o) {
+  if (obj2rope(o)->flat) {
+    fiobj_free(obj2rope(o)->flat);
+    obj2rope(o)->flat = FIOBJ_INVALID;
+  }
+}
+
+/**
+ * Copies `length` bytes to the end of the Rope.
+ *
+ * Returns the number of bytes written (0 on error).
+ */
+uintptr_t fiobj_rope_write(FIOBJ rope, const void *data, uintptr_t length) {
+  if (!FIOBJ_IS_ROPE(rope) || !data || !length)
+    return 0;
+  fiobj_rope_edit(rope);
+  fiobj_rope_s *r = obj2rope(rope);
+  const char *pos = data;
+  uintptr_t left = length;
+  r->len += length;
+  if (r->count && r->seg[r->count - 1].chunk) {
+    /* fill the last chunk, it's never reallocated */
+    fiobj_rope_seg_s *s = r->seg + r->count - 1;
+    uintptr_t room = fiobj_str_capa(s->obj) - s->len;
+    /* a String filled to capacity is reallocated, so a byte is left unused */
+    room = (room > 1 ? room - 1 : 0);
+    if (room > left)
+      room = left;
+    fiobj_str_write(s->obj, pos, room);
+    s->len += room;
+    pos += room;
+    left -= room;
+  }
+  if (!left)
+    return length;
+  /* chunks are never allocated from an arena, Ropes are meant to be sent */
+  fiobj_arena_s *old = fiobj_arena_enter(NULL);
+  fiobj_rope_seg_s *s = fiobj_rope_seg_add(rope);
+  s->obj = fiobj_str_buf(left > FIOBJ_ROPE_CHUNK ? left : FIOBJ_ROPE_CHUNK);
+  fiobj_arena_enter(old);
+  fiobj_str_write(s->obj, pos, left);
+  s->data = fiobj_obj2cstr(s->obj).data;
+  s->len = left;
+  s->chunk = 1;
+  return length;
+}
+
+/**
+ * Adds the object's String value to the end of the Rope, taking ownership of
+ * the object.
+ */
+void fiobj_rope_push(FIOBJ rope, FIOBJ obj) {
+  if (!FIOBJ_IS_ROPE(rope) || rope == obj) {
+    fiobj_free(obj);
+    return;
+  }
+  if (FIOBJ_IS_ROPE(obj)) {
+    /* add the nested Rope's segments */
+    fiobj_rope_s *src = obj2rope(obj);
+    for (size_t i = 0; i < src->count; ++i) {
+      if (src->seg[i].fd != -1) {
+        fiobj_rope_push_file(rope, dup(src->seg[i].fd), src->seg[i].offset,
+                             src->seg[i].len);
+        continue;
+      }
+      if (src->seg[i].len < FIOBJ_ROPE_SHARE_MIN) {
+        fiobj_rope_write(rope, src->seg[i].data, src->seg[i].len);
+        continue;
+      }
+      fiobj_rope_edit(rope);
+      fiobj_rope_seg_s *s = fiobj_rope_seg_add(rope);
+      *s = src->seg[i];
+      s->obj = fiobj_dup(s->obj);
+      s->chunk = 0; /* chunks might be shared, so they are never edited */
+      obj2rope(rope)->len += s->len;
+    }
+    fiobj_free(obj);
+    return;
+  }
+  fio_str_info_s str = fiobj_obj2cstr(obj);
+  if (str.len < FIOBJ_ROPE_SHARE_MIN || !FIOBJ_TYPE_IS(obj, FIOBJ_T_STRING)) {
+    /* copying is cheaper than an extra segment (or required) */
+    fiobj_rope_write(rope, str.data, str.len);
+    fiobj_free(obj);
+    return;
+  }
+  fiobj_rope_edit(rope);
+  fiobj_rope_seg_s *s = fiobj_rope_seg_add(rope);
+  s->obj = obj;
+  s->data = str.data;
+  s->len = str.len;
+  obj2rope(rope)->len += str.len;
+}
+
+/**
+ * Adds a reference to static (or external) memory to the end of the Rope.
+ */
+void fiobj_rope_push_static(FIOBJ rope, const void *data, uintptr_t length) {
+  if (!FIOBJ_IS_ROPE(rope) || !data || !length)
+    return;
+  fiobj_rope_edit(rope);
+  fiobj_rope_seg_s *s = fiobj_rope_seg_add(rope);
+  s->data = data;
+  s->len = length;
+  obj2rope(rope)->len += length;
+}
+
+/**
+ * Adds `length` bytes from the file, starting at `offset`, to the end of the
+ * Rope, taking ownership of the file descriptor.
+ */
+int fiobj_rope_push_file(FIOBJ rope, int fd, uintptr_t offset,
+                         uintptr_t length) {
+  if (fd == -1)
+    return -1;
+  if (!FIOBJ_IS_ROPE(rope)) {
+    close(fd);
+    errno = EINVAL;
+    return -1;
+  }
+  if (!length) {
+    close(fd);
+    return 0;
+  }
+  fiobj_rope_edit(rope);
+  fiobj_rope_seg_s *s = fiobj_rope_seg_add(rope);
+  s->fd = fd;
+  s->offset = offset;
+  s->len = length;
+  obj2rope(rope)->len += length;
+  return 0;
+}
+
+/** Returns the Rope's length (in bytes). */
+uintptr_t fiobj_rope_len(FIOBJ rope) {
+  if (!FIOBJ_IS_ROPE(rope))
+    return 0;
+  return obj2rope(rope)->len;
+}
+
+/** Returns the number of segments in the Rope. */
+size_t fiobj_rope_count(FIOBJ rope) {
+  if (!FIOBJ_IS_ROPE(rope))
+    return 0;
+  return obj2rope(rope)->count;
+}
+
+static void fiobj_rope_seg_dealloc(void *o) { fiobj_free((FIOBJ)o); }
+
+/**
+ * Sends the Rope to the (facil.io) socket and frees the Rope.
+ */
+ssize_t fiobj_rope_send_free(intptr_t uuid, FIOBJ rope) {
+  if (!FIOBJ_IS_ROPE(rope)) {
+    fiobj_free(rope);
+    errno = EINVAL;
+    return -1;
+  }
+  fiobj_rope_s *r = obj2rope(rope);
+  ssize_t ret = 0;
+  for (size_t i = 0; ret != -1 && i < r->count; ++i) {
+    fiobj_rope_seg_s *s = r->seg + i;
+    if (s->obj) {
+      /* the packet holds a reference to the segment's String */
+      ret = fio_write2(uuid, .data.buffer = (void *)fiobj_dup(s->obj),
+                       .offset = (uintptr_t)s->data - (uintptr_t)s->obj,
+                       .length = s->len,
+                       .after.dealloc = fiobj_rope_seg_dealloc);
+    } else if (s->data) {
+      ret = fio_write2(uuid, .data.buffer = s->data, .length = s->len,
+                       .after.dealloc = FIO_DEALLOC_NOOP);
+    } else {
+      /* the packet closes its own copy of the file descriptor */
+      const int fd = dup(s->fd);
+      if (fd == -1) {
+        ret = -1;
+        break;
+      }
+      ret = fio_write2(uuid, .data.fd = fd, .offset = s->offset,
+                       .length = s->len, .is_fd = 1);
+    }
+  }
+  fiobj_free(rope);
+  return ret;
+}
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+
+#if DEBUG
+#include <fio_tmpfile.h>
+
+#define TEST_ASSERT(cond, ...)                                                 \
+  if (!(cond)) {                                                               \
+    fprintf(stderr, "* " __VA_ARGS__);                                         \
+    fprintf(stderr, "Testing failed.\n");                                      \
+    exit(-1);                                                                  \
+  }
+
+void fiobj_rope_test(void) {
+  fprintf(stderr, "=== Testing Rope\n");
+  FIOBJ rope = fiobj_rope_new();
+  FIOBJ expected = fiobj_str_buf(0);
+  char line[32];
+  /* small writes fill chunks */
+  for (size_t i = 0; i < 4096; ++i) {
+    size_t l = (size_t)snprintf(line, 32, "%zu,", i);
+    fiobj_rope_write(rope, line, l);
+    fiobj_str_write(expected, line, l);
+  }
+  TEST_ASSERT(fiobj_rope_count(rope) &&
+                  fiobj_rope_count(rope) <=
+                      fiobj_rope_len(rope) / FIOBJ_ROPE_CHUNK + 1,
+              "Rope chunk count error (%zu chunks)\n", fiobj_rope_count(rope));
+  /* shared Strings, static data and nested Ropes */
+  {
+    FIOBJ big = fiobj_str_buf(FIOBJ_ROPE_SHARE_MIN * 2);
+    for (size_t i = 0; i < FIOBJ_ROPE_SHARE_MIN * 2; ++i)
+      fiobj_str_write(big, "x", 1);
+    const size_t before = fiobj_rope_count(rope);
+    fiobj_str_join(expected, big);
+    fiobj_rope_push(rope, big);
+    TEST_ASSERT(fiobj_rope_count(rope) == before + 1,
+                "Rope should reference long Strings\n");
+    fiobj_rope_push(rope, fiobj_str_new("short", 5));
+    fiobj_str_write(expected, "short", 5);
+    fiobj_rope_push_static(rope, "static", 6);
+    fiobj_str_write(expected, "static", 6);
+    FIOBJ nested = fiobj_rope_new();
+    fiobj_rope_write(nested, "nested", 6);
+    fiobj_rope_push(rope, nested);
+    fiobj_str_write(expected, "nested", 6);
+  }
+  /* file segments */
+  {
+    int fd = fio_tmpfile();
+    TEST_ASSERT(fd != -1, "couldn't open a temporary file\n");
+    TEST_ASSERT(write(fd, "--file data--", 13) == 13,
+                "couldn't write to a temporary file\n");
+    fiobj_rope_push_file(rope, fd, 2, 9);
+    fiobj_str_write(expected, "file data", 9);
+  }
+  fiobj_rope_write(rope, "end", 3);
+  fiobj_str_write(expected, "end", 3);
+  TEST_ASSERT(fiobj_rope_len(rope) == fiobj_obj2cstr(expected).len,
+              "Rope length error (%zu != %zu)\n", (size_t)fiobj_rope_len(rope),
+              fiobj_obj2cstr(expected).len);
+  TEST_ASSERT(fiobj_iseq(rope, rope), "Rope should equal itself\n");
+  fio_str_info_s s1 = fiobj_obj2cstr(rope);
+  fio_str_info_s s2 = fiobj_obj2cstr(expected);
+  TEST_ASSERT(s1.len == s2.len && !memcmp(s1.data, s2.data, s1.len),
+              "Rope String value error\n");
+  /* edits invalidate the joined String */
+  fiobj_rope_write(rope, "!", 1);
+  fiobj_str_write(expected, "!", 1);
+  s1 = fiobj_obj2cstr(rope);
+  s2 = fiobj_obj2cstr(expected);
+  TEST_ASSERT(s1.len == s2.len && !memcmp(s1.data, s2.data, s1.len),
+              "Rope String value wasn't updated\n");
+  fiobj_free(expected);
+  fiobj_free(rope);
+  fprintf(stderr, "* passed.\n");
+}
+#endif
@@ -0,0 +1,107 @@
+#ifndef H_FIOBJ_ROPE_H
+/*
+Copyright: Boaz Segev, 2017-2019
+License: MIT
+*/
+#define H_FIOBJ_ROPE_H
+
+/**
+ * A Rope is a String made of a list of segments (Strings, static memory and
+ * file ranges) that can be sent to a socket without being copied into a
+ * single buffer.
+ *
+ * Small writes are copied to fixed size chunks that are never reallocated, so
+ * building a large output doesn't copy the data that was already written.
+ *
+ * Reading the Rope's String value (i.e., `fiobj_obj2cstr`) joins the segments
+ * into a single String (which is cached until the Rope is edited).
+ */
+#include <fiobject.h>
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef FIOBJ_ROPE_CHUNK
+/** The capacity of the chunks used by `fiobj_rope_write`. */
+#define FIOBJ_ROPE_CHUNK 16384
+#endif
+
+#define FIOBJ_IS_ROPE(obj) FIOBJ_TYPE_IS((obj), FIOBJ_T_ROPE)
+
+/* *****************************************************************************
+API: Creating a Rope Object
+***************************************************************************** */
+
+/** Creates a new (empty) Rope object. Remember to use `fiobj_free`. */
+FIOBJ fiobj_rope_new(void);
+
+/* *****************************************************************************
+API: Adding Segments
+***************************************************************************** */
+
+/**
+ * Copies `length` bytes to the end of the Rope.
+ *
+ * Returns the number of bytes written (0 on error).
+ */
+uintptr_t fiobj_rope_write(FIOBJ rope, const void *data, uintptr_t length);
+
+/**
+ * Adds the object's String value to the end of the Rope, taking ownership of
+ * the object (the object is freed once the Rope is done with it).
+ *
+ * Strings are referenced (not copied) unless they are short, so they MUST NOT
+ * be edited afterwards. Pushing a Rope adds its segments. Other objects are
+ * copied (see `fiobj_obj2cstr`).
+ */
+void fiobj_rope_push(FIOBJ rope, FIOBJ obj);
+
+/**
+ * Adds a reference to static (or external) memory to the end of the Rope.
+ *
+ * The memory MUST remain valid (and unchanged) until the Rope and any socket
+ * it was sent to are done with it.
+ */
+void fiobj_rope_push_static(FIOBJ rope, const void *data, uintptr_t length);
+
+/**
+ * Adds `length` bytes from the file, starting at `offset`, to the end of the
+ * Rope, taking ownership of the file descriptor (it's closed by the Rope).
+ *
+ * Returns -1 on error (the file descriptor is closed).
+ */
+int fiobj_rope_push_file(FIOBJ rope, int fd, uintptr_t offset,
+                         uintptr_t length);
+
+/* *****************************************************************************
+API: Rope Data
+***************************************************************************** */
+
+/** Returns the Rope's length (in bytes). */
+uintptr_t fiobj_rope_len(FIOBJ rope);
+
+/** Returns the number of segments in the Rope. */
+size_t fiobj_rope_count(FIOBJ rope);
+
+/**
+ * Sends the Rope to the (facil.io) socket and frees the Rope.
+ *
+ * Each segment becomes a separate packet that shares the segment's memory,
+ * so successive in-memory segments are sent using a single `writev` call.
+ *
+ * Returns -1 on error and 0 on success (see `fio_write2`).
+ */
+ssize_t fiobj_rope_send_free(intptr_t uuid, FIOBJ rope);
+
+#if DEBUG
+void fiobj_rope_test(void);
+#endif
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif
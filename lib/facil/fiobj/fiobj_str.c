@@ -49,6 +49,32 @@ typedef struct {
 
 #define obj2str(o) ((fiobj_str_s *)(FIOBJ2PTR(o)))
 
+/* a String referencing a read buffer's data (see `fiobj_str_new_rbuf`) */
+typedef struct {
+  fiobj_str_s s;
+  fio_rbuf_s *rbuf;
+} fiobj_str_view_s;
+
+/* marks String views (`fio_str_s` never calls it, views are unshared first) */
+static void fiobj_str_view_dealloc(void *data) { (void)data; }
+
+#define FIOBJ_STR_IS_VIEW(o)                                                   \
+  (obj2str(o)->str.dealloc == fiobj_str_view_dealloc)
+
+/* copies a view's data, so the String can be edited */
+static inline void fiobj_str_view_unshare(FIOBJ o) {
+  if (!FIOBJ_STR_IS_VIEW(o))
+    return;
+  fiobj_str_view_s *v = (fiobj_str_view_s *)FIOBJ2PTR(o);
+  fio_str_info_s i = fio_str_info(&v->s.str);
+  const uint8_t frozen = v->s.str.frozen;
+  v->s.str = FIO_STR_INIT;
+  fio_str_write(&v->s.str, i.data, i.len);
+  v->s.str.frozen = frozen;
+  fio_rbuf_free(v->rbuf);
+  v->rbuf = NULL;
+}
+
 static inline fio_str_info_s fiobj_str_get_cstr(const FIOBJ o) {
   return fio_str_info(&obj2str(o)->str);
 }
@@ -62,8 +88,11 @@ static fio_str_info_s fio_str2str(const FIOBJ o) {
 }
 
 static void fiobj_str_dealloc(FIOBJ o, void (*task)(FIOBJ, void *), void *arg) {
-  fio_str_free(&obj2str(o)->str);
-  fio_free(FIOBJ2PTR(o));
+  if (FIOBJ_STR_IS_VIEW(o))
+    fio_rbuf_free(((fiobj_str_view_s *)FIOBJ2PTR(o))->rbuf);
+  else
+    fio_str_free(&obj2str(o)->str);
+  fiobject___free(FIOBJ2PTR(o));
   (void)task;
   (void)arg;
 }
@@ -109,7 +138,7 @@ FIOBJ fiobj_str_buf(size_t capa) {
   else
     capa = PAGE_SIZE;
 
-  fiobj_str_s *s = fio_malloc(sizeof(*s));
+  fiobj_str_s *s = fiobject___alloc(sizeof(*s));
   if (!s) {
     perror("ERROR: fiobj string couldn't allocate memory");
     exit(errno);
@@ -119,6 +148,7 @@ FIOBJ fiobj_str_buf(size_t capa) {
           {
               .ref = 1,
               .type = FIOBJ_T_STRING,
+              .arena = FIOBJECT_ARENA_ACTIVE(),
           },
       .str = FIO_STR_INIT,
   };
@@ -130,7 +160,7 @@ FIOBJ fiobj_str_buf(size_t capa) {
 
 /** Creates a String object. Remember to use `fiobj_free`. */
 FIOBJ fiobj_str_new(const char *str, size_t len) {
-  fiobj_str_s *s = fio_malloc(sizeof(*s));
+  fiobj_str_s *s = fiobject___alloc(sizeof(*s));
   if (!s) {
     perror("ERROR: fiobj string couldn't allocate memory");
     exit(errno);
@@ -140,11 +170,20 @@ FIOBJ fiobj_str_new(const char *str, size_t len) {
           {
               .ref = 1,
               .type = FIOBJ_T_STRING,
+              .arena = FIOBJECT_ARENA_ACTIVE(),
           },
       .str = FIO_STR_INIT,
   };
   if (str && len) {
-    fio_str_write(&s->str, str, len);
+    if (s->head.arena && len >= FIO_STR_SMALL_CAPA) {
+      /* the data is released along with the arena */
+      char *data = fiobject___alloc(len + 1);
+      memcpy(data, str, len);
+      data[len] = 0;
+      s->str = (fio_str_s){.data = data, .len = len, .capa = len};
+    } else {
+      fio_str_write(&s->str, str, len);
+    }
   }
   return ((uintptr_t)s | FIOBJECT_STRING_FLAG);
 }
@@ -160,7 +199,7 @@ FIOBJ fiobj_str_new(const char *str, size_t len) {
  * zero.
  */
 FIOBJ fiobj_str_move(char *str, size_t len, size_t capacity) {
-  fiobj_str_s *s = fio_malloc(sizeof(*s));
+  fiobj_str_s *s = fiobject___alloc(sizeof(*s));
   if (!s) {
     perror("ERROR: fiobj string couldn't allocate memory");
     exit(errno);
@@ -170,12 +209,47 @@ FIOBJ fiobj_str_move(char *str, size_t len, size_t capacity) {
           {
               .ref = 1,
               .type = FIOBJ_T_STRING,
+              .arena = FIOBJECT_ARENA_ACTIVE(),
           },
       .str = FIO_STR_INIT_EXISTING(str, len, capacity),
   };
   return ((uintptr_t)s | FIOBJECT_STRING_FLAG);
 }
 
+/**
+ * Creates a String object that references `len` bytes of a read buffer, rather
+ * than copying them. Remember to use `fiobj_free`.
+ */
+FIOBJ fiobj_str_new_rbuf(fio_rbuf_s *rbuf, const char *str, size_t len) {
+  if (!rbuf || len < FIO_STR_SMALL_CAPA || str[len])
+    return fiobj_str_new(str, len);
+  fiobj_str_view_s *v = fiobject___alloc(sizeof(*v));
+  if (!v) {
+    perror("ERROR: fiobj string couldn't allocate memory");
+    exit(errno);
+  }
+  *v = (fiobj_str_view_s){
+      .s =
+          {
+              .head =
+                  {
+                      .ref = 1,
+                      .type = FIOBJ_T_STRING,
+                      .arena = FIOBJECT_ARENA_ACTIVE(),
+                  },
+              .str =
+                  {
+                      .data = (char *)str,
+                      .len = len,
+                      .capa = len,
+                      .dealloc = fiobj_str_view_dealloc,
+                  },
+          },
+      .rbuf = fio_rbuf_dup(rbuf),
+  };
+  return ((uintptr_t)v | FIOBJECT_STRING_FLAG);
+}
+
 /**
  * Returns a thread-static temporary string. Avoid calling `fiobj_dup` or
  * `fiobj_free`.
@@ -194,6 +268,15 @@ FIOBJ fiobj_str_tmp(void) {
   return ((uintptr_t)&tmp | FIOBJECT_STRING_FLAG);
 }
 
+/**
+ * Copies the data of a String that references a read buffer (see
+ * `fiobj_str_new_rbuf`), releasing the buffer. Other Strings are left as is.
+ */
+void fiobj_str_unshare(FIOBJ str) {
+  if (FIOBJ_TYPE_IS(str, FIOBJ_T_STRING))
+    fiobj_str_view_unshare(str);
+}
+
 /** Prevents the String object from being changed. */
 void fiobj_str_freeze(FIOBJ str) {
   if (FIOBJ_TYPE_IS(str, FIOBJ_T_STRING))
@@ -206,6 +289,7 @@ size_t fiobj_str_capa_assert(FIOBJ str, size_t size) {
   assert(FIOBJ_TYPE_IS(str, FIOBJ_T_STRING));
   if (obj2str(str)->str.frozen)
     return 0;
+  fiobj_str_view_unshare(str);
   fio_str_info_s state = fio_str_capa_assert(&obj2str(str)->str, size);
   return state.capa;
 }
@@ -219,6 +303,7 @@ size_t fiobj_str_capa(FIOBJ str) {
 /** Resizes a String object, allocating more memory if required. */
 void fiobj_str_resize(FIOBJ str, size_t size) {
   assert(FIOBJ_TYPE_IS(str, FIOBJ_T_STRING));
+  fiobj_str_view_unshare(str);
   fio_str_resize(&obj2str(str)->str, size);
   obj2str(str)->hash = 0;
   return;
@@ -227,6 +312,8 @@ void fiobj_str_resize(FIOBJ str, size_t size) {
 /** Deallocates any unnecessary memory (if supported by OS). */
 void fiobj_str_compact(FIOBJ str) {
   assert(FIOBJ_TYPE_IS(str, FIOBJ_T_STRING));
+  if (obj2str(str)->str.dealloc != FIO_FREE)
+    return; /* views, arena and static data have no spare capacity */
   fio_str_compact(&obj2str(str)->str);
   return;
 }
@@ -234,6 +321,7 @@ void fiobj_str_compact(FIOBJ str) {
 /** Empties a String's data. */
 void fiobj_str_clear(FIOBJ str) {
   assert(FIOBJ_TYPE_IS(str, FIOBJ_T_STRING));
+  fiobj_str_view_unshare(str);
   fio_str_resize(&obj2str(str)->str, 0);
   obj2str(str)->hash = 0;
 }
@@ -246,6 +334,7 @@ size_t fiobj_str_write(FIOBJ dest, const char *data, size_t len) {
   assert(FIOBJ_TYPE_IS(dest, FIOBJ_T_STRING));
   if (obj2str(dest)->str.frozen)
     return 0;
+  fiobj_str_view_unshare(dest);
   obj2str(dest)->hash = 0;
   return fio_str_write(&obj2str(dest)->str, data, len).len;
 }
@@ -259,6 +348,7 @@ size_t fiobj_str_write_i(FIOBJ dest, int64_t num) {
   assert(FIOBJ_TYPE_IS(dest, FIOBJ_T_STRING));
   if (obj2str(dest)->str.frozen)
     return 0;
+  fiobj_str_view_unshare(dest);
   obj2str(dest)->hash = 0;
   return fio_str_write_i(&obj2str(dest)->str, num).len;
 }
@@ -271,6 +361,7 @@ size_t fiobj_str_printf(FIOBJ dest, const char *format, ...) {
   assert(FIOBJ_TYPE_IS(dest, FIOBJ_T_STRING));
   if (obj2str(dest)->str.frozen)
     return 0;
+  fiobj_str_view_unshare(dest);
   obj2str(dest)->hash = 0;
   va_list argv;
   va_start(argv, format);
@@ -283,6 +374,7 @@ size_t fiobj_str_vprintf(FIOBJ dest, const char *format, va_list argv) {
   assert(FIOBJ_TYPE_IS(dest, FIOBJ_T_STRING));
   if (obj2str(dest)->str.frozen)
     return 0;
+  fiobj_str_view_unshare(dest);
   obj2str(dest)->hash = 0;
   fio_str_info_s state = fio_str_vprintf(&obj2str(dest)->str, format, argv);
   return state.len;
@@ -298,6 +390,7 @@ size_t fiobj_str_vprintf(FIOBJ dest, const char *format, va_list argv) {
  */
 size_t fiobj_str_readfile(FIOBJ dest, const char *filename, intptr_t start_at,
                           intptr_t limit) {
+  fiobj_str_view_unshare(dest);
   fio_str_info_s state =
       fio_str_readfile(&obj2str(dest)->str, filename, start_at, limit);
   return state.len;
@@ -311,6 +404,7 @@ size_t fiobj_str_concat(FIOBJ dest, FIOBJ obj) {
   assert(FIOBJ_TYPE_IS(dest, FIOBJ_T_STRING));
   if (obj2str(dest)->str.frozen)
     return 0;
+  fiobj_str_view_unshare(dest);
   obj2str(dest)->hash = 0;
   fio_str_info_s o = fiobj_obj2cstr(obj);
   if (o.len == 0)
@@ -415,6 +509,60 @@ void fiobj_test_string(void) {
               fiobj_obj2cstr(o).data);
   fiobj_free(o);
 
+  {
+    /* Strings referencing a read buffer */
+    static const char text[] =
+        "GET /a/rather/long/path/that/won't/fit/in/the/String/object?q=1";
+    fio_rbuf_s *rbuf = fio_rbuf_new(0);
+    memcpy(rbuf->data, text, sizeof(text));
+    rbuf->len = sizeof(text);
+    o = fiobj_str_new_rbuf(rbuf, rbuf->data, 4);
+    TEST_ASSERT(!FIOBJ_STR_IS_VIEW(o) && !fio_rbuf_is_shared(rbuf),
+                "short Strings should be copied, not referenced\n");
+    fiobj_free(o);
+    o = fiobj_str_new_rbuf(rbuf, rbuf->data, sizeof(text) - 3);
+    TEST_ASSERT(!FIOBJ_STR_IS_VIEW(o) && !fio_rbuf_is_shared(rbuf),
+                "data that isn't NUL terminated should be copied\n");
+    fiobj_free(o);
+    o = fiobj_str_new_rbuf(rbuf, rbuf->data, sizeof(text) - 1);
+    TEST_ASSERT(FIOBJ_STR_IS_VIEW(o) && fio_rbuf_is_shared(rbuf) &&
+                    fiobj_obj2cstr(o).data == rbuf->data,
+                "long Strings should reference the buffer\n");
+    TEST_ASSERT(!memcmp(fiobj_obj2cstr(o).data, text, sizeof(text)),
+                "String view data error\n");
+    TEST_ASSERT(fiobj_str_hash(o) == fiobj_hash_string(text, sizeof(text) - 1),
+                "String view hash error\n");
+    fiobj_str_write(o, "&r=2", 4);
+    TEST_ASSERT(!FIOBJ_STR_IS_VIEW(o) && !fio_rbuf_is_shared(rbuf) &&
+                    fiobj_obj2cstr(o).data != rbuf->data,
+                "editing a String view should copy the data\n");
+    TEST_ASSERT(fiobj_obj2cstr(o).len == sizeof(text) + 3 &&
+                    !memcmp(fiobj_obj2cstr(o).data + sizeof(text) - 1, "&r=2",
+                            5),
+                "String view write error\n");
+    TEST_ASSERT(!memcmp(rbuf->data, text, sizeof(text)),
+                "editing a String view shouldn't change the buffer\n");
+    fiobj_free(o);
+    o = fiobj_str_new_rbuf(rbuf, rbuf->data, sizeof(text) - 1);
+    fiobj_str_resize(o, 3);
+    TEST_ASSERT(fiobj_obj2cstr(o).len == 3 &&
+                    !memcmp(fiobj_obj2cstr(o).data, "GET", 4) &&
+                    !fio_rbuf_is_shared(rbuf) && rbuf->data[3] == ' ',
+                "resizing a String view should copy the data\n");
+    fiobj_free(o);
+    o = fiobj_str_new_rbuf(rbuf, rbuf->data, sizeof(text) - 1);
+    fiobj_free(o);
+    TEST_ASSERT(!fio_rbuf_is_shared(rbuf),
+                "freeing a String view should release the buffer\n");
+    o = fiobj_str_new_rbuf(rbuf, rbuf->data, sizeof(text) - 1);
+    fiobj_str_unshare(o);
+    TEST_ASSERT(!FIOBJ_STR_IS_VIEW(o) && !fio_rbuf_is_shared(rbuf) &&
+                    !memcmp(fiobj_obj2cstr(o).data, text, sizeof(text)),
+                "`fiobj_str_unshare` should copy the data\n");
+    fiobj_free(o);
+    fio_rbuf_free(rbuf);
+  }
+
   fprintf(stderr, "* passed.\n");
 }
 #endif
@@ -50,6 +50,32 @@ static inline __attribute__((unused)) FIOBJ fiobj_str_copy(FIOBJ src) {
  */
 FIOBJ fiobj_str_move(char *str, size_t len, size_t capacity);
 
+/**
+ * Creates a String object that references `len` bytes of a read buffer (see
+ * `fio_rbuf_new`), rather than copying them. Remember to use `fiobj_free`.
+ *
+ * The String holds a reference to the buffer (see `fio_rbuf_dup`) until the
+ * String is freed or edited. Editing the String copies the data first, so the
+ * buffer itself is never changed.
+ *
+ * While the String is alive, the WHOLE buffer is kept in memory (it isn't
+ * returned to the pool). Use `fiobj_str_unshare` before keeping such a String
+ * for a long while.
+ *
+ * Short Strings (that fit in the object) and data that isn't NUL terminated
+ * (`str[len] != 0`) are copied, so `str[len]` MUST be readable.
+ */
+FIOBJ fiobj_str_new_rbuf(fio_rbuf_s *rbuf, const char *str, size_t len);
+
+/**
+ * Copies the data of a String that references a read buffer (see
+ * `fiobj_str_new_rbuf`), releasing the buffer. Other Strings are left as is.
+ *
+ * Use this before keeping a String that might reference a read buffer (i.e.,
+ * an HTTP/1.x header value) for a long while.
+ */
+void fiobj_str_unshare(FIOBJ str);
+
 /**
  * Returns a thread-static temporary string. Avoid calling `fiobj_dup` or
  * `fiobj_free`.
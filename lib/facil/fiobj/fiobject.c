@@ -492,7 +492,7 @@ void fiobject___noop_dealloc(FIOBJ o, void (*task)(FIOBJ, void *), void *arg) {
 }
 void fiobject___simple_dealloc(FIOBJ o, void (*task)(FIOBJ, void *),
                                void *arg) {
-  fio_free(FIOBJ2PTR(o));
+  fiobject___free(FIOBJ2PTR(o));
   (void)task;
   (void)arg;
 }
@@ -520,10 +520,177 @@ double fiobject___noop_to_f(const FIOBJ o) {
   return 0;
 }
 
-#if DEBUG
+/* *****************************************************************************
+Allocation Arenas
+***************************************************************************** */
 
 #include <fiobj_ary.h>
 #include <fiobj_numbers.h>
+#include <fiobj_str.h>
+
+typedef struct fiobj_arena_chunk_s {
+  struct fiobj_arena_chunk_s *next;
+  size_t pos;
+  size_t capa;
+  /* keeps the data 16 byte aligned */
+  size_t padding___;
+} fiobj_arena_chunk_s;
+
+struct fiobj_arena_s {
+  /* the chunk objects are allocated from (first) and the filled chunks */
+  fiobj_arena_chunk_s *chunks;
+  /* chunks allocated for objects larger than half a chunk */
+  fiobj_arena_chunk_s *big;
+};
+
+static __thread fiobj_arena_s *fiobj___arena_active;
+
+static inline fiobj_arena_chunk_s *fiobj_arena_chunk_new(size_t capa) {
+  fiobj_arena_chunk_s *c = fio_malloc(sizeof(*c) + capa);
+  FIO_ASSERT_ALLOC(c);
+  *c = (fiobj_arena_chunk_s){.capa = capa};
+  return c;
+}
+
+static inline void fiobj_arena_chunks_free(fiobj_arena_chunk_s *c) {
+  while (c) {
+    fiobj_arena_chunk_s *tmp = c;
+    c = c->next;
+    fio_free(tmp);
+  }
+}
+
+static void *fiobj_arena_alloc(fiobj_arena_s *a, size_t size) {
+  size = (size + 15) & (~(size_t)15);
+  fiobj_arena_chunk_s *c = a->chunks;
+  if (!c || c->pos + size > c->capa) {
+    if (size > (FIOBJ_ARENA_CHUNK_SIZE >> 1)) {
+      c = fiobj_arena_chunk_new(size);
+      c->next = a->big;
+      a->big = c;
+      c->pos = size;
+      return (void *)(c + 1);
+    }
+    c = fiobj_arena_chunk_new(FIOBJ_ARENA_CHUNK_SIZE);
+    c->next = a->chunks;
+    a->chunks = c;
+  }
+  void *ret = (void *)((uintptr_t)(c + 1) + c->pos);
+  c->pos += size;
+  return ret;
+}
+
+/** Creates a new (empty) arena. Remember to use `fiobj_arena_free`. */
+fiobj_arena_s *fiobj_arena_new(void) {
+  fiobj_arena_s *a = fio_malloc(sizeof(*a));
+  FIO_ASSERT_ALLOC(a);
+  *a = (fiobj_arena_s){.chunks = NULL};
+  return a;
+}
+
+/** Releases all the arena's memory, invalidating the objects allocated. */
+void fiobj_arena_reset(fiobj_arena_s *a) {
+  if (!a)
+    return;
+  fiobj_arena_chunks_free(a->big);
+  a->big = NULL;
+  if (!a->chunks)
+    return;
+  /* keep the latest chunk, so the next cycle doesn't allocate memory */
+  fiobj_arena_chunks_free(a->chunks->next);
+  a->chunks->next = NULL;
+  a->chunks->pos = 0;
+}
+
+/** Frees the arena (see `fiobj_arena_reset`). */
+void fiobj_arena_free(fiobj_arena_s *a) {
+  if (!a)
+    return;
+  if (fiobj___arena_active == a)
+    fiobj___arena_active = NULL;
+  fiobj_arena_chunks_free(a->big);
+  fiobj_arena_chunks_free(a->chunks);
+  fio_free(a);
+}
+
+/** Sets the calling thread's active arena, returning the previous one. */
+fiobj_arena_s *fiobj_arena_enter(fiobj_arena_s *arena) {
+  fiobj_arena_s *old = fiobj___arena_active;
+  fiobj___arena_active = arena;
+  return old;
+}
+
+/** Returns the calling thread's active arena (or NULL). */
+fiobj_arena_s *fiobj_arena_active(void) { return fiobj___arena_active; }
+
+/** used internally to allocate objects (from the active arena, if any). */
+void *fiobject___alloc(size_t size) {
+  if (fiobj___arena_active)
+    return fiobj_arena_alloc(fiobj___arena_active, size);
+  return fio_malloc(size);
+}
+
+static FIOBJ fiobj_arena_copy___internal(FIOBJ o);
+
+static int fiobj_arena_copy___ary_task(FIOBJ o, void *dest) {
+  fiobj_ary_push((FIOBJ)dest, fiobj_arena_copy___internal(o));
+  return 0;
+}
+
+static int fiobj_arena_copy___hash_task(FIOBJ o, void *dest) {
+  /* copy the key first, nested Hashes replace the key in the loop */
+  FIOBJ key = fiobj_arena_copy___internal(fiobj_hash_key_in_loop());
+  fiobj_hash_set((FIOBJ)dest, key, fiobj_arena_copy___internal(o));
+  fiobj_free(key);
+  return 0;
+}
+
+static FIOBJ fiobj_arena_copy___internal(FIOBJ o) {
+  FIOBJ ret;
+  if (!FIOBJ_IS_ALLOCATED(o))
+    return o;
+  switch (FIOBJ_TYPE(o)) {
+  case FIOBJ_T_ARRAY:
+    ret = fiobj_ary_new2(fiobj_ary_count(o));
+    fiobj_each1(o, 0, fiobj_arena_copy___ary_task, (void *)ret);
+    return ret;
+  case FIOBJ_T_HASH:
+    ret = fiobj_hash_new2(fiobj_hash_count(o));
+    fiobj_each1(o, 0, fiobj_arena_copy___hash_task, (void *)ret);
+    return ret;
+  case FIOBJ_T_STRING:
+    if (FIOBJECT2HEAD(o)->arena) {
+      fio_str_info_s s = fiobj_obj2cstr(o);
+      return fiobj_str_new(s.data, s.len);
+    }
+    break;
+  case FIOBJ_T_NUMBER:
+    if (FIOBJECT2HEAD(o)->arena)
+      return fiobj_num_new(fiobj_obj2num(o));
+    break;
+  case FIOBJ_T_FLOAT:
+    if (FIOBJECT2HEAD(o)->arena)
+      return fiobj_float_new(fiobj_obj2float(o));
+    break;
+  default:
+    break;
+  }
+  return fiobj_dup(o);
+}
+
+/** Returns a deep copy of the object that doesn't use any arena memory. */
+FIOBJ fiobj_arena_copy(FIOBJ o) {
+  fiobj_arena_s *old = fiobj_arena_enter(NULL);
+  FIOBJ ret = fiobj_arena_copy___internal(o);
+  fiobj_arena_enter(old);
+  return ret;
+}
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+
+#if DEBUG
 
 static int fiobject_test_task(FIOBJ o, void *arg) {
   ++((uintptr_t *)arg)[0];
@@ -614,6 +781,52 @@ void fiobj_test_core(void) {
   TEST_ASSERT(!fiobj_iseq(fiobj_null(), fiobj_true()),
               "fiobj_null eqal to fiobj_true!");
   fprintf(stderr, "* passed.\n");
+  fprintf(stderr, "=== Testing arenas\n");
+  {
+    fiobj_arena_s *arena = fiobj_arena_new();
+    TEST_ASSERT(!fiobj_arena_enter(arena), "an arena was already active!");
+    TEST_ASSERT(fiobj_arena_active() == arena, "arena isn't active!");
+    char long_str[FIOBJ_ARENA_CHUNK_SIZE];
+    memset(long_str, 'x', sizeof(long_str));
+    for (int round = 0; round < 2; ++round) {
+      o = fiobj_hash_new();
+      for (size_t i = 0; i < 128; ++i) {
+        key = fiobj_str_new(long_str, i);
+        tmp = fiobj_ary_new();
+        fiobj_ary_push(tmp, fiobj_str_new(long_str, sizeof(long_str) - i));
+        fiobj_ary_push(tmp, fiobj_float_new(1.5));
+        fiobj_ary_push(tmp, fiobj_num_new(INTPTR_MAX));
+        fiobj_hash_set(o, key, tmp);
+        fiobj_free(key);
+      }
+      TEST_ASSERT(FIOBJECT2HEAD(o)->arena, "Hash wasn't allocated in arena!");
+      fiobj_arena_enter(NULL);
+      o2 = fiobj_arena_copy(o);
+      TEST_ASSERT(!FIOBJECT2HEAD(o2)->arena, "copy allocated in arena!");
+      TEST_ASSERT(fiobj_hash_count(o2) == 128, "copy is missing items!");
+      key = fiobj_str_new(long_str, 40);
+      tmp = fiobj_hash_get(o2, key);
+      fiobj_free(key);
+      TEST_ASSERT(FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY) &&
+                      !FIOBJECT2HEAD(tmp)->arena &&
+                      !FIOBJECT2HEAD(fiobj_ary_index(tmp, 0))->arena &&
+                      fiobj_obj2cstr(fiobj_ary_index(tmp, 0)).len ==
+                          sizeof(long_str) - 40,
+                  "copied Array error!");
+      TEST_ASSERT(fiobj_obj2float(fiobj_ary_index(tmp, 1)) == 1.5 &&
+                      fiobj_obj2num(fiobj_ary_index(tmp, 2)) == INTPTR_MAX,
+                  "copied numbers error!");
+      fiobj_free(o);
+      fiobj_arena_enter(arena);
+      /* objects are released along with the arena */
+      fiobj_str_new(long_str, 64);
+      fiobj_arena_reset(arena);
+      fiobj_free(o2);
+    }
+    fiobj_arena_enter(NULL);
+    fiobj_arena_free(arena);
+  }
+  fprintf(stderr, "* passed.\n");
 }
 
 #endif
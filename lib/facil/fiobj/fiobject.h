@@ -57,6 +57,7 @@ typedef enum __attribute__((packed)) {
   FIOBJ_T_ARRAY,
   FIOBJ_T_HASH,
   FIOBJ_T_DATA,
+  FIOBJ_T_ROPE,
   FIOBJ_T_UNKNOWN
 } fiobj_type_enum;
 
@@ -220,6 +221,66 @@ size_t fiobj_each2(FIOBJ, int (*task)(FIOBJ obj, void *arg), void *arg);
  */
 FIO_INLINE int fiobj_iseq(const FIOBJ obj1, const FIOBJ obj2);
 
+/* *****************************************************************************
+Allocation Arenas
+***************************************************************************** */
+
+#ifndef FIOBJ_ARENA_CHUNK_SIZE
+/**
+ * The size of the memory chunks arenas allocate (larger objects get a chunk of
+ * their own).
+ */
+#define FIOBJ_ARENA_CHUNK_SIZE 4096
+#endif
+
+/**
+ * An arena allows short lived objects to be allocated from a few memory chunks
+ * and released all at once, instead of one by one.
+ *
+ * While an arena is active (see `fiobj_arena_enter`), the String, Number
+ * (big), Float, Array and Hash constructors allocate the object (and short
+ * String data) from the arena. `fiobj_free` still releases any resources the
+ * object holds (i.e., nested objects or memory allocated when a String grows),
+ * but the object's memory is only released by `fiobj_arena_reset` (or
+ * `fiobj_arena_free`).
+ *
+ * An arena must only be used by a single thread at a time.
+ *
+ * Objects MUST NOT be used after their arena was reset. Use `fiobj_arena_copy`
+ * to copy objects that must outlive the arena.
+ */
+typedef struct fiobj_arena_s fiobj_arena_s;
+
+/** Creates a new (empty) arena. Remember to use `fiobj_arena_free`. */
+fiobj_arena_s *fiobj_arena_new(void);
+
+/** Releases all the arena's memory, invalidating the objects allocated. */
+void fiobj_arena_reset(fiobj_arena_s *arena);
+
+/** Frees the arena (see `fiobj_arena_reset`). */
+void fiobj_arena_free(fiobj_arena_s *arena);
+
+/**
+ * Sets the calling thread's active arena, returning the previous one.
+ *
+ * Pass NULL to stop allocating objects from an arena.
+ */
+fiobj_arena_s *fiobj_arena_enter(fiobj_arena_s *arena);
+
+/** Returns the calling thread's active arena (or NULL). */
+fiobj_arena_s *fiobj_arena_active(void);
+
+/**
+ * Returns a deep copy of the object that doesn't use any arena memory.
+ *
+ * Objects that weren't allocated from an arena are copied by reference (see
+ * `fiobj_dup`), except for Arrays and Hashes, which are always copied so their
+ * nested objects can be tested.
+ *
+ * Remember to use `fiobj_free`.
+ */
+FIOBJ fiobj_arena_copy(FIOBJ o);
+
 /* *****************************************************************************
 Object Type Identification
 ***************************************************************************** */
@@ -291,6 +352,7 @@ FIO_INLINE size_t fiobj_type_is(FIOBJ o, fiobj_type_enum type) {
   case FIOBJ_T_FLOAT:
   case FIOBJ_T_ARRAY:
   case FIOBJ_T_DATA:
+  case FIOBJ_T_ROPE:
   case FIOBJ_T_UNKNOWN:
     return FIOBJ_IS_ALLOCATED(o) &&
            ((fiobj_type_enum *)FIOBJ2PTR(o))[0] == type;
@@ -327,6 +389,8 @@ typedef struct {
 typedef struct {
   /* must be first */
   fiobj_type_enum type;
+  /* set when the object was allocated from an arena */
+  uint8_t arena;
   /* reference counter */
   uint32_t ref;
 } fiobj_object_header_s;
@@ -337,10 +401,24 @@ extern const fiobj_object_vtable_s FIOBJECT_VTABLE_STRING;
 extern const fiobj_object_vtable_s FIOBJECT_VTABLE_ARRAY;
 extern const fiobj_object_vtable_s FIOBJECT_VTABLE_HASH;
 extern const fiobj_object_vtable_s FIOBJECT_VTABLE_DATA;
+extern const fiobj_object_vtable_s FIOBJECT_VTABLE_ROPE;
 
 #define FIOBJECT2VTBL(o) fiobj_type_vtable(o)
 #define FIOBJECT2HEAD(o) (((fiobj_object_header_s *)FIOBJ2PTR((o))))
 
+/** used internally to allocate objects (from the active arena, if any). */
+void *fiobject___alloc(size_t size);
+
+/** used internally to test if new objects are allocated from an arena. */
+#define FIOBJECT_ARENA_ACTIVE() (fiobj_arena_active() != NULL)
+
+/** used internally to free objects (arena memory is left untouched). */
+FIO_INLINE void fiobject___free(void *obj) {
+  if (((fiobj_object_header_s *)obj)->arena)
+    return;
+  fio_free(obj);
+}
+
 FIO_INLINE const fiobj_object_vtable_s *fiobj_type_vtable(FIOBJ o) {
   switch (FIOBJ_TYPE(o)) {
   case FIOBJ_T_NUMBER:
@@ -355,6 +433,8 @@ FIO_INLINE const fiobj_object_vtable_s *fiobj_type_vtable(FIOBJ o) {
     return &FIOBJECT_VTABLE_HASH;
   case FIOBJ_T_DATA:
     return &FIOBJECT_VTABLE_DATA;
+  case FIOBJ_T_ROPE:
+    return &FIOBJECT_VTABLE_ROPE;
   case FIOBJ_T_NULL:
   case FIOBJ_T_TRUE:
   case FIOBJ_T_FALSE:
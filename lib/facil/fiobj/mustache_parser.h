@@ -117,10 +117,29 @@ MUSTACHE_FUNC mustache_s *mustache_load(mustache_load_args_s args);
 
 #define mustache_load(...) mustache_load((mustache_load_args_s){__VA_ARGS__})
 
-/** free the mustache template */
-inline MUSTACHE_FUNC void mustache_free(mustache_s *mustache) {
-  free(mustache);
-}
+/** free the mustache template (or drop a reference, see `mustache_dup`) */
+inline MUSTACHE_FUNC void mustache_free(mustache_s *mustache);
+
+/** Adds a reference to the template, so it can be shared (i.e., cached). */
+inline MUSTACHE_FUNC mustache_s *mustache_dup(mustache_s *mustache);
+
+/**
+ * Returns the length of the template's static text (partials used more than
+ * once are counted once), a lower bound for most rendered outputs.
+ */
+inline MUSTACHE_FUNC size_t mustache_text_length(mustache_s *mustache);
+
+/**
+ * Calls `task` for the name of every template file (the root template and any
+ * partials), stopping if `task` returns a non-zero value.
+ *
+ * Returns the last value returned by `task` (or 0).
+ */
+MUSTACHE_FUNC int mustache_each_file(mustache_s *mustache,
+                                     int (*task)(const char *filename,
+                                                 size_t filename_len,
+                                                 void *arg),
+                                     void *arg);
 
 /** Arguments for the `mustache_build` function. */
 typedef struct {
@@ -314,6 +333,12 @@ struct mustache_s {
       uint32_t data_length;
     } read_only;
   } u;
+  /* The length of the template's static text (computed while loading) */
+  uint32_t text_length;
+  /* The length of the most recent output, for the rendering layer's use */
+  uint32_t size_hint;
+  /* References in addition to the first (see `mustache_dup`) */
+  volatile uint32_t ref;
 };
 
 typedef struct mustache__instruction_s {
@@ -653,17 +678,17 @@ typedef struct {
 static inline size_t
 mustache__data_segment_write(uint8_t *dest, mustache__data_segment_s data) {
   dest[0] = 0xFF & data.inst_start;
-  dest[1] = 0xFF & (data.inst_start >> 1);
-  dest[2] = 0xFF & (data.inst_start >> 2);
-  dest[3] = 0xFF & (data.inst_start >> 3);
+  dest[1] = 0xFF & (data.inst_start >> 8);
+  dest[2] = 0xFF & (data.inst_start >> 16);
+  dest[3] = 0xFF & (data.inst_start >> 24);
   dest[4] = 0xFF & data.next;
-  dest[5] = 0xFF & (data.next >> 1);
-  dest[6] = 0xFF & (data.next >> 2);
-  dest[7] = 0xFF & (data.next >> 3);
+  dest[5] = 0xFF & (data.next >> 8);
+  dest[6] = 0xFF & (data.next >> 16);
+  dest[7] = 0xFF & (data.next >> 24);
   dest[8] = 0xFF & data.filename_len;
-  dest[9] = 0xFF & (data.filename_len >> 1);
+  dest[9] = 0xFF & (data.filename_len >> 8);
   dest[10] = 0xFF & data.path_len;
-  dest[11] = 0xFF & (data.path_len >> 1);
+  dest[11] = 0xFF & (data.path_len >> 8);
   if (data.filename_len)
     memcpy(dest + 12, data.filename, data.filename_len);
   (dest + 12)[data.filename_len] = 0;
@@ -679,12 +704,12 @@ static inline mustache__data_segment_s
 mustache__data_segment_read(uint8_t *data) {
   mustache__data_segment_s s = {
       .filename = (char *)(data + 12),
-      .inst_start = ((uint32_t)data[0] | ((uint32_t)data[1] << 1) |
-                     ((uint32_t)data[2] << 2) | ((uint32_t)data[3] << 3)),
-      .next = ((uint32_t)data[4] | ((uint32_t)data[5] << 1) |
-               ((uint32_t)data[6] << 2) | ((uint32_t)data[7] << 3)),
-      .filename_len = ((uint16_t)data[8] | ((uint16_t)data[9] << 1)),
-      .path_len = ((uint16_t)data[10] | ((uint16_t)data[11] << 1)),
+      .inst_start = ((uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+                     ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24)),
+      .next = ((uint32_t)data[4] | ((uint32_t)data[5] << 8) |
+               ((uint32_t)data[6] << 16) | ((uint32_t)data[7] << 24)),
+      .filename_len = (uint16_t)((uint16_t)data[8] | ((uint16_t)data[9] << 8)),
+      .path_len = (uint16_t)((uint16_t)data[10] | ((uint16_t)data[11] << 8)),
   };
   return s;
 }
@@ -787,7 +812,7 @@ static inline uint32_t mustache__file_is_loaded(mustache__loader_stack_s *s,
     mustache__data_segment_s seg = mustache__data_segment_read((uint8_t *)data);
     if (seg.filename_len == name_len && !memcmp(seg.filename, name, name_len))
       return seg.inst_start;
-    data += seg.next;
+    data = s->data + seg.next; /* `next` is an absolute position */
   }
   return (uint32_t)-1;
 }
@@ -991,6 +1016,49 @@ unknown_error:
   return -1;
 }
 
+/* *****************************************************************************
+Template Lifetime and Information
+***************************************************************************** */
+
+/** free the mustache template (or drop a reference, see `mustache_dup`) */
+inline MUSTACHE_FUNC void mustache_free(mustache_s *mustache) {
+  if (!mustache || __atomic_fetch_sub(&mustache->ref, 1, __ATOMIC_ACQ_REL))
+    return;
+  free(mustache);
+}
+
+/** Adds a reference to the template, so it can be shared (i.e., cached). */
+inline MUSTACHE_FUNC mustache_s *mustache_dup(mustache_s *mustache) {
+  if (mustache)
+    __atomic_add_fetch(&mustache->ref, 1, __ATOMIC_RELAXED);
+  return mustache;
+}
+
+/** Returns the length of the template's static text. */
+inline MUSTACHE_FUNC size_t mustache_text_length(mustache_s *mustache) {
+  return mustache ? mustache->text_length : 0;
+}
+
+/** Calls `task` for the name of every template file. */
+MUSTACHE_FUNC int mustache_each_file(mustache_s *mustache,
+                                     int (*task)(const char *filename,
+                                                 size_t filename_len,
+                                                 void *arg),
+                                     void *arg) {
+  int ret = 0;
+  if (!mustache || !task)
+    return ret;
+  char *const data = MUSTACH2DATA(mustache);
+  uint32_t pos = 0;
+  while (!ret && pos < mustache->u.read_only.data_length) {
+    mustache__data_segment_s seg =
+        mustache__data_segment_read((uint8_t *)data + pos);
+    ret = task(seg.filename, seg.filename_len, arg);
+    pos = seg.next;
+  }
+  return ret;
+}
+
 /* *****************************************************************************
 Calling the instrustion list (using the template engine)
 ***************************************************************************** */
@@ -1177,6 +1245,9 @@ MUSTACHE_FUNC mustache_s *(mustache_load)(mustache_load_args_s args) {
   s.m->u.read_only_pt = 0;
   s.m->u.read_only.data_length = 0;
   s.m->u.read_only.intruction_count = 0;
+  s.m->text_length = 0;
+  s.m->size_hint = 0;
+  s.m->ref = 0;
   s.i = MUSTACH2INSTRUCTIONS(s.m);
   s.err = args.err;
 
@@ -1517,6 +1588,12 @@ MUSTACHE_FUNC mustache_s *(mustache_load)(mustache_load_args_s args) {
   memcpy(MUSTACH2DATA(s.m), s.data, s.data_len);
   free(s.data);
   free(s.path);
+  /* sum the static text, so the output can be sized ahead of time */
+  s.i = MUSTACH2INSTRUCTIONS(s.m);
+  for (uint32_t i = 0; i < s.m->u.read_only.intruction_count; ++i) {
+    if (s.i[i].instruction == MUSTACHE_WRITE_TEXT)
+      s.m->text_length += s.i[i].data.name_len;
+  }
 
   *args.err = MUSTACHE_OK;
   return s.m;
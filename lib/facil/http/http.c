@@ -8,6 +8,7 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <fio.h>
 
 #include <http1.h>
+#include <http2.h>
 #include <http_internal.h>
 
 #include <ctype.h>
@@ -18,6 +19,10 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <sys/types.h>
 #include <unistd.h>
 
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 /* *****************************************************************************
 SSL/TLS patch
 ***************************************************************************** */
@@ -47,19 +52,87 @@ Small Helpers
 ***************************************************************************** */
 static inline int hex2byte(uint8_t *dest, const uint8_t *source);
 
+#if HTTP_DECODE_SIMD && defined(__GNUC__) && defined(__x86_64__) &&            \
+    defined(__SSE2__)
+#include <immintrin.h>
+/**
+ * Returns a pointer to the first occurrence of any of the 4 bytes, or `end`.
+ *
+ * Scans 16 bytes at a time.
+ */
+static inline char *http_seek4(char *pos, char *const end, const char c1,
+                               const char c2, const char c3, const char c4) {
+  const __m128i v1 = _mm_set1_epi8(c1);
+  const __m128i v2 = _mm_set1_epi8(c2);
+  const __m128i v3 = _mm_set1_epi8(c3);
+  const __m128i v4 = _mm_set1_epi8(c4);
+  for (; pos + 16 <= end; pos += 16) {
+    const __m128i in = _mm_loadu_si128((__m128i *)pos);
+    __m128i eq = _mm_or_si128(_mm_cmpeq_epi8(in, v1), _mm_cmpeq_epi8(in, v2));
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi8(in, v3));
+    eq = _mm_or_si128(eq, _mm_cmpeq_epi8(in, v4));
+    const uint32_t found = (uint32_t)_mm_movemask_epi8(eq);
+    if (found)
+      return pos + __builtin_ctz(found);
+  }
+  while (pos < end && *pos != c1 && *pos != c2 && *pos != c3 && *pos != c4)
+    ++pos;
+  return pos;
+}
+
+#elif HTTP_DECODE_SIMD && defined(__GNUC__) && defined(__aarch64__) &&         \
+    defined(__ARM_NEON)
+#include <arm_neon.h>
+/**
+ * Returns a pointer to the first occurrence of any of the 4 bytes, or `end`.
+ *
+ * Scans 16 bytes at a time.
+ */
+static inline char *http_seek4(char *pos, char *const end, const char c1,
+                               const char c2, const char c3, const char c4) {
+  const uint8x16_t v1 = vdupq_n_u8((uint8_t)c1);
+  const uint8x16_t v2 = vdupq_n_u8((uint8_t)c2);
+  const uint8x16_t v3 = vdupq_n_u8((uint8_t)c3);
+  const uint8x16_t v4 = vdupq_n_u8((uint8_t)c4);
+  for (; pos + 16 <= end; pos += 16) {
+    const uint8x16_t in = vld1q_u8((uint8_t *)pos);
+    uint8x16_t eq = vorrq_u8(vceqq_u8(in, v1), vceqq_u8(in, v2));
+    eq = vorrq_u8(eq, vceqq_u8(in, v3));
+    eq = vorrq_u8(eq, vceqq_u8(in, v4));
+    /* narrow the 0x00/0xFF byte mask into a nibble per byte */
+    const uint64_t found = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+    if (found)
+      return pos + (__builtin_ctzll(found) >> 2);
+  }
+  while (pos < end && *pos != c1 && *pos != c2 && *pos != c3 && *pos != c4)
+    ++pos;
+  return pos;
+}
+
+#else
+/** Returns a pointer to the first occurrence of any of the 4 bytes (or end). */
+static inline char *http_seek4(char *pos, char *const end, const char c1,
+                               const char c2, const char c3, const char c4) {
+  while (pos < end && *pos != c1 && *pos != c2 && *pos != c3 && *pos != c4)
+    ++pos;
+  return pos;
+}
+#endif
+
+/* the request that might be cached by the calling thread (see `cache_ttl`) */
+static __thread http_s *http_cache_pending;
+static void http_cache_store(http_s *h, void *data, uintptr_t length);
+
 static inline void add_content_length(http_s *r, uintptr_t length) {
-  static uint64_t cl_hash = 0;
-  if (!cl_hash)
-    cl_hash = fiobj_hash_string("content-length", 14);
+  const uint64_t cl_hash = fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH);
   if (!fiobj_hash_get2(r->private_data.out_headers, cl_hash)) {
     fiobj_hash_set(r->private_data.out_headers, HTTP_HEADER_CONTENT_LENGTH,
                    fiobj_num_new(length));
   }
 }
 static inline void add_content_type(http_s *r) {
-  static uint64_t ct_hash = 0;
-  if (!ct_hash)
-    ct_hash = fiobj_hash_string("content-type", 12);
+  const uint64_t ct_hash = fiobj_obj2hash(HTTP_HEADER_CONTENT_TYPE);
   if (!fiobj_hash_get2(r->private_data.out_headers, ct_hash)) {
     fiobj_hash_set(r->private_data.out_headers, HTTP_HEADER_CONTENT_TYPE,
                    http_mimetype_find2(r->path));
@@ -70,12 +143,8 @@ static FIOBJ current_date;
 static time_t last_date_added;
 static fio_lock_i date_lock;
 static inline void add_date(http_s *r) {
-  static uint64_t date_hash = 0;
-  if (!date_hash)
-    date_hash = fiobj_hash_string("date", 4);
-  static uint64_t mod_hash = 0;
-  if (!mod_hash)
-    mod_hash = fiobj_hash_string("last-modified", 13);
+  const uint64_t date_hash = fiobj_obj2hash(HTTP_HEADER_DATE);
+  const uint64_t mod_hash = fiobj_obj2hash(HTTP_HEADER_LAST_MODIFIED);
 
   if (fio_last_tick().tv_sec > last_date_added) {
     fio_lock(&date_lock);
@@ -252,9 +321,7 @@ int http_set_cookie(http_s *h, http_cookie_args_s cookie) {
   t.data[len++] = ' ';
 
   if (h->status_str || !h->status) { /* on first request status == 0 */
-    static uint64_t cookie_hash;
-    if (!cookie_hash)
-      cookie_hash = fiobj_hash_string("cookie", 6);
+    const uint64_t cookie_hash = fiobj_obj2hash(HTTP_HEADER_COOKIE);
     FIOBJ tmp = fiobj_hash_get2(h->private_data.out_headers, cookie_hash);
     if (!tmp) {
       set_header_add(h->private_data.out_headers, HTTP_HEADER_COOKIE, c);
@@ -320,9 +387,45 @@ int http_send_body(http_s *r, void *data, uintptr_t length) {
   add_content_length(r, length);
   // add_content_type(r);
   add_date(r);
+  if (http_cache_pending == r)
+    http_cache_store(r, data, length);
   return ((http_vtable_s *)r->private_data.vtbl)
       ->http_send_body(r, data, length);
 }
+
+/**
+ * Sends the response headers and the object's String value as the body,
+ * taking ownership of the object.
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_fiobj(http_s *r, FIOBJ body) {
+  if (HTTP_INVALID_HANDLE(r)) {
+    fiobj_free(body);
+    return -1;
+  }
+  if ((!FIOBJ_IS_ROPE(body) && !FIOBJ_TYPE_IS(body, FIOBJ_T_STRING)) ||
+      http_cache_pending == r ||
+      !((http_vtable_s *)r->private_data.vtbl)->http_send_fiobj) {
+    /* the String value is copied (or cached) */
+    fio_str_info_s s = fiobj_obj2cstr(body);
+    int ret = http_send_body(r, s.data, s.len);
+    fiobj_free(body);
+    return ret;
+  }
+  const uintptr_t length = FIOBJ_IS_ROPE(body) ? fiobj_rope_len(body)
+                                               : fiobj_obj2cstr(body).len;
+  if (!length) {
+    fiobj_free(body);
+    http_finish(r);
+    return 0;
+  }
+  add_content_length(r, length);
+  add_date(r);
+  return ((http_vtable_s *)r->private_data.vtbl)->http_send_fiobj(r, body);
+}
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -332,7 +435,7 @@ int http_send_body(http_s *r, void *data, uintptr_t length) {
  */
 int http_sendfile(http_s *r, int fd, uintptr_t length, uintptr_t offset) {
   if (HTTP_INVALID_HANDLE(r)) {
-    close(fd);
+    http_sendfile_close(fd);
     return -1;
   };
   add_content_length(r, length);
@@ -341,6 +444,490 @@ int http_sendfile(http_s *r, int fd, uintptr_t length, uintptr_t offset) {
   return ((http_vtable_s *)r->private_data.vtbl)
       ->http_sendfile(r, fd, length, offset);
 }
+/* *****************************************************************************
+Static file descriptor cache
+***************************************************************************** */
+
+typedef struct {
+  /* the cache's LRU list */
+  fio_ls_embd_s node;
+  FIOBJ path;
+  struct stat st;
+  /* -1 when the file is missing (or isn't a regular file) */
+  int fd;
+  /* one reference for the cache and one for every response using the `fd` */
+  uint32_t ref;
+  /* the `stat` data is tested again after this time (in seconds) */
+  time_t expires;
+} http_fd_entry_s;
+
+#define FIO_SET_NAME http_fd_set
+#define FIO_SET_OBJ_TYPE http_fd_entry_s *
+#define FIO_SET_OBJ_COMPARE(o1, o2) fiobj_iseq((o1)->path, (o2)->path)
+#include <fio.h>
+
+static struct {
+  http_fd_set_s set;
+  fio_ls_embd_s lru;
+  /* maps cached file descriptors to their entries */
+  http_fd_entry_s **by_fd;
+  size_t capa;
+  /* entries in the set */
+  size_t count;
+  /* entries that weren't freed yet (evicted entries might be in use) */
+  size_t live;
+  fio_lock_i lock;
+} http_fd_cache = {
+    .set = FIO_SET_INIT,
+    .lru = FIO_LS_INIT(http_fd_cache.lru),
+    .lock = FIO_LOCK_INIT,
+};
+
+/* drops a reference to an entry, call within the lock */
+static void http_fd_entry_release(http_fd_entry_s *e) {
+  if (--e->ref)
+    return;
+  if (e->fd != -1) {
+    http_fd_cache.by_fd[e->fd] = NULL;
+    close(e->fd);
+  }
+  fiobj_free(e->path);
+  fio_free(e);
+  --http_fd_cache.live;
+}
+
+/* removes an entry from the cache, call within the lock */
+static void http_fd_cache_remove(http_fd_entry_s *e) {
+  http_fd_set_remove(&http_fd_cache.set, fiobj_obj2hash(e->path), e, NULL);
+  fio_ls_embd_remove(&e->node);
+  --http_fd_cache.count;
+  http_fd_entry_release(e);
+}
+
+static void http_fd_cache_clear(void) {
+  fio_lock(&http_fd_cache.lock);
+  while (fio_ls_embd_any(&http_fd_cache.lru)) {
+    http_fd_cache_remove(
+        FIO_LS_EMBD_OBJ(http_fd_entry_s, node, http_fd_cache.lru.next));
+  }
+  http_fd_set_free(&http_fd_cache.set);
+  if (!http_fd_cache.live) {
+    fio_free(http_fd_cache.by_fd);
+    http_fd_cache.by_fd = NULL;
+    http_fd_cache.capa = 0;
+  }
+  fio_unlock(&http_fd_cache.lock);
+}
+
+/* tests if the entry's `stat` data is still valid */
+static inline int http_fd_entry_is_valid(http_fd_entry_s *e, struct stat *st) {
+  if (e->fd == -1)
+    return !S_ISREG(st->st_mode);
+  return S_ISREG(st->st_mode) && e->st.st_ino == st->st_ino &&
+         e->st.st_dev == st->st_dev && e->st.st_mtime == st->st_mtime &&
+         e->st.st_size == st->st_size;
+}
+
+/**
+ * Closes a file descriptor sent using `http_sendfile`, releasing it if it
+ * belongs to the static file cache.
+ */
+void http_sendfile_close(intptr_t fd) {
+  if (fd < 0)
+    return;
+  http_fd_entry_s *e = NULL;
+  fio_lock(&http_fd_cache.lock);
+  if ((size_t)fd < http_fd_cache.capa)
+    e = http_fd_cache.by_fd[fd];
+  if (e)
+    http_fd_entry_release(e);
+  fio_unlock(&http_fd_cache.lock);
+  if (!e)
+    close(fd);
+}
+
+/* opens a regular file, returning -1 on error */
+static int http_static_open_file(const char *filename, struct stat *st) {
+  int fd = open(filename, O_RDONLY);
+  if (fd != -1 && (fstat(fd, st) || !S_ISREG(st->st_mode))) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+/**
+ * Opens a static file (unless it's cached), filling in the `stat` data.
+ *
+ * Returns -1 if the file is missing (or isn't a regular file). Otherwise the
+ * file descriptor should be closed using `http_sendfile_close`.
+ *
+ * The file's position is shared, so only `pread` and `sendfile` (with an
+ * explicit offset) should be used.
+ */
+static int http_static_open(FIOBJ filename, struct stat *st) {
+  fio_str_info_s s = fiobj_obj2cstr(filename);
+  struct stat tmp;
+  int fd;
+  if (!HTTP_STATIC_FD_CACHE_LIMIT)
+    return http_static_open_file(s.data, st);
+  const time_t now = fio_last_tick().tv_sec;
+  const uint64_t hash = fiobj_obj2hash(filename);
+  http_fd_entry_s key = {.path = filename};
+  http_fd_entry_s *e;
+  fio_lock(&http_fd_cache.lock);
+  e = http_fd_set_find(&http_fd_cache.set, hash, &key);
+  if (e && e->expires > now)
+    goto found;
+  fio_unlock(&http_fd_cache.lock);
+  if (e) {
+    /* revalidate the entry (the entry may be evicted while unlocked) */
+    if (stat(s.data, &tmp))
+      tmp.st_mode = 0;
+    fio_lock(&http_fd_cache.lock);
+    e = http_fd_set_find(&http_fd_cache.set, hash, &key);
+    if (e && http_fd_entry_is_valid(e, &tmp)) {
+      e->expires = now + HTTP_STATIC_FD_CACHE_TTL;
+      goto found;
+    }
+    fio_unlock(&http_fd_cache.lock);
+  }
+  fd = http_static_open_file(s.data, &tmp);
+  if (fd == -1)
+    tmp = (struct stat){.st_mode = 0};
+  e = fio_malloc(sizeof(*e));
+  FIO_ASSERT_ALLOC(e);
+  *e = (http_fd_entry_s){
+      .path = fiobj_str_new(s.data, s.len),
+      .st = tmp,
+      .fd = fd,
+      .ref = 1 + (fd != -1),
+      .expires = now + HTTP_STATIC_FD_CACHE_TTL,
+  };
+  fio_lock(&http_fd_cache.lock);
+  if (!http_fd_cache.by_fd) {
+    http_fd_cache.capa = fio_capa();
+    http_fd_cache.by_fd =
+        fio_calloc(sizeof(*http_fd_cache.by_fd), http_fd_cache.capa);
+    FIO_ASSERT_ALLOC(http_fd_cache.by_fd);
+  }
+  if ((size_t)fd >= http_fd_cache.capa && fd != -1) {
+    /* can't be mapped, the file will be closed normally */
+    fio_unlock(&http_fd_cache.lock);
+    fiobj_free(e->path);
+    fio_free(e);
+    goto finish;
+  }
+  {
+    http_fd_entry_s *old = NULL;
+    http_fd_set_overwrite(&http_fd_cache.set, hash, e, &old);
+    if (old) {
+      fio_ls_embd_remove(&old->node);
+      --http_fd_cache.count;
+      http_fd_entry_release(old);
+    }
+  }
+  if (fd != -1)
+    http_fd_cache.by_fd[fd] = e;
+  fio_ls_embd_push(&http_fd_cache.lru, &e->node);
+  ++http_fd_cache.count;
+  ++http_fd_cache.live;
+  while (http_fd_cache.count > HTTP_STATIC_FD_CACHE_LIMIT) {
+    http_fd_cache_remove(
+        FIO_LS_EMBD_OBJ(http_fd_entry_s, node, http_fd_cache.lru.next));
+  }
+  fio_unlock(&http_fd_cache.lock);
+finish:
+  if (fd != -1)
+    *st = tmp;
+  return fd;
+
+found:
+  /* most recently used */
+  fio_ls_embd_remove(&e->node);
+  fio_ls_embd_push(&http_fd_cache.lru, &e->node);
+  fd = e->fd;
+  if (fd != -1) {
+    ++e->ref;
+    *st = e->st;
+  }
+  fio_unlock(&http_fd_cache.lock);
+  return fd;
+}
+
+/* *****************************************************************************
+Static file compression
+***************************************************************************** */
+
+/** Tests if the Accept-Encoding header(s) accept the encoding (q > 0). */
+static int http_accepts_encoding(FIOBJ header, const char *enc, size_t len) {
+  if (FIOBJ_TYPE_IS(header, FIOBJ_T_ARRAY)) {
+    for (size_t i = 0; i < fiobj_ary_count(header); ++i) {
+      if (http_accepts_encoding(fiobj_ary_index(header, i), enc, len))
+        return 1;
+    }
+    return 0;
+  }
+  fio_str_info_s v = fiobj_obj2cstr(header);
+  char *pos = v.data;
+  char *end = v.data + v.len;
+  while (pos < end) {
+    while (pos < end && (*pos == ' ' || *pos == ',' || *pos == '\t'))
+      ++pos;
+    char *token = pos;
+    while (pos < end && *pos != ',' && *pos != ';' && *pos != ' ')
+      ++pos;
+    const uint8_t match =
+        ((size_t)(pos - token) == len && !strncasecmp(token, enc, len));
+    /* test for a zero quality value (i.e. "gzip;q=0") */
+    uint8_t refused = 0;
+    while (pos < end && *pos != ',') {
+      if (*pos == '=' && pos[-1] == 'q') {
+        ++pos;
+        while (pos < end && (*pos == '0' || *pos == '.'))
+          ++pos;
+        refused = (pos >= end || *pos == ',' || *pos == ' ' || *pos == ';');
+        continue;
+      }
+      ++pos;
+    }
+    if (match)
+      return !refused;
+  }
+  return 0;
+}
+
+/** Tests if a mime-type is text based (worth compressing). */
+static int http_mimetype_is_compressible(FIOBJ mime) {
+  fio_str_info_s m = fiobj_obj2cstr(mime);
+  if (!m.data || !m.len)
+    return 0;
+  return (m.len > 5 && !strncasecmp(m.data, "text/", 5)) ||
+         strstr(m.data, "javascript") || strstr(m.data, "json") ||
+         strstr(m.data, "xml") || strstr(m.data, "wasm") ||
+         strstr(m.data, "font/ttf") || strstr(m.data, "font/otf");
+}
+
+#if HAVE_ZLIB
+
+typedef struct {
+  /* the cache's LRU list */
+  fio_ls_embd_s node;
+  FIOBJ path;
+  /* the gzip data (FIOBJ_INVALID when the compression isn't worth while) */
+  FIOBJ data;
+  time_t mtime;
+  off_t size;
+  /* set while the file is compressed (the file is served as is meanwhile) */
+  uint8_t pending;
+} http_gz_entry_s;
+
+#define FIO_SET_NAME http_gz_set
+#define FIO_SET_OBJ_TYPE http_gz_entry_s *
+#define FIO_SET_OBJ_COMPARE(o1, o2) fiobj_iseq((o1)->path, (o2)->path)
+#include <fio.h>
+
+static struct {
+  http_gz_set_s set;
+  fio_ls_embd_s lru;
+  size_t total;
+  fio_lock_i lock;
+} http_gz_cache = {
+    .set = FIO_SET_INIT,
+    .lru = FIO_LS_INIT(http_gz_cache.lru),
+    .lock = FIO_LOCK_INIT,
+};
+
+static inline size_t http_gz_entry_size(http_gz_entry_s *e) {
+  return sizeof(*e) + fiobj_obj2cstr(e->path).len +
+         (e->data ? fiobj_obj2cstr(e->data).len : 0);
+}
+
+static void http_gz_entry_free(http_gz_entry_s *e) {
+  fiobj_free(e->path);
+  fiobj_free(e->data);
+  fio_free(e);
+}
+
+/* removes an entry from the cache, call within the lock */
+static void http_gz_cache_remove(http_gz_entry_s *e) {
+  http_gz_set_remove(&http_gz_cache.set, fiobj_obj2hash(e->path), e, NULL);
+  fio_ls_embd_remove(&e->node);
+  http_gz_cache.total -= http_gz_entry_size(e);
+  http_gz_entry_free(e);
+}
+
+static void http_gz_cache_clear(void) {
+  fio_lock(&http_gz_cache.lock);
+  while (fio_ls_embd_any(&http_gz_cache.lru)) {
+    http_gz_cache_remove(
+        FIO_LS_EMBD_OBJ(http_gz_entry_s, node, http_gz_cache.lru.next));
+  }
+  http_gz_set_free(&http_gz_cache.set);
+  fio_unlock(&http_gz_cache.lock);
+}
+
+/* compresses a file (gzip), returning a String or FIOBJ_INVALID */
+static FIOBJ http_gz_compress(int fd, size_t size) {
+  FIOBJ dest = FIOBJ_INVALID;
+  char *src = fio_malloc(size);
+  FIO_ASSERT_ALLOC(src);
+  size_t pos = 0;
+  while (pos < size) {
+    ssize_t r = pread(fd, src + pos, size - pos, pos);
+    if (r <= 0)
+      goto finish;
+    pos += r;
+  }
+  z_stream z = {.zalloc = Z_NULL};
+  /* 31 == 15 (window bits) + 16 (gzip header) */
+  if (deflateInit2(&z, HTTP_STATIC_COMPRESSION_LEVEL, Z_DEFLATED, 31, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    goto finish;
+  const size_t bound = deflateBound(&z, size);
+  dest = fiobj_str_buf(bound);
+  z.next_in = (Bytef *)src;
+  z.avail_in = size;
+  z.next_out = (Bytef *)fiobj_obj2cstr(dest).data;
+  z.avail_out = bound;
+  if (deflate(&z, Z_FINISH) == Z_STREAM_END) {
+    fiobj_str_resize(dest, z.total_out);
+  } else {
+    fiobj_free(dest);
+    dest = FIOBJ_INVALID;
+  }
+  deflateEnd(&z);
+finish:
+  fio_free(src);
+  return dest;
+}
+
+/* evicts the least recently used entries, call within the lock */
+static void http_gz_cache_trim(void) {
+  while (http_gz_cache.total > HTTP_STATIC_COMPRESSION_CACHE) {
+    http_gz_cache_remove(
+        FIO_LS_EMBD_OBJ(http_gz_entry_s, node, http_gz_cache.lru.next));
+  }
+}
+
+/* compresses a file on the blocking task pool, completing the pending entry */
+static void http_gz_compress_task(void *path_, void *ignr_) {
+  FIOBJ path = (FIOBJ)path_;
+  FIOBJ data = FIOBJ_INVALID;
+  struct stat st = {.st_size = 0};
+  int fd = open(fiobj_obj2cstr(path).data, O_RDONLY);
+  if (fd != -1) {
+    if (!fstat(fd, &st))
+      data = http_gz_compress(fd, st.st_size);
+    close(fd);
+  }
+  if (data && fiobj_obj2cstr(data).len >= (size_t)(st.st_size - 64)) {
+    /* not worth while, remember to serve the file as is */
+    fiobj_free(data);
+    data = FIOBJ_INVALID;
+  }
+  http_gz_entry_s key = {.path = path};
+  fio_lock(&http_gz_cache.lock);
+  http_gz_entry_s *e =
+      http_gz_set_find(&http_gz_cache.set, fiobj_obj2hash(path), &key);
+  if (e && e->pending) {
+    /* a file that changed meanwhile is compressed again by a later request */
+    if (fd != -1 && e->mtime == st.st_mtime && e->size == st.st_size) {
+      http_gz_cache.total -= http_gz_entry_size(e);
+      e->data = data;
+      data = FIOBJ_INVALID;
+      http_gz_cache.total += http_gz_entry_size(e);
+    }
+    e->pending = 0;
+    http_gz_cache_trim();
+  }
+  fio_unlock(&http_gz_cache.lock);
+  fiobj_free(data);
+  fiobj_free(path);
+  (void)ignr_;
+}
+
+/**
+ * Returns the (cached) gzip version of a static file (remember to
+ * `fiobj_free`), or FIOBJ_INVALID if the file shouldn't (or can't yet) be
+ * compressed.
+ *
+ * The first request for a file schedules the compression on the blocking task
+ * pool and a placeholder entry marks the compression as in progress, so the
+ * file is compressed once while requests are served with the file as is.
+ */
+static FIOBJ http_static_compressed(FIOBJ filename, struct stat *st) {
+  if (st->st_size < 256 || st->st_size > HTTP_STATIC_COMPRESSION_LIMIT)
+    return FIOBJ_INVALID;
+  fio_str_info_s s = fiobj_obj2cstr(filename);
+  {
+    uintptr_t pos = s.len - 1;
+    while (pos && s.data[pos] != '.' && s.data[pos] != '/')
+      pos--;
+    if (s.data[pos] != '.')
+      return FIOBJ_INVALID;
+    ++pos;
+    FIOBJ mime = http_mimetype_find(s.data + pos, s.len - pos);
+    const int compressible = http_mimetype_is_compressible(mime);
+    fiobj_free(mime);
+    if (!compressible)
+      return FIOBJ_INVALID;
+  }
+  const uint64_t hash = fiobj_obj2hash(filename);
+  FIOBJ data;
+  http_gz_entry_s *e;
+  http_gz_entry_s key = {.path = filename};
+  fio_lock(&http_gz_cache.lock);
+  e = http_gz_set_find(&http_gz_cache.set, hash, &key);
+  if (e && e->mtime == st->st_mtime && e->size == st->st_size) {
+    /* most recently used */
+    fio_ls_embd_remove(&e->node);
+    fio_ls_embd_push(&http_gz_cache.lru, &e->node);
+    data = fiobj_dup(e->data);
+    fio_unlock(&http_gz_cache.lock);
+    return data;
+  }
+  e = fio_malloc(sizeof(*e));
+  FIO_ASSERT_ALLOC(e);
+  *e = (http_gz_entry_s){
+      .path = fiobj_str_new(s.data, s.len),
+      .mtime = st->st_mtime,
+      .size = st->st_size,
+      .pending = 1,
+  };
+  {
+    http_gz_entry_s *old = NULL;
+    http_gz_set_overwrite(&http_gz_cache.set, hash, e, &old);
+    if (old) {
+      fio_ls_embd_remove(&old->node);
+      http_gz_cache.total -= http_gz_entry_size(old);
+      http_gz_entry_free(old);
+    }
+  }
+  fio_ls_embd_push(&http_gz_cache.lru, &e->node);
+  http_gz_cache.total += http_gz_entry_size(e);
+  data = fiobj_dup(e->path);
+  http_gz_cache_trim();
+  fio_unlock(&http_gz_cache.lock);
+  /* compress outside of the IO thread pool */
+  if (fio_defer_blocking(http_gz_compress_task, (void *)data, NULL))
+    http_gz_compress_task((void *)data, NULL);
+  return FIOBJ_INVALID;
+}
+
+#else /* HAVE_ZLIB */
+
+#define http_gz_cache_clear()
+#define http_static_compressed(filename, st) ((void)(st), FIOBJ_INVALID)
+
+#endif /* HAVE_ZLIB */
+
+/** Clears the static file caches (open files and compressed data). */
+void http_static_cache_clear(void) {
+  http_gz_cache_clear();
+  http_fd_cache_clear();
+}
+
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -353,12 +940,8 @@ int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
   if (HTTP_INVALID_HANDLE(h))
     return -1;
   struct stat file_data = {.st_size = 0};
-  static uint64_t accept_enc_hash = 0;
-  if (!accept_enc_hash)
-    accept_enc_hash = fiobj_hash_string("accept-encoding", 15);
-  static uint64_t range_hash = 0;
-  if (!range_hash)
-    range_hash = fiobj_hash_string("range", 5);
+  const uint64_t accept_enc_hash = fiobj_obj2hash(HTTP_HEADER_ACCEPT_ENCODING);
+  const uint64_t range_hash = fiobj_obj2hash(HTTP_HEADER_RANGE);
 
   /* create filename string */
   FIOBJ filename = fiobj_str_tmp();
@@ -397,35 +980,56 @@ int http_sendfile2(http_s *h, const char *prefix, size_t prefix_len,
     if (tmp.data[tmp.len - 1] == '/')
       fiobj_str_write(filename, "index.html", 10);
   }
-  /* test for file existance  */
+  /* test for file existance (opening the file, or finding it in the cache) */
 
   int file = -1;
+  /* a pre-compressed sibling was found (".gz" / ".br") */
   uint8_t is_gz = 0;
+  uint8_t is_br = 0;
+  uint8_t accepts_gzip = 0;
+  /* on-the-fly compressed data */
+  FIOBJ gz = FIOBJ_INVALID;
 
   fio_str_info_s s = fiobj_obj2cstr(filename);
   {
     FIOBJ tmp = fiobj_hash_get2(h->headers, accept_enc_hash);
     if (!tmp)
       goto no_gzip_support;
-    fio_str_info_s ac_str = fiobj_obj2cstr(tmp);
-    if (!ac_str.data || !strstr(ac_str.data, "gzip"))
+    /* pre-compressed files requested explicitly are sent as is */
+    if (s.len > 3 && s.data[s.len - 3] == '.' &&
+        ((s.data[s.len - 2] == 'g' && s.data[s.len - 1] == 'z') ||
+         (s.data[s.len - 2] == 'b' && s.data[s.len - 1] == 'r')))
       goto no_gzip_support;
-    if (s.data[s.len - 3] != '.' || s.data[s.len - 2] != 'g' ||
-        s.data[s.len - 1] != 'z') {
+    if (http_accepts_encoding(tmp, "br", 2)) {
+      fiobj_str_write(filename, ".br", 3);
+      s = fiobj_obj2cstr(filename);
+      file = http_static_open(filename, &file_data);
+      if (file != -1) {
+        is_br = 1;
+        goto found_file;
+      }
+      fiobj_str_resize(filename, s.len - 3);
+      s = fiobj_obj2cstr(filename);
+    }
+    accepts_gzip = http_accepts_encoding(tmp, "gzip", 4);
+    if (accepts_gzip) {
       fiobj_str_write(filename, ".gz", 3);
       s = fiobj_obj2cstr(filename);
-      if (!stat(s.data, &file_data) &&
-          (S_ISREG(file_data.st_mode) || S_ISLNK(file_data.st_mode))) {
+      file = http_static_open(filename, &file_data);
+      if (file != -1) {
         is_gz = 1;
         goto found_file;
       }
       fiobj_str_resize(filename, s.len - 3);
+      s = fiobj_obj2cstr(filename);
     }
   }
 no_gzip_support:
-  if (stat(s.data, &file_data) ||
-      !(S_ISREG(file_data.st_mode) || S_ISLNK(file_data.st_mode)))
+  file = http_static_open(filename, &file_data);
+  if (file == -1)
     return -1;
+  if (accepts_gzip && http2protocol(h)->settings->compress_static)
+    gz = http_static_compressed(filename, &file_data);
 found_file:
   /* set last-modified */
   {
@@ -439,6 +1043,8 @@ found_file:
   /* set & test etag */
   uint64_t etag = (uint64_t)file_data.st_size;
   etag ^= (uint64_t)file_data.st_mtime;
+  if (gz) /* the compressed variant requires a different ETag */
+    etag = ~etag;
   etag = fiobj_hash_string(&etag, sizeof(uint64_t));
   FIOBJ etag_str = fiobj_str_buf(32);
   fiobj_str_resize(etag_str,
@@ -448,11 +1054,11 @@ found_file:
   http_set_header(h, HTTP_HEADER_ETAG, etag_str);
   /* test */
   {
-    static uint64_t none_match_hash = 0;
-    if (!none_match_hash)
-      none_match_hash = fiobj_hash_string("if-none-match", 13);
+    const uint64_t none_match_hash = fiobj_obj2hash(HTTP_HEADER_IF_NONE_MATCH);
     FIOBJ tmp2 = fiobj_hash_get2(h->headers, none_match_hash);
     if (tmp2 && fiobj_iseq(tmp2, etag_str)) {
+      http_sendfile_close(file);
+      fiobj_free(gz);
       h->status = 304;
       http_finish(h);
       return 0;
@@ -461,10 +1067,13 @@ found_file:
   /* handle range requests */
   int64_t offset = 0;
   int64_t length = file_data.st_size;
+  if (gz) {
+    /* compressed variants are sent as a whole (ranges are ignored) */
+    fiobj_hash_delete2(h->headers, range_hash);
+    length = fiobj_obj2cstr(gz).len;
+  }
   {
-    static uint64_t ifrange_hash = 0;
-    if (!ifrange_hash)
-      ifrange_hash = fiobj_hash_string("if-range", 8);
+    const uint64_t ifrange_hash = fiobj_obj2hash(HTTP_HEADER_IF_RANGE);
     FIOBJ tmp = fiobj_hash_get2(h->headers, ifrange_hash);
     if (tmp && fiobj_iseq(tmp, etag_str)) {
       fiobj_hash_delete2(h->headers, range_hash);
@@ -523,6 +1132,8 @@ found_file:
   switch (s.len) {
   case 7:
     if (!strncasecmp("options", s.data, 7)) {
+      http_sendfile_close(file);
+      fiobj_free(gz);
       http_set_header2(h, (fio_str_info_s){.data = (char *)"allow", .len = 5},
                        (fio_str_info_s){.data = (char *)"GET, HEAD", .len = 9});
       h->status = 200;
@@ -535,31 +1146,27 @@ found_file:
       goto open_file;
     break;
   case 4:
-    if (!strncasecmp("head", s.data, 4)) {
-      http_set_header(h, HTTP_HEADER_CONTENT_LENGTH, fiobj_num_new(length));
-      http_finish(h);
-      return 0;
-    }
+    if (!strncasecmp("head", s.data, 4))
+      goto open_file;
     break;
   }
+  http_sendfile_close(file);
+  fiobj_free(gz);
   http_send_error(h, 403);
   return 0;
 open_file:
+  /* set the content type and encoding */
   s = fiobj_obj2cstr(filename);
-  file = open(s.data, O_RDONLY);
-  if (file == -1) {
-    FIO_LOG_ERROR("(HTTP) couldn't open file %s!\n", s.data);
-    perror("     ");
-    http_send_error(h, 500);
-    return 0;
-  }
   {
     FIOBJ tmp = 0;
     uintptr_t pos = 0;
-    if (is_gz) {
-      http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
-                      fiobj_dup(HTTP_HVALUE_GZIP));
-
+    if (is_gz || is_br) {
+      if (is_gz)
+        http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
+                        fiobj_dup(HTTP_HVALUE_GZIP));
+      else
+        http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
+                        fiobj_str_new("br", 2));
       pos = s.len - 4;
       while (pos && s.data[pos] != '.')
         pos--;
@@ -567,15 +1174,39 @@ open_file:
       tmp = http_mimetype_find(s.data + pos, s.len - pos - 3);
 
     } else {
+      if (gz)
+        http_set_header(h, HTTP_HEADER_CONTENT_ENCODING,
+                        fiobj_dup(HTTP_HVALUE_GZIP));
       pos = s.len - 1;
       while (pos && s.data[pos] != '.')
         pos--;
       pos++; /* assuming, but that's fine. */
       tmp = http_mimetype_find(s.data + pos, s.len - pos);
     }
+    /* caches must know that the response depends on the Accept-Encoding */
+    if (is_gz || is_br || gz ||
+        (http2protocol(h)->settings->compress_static &&
+         http_mimetype_is_compressible(tmp)))
+      http_set_header2(
+          h, (fio_str_info_s){.data = (char *)"vary", .len = 4},
+          (fio_str_info_s){.data = (char *)"accept-encoding", .len = 15});
     if (tmp)
       http_set_header(h, HTTP_HEADER_CONTENT_TYPE, tmp);
   }
+  s = fiobj_obj2cstr(h->method);
+  if (s.len == 4 && !strncasecmp("head", s.data, 4)) {
+    http_sendfile_close(file);
+    fiobj_free(gz);
+    http_set_header(h, HTTP_HEADER_CONTENT_LENGTH, fiobj_num_new(length));
+    http_finish(h);
+    return 0;
+  }
+  if (gz) {
+    /* the cached data is shared (not copied) */
+    http_sendfile_close(file);
+    http_send_fiobj(h, gz);
+    return 0;
+  }
   http_sendfile(h, file, length, offset);
   return 0;
 }
@@ -630,30 +1261,455 @@ void http_finish(http_s *r) {
   add_date(r);
   ((http_vtable_s *)r->private_data.vtbl)->http_finish(r);
 }
+
+/* *****************************************************************************
+Response templates
+***************************************************************************** */
+
+struct http_template_writer_s {
+  http_response_template_s *t;
+  FIOBJ name;
+  uint8_t in_array;
+};
+
+static int http_template_write_header(FIOBJ o, void *w_) {
+  struct http_template_writer_s *w = w_;
+  if (!w->in_array) {
+    w->name = fiobj_hash_key_in_loop();
+    fiobj_hash_set(w->t->headers, w->name, fiobj_dup(o));
+  }
+  if (FIOBJ_TYPE_IS(o, FIOBJ_T_ARRAY)) {
+    w->in_array = 1;
+    fiobj_each1(o, 0, http_template_write_header, w);
+    w->in_array = 0;
+    return 0;
+  }
+  fio_str_info_s name = fiobj_obj2cstr(w->name);
+  fio_str_info_s str = fiobj_obj2cstr(o);
+  if (!str.data)
+    return 0;
+  if (name.len == 10 && !memcmp(name.data, "connection", 10)) {
+    w->t->has_connection = 1;
+    w->t->close = (str.data[0] == 'c' || str.data[0] == 'C');
+  }
+  fiobj_str_write(w->t->http1, name.data, name.len);
+  fiobj_str_write(w->t->http1, ":", 1);
+  fiobj_str_write(w->t->http1, str.data, str.len);
+  fiobj_str_write(w->t->http1, "\r\n", 2);
+  return 0;
+}
+
+/**
+ * Creates a response template with the `status` and `headers`.
+ */
+http_response_template_s *http_response_template_new(uintptr_t status,
+                                                     FIOBJ headers) {
+  if (status < 100 || status >= 1000)
+    status = 200;
+  http_response_template_s *t = fio_malloc(sizeof(*t));
+  FIO_ASSERT_ALLOC(t);
+  *t = (http_response_template_s){
+      .headers = fiobj_hash_new(),
+      .http1 = fiobj_str_buf(128),
+      .status = status,
+  };
+  fio_str_info_s s = http_status2str(status);
+  fiobj_str_printf(t->http1, "HTTP/1.1 %u %.*s\r\n", (unsigned int)status,
+                   (int)s.len, s.data);
+  if (FIOBJ_TYPE_IS(headers, FIOBJ_T_HASH)) {
+    struct http_template_writer_s w = {.t = t};
+    fiobj_each1(headers, 0, http_template_write_header, &w);
+  }
+  return t;
+}
+
+/** Frees a response template (see `http_response_template_new`). */
+void http_response_template_free(http_response_template_s *t) {
+  if (!t)
+    return;
+  fiobj_free(t->headers);
+  fiobj_free(t->http1);
+  fio_free(t);
+}
+
+static int http_template_copy_header(FIOBJ o, void *h_) {
+  http_s *h = h_;
+  FIOBJ name = fiobj_hash_key_in_loop();
+  if (FIOBJ_TYPE_IS(o, FIOBJ_T_ARRAY)) {
+    for (size_t i = 0; i < fiobj_ary_count(o); ++i)
+      set_header_add(h->private_data.out_headers, name,
+                     fiobj_dup(fiobj_ary_index(o, i)));
+    return 0;
+  }
+  set_header_add(h->private_data.out_headers, name, fiobj_dup(o));
+  return 0;
+}
+
+/**
+ * Sends a response using a template and a body (which might be empty).
+ */
+int http_send_template(http_s *h, http_response_template_s *t, void *data,
+                       uintptr_t length) {
+  if (HTTP_INVALID_HANDLE(h) || !t)
+    return -1;
+  if (!data)
+    length = 0;
+  h->status = t->status;
+  if (((http_vtable_s *)h->private_data.vtbl)->http_send_template &&
+      !fiobj_hash_count(h->private_data.out_headers) &&
+      !http_settings(h)->is_client && http_cache_pending != h) {
+    return ((http_vtable_s *)h->private_data.vtbl)
+        ->http_send_template(h, t, data, length);
+  }
+  /* other headers were set - merge the template's headers */
+  fiobj_each1(t->headers, 0, http_template_copy_header, h);
+  return http_send_body(h, data, length);
+}
+/* *****************************************************************************
+Response cache (microcache)
+***************************************************************************** */
+
+typedef struct {
+  /* the cache's LRU list */
+  fio_ls_embd_s node;
+  http_settings_s *settings;
+  /* the request's host, path and query */
+  FIOBJ key;
+  http_response_template_s *t;
+  FIOBJ body;
+  /* the response's `vary` header and the request's values for these headers */
+  FIOBJ vary;
+  uint64_t vary_hash;
+  uint64_t hash;
+  time_t expires;
+  /* one reference for the cache and one for every response being sent */
+  uint32_t ref;
+  /* set while a request rebuilds the (stale) entry */
+  uint8_t rebuilding;
+} http_cache_entry_s;
+
+#define FIO_SET_NAME http_cache_set
+#define FIO_SET_OBJ_TYPE http_cache_entry_s *
+#define FIO_SET_OBJ_COMPARE(o1, o2)                                            \
+  ((o1)->settings == (o2)->settings && fiobj_iseq((o1)->key, (o2)->key))
+#include <fio.h>
+
+static struct {
+  http_cache_set_s set;
+  fio_ls_embd_s lru;
+  size_t total;
+  fio_lock_i lock;
+} http_cache = {
+    .set = FIO_SET_INIT,
+    .lru = FIO_LS_INIT(http_cache.lru),
+    .lock = FIO_LOCK_INIT,
+};
+
+static inline size_t http_cache_entry_size(http_cache_entry_s *e) {
+  return sizeof(*e) + fiobj_obj2cstr(e->key).len +
+         fiobj_obj2cstr(e->t->http1).len + fiobj_obj2cstr(e->body).len;
+}
+
+/* drops a reference to an entry, call within the lock */
+static void http_cache_entry_release(http_cache_entry_s *e) {
+  if (--e->ref)
+    return;
+  fiobj_free(e->key);
+  fiobj_free(e->body);
+  fiobj_free(e->vary);
+  http_response_template_free(e->t);
+  fio_free(e);
+}
+
+/* removes an entry from the cache, call within the lock */
+static void http_cache_remove(http_cache_entry_s *e) {
+  http_cache_set_remove(&http_cache.set, e->hash, e, NULL);
+  fio_ls_embd_remove(&e->node);
+  http_cache.total -= http_cache_entry_size(e);
+  http_cache_entry_release(e);
+}
+
+/** Removes the responses cached for the `settings` (or all, if NULL). */
+void http_cache_clear(http_settings_s *settings) {
+  fio_lock(&http_cache.lock);
+  fio_ls_embd_s *pos = http_cache.lru.next;
+  while (pos != &http_cache.lru) {
+    http_cache_entry_s *e = FIO_LS_EMBD_OBJ(http_cache_entry_s, node, pos);
+    pos = pos->next;
+    if (!settings || e->settings == settings)
+      http_cache_remove(e);
+  }
+  if (!settings)
+    http_cache_set_free(&http_cache.set);
+  fio_unlock(&http_cache.lock);
+}
+
+/* the cache key (host, path and query) or FIOBJ_INVALID if not cacheable */
+static FIOBJ http_cache_key(http_s *h) {
+  fio_str_info_s m = fiobj_obj2cstr(h->method);
+  if (m.len != 3 || memcmp(m.data, "GET", 3) ||
+      fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_COOKIE)) ||
+      fiobj_hash_get2(h->headers, fiobj_hash_string("authorization", 13)))
+    return FIOBJ_INVALID;
+  FIOBJ tmp = fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_HOST));
+  /* `fiobj_obj2cstr` returns "null" for missing objects */
+  fio_str_info_s host = {.len = 0}, path = {.len = 0}, query = {.len = 0};
+  if (tmp)
+    host = fiobj_obj2cstr(tmp);
+  if (h->path)
+    path = fiobj_obj2cstr(h->path);
+  if (h->query)
+    query = fiobj_obj2cstr(h->query);
+  FIOBJ key = fiobj_str_buf(host.len + path.len + query.len + 2);
+  fiobj_str_write(key, host.data, host.len);
+  fiobj_str_write(key, " ", 1);
+  fiobj_str_write(key, path.data, path.len);
+  if (query.len) {
+    fiobj_str_write(key, "?", 1);
+    fiobj_str_write(key, query.data, query.len);
+  }
+  return key;
+}
+
+/* hashes the request's values for the headers named in the `vary` header */
+static uint64_t http_cache_vary_hash(http_s *h, FIOBJ vary) {
+  uint64_t hash = 0;
+  fio_str_info_s v = fiobj_obj2cstr(vary);
+  char name[64];
+  size_t pos = 0;
+  while (pos < v.len) {
+    size_t len = 0;
+    while (pos < v.len && (v.data[pos] == ' ' || v.data[pos] == ','))
+      ++pos;
+    while (pos < v.len && v.data[pos] != ' ' && v.data[pos] != ',') {
+      if (len < sizeof(name))
+        name[len++] = tolower((uint8_t)v.data[pos]);
+      ++pos;
+    }
+    if (!len)
+      continue;
+    FIOBJ value = fiobj_hash_get2(h->headers, fiobj_hash_string(name, len));
+    hash = (hash * 31) + len;
+    if (value)
+      hash += fiobj_obj2hash(value);
+  }
+  return hash;
+}
+
+struct http_cache_writer_s {
+  FIOBJ headers;
+  uint8_t refused;
+};
+
+/* copies the response headers, refusing responses that shouldn't be cached */
+static int http_cache_copy_header(FIOBJ o, void *w_) {
+  struct http_cache_writer_s *w = w_;
+  FIOBJ name = fiobj_hash_key_in_loop();
+  const uint64_t hash = fiobj_obj2hash(name);
+  if (hash == fiobj_obj2hash(HTTP_HEADER_SET_COOKIE) ||
+      (hash == fiobj_obj2hash(HTTP_HEADER_CACHE_CONTROL) &&
+       /* the token parser is shared with the `accept-encoding` header */
+       (http_accepts_encoding(o, "no-store", 8) ||
+        http_accepts_encoding(o, "no-cache", 8) ||
+        http_accepts_encoding(o, "private", 7)))) {
+    w->refused = 1;
+    return -1;
+  }
+  /* added when the response is sent */
+  if (hash == fiobj_obj2hash(HTTP_HEADER_DATE) ||
+      hash == fiobj_obj2hash(HTTP_HEADER_LAST_MODIFIED) ||
+      hash == fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH))
+    return 0;
+  /* the values might belong to the request's arena (i.e., echoed headers) */
+  name = fiobj_arena_copy(name);
+  fiobj_hash_set(w->headers, name, fiobj_arena_copy(o));
+  fiobj_free(name);
+  return 0;
+}
+
+/* caches a response (called by `http_send_body`) */
+static void http_cache_store(http_s *h, void *data, uintptr_t length) {
+  http_settings_s *settings = http_settings(h);
+  http_cache_pending = NULL;
+  if (h->status != 200 || length > HTTP_RESPONSE_CACHE_LIMIT)
+    return;
+  FIOBJ key = http_cache_key(h);
+  struct http_cache_writer_s w = {.headers = fiobj_hash_new()};
+  FIOBJ vary = fiobj_hash_get2(h->private_data.out_headers,
+                               fiobj_hash_string("vary", 4));
+  fio_str_info_s v = fiobj_obj2cstr(vary);
+  if (key)
+    fiobj_each1(h->private_data.out_headers, 0, http_cache_copy_header, &w);
+  if (!key || w.refused ||
+      (vary && (!FIOBJ_TYPE_IS(vary, FIOBJ_T_STRING) ||
+                memchr(v.data, '*', v.len)))) {
+    fiobj_free(w.headers);
+    fiobj_free(key);
+    return;
+  }
+  http_cache_entry_s *e = fio_malloc(sizeof(*e));
+  FIO_ASSERT_ALLOC(e);
+  *e = (http_cache_entry_s){
+      .settings = settings,
+      .key = key,
+      .t = http_response_template_new(200, w.headers),
+      .body = fiobj_str_new(data, length),
+      .vary = fiobj_arena_copy(vary),
+      .vary_hash = (vary ? http_cache_vary_hash(h, vary) : 0),
+      .hash = fiobj_obj2hash(key) + (uintptr_t)settings,
+      .expires = fio_last_tick().tv_sec + settings->cache_ttl,
+      .ref = 1,
+  };
+  fiobj_free(w.headers);
+  fio_lock(&http_cache.lock);
+  {
+    http_cache_entry_s *old = NULL;
+    http_cache_set_overwrite(&http_cache.set, e->hash, e, &old);
+    if (old) {
+      fio_ls_embd_remove(&old->node);
+      http_cache.total -= http_cache_entry_size(old);
+      http_cache_entry_release(old);
+    }
+  }
+  fio_ls_embd_push(&http_cache.lru, &e->node);
+  http_cache.total += http_cache_entry_size(e);
+  while (http_cache.total > HTTP_RESPONSE_CACHE &&
+         http_cache.lru.next != &e->node) {
+    http_cache_remove(
+        FIO_LS_EMBD_OBJ(http_cache_entry_s, node, http_cache.lru.next));
+  }
+  fio_unlock(&http_cache.lock);
+}
+
+/* sends a cached response */
+static void http_cache_send(http_s *h, http_cache_entry_s *e) {
+  if (((http_vtable_s *)h->private_data.vtbl)->http_send_cached) {
+    h->status = 200;
+    ((http_vtable_s *)h->private_data.vtbl)->http_send_cached(h, e->t, e->body);
+    return;
+  }
+  fio_str_info_s body = fiobj_obj2cstr(e->body);
+  http_send_template(h, e->t, body.data, body.len);
+}
+
+/**
+ * Handles a request using the response cache (see `cache_ttl`), calling the
+ * `on_request` callback unless a cached response was sent.
+ */
+void http_cache_on_request(http_s *h, http_settings_s *settings) {
+  FIOBJ key = http_cache_key(h);
+  if (!key) {
+    http_coroutine_on_request(h, settings);
+    return;
+  }
+  const time_t now = fio_last_tick().tv_sec;
+  http_cache_entry_s tmp = {.settings = settings, .key = key};
+  const uint64_t hash = fiobj_obj2hash(key) + (uintptr_t)settings;
+  http_cache_entry_s *e;
+  fio_lock(&http_cache.lock);
+  e = http_cache_set_find(&http_cache.set, hash, &tmp);
+  if (e && e->vary && e->vary_hash != http_cache_vary_hash(h, e->vary))
+    e = NULL; /* a different variant, replaced once the response was sent */
+  if (e && (e->expires > now || e->rebuilding)) {
+    /* fresh, or stale while another request rebuilds the entry */
+    fio_ls_embd_remove(&e->node);
+    fio_ls_embd_push(&http_cache.lru, &e->node);
+    ++e->ref;
+    fio_unlock(&http_cache.lock);
+    fiobj_free(key);
+    http_cache_send(h, e);
+    fio_lock(&http_cache.lock);
+    http_cache_entry_release(e);
+    fio_unlock(&http_cache.lock);
+    return;
+  }
+  if (e)
+    e->rebuilding = 1;
+  fio_unlock(&http_cache.lock);
+  http_cache_pending = h;
+  http_coroutine_on_request(h, settings);
+  http_cache_pending = NULL;
+  if (e) {
+    /* if the response wasn't cached, another request might rebuild it */
+    fio_lock(&http_cache.lock);
+    e = http_cache_set_find(&http_cache.set, hash, &tmp);
+    if (e)
+      e->rebuilding = 0;
+    fio_unlock(&http_cache.lock);
+  }
+  fiobj_free(key);
+}
+
+/**
+ * Pushes a data response when supported (HTTP/2 only).
+ *
+ * Returns -1 on error and 0 on success.
+ */
+int http_push_data(http_s *r, void *data, uintptr_t length, FIOBJ mime_type) {
+  if (!r || !(http_fio_protocol_s *)r->private_data.flag)
+    return -1;
+  return ((http_vtable_s *)r->private_data.vtbl)
+      ->http_push_data(r, data, length, mime_type);
+}
+/**
+ * Pushes a file response when supported (HTTP/2 only).
+ *
+ * If `mime_type` is NULL, an attempt at automatic detection using
+ * `filename` will be made.
+ *
+ * Returns -1 on error and 0 on success.
+ */
+int http_push_file(http_s *h, FIOBJ filename, FIOBJ mime_type) {
+  if (HTTP_INVALID_HANDLE(h))
+    return -1;
+  return ((http_vtable_s *)h->private_data.vtbl)
+      ->http_push_file(h, filename, mime_type);
+}
+
+/* *****************************************************************************
+HTTP Streaming (responses of unknown length)
+***************************************************************************** */
+
+/**
+ * Sends the response headers and starts a streamed response.
+ *
+ * Returns -1 on error and 0 on success.
+ */
+#undef http_stream_start
+int http_stream_start(http_s *h, http_stream_args_s args) {
+  if (HTTP_INVALID_HANDLE(h) ||
+      !((http_vtable_s *)h->private_data.vtbl)->http_stream_start)
+    return -1;
+  add_date(h);
+  return ((http_vtable_s *)h->private_data.vtbl)->http_stream_start(h, &args);
+}
+
 /**
- * Pushes a data response when supported (HTTP/2 only).
+ * Writes data to a streamed response.
  *
- * Returns -1 on error and 0 on success.
+ * Returns -1 on error, 0 on success or 1 if the stream should wait for the
+ * `on_ready` callback.
  */
-int http_push_data(http_s *r, void *data, uintptr_t length, FIOBJ mime_type) {
-  if (!r || !(http_fio_protocol_s *)r->private_data.flag)
+int http_stream_write(http_s *h, void *data, uintptr_t length) {
+  if (HTTP_INVALID_HANDLE(h) ||
+      !((http_vtable_s *)h->private_data.vtbl)->http_stream_write)
     return -1;
-  return ((http_vtable_s *)r->private_data.vtbl)
-      ->http_push_data(r, data, length, mime_type);
+  if (!data)
+    length = 0;
+  return ((http_vtable_s *)h->private_data.vtbl)
+      ->http_stream_write(h, data, length);
 }
+
 /**
- * Pushes a file response when supported (HTTP/2 only).
- *
- * If `mime_type` is NULL, an attempt at automatic detection using
- * `filename` will be made.
+ * Ends a streamed response.
  *
  * Returns -1 on error and 0 on success.
  */
-int http_push_file(http_s *h, FIOBJ filename, FIOBJ mime_type) {
-  if (HTTP_INVALID_HANDLE(h))
+int http_stream_end(http_s *h) {
+  if (HTTP_INVALID_HANDLE(h) ||
+      !((http_vtable_s *)h->private_data.vtbl)->http_stream_end)
     return -1;
-  return ((http_vtable_s *)h->private_data.vtbl)
-      ->http_push_file(h, filename, mime_type);
+  return ((http_vtable_s *)h->private_data.vtbl)->http_stream_end(h);
 }
 
 /**
@@ -769,6 +1825,260 @@ intptr_t http_hijack(http_s *h, fio_str_info_s *leftover) {
   return ((http_vtable_s *)h->private_data.vtbl)->http_hijack(h, leftover);
 }
 
+/* *****************************************************************************
+Coroutines (see the `coroutines` setting)
+***************************************************************************** */
+#if HTTP_COROUTINE_SUPPORT
+#include <sys/mman.h>
+#include <ucontext.h>
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_STACK
+#define MAP_STACK 0
+#endif
+
+/* a coroutine, placed at the top of its own (mapped) stack */
+struct http_await_s {
+  ucontext_t ctx;    /* the coroutine's context */
+  ucontext_t caller; /* the context that last switched to the coroutine */
+  http_s *h;
+  http_settings_s *settings;
+  intptr_t uuid;
+  /* the `http_await` task, performed once the coroutine was suspended */
+  void (*task)(http_await_s *await, void *arg);
+  void *arg;
+  void *result;
+  void *map;
+  size_t map_len;
+  http_await_s *next; /* the stack pool */
+  uint8_t done;
+  uint8_t lost;
+};
+
+static struct {
+  http_await_s *head;
+  size_t count;
+  fio_lock_i lock;
+} http_coroutine_pool = {.lock = FIO_LOCK_INIT};
+
+/* the coroutine running on this thread (if any) */
+static __thread http_await_s *http_coroutine_current;
+
+/* takes a stack from the pool or maps a new one (with a guard page) */
+static http_await_s *http_coroutine_new(void) {
+  http_await_s *co;
+  fio_lock(&http_coroutine_pool.lock);
+  co = http_coroutine_pool.head;
+  if (co) {
+    http_coroutine_pool.head = co->next;
+    --http_coroutine_pool.count;
+  }
+  fio_unlock(&http_coroutine_pool.lock);
+  if (co)
+    return co;
+  const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  const size_t len =
+      page + ((HTTP_COROUTINE_STACK_SIZE + page - 1) & (~(page - 1)));
+  char *map = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+  if (mprotect(map, page, PROT_NONE)) {
+    munmap(map, len);
+    return NULL;
+  }
+  co = (http_await_s *)(((uintptr_t)(map + len) - sizeof(*co)) &
+                        (~(uintptr_t)63));
+  co->map = map;
+  co->map_len = len;
+  return co;
+}
+
+/* returns the stack to the pool (or unmaps it) */
+static void http_coroutine_free(http_await_s *co) {
+  fio_lock(&http_coroutine_pool.lock);
+  if (http_coroutine_pool.count < HTTP_COROUTINE_POOL_LIMIT) {
+    co->next = http_coroutine_pool.head;
+    http_coroutine_pool.head = co;
+    ++http_coroutine_pool.count;
+    co = NULL;
+  }
+  fio_unlock(&http_coroutine_pool.lock);
+  if (co)
+    munmap(co->map, co->map_len);
+}
+
+/* switches to the coroutine, performing the `http_await` task it left */
+static void http_coroutine_switch(http_await_s *co) {
+  http_await_s *old = http_coroutine_current;
+  http_coroutine_current = co;
+  swapcontext(&co->caller, &co->ctx);
+  http_coroutine_current = old;
+  if (co->done) {
+    http_coroutine_free(co);
+    return;
+  }
+  void (*task)(http_await_s *, void *) = co->task;
+  co->task = NULL;
+  task(co, co->arg);
+}
+
+/* the coroutine's entry point */
+static void http_coroutine_main(void) {
+  http_await_s *co = http_coroutine_current;
+  co->settings->on_request(co->h);
+  co->done = 1;
+  setcontext(&co->caller);
+}
+
+/*
+ * Initializes the coroutine's context, returning -1 on error.
+ *
+ * Kept out of line, so the caller's variables aren't live across `getcontext`
+ * (which could, in theory, return twice).
+ */
+static __attribute__((noinline)) int http_coroutine_init(http_await_s *co) {
+  if (getcontext(&co->ctx))
+    return -1;
+  co->ctx.uc_stack.ss_sp = co->map;
+  co->ctx.uc_stack.ss_size = (size_t)((char *)co - (char *)co->map);
+  co->ctx.uc_link = NULL;
+  makecontext(&co->ctx, http_coroutine_main, 0);
+  return 0;
+}
+
+/** Calls the `on_request` callback (within a coroutine, if enabled). */
+void http_coroutine_on_request(http_s *h, http_settings_s *settings) {
+  http_await_s *co;
+  if (!settings->coroutines || !(co = http_coroutine_new()))
+    goto direct;
+  if (http_coroutine_init(co)) {
+    http_coroutine_free(co);
+    goto direct;
+  }
+  co->h = h;
+  co->settings = settings;
+  co->task = NULL;
+  co->done = 0;
+  co->lost = 0;
+  http_coroutine_switch(co);
+  return;
+direct:
+  settings->on_request(h);
+}
+
+/* resumes the coroutine within the connection's lock */
+static void http_await_resume_wrapper(intptr_t uuid, fio_protocol_s *p_,
+                                      void *arg) {
+  http_await_s *co = arg;
+  http_s *h = co->h;
+  http_vtable_s *vtbl = (http_vtable_s *)h->private_data.vtbl;
+  http_coroutine_switch(co);
+  vtbl->http_on_resume(h, (http_fio_protocol_s *)p_);
+  (void)uuid;
+}
+
+/* resumes the coroutine after the connection was lost */
+static void http_await_resume_fallback(intptr_t uuid, void *arg) {
+  http_await_s *co = arg;
+  co->lost = 1;
+  co->h = NULL;
+  http_coroutine_switch(co);
+  (void)uuid;
+}
+
+/**
+ * Suspends the `on_request` coroutine until `http_await_resume` is called.
+ */
+int http_await(http_s *h, void (*task)(http_await_s *await, void *arg),
+               void *arg, void **result) {
+  http_await_s *co = http_coroutine_current;
+  if (!co || co->lost || co->h != h || !task || HTTP_INVALID_HANDLE(h))
+    return -1;
+  http_fio_protocol_s *p = (http_fio_protocol_s *)h->private_data.flag;
+  co->uuid = p->uuid;
+  co->task = task;
+  co->arg = arg;
+  co->result = NULL;
+  ((http_vtable_s *)h->private_data.vtbl)->http_on_pause(h, p);
+  swapcontext(&co->ctx, &co->caller);
+  if (co->lost)
+    return -1;
+  if (result)
+    *result = co->result;
+  return 0;
+}
+
+/** Resumes a coroutine suspended by `http_await`. */
+void http_await_resume(http_await_s *await, void *result) {
+  if (!await)
+    return;
+  await->result = result;
+  fio_defer_io_task(await->uuid, .udata = await, .type = FIO_PR_LOCK_TASK,
+                    .task = http_await_resume_wrapper,
+                    .fallback = http_await_resume_fallback);
+}
+
+typedef struct {
+  void *(*task)(void *arg);
+  void *arg;
+} http_await_task_s;
+
+/* performs a blocking task on the blocking task pool */
+static void http_await_task_perform(void *await, void *t_) {
+  http_await_task_s *t = t_;
+  http_await_resume(await, t->task(t->arg));
+}
+
+static void http_await_task_defer(http_await_s *await, void *t) {
+  fio_defer_blocking(http_await_task_perform, await, t);
+}
+
+/**
+ * Suspends the `on_request` coroutine while the (blocking) `task` is performed
+ * by the blocking task pool, returning the `task`'s result.
+ */
+void *http_await_task(http_s *h, void *(*task)(void *arg), void *arg) {
+  http_await_task_s t = {.task = task, .arg = arg};
+  void *result = NULL;
+  http_await_s *co = http_coroutine_current;
+  if (!co || (co->h != h && !co->lost))
+    return task(arg);
+  if (http_await(h, http_await_task_defer, &t, &result))
+    return NULL;
+  return result;
+}
+
+#else /* HTTP_COROUTINE_SUPPORT */
+
+/** Calls the `on_request` callback (within a coroutine, if enabled). */
+void http_coroutine_on_request(http_s *h, http_settings_s *settings) {
+  settings->on_request(h);
+}
+
+int http_await(http_s *h, void (*task)(http_await_s *await, void *arg),
+               void *arg, void **result) {
+  return -1;
+  (void)h;
+  (void)task;
+  (void)arg;
+  (void)result;
+}
+
+void http_await_resume(http_await_s *await, void *result) {
+  (void)await;
+  (void)result;
+}
+
+void *http_await_task(http_s *h, void *(*task)(void *arg), void *arg) {
+  return task(arg);
+  (void)h;
+}
+
+#endif /* HTTP_COROUTINE_SUPPORT */
+
 /* *****************************************************************************
 Setting the default settings and allocating a persistent copy
 ***************************************************************************** */
@@ -781,6 +2091,16 @@ static void http_on_upgrade_fallback(http_s *h, char *p, size_t i) {
 }
 static void http_on_response_fallback(http_s *h) { http_send_error(h, 400); }
 
+typedef struct http_client_pool_s http_client_pool_s;
+/* client connections store some data after their settings */
+typedef struct {
+  /* the protocol's original `on_close` (wrapped by `http_on_close_client`) */
+  void (*on_close)(intptr_t uuid, fio_protocol_s *protocol);
+  /* the connection's pool (if `reuse_connections` was set) */
+  http_client_pool_s *pool;
+} http_client_data_s;
+#define http_client_data(settings) ((http_client_data_s *)((settings) + 1))
+
 static http_settings_s *http_settings_new(http_settings_s arg_settings) {
   /* TODO: improve locality by unifying malloc to a single call */
   if (!arg_settings.on_request)
@@ -800,6 +2120,8 @@ static http_settings_s *http_settings_new(http_settings_s arg_settings) {
     arg_settings.ws_timeout = 40; /* defaults to 40 seconds */
   if (!arg_settings.max_header_size)
     arg_settings.max_header_size = 32 * 1024; /* defaults to 32Kib seconds */
+  if (!arg_settings.pipeline_limit)
+    arg_settings.pipeline_limit = HTTP_DEFAULT_PIPELINE_LIMIT;
   if (arg_settings.max_clients <= 0 ||
       (size_t)(arg_settings.max_clients + HTTP_BUSY_UNLESS_HAS_FDS) >
           fio_capa()) {
@@ -808,8 +2130,11 @@ static http_settings_s *http_settings_new(http_settings_s arg_settings) {
       arg_settings.max_clients -= HTTP_BUSY_UNLESS_HAS_FDS;
   }
 
-  http_settings_s *settings = malloc(sizeof(*settings) + sizeof(void *));
+  http_settings_s *settings =
+      malloc(sizeof(*settings) + sizeof(http_client_data_s));
+  FIO_ASSERT_ALLOC(settings);
   *settings = arg_settings;
+  *http_client_data(settings) = (http_client_data_s){.on_close = NULL};
 
   if (settings->public_folder) {
     settings->public_folder_length = strlen(settings->public_folder);
@@ -836,6 +2161,8 @@ static http_settings_s *http_settings_new(http_settings_s arg_settings) {
 }
 
 static void http_settings_free(http_settings_s *s) {
+  if (s->cache_ttl)
+    http_cache_clear(s);
   free((void *)s->public_folder);
   free(s);
 }
@@ -863,6 +2190,25 @@ static void http_on_server_protocol_http1(intptr_t uuid, void *set,
   (void)ignr_;
 }
 
+#if HTTP_ENABLE_HTTP2
+static void http_on_server_protocol_http2(intptr_t uuid, void *set,
+                                          void *ignr_) {
+  fio_timeout_set(uuid, ((http_settings_s *)set)->timeout);
+  if (fio_uuid2fd(uuid) >= ((http_settings_s *)set)->max_clients) {
+    if (!fio_http_at_capa)
+      FIO_LOG_WARNING("HTTP server at capacity");
+    fio_http_at_capa = 1;
+    fio_close(uuid);
+    return;
+  }
+  fio_http_at_capa = 0;
+  fio_protocol_s *pr = http2_new(uuid, set, NULL, 0);
+  if (!pr)
+    fio_close(uuid);
+  (void)ignr_;
+}
+#endif
+
 static void http_on_open(intptr_t uuid, void *set) {
   http_on_server_protocol_http1(uuid, set, NULL);
 }
@@ -896,14 +2242,25 @@ intptr_t http_listen(const char *port, const char *binding,
 
   http_settings_s *settings = http_settings_new(arg_settings);
   settings->is_client = 0;
+#if !HAVE_ZLIB
+  if (settings->compress_static) {
+    FIO_LOG_WARNING(
+        "(HTTP) compress_static requires zlib (HAVE_ZLIB), ignored.");
+    settings->compress_static = 0;
+  }
+#endif
   if (settings->tls) {
     fio_tls_alpn_add(settings->tls, "http/1.1", http_on_server_protocol_http1,
                      NULL, NULL);
+#if HTTP_ENABLE_HTTP2
+    fio_tls_alpn_add(settings->tls, "h2", http_on_server_protocol_http2, NULL,
+                     NULL);
+#endif
   }
 
   return fio_listen(.port = port, .address = binding, .tls = arg_settings.tls,
                     .on_finish = http_on_finish, .on_open = http_on_open,
-                    .udata = settings);
+                    .udata = settings, .reuse_port = arg_settings.reuse_port);
 }
 /** Listens to HTTP connections at the specified `port` and `binding`. */
 #define http_listen(port, binding, ...)                                        \
@@ -929,20 +2286,30 @@ fio_str_info_s http_peer_addr(http_s *h) {
 HTTP client connections
 ***************************************************************************** */
 
+static void http_client_pool_remove(http_client_pool_s *pool, intptr_t uuid);
+static int http_client_pool_is_idle(http_settings_s *set);
+
 static void http_on_close_client(intptr_t uuid, fio_protocol_s *protocol) {
   http_fio_protocol_s *p = (http_fio_protocol_s *)protocol;
   http_settings_s *set = p->settings;
-  void (**original)(intptr_t, fio_protocol_s *) =
-      (void (**)(intptr_t, fio_protocol_s *))(set + 1);
+  void (*original)(intptr_t, fio_protocol_s *) =
+      http_client_data(set)->on_close;
+  if (http_client_pool_is_idle(set)) {
+    /* an idle pooled connection, the settings belong to the pool */
+    http_client_pool_remove(http_client_data(set)->pool, uuid);
+    original(uuid, protocol);
+    return;
+  }
   if (set->on_finish)
     set->on_finish(set);
 
-  original[0](uuid, protocol);
+  original(uuid, protocol);
   http_settings_free(set);
 }
 
 static void http_on_open_client_perform(http_settings_s *set) {
   http_s *h = set->udata;
+  set->udata = h->udata; /* the response's `udata` */
   set->on_response(h);
 }
 static void http_on_open_client_http1(intptr_t uuid, void *set_,
@@ -955,12 +2322,9 @@ static void http_on_open_client_http1(intptr_t uuid, void *set_,
     fio_close(uuid);
     return;
   }
-  { /* store the original on_close at the end of the struct, we wrap it. */
-    void (**original)(intptr_t, fio_protocol_s *) =
-        (void (**)(intptr_t, fio_protocol_s *))(set + 1);
-    *original = pr->on_close;
-    pr->on_close = http_on_close_client;
-  }
+  /* store the original on_close at the end of the struct, we wrap it. */
+  http_client_data(set)->on_close = pr->on_close;
+  pr->on_close = http_on_close_client;
   h->private_data.flag = (uintptr_t)pr;
   h->private_data.vtbl = http1_vtable();
   http_on_open_client_perform(set);
@@ -983,6 +2347,199 @@ static void http_on_client_failed(intptr_t uuid, void *set_) {
   (void)uuid;
 }
 
+/* *****************************************************************************
+HTTP client connection pooling (`reuse_connections`)
+***************************************************************************** */
+
+struct http_client_pool_s {
+  /* the origin's identifier (TLS object, address, port) */
+  FIOBJ key;
+  char *address;
+  char *port;
+  void *tls;
+  /* the settings used by idle connections (mostly to reject data) */
+  http_settings_s *settings;
+  /* idle connections, the most recently used is reused first */
+  size_t count;
+  intptr_t idle[HTTP_CLIENT_POOL_LIMIT];
+};
+
+#define FIO_SET_NAME http_client_pool_set
+#define FIO_SET_OBJ_TYPE http_client_pool_s *
+#define FIO_SET_OBJ_COMPARE(o1, o2) fiobj_iseq((o1)->key, (o2)->key)
+#include <fio.h>
+
+static struct {
+  http_client_pool_set_s set;
+  fio_lock_i lock;
+} http_client_pools = {
+    .set = FIO_SET_INIT,
+    .lock = FIO_LOCK_INIT,
+};
+
+/* idle connections don't expect any data */
+static void http_client_pool_on_unexpected(http_s *h) {
+  fio_close(((http_fio_protocol_s *)h->private_data.flag)->uuid);
+}
+static void http_client_pool_on_unexpected_upgrade(http_s *h, char *p,
+                                                   size_t i) {
+  http_client_pool_on_unexpected(h);
+  (void)p;
+  (void)i;
+}
+
+/* tests if the settings belong to an idle connection's pool */
+static int http_client_pool_is_idle(http_settings_s *set) {
+  return http_client_data(set)->pool &&
+         http_client_data(set)->pool->settings == set;
+}
+
+/* finds (or creates) the origin's pool */
+static http_client_pool_s *http_client_pool_get(const char *address,
+                                                const char *port, void *tls,
+                                                http_settings_s *set) {
+  http_client_pool_s tmp = {.key = fiobj_str_buf(64)};
+  fiobj_str_printf(tmp.key, "%p|%s|%s", tls, address, (port ? port : ""));
+  const uint64_t hash = fiobj_obj2hash(tmp.key);
+  fio_lock(&http_client_pools.lock);
+  http_client_pool_s *pool =
+      http_client_pool_set_find(&http_client_pools.set, hash, &tmp);
+  if (pool) {
+    fio_unlock(&http_client_pools.lock);
+    fiobj_free(tmp.key);
+    return pool;
+  }
+  const size_t addr_len = strlen(address);
+  const size_t port_len = port ? strlen(port) : 0;
+  pool = malloc(sizeof(*pool) + addr_len + port_len + 2);
+  FIO_ASSERT_ALLOC(pool);
+  *pool = (http_client_pool_s){
+      .key = tmp.key,
+      .address = (char *)(pool + 1),
+      .port = (port ? (char *)(pool + 1) + addr_len + 1 : NULL),
+      .tls = tls,
+  };
+  memcpy(pool->address, address, addr_len + 1);
+  if (port)
+    memcpy(pool->port, port, port_len + 1);
+  {
+    http_settings_s idle = *set;
+    idle.on_response = http_client_pool_on_unexpected;
+    idle.on_upgrade = http_client_pool_on_unexpected_upgrade;
+    idle.on_finish = NULL;
+    idle.udata = pool;
+    idle.public_folder = NULL;
+    pool->settings = http_settings_new(idle);
+    http_client_data(pool->settings)->pool = pool;
+  }
+  http_client_pool_set_insert(&http_client_pools.set, hash, pool);
+  fio_unlock(&http_client_pools.lock);
+  return pool;
+}
+
+/* returns an idle connection or -1 */
+static intptr_t http_client_pool_pop(http_client_pool_s *pool) {
+  intptr_t uuid = -1;
+  fio_lock(&http_client_pools.lock);
+  while (pool->count) {
+    uuid = pool->idle[--pool->count];
+    if (fio_is_valid(uuid) && !fio_is_closed(uuid))
+      break;
+    uuid = -1;
+  }
+  fio_unlock(&http_client_pools.lock);
+  return uuid;
+}
+
+/* removes a closed connection from the pool */
+static void http_client_pool_remove(http_client_pool_s *pool, intptr_t uuid) {
+  fio_lock(&http_client_pools.lock);
+  for (size_t i = 0; i < pool->count; ++i) {
+    if (pool->idle[i] != uuid)
+      continue;
+    --pool->count;
+    memmove(pool->idle + i, pool->idle + i + 1,
+            (pool->count - i) * sizeof(*pool->idle));
+    break;
+  }
+  fio_unlock(&http_client_pools.lock);
+}
+
+/** Frees the client connection pools (idle connections should be closed). */
+void http_client_pool_clear(void) {
+  fio_lock(&http_client_pools.lock);
+  FIO_SET_FOR_LOOP(&http_client_pools.set, pos) {
+    if (!pos->hash)
+      continue;
+    fiobj_free(pos->obj->key);
+    http_settings_free(pos->obj->settings);
+    free(pos->obj);
+  }
+  http_client_pool_set_free(&http_client_pools.set);
+  fio_unlock(&http_client_pools.lock);
+}
+
+/* opens a new connection for the request */
+static intptr_t http_client_pool_connect(http_settings_s *set) {
+  http_client_pool_s *pool = http_client_data(set)->pool;
+  return fio_connect(.address = pool->address, .port = pool->port,
+                     .on_fail = http_on_client_failed,
+                     .on_connect = http_on_open_client, .udata = set,
+                     .tls = pool->tls);
+}
+
+/* the pooled connection was lost before it could be reused */
+static void http_client_pool_reuse_failed(intptr_t uuid, void *set_) {
+  http_client_pool_connect(set_);
+  (void)uuid;
+}
+
+/* hands an idle connection over to a new request */
+static void http_client_pool_reuse(intptr_t uuid, fio_protocol_s *protocol,
+                                   void *set_) {
+  http_settings_s *set = set_;
+  http_fio_protocol_s *pr = (http_fio_protocol_s *)protocol;
+  http_client_pool_s *pool = http_client_data(set)->pool;
+  if (protocol->on_close != http_on_close_client ||
+      pr->settings != pool->settings || fio_is_closed(uuid)) {
+    http_client_pool_connect(set);
+    return;
+  }
+  http_client_data(set)->on_close = http_client_data(pr->settings)->on_close;
+  pr->settings = set;
+  fio_timeout_set(uuid, set->timeout);
+  http_s *h = set->udata;
+  h->private_data.flag = (uintptr_t)pr;
+  h->private_data.vtbl = http1_vtable();
+  http_on_open_client_perform(set);
+}
+
+/**
+ * Called once a client connection's response was handled, if the connection
+ * can be reused (HTTP/1.1 keep-alive).
+ */
+void http_client_release(http_fio_protocol_s *pr) {
+  http_settings_s *set = pr->settings;
+  http_client_pool_s *pool = http_client_data(set)->pool;
+  if (!pool || pool->settings == set ||
+      pr->protocol.on_close != http_on_close_client)
+    return;
+  fio_lock(&http_client_pools.lock);
+  if (pool->count == HTTP_CLIENT_POOL_LIMIT) {
+    fio_unlock(&http_client_pools.lock);
+    fio_close(pr->uuid);
+    return;
+  }
+  http_client_data(pool->settings)->on_close = http_client_data(set)->on_close;
+  pr->settings = pool->settings;
+  pool->idle[pool->count++] = pr->uuid;
+  fio_unlock(&http_client_pools.lock);
+  fio_timeout_set(pr->uuid, HTTP_CLIENT_POOL_TIMEOUT);
+  if (set->on_finish)
+    set->on_finish(set);
+  http_settings_free(set);
+}
+
 intptr_t http_connect__(void); /* sublime text marker */
 /**
  * Connects to an HTTP server as a client.
@@ -1104,7 +2661,18 @@ intptr_t http_connect FIO_IGNORE_MACRO(const char *url,
     http_set_header2(h, (fio_str_info_s){.data = (char *)"host", .len = 4},
                      (fio_str_info_s){.data = host, .len = h_len});
   intptr_t ret;
-  if (is_websocket) {
+  if (settings->reuse_connections && !is_websocket) {
+    http_client_data(settings)->pool =
+        http_client_pool_get(a, p, arg_settings.tls, settings);
+    ret = http_client_pool_pop(http_client_data(settings)->pool);
+    if (ret == -1)
+      ret = http_client_pool_connect(settings);
+    else
+      fio_defer_io_task(ret, .type = FIO_PR_LOCK_TASK,
+                        .task = http_client_pool_reuse,
+                        .fallback = http_client_pool_reuse_failed,
+                        .udata = settings);
+  } else if (is_websocket) {
     /* force HTTP/1.1 */
     ret = fio_connect(.address = a, .port = p, .on_fail = http_on_client_failed,
                       .on_connect = http_on_open_client, .udata = settings,
@@ -1196,6 +2764,56 @@ static inline void http_sse_copy2str(FIOBJ dest, char *prefix, size_t pre_len,
   }
 }
 
+/* *****************************************************************************
+SSE broadcast optimizations
+***************************************************************************** */
+
+/* the pub/sub metadata type for pre-formatted (direct) SSE messages */
+#define HTTP_SSE_OPTIMIZE_PUBSUB (-40)
+
+static void http_sse_optimize_free(fio_msg_s *msg, void *metadata) {
+  fiobj_free((FIOBJ)metadata);
+  (void)msg;
+}
+
+/* formats a message once, for all direct SSE subscriptions */
+static fio_msg_metadata_s http_sse_optimize(fio_str_info_s ch,
+                                            fio_str_info_s msg,
+                                            uint8_t is_json) {
+  fio_msg_metadata_s ret = {
+      .type_id = HTTP_SSE_OPTIMIZE_PUBSUB,
+      .on_finish = http_sse_optimize_free,
+  };
+  if (!msg.len)
+    return ret;
+  FIOBJ out = fiobj_str_buf(msg.len + 10);
+  http_sse_copy2str(out, (char *)"data: ", 6, msg);
+  fiobj_str_write(out, "\r\n", 2);
+  ret.metadata = (void *)out;
+  return ret;
+  (void)ch;
+  (void)is_json;
+}
+
+/* enables (or disables) the broadcast optimization (reference counted) */
+static void http_sse_optimize4broadcasts(int enable) {
+  static intptr_t count = 0;
+  if (enable) {
+    if (fio_atomic_add(&count, 1) == 1)
+      fio_message_metadata_callback_set(http_sse_optimize, 1);
+  } else {
+    if (fio_atomic_sub(&count, 1) == 0)
+      fio_message_metadata_callback_set(http_sse_optimize, 0);
+  }
+}
+
+/* *****************************************************************************
+SSE subscriptions
+***************************************************************************** */
+
+static void http_sse_on_message__direct(http_sse_s *sse, fio_str_info_s channel,
+                                        fio_str_info_s msg, void *udata);
+
 /** The on message callback. the `*msg` pointer is to a temporary object. */
 static void http_sse_on_message(fio_msg_s *msg) {
   http_sse_internal_s *sse = msg->udata1;
@@ -1204,7 +2822,15 @@ static void http_sse_on_message(fio_msg_s *msg) {
   fio_protocol_s *pr = fio_protocol_try_lock(sse->uuid, FIO_PR_LOCK_TASK);
   if (!pr)
     goto postpone;
-  args->on_message(&sse->sse, msg->channel, msg->msg, args->udata);
+  FIOBJ pre_formatted = FIOBJ_INVALID;
+  if (args->on_message == http_sse_on_message__direct)
+    pre_formatted = (FIOBJ)fio_message_metadata(msg, HTTP_SSE_OPTIMIZE_PUBSUB);
+  if (pre_formatted) {
+    /* the formatted message is shared by all the (direct) subscribers */
+    (sse->vtable->http_sse_write)(&sse->sse, fiobj_dup(pre_formatted));
+  } else {
+    args->on_message(&sse->sse, msg->channel, msg->msg, args->udata);
+  }
   fio_protocol_unlock(pr, FIO_PR_LOCK_TASK);
   return;
 postpone:
@@ -1226,6 +2852,8 @@ static void http_sse_on_unsubscribe(void *sse_, void *args_) {
   struct http_sse_subscribe_args *args = args_;
   if (args->on_unsubscribe)
     args->on_unsubscribe(args->udata);
+  if (args->on_message == http_sse_on_message__direct)
+    http_sse_optimize4broadcasts(0);
   fio_free(args);
   http_sse_try_free(sse);
 }
@@ -1250,8 +2878,10 @@ uintptr_t http_sse_subscribe(http_sse_s *sse_,
   http_sse_internal_s *sse = FIO_LS_EMBD_OBJ(http_sse_internal_s, sse, sse_);
   if (sse->uuid == -1)
     return 0;
-  if (!args.on_message)
+  if (!args.on_message) {
     args.on_message = http_sse_on_message__direct;
+    http_sse_optimize4broadcasts(1);
+  }
   struct http_sse_subscribe_args *udata = fio_malloc(sizeof(*udata));
   FIO_ASSERT_ALLOC(udata);
   *udata = args;
@@ -1427,37 +3057,85 @@ static inline FIOBJ http_str2fiobj(char *s, size_t len, uint8_t encoded) {
   return fiobj_str_new(s, len);
 }
 
-/** Parses the query part of an HTTP request/response. Uses `http_add2hash`. */
-void http_parse_query(http_s *h) {
-  if (!h->query)
-    return;
-  if (!h->params)
-    h->params = fiobj_hash_new();
-  fio_str_info_s q = fiobj_obj2cstr(h->query);
-  do {
-    char *cut = memchr(q.data, '&', q.len);
-    if (!cut)
-      cut = q.data + q.len;
-    char *cut2 = memchr(q.data, '=', (cut - q.data));
-    if (cut2) {
-      /* we only add named elements... */
-      http_add2hash(h->params, q.data, (size_t)(cut2 - q.data), (cut2 + 1),
-                    (size_t)(cut - (cut2 + 1)), 1);
+/** Tests a (possibly encoded) parameter name against the requested name. */
+static inline int http_lazy_name_eq(char *name, size_t len, uint8_t encoded,
+                                    const char *only, size_t only_len) {
+  if (!encoded)
+    return len == only_len && !memcmp(name, only, len);
+  if (len < only_len)
+    return 0;
+  FIOBJ tmp = http_urlstr2fiobj(name, len);
+  fio_str_info_s t = fiobj_obj2cstr(tmp);
+  int ret = t.len == only_len && !memcmp(t.data, only, only_len);
+  fiobj_free(tmp);
+  return ret;
+}
+
+/**
+ * Adds the `name=value` pairs in the URL encoded String to `dest`.
+ *
+ * If `only` is set, only pairs named `only` are added (see `http_param_get`).
+ */
+static void http_parse_query_str(FIOBJ dest, fio_str_info_s q,
+                                 const char *only, size_t only_len) {
+  char *pos = q.data;
+  char *const end = q.data + q.len;
+  while (pos < end) {
+    /* a single pass finds the delimiters and notes any escaped bytes */
+    char *const name = pos;
+    char *eq = NULL;
+    uint8_t name_encoded = 0;
+    uint8_t value_encoded = 0;
+    while ((pos = http_seek4(pos, end, '&', '=', '%', '+')) < end &&
+           *pos != '&') {
+      if (*pos == '=' && !eq)
+        eq = pos;
+      else if (*pos != '=') {
+        if (eq)
+          value_encoded = 1;
+        else
+          name_encoded = 1;
+      }
+      ++pos;
+    }
+    if (eq && (!only || http_lazy_name_eq(name, (size_t)(eq - name),
+                                          name_encoded, only, only_len))) {
+      /* we only add named elements... (unescaped Strings aren't decoded) */
+      http_add2hash2(dest, name, (size_t)(eq - name),
+                     http_str2fiobj(eq + 1, (size_t)(pos - (eq + 1)),
+                                    value_encoded),
+                     name_encoded);
     }
-    if (cut[0] == '&') {
+    if (pos < end) {
       /* protecting against some ...less informed... clients */
-      if (cut[1] == 'a' && cut[2] == 'm' && cut[3] == 'p' && cut[4] == ';')
-        cut += 5;
+      if (end - pos >= 5 && pos[1] == 'a' && pos[2] == 'm' && pos[3] == 'p' &&
+          pos[4] == ';')
+        pos += 5;
       else
-        cut += 1;
+        pos += 1;
     }
-    q.len -= (uintptr_t)(cut - q.data);
-    q.data = cut;
-  } while (q.len);
+  }
+}
+
+static void http_parse_query___internal(http_s *h) {
+  if (!h->query)
+    return;
+  if (!h->params)
+    h->params = fiobj_hash_new();
+  http_parse_query_str(h->params, fiobj_obj2cstr(h->query), NULL, 0);
+}
+
+/** Parses the query part of an HTTP request/response. Uses `http_add2hash`. */
+void http_parse_query(http_s *h) {
+  fiobj_arena_s *old = http_arena_enter(h);
+  http_parse_query___internal(h);
+  fiobj_arena_enter(old);
 }
 
 static inline void http_parse_cookies_cookie_str(FIOBJ dest, FIOBJ str,
-                                                 uint8_t is_url_encoded) {
+                                                 uint8_t is_url_encoded,
+                                                 const char *only,
+                                                 size_t only_len) {
   if (!FIOBJ_TYPE_IS(str, FIOBJ_T_STRING))
     return;
   fio_str_info_s s = fiobj_obj2cstr(str);
@@ -1473,8 +3151,10 @@ static inline void http_parse_cookies_cookie_str(FIOBJ dest, FIOBJ str,
     char *cut2 = memchr(cut, ';', s.len - (cut - s.data));
     if (!cut2)
       cut2 = s.data + s.len;
-    http_add2hash(dest, s.data, cut - s.data, cut + 1, (cut2 - (cut + 1)),
-                  is_url_encoded);
+    if (!only || ((size_t)(cut - s.data) == only_len &&
+                  !memcmp(s.data, only, only_len)))
+      http_add2hash(dest, s.data, cut - s.data, cut + 1, (cut2 - (cut + 1)),
+                    is_url_encoded);
     if ((size_t)((cut2 + 1) - s.data) > s.len)
       s.len = 0;
     else
@@ -1483,7 +3163,9 @@ static inline void http_parse_cookies_cookie_str(FIOBJ dest, FIOBJ str,
   }
 }
 static inline void http_parse_cookies_setcookie_str(FIOBJ dest, FIOBJ str,
-                                                    uint8_t is_url_encoded) {
+                                                    uint8_t is_url_encoded,
+                                                    const char *only,
+                                                    size_t only_len) {
   if (!FIOBJ_TYPE_IS(str, FIOBJ_T_STRING))
     return;
   fio_str_info_s s = fiobj_obj2cstr(str);
@@ -1493,56 +3175,150 @@ static inline void http_parse_cookies_setcookie_str(FIOBJ dest, FIOBJ str,
   char *cut2 = memchr(cut, ';', s.len - (cut - s.data));
   if (!cut2)
     cut2 = s.data + s.len;
+  if (only && ((size_t)(cut - s.data) != only_len ||
+               memcmp(s.data, only, only_len)))
+    return;
   if (cut2 > cut)
     http_add2hash(dest, s.data, cut - s.data, cut + 1, (cut2 - (cut + 1)),
                   is_url_encoded);
 }
 
-/** Parses any Cookie / Set-Cookie headers, using the `http_add2hash` scheme. */
-void http_parse_cookies(http_s *h, uint8_t is_url_encoded) {
-  if (!h->headers)
-    return;
-  if (h->cookies && fiobj_hash_count(h->cookies)) {
-    FIO_LOG_WARNING("(http) attempting to parse cookies more than once.");
-    return;
-  }
-  static uint64_t setcookie_header_hash;
-  if (!setcookie_header_hash)
-    setcookie_header_hash = fiobj_obj2hash(HTTP_HEADER_SET_COOKIE);
+/**
+ * Adds the Cookie / Set-Cookie header values to `*dest` (initializing the Hash
+ * if required).
+ *
+ * If `only` is set, only cookies named `only` are added (see `http_cookie_get`).
+ */
+static void http_parse_cookies_headers(FIOBJ *dest, http_s *h,
+                                       uint8_t is_url_encoded,
+                                       const char *only, size_t only_len) {
   FIOBJ c = fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_COOKIE));
   if (c) {
-    if (!h->cookies)
-      h->cookies = fiobj_hash_new();
+    if (!*dest)
+      *dest = fiobj_hash_new();
     if (FIOBJ_TYPE_IS(c, FIOBJ_T_ARRAY)) {
       /* Array of Strings */
       size_t count = fiobj_ary_count(c);
       for (size_t i = 0; i < count; ++i) {
-        http_parse_cookies_cookie_str(
-            h->cookies, fiobj_ary_index(c, (int64_t)i), is_url_encoded);
+        http_parse_cookies_cookie_str(*dest, fiobj_ary_index(c, (int64_t)i),
+                                      is_url_encoded, only, only_len);
       }
     } else {
       /* single string */
-      http_parse_cookies_cookie_str(h->cookies, c, is_url_encoded);
+      http_parse_cookies_cookie_str(*dest, c, is_url_encoded, only, only_len);
     }
   }
   c = fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_SET_COOKIE));
   if (c) {
-    if (!h->cookies)
-      h->cookies = fiobj_hash_new();
+    if (!*dest)
+      *dest = fiobj_hash_new();
     if (FIOBJ_TYPE_IS(c, FIOBJ_T_ARRAY)) {
       /* Array of Strings */
       size_t count = fiobj_ary_count(c);
       for (size_t i = 0; i < count; ++i) {
-        http_parse_cookies_setcookie_str(
-            h->cookies, fiobj_ary_index(c, (int64_t)i), is_url_encoded);
+        http_parse_cookies_setcookie_str(*dest, fiobj_ary_index(c, (int64_t)i),
+                                         is_url_encoded, only, only_len);
       }
     } else {
       /* single string */
-      http_parse_cookies_setcookie_str(h->cookies, c, is_url_encoded);
+      http_parse_cookies_setcookie_str(*dest, c, is_url_encoded, only,
+                                       only_len);
     }
   }
 }
 
+static void http_parse_cookies___internal(http_s *h, uint8_t is_url_encoded) {
+  if (!h->headers)
+    return;
+  if (h->cookies && fiobj_hash_count(h->cookies)) {
+    FIO_LOG_WARNING("(http) attempting to parse cookies more than once.");
+    return;
+  }
+  http_parse_cookies_headers(&h->cookies, h, is_url_encoded, NULL, 0);
+}
+
+/** Parses any Cookie / Set-Cookie headers, using the `http_add2hash` scheme. */
+void http_parse_cookies(http_s *h, uint8_t is_url_encoded) {
+  fiobj_arena_s *old = http_arena_enter(h);
+  http_parse_cookies___internal(h, is_url_encoded);
+  fiobj_arena_enter(old);
+}
+
+/* *****************************************************************************
+Lazy (single key) parsing
+***************************************************************************** */
+
+/** Tests for a plain name (nested names require the full parsing scheme). */
+static inline int http_lazy_name_valid(const char *name, size_t len) {
+  return name && len && name[0] != '[' && name[len - 1] != ']' &&
+         !memchr(name, '[', len);
+}
+
+/** Tests for a URL encoded body. */
+static inline int http_body_is_urlencoded(http_s *h) {
+  FIOBJ ct =
+      fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_CONTENT_TYPE));
+  fio_str_info_s content_type = fiobj_obj2cstr(ct);
+  return content_type.len >= 33 &&
+         !strncasecmp("application/x-www-form-urlencoded", content_type.data,
+                      33);
+}
+
+/**
+ * Returns the value of a single parameter, scanning the query and the URL
+ * encoded body (if any) for the named parameter alone.
+ */
+FIOBJ http_param_get(http_s *h, const char *name, size_t name_len) {
+  if (HTTP_INVALID_HANDLE(h) || !http_lazy_name_valid(name, name_len))
+    return FIOBJ_INVALID;
+  const uint64_t hash = fiobj_hash_string(name, name_len);
+  FIOBJ val;
+  if (h->params && (val = fiobj_hash_get2(h->params, hash)))
+    return val;
+  if (h->private_data.lazy_params &&
+      (val = fiobj_hash_get2(h->private_data.lazy_params, hash)))
+    return val;
+  const uint8_t has_body = h->body && h->headers && http_body_is_urlencoded(h);
+  if (!h->query && !has_body)
+    return FIOBJ_INVALID;
+  fiobj_arena_s *old = http_arena_enter(h);
+  if (!h->private_data.lazy_params)
+    h->private_data.lazy_params = fiobj_hash_new();
+  /* the body is parsed first, matching `http_parse_body` / `http_parse_query` */
+  if (has_body)
+    http_parse_query_str(h->private_data.lazy_params, fiobj_obj2cstr(h->body),
+                         name, name_len);
+  if (h->query)
+    http_parse_query_str(h->private_data.lazy_params, fiobj_obj2cstr(h->query),
+                         name, name_len);
+  fiobj_arena_enter(old);
+  return fiobj_hash_get2(h->private_data.lazy_params, hash);
+}
+
+/**
+ * Returns the value of a single cookie, scanning the Cookie / Set-Cookie
+ * headers for the named cookie alone.
+ */
+FIOBJ http_cookie_get(http_s *h, const char *name, size_t name_len) {
+  if (HTTP_INVALID_HANDLE(h) || !h->headers ||
+      !http_lazy_name_valid(name, name_len))
+    return FIOBJ_INVALID;
+  const uint64_t hash = fiobj_hash_string(name, name_len);
+  FIOBJ val;
+  if (h->cookies && (val = fiobj_hash_get2(h->cookies, hash)))
+    return val;
+  if (h->private_data.lazy_cookies &&
+      (val = fiobj_hash_get2(h->private_data.lazy_cookies, hash)))
+    return val;
+  fiobj_arena_s *old = http_arena_enter(h);
+  http_parse_cookies_headers(&h->private_data.lazy_cookies, h, 0, name,
+                             name_len);
+  fiobj_arena_enter(old);
+  if (!h->private_data.lazy_cookies)
+    return FIOBJ_INVALID;
+  return fiobj_hash_get2(h->private_data.lazy_cookies, hash);
+}
+
 /**
  * Adds a named parameter to the hash, resolving nesting references.
  *
@@ -1769,6 +3545,9 @@ typedef struct {
   size_t partial_offset;
   size_t partial_length;
   FIOBJ partial_name;
+  /* the partial data's target object, used by the streaming parser */
+  FIOBJ partial;
+  uint8_t stream;
 } http_fio_mime_s;
 
 #define http_mime_parser2fio(parser) ((http_fio_mime_s *)(parser))
@@ -1812,8 +3591,11 @@ static void http_mime_parser_on_partial_start(
   http_mime_parser2fio(parser)->partial_offset = 0;
   http_mime_parser2fio(parser)->partial_name = fiobj_str_new(name, name_len);
 
-  if (!filename)
+  if (!filename) {
+    if (http_mime_parser2fio(parser)->stream)
+      http_mime_parser2fio(parser)->partial = fiobj_str_buf(0);
     return;
+  }
 
   fiobj_str_write(http_mime_parser2fio(parser)->partial_name, "[type]", 6);
   fio_str_info_s tmp =
@@ -1829,11 +3611,23 @@ static void http_mime_parser_on_partial_start(
 
   fiobj_str_resize(http_mime_parser2fio(parser)->partial_name, name_len);
   fiobj_str_write(http_mime_parser2fio(parser)->partial_name, "[data]", 6);
+  if (http_mime_parser2fio(parser)->stream) {
+    /* uploaded files are written directly to a temporary file */
+    http_mime_parser2fio(parser)->partial = fiobj_data_newtmpfile();
+  }
 }
 
 /** Called when partial data is available. */
 static void http_mime_parser_on_partial_data(http_mime_parser_s *parser,
                                              void *value, size_t value_len) {
+  if (http_mime_parser2fio(parser)->stream) {
+    if (FIOBJ_TYPE_IS(http_mime_parser2fio(parser)->partial, FIOBJ_T_STRING))
+      fiobj_str_write(http_mime_parser2fio(parser)->partial, value, value_len);
+    else
+      fiobj_data_write(http_mime_parser2fio(parser)->partial, value, value_len);
+    http_mime_parser2fio(parser)->partial_length += value_len;
+    return;
+  }
   if (!http_mime_parser2fio(parser)->partial_offset)
     http_mime_parser2fio(parser)->partial_offset =
         http_mime_parser2fio(parser)->pos +
@@ -1849,9 +3643,12 @@ static void http_mime_parser_on_partial_end(http_mime_parser_s *parser) {
   fio_str_info_s tmp =
       fiobj_obj2cstr(http_mime_parser2fio(parser)->partial_name);
   FIOBJ o = FIOBJ_INVALID;
-  if (!http_mime_parser2fio(parser)->partial_length)
-    return;
-  if (http_mime_parser2fio(parser)->partial_length < 42) {
+  if (http_mime_parser2fio(parser)->stream) {
+    o = http_mime_parser2fio(parser)->partial;
+    http_mime_parser2fio(parser)->partial = FIOBJ_INVALID;
+  } else if (!http_mime_parser2fio(parser)->partial_length) {
+    goto finish;
+  } else if (http_mime_parser2fio(parser)->partial_length < 42) {
     /* short data gets a new object */
     o = fiobj_str_new(http_mime_parser2fio(parser)->buffer.data +
                           http_mime_parser2fio(parser)->partial_offset,
@@ -1864,6 +3661,7 @@ static void http_mime_parser_on_partial_end(http_mime_parser_s *parser) {
   }
   http_add2hash2(http_mime_parser2fio(parser)->h->params, tmp.data, tmp.len, o,
                  0);
+finish:
   fiobj_free(http_mime_parser2fio(parser)->partial_name);
   http_mime_parser2fio(parser)->partial_name = FIOBJ_INVALID;
   http_mime_parser2fio(parser)->partial_offset = 0;
@@ -1881,21 +3679,11 @@ static inline size_t http_mime_decode_url(char *dest, const char *encoded,
   return http_decode_url(dest, encoded, length);
 }
 
-/**
- * Attempts to decode the request's body.
- *
- * Supported Types include:
- * * application/x-www-form-urlencoded
- * * application/json
- * * multipart/form-data
- */
-int http_parse_body(http_s *h) {
-  static uint64_t content_type_hash;
+static int http_parse_body___internal(http_s *h) {
   if (!h->body)
     return -1;
-  if (!content_type_hash)
-    content_type_hash = fiobj_hash_string("content-type", 12);
-  FIOBJ ct = fiobj_hash_get2(h->headers, content_type_hash);
+  FIOBJ ct =
+      fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_CONTENT_TYPE));
   fio_str_info_s content_type = fiobj_obj2cstr(ct);
   if (content_type.len < 16)
     return -1;
@@ -1935,6 +3723,8 @@ int http_parse_body(http_s *h) {
 
   do {
     size_t cons = http_mime_parse(&p.p, p.buffer.data, p.buffer.len);
+    if (!cons && p.buffer.len)
+      break; /* no progress, the data is truncated */
     p.pos += cons;
     p.buffer = fiobj_data_pread(h->body, p.pos, 4096);
   } while (p.buffer.data && !p.p.done && !p.p.error);
@@ -1943,6 +3733,135 @@ int http_parse_body(http_s *h) {
   return 0;
 }
 
+/**
+ * Attempts to decode the request's body.
+ *
+ * Supported Types include:
+ * * application/x-www-form-urlencoded
+ * * application/json
+ * * multipart/form-data
+ */
+int http_parse_body(http_s *h) {
+  fiobj_arena_s *old = http_arena_enter(h);
+  int ret = http_parse_body___internal(h);
+  fiobj_arena_enter(old);
+  return ret;
+}
+
+/* *****************************************************************************
+HTTP Body Parsing - streaming multipart uploads
+***************************************************************************** */
+
+/* the minimal buffer required for parsing the multipart headers */
+#define HTTP_UPLOAD_MIN_BUFFER 4096
+
+struct http_upload_s {
+  http_fio_mime_s p;
+  /* keeps the boundary (in the Content-Type header) alive */
+  FIOBJ content_type;
+  /* unconsumed data (the parser requires the complete part headers) */
+  FIOBJ leftover;
+};
+
+/**
+ * Returns a streaming parser if the request's body is `multipart/form-data`,
+ * otherwise returns NULL.
+ */
+http_upload_s *http_upload_new(http_s *h) {
+  FIOBJ ct =
+      fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_CONTENT_TYPE));
+  fio_str_info_s content_type = fiobj_obj2cstr(ct);
+  http_mime_parser_s parser;
+  if (http_mime_parser_init(&parser, content_type.data, content_type.len))
+    return NULL;
+  http_upload_s *u = fio_malloc(sizeof(*u));
+  FIO_ASSERT_ALLOC(u);
+  *u = (http_upload_s){.p = {.p = parser, .h = h, .stream = 1}};
+  u->content_type = fiobj_dup(ct);
+  u->leftover = fiobj_str_buf(HTTP_UPLOAD_MIN_BUFFER);
+  fiobj_arena_s *old = http_arena_enter(h);
+  if (!h->params)
+    h->params = fiobj_hash_new();
+  fiobj_arena_enter(old);
+  return u;
+}
+
+/* parses the data, returning the number of bytes consumed (or -1) */
+static ssize_t http_upload_parse(http_upload_s *u, char *data, size_t len,
+                                 uint8_t is_last) {
+  if (!u->p.p.in_obj && len < HTTP_UPLOAD_MIN_BUFFER && !is_last)
+    return 0; /* wait for the complete headers */
+  fiobj_arena_s *old = http_arena_enter(u->p.h);
+  size_t consumed = http_mime_parse(&u->p.p, data, len);
+  fiobj_arena_enter(old);
+  if (u->p.p.error ||
+      (!consumed && !u->p.p.done && len >= HTTP_UPLOAD_MIN_BUFFER))
+    return -1;
+  return (ssize_t)consumed;
+}
+
+/**
+ * Parses a chunk of the body, writing uploaded files to temporary files.
+ *
+ * Returns -1 on error (the body isn't valid multipart data).
+ */
+int http_upload_write(http_upload_s *u, void *data, size_t len) {
+  if (u->p.p.done)
+    return 0; /* ignore any trailing data */
+  if (u->p.p.error)
+    return -1;
+  fio_str_info_s buf = fiobj_obj2cstr(u->leftover);
+  if (!buf.len) {
+    /* parse the data where it is, keeping whatever wasn't consumed */
+    ssize_t consumed = http_upload_parse(u, data, len, 0);
+    if (consumed < 0)
+      return -1;
+    if ((size_t)consumed < len && !u->p.p.done)
+      fiobj_str_write(u->leftover, (char *)data + consumed, len - consumed);
+    return 0;
+  }
+  fiobj_str_write(u->leftover, data, len);
+  buf = fiobj_obj2cstr(u->leftover);
+  ssize_t consumed = http_upload_parse(u, buf.data, buf.len, 0);
+  if (consumed < 0)
+    return -1;
+  if (consumed) {
+    memmove(buf.data, buf.data + consumed, buf.len - consumed);
+    fiobj_str_resize(u->leftover, buf.len - consumed);
+  }
+  return 0;
+}
+
+/**
+ * Parses any remaining data and frees the parser.
+ *
+ * Returns -1 if the body wasn't valid (or complete) multipart data.
+ */
+int http_upload_finish(http_upload_s *u) {
+  fio_str_info_s buf = fiobj_obj2cstr(u->leftover);
+  while (buf.len && !u->p.p.done && !u->p.p.error) {
+    ssize_t consumed = http_upload_parse(u, buf.data, buf.len, 1);
+    if (consumed <= 0)
+      break;
+    buf.data += consumed;
+    buf.len -= consumed;
+  }
+  int ret = (u->p.p.done ? 0 : -1);
+  http_upload_free(u);
+  return ret;
+}
+
+/** Frees the streaming parser (i.e., if the connection was lost). */
+void http_upload_free(http_upload_s *u) {
+  if (!u)
+    return;
+  fiobj_free(u->p.partial);
+  fiobj_free(u->p.partial_name);
+  fiobj_free(u->content_type);
+  fiobj_free(u->leftover);
+  fio_free(u);
+}
+
 /* *****************************************************************************
 HTTP Helper functions that could be used globally
 ***************************************************************************** */
@@ -1996,63 +3915,490 @@ FIOBJ http_req2str(http_s *h) {
   return w.dest;
 }
 
-void http_write_log(http_s *h) {
-  FIOBJ l = fiobj_str_buf(128);
+/* *****************************************************************************
+Access logging
 
-  intptr_t bytes_sent = fiobj_obj2num(fiobj_hash_get2(
-      h->private_data.out_headers, fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH)));
+Log records are stored in per-thread (single producer / single consumer) rings
+and formatted / written in batches by a timer task (or when a ring is full).
+***************************************************************************** */
 
-  struct timespec start, end;
-  clock_gettime(CLOCK_REALTIME, &end);
-  start = h->received_at;
+/* a binary log record (formatted once flushed) */
+typedef struct {
+  /* when the response was completed */
+  time_t at;
+  /* the response time, in milliseconds */
+  intptr_t ms;
+  /* the `content-length` of the response (0 if unknown) */
+  intptr_t bytes;
+  /* the output file descriptor */
+  int fd;
+  uint16_t status;
+  uint8_t addr_len;
+  uint16_t line_len;
+  char addr[48];
+  /* the request line (method, path and version), truncated if too long */
+  char line[HTTP_LOG_LINE_LIMIT];
+} http_log_record_s;
+
+typedef struct http_log_ring_s http_log_ring_s;
+struct http_log_ring_s {
+  http_log_ring_s *next;
+  /* written only by the ring's thread */
+  volatile size_t head;
+  /* written only by the (locked) consumer */
+  volatile size_t tail;
+  /* sampling counter (see the `log_sample` setting) */
+  size_t sampled;
+  http_log_record_s records[HTTP_LOG_RING_SIZE];
+};
+
+static struct {
+  http_log_ring_s *rings;
+  /* the number of records dropped (a ring was full) */
+  size_t dropped;
+  /* protects the ring list and consumer */
+  fio_lock_i lock;
+  /* set while a flush is scheduled */
+  fio_lock_i scheduled;
+  /* incremented when the rings are freed (see `http_log_clear`) */
+  size_t generation;
+} http_log = {.lock = FIO_LOCK_INIT, .scheduled = FIO_LOCK_INIT};
+
+static __thread http_log_ring_s *http_log_thread_ring;
+static __thread size_t http_log_thread_generation;
+
+static http_log_ring_s *http_log_ring(void) {
+  if (http_log_thread_ring &&
+      http_log_thread_generation == http_log.generation)
+    return http_log_thread_ring;
+  http_log_ring_s *ring = fio_malloc(sizeof(*ring));
+  FIO_ASSERT_ALLOC(ring);
+  ring->head = ring->tail = ring->sampled = 0;
+  fio_lock(&http_log.lock);
+  ring->next = http_log.rings;
+  http_log.rings = ring;
+  http_log_thread_generation = http_log.generation;
+  fio_unlock(&http_log.lock);
+  http_log_thread_ring = ring;
+  return ring;
+}
+
+/* writes the whole buffer, unless an error occurs */
+static void http_log_write_fd(int fd, char *data, size_t len) {
+  while (len) {
+    ssize_t w = write(fd, data, len);
+    if (w > 0) {
+      data += w;
+      len -= w;
+    } else if (w < 0 && errno == EINTR) {
+      continue;
+    } else {
+      return;
+    }
+  }
+}
+
+/* formats a record, returns the number of bytes written to `dest` */
+static size_t http_log_format(char *dest, http_log_record_s *r) {
+  /* records are formatted while the consumer is locked */
+  static time_t last_at;
+  static char date[48];
+  static size_t date_len;
+  char *pos = dest;
+  if (r->addr_len) {
+    memcpy(pos, r->addr, r->addr_len);
+    pos += r->addr_len;
+  } else {
+    memcpy(pos, "[unknown]", 9);
+    pos += 9;
+  }
+  if (!date_len || last_at != r->at) {
+    last_at = r->at;
+    date_len = http_time2str(date, r->at);
+  }
+  memcpy(pos, " - - [", 6);
+  pos += 6;
+  memcpy(pos, date, date_len);
+  pos += date_len;
+  memcpy(pos, "] \"", 3);
+  pos += 3;
+  memcpy(pos, r->line, r->line_len);
+  pos += r->line_len;
+  *(pos++) = '"';
+  *(pos++) = ' ';
+  pos += fio_ltoa(pos, r->status, 10);
+  if (r->bytes > 0) {
+    *(pos++) = ' ';
+    pos += fio_ltoa(pos, r->bytes, 10);
+    memcpy(pos, "b ", 2);
+    pos += 2;
+  } else {
+    memcpy(pos, " -- ", 4);
+    pos += 4;
+  }
+  pos += fio_ltoa(pos, r->ms, 10);
+  memcpy(pos, "ms\r\n", 4);
+  pos += 4;
+  return pos - dest;
+}
+
+/** Formats and writes all the pending log records. */
+void http_log_flush(void) {
+  /* a formatted record is always shorter than 256 bytes + the request line */
+  char buffer[8192 + HTTP_LOG_LINE_LIMIT + 256];
+  size_t len = 0;
+  int fd = -1;
+  fio_lock(&http_log.lock);
+  for (http_log_ring_s *ring = http_log.rings; ring; ring = ring->next) {
+    /* the atomic operation acts as a memory barrier */
+    const size_t head = fio_atomic_add(&ring->head, 0);
+    size_t tail = ring->tail;
+    for (; tail != head; ++tail) {
+      http_log_record_s *r = ring->records + (tail & (HTTP_LOG_RING_SIZE - 1));
+      if (len && (r->fd != fd || len >= 8192)) {
+        http_log_write_fd(fd, buffer, len);
+        len = 0;
+      }
+      fd = r->fd;
+      len += http_log_format(buffer + len, r);
+    }
+    fio_atomic_add(&ring->tail, tail - ring->tail);
+  }
+  if (len)
+    http_log_write_fd(fd, buffer, len);
+  if (http_log.dropped) {
+    size_t dropped = http_log.dropped;
+    http_log.dropped = 0;
+    FIO_LOG_WARNING("%zu HTTP access log records were dropped.", dropped);
+  }
+  fio_unlock(&http_log.lock);
+}
+
+static void http_log_flush_task(void *ignr_) {
+  fio_unlock(&http_log.scheduled);
+  http_log_flush();
+  (void)ignr_;
+}
+
+/* pending records in the parent process are written by the parent */
+void http_log_on_fork(void *ignr_) {
+  http_log.lock = FIO_LOCK_INIT;
+  http_log.scheduled = FIO_LOCK_INIT;
+  for (http_log_ring_s *ring = http_log.rings; ring; ring = ring->next)
+    ring->tail = ring->head;
+  (void)ignr_;
+}
 
+/** Frees the log's rings (after writing any pending records). */
+void http_log_clear(void) {
+  http_log_flush();
+  fio_lock(&http_log.lock);
+  http_log_ring_s *ring = http_log.rings;
+  http_log.rings = NULL;
+  ++http_log.generation;
+  fio_unlock(&http_log.lock);
+  while (ring) {
+    http_log_ring_s *tmp = ring;
+    ring = ring->next;
+    fio_free(tmp);
+  }
+}
+
+void http_write_log(http_s *h) {
+  http_settings_s *settings = http2protocol(h)->settings;
+  http_log_ring_s *ring = http_log_ring();
+  if (settings->log_sample > 1 && (ring->sampled++ % settings->log_sample))
+    return;
+  if (ring->head - ring->tail >= HTTP_LOG_RING_SIZE) {
+    /* the ring is full, flush it (unless a flush is in progress) */
+    if (!fio_trylock(&http_log.lock)) {
+      fio_unlock(&http_log.lock);
+      http_log_flush();
+    }
+    if (ring->head - ring->tail >= HTTP_LOG_RING_SIZE) {
+      fio_atomic_add(&http_log.dropped, 1);
+      return;
+    }
+  }
+  http_log_record_s *r =
+      ring->records + (ring->head & (HTTP_LOG_RING_SIZE - 1));
+  const struct timespec end = fio_last_tick();
+  r->at = end.tv_sec;
+  r->ms = ((end.tv_sec - h->received_at.tv_sec) * 1000) +
+          ((end.tv_nsec - h->received_at.tv_nsec) / 1000000);
+  r->bytes = fiobj_obj2num(fiobj_hash_get2(
+      h->private_data.out_headers, fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH)));
+  r->fd = (settings->log_fd ? settings->log_fd : STDERR_FILENO);
+  r->status = (uint16_t)h->status;
   {
     // TODO Guess IP address from headers (forwarded) where possible
     fio_str_info_s peer = fio_peer_addr(http2protocol(h)->uuid);
-    fiobj_str_write(l, peer.data, peer.len);
+    if (peer.len > sizeof(r->addr))
+      peer.len = sizeof(r->addr);
+    if (peer.len)
+      memcpy(r->addr, peer.data, peer.len);
+    r->addr_len = (uint8_t)peer.len;
+  }
+  {
+    /* the request line: method path version */
+    fio_str_info_s parts[3] = {fiobj_obj2cstr(h->method),
+                                     fiobj_obj2cstr(h->path),
+                                     fiobj_obj2cstr(h->version)};
+    size_t len = 0;
+    for (size_t i = 0; i < 3; ++i) {
+      if (i && len < HTTP_LOG_LINE_LIMIT)
+        r->line[len++] = ' ';
+      if (parts[i].len > HTTP_LOG_LINE_LIMIT - len)
+        parts[i].len = HTTP_LOG_LINE_LIMIT - len;
+      memcpy(r->line + len, parts[i].data, parts[i].len);
+      len += parts[i].len;
+    }
+    r->line_len = (uint8_t)len;
   }
-  fio_str_info_s buff = fiobj_obj2cstr(l);
+  /* publishes the record (the atomic operation acts as a memory barrier) */
+  fio_atomic_add(&ring->head, 1);
+  if (!fio_trylock(&http_log.scheduled) &&
+      fio_run_every(HTTP_LOG_FLUSH_INTERVAL, 1, http_log_flush_task, NULL,
+                    NULL) == -1) {
+    http_log_flush_task(NULL);
+  }
+}
+
+/* *****************************************************************************
+HTTP Metrics (per-thread histograms, merged on read)
+***************************************************************************** */
+
+typedef struct http_metrics_thread_s http_metrics_thread_s;
+struct http_metrics_thread_s {
+  http_metrics_thread_s *next;
+  /* written only by the thread */
+  http_metrics_s m;
+};
+
+static struct {
+  http_metrics_thread_s *list;
+  fio_lock_i lock;
+  /* incremented when the counters are freed (see `http_metrics_clear`) */
+  size_t generation;
+} http_metrics_data = {.lock = FIO_LOCK_INIT};
+
+static __thread http_metrics_thread_s *http_metrics_thread;
+static __thread size_t http_metrics_thread_generation;
+
+static http_metrics_thread_s *http_metrics_thread_get(void) {
+  if (http_metrics_thread &&
+      http_metrics_thread_generation == http_metrics_data.generation)
+    return http_metrics_thread;
+  http_metrics_thread_s *t = fio_malloc(sizeof(*t));
+  FIO_ASSERT_ALLOC(t);
+  memset(&t->m, 0, sizeof(t->m));
+  fio_lock(&http_metrics_data.lock);
+  t->next = http_metrics_data.list;
+  http_metrics_data.list = t;
+  http_metrics_thread_generation = http_metrics_data.generation;
+  fio_unlock(&http_metrics_data.lock);
+  http_metrics_thread = t;
+  return t;
+}
+
+/* 8 linear buckets per power of 2 (a precision of 12.5%) */
+static inline size_t http_metrics_usec2bucket(uint64_t usec) {
+  if (usec < 8)
+    return (size_t)usec;
+#if __has_builtin(__builtin_clzll)
+  const size_t msb = 63 - __builtin_clzll(usec);
+#else
+  size_t msb = 3;
+  while (usec >> (msb + 1))
+    ++msb;
+#endif
+  const size_t bucket = ((msb - 2) << 3) | ((usec >> (msb - 3)) & 7);
+  return (bucket < HTTP_METRICS_BUCKETS ? bucket : (HTTP_METRICS_BUCKETS - 1));
+}
+
+size_t http_metrics_bucket2usec(size_t bucket) {
+  if (bucket >= HTTP_METRICS_BUCKETS)
+    bucket = HTTP_METRICS_BUCKETS - 1;
+  if (bucket < 8)
+    return bucket;
+  return (size_t)(8 | (bucket & 7)) << ((bucket >> 3) - 1);
+}
+
+/** Adds a finished response to the calling thread's metrics. */
+void http_metrics_add(http_s *h) {
+  http_metrics_thread_s *t = http_metrics_thread_get();
+  struct timespec end;
+  clock_gettime(CLOCK_REALTIME, &end);
+  int64_t usec = ((int64_t)(end.tv_sec - h->received_at.tv_sec) * 1000000) +
+                 ((end.tv_nsec - h->received_at.tv_nsec) / 1000);
+  if (usec < 0) /* the clock was adjusted */
+    usec = 0;
+  ++t->m.requests;
+  if (h->status >= 100 && h->status < 600)
+    ++t->m.status[(h->status / 100) - 1];
+  t->m.latency_sum += (size_t)usec;
+  ++t->m.latency[http_metrics_usec2bucket((uint64_t)usec)];
+}
+
+/* a worker reports its own metrics (the responses sent by the parent aren't) */
+void http_metrics_on_fork(void *ignr_) {
+  http_metrics_data.lock = FIO_LOCK_INIT;
+  for (http_metrics_thread_s *t = http_metrics_data.list; t; t = t->next)
+    memset(&t->m, 0, sizeof(t->m));
+  (void)ignr_;
+}
 
-  if (buff.len == 0) {
-    memcpy(buff.data, "[unknown]", 9);
-    buff.len = 9;
+/** Frees the per-thread metrics. */
+void http_metrics_clear(void) {
+  fio_lock(&http_metrics_data.lock);
+  http_metrics_thread_s *t = http_metrics_data.list;
+  http_metrics_data.list = NULL;
+  ++http_metrics_data.generation;
+  fio_unlock(&http_metrics_data.lock);
+  while (t) {
+    http_metrics_thread_s *tmp = t;
+    t = t->next;
+    fio_free(tmp);
   }
-  memcpy(buff.data + buff.len, " - - [", 6);
-  buff.len += 6;
-  fiobj_str_resize(l, buff.len);
-  {
-    FIOBJ date;
-    fio_lock(&date_lock);
-    date = fiobj_dup(current_date);
-    fio_unlock(&date_lock);
-    fiobj_str_join(l, current_date);
-    fiobj_free(date);
-  }
-  fiobj_str_write(l, "] \"", 3);
-  fiobj_str_join(l, h->method);
-  fiobj_str_write(l, " ", 1);
-  fiobj_str_join(l, h->path);
-  fiobj_str_write(l, " ", 1);
-  fiobj_str_join(l, h->version);
-  fiobj_str_write(l, "\" ", 2);
-  if (bytes_sent > 0) {
-    fiobj_str_write_i(l, h->status);
-    fiobj_str_write(l, " ", 1);
-    fiobj_str_write_i(l, bytes_sent);
-    fiobj_str_write(l, "b ", 2);
-  } else {
-    fiobj_str_join(l, fiobj_num_tmp(h->status));
-    fiobj_str_write(l, " -- ", 4);
+}
+
+http_metrics_s http_metrics(void) {
+  http_metrics_s r = {.requests = 0};
+  fio_lock(&http_metrics_data.lock);
+  for (http_metrics_thread_s *t = http_metrics_data.list; t; t = t->next) {
+    r.requests += t->m.requests;
+    for (size_t i = 0; i < 5; ++i)
+      r.status[i] += t->m.status[i];
+    r.latency_sum += t->m.latency_sum;
+    for (size_t i = 0; i < HTTP_METRICS_BUCKETS; ++i)
+      r.latency[i] += t->m.latency[i];
+  }
+  fio_unlock(&http_metrics_data.lock);
+  return r;
+}
+
+size_t http_metrics_percentile(const http_metrics_s *m, double percentile) {
+  size_t total = 0;
+  for (size_t i = 0; i < HTTP_METRICS_BUCKETS; ++i)
+    total += m->latency[i];
+  if (!total)
+    return 0;
+  if (percentile > 100)
+    percentile = 100;
+  /* the rank of the response, rounded up (at least the first response) */
+  size_t rank = (size_t)((percentile * total) / 100);
+  if ((double)rank * 100 < percentile * total || !rank)
+    ++rank;
+  size_t i = 0;
+  for (size_t count = 0; i < HTTP_METRICS_BUCKETS - 1; ++i) {
+    count += m->latency[i];
+    if (count >= rank)
+      break;
   }
+  if (i == HTTP_METRICS_BUCKETS - 1)
+    return http_metrics_bucket2usec(i);
+  return http_metrics_bucket2usec(i + 1) - 1;
+}
 
-  bytes_sent = ((end.tv_sec - start.tv_sec) * 1000) +
-               ((end.tv_nsec - start.tv_nsec) / 1000000);
-  fiobj_str_write_i(l, bytes_sent);
-  fiobj_str_write(l, "ms\r\n", 4);
+/* writes a metric's HELP, TYPE and value lines */
+static void http_metrics_write(FIOBJ dest, const char *name, const char *type,
+                               const char *help, size_t value) {
+  fiobj_str_printf(dest, "# HELP %s %s\n# TYPE %s %s\n%s %zu\n", name, help,
+                   name, type, name, value);
+}
+
+FIOBJ http_metrics2str(void) {
+  const fio_metrics_s f = fio_metrics();
+  const http_metrics_s h = http_metrics();
+  FIOBJ s = fiobj_str_buf(4096);
+  http_metrics_write(s, "fio_process_id", "gauge",
+                     "The process id (each worker reports its own metrics).",
+                     (size_t)getpid());
+  http_metrics_write(s, "fio_connections_accepted_total", "counter",
+                     "Connections accepted.", f.accepted);
+  http_metrics_write(s, "fio_connections_closed_total", "counter",
+                     "Connections closed.", f.closed);
+  http_metrics_write(s, "fio_connections_open", "gauge",
+                     "Open connections (including listening sockets).",
+                     f.open);
+  http_metrics_write(s, "fio_tasks_total", "counter",
+                     "Tasks performed (including IO events and timers).",
+                     f.tasks);
+  http_metrics_write(s, "fio_tasks_pending", "gauge",
+                     "Tasks waiting in the queues.", f.tasks_pending);
+  http_metrics_write(s, "fio_packets_pending", "gauge",
+                     "Packets waiting in the outgoing queues.",
+                     f.packets_pending);
+  http_metrics_write(s, "fio_bytes_pending", "gauge",
+                     "Buffered bytes waiting in the outgoing queues.",
+                     f.bytes_pending);
+  http_metrics_write(s, "fio_bytes_read_total", "counter", "Bytes read.",
+                     f.bytes_read);
+  http_metrics_write(s, "fio_bytes_written_total", "counter", "Bytes written.",
+                     f.bytes_written);
+  http_metrics_write(s, "fio_pubsub_published_total", "counter",
+                     "Pub/Sub messages published.", f.published);
+  http_metrics_write(s, "fio_pubsub_delivered_total", "counter",
+                     "Pub/Sub messages delivered to subscribers.",
+                     f.delivered);
+  http_metrics_write(s, "fio_memory_system_bytes", "gauge",
+                     "Memory collected from the system for the block pool.",
+                     f.memory.system);
+  http_metrics_write(s, "fio_memory_blocks", "gauge", "Memory blocks in use.",
+                     f.memory.blocks);
+  http_metrics_write(s, "fio_memory_pool_blocks", "gauge",
+                     "Free memory blocks in the memory pool.", f.memory.pool);
+  http_metrics_write(s, "fio_memory_slab_bytes", "gauge",
+                     "Memory held by slab allocations.", f.memory.slab_bytes);
+  http_metrics_write(s, "fio_memory_big_bytes", "gauge",
+                     "Memory held by big allocations.", f.memory.big);
+  fiobj_str_printf(s, "# HELP http_responses_total HTTP responses sent.\n"
+                      "# TYPE http_responses_total counter\n");
+  for (size_t i = 0; i < 5; ++i)
+    fiobj_str_printf(s, "http_responses_total{class=\"%zuxx\"} %zu\n", i + 1,
+                     h.status[i]);
+  /* the histogram is reported using a bucket per power of 2 */
+  fiobj_str_printf(s, "# HELP http_response_duration_microseconds HTTP "
+                      "response times.\n"
+                      "# TYPE http_response_duration_microseconds histogram\n");
+  size_t count = 0;
+  for (size_t i = 0; i < HTTP_METRICS_BUCKETS; ++i) {
+    count += h.latency[i];
+    if ((i & 7) == 7 && i + 1 < HTTP_METRICS_BUCKETS)
+      fiobj_str_printf(s,
+                       "http_response_duration_microseconds_bucket{le=\"%zu\"}"
+                       " %zu\n",
+                       http_metrics_bucket2usec(i + 1) - 1, count);
+  }
+  fiobj_str_printf(s,
+                   "http_response_duration_microseconds_bucket{le=\"+Inf\"} "
+                   "%zu\nhttp_response_duration_microseconds_sum %zu\n"
+                   "http_response_duration_microseconds_count %zu\n",
+                   count, h.latency_sum, count);
+  const double quantiles[] = {50, 90, 99, 99.9};
+  fiobj_str_printf(s, "# HELP http_response_quantile_microseconds HTTP "
+                      "response time percentiles (HDR histogram).\n"
+                      "# TYPE http_response_quantile_microseconds gauge\n");
+  for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); ++i) {
+    const size_t usec = http_metrics_percentile(&h, quantiles[i]);
+    fiobj_str_printf(
+        s, "http_response_quantile_microseconds{quantile=\"%g\"} %zu\n",
+        quantiles[i] / 100, usec);
+  }
+  return s;
+}
 
-  buff = fiobj_obj2cstr(l);
-  fwrite(buff.data, 1, buff.len, stderr);
-  fiobj_free(l);
+/** Answers the request with the process's metrics (see `metrics_path`). */
+void http_send_metrics(http_s *h) {
+  static const char type[] = "text/plain; version=0.0.4";
+  http_set_header(h, HTTP_HEADER_CONTENT_TYPE,
+                  fiobj_str_new(type, sizeof(type) - 1));
+  http_set_header(h, HTTP_HEADER_CACHE_CONTROL,
+                  fiobj_dup(HTTP_HVALUE_NO_CACHE));
+  FIOBJ body = http_metrics2str();
+  fio_str_info_s b = fiobj_obj2cstr(body);
+  http_send_body(h, b.data, b.len);
+  fiobj_free(body);
 }
 
 /**
@@ -2373,19 +4719,28 @@ ssize_t http_decode_url(char *dest, const char *url_data, size_t length) {
   char *pos = dest;
   const char *end = url_data + length;
   while (url_data < end) {
+    /* copy the span with no escaped bytes in bulk */
+    const char *span =
+        http_seek4((char *)url_data, (char *)end, '%', '+', '%', '+');
+    if (span != url_data) {
+      memmove(pos, url_data, (size_t)(span - url_data));
+      pos += span - url_data;
+      url_data = span;
+      if (url_data == end)
+        break;
+    }
     if (*url_data == '+') {
       // decode space
       *(pos++) = ' ';
       ++url_data;
-    } else if (*url_data == '%') {
+    } else {
       // decode hex value
       // this is a percent encoded value.
       if (hex2byte((uint8_t *)pos, (uint8_t *)&url_data[1]))
         return -1;
       pos++;
       url_data += 3;
-    } else
-      *(pos++) = *(url_data++);
+    }
   }
   *pos = 0;
   return pos - dest;
@@ -2394,19 +4749,27 @@ ssize_t http_decode_url(char *dest, const char *url_data, size_t length) {
 ssize_t http_decode_url_unsafe(char *dest, const char *url_data) {
   char *pos = dest;
   while (*url_data) {
+    /* copy the span with no escaped bytes in bulk */
+    const size_t span = strcspn(url_data, "%+");
+    if (span) {
+      memmove(pos, url_data, span);
+      pos += span;
+      url_data += span;
+      if (!*url_data)
+        break;
+    }
     if (*url_data == '+') {
       // decode space
       *(pos++) = ' ';
       ++url_data;
-    } else if (*url_data == '%') {
+    } else {
       // decode hex value
       // this is a percent encoded value.
       if (hex2byte((uint8_t *)pos, (uint8_t *)&url_data[1]))
         return -1;
       pos++;
       url_data += 3;
-    } else
-      *(pos++) = *(url_data++);
+    }
   }
   *pos = 0;
   return pos - dest;
@@ -2416,15 +4779,22 @@ ssize_t http_decode_path(char *dest, const char *url_data, size_t length) {
   char *pos = dest;
   const char *end = url_data + length;
   while (url_data < end) {
-    if (*url_data == '%') {
-      // decode hex value
-      // this is a percent encoded value.
-      if (hex2byte((uint8_t *)pos, (uint8_t *)&url_data[1]))
-        return -1;
-      pos++;
-      url_data += 3;
-    } else
-      *(pos++) = *(url_data++);
+    /* copy the span with no escaped bytes in bulk */
+    const char *span =
+        http_seek4((char *)url_data, (char *)end, '%', '%', '%', '%');
+    if (span != url_data) {
+      memmove(pos, url_data, (size_t)(span - url_data));
+      pos += span - url_data;
+      url_data = span;
+      if (url_data == end)
+        break;
+    }
+    // decode hex value
+    // this is a percent encoded value.
+    if (hex2byte((uint8_t *)pos, (uint8_t *)&url_data[1]))
+      return -1;
+    pos++;
+    url_data += 3;
   }
   *pos = 0;
   return pos - dest;
@@ -2433,15 +4803,21 @@ ssize_t http_decode_path(char *dest, const char *url_data, size_t length) {
 ssize_t http_decode_path_unsafe(char *dest, const char *url_data) {
   char *pos = dest;
   while (*url_data) {
-    if (*url_data == '%') {
-      // decode hex value
-      // this is a percent encoded value.
-      if (hex2byte((uint8_t *)pos, (uint8_t *)&url_data[1]))
-        return -1;
-      pos++;
-      url_data += 3;
-    } else
-      *(pos++) = *(url_data++);
+    /* copy the span with no escaped bytes in bulk */
+    const size_t span = strcspn(url_data, "%");
+    if (span) {
+      memmove(pos, url_data, span);
+      pos += span;
+      url_data += span;
+      if (!*url_data)
+        break;
+    }
+    // decode hex value
+    // this is a percent encoded value.
+    if (hex2byte((uint8_t *)pos, (uint8_t *)&url_data[1]))
+      return -1;
+    pos++;
+    url_data += 3;
   }
   *pos = 0;
   return pos - dest;
@@ -2669,11 +5045,540 @@ fio_str_info_s http_status2str(uintptr_t status) {
 #undef HTTP_SET_STATUS_STR
 
 #if DEBUG
+/* a mock connection for the response cache test */
+static size_t http_cache_test_handled;
+static size_t http_cache_test_sent;
+static void http_cache_test_on_request(http_s *h) {
+  ++http_cache_test_handled;
+  if (fiobj_obj2cstr(h->path).len == 8) /* "/private" */
+    http_set_cookie(h, .name = "sid", .value = "1");
+  http_set_header(h, HTTP_HEADER_CONTENT_TYPE, fiobj_str_new("text/plain", 10));
+  http_send_body(h, "cached", 6);
+}
+static int http_cache_test_send_body(http_s *h, void *data, uintptr_t len) {
+  FIO_ASSERT(len == 6 && !memcmp(data, "cached", 6) &&
+                 fiobj_hash_get2(h->private_data.out_headers,
+                                 fiobj_obj2hash(HTTP_HEADER_CONTENT_TYPE)),
+             "cached response error\n");
+  ++http_cache_test_sent;
+  http_s_destroy(h, 0);
+  return 0;
+}
+static void http_cache_test_request(http_s *h, http_fio_protocol_s *pr,
+                                    const char *path, uint8_t cookie) {
+  static http_vtable_s vtbl = {.http_send_body = http_cache_test_send_body};
+  http_s_new(h, pr, &vtbl);
+  h->method = fiobj_str_new("GET", 3);
+  h->path = fiobj_str_new(path, strlen(path));
+  fiobj_hash_set(h->headers, HTTP_HEADER_HOST, fiobj_str_new("localhost", 9));
+  if (cookie)
+    fiobj_hash_set(h->headers, HTTP_HEADER_COOKIE, fiobj_str_new("a=1", 3));
+  http_cache_on_request(h, pr->settings);
+  http_s_destroy(h, 0);
+}
+
+#if HTTP_COROUTINE_SUPPORT
+/* a mock connection for the coroutine test */
+static http_await_s *http_coroutine_test_await;
+static size_t http_coroutine_test_state;
+static size_t http_coroutine_test_paused;
+static size_t http_coroutine_test_resumed;
+static size_t http_coroutine_test_sent;
+static void http_coroutine_test_task(http_await_s *await, void *arg) {
+  FIO_ASSERT(arg == &http_coroutine_test_state && !http_coroutine_test_await,
+             "http_await task error\n");
+  http_coroutine_test_await = await;
+}
+static void http_coroutine_test_on_request(http_s *h) {
+  void *result = NULL;
+  http_coroutine_test_state = 1;
+  if (http_await(h, http_coroutine_test_task, &http_coroutine_test_state,
+                 &result)) {
+    http_coroutine_test_state = 3;
+    return;
+  }
+  FIO_ASSERT(result == (void *)h, "http_await result error\n");
+  http_coroutine_test_state = 2;
+  http_send_body(h, "await", 5);
+}
+static void http_coroutine_test_on_pause(http_s *h, http_fio_protocol_s *p) {
+  ++http_coroutine_test_paused;
+  (void)h;
+  (void)p;
+}
+static void http_coroutine_test_on_resume(http_s *h, http_fio_protocol_s *p) {
+  ++http_coroutine_test_resumed;
+  (void)h;
+  (void)p;
+}
+static int http_coroutine_test_send_body(http_s *h, void *data,
+                                         uintptr_t len) {
+  ++http_coroutine_test_sent;
+  return 0;
+  (void)h;
+  (void)data;
+  (void)len;
+}
+static void *http_coroutine_test_blocking(void *arg) { return arg; }
+#endif
+
 void http_tests(void) {
   fprintf(stderr, "=== Testing HTTP helpers\n");
   FIOBJ html_mime = http_mimetype_find("html", 4);
   FIO_ASSERT(html_mime,
              "HTML mime-type not found! Mime-Type registry invalid!\n");
   fiobj_free(html_mime);
+  fprintf(stderr, "=== Testing HTTP header name interning\n");
+  FIO_ASSERT(http_header_intern("host", 4) == HTTP_HEADER_HOST &&
+                 http_header_intern("Host", 4) == HTTP_HEADER_HOST,
+             "Host header wasn't interned!\n");
+  FIO_ASSERT(http_header_intern("Content-Type", 12) ==
+                 HTTP_HEADER_CONTENT_TYPE,
+             "Content-Type header wasn't interned!\n");
+  FIO_ASSERT(!http_header_intern("hosts", 5) &&
+                 !http_header_intern("hos", 3) &&
+                 !http_header_intern("x-not-a-header", 14) &&
+                 !http_header_intern("content-typf", 12),
+             "unknown header names shouldn't be interned!\n");
+  {
+    /* every interned name is found (once) in upper case */
+    FIOBJ seen = fiobj_hash_new();
+    const char *names[] = {"ACCEPT-ENCODING",  "X-FORWARDED-FOR",
+                           "SEC-WEBSOCKET-KEY", "TE",
+                           "IF-NONE-MATCH",    "USER-AGENT"};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+      FIOBJ name = http_header_intern(names[i], strlen(names[i]));
+      FIO_ASSERT(name && !fiobj_hash_get(seen, name),
+                 "header name %s wasn't interned!\n", names[i]);
+      FIO_ASSERT(!strcasecmp(fiobj_obj2cstr(name).data, names[i]),
+                 "header name %s interned as a different name!\n", names[i]);
+      fiobj_hash_set(seen, name, fiobj_true());
+    }
+    fiobj_free(seen);
+  }
+  fprintf(stderr, "=== Testing URL decoding and query parsing\n");
+  {
+    const char *url = "/search/long%20spans%2Fwith+escapes/and+a+few%2b"
+                      "spaces%20between+long+unescaped+segments";
+    const char *decoded_url = "/search/long spans/with escapes/and a few+"
+                              "spaces between long unescaped segments";
+    const char *decoded_path = "/search/long spans/with+escapes/and+a+few+"
+                               "spaces between+long+unescaped+segments";
+    char buf[128];
+    FIO_ASSERT(http_decode_url(buf, url, strlen(url)) ==
+                       (ssize_t)strlen(decoded_url) &&
+                   !strcmp(buf, decoded_url),
+               "http_decode_url error: %s\n", buf);
+    FIO_ASSERT(http_decode_url_unsafe(buf, url) ==
+                       (ssize_t)strlen(decoded_url) &&
+                   !strcmp(buf, decoded_url),
+               "http_decode_url_unsafe error: %s\n", buf);
+    FIO_ASSERT(http_decode_path(buf, url, strlen(url)) ==
+                       (ssize_t)strlen(decoded_path) &&
+                   !strcmp(buf, decoded_path),
+               "http_decode_path error: %s\n", buf);
+    FIO_ASSERT(http_decode_path_unsafe(buf, url) ==
+                       (ssize_t)strlen(decoded_path) &&
+                   !strcmp(buf, decoded_path),
+               "http_decode_path_unsafe error: %s\n", buf);
+    memcpy(buf, url, strlen(url) + 1);
+    FIO_ASSERT(http_decode_url(buf, buf, strlen(buf)) ==
+                       (ssize_t)strlen(decoded_url) &&
+                   !strcmp(buf, decoded_url),
+               "http_decode_url (in place) error: %s\n", buf);
+    FIO_ASSERT(http_decode_url(buf, "bad%2", 5) == -1 &&
+                   http_decode_path(buf, "a%zz/long/enough/to/be/vectorized",
+                                    33) == -1,
+               "URL decoding should fail for broken escapes\n");
+
+    const char *query = "search=long+unescaped+value+with+spaces&n=42&"
+                        "a%5Bb%5D=name+escaped&amp;empty=&eq=a=b&flag&"
+                        "list[]=1&list[]=2&t=true&f=3.5";
+    http_s h = {.query = fiobj_str_new(query, strlen(query))};
+    http_parse_query(&h);
+    FIO_ASSERT(fiobj_hash_count(h.params) == 8,
+               "query parsing error (%zu parameters)\n",
+               fiobj_hash_count(h.params));
+    struct {
+      const char *name;
+      const char *value;
+    } expect[] = {
+        {"search", "long unescaped value with spaces"},
+        {"n", "42"},
+        {"a[b]", "name escaped"},
+        {"empty", ""},
+        {"eq", "a=b"},
+        {"t", "true"},
+        {"f", "3.5"},
+        {NULL, NULL},
+    };
+    for (size_t i = 0; expect[i].name; ++i) {
+      FIOBJ key = fiobj_str_new(expect[i].name, strlen(expect[i].name));
+      FIOBJ val = fiobj_hash_get(h.params, key);
+      fiobj_free(key);
+      FIO_ASSERT(val && !strcmp(fiobj_obj2cstr(val).data, expect[i].value),
+                 "query parameter %s error (%s)\n", expect[i].name,
+                 val ? fiobj_obj2cstr(val).data : "missing");
+    }
+    {
+      FIOBJ key = fiobj_str_new("n", 1);
+      FIO_ASSERT(FIOBJ_TYPE_IS(fiobj_hash_get(h.params, key), FIOBJ_T_NUMBER),
+                 "query numbers should be converted\n");
+      fiobj_free(key);
+      key = fiobj_str_new("list", 4);
+      FIO_ASSERT(fiobj_ary_count(fiobj_hash_get(h.params, key)) == 2,
+                 "query array error\n");
+      fiobj_free(key);
+    }
+    fiobj_free(h.params);
+    fiobj_free(h.query);
+  }
+  fprintf(stderr, "=== Testing retained request Strings (read buffer)\n");
+  {
+    const char *text = "/a/long/request/path/that/references/the/read/buffer\n"
+                       "a-long-header-value-that-references-the-read-buffer";
+    fio_rbuf_s *rbuf = fio_rbuf_new(0);
+    memcpy(rbuf->data, text, strlen(text) + 1);
+    rbuf->len = strlen(text);
+    rbuf->data[52] = 0;
+    http_s h = {.path = fiobj_str_new_rbuf(rbuf, rbuf->data, 52),
+                .headers = fiobj_hash_new()};
+    FIOBJ val = fiobj_str_new_rbuf(rbuf, rbuf->data + 53, strlen(text) - 53);
+    fiobj_hash_set(h.headers, HTTP_HEADER_ACCEPT, val);
+    FIO_ASSERT(fiobj_obj2cstr(val).data == rbuf->data + 53,
+               "request String should reference the read buffer\n");
+    FIOBJ kept = fiobj_dup(val);
+    http_s_destroy(&h, 0);
+    FIO_ASSERT(fiobj_obj2cstr(kept).data != rbuf->data + 53 &&
+                   !fio_rbuf_is_shared(rbuf) &&
+                   !strcmp(fiobj_obj2cstr(kept).data, text + 53),
+               "retained request String should own its data\n");
+    fiobj_free(kept);
+    fio_rbuf_free(rbuf);
+  }
+  fprintf(stderr, "=== Testing lazy parameter and cookie access\n");
+  {
+    const char *q = "a=1&n%61me=Joe+Doe&list=1&list=2&user[name]=x&b";
+    const char *body = "name=ignored&from_body=yes";
+    http_s h = {.query = fiobj_str_new(q, strlen(q)),
+                .body = fiobj_str_new(body, strlen(body)),
+                .headers = fiobj_hash_new()};
+    fiobj_hash_set(h.headers, HTTP_HEADER_CONTENT_TYPE,
+                   fiobj_str_new("application/x-www-form-urlencoded", 33));
+    fiobj_hash_set(h.headers, HTTP_HEADER_COOKIE,
+                   fiobj_str_new("sid=a%20b; theme=dark", 21));
+    FIOBJ val = http_param_get(&h, "name", 4);
+    FIO_ASSERT(FIOBJ_TYPE_IS(val, FIOBJ_T_ARRAY) && fiobj_ary_count(val) == 2 &&
+                   !strcmp(fiobj_obj2cstr(fiobj_ary_index(val, 1)).data,
+                           "Joe Doe"),
+               "lazy parameter (body + encoded query name) error\n");
+    FIO_ASSERT(val == http_param_get(&h, "name", 4),
+               "lazy parameter wasn't cached\n");
+    val = http_param_get(&h, "a", 1);
+    FIO_ASSERT(FIOBJ_TYPE_IS(val, FIOBJ_T_NUMBER) && fiobj_obj2num(val) == 1,
+               "lazy parameter conversion error\n");
+    FIO_ASSERT(fiobj_ary_count(http_param_get(&h, "list", 4)) == 2,
+               "lazy parameter array error\n");
+    val = http_param_get(&h, "from_body", 9);
+    FIO_ASSERT(val && !strcmp(fiobj_obj2cstr(val).data, "yes"),
+               "lazy body parameter error\n");
+    FIO_ASSERT(!http_param_get(&h, "b", 1) && !http_param_get(&h, "nam", 3) &&
+                   !http_param_get(&h, "user[name]", 10),
+               "lazy parameter should be missing\n");
+    FIO_ASSERT(!h.params, "lazy parameter access shouldn't parse the query\n");
+    val = http_cookie_get(&h, "sid", 3);
+    FIO_ASSERT(val && !strcmp(fiobj_obj2cstr(val).data, "a%20b"),
+               "lazy cookie error\n");
+    val = http_cookie_get(&h, "theme", 5);
+    FIO_ASSERT(val && !strcmp(fiobj_obj2cstr(val).data, "dark"),
+               "lazy cookie error (second cookie)\n");
+    FIO_ASSERT(!http_cookie_get(&h, "the", 3) && !h.cookies,
+               "lazy cookie should be missing\n");
+    fiobj_free(h.query);
+    fiobj_free(h.body);
+    fiobj_free(h.headers);
+    fiobj_free(h.private_data.lazy_params);
+    fiobj_free(h.private_data.lazy_cookies);
+  }
+  fprintf(stderr, "=== Testing streaming multipart uploads\n");
+  {
+    const char head[] = "--AaB03x\r\n"
+                        "Content-Disposition: form-data; name=\"field\"\r\n"
+                        "\r\nvalue\r\n"
+                        "--AaB03x\r\n"
+                        "Content-Disposition: form-data; name=\"file\"; "
+                        "filename=\"file.txt\"\r\n"
+                        "Content-Type: text/plain\r\n\r\n";
+    const char tail[] = "\r\n--AaB03x--\r\n";
+    char file[HTTP_UPLOAD_MIN_BUFFER * 3];
+    for (size_t i = 0; i < sizeof(file); ++i)
+      file[i] = (i % 61) ? ('a' + (i % 26)) : '\n';
+    FIOBJ body = fiobj_str_buf(sizeof(file) + sizeof(head) + sizeof(tail));
+    fiobj_str_write(body, head, sizeof(head) - 1);
+    fiobj_str_write(body, file, sizeof(file));
+    fiobj_str_write(body, tail, sizeof(tail) - 1);
+    fio_str_info_s b = fiobj_obj2cstr(body);
+    FIOBJ keys[3] = {fiobj_str_new("field", 5), fiobj_str_new("file", 4),
+                     fiobj_str_new("data", 4)};
+    for (size_t step = 1; step < 4096; step = (step << 1) + 7) {
+      http_s h = {.headers = fiobj_hash_new()};
+      fiobj_hash_set(h.headers, HTTP_HEADER_CONTENT_TYPE,
+                     fiobj_str_new("multipart/form-data; boundary=AaB03x", 36));
+      http_upload_s *u = http_upload_new(&h);
+      FIO_ASSERT(u, "multipart upload parser wasn't created!\n");
+      for (size_t pos = 0; pos < b.len; pos += step) {
+        const size_t len = (b.len - pos < step ? b.len - pos : step);
+        FIO_ASSERT(!http_upload_write(u, b.data + pos, len),
+                   "multipart upload parsing error (%zu byte chunks)\n", step);
+      }
+      FIO_ASSERT(!http_upload_finish(u),
+                 "multipart upload incomplete (%zu byte chunks)\n", step);
+      FIOBJ tmp = fiobj_hash_get(h.params, keys[0]);
+      FIO_ASSERT(tmp && !strcmp(fiobj_obj2cstr(tmp).data, "value"),
+                 "multipart field error (%zu byte chunks)\n", step);
+      tmp = fiobj_hash_get(h.params, keys[1]);
+      FIO_ASSERT(FIOBJ_TYPE_IS(tmp, FIOBJ_T_HASH),
+                 "multipart file missing (%zu byte chunks)\n", step);
+      tmp = fiobj_hash_get(tmp, keys[2]);
+      FIO_ASSERT(FIOBJ_TYPE_IS(tmp, FIOBJ_T_DATA) &&
+                     fiobj_obj2cstr(tmp).len == sizeof(file) &&
+                     !memcmp(fiobj_obj2cstr(tmp).data, file, sizeof(file)),
+                 "multipart file data error (%zu byte chunks)\n", step);
+      fiobj_free(h.params);
+      h.params = FIOBJ_INVALID;
+      /* truncated data is an error (the closing boundary is missing) */
+      u = http_upload_new(&h);
+      http_upload_write(u, b.data, b.len - (step + 8));
+      FIO_ASSERT(http_upload_finish(u),
+                 "truncated multipart upload should fail (%zu bytes short)\n",
+                 step + 8);
+      fiobj_free(h.params);
+      fiobj_free(h.headers);
+    }
+    for (size_t i = 0; i < 3; ++i)
+      fiobj_free(keys[i]);
+    fiobj_free(body);
+  }
+  fprintf(stderr, "=== Testing buffered access logging\n");
+  {
+    int fds[2];
+    FIO_ASSERT(!pipe(fds), "pipe failed\n");
+    http_settings_s settings = {.log_fd = fds[1], .log_sample = 2};
+    http_fio_protocol_s pr = {.settings = &settings, .uuid = -1};
+    http_s h;
+    http_s_new(&h, &pr, NULL);
+    h.method = fiobj_str_new("GET", 3);
+    h.path = fiobj_str_new("/index.html", 11);
+    h.version = fiobj_str_new("HTTP/1.1", 8);
+    h.status = 404;
+    for (size_t i = 0; i < 4; ++i)
+      http_write_log(&h);
+    http_log_flush();
+    close(fds[1]);
+    char buf[1024];
+    ssize_t len = read(fds[0], buf, sizeof(buf) - 1);
+    close(fds[0]);
+    FIO_ASSERT(len > 0, "access log records weren't written\n");
+    buf[len] = 0;
+    char *pos = buf;
+    size_t lines = 0;
+    while ((pos = strstr(pos, "\"GET /index.html HTTP/1.1\" 404 -- "))) {
+      ++lines;
+      ++pos;
+    }
+    FIO_ASSERT(lines == 2 && !strncmp(buf, "[unknown] - - [", 15) &&
+                   !strcmp(buf + len - 4, "ms\r\n"),
+               "access log (sampled) format error:\n%s\n", buf);
+    http_s_destroy(&h, 0);
+  }
+  fprintf(stderr, "=== Testing HTTP metrics (latency histogram)\n");
+  {
+    for (uint64_t v = 0; v < ((uint64_t)1 << 27); v += (v >> 3) + 1) {
+      const size_t b = http_metrics_usec2bucket(v);
+      FIO_ASSERT(http_metrics_bucket2usec(b) <= v &&
+                     (b == HTTP_METRICS_BUCKETS - 1 ||
+                      v < http_metrics_bucket2usec(b + 1)),
+                 "latency bucket error for %zu (bucket %zu)\n", (size_t)v, b);
+    }
+    http_settings_s settings = {.log = 0};
+    http_fio_protocol_s pr = {.settings = &settings, .uuid = -1};
+    http_s h;
+    http_s_new(&h, &pr, NULL);
+    clock_gettime(CLOCK_REALTIME, &h.received_at);
+    h.received_at.tv_sec -= 2; /* a 2 second response */
+    const http_metrics_s m0 = http_metrics();
+    http_metrics_add(&h);
+    h.status = 404;
+    http_metrics_add(&h);
+    http_metrics_s m = http_metrics();
+    FIO_ASSERT(m.requests == m0.requests + 2 &&
+                   m.status[1] == m0.status[1] + 1 &&
+                   m.status[3] == m0.status[3] + 1,
+               "HTTP metrics counters error\n");
+    FIO_ASSERT(m.latency_sum >= m0.latency_sum + 4000000,
+               "HTTP metrics latency sum error\n");
+    memset(&m, 0, sizeof(m));
+    m.latency[http_metrics_usec2bucket(100)] = 99;
+    m.latency[http_metrics_usec2bucket(2000000)] = 1;
+    FIO_ASSERT(http_metrics_percentile(&m, 50) >= 100 &&
+                   http_metrics_percentile(&m, 99) < 113 &&
+                   http_metrics_percentile(&m, 99.9) >= 2000000 &&
+                   http_metrics_percentile(&m, 99.9) < 2250000,
+               "HTTP metrics percentile error (%zu, %zu)\n",
+               http_metrics_percentile(&m, 99),
+               http_metrics_percentile(&m, 99.9));
+    FIOBJ str = http_metrics2str();
+    FIO_ASSERT(strstr(fiobj_obj2cstr(str).data, "\nfio_tasks_total ") &&
+                   strstr(fiobj_obj2cstr(str).data,
+                          "\nhttp_responses_total{class=\"4xx\"} ") &&
+                   strstr(fiobj_obj2cstr(str).data,
+                          "\nhttp_response_duration_microseconds_bucket{"
+                          "le=\"+Inf\"} "),
+               "HTTP metrics format error:\n%s\n", fiobj_obj2cstr(str).data);
+    fiobj_free(str);
+    http_s_destroy(&h, 0);
+  }
+#if HAVE_ZLIB
+  fprintf(stderr, "=== Testing on-the-fly static file compression\n");
+  {
+    char path[] = "/tmp/fio_gz_test_XXXXXX.txt";
+    int fd = mkstemps(path, 4);
+    FIO_ASSERT(fd != -1, "couldn't create a temporary file\n");
+    for (size_t i = 0; i < 128; ++i)
+      FIO_ASSERT(write(fd, "compressible static file data.\n", 32) == 32,
+                 "couldn't write to the temporary file\n");
+    struct stat st;
+    FIO_ASSERT(!fstat(fd, &st), "fstat failed\n");
+    FIOBJ name = fiobj_str_new(path, strlen(path));
+    http_gz_entry_s key = {.path = name};
+    FIO_ASSERT(!http_static_compressed(name, &st),
+               "the file should be sent as is until it's compressed\n");
+    http_gz_entry_s *e =
+        http_gz_set_find(&http_gz_cache.set, fiobj_obj2hash(name), &key);
+    FIO_ASSERT(e && e->pending, "the compression should be pending\n");
+    FIO_ASSERT(!http_static_compressed(name, &st) &&
+                   e == http_gz_set_find(&http_gz_cache.set,
+                                         fiobj_obj2hash(name), &key),
+               "a pending compression should be scheduled once\n");
+    fio_defer_perform(); /* the blocking task pool isn't running */
+    FIOBJ gz = http_static_compressed(name, &st);
+    FIOBJ gz2 = http_static_compressed(name, &st);
+    FIO_ASSERT(gz && !e->pending && fiobj_obj2cstr(gz).len < 4096 &&
+                   (uint8_t)fiobj_obj2cstr(gz).data[0] == 0x1f &&
+                   (uint8_t)fiobj_obj2cstr(gz).data[1] == 0x8b,
+               "the compressed (gzip) data is missing\n");
+    FIO_ASSERT(gz == gz2, "the compressed data should be shared\n");
+    fiobj_free(gz);
+    fiobj_free(gz2);
+    fiobj_free(name);
+    close(fd);
+    unlink(path);
+    http_gz_cache_clear();
+  }
+#endif
+  fprintf(stderr, "=== Testing the response cache (microcache)\n");
+  {
+    http_settings_s settings = {.cache_ttl = 5,
+                                .on_request = http_cache_test_on_request};
+    http_fio_protocol_s pr = {.settings = &settings, .uuid = -1};
+    http_s h;
+    for (size_t i = 0; i < 3; ++i)
+      http_cache_test_request(&h, &pr, "/cached", 0);
+    FIO_ASSERT(http_cache_test_handled == 1 && http_cache_test_sent == 3,
+               "cached responses shouldn't call `on_request` (%zu/%zu)\n",
+               http_cache_test_handled, http_cache_test_sent);
+    http_cache_test_request(&h, &pr, "/cached", 1);
+    http_cache_test_request(&h, &pr, "/private", 0);
+    http_cache_test_request(&h, &pr, "/private", 0);
+    FIO_ASSERT(http_cache_test_handled == 4,
+               "requests with cookies and responses setting cookies shouldn't "
+               "be cached\n");
+    /* an expired entry is served while another request rebuilds it */
+    FIOBJ key = fiobj_str_new("localhost /cached", 17);
+    http_cache_entry_s tmp = {.settings = &settings, .key = key};
+    http_cache_entry_s *e = http_cache_set_find(
+        &http_cache.set, fiobj_obj2hash(key) + (uintptr_t)&settings, &tmp);
+    FIO_ASSERT(e, "response cache entry missing\n");
+    e->expires = fio_last_tick().tv_sec - 1;
+    e->rebuilding = 1;
+    http_cache_test_request(&h, &pr, "/cached", 0);
+    FIO_ASSERT(http_cache_test_handled == 4,
+               "a stale entry should be served while it's rebuilt\n");
+    e->rebuilding = 0;
+    http_cache_test_request(&h, &pr, "/cached", 0);
+    http_cache_test_request(&h, &pr, "/cached", 0);
+    FIO_ASSERT(http_cache_test_handled == 5 && http_cache_test_sent == 9,
+               "an expired entry should be rebuilt once (%zu/%zu)\n",
+               http_cache_test_handled, http_cache_test_sent);
+    fiobj_free(key);
+    http_cache_clear(&settings);
+    FIO_ASSERT(!http_cache.total, "response cache wasn't cleared\n");
+  }
+#if HTTP_COROUTINE_SUPPORT
+  fprintf(stderr, "=== Testing coroutines (http_await)\n");
+  {
+    static http_vtable_s vtbl = {
+        .http_send_body = http_coroutine_test_send_body,
+        .http_on_pause = http_coroutine_test_on_pause,
+        .http_on_resume = http_coroutine_test_on_resume,
+    };
+    http_settings_s settings = {.coroutines = 1,
+                                .on_request = http_coroutine_test_on_request};
+    http_fio_protocol_s pr = {.settings = &settings, .uuid = -1};
+    http_s h;
+    http_s_new(&h, &pr, &vtbl);
+    h.method = fiobj_str_new("GET", 3);
+    FIO_ASSERT(http_await(&h, http_coroutine_test_task, NULL, NULL) == -1 &&
+                   http_await_task(&h, http_coroutine_test_blocking, &h) == &h,
+               "http_await should fail outside of a coroutine\n");
+    /* resumed within the connection's lock */
+    http_coroutine_on_request(&h, &settings);
+    FIO_ASSERT(http_coroutine_test_state == 1 && http_coroutine_test_await &&
+                   http_coroutine_test_paused == 1 && !http_coroutine_test_sent,
+               "http_await should suspend the handler\n");
+    http_coroutine_test_await->result = &h;
+    http_await_s *await = http_coroutine_test_await;
+    http_coroutine_test_await = NULL;
+    http_await_resume_wrapper(-1, (fio_protocol_s *)&pr, await);
+    FIO_ASSERT(http_coroutine_test_state == 2 &&
+                   http_coroutine_test_resumed == 1 &&
+                   http_coroutine_test_sent == 1,
+               "the handler wasn't resumed\n");
+    /* the connection was lost (the uuid is invalid) */
+    http_coroutine_on_request(&h, &settings);
+    FIO_ASSERT(http_coroutine_test_state == 1 && http_coroutine_test_await,
+               "http_await should suspend the handler (2)\n");
+    await = http_coroutine_test_await;
+    http_coroutine_test_await = NULL;
+    http_await_resume(await, &h);
+    fio_defer_perform();
+    FIO_ASSERT(http_coroutine_test_state == 3 &&
+                   http_coroutine_test_resumed == 1 &&
+                   http_coroutine_test_sent == 1,
+               "http_await should fail once the connection was lost\n");
+    FIO_ASSERT(http_coroutine_pool.count, "coroutine stacks aren't reused\n");
+    http_s_destroy(&h, 0);
+  }
+#endif
+  http1_tests();
+  websocket_tests();
+  http2_tests();
+  fprintf(stderr, "=== Testing pre-formatted SSE broadcasts\n");
+  {
+    fio_str_info_s ch = {.data = (char *)"ch", .len = 2};
+    fio_str_info_s msg = {.data = (char *)"line1\r\nline2\n", .len = 13};
+    fio_msg_metadata_s meta = http_sse_optimize(ch, msg, 0);
+    FIO_ASSERT(meta.type_id == HTTP_SSE_OPTIMIZE_PUBSUB && meta.metadata,
+               "SSE broadcast metadata missing\n");
+    FIO_ASSERT(!strcmp(fiobj_obj2cstr((FIOBJ)meta.metadata).data,
+                       "data: line1\r\ndata: line2\r\n\r\n"),
+               "SSE broadcast format error: %s\n",
+               fiobj_obj2cstr((FIOBJ)meta.metadata).data);
+    meta.on_finish(NULL, meta.metadata);
+    msg.len = 0;
+    meta = http_sse_optimize(ch, msg, 0);
+    FIO_ASSERT(!meta.metadata, "empty SSE messages shouldn't be formatted\n");
+  }
+  fprintf(stderr, "* passed.\n");
 }
 #endif
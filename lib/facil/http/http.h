@@ -33,6 +33,29 @@ Compile Time Settings
 #define HTTP_DEFAULT_BODY_LIMIT (1024 * 1024 * 50)
 #endif
 
+#ifndef HTTP_LOG_RING_SIZE
+/**
+ * The number of access log records each thread can buffer before they're
+ * written (a power of 2). Records are dropped if the buffer is full.
+ */
+#define HTTP_LOG_RING_SIZE 512
+#endif
+
+#ifndef HTTP_LOG_LINE_LIMIT
+/** The request line (method, path, version) bytes logged (truncating). */
+#define HTTP_LOG_LINE_LIMIT 192
+#endif
+
+#ifndef HTTP_LOG_FLUSH_INTERVAL
+/** The number of milliseconds access log records are buffered for. */
+#define HTTP_LOG_FLUSH_INTERVAL 100
+#endif
+
+#ifndef HTTP_DEFAULT_PIPELINE_LIMIT
+/** The default `pipeline_limit` (requests handled per `on_data` event). */
+#define HTTP_DEFAULT_PIPELINE_LIMIT 8
+#endif
+
 #ifndef HTTP_MAX_HEADER_COUNT
 #define HTTP_MAX_HEADER_COUNT 128
 #endif
@@ -42,6 +65,37 @@ Compile Time Settings
 #define HTTP_MAX_HEADER_LENGTH 8192
 #endif
 
+#ifndef HTTP_DECODE_SIMD
+/**
+ * When available (SSE2 / NEON), URL decoding and query parsing search for
+ * delimiters and escaped (encoded) bytes 16 bytes at a time, copying the spans
+ * between them in bulk.
+ */
+#define HTTP_DECODE_SIMD 1
+#endif
+
+#ifndef HTTP_COROUTINE_SUPPORT
+/**
+ * Enables the `coroutines` setting (requires `ucontext.h`, which is deprecated
+ * on macOS).
+ */
+#if defined(__APPLE__)
+#define HTTP_COROUTINE_SUPPORT 0
+#else
+#define HTTP_COROUTINE_SUPPORT 1
+#endif
+#endif
+
+#ifndef HTTP_COROUTINE_STACK_SIZE
+/** The stack size for each `on_request` coroutine (a guard page is added). */
+#define HTTP_COROUTINE_STACK_SIZE (1UL << 16)
+#endif
+
+#ifndef HTTP_COROUTINE_POOL_LIMIT
+/** The number of released coroutine stacks kept for reuse (per process). */
+#define HTTP_COROUTINE_POOL_LIMIT 256
+#endif
+
 #ifndef FIO_HTTP_EXACT_LOGGING
 /**
  * By default, facil.io logs the HTTP request cycle using a fuzzy starting point
@@ -58,6 +112,86 @@ Compile Time Settings
 #define FIO_HTTP_EXACT_LOGGING 0
 #endif
 
+#ifndef HTTP_STATIC_COMPRESSION_CACHE
+/**
+ * The memory limit (in bytes) for static files compressed on-the-fly (see the
+ * `compress_static` setting). Least recently used files are evicted first.
+ */
+#define HTTP_STATIC_COMPRESSION_CACHE (16 * 1024 * 1024) /* ~16Mb */
+#endif
+
+#ifndef HTTP_STATIC_COMPRESSION_LIMIT
+/** Static files larger than this limit aren't compressed on-the-fly. */
+#define HTTP_STATIC_COMPRESSION_LIMIT (1024 * 1024) /* ~1Mb */
+#endif
+
+#ifndef HTTP_STATIC_COMPRESSION_LEVEL
+/**
+ * The zlib compression level (1-9) for static files compressed on-the-fly.
+ * Files are compressed once (on the blocking task pool) and cached.
+ */
+#define HTTP_STATIC_COMPRESSION_LEVEL 6
+#endif
+
+#ifndef HTTP_RESPONSE_CACHE
+/**
+ * The memory limit (in bytes) for cached responses (see the `cache_ttl`
+ * setting). Least recently used responses are evicted first.
+ */
+#define HTTP_RESPONSE_CACHE (16 * 1024 * 1024) /* ~16Mb */
+#endif
+
+#ifndef HTTP_RESPONSE_CACHE_LIMIT
+/** Responses with a larger body aren't cached (see the `cache_ttl` setting). */
+#define HTTP_RESPONSE_CACHE_LIMIT (256 * 1024) /* ~256Kb */
+#endif
+
+#ifndef HTTP_STATIC_FD_CACHE_LIMIT
+/**
+ * The number of static files kept open (along with their `stat` data) by
+ * `http_sendfile2` and the `public_folder`. Missing files are remembered as
+ * well. Least recently used files are evicted first, 0 disables the cache.
+ */
+#define HTTP_STATIC_FD_CACHE_LIMIT 256
+#endif
+
+#ifndef HTTP_CLIENT_POOL_LIMIT
+/**
+ * The maximum number of idle keep-alive connections pooled for each origin
+ * (see the `reuse_connections` setting). Excess connections are closed.
+ */
+#define HTTP_CLIENT_POOL_LIMIT 16
+#endif
+
+#ifndef HTTP_CLIENT_POOL_TIMEOUT
+/** The number of seconds a pooled connection may remain idle (max 255). */
+#define HTTP_CLIENT_POOL_TIMEOUT 15
+#endif
+
+#ifndef HTTP_STATIC_FD_CACHE_TTL
+/**
+ * The number of seconds a cached static file is trusted before it's `stat`
+ * data is tested again (changed files are reopened).
+ */
+#define HTTP_STATIC_FD_CACHE_TTL 2
+#endif
+
+#ifndef HTTP_STREAM_BUFFER_LIMIT
+/**
+ * The number of buffered bytes after which `http_stream_write` asks for the
+ * `on_ready` callback before more data is written (see `http_stream_start`).
+ */
+#define HTTP_STREAM_BUFFER_LIMIT (256 * 1024) /* ~256Kb */
+#endif
+
+#ifndef HTTP_ENABLE_HTTP2
+/**
+ * When set, servers accept HTTP/2 connections, negotiated using TLS (ALPN "h2")
+ * or started with prior knowledge (the HTTP/2 connection preface).
+ */
+#define HTTP_ENABLE_HTTP2 1
+#endif
+
 /** the `http_listen settings, see details in the struct definition. */
 typedef struct http_settings_s http_settings_s;
 
@@ -80,6 +214,12 @@ typedef struct {
     uintptr_t flag;
     /** The response headers, if they weren't sent. Don't access directly. */
     FIOBJ out_headers;
+    /** The request's arena (see `request_arena`). Don't access directly. */
+    fiobj_arena_s *arena;
+    /** Values found by `http_param_get`. Don't access directly. */
+    FIOBJ lazy_params;
+    /** Values found by `http_cookie_get`. Don't access directly. */
+    FIOBJ lazy_cookies;
   } private_data;
   /** a time merker indicating when the request was received. */
   struct timespec received_at;
@@ -196,6 +336,19 @@ int http_set_cookie(http_s *h, http_cookie_args_s);
  */
 int http_send_body(http_s *h, void *data, uintptr_t length);
 
+/**
+ * Sends the response headers and the object's String value as the body,
+ * taking ownership of the object (it's freed).
+ *
+ * Strings and Ropes (see `fiobj_rope_new`) are sent without being copied, so
+ * a large Rope is written to the socket segment by segment (using `writev`).
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_fiobj(http_s *h, FIOBJ body);
+
 /**
  * Sends the response headers and the specified file (the response's body).
  *
@@ -216,6 +369,13 @@ int http_sendfile(http_s *h, int fd, uintptr_t length, uintptr_t offset);
  * The `encoded` string will be URL decoded while the `local` string will used
  * as is.
  *
+ * When the client accepts them (`Accept-Encoding`), pre-compressed siblings
+ * (`file.br`, then `file.gz`) are preferred. See the `compress_static` setting
+ * for on-the-fly compression.
+ *
+ * Open files (and missing ones) are cached for a short while, see
+ * `HTTP_STATIC_FD_CACHE_LIMIT` and `HTTP_STATIC_FD_CACHE_TTL`.
+ *
  * Returns 0 on success. A success value WILL CONSUME the `http_s` handle (it
  * will become invalid).
  *
@@ -243,6 +403,49 @@ int http_send_error(http_s *h, size_t error_code);
  */
 void http_finish(http_s *h);
 
+/**
+ * A frozen response template - a status line and a fixed set of headers that
+ * are rendered once and reused for every response (see `http_send_template`).
+ */
+typedef struct http_response_template_s http_response_template_s;
+
+/**
+ * Creates a response template with the `status` and `headers` (a Hash of lower
+ * case header names, the values may be Strings or Arrays of Strings).
+ *
+ * The `headers` Hash isn't consumed (it should be freed by the caller) and
+ * might be FIOBJ_INVALID.
+ *
+ * The `date` and `content-length` headers are added when the response is sent
+ * and shouldn't be part of the template.
+ *
+ * Templates should be created once (i.e., before calling `fio_start`) and freed
+ * using `http_response_template_free` once they're no longer in use.
+ */
+http_response_template_s *http_response_template_new(uintptr_t status,
+                                                     FIOBJ headers);
+
+/** Frees a response template (see `http_response_template_new`). */
+void http_response_template_free(http_response_template_s *t);
+
+/**
+ * Sends a response using a template and a body (which might be empty).
+ *
+ * When no other headers were set for the response, the pre-rendered template
+ * is sent with only the `date` and `content-length` headers added, avoiding the
+ * overhead of the header Hash. Otherwise, the template's headers are added to
+ * the response and it's sent using `http_send_body`.
+ *
+ * **Note**: The body is *copied* to the HTTP stream and it's memory should be
+ * freed by the calling function.
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_send_template(http_s *h, http_response_template_s *t, void *data,
+                       uintptr_t length);
+
 /**
  * Pushes a data response when supported (HTTP/2 only).
  *
@@ -253,6 +456,9 @@ int http_push_data(http_s *h, void *data, uintptr_t length, FIOBJ mime_type);
 /**
  * Pushes a file response when supported (HTTP/2 only).
  *
+ * The `filename` is the request path of the promised resource (i.e.,
+ * "/style.css"), served from the `public_folder`.
+ *
  * If `mime_type` is NULL, an attempt at automatic detection using `filename`
  * will be made.
  *
@@ -260,6 +466,75 @@ int http_push_data(http_s *h, void *data, uintptr_t length, FIOBJ mime_type);
  */
 int http_push_file(http_s *h, FIOBJ filename, FIOBJ mime_type);
 
+/* *****************************************************************************
+HTTP Streaming (responses of unknown length)
+***************************************************************************** */
+
+/** The named arguments for the `http_stream_start` function and macro. */
+typedef struct {
+  /**
+   * The (optional) on_ready callback is called once the buffered data was sent
+   * and more data can be written (see `http_stream_write`).
+   *
+   * The `http_s` handle is valid during the callback.
+   */
+  void (*on_ready)(http_s *h);
+  /**
+   * The (optional) on_finish callback is called once the stream ended, either
+   * by calling `http_stream_end` or when the connection was lost.
+   *
+   * The `udata` is the handle's `udata`. The `http_s` handle is invalid.
+   */
+  void (*on_finish)(void *udata);
+} http_stream_args_s;
+
+/**
+ * Sends the response headers and starts a streamed response, where the body is
+ * written in pieces using `http_stream_write` and `http_stream_end`.
+ *
+ * HTTP/1.1 responses use the `chunked` transfer encoding (unless a
+ * `content-length` header was set), HTTP/1.0 connections are closed once the
+ * stream ends (overriding any `connection` header) and HTTP/2 responses are
+ * sent as DATA frames.
+ *
+ * The `http_s` handle remains valid until `http_stream_end` is called (or
+ * `on_finish` is called). However, it can only be used by `http_stream_write`
+ * and `http_stream_end` and only within the connection's tasks: the
+ * `on_request` callback, the `on_ready` callback or an `http_resume` task (use
+ * `http_pause` to wait for data).
+ *
+ * Pipelined requests (on the same HTTP/1.1 connection) are handled once the
+ * stream ends.
+ *
+ * Returns -1 on error (the `http_s` handle should still be used to respond) and
+ * 0 on success.
+ */
+int http_stream_start(http_s *h, http_stream_args_s args);
+#define http_stream_start(h, ...)                                              \
+  http_stream_start((h), (http_stream_args_s){__VA_ARGS__})
+
+/**
+ * Writes data to a streamed response (see `http_stream_start`).
+ *
+ * **Note**: The data is *copied* to the HTTP stream and it's memory should be
+ * freed by the calling function.
+ *
+ * Returns -1 on error (i.e., the connection is closing), 0 on success or 1 if
+ * more than `HTTP_STREAM_BUFFER_LIMIT` bytes are waiting to be sent. In which
+ * case, the stream should wait for the `on_ready` callback before writing any
+ * more data.
+ */
+int http_stream_write(http_s *h, void *data, uintptr_t length);
+
+/**
+ * Ends a streamed response (see `http_stream_start`).
+ *
+ * Returns -1 on error and 0 on success.
+ *
+ * AFTER THIS FUNCTION IS CALLED, THE `http_s` OBJECT IS NO LONGER VALID.
+ */
+int http_stream_end(http_s *h);
+
 /* *****************************************************************************
 HTTP evented API (pause / resume HTTp handling)
 ***************************************************************************** */
@@ -310,6 +585,62 @@ void *http_paused_udata_get(http_pause_handle_s *http);
  */
 void *http_paused_udata_set(http_pause_handle_s *http, void *udata);
 
+/* *****************************************************************************
+HTTP coroutines (awaiting asynchronous results, see the `coroutines` setting)
+***************************************************************************** */
+
+typedef struct http_await_s http_await_s;
+
+/**
+ * Suspends the `on_request` coroutine (see the `coroutines` setting) until
+ * `http_await_resume` is called, allowing the thread to handle other events.
+ *
+ * The `task` is called once the coroutine was suspended (on the same thread,
+ * before the connection's next event) and should start the asynchronous
+ * operation (i.e., a Redis command or an `http_connect` request), calling
+ * `http_await_resume` once the result is available. The `task` MUST NOT block.
+ *
+ * On success, 0 is returned and `result` (if not NULL) is set to the value
+ * passed to `http_await_resume`.
+ *
+ * Returns -1 (without calling `task`) if the handler isn't running in a
+ * coroutine or if the connection was lost while waiting. If the connection was
+ * lost, the `http_s` handle is INVALID and the handler should clean up and
+ * return.
+ *
+ * Note: the coroutine is resumed by whichever IO thread performs the
+ *       connection's next task, which might not be the thread that suspended
+ *       it. Thread local data (`__thread` variables, `errno`, the active
+ *       `fiobj_arena_enter` arena and the allocator's per-thread caches)
+ *       changes across `http_await`, so handlers MUST NOT keep pointers to (or
+ *       rely on) thread local state from before the call.
+ */
+int http_await(http_s *h, void (*task)(http_await_s *await, void *arg),
+               void *arg, void **result);
+
+/**
+ * Resumes a coroutine suspended by `http_await`, returning `result` from
+ * `http_await`.
+ *
+ * Can be called from any thread, but MUST be called exactly once for every
+ * `http_await` task.
+ */
+void http_await_resume(http_await_s *await, void *result);
+
+/**
+ * Suspends the `on_request` coroutine while the (blocking) `task` is performed
+ * by the blocking task pool (see `fio_defer_blocking`), i.e., reading a file,
+ * returning the `task`'s result.
+ *
+ * If the handler isn't running in a coroutine, the `task` is performed
+ * immediately.
+ *
+ * Returns NULL if the connection was lost (the `task` might have been
+ * performed, so any result it allocated is leaked unless the `task` handles
+ * this).
+ */
+void *http_await_task(http_s *h, void *(*task)(void *arg), void *arg);
+
 /* *****************************************************************************
 HTTP Connections - Listening / Connecting / Hijacking
 ***************************************************************************** */
@@ -334,7 +665,7 @@ struct http_settings_s {
    * A public folder for file transfers - allows to circumvent any application
    * layer logic and simply serve static files.
    *
-   * Supports automatic `gz` pre-compressed alternatives.
+   * Supports automatic `br` and `gz` pre-compressed alternatives.
    */
   const char *public_folder;
   /**
@@ -357,6 +688,20 @@ struct http_settings_s {
    * Defaults to ~ 50Mb.
    */
   size_t max_body_size;
+  /**
+   * The maximum number of (pipelined) requests handled in a single `on_data`
+   * event, before the connection yields to other connections.
+   *
+   * Defaults to HTTP_DEFAULT_PIPELINE_LIMIT (8).
+   */
+  size_t pipeline_limit;
+  /**
+   * The maximum number of bytes read in a single `on_data` event, before the
+   * connection yields to other connections.
+   *
+   * Defaults to 0 (fill the read buffer, up to HTTP_MAX_HEADER_LENGTH bytes).
+   */
+  size_t event_read_limit;
   /**
    * The maximum number of clients that are allowed to connect concurrently.
    *
@@ -401,6 +746,115 @@ struct http_settings_s {
   uint8_t ws_timeout;
   /** Logging flag - set to TRUE to log HTTP requests. */
   uint8_t log;
+  /**
+   * Logs only one of every `log_sample` requests (per thread).
+   *
+   * Defaults to 0 (all requests are logged).
+   */
+  uint16_t log_sample;
+  /**
+   * The file descriptor the access log is written to.
+   *
+   * Defaults to 0 (`stderr`).
+   */
+  int log_fd;
+  /**
+   * When set (i.e., `"/metrics"`), requests to this path are answered with the
+   * worker's metrics (see `http_metrics2str`) rather than routed to the
+   * `on_request` callback.
+   *
+   * Note: the metrics are available to any client that can reach the server.
+   */
+  const char *metrics_path;
+  /**
+   * Set to TRUE to listen on a separate `SO_REUSEPORT` socket per worker
+   * process (see `fio_listen`). Ignored by `http_connect`.
+   */
+  uint8_t reuse_port;
+  /**
+   * Set to TRUE to compress (gzip) text based static files on-the-fly when a
+   * pre-compressed alternative is missing (see `http_sendfile2`).
+   *
+   * Files are compressed once, using the blocking task pool (the file is sent
+   * as is until the compressed data is ready). Compressed files are cached in
+   * memory, limited by the `HTTP_STATIC_COMPRESSION_CACHE` value. Requires
+   * zlib (`HAVE_ZLIB`).
+   */
+  uint8_t compress_static;
+  /**
+   * The number of seconds a response is cached in memory and served without
+   * calling `on_request` (a microcache). Defaults to 0 (no caching).
+   *
+   * Only GET requests without `cookie` or `authorization` headers are cached,
+   * keyed by the `host` header, the path and the query (as well as the request
+   * headers named by the response's `vary` header).
+   *
+   * Only 200 responses sent (synchronously) using `http_send_body` or
+   * `http_send_template` are cached, unless they set a cookie or a
+   * `cache-control` header with the `no-store`, `no-cache` or `private`
+   * directives.
+   *
+   * Once an entry expires, a single request rebuilds it while concurrent
+   * requests are served the stale response.
+   *
+   * See `HTTP_RESPONSE_CACHE` and `HTTP_RESPONSE_CACHE_LIMIT`. The cache is
+   * per worker process.
+   */
+  uint8_t cache_ttl;
+  /**
+   * Set to TRUE to allocate the request's objects (the request line and header
+   * Strings, as well as the parsed `params` and `cookies`) from an arena that's
+   * released in one step once the response was sent (`http_finish`).
+   *
+   * Objects that should outlive the request (i.e., stored using `fiobj_dup`)
+   * MUST be copied using `fiobj_arena_copy`.
+   *
+   * Currently only HTTP/1.x server connections use an arena.
+   */
+  uint8_t request_arena;
+  /**
+   * Set to TRUE to parse `multipart/form-data` request bodies while they're
+   * received, writing uploaded files directly to temporary files (rather than
+   * storing the whole body and parsing it later).
+   *
+   * The request's `params` are populated before `on_request` is called, the
+   * `body` is left empty and `http_parse_body` will return -1.
+   *
+   * Fields that don't fit in the read buffer (i.e., most uploaded files) are
+   * `fiobj_data` objects (see `fiobj_data_save`). Invalid or incomplete bodies
+   * are answered with a 400 error.
+   *
+   * Currently only HTTP/1.x server connections stream uploads.
+   */
+  uint8_t stream_uploads;
+  /**
+   * (client) Set to TRUE to reuse HTTP/1.1 keep-alive connections.
+   *
+   * Once the response was handled, the connection is returned to a pool of
+   * idle connections to the same origin (address, port and TLS object) and
+   * `on_finish` is called. Later `http_connect` calls to the same origin (with
+   * `reuse_connections` set) use a pooled connection rather than opening a
+   * new one.
+   *
+   * See `HTTP_CLIENT_POOL_LIMIT` and `HTTP_CLIENT_POOL_TIMEOUT`. WebSocket
+   * connections aren't pooled.
+   */
+  uint8_t reuse_connections;
+  /**
+   * Set to TRUE to call `on_request` within a coroutine (using a pooled stack
+   * of `HTTP_COROUTINE_STACK_SIZE` bytes) that can wait for asynchronous
+   * results using `http_await`, without blocking the thread.
+   *
+   * Handlers that return after waiting MUST send a response (or call
+   * `http_finish`), just like an `http_resume` task.
+   *
+   * A suspended handler might be resumed by a different IO thread, so thread
+   * local state isn't preserved across `http_await` (see `http_await`).
+   *
+   * Requires `HTTP_COROUTINE_SUPPORT`, otherwise `on_request` is called
+   * directly (and `http_await` fails).
+   */
+  uint8_t coroutines;
   /** a read only flag set automatically to indicate the protocol's mode. */
   uint8_t is_client;
 };
@@ -510,6 +964,19 @@ typedef struct {
    * can be copied).
    */
   void (*on_message)(ws_s *ws, fio_str_info_s msg, uint8_t is_text);
+  /**
+   * The (optional) on_fragment callback streams incoming messages. When set,
+   * it replaces `on_message` and message data is delivered (unmasked) as it
+   * arrives, without collecting the message (or a large frame) in memory.
+   *
+   * `first` marks the beginning of a message and `last` marks its end (a
+   * single call might set both). `is_text` is the message's type.
+   *
+   * The data is only valid during the callback. Streamed messages aren't
+   * limited by `ws_max_msg_size`, the callback can close the connection.
+   */
+  void (*on_fragment)(ws_s *ws, fio_str_info_s data, uint8_t is_text,
+                      uint8_t first, uint8_t last);
   /**
    * The (optional) on_open callback will be called once the websocket
    * connection is established and before is is registered with `facil`, so no
@@ -543,6 +1010,31 @@ typedef struct {
   void (*on_close)(intptr_t uuid, void *udata);
   /** Opaque user data. */
   void *udata;
+  /**
+   * If set, the permessage-deflate extension (RFC 7692) is negotiated and
+   * messages are compressed when the peer supports it. Requires zlib
+   * (`HAVE_ZLIB`).
+   */
+  uint8_t deflate;
+  /**
+   * If set, compression contexts aren't kept between messages (the
+   * `server_no_context_takeover` and `client_no_context_takeover` parameters).
+   *
+   * This lowers the compression ratio, but idle connections hold no
+   * compression memory, as messages are compressed using shared compressors.
+   */
+  uint8_t deflate_no_context_takeover;
+  /**
+   * Limits the compression window size (9-15 bits). Defaults to 15 bits.
+   *
+   * A connection keeping its compression context holds about `1 << (bits + 3)`
+   * bytes for compression and `1 << bits` bytes (plus ~7Kb) for decompression,
+   * when the peer accepts the limit.
+   *
+   * Broadcasts are compressed once for all the connections using the default
+   * window size (see `websocket_optimize4broadcasts`).
+   */
+  uint8_t deflate_max_window_bits;
 } websocket_settings_s;
 
 /**
@@ -786,6 +1278,36 @@ void http_parse_query(http_s *h);
 /** Parses any Cookie / Set-Cookie headers, using the `http_add2hash` scheme. */
 void http_parse_cookies(http_s *h, uint8_t is_url_encoded);
 
+/**
+ * Returns the value of a single parameter without parsing all of the request's
+ * parameters, scanning the query and the URL encoded body (if any) for the
+ * named parameter alone.
+ *
+ * Values are converted the same way `http_parse_query` converts them (a
+ * repeated name returns an Array). Nested names (i.e., "user[name]") aren't
+ * supported, use `http_parse_query` / `http_parse_body` for these.
+ *
+ * If the parameters were already parsed, the `params` Hash is used.
+ *
+ * The value is owned by the request, it MUST NOT be freed.
+ *
+ * Returns FIOBJ_INVALID if the parameter is missing.
+ */
+FIOBJ http_param_get(http_s *h, const char *name, size_t name_len);
+
+/**
+ * Returns the value of a single cookie without parsing all of the request's
+ * cookies, scanning the Cookie / Set-Cookie headers for the named cookie alone.
+ *
+ * Values aren't URL decoded (see `http_parse_cookies`). If the cookies were
+ * already parsed, the `cookies` Hash is used.
+ *
+ * The value is owned by the request, it MUST NOT be freed.
+ *
+ * Returns FIOBJ_INVALID if the cookie is missing.
+ */
+FIOBJ http_cookie_get(http_s *h, const char *name, size_t name_len);
+
 /**
  * Adds a named parameter to the hash, converting a string to an object and
  * resolving nesting references and URL decoding if required.
@@ -887,11 +1409,72 @@ HTTP General Helper functions that could be used globally
 FIOBJ http_req2str(http_s *h);
 
 /**
- * Writes a log line to `stderr` about the request / response object.
+ * Writes a log line to `stderr` (or the `log_fd`) about the request / response
+ * object.
+ *
+ * Log records are buffered by each thread and written in batches by a timer
+ * task (see `HTTP_LOG_FLUSH_INTERVAL`), after the response was sent.
  *
  * This function is called automatically if the `.log` setting is enabled.
  */
 void http_write_log(http_s *h);
+
+/* *****************************************************************************
+HTTP Metrics (server responses)
+***************************************************************************** */
+
+/**
+ * The number of latency histogram buckets (8 buckets per power of 2, up to
+ * ~63 seconds).
+ */
+#define HTTP_METRICS_BUCKETS 192
+
+/** The calling process's HTTP server metrics, see `http_metrics`. */
+typedef struct {
+  /** The number of responses sent. */
+  size_t requests;
+  /** The number of responses by status class (`status[0]` counts 1xx). */
+  size_t status[5];
+  /** The sum of all the response times (in microseconds). */
+  size_t latency_sum;
+  /**
+   * An HDR style histogram of the response times, in microseconds (see
+   * `http_metrics_bucket2usec` and `http_metrics_percentile`).
+   *
+   * A response time is measured from the reactor cycle in which the request
+   * was received until the response was finished (see `http_finish`).
+   */
+  size_t latency[HTTP_METRICS_BUCKETS];
+} http_metrics_s;
+
+/**
+ * Returns the calling process's HTTP server metrics (worker processes report
+ * their own metrics).
+ *
+ * Metrics are collected by each thread and merged when read.
+ */
+http_metrics_s http_metrics(void);
+
+/** Returns the smallest response time (in microseconds) counted by a bucket. */
+size_t http_metrics_bucket2usec(size_t bucket);
+
+/**
+ * Returns the response time (in microseconds) that wasn't exceeded by
+ * `percentile` percent (i.e., 99.9) of the responses.
+ *
+ * The result is accurate to within ~12.5% (the upper bound of a bucket).
+ */
+size_t http_metrics_percentile(const http_metrics_s *m, double percentile);
+
+/**
+ * Returns a String object with the calling process's metrics (both
+ * `fio_metrics` and `http_metrics`), formatted using the Prometheus text
+ * format.
+ *
+ * This is the response sent for the `metrics_path` setting.
+ */
+FIOBJ http_metrics2str(void);
+
 /* *****************************************************************************
 HTTP Time related helper functions that could be used globally
 ***************************************************************************** */
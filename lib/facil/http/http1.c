@@ -6,6 +6,7 @@ License: MIT
 
 #include <http1.h>
 #include <http1_parser.h>
+#include <http2.h>
 #include <http_internal.h>
 #include <websockets.h>
 
@@ -22,13 +23,19 @@ typedef struct http1pr_s {
   http_fio_protocol_s p;
   http1_parser_s parser;
   http_s request;
-  uintptr_t buf_len;
+  /* incoming data, NULL while idle (see `http1_buffer_release`) */
+  fio_rbuf_s *buf;
+  /* the multipart body parser (see the `stream_uploads` setting) */
+  http_upload_s *upload;
+  /* a streamed response's callbacks (see `http_stream_start`) */
+  http_stream_args_s stream;
   uintptr_t max_header_size;
   uintptr_t header_size;
   uint8_t close;
   uint8_t is_client;
   uint8_t stop;
-  uint8_t buf[];
+  /* set while a response is streamed, 2 when using the chunked encoding */
+  uint8_t streaming;
 } http1pr_s;
 
 struct http_vtable_s HTTP1_VTABLE; /* initialized later on */
@@ -40,13 +47,32 @@ Internal Helpers
 #define parser2http(x)                                                         \
   ((http1pr_s *)((uintptr_t)(x) - (uintptr_t)(&((http1pr_s *)0)->parser)))
 
+/* the parser marks chunked messages while they're parsed */
+#define parser_chunked(p) ((p)->parser.state.reserved & 64)
+
 inline static void h1_reset(http1pr_s *p) { p->header_size = 0; }
 
+/* the number of unparsed bytes following the parser's position */
+inline static intptr_t h1_leftover_len(http1pr_s *p) {
+  if (!p->buf)
+    return 0;
+  return p->buf->len -
+         (intptr_t)(p->parser.state.next - (uint8_t *)p->buf->data);
+}
+
 #define http1_pr2handle(pr) (((http1pr_s *)(pr))->request)
 #define handle2pr(h) ((http1pr_s *)h->private_data.flag)
 
 static fio_str_info_s http1pr_status2str(uintptr_t status);
 
+/* creates a String in the request's arena (if any), sharing the buffer */
+static inline FIOBJ http1_str_new(http1pr_s *p, char *data, size_t len) {
+  fiobj_arena_s *old = http_arena_enter(&p->request);
+  FIOBJ ret = fiobj_str_new_rbuf(p->buf, data, len);
+  fiobj_arena_enter(old);
+  return ret;
+}
+
 /* cleanup an HTTP/1.1 handler object */
 static inline void http1_after_finish(http_s *h) {
   http1pr_s *p = handle2pr(h);
@@ -55,7 +81,7 @@ static inline void http1_after_finish(http_s *h) {
     http_s_destroy(h, 0);
     fio_free(h);
   } else {
-    http_s_clear(h, p->p.settings->log);
+    http_s_clear(h, !p->is_client);
   }
   if (p->close)
     fio_close(p->p.uuid);
@@ -95,13 +121,37 @@ static int write_header(FIOBJ o, void *w_) {
   return 0;
 }
 
+/* writes the `connection` header according to the request's headers */
+static void http1_connection2str(http_s *h, FIOBJ dest) {
+  const uint64_t connection_hash = fiobj_obj2hash(HTTP_HEADER_CONNECTION);
+  http1pr_s *p = handle2pr(h);
+  fio_str_info_s t;
+  FIOBJ tmp = fiobj_hash_get2(h->headers, connection_hash);
+  if (tmp) {
+    t = fiobj_obj2cstr(tmp);
+    if (!t.data || !t.len || t.data[0] == 'k' || t.data[0] == 'K')
+      fiobj_str_write(dest, "connection:keep-alive\r\n", 23);
+    else {
+      fiobj_str_write(dest, "connection:close\r\n", 18);
+      p->close = 1;
+    }
+  } else {
+    t = fiobj_obj2cstr(h->version);
+    if (!p->close && t.len > 7 && t.data && t.data[5] == '1' &&
+        t.data[6] == '.' && t.data[7] == '1')
+      fiobj_str_write(dest, "connection:keep-alive\r\n", 23);
+    else {
+      fiobj_str_write(dest, "connection:close\r\n", 18);
+      p->close = 1;
+    }
+  }
+}
+
 static FIOBJ headers2str(http_s *h, uintptr_t padding) {
   if (!h->method && !!h->status_str)
     return FIOBJ_INVALID;
 
-  static uintptr_t connection_hash;
-  if (!connection_hash)
-    connection_hash = fiobj_hash_string("connection", 10);
+  const uint64_t connection_hash = fiobj_obj2hash(HTTP_HEADER_CONNECTION);
 
   struct header_writer_s w;
   {
@@ -120,25 +170,7 @@ static FIOBJ headers2str(http_s *h, uintptr_t padding) {
       if (t.data[0] == 'c' || t.data[0] == 'C')
         p->close = 1;
     } else {
-      tmp = fiobj_hash_get2(h->headers, connection_hash);
-      if (tmp) {
-        t = fiobj_obj2cstr(tmp);
-        if (!t.data || !t.len || t.data[0] == 'k' || t.data[0] == 'K')
-          fiobj_str_write(w.dest, "connection:keep-alive\r\n", 23);
-        else {
-          fiobj_str_write(w.dest, "connection:close\r\n", 18);
-          p->close = 1;
-        }
-      } else {
-        t = fiobj_obj2cstr(h->version);
-        if (!p->close && t.len > 7 && t.data && t.data[5] == '1' &&
-            t.data[6] == '.' && t.data[7] == '1')
-          fiobj_str_write(w.dest, "connection:keep-alive\r\n", 23);
-        else {
-          fiobj_str_write(w.dest, "connection:close\r\n", 18);
-          p->close = 1;
-        }
-      }
+      http1_connection2str(h, w.dest);
     }
   } else {
     if (h->method) {
@@ -154,9 +186,7 @@ static FIOBJ headers2str(http_s *h, uintptr_t padding) {
     }
     fiobj_str_write(w.dest, " HTTP/1.1\r\n", 11);
     /* make sure we have a host header? */
-    static uint64_t host_hash;
-    if (!host_hash)
-      host_hash = fiobj_hash_string("host", 4);
+    const uint64_t host_hash = fiobj_obj2hash(HTTP_HEADER_HOST);
     FIOBJ tmp;
     if (!fiobj_hash_get2(h->private_data.out_headers, host_hash) &&
         (tmp = fiobj_hash_get2(h->headers, host_hash))) {
@@ -186,12 +216,87 @@ static int http1_send_body(http_s *h, void *data, uintptr_t length) {
   http1_after_finish(h);
   return 0;
 }
+/* renders a response template's status line and headers */
+static FIOBJ http1_template2str(http_s *h, http_response_template_s *t,
+                                uintptr_t length, uintptr_t padding) {
+  http1pr_s *p = handle2pr(h);
+  fio_str_info_s head = fiobj_obj2cstr(t->http1);
+  FIOBJ packet = fiobj_str_buf(head.len + 144 + padding);
+  fiobj_str_write(packet, head.data, head.len);
+  if (!t->has_connection)
+    http1_connection2str(h, packet);
+  else if (t->close)
+    p->close = 1;
+  /* the date is the only value that changes (once a second) */
+  char tmp[48];
+  size_t len = http_time2str(tmp, fio_last_tick().tv_sec);
+  fiobj_str_write(packet, "date:", 5);
+  fiobj_str_write(packet, tmp, len);
+  fiobj_str_write(packet, "\r\nlast-modified:", 16);
+  fiobj_str_write(packet, tmp, len);
+  fiobj_str_write(packet, "\r\ncontent-length:", 17);
+  len = fio_ltoa(tmp, length, 10);
+  fiobj_str_write(packet, tmp, len);
+  fiobj_str_write(packet, "\r\n\r\n", 4);
+  return packet;
+}
+
+/** Should send a response template and data (no headers were set) */
+static int http1_send_template(http_s *h, http_response_template_s *t,
+                               void *data, uintptr_t length) {
+  FIOBJ packet = http1_template2str(h, t, length, length);
+  if (length)
+    fiobj_str_write(packet, data, length);
+  fiobj_send_free(handle2pr(h)->p.uuid, packet);
+  http1_after_finish(h);
+  return 0;
+}
+
+/** Should send a response template and a (shared) String */
+static int http1_send_cached(http_s *h, http_response_template_s *t,
+                             FIOBJ body) {
+  const intptr_t uuid = handle2pr(h)->p.uuid;
+  fio_str_info_s b = fiobj_obj2cstr(body);
+  if (b.len <= HTTP_MAX_HEADER_LENGTH) {
+    /* a single packet (system call) is cheaper than sharing small bodies */
+    return http1_send_template(h, t, b.data, b.len);
+  }
+  fiobj_send_free(uuid, http1_template2str(h, t, b.len, 0));
+  fiobj_send_free(uuid, fiobj_dup(body));
+  http1_after_finish(h);
+  return 0;
+}
+
+/** Should send existing headers and a String / Rope */
+static int http1_send_fiobj(http_s *h, FIOBJ body) {
+  const intptr_t uuid = handle2pr(h)->p.uuid;
+  if (!FIOBJ_IS_ROPE(body)) {
+    fio_str_info_s b = fiobj_obj2cstr(body);
+    if (b.len <= HTTP_MAX_HEADER_LENGTH) {
+      /* a single packet (system call) is cheaper than sharing small bodies */
+      int ret = http1_send_body(h, b.data, b.len);
+      fiobj_free(body);
+      return ret;
+    }
+  }
+  FIOBJ packet = headers2str(h, 0);
+  if (!packet) {
+    fiobj_free(body);
+    http1_after_finish(h);
+    return -1;
+  }
+  fiobj_send_free(uuid, packet);
+  fiobj_send_free(uuid, body);
+  http1_after_finish(h);
+  return 0;
+}
+
 /** Should send existing headers and file */
 static int http1_sendfile(http_s *h, int fd, uintptr_t length,
                           uintptr_t offset) {
   FIOBJ packet = headers2str(h, 0);
   if (!packet) {
-    close(fd);
+    http_sendfile_close(fd);
     http1_after_finish(h);
     return -1;
   }
@@ -202,25 +307,111 @@ static int http1_sendfile(http_s *h, int fd, uintptr_t length,
     s = fiobj_obj2cstr(packet);
     intptr_t i = pread(fd, s.data + s.len, length, offset);
     if (i < 0) {
-      close(fd);
+      http_sendfile_close(fd);
       fiobj_send_free((handle2pr(h)->p.uuid), packet);
       fio_close((handle2pr(h)->p.uuid));
       return -1;
     }
-    close(fd);
+    http_sendfile_close(fd);
     fiobj_str_resize(packet, s.len + i);
     fiobj_send_free((handle2pr(h)->p.uuid), packet);
     http1_after_finish(h);
     return 0;
   }
   fiobj_send_free((handle2pr(h)->p.uuid), packet);
-  fio_sendfile((handle2pr(h)->p.uuid), fd, offset, length);
+  fio_write2((handle2pr(h)->p.uuid), .data.fd = fd, .length = length,
+             .offset = offset, .is_fd = 1, .after.close = http_sendfile_close);
+  http1_after_finish(h);
+  return 0;
+}
+
+/** Should send existing headers and prepare for streaming */
+static int http1_stream_start(http_s *h, http_stream_args_s *args) {
+  const uint64_t cl_hash = fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH);
+  http1pr_s *p = handle2pr(h);
+  uint8_t streaming = 1;
+  if (p->is_client || p->streaming)
+    return -1;
+  if (!fiobj_hash_get2(h->private_data.out_headers, cl_hash)) {
+    fio_str_info_s v = fiobj_obj2cstr(h->version);
+    if (v.len == 8 && v.data[7] != '0') {
+      http_set_header2(
+          h, (fio_str_info_s){.data = (char *)"transfer-encoding", .len = 17},
+          (fio_str_info_s){.data = (char *)"chunked", .len = 7});
+      streaming = 2;
+    } else {
+      /* HTTP/1.0 clients read the body until the connection is closed, so a
+       * `keep-alive` value set by the application is overwritten */
+      fiobj_free(fiobj_hash_replace(h->private_data.out_headers,
+                                    HTTP_HEADER_CONNECTION,
+                                    fiobj_str_new("close", 5)));
+    }
+  }
+  FIOBJ packet = headers2str(h, 0);
+  if (!packet)
+    return -1;
+  if (fiobj_send_free(p->p.uuid, packet) < 0)
+    return -1;
+  p->stream = *args;
+  p->streaming = streaming;
+  /* pipelined requests wait until the stream ends */
+  p->stop |= 1;
+  return 0;
+}
+
+/** Should send data as part of a stream */
+static int http1_stream_write(http_s *h, void *data, uintptr_t length) {
+  http1pr_s *p = handle2pr(h);
+  if (!p->streaming)
+    return -1;
+  if (length) {
+    FIOBJ packet = fiobj_str_buf(length + 20);
+    if (p->streaming == 2) {
+      /* the chunk's size, in hex (`fio_ltoa` adds a "0x" prefix) */
+      char tmp[24];
+      size_t len = 0;
+      for (int i = (int)(sizeof(length) << 1) - 1; i >= 0; --i) {
+        const uint8_t digit = (length >> (i << 2)) & 15;
+        if (digit || len)
+          tmp[len++] = "0123456789abcdef"[digit];
+      }
+      tmp[len++] = '\r';
+      tmp[len++] = '\n';
+      fiobj_str_write(packet, tmp, len);
+    }
+    fiobj_str_write(packet, data, length);
+    if (p->streaming == 2)
+      fiobj_str_write(packet, "\r\n", 2);
+    if (fiobj_send_free(p->p.uuid, packet) < 0)
+      return -1;
+  }
+  return (fio_pending_bytes(p->p.uuid) >= HTTP_STREAM_BUFFER_LIMIT);
+}
+
+/** Should complete streaming */
+static int http1_stream_end(http_s *h) {
+  http1pr_s *p = handle2pr(h);
+  if (!p->streaming)
+    return -1;
+  void (*on_finish)(void *udata) = p->stream.on_finish;
+  void *udata = h->udata;
+  if (p->streaming == 2)
+    fio_write(p->p.uuid, "0\r\n\r\n", 5);
+  p->streaming = 0;
   http1_after_finish(h);
+  if (on_finish)
+    on_finish(udata);
+  if (!p->close && !p->stop)
+    fio_force_event(p->p.uuid, FIO_EVENT_ON_DATA);
   return 0;
 }
 
 /** Should send existing headers or complete streaming */
 static void htt1p_finish(http_s *h) {
+  if (handle2pr(h)->streaming) {
+    http1_stream_end(h);
+    return;
+  }
   FIOBJ packet = headers2str(h, 0);
   if (packet)
     fiobj_send_free((handle2pr(h)->p.uuid), packet);
@@ -267,9 +458,7 @@ static void http1_on_resume(http_s *h, http_fio_protocol_s *pr) {
 
 static intptr_t http1_hijack(http_s *h, fio_str_info_s *leftover) {
   if (leftover) {
-    intptr_t len =
-        handle2pr(h)->buf_len -
-        (intptr_t)(handle2pr(h)->parser.state.next - handle2pr(h)->buf);
+    intptr_t len = h1_leftover_len(handle2pr(h));
     if (len) {
       *leftover = (fio_str_info_s){
           .len = len, .data = (char *)handle2pr(h)->parser.state.next};
@@ -294,11 +483,25 @@ static void http1_websocket_client_on_upgrade(http_s *h, char *proto,
   websocket_settings_s *args = h->udata;
   const intptr_t uuid = handle2pr(h)->p.uuid;
   http_settings_s *set = handle2pr(h)->p.settings;
+  websocket_deflate_s pmd;
   set->udata = NULL;
+  if (websocket_deflate_confirm(
+          fiobj_hash_get2(h->headers,
+                          fiobj_obj2hash(HTTP_HEADER_WS_SEC_EXTENSIONS)),
+          args, &pmd)) {
+    FIO_LOG_WARNING("(websocket client) unexpected extension negotiation.");
+    http_finish(h);
+    p->stop = 1;
+    if (args->on_close)
+      args->on_close(0, args->udata);
+    fio_free(args);
+    fio_close(uuid);
+    return;
+  }
   http_finish(h);
   p->stop = 1;
-  websocket_attach(uuid, set, args, p->parser.state.next,
-                   p->buf_len - (intptr_t)(p->parser.state.next - p->buf));
+  websocket_attach(uuid, set, args, &pmd, p->parser.state.next,
+                   h1_leftover_len(p));
   fio_free(args);
   (void)proto;
   (void)len;
@@ -323,12 +526,8 @@ static void http1_websocket_client_on_hangup(http_settings_s *settings) {
 static int http1_http2websocket_server(http_s *h, websocket_settings_s *args) {
   // A static data used for all websocket connections.
   static char ws_key_accpt_str[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
-  static uintptr_t sec_version = 0;
-  static uintptr_t sec_key = 0;
-  if (!sec_version)
-    sec_version = fiobj_hash_string("sec-websocket-version", 21);
-  if (!sec_key)
-    sec_key = fiobj_hash_string("sec-websocket-key", 17);
+  const uint64_t sec_version = fiobj_obj2hash(HTTP_HVALUE_WS_SEC_VERSION);
+  const uint64_t sec_key = fiobj_obj2hash(HTTP_HEADER_WS_SEC_CLIENT_KEY);
 
   FIOBJ tmp = fiobj_hash_get2(h->headers, sec_version);
   if (!tmp)
@@ -352,14 +551,21 @@ static int http1_http2websocket_server(http_s *h, websocket_settings_s *args) {
   http_set_header(h, HTTP_HEADER_CONNECTION, fiobj_dup(HTTP_HVALUE_WS_UPGRADE));
   http_set_header(h, HTTP_HEADER_UPGRADE, fiobj_dup(HTTP_HVALUE_WEBSOCKET));
   http_set_header(h, HTTP_HEADER_WS_SEC_KEY, tmp);
+  websocket_deflate_s pmd;
+  tmp = websocket_deflate_accept(
+      fiobj_hash_get2(h->headers,
+                      fiobj_obj2hash(HTTP_HEADER_WS_SEC_EXTENSIONS)),
+      args, &pmd);
+  if (tmp)
+    http_set_header(h, HTTP_HEADER_WS_SEC_EXTENSIONS, tmp);
   h->status = 101;
   http1pr_s *pr = handle2pr(h);
   const intptr_t uuid = handle2pr(h)->p.uuid;
   http_settings_s *set = handle2pr(h)->p.settings;
   http_finish(h);
   pr->stop = 1;
-  websocket_attach(uuid, set, args, pr->parser.state.next,
-                   pr->buf_len - (intptr_t)(pr->parser.state.next - pr->buf));
+  websocket_attach(uuid, set, args, &pmd, pr->parser.state.next,
+                   h1_leftover_len(pr));
   return 0;
 bad_request:
   http_send_error(h, 400);
@@ -386,6 +592,11 @@ static int http1_http2websocket_client(http_s *h, websocket_settings_s *args) {
   http_set_header(h, HTTP_HEADER_UPGRADE, fiobj_dup(HTTP_HVALUE_WEBSOCKET));
   http_set_header(h, HTTP_HVALUE_WS_SEC_VERSION,
                   fiobj_dup(HTTP_HVALUE_WS_VERSION));
+  {
+    FIOBJ offer = websocket_deflate_offer(args);
+    if (offer)
+      http_set_header(h, HTTP_HEADER_WS_SEC_EXTENSIONS, offer);
+  }
 
   /* we don't set the Origin header since we're not a browser... should we? */
   // http_set_header(
@@ -529,6 +740,9 @@ Virtual Table Decleration
 struct http_vtable_s HTTP1_VTABLE = {
     .http_send_body = http1_send_body,
     .http_sendfile = http1_sendfile,
+    .http_stream_start = http1_stream_start,
+    .http_stream_write = http1_stream_write,
+    .http_stream_end = http1_stream_end,
     .http_finish = htt1p_finish,
     .http_push_data = http1_push_data,
     .http_push_file = http1_push_file,
@@ -539,6 +753,9 @@ struct http_vtable_s HTTP1_VTABLE = {
     .http_upgrade2sse = http1_upgrade2sse,
     .http_sse_write = http1_sse_write,
     .http_sse_close = http1_sse_close,
+    .http_send_template = http1_send_template,
+    .http_send_cached = http1_send_cached,
+    .http_send_fiobj = http1_send_fiobj,
 };
 
 void *http1_vtable(void) { return (void *)&HTTP1_VTABLE; }
@@ -550,26 +767,62 @@ Parser Callbacks
 /** called when a request was received. */
 static int http1_on_request(http1_parser_s *parser) {
   http1pr_s *p = parser2http(parser);
+  if (p->upload) {
+    int err = http_upload_finish(p->upload);
+    p->upload = NULL;
+    if (err) {
+      http_send_error(&http1_pr2handle(p), 400);
+      h1_reset(p);
+      return -1;
+    }
+  }
   http_on_request_handler______internal(&http1_pr2handle(p), p->p.settings);
   if (p->request.method && !p->stop)
     http_finish(&p->request);
   h1_reset(p);
   return fio_is_closed(p->p.uuid);
 }
+/* tests if a response allows a client connection to be reused */
+static int http1_response_keeps_alive(http1pr_s *p) {
+  http_s *h = &p->request;
+  if (h->status < 200 ||
+      fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_UPGRADE)))
+    return 0;
+  /* the response's length must be known (otherwise it ends with the stream) */
+  if (h->status != 204 && h->status != 304 && !parser_chunked(p) &&
+      !fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH)))
+    return 0;
+  FIOBJ tmp =
+      fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_CONNECTION));
+  if (tmp) {
+    fio_str_info_s t = fiobj_obj2cstr(tmp);
+    if (t.len && (t.data[0] == 'c' || t.data[0] == 'C'))
+      return 0;
+    if (t.len && (t.data[0] == 'k' || t.data[0] == 'K'))
+      return 1;
+  }
+  /* HTTP/1.0 connections are closed unless they say otherwise */
+  fio_str_info_s v = fiobj_obj2cstr(h->version);
+  return v.len == 8 && v.data[7] != '0';
+}
+
 /** called when a response was received. */
 static int http1_on_response(http1_parser_s *parser) {
   http1pr_s *p = parser2http(parser);
+  const int keep_alive = http1_response_keeps_alive(p);
   http_on_response_handler______internal(&http1_pr2handle(p), p->p.settings);
   if (p->request.status_str && !p->stop)
     http_finish(&p->request);
   h1_reset(p);
+  if (keep_alive && !p->stop && !fio_is_closed(p->p.uuid))
+    http_client_release(&p->p); /* returns the connection to a pool, if any */
   return fio_is_closed(p->p.uuid);
 }
 /** called when a request method is parsed. */
 static int http1_on_method(http1_parser_s *parser, char *method,
                            size_t method_len) {
   http1_pr2handle(parser2http(parser)).method =
-      fiobj_str_new(method, method_len);
+      http1_str_new(parser2http(parser), method, method_len);
   parser2http(parser)->header_size += method_len;
   return 0;
 }
@@ -579,7 +832,7 @@ static int http1_on_method(http1_parser_s *parser, char *method,
 static int http1_on_status(http1_parser_s *parser, size_t status,
                            char *status_str, size_t len) {
   http1_pr2handle(parser2http(parser)).status_str =
-      fiobj_str_new(status_str, len);
+      http1_str_new(parser2http(parser), status_str, len);
   http1_pr2handle(parser2http(parser)).status = status;
   parser2http(parser)->header_size += len;
   return 0;
@@ -587,21 +840,24 @@ static int http1_on_status(http1_parser_s *parser, size_t status,
 
 /** called when a request path (excluding query) is parsed. */
 static int http1_on_path(http1_parser_s *parser, char *path, size_t len) {
-  http1_pr2handle(parser2http(parser)).path = fiobj_str_new(path, len);
+  http1_pr2handle(parser2http(parser)).path =
+      http1_str_new(parser2http(parser), path, len);
   parser2http(parser)->header_size += len;
   return 0;
 }
 
 /** called when a request path (excluding query) is parsed. */
 static int http1_on_query(http1_parser_s *parser, char *query, size_t len) {
-  http1_pr2handle(parser2http(parser)).query = fiobj_str_new(query, len);
+  http1_pr2handle(parser2http(parser)).query =
+      http1_str_new(parser2http(parser), query, len);
   parser2http(parser)->header_size += len;
   return 0;
 }
 /** called when a the HTTP/1.x version is parsed. */
 static int http1_on_http_version(http1_parser_s *parser, char *version,
                                  size_t len) {
-  http1_pr2handle(parser2http(parser)).version = fiobj_str_new(version, len);
+  http1_pr2handle(parser2http(parser)).version =
+      http1_str_new(parser2http(parser), version, len);
   parser2http(parser)->header_size += len;
 /* start counting - occurs on the first line of both requests and responses */
 #if FIO_HTTP_EXACT_LOGGING
@@ -636,10 +892,17 @@ static int http1_on_header(http1_parser_s *parser, char *name, size_t name_len,
     http_send_error(&http1_pr2handle(parser2http(parser)), 413);
     return -1;
   }
-  sym = fiobj_str_new(name, name_len);
-  obj = fiobj_str_new(data, data_len);
+  fiobj_arena_s *old = http_arena_enter(&http1_pr2handle(parser2http(parser)));
+  /* common header names are shared, so they aren't allocated */
+  FIOBJ tmp = FIOBJ_INVALID;
+  sym = http_header_intern(name, name_len);
+  if (!sym)
+    sym = tmp = fiobj_str_new_rbuf(parser2http(parser)->buf, name, name_len);
+  /* long values reference the read buffer (copied only if edited) */
+  obj = fiobj_str_new_rbuf(parser2http(parser)->buf, data, data_len);
   set_header_add(http1_pr2handle(parser2http(parser)).headers, sym, obj);
-  fiobj_free(sym);
+  fiobj_free(tmp);
+  fiobj_arena_enter(old);
   return 0;
 }
 /** called when a body chunk is parsed. */
@@ -652,7 +915,32 @@ static int http1_on_body_chunk(http1_parser_s *parser, char *data,
     http_send_error(&http1_pr2handle(parser2http(parser)), 413);
     return -1; /* test every time, in case of chunked data */
   }
+  if (parser2http(parser)->upload) {
+    if (http_upload_write(parser2http(parser)->upload, data, data_len)) {
+      http_send_error(&http1_pr2handle(parser2http(parser)), 400);
+      return -1;
+    }
+    return 0;
+  }
   if (!parser->state.read) {
+    if (parser2http(parser)->p.settings->stream_uploads &&
+        !parser2http(parser)->is_client &&
+        (parser2http(parser)->upload =
+             http_upload_new(&http1_pr2handle(parser2http(parser))))) {
+      /* multipart data is parsed while it's received */
+      return http1_on_body_chunk(parser, data, data_len);
+    }
+    if (parser->state.content_length > 0 &&
+        (ssize_t)data_len == parser->state.content_length) {
+      /* the whole body is in the buffer - share it rather than copy it */
+      fio_rbuf_s *buf = parser2http(parser)->buf;
+      FIOBJ tmp = fiobj_data_newstr2(fio_rbuf_dup(buf)->data, buf->len,
+                                     fio_rbuf_free2);
+      http1_pr2handle(parser2http(parser)).body =
+          fiobj_data_slice(tmp, data - buf->data, data_len);
+      fiobj_free(tmp);
+      return 0;
+    }
     if (parser->state.content_length > 0 &&
         parser->state.content_length <= HTTP_MAX_HEADER_LENGTH) {
       http1_pr2handle(parser2http(parser)).body = fiobj_data_newstr();
@@ -675,16 +963,33 @@ Connection Callbacks
 *****************************************************************************
 */
 
+/* takes a read buffer from the shared pool, if the connection has none */
+static inline void http1_buffer_require(http1pr_s *p) {
+  if (!p->buf)
+    p->buf = fio_rbuf_new(HTTP_MAX_HEADER_LENGTH);
+}
+
+/* idle connections return their (empty) buffer to the shared pool */
+static inline void http1_buffer_release(http1pr_s *p) {
+  if (!p->buf || p->buf->len || p->stop)
+    return;
+  fio_rbuf_free(p->buf);
+  p->buf = NULL;
+}
+
 static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
   ssize_t i = 0;
-  size_t org_len = p->buf_len;
-  int pipeline_limit = 8;
-  if (!p->buf_len)
+  size_t consumed = 0;
+  size_t pipeline_limit = p->p.settings->pipeline_limit;
+  if (!p->buf->len) {
+    http1_buffer_release(p);
     return;
+  }
   do {
     i = http1_fio_parser(.parser = &p->parser,
-                         .buffer = p->buf + (org_len - p->buf_len),
-                         .length = p->buf_len, .on_request = http1_on_request,
+                         .buffer = p->buf->data + consumed,
+                         .length = p->buf->len - consumed,
+                         .on_request = http1_on_request,
                          .on_response = http1_on_response,
                          .on_method = http1_on_method,
                          .on_status = http1_on_status, .on_path = http1_on_path,
@@ -693,15 +998,14 @@ static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
                          .on_header = http1_on_header,
                          .on_body_chunk = http1_on_body_chunk,
                          .on_error = http1_on_error);
-    p->buf_len -= i;
+    consumed += i;
     --pipeline_limit;
-  } while (i && p->buf_len && pipeline_limit && !p->stop);
+  } while (i && consumed < p->buf->len && pipeline_limit && !p->stop);
 
-  if (p->buf_len && org_len != p->buf_len) {
-    memmove(p->buf, p->buf + (org_len - p->buf_len), p->buf_len);
-  }
+  /* moves (or copies, if shared) the leftover data */
+  fio_rbuf_consume(&p->buf, consumed);
 
-  if (p->buf_len == HTTP_MAX_HEADER_LENGTH) {
+  if (p->buf->len == HTTP_MAX_HEADER_LENGTH) {
     /* no room to read... parser not consuming data */
     if (p->request.method)
       http_send_error(&p->request, 413);
@@ -714,6 +1018,7 @@ static inline void http1_consume_data(intptr_t uuid, http1pr_s *p) {
   if (!pipeline_limit) {
     fio_force_event(uuid, FIO_EVENT_ON_DATA);
   }
+  http1_buffer_release(p);
 }
 
 /** called when a data is available, but will not run concurrently */
@@ -724,15 +1029,29 @@ static void http1_on_data(intptr_t uuid, fio_protocol_s *protocol) {
     return;
   }
   ssize_t i = 0;
-  if (HTTP_MAX_HEADER_LENGTH - p->buf_len)
-    i = fio_read(uuid, p->buf + p->buf_len,
-                 HTTP_MAX_HEADER_LENGTH - p->buf_len);
+  size_t limit;
+  http1_buffer_require(p);
+  limit = HTTP_MAX_HEADER_LENGTH - p->buf->len;
+  if (p->p.settings->event_read_limit &&
+      limit > p->p.settings->event_read_limit)
+    limit = p->p.settings->event_read_limit;
+  if (limit)
+    i = fio_read(uuid, p->buf->data + p->buf->len, limit);
   if (i > 0) {
-    p->buf_len += i;
+    /* leftover socket data is reported by the next polling cycle */
+    p->buf->len += i;
   }
   http1_consume_data(uuid, p);
 }
 
+/** called when the outgoing buffer was drained, used by streamed responses */
+static void http1_on_ready(intptr_t uuid, fio_protocol_s *protocol) {
+  http1pr_s *p = (http1pr_s *)protocol;
+  if (p->streaming && p->stream.on_ready)
+    p->stream.on_ready(&p->request);
+  (void)uuid;
+}
+
 /** called when the connection was closed, but will not run concurrently */
 static void http1_on_close(intptr_t uuid, fio_protocol_s *protocol) {
   http1_destroy(protocol);
@@ -744,17 +1063,26 @@ static void http1_on_data_first_time(intptr_t uuid, fio_protocol_s *protocol) {
   http1pr_s *p = (http1pr_s *)protocol;
   ssize_t i;
 
-  i = fio_read(uuid, p->buf + p->buf_len, HTTP_MAX_HEADER_LENGTH - p->buf_len);
+  http1_buffer_require(p);
+  i = fio_read(uuid, p->buf->data + p->buf->len,
+               HTTP_MAX_HEADER_LENGTH - p->buf->len);
 
-  if (i <= 0)
+  if (i <= 0) {
+    http1_buffer_release(p);
     return;
-  p->buf_len += i;
+  }
+  p->buf->len += i;
 
   /* ensure future reads skip this first time HTTP/2.0 test */
   p->p.protocol.on_data = http1_on_data;
-  if (i >= 24 && !memcmp(p->buf, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24)) {
-    FIO_LOG_WARNING("client claimed unsupported HTTP/2 prior knowledge.");
-    fio_close(uuid);
+  if (i >= HTTP2_PREFACE_LEN &&
+      !memcmp(p->buf->data, HTTP2_PREFACE, HTTP2_PREFACE_LEN)) {
+    if (!HTTP_ENABLE_HTTP2 || p->is_client ||
+        !http2_new(uuid, p->p.settings, p->buf->data, p->buf->len)) {
+      FIO_LOG_WARNING("client claimed unsupported HTTP/2 prior knowledge.");
+      fio_close(uuid);
+    }
+    /* the HTTP/1.1 protocol object is freed once replaced */
     return;
   }
 
@@ -773,13 +1101,14 @@ fio_protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
                           void *unread_data, size_t unread_length) {
   if (unread_data && unread_length > HTTP_MAX_HEADER_LENGTH)
     return NULL;
-  http1pr_s *p = fio_malloc(sizeof(*p) + HTTP_MAX_HEADER_LENGTH);
+  http1pr_s *p = fio_malloc(sizeof(*p));
   // FIO_LOG_DEBUG("Allocated HTTP/1.1 protocol at. %p", (void *)p);
   FIO_ASSERT_ALLOC(p);
   *p = (http1pr_s){
       .p.protocol =
           {
               .on_data = http1_on_data_first_time,
+              .on_ready = http1_on_ready,
               .on_close = http1_on_close,
           },
       .p.uuid = uuid,
@@ -788,9 +1117,12 @@ fio_protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
       .is_client = settings->is_client,
   };
   http_s_new(&p->request, &p->p, &HTTP1_VTABLE);
+  if (settings->request_arena && !settings->is_client)
+    p->request.private_data.arena = fiobj_arena_new();
   if (unread_data && unread_length <= HTTP_MAX_HEADER_LENGTH) {
-    memcpy(p->buf, unread_data, unread_length);
-    p->buf_len = unread_length;
+    http1_buffer_require(p);
+    memcpy(p->buf->data, unread_data, unread_length);
+    p->buf->len = unread_length;
   }
   fio_attach(uuid, &p->p.protocol);
   if (unread_data && unread_length <= HTTP_MAX_HEADER_LENGTH) {
@@ -802,8 +1134,13 @@ fio_protocol_s *http1_new(uintptr_t uuid, http_settings_s *settings,
 /** Manually destroys the HTTP1 protocol object. */
 void http1_destroy(fio_protocol_s *pr) {
   http1pr_s *p = (http1pr_s *)pr;
+  http_upload_free(p->upload);
+  if (p->streaming && p->stream.on_finish)
+    p->stream.on_finish(http1_pr2handle(p).udata);
   http1_pr2handle(p).status = 0;
   http_s_destroy(&http1_pr2handle(p), 0);
+  fiobj_arena_free(http1_pr2handle(p).private_data.arena);
+  fio_rbuf_free(p->buf);
   fio_free(p);
   // FIO_LOG_DEBUG("Deallocated HTTP/1.1 protocol at. %p", (void *)p);
 }
@@ -894,3 +1231,180 @@ static fio_str_info_s http1pr_status2str(uintptr_t status) {
   return ret;
 }
 #undef HTTP_SET_STATUS_STR
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+#if DEBUG
+#include <sys/socket.h>
+
+static http_s *http1_test_stream;
+static size_t http1_test_finished;
+static uint8_t http1_test_keep_alive;
+
+static void http1_test_on_finish(void *udata) {
+  ++http1_test_finished;
+  (void)udata;
+}
+
+static void http1_test_on_request(http_s *h) {
+  if (http1_test_keep_alive)
+    http_set_header(h, HTTP_HEADER_CONNECTION, fiobj_str_new("keep-alive", 10));
+  FIO_ASSERT(!http_stream_start(h, .on_finish = http1_test_on_finish),
+             "http_stream_start failed\n");
+  http1_test_stream = h;
+}
+
+static char http1_test_request[64];
+
+static void http1_test_on_request_copy(http_s *h) {
+  FIOBJ host = fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_HOST));
+  snprintf(http1_test_request, sizeof(http1_test_request), "%s %s",
+           fiobj_obj2cstr(h->path).data, fiobj_obj2cstr(host).data);
+  http_send_body(h, "ok", 2);
+}
+
+/* attaches the HTTP/1.x protocol to a new socket pair (`fd` is the client) */
+static intptr_t http1_test_conn(http_settings_s *settings, int *fd) {
+  int fds[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds), "socketpair failed\n");
+  FIO_ASSERT(fio_set_non_block(fds[0]) != -1, "non-blocking mode failed\n");
+  intptr_t uuid = fio_fd2uuid(fds[0]);
+  FIO_ASSERT(http1_new(uuid, settings, NULL, 0), "http1_new failed\n");
+  *fd = fds[1];
+  return uuid;
+}
+
+/* writes the client's data and lets the protocol read it */
+static void http1_test_feed(intptr_t uuid, int fd, const char *data) {
+  const size_t len = strlen(data);
+  FIO_ASSERT(write(fd, data, len) == (ssize_t)len, "test write failed\n");
+  fio_protocol_s *pr = fio_protocol_try_lock(uuid, FIO_PR_LOCK_TASK);
+  FIO_ASSERT(pr, "the HTTP/1.x protocol is missing\n");
+  pr->on_data(uuid, pr);
+  fio_protocol_unlock(pr, FIO_PR_LOCK_TASK);
+}
+
+/* flushes the connection, reading up to `capa - 1` bytes into `buf` */
+static size_t http1_test_drain(intptr_t uuid, int fd, char *buf, size_t capa) {
+  char tmp[16384];
+  size_t total = 0;
+  ssize_t flushed;
+  do {
+    ssize_t r;
+    flushed = fio_flush(uuid);
+    while ((r = recv(fd, tmp, sizeof(tmp), MSG_DONTWAIT)) > 0) {
+      if (total + 1 < capa)
+        memcpy(buf + total, tmp,
+               ((size_t)r < capa - 1 - total) ? (size_t)r : capa - 1 - total);
+      total += r;
+    }
+  } while (flushed > 0);
+  buf[(total < capa) ? total : capa - 1] = 0;
+  return total;
+}
+
+void http1_tests(void) {
+  fprintf(stderr, "=== Testing HTTP/1.x streamed responses\n");
+  {
+    http_settings_s settings = {.on_request = http1_test_on_request,
+                                .max_header_size = 8192,
+                                .pipeline_limit = 8};
+    char buf[1024];
+    int fd;
+    intptr_t uuid = http1_test_conn(&settings, &fd);
+    /* HTTP/1.1 - the chunked encoding */
+    http1_test_feed(uuid, fd, "GET / HTTP/1.1\r\nhost: x\r\n\r\n");
+    FIO_ASSERT(http1_test_stream, "the stream wasn't started\n");
+    char data[300];
+    memset(data, 'x', sizeof(data));
+    FIO_ASSERT(!http_stream_write(http1_test_stream, "hello", 5) &&
+                   !http_stream_write(http1_test_stream, data, sizeof(data)),
+               "http_stream_write failed\n");
+    http1_test_drain(uuid, fd, buf, sizeof(buf));
+    char *body = strstr(buf, "\r\n\r\n");
+    FIO_ASSERT(strstr(buf, "transfer-encoding:chunked\r\n") && body &&
+                   !strncmp(body + 4, "5\r\nhello\r\n12c\r\nxxx", 18) &&
+                   !strcmp(body + 4 + 10 + 5 + 300, "\r\n"),
+               "chunked stream error:\n%s\n", buf);
+    /* back-pressure */
+    char *big = fio_malloc(HTTP_STREAM_BUFFER_LIMIT);
+    FIO_ASSERT_ALLOC(big);
+    memset(big, 'y', HTTP_STREAM_BUFFER_LIMIT);
+    FIO_ASSERT(http_stream_write(http1_test_stream, big,
+                                 HTTP_STREAM_BUFFER_LIMIT) == 1,
+               "http_stream_write should ask to wait for `on_ready`\n");
+    fio_free(big);
+    FIO_ASSERT(http1_test_drain(uuid, fd, buf, sizeof(buf)) >
+                       HTTP_STREAM_BUFFER_LIMIT &&
+                   !http_stream_write(http1_test_stream, "z", 1),
+               "http_stream_write should succeed once drained\n");
+    http1_test_drain(uuid, fd, buf, sizeof(buf));
+    FIO_ASSERT(!http_stream_end(http1_test_stream) &&
+                   http1_test_finished == 1,
+               "`on_finish` wasn't called when the stream ended\n");
+    http1_test_drain(uuid, fd, buf, sizeof(buf));
+    FIO_ASSERT(!strcmp(buf, "0\r\n\r\n") && !fio_is_closed(uuid),
+               "chunked stream terminator error (%s)\n", buf);
+    fio_defer_perform();
+    /* the connection is lost while streaming */
+    http1_test_stream = NULL;
+    http1_test_feed(uuid, fd, "GET / HTTP/1.1\r\nhost: x\r\n\r\n");
+    FIO_ASSERT(http1_test_stream, "the stream wasn't started (2)\n");
+    fio_force_close(uuid);
+    fio_defer_perform();
+    FIO_ASSERT(http1_test_finished == 2,
+               "`on_finish` wasn't called when the connection was lost\n");
+    close(fd);
+    /* HTTP/1.0 - the body ends when the connection is closed */
+    http1_test_keep_alive = 1;
+    uuid = http1_test_conn(&settings, &fd);
+    http1_test_feed(uuid, fd, "GET / HTTP/1.0\r\nhost: x\r\n\r\n");
+    FIO_ASSERT(!http_stream_write(http1_test_stream, "hello", 5) &&
+                   !http_stream_end(http1_test_stream) &&
+                   http1_test_finished == 3,
+               "HTTP/1.0 stream error\n");
+    http1_test_drain(uuid, fd, buf, sizeof(buf));
+    body = strstr(buf, "\r\n\r\n");
+    FIO_ASSERT(strstr(buf, "connection:close\r\n") &&
+                   !strstr(buf, "keep-alive") && body &&
+                   !strcmp(body + 4, "hello") && fio_is_closed(uuid),
+               "HTTP/1.0 streams should close the connection:\n%s\n", buf);
+    http1_test_keep_alive = 0;
+    fio_defer_perform();
+    close(fd);
+  }
+  fprintf(stderr, "=== Testing HTTP/1.x read buffers (released while idle)\n");
+  {
+    http_settings_s settings = {.on_request = http1_test_on_request_copy,
+                                .max_header_size = 8192,
+                                .pipeline_limit = 8};
+    static const char *parts[] = {"GET /spl", "it HTTP/1.1\r\nho",
+                                  "st: x\r\n\r\n"};
+    int fd;
+    intptr_t uuid = http1_test_conn(&settings, &fd);
+    http1pr_s *p = (http1pr_s *)fio_protocol_try_lock(uuid, FIO_PR_LOCK_TASK);
+    FIO_ASSERT(p && !p->buf, "new connections shouldn't hold a read buffer\n");
+    fio_protocol_unlock(&p->p.protocol, FIO_PR_LOCK_TASK);
+    for (size_t round = 0; round < 2; ++round) {
+      http1_test_request[0] = 0;
+      for (size_t i = 0; i < 2; ++i) {
+        http1_test_feed(uuid, fd, parts[i]);
+        FIO_ASSERT(p->buf && p->buf->len && !http1_test_request[0],
+                   "a partial request should keep the read buffer\n");
+      }
+      http1_test_feed(uuid, fd, parts[2]);
+      FIO_ASSERT(!strcmp(http1_test_request, "/split x"),
+                 "data lost between reads (%s)\n", http1_test_request);
+      FIO_ASSERT(!p->buf, "idle connections should release the buffer\n");
+      /* an `on_data` event without data (i.e., a forced event) */
+      fio_defer_perform();
+      http1_test_feed(uuid, fd, "");
+      FIO_ASSERT(!p->buf, "the buffer should stay released while idle\n");
+    }
+    fio_force_close(uuid);
+    fio_defer_perform();
+    close(fd);
+  }
+}
+#endif
@@ -0,0 +1,1992 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+*/
+#include <fio.h>
+
+#include <http2.h>
+#include <http_internal.h>
+
+#include <fiobj.h>
+#include <hpack.h>
+
+#include <stddef.h>
+
+/* *****************************************************************************
+HTTP/2 Constants (RFC 7540)
+***************************************************************************** */
+
+enum {
+  H2_DATA = 0x0,
+  H2_HEADERS = 0x1,
+  H2_PRIORITY = 0x2,
+  H2_RST_STREAM = 0x3,
+  H2_SETTINGS = 0x4,
+  H2_PUSH_PROMISE = 0x5,
+  H2_PING = 0x6,
+  H2_GOAWAY = 0x7,
+  H2_WINDOW_UPDATE = 0x8,
+  H2_CONTINUATION = 0x9,
+};
+
+enum {
+  H2_FLAG_END_STREAM = 0x1,
+  H2_FLAG_ACK = 0x1,
+  H2_FLAG_END_HEADERS = 0x4,
+  H2_FLAG_PADDED = 0x8,
+  H2_FLAG_PRIORITY = 0x20,
+};
+
+enum {
+  H2_NO_ERROR = 0x0,
+  H2_PROTOCOL_ERROR = 0x1,
+  H2_INTERNAL_ERROR = 0x2,
+  H2_FLOW_CONTROL_ERROR = 0x3,
+  H2_STREAM_CLOSED = 0x5,
+  H2_FRAME_SIZE_ERROR = 0x6,
+  H2_REFUSED_STREAM = 0x7,
+  H2_CANCEL = 0x8,
+  H2_COMPRESSION_ERROR = 0x9,
+  H2_ENHANCE_YOUR_CALM = 0xb,
+};
+
+enum {
+  H2_SETTINGS_HEADER_TABLE_SIZE = 0x1,
+  H2_SETTINGS_ENABLE_PUSH = 0x2,
+  H2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+  H2_SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+  H2_SETTINGS_MAX_FRAME_SIZE = 0x5,
+  H2_SETTINGS_MAX_HEADER_LIST_SIZE = 0x6,
+};
+
+/* the (default) frame size we accept, we never advertise a larger one */
+#define H2_MAX_FRAME 16384
+/* the default flow control window */
+#define H2_DEFAULT_WINDOW 65535
+/* the largest flow control window */
+#define H2_MAX_WINDOW 0x7FFFFFFF
+/* DATA frames (with their header) are kept below the allocator's block limit */
+#define H2_DATA_CHUNK (16384 - 32)
+
+/* *****************************************************************************
+The HTTP/2 Protocol Object
+***************************************************************************** */
+
+/* stream state flags */
+enum {
+  /* the client sent END_STREAM (or the stream was promised by the server) */
+  H2S_REMOTE_CLOSED = 1,
+  /* the request was handed to the user */
+  H2S_DISPATCHED = 2,
+  /* the stream is protected while a callback is running */
+  H2S_HANDLER = 4,
+  /* the response headers were sent, pending data might follow */
+  H2S_RESPONDED = 8,
+  /* END_STREAM should be sent once the pending data was sent */
+  H2S_END = 16,
+  /* the stream is complete (or reset) and can be freed */
+  H2S_DONE = 32,
+  /* the stream was reset by the client */
+  H2S_RESET = 64,
+  /* a server initiated (pushed) stream */
+  H2S_PUSHED = 128,
+  /* a header or body limit was exceeded */
+  H2S_TOO_LARGE = 256,
+  /* the request was malformed */
+  H2S_MALFORMED = 512,
+  /* the request used the "https" scheme */
+  H2S_HTTPS = 1024,
+  /* the response is streamed (see `http_stream_start`) */
+  H2S_STREAMING = 2048,
+};
+
+typedef struct {
+  /* the request / response handle, MUST be the first member */
+  http_s h;
+  /* the connection's stream list */
+  fio_ls_embd_s node;
+  /* EventSource streams are attached to an SSE object */
+  http_sse_internal_s *sse;
+  /* a streamed response's callbacks (see `http_stream_start`) */
+  http_stream_args_s stream;
+  /* pending response data (a String) */
+  FIOBJ body;
+  size_t body_pos;
+  /* pending response file, or -1 */
+  int fd;
+  uintptr_t fd_offset;
+  uintptr_t fd_len;
+  /* the request's content-length, if known */
+  intptr_t content_length;
+  /* the stream's send window */
+  int64_t window;
+  uint32_t id;
+  uint16_t flags;
+  /* pending `http_pause` calls, the handle is valid until they resume */
+  uint16_t paused;
+} h2stream_s;
+
+typedef struct {
+  http_fio_protocol_s p;
+  /* incoming data */
+  fio_rbuf_s *buf;
+  /* an incomplete header block (HEADERS + CONTINUATION frames) */
+  FIOBJ block;
+  /* active streams, in order of creation */
+  fio_ls_embd_s streams;
+  /* the connection's send window */
+  int64_t window;
+  /* connecion level data that wasn't acknowledged (WINDOW_UPDATE) yet */
+  size_t recv_unacked;
+  /* the stream expecting CONTINUATION frames */
+  uint32_t block_stream;
+  /* the highest stream ID opened by the client */
+  uint32_t last_stream;
+  /* the last stream ID promised by the server */
+  uint32_t push_stream;
+  uint32_t stream_count;
+  uint32_t push_count;
+  /* the peer's settings */
+  uint32_t peer_window;
+  uint32_t peer_frame;
+  uint32_t peer_streams;
+  uint8_t peer_push;
+  /* the END_STREAM flag of the incomplete header block */
+  uint8_t block_end_stream;
+  /* the client's connection preface wasn't consumed yet */
+  uint8_t preface;
+  /* GOAWAY was sent or received, no new streams are accepted */
+  uint8_t goaway;
+  /* the decoder's dynamic table */
+  hpack_table_s hpack;
+} http2pr_s;
+
+struct http_vtable_s HTTP2_VTABLE; /* initialized later on */
+
+/* *****************************************************************************
+Internal Helpers
+***************************************************************************** */
+
+#define handle2pr(h) ((http2pr_s *)h->private_data.flag)
+#define handle2stream(h) ((h2stream_s *)(h))
+
+inline static void h2_u32_write(uint8_t *dest, uint32_t i) {
+  dest[0] = (uint8_t)(i >> 24);
+  dest[1] = (uint8_t)(i >> 16);
+  dest[2] = (uint8_t)(i >> 8);
+  dest[3] = (uint8_t)i;
+}
+
+inline static uint32_t h2_u32_read(const uint8_t *src) {
+  return ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) |
+         ((uint32_t)src[2] << 8) | (uint32_t)src[3];
+}
+
+/* writes a frame header (9 bytes) */
+inline static void h2_frame_header(uint8_t *dest, size_t len, uint8_t type,
+                                   uint8_t flags, uint32_t sid) {
+  dest[0] = (uint8_t)(len >> 16);
+  dest[1] = (uint8_t)(len >> 8);
+  dest[2] = (uint8_t)len;
+  dest[3] = type;
+  dest[4] = flags;
+  h2_u32_write(dest + 5, sid & 0x7FFFFFFF);
+}
+
+/* sends a (small) control frame */
+static void h2_send_frame(http2pr_s *p, uint8_t type, uint8_t flags,
+                          uint32_t sid, const void *payload, size_t len) {
+  uint8_t buf[9 + 64];
+  h2_frame_header(buf, len, type, flags, sid);
+  if (len)
+    memcpy(buf + 9, payload, len);
+  fio_write(p->p.uuid, buf, len + 9);
+}
+
+static void h2_send_rst(http2pr_s *p, uint32_t sid, uint32_t error) {
+  uint8_t tmp[4];
+  h2_u32_write(tmp, error);
+  h2_send_frame(p, H2_RST_STREAM, 0, sid, tmp, 4);
+}
+
+static void h2_send_window_update(http2pr_s *p, uint32_t sid, size_t inc) {
+  uint8_t tmp[4];
+  h2_u32_write(tmp, (uint32_t)inc);
+  h2_send_frame(p, H2_WINDOW_UPDATE, 0, sid, tmp, 4);
+}
+
+/* sends GOAWAY, closing the connection on errors. always returns -1 */
+static int h2_send_goaway(http2pr_s *p, uint32_t error) {
+  uint8_t tmp[8];
+  h2_u32_write(tmp, p->last_stream);
+  h2_u32_write(tmp + 4, error);
+  h2_send_frame(p, H2_GOAWAY, 0, 0, tmp, 8);
+  p->goaway = 1;
+  if (error) {
+    FIO_LOG_DEBUG("(HTTP/2) connection error %u for %p", (unsigned)error,
+                  (void *)p->p.uuid);
+    fio_close(p->p.uuid);
+  }
+  return -1;
+}
+
+/* *****************************************************************************
+Streams
+***************************************************************************** */
+
+static h2stream_s *h2_stream_find(http2pr_s *p, uint32_t id) {
+  FIO_LS_EMBD_FOR(&p->streams, node) {
+    h2stream_s *s = FIO_LS_EMBD_OBJ(h2stream_s, node, node);
+    if (s->id == id)
+      return s;
+  }
+  return NULL;
+}
+
+static h2stream_s *h2_stream_new(http2pr_s *p, uint32_t id, uint16_t flags) {
+  h2stream_s *s = fio_malloc(sizeof(*s));
+  FIO_ASSERT_ALLOC(s);
+  *s = (h2stream_s){
+      .fd = -1,
+      .content_length = -1,
+      .window = p->peer_window,
+      .id = id,
+      .flags = flags,
+  };
+  http_s_new(&s->h, &p->p, &HTTP2_VTABLE);
+  s->h.version = fiobj_str_new("HTTP/2", 6);
+  fio_ls_embd_push(&p->streams, &s->node);
+  if (flags & H2S_PUSHED)
+    ++p->push_count;
+  else
+    ++p->stream_count;
+  return s;
+}
+
+static void h2_stream_free(http2pr_s *p, h2stream_s *s) {
+  fio_ls_embd_remove(&s->node);
+  if (s->flags & H2S_PUSHED)
+    --p->push_count;
+  else
+    --p->stream_count;
+  if (!(s->flags & (H2S_REMOTE_CLOSED | H2S_RESET)) &&
+      !fio_is_closed(p->p.uuid)) {
+    /* we responded before the request was complete, stop the upload */
+    h2_send_rst(p, s->id, H2_NO_ERROR);
+  }
+  if (s->sse)
+    http_sse_destroy(s->sse);
+  if ((s->flags & H2S_STREAMING) && s->stream.on_finish)
+    s->stream.on_finish(s->h.udata);
+  http_s_destroy(&s->h, 0);
+  fiobj_free(s->body);
+  if (s->fd != -1)
+    http_sendfile_close(s->fd);
+  fio_free(s);
+}
+
+/* sends a single DATA frame (if permitted), returns 1 if a frame was sent */
+static int h2_stream_send(http2pr_s *p, h2stream_s *s) {
+  size_t remaining = s->body ? fiobj_obj2cstr(s->body).len - s->body_pos
+                             : (s->fd != -1 ? s->fd_len : 0);
+  if (!remaining) {
+    if (!(s->flags & H2S_END))
+      return 0;
+    h2_send_frame(p, H2_DATA, H2_FLAG_END_STREAM, s->id, NULL, 0);
+    s->flags |= H2S_DONE;
+    return 1;
+  }
+  int64_t window = (p->window < s->window ? p->window : s->window);
+  if (window <= 0)
+    return 0;
+  size_t len = remaining;
+  if ((int64_t)len > window)
+    len = (size_t)window;
+  if (len > p->peer_frame)
+    len = p->peer_frame;
+  if (len > H2_DATA_CHUNK)
+    len = H2_DATA_CHUNK;
+  const uint8_t end = (len == remaining && (s->flags & H2S_END));
+  uint8_t *buf = fio_malloc(len + 9);
+  FIO_ASSERT_ALLOC(buf);
+  h2_frame_header(buf, len, H2_DATA, (end ? H2_FLAG_END_STREAM : 0), s->id);
+  if (s->body) {
+    memcpy(buf + 9, fiobj_obj2cstr(s->body).data + s->body_pos, len);
+    s->body_pos += len;
+    if (len == remaining) {
+      fiobj_free(s->body);
+      s->body = FIOBJ_INVALID;
+      s->body_pos = 0;
+    }
+  } else {
+    ssize_t r = pread(s->fd, buf + 9, len, s->fd_offset);
+    if (r != (ssize_t)len) {
+      FIO_LOG_ERROR("(HTTP/2) couldn't read file for stream %u",
+                    (unsigned)s->id);
+      fio_free(buf);
+      h2_send_rst(p, s->id, H2_INTERNAL_ERROR);
+      s->flags |= H2S_DONE | H2S_RESET;
+      return 1;
+    }
+    s->fd_offset += len;
+    s->fd_len -= len;
+    if (!s->fd_len) {
+      http_sendfile_close(s->fd);
+      s->fd = -1;
+    }
+  }
+  fio_write2(p->p.uuid, .data.buffer = buf, .length = len + 9,
+             .after.dealloc = fio_free);
+  p->window -= len;
+  s->window -= len;
+  if (end)
+    s->flags |= H2S_DONE;
+  return 1;
+}
+
+/* sends pending data (round robin) and frees completed streams */
+static void h2_flush(http2pr_s *p) {
+  int progress;
+  do {
+    progress = 0;
+    FIO_LS_EMBD_FOR(&p->streams, node) {
+      h2stream_s *s = FIO_LS_EMBD_OBJ(h2stream_s, node, node);
+      if ((s->flags & (H2S_RESPONDED | H2S_DONE)) != H2S_RESPONDED)
+        continue;
+      progress |= h2_stream_send(p, s);
+    }
+  } while (progress && fio_pending(p->p.uuid) < HTTP2_PENDING_LIMIT);
+
+  fio_ls_embd_s *pos = p->streams.next;
+  while (pos != &p->streams) {
+    h2stream_s *s = FIO_LS_EMBD_OBJ(h2stream_s, node, pos);
+    pos = pos->next;
+    if ((s->flags & (H2S_DONE | H2S_HANDLER)) == H2S_DONE && !s->paused)
+      h2_stream_free(p, s);
+  }
+  if (p->goaway && !fio_ls_embd_any(&p->streams))
+    fio_close(p->p.uuid);
+}
+
+/* *****************************************************************************
+Header Blocks
+***************************************************************************** */
+
+/* sends a header block using HEADERS / PUSH_PROMISE + CONTINUATION frames */
+static void h2_send_block(http2pr_s *p, uint8_t type, uint32_t sid,
+                          uint32_t promised, FIOBJ block, uint8_t end_stream) {
+  fio_str_info_s b = fiobj_obj2cstr(block);
+  const size_t prefix = (type == H2_PUSH_PROMISE ? 4 : 0);
+  size_t frame = p->peer_frame;
+  if (frame > H2_MAX_FRAME)
+    frame = H2_MAX_FRAME;
+  const size_t count = (b.len + prefix) / frame + 1;
+  uint8_t *buf = fio_malloc(b.len + prefix + (count * 9));
+  FIO_ASSERT_ALLOC(buf);
+  size_t pos = 0;
+  size_t written = 0;
+  do {
+    size_t len = b.len - written;
+    uint8_t flags = 0;
+    if (len + (written ? 0 : prefix) > frame)
+      len = frame - (written ? 0 : prefix);
+    if (written + len == b.len)
+      flags |= H2_FLAG_END_HEADERS;
+    if (!written) {
+      if (end_stream)
+        flags |= H2_FLAG_END_STREAM;
+      h2_frame_header(buf + pos, len + prefix, type, flags, sid);
+      pos += 9;
+      if (prefix) {
+        h2_u32_write(buf + pos, promised);
+        pos += 4;
+      }
+    } else {
+      h2_frame_header(buf + pos, len, H2_CONTINUATION, flags, sid);
+      pos += 9;
+    }
+    memcpy(buf + pos, b.data + written, len);
+    pos += len;
+    written += len;
+  } while (written < b.len);
+  fio_write2(p->p.uuid, .data.buffer = buf, .length = pos,
+             .after.dealloc = fio_free);
+}
+
+/* encodes a header into the block, lower casing the name if required */
+static void h2_block_write(FIOBJ dest, fio_str_info_s name,
+                           fio_str_info_s value) {
+  char tmp[128];
+  fio_str_info_s d = fiobj_obj2cstr(dest);
+  fiobj_str_capa_assert(dest, d.len + name.len + value.len + 12);
+  d = fiobj_obj2cstr(dest);
+  size_t i = 0;
+  while (i < name.len && (name.data[i] < 'A' || name.data[i] > 'Z'))
+    ++i;
+  if (i < name.len) {
+    char *lower = (name.len <= sizeof(tmp) ? tmp : fio_malloc(name.len));
+    for (i = 0; i < name.len; ++i)
+      lower[i] = (name.data[i] >= 'A' && name.data[i] <= 'Z')
+                     ? name.data[i] | 32
+                     : name.data[i];
+    d.len += hpack_encode((uint8_t *)d.data + d.len, lower, name.len,
+                          value.data, value.len);
+    if (lower != tmp)
+      fio_free(lower);
+  } else {
+    d.len += hpack_encode((uint8_t *)d.data + d.len, name.data, name.len,
+                          value.data, value.len);
+  }
+  fiobj_str_resize(dest, d.len);
+}
+
+struct h2_header_writer_s {
+  FIOBJ dest;
+  FIOBJ name;
+  uint8_t in_array;
+};
+
+static int h2_write_header(FIOBJ o, void *w_) {
+  struct h2_header_writer_s *w = w_;
+  if (!w->in_array)
+    w->name = fiobj_hash_key_in_loop();
+  if (FIOBJ_TYPE_IS(o, FIOBJ_T_ARRAY)) {
+    w->in_array = 1;
+    fiobj_each1(o, 0, h2_write_header, w);
+    w->in_array = 0;
+    return 0;
+  }
+  fio_str_info_s name = fiobj_obj2cstr(w->name);
+  fio_str_info_s value = fiobj_obj2cstr(o);
+  if (!value.data || !name.len)
+    return 0;
+  /* connection specific headers aren't allowed in HTTP/2 */
+  switch (name.len) {
+  case 7:
+    if (!strncasecmp(name.data, "upgrade", 7))
+      return 0;
+    break;
+  case 10:
+    if (!strncasecmp(name.data, "connection", 10) ||
+        !strncasecmp(name.data, "keep-alive", 10))
+      return 0;
+    break;
+  case 16:
+    if (!strncasecmp(name.data, "proxy-connection", 16))
+      return 0;
+    break;
+  case 17:
+    if (!strncasecmp(name.data, "transfer-encoding", 17))
+      return 0;
+    break;
+  }
+  h2_block_write(w->dest, name, value);
+  return 0;
+}
+
+/* encodes the response status and headers */
+static FIOBJ h2_headers2block(http_s *h) {
+  struct h2_header_writer_s w = {
+      .dest = fiobj_str_buf(fiobj_hash_count(h->private_data.out_headers) * 48 +
+                            16),
+  };
+  fio_str_info_s d = fiobj_obj2cstr(w.dest);
+  fiobj_str_resize(w.dest, hpack_encode_status((uint8_t *)d.data, h->status));
+  fiobj_each1(h->private_data.out_headers, 0, h2_write_header, &w);
+  return w.dest;
+}
+
+/* prepares a response: sends the headers, returns the stream or NULL */
+static h2stream_s *h2_respond(http_s *h, uint8_t end_stream) {
+  h2stream_s *s = handle2stream(h);
+  http2pr_s *p = handle2pr(h);
+  s->flags |= H2S_RESPONDED;
+  if (!(s->flags & H2S_RESET)) {
+    FIOBJ block = h2_headers2block(h);
+    h2_send_block(p, H2_HEADERS, s->id, 0, block, end_stream);
+    fiobj_free(block);
+  }
+  if (end_stream || (s->flags & H2S_RESET))
+    s->flags |= H2S_DONE;
+  else
+    s->flags |= H2S_END;
+  http_s_destroy(h, 1);
+  /* marks the handle as invalid (see HTTP_INVALID_HANDLE) */
+  h->status = 200;
+  if (s->flags & H2S_RESET)
+    return NULL;
+  return s;
+}
+
+/* *****************************************************************************
+HTTP Request / Response (Virtual) Functions
+***************************************************************************** */
+
+/** Should send existing headers and data */
+static int http2_send_body(http_s *h, void *data, uintptr_t length) {
+  http2pr_s *p = handle2pr(h);
+  /* the data might belong to the handle (i.e., an echoed body) */
+  FIOBJ body = (length ? fiobj_str_new(data, length) : FIOBJ_INVALID);
+  h2stream_s *s = h2_respond(h, !length);
+  if (s)
+    s->body = body;
+  else
+    fiobj_free(body);
+  h2_flush(p);
+  return 0;
+}
+
+/** Should send existing headers and file */
+static int http2_sendfile(http_s *h, int fd, uintptr_t length,
+                          uintptr_t offset) {
+  http2pr_s *p = handle2pr(h);
+  h2stream_s *s = h2_respond(h, !length);
+  if (s && length) {
+    s->fd = fd;
+    s->fd_offset = offset;
+    s->fd_len = length;
+  } else {
+    http_sendfile_close(fd);
+  }
+  h2_flush(p);
+  return 0;
+}
+
+/* the number of bytes waiting to be sent by a streamed response */
+static size_t h2_stream_buffered(http2pr_s *p, h2stream_s *s) {
+  size_t ret = fio_pending_bytes(p->p.uuid);
+  if (s->body)
+    ret += fiobj_obj2cstr(s->body).len - s->body_pos;
+  return ret;
+}
+
+/** Should send existing headers and prepare for streaming */
+static int http2_stream_start(http_s *h, http_stream_args_s *args) {
+  h2stream_s *s = handle2stream(h);
+  http2pr_s *p = handle2pr(h);
+  if (s->flags & (H2S_RESPONDED | H2S_RESET))
+    return -1;
+  FIOBJ block = h2_headers2block(h);
+  h2_send_block(p, H2_HEADERS, s->id, 0, block, 0);
+  fiobj_free(block);
+  s->flags |= H2S_RESPONDED | H2S_STREAMING;
+  s->stream = *args;
+  return 0;
+}
+
+/** Should send data as part of a stream */
+static int http2_stream_write(http_s *h, void *data, uintptr_t length) {
+  h2stream_s *s = handle2stream(h);
+  http2pr_s *p = handle2pr(h);
+  if ((s->flags & (H2S_STREAMING | H2S_RESET)) != H2S_STREAMING)
+    return -1;
+  if (length) {
+    if (!s->body) {
+      s->body = fiobj_str_buf(length);
+    } else if (s->body_pos >= HTTP_STREAM_BUFFER_LIMIT) {
+      /* drop the data that was already sent */
+      fio_str_info_s b = fiobj_obj2cstr(s->body);
+      FIOBJ tmp = fiobj_str_buf(b.len - s->body_pos + length);
+      fiobj_str_write(tmp, b.data + s->body_pos, b.len - s->body_pos);
+      fiobj_free(s->body);
+      s->body = tmp;
+      s->body_pos = 0;
+    }
+    fiobj_str_write(s->body, data, length);
+    h2_flush(p);
+  }
+  return (h2_stream_buffered(p, s) >= HTTP_STREAM_BUFFER_LIMIT);
+}
+
+/** Should complete streaming */
+static int http2_stream_end(http_s *h) {
+  h2stream_s *s = handle2stream(h);
+  http2pr_s *p = handle2pr(h);
+  if (!(s->flags & H2S_STREAMING))
+    return -1;
+  void (*on_finish)(void *udata) = s->stream.on_finish;
+  void *udata = h->udata;
+  s->flags &= ~H2S_STREAMING;
+  s->flags |= ((s->flags & H2S_RESET) ? H2S_DONE : H2S_END);
+  http_s_destroy(h, 1);
+  /* marks the handle as invalid (see HTTP_INVALID_HANDLE) */
+  h->status = 200;
+  if (on_finish)
+    on_finish(udata);
+  h2_flush(p);
+  return 0;
+}
+
+/** Should send existing headers or complete streaming */
+static void http2_finish(http_s *h) {
+  http2pr_s *p = handle2pr(h);
+  if (handle2stream(h)->flags & H2S_STREAMING) {
+    http2_stream_end(h);
+    return;
+  }
+  h2_respond(h, 1);
+  h2_flush(p);
+}
+
+/** Push for data - unsupported (the promised request requires a path). */
+static int http2_push_data(http_s *h, void *data, uintptr_t length,
+                           FIOBJ mime_type) {
+  return -1;
+  (void)h;
+  (void)data;
+  (void)length;
+  (void)mime_type;
+}
+
+/**
+ * Push for files. The `filename` is the (absolute) request path of the
+ * promised resource, served from the public folder (if any).
+ */
+static int http2_push_file(http_s *h, FIOBJ filename, FIOBJ mime_type) {
+  const uint64_t host_hash = fiobj_obj2hash(HTTP_HEADER_HOST);
+  http2pr_s *p = handle2pr(h);
+  h2stream_s *parent = handle2stream(h);
+  fio_str_info_s path = fiobj_obj2cstr(filename);
+  if (!p->peer_push || p->goaway || (parent->flags & H2S_PUSHED) ||
+      p->push_count >= p->peer_streams || p->push_stream >= H2_MAX_WINDOW - 1 ||
+      !path.len || path.data[0] != '/')
+    return -1;
+  FIOBJ host = fiobj_hash_get2(h->headers, host_hash);
+  if (FIOBJ_TYPE_IS(host, FIOBJ_T_ARRAY))
+    host = fiobj_ary_index(host, 0);
+  fio_str_info_s authority = fiobj_obj2cstr(host);
+
+  p->push_stream += 2;
+  h2stream_s *s = h2_stream_new(p, p->push_stream,
+                                H2S_PUSHED | H2S_REMOTE_CLOSED |
+                                    H2S_DISPATCHED | H2S_HANDLER);
+  s->h.method = fiobj_str_new("GET", 3);
+  s->h.path = fiobj_dup(filename);
+  s->h.udata = h->udata;
+  if (authority.len)
+    fiobj_hash_set(s->h.headers, HTTP_HEADER_HOST, fiobj_dup(host));
+
+  /* promise the request (on the parent stream) */
+  FIOBJ block = fiobj_str_buf(path.len + authority.len + 32);
+  h2_block_write(block, (fio_str_info_s){.data = (char *)":method", .len = 7},
+                 (fio_str_info_s){.data = (char *)"GET", .len = 3});
+  if (parent->flags & H2S_HTTPS)
+    h2_block_write(block, (fio_str_info_s){.data = (char *)":scheme", .len = 7},
+                   (fio_str_info_s){.data = (char *)"https", .len = 5});
+  else
+    h2_block_write(block, (fio_str_info_s){.data = (char *)":scheme", .len = 7},
+                   (fio_str_info_s){.data = (char *)"http", .len = 4});
+  h2_block_write(block, (fio_str_info_s){.data = (char *)":path", .len = 5},
+                 path);
+  if (authority.len)
+    h2_block_write(block,
+                   (fio_str_info_s){.data = (char *)":authority", .len = 10},
+                   authority);
+  h2_send_block(p, H2_PUSH_PROMISE, parent->id, s->id, block, 0);
+  fiobj_free(block);
+
+  /* respond to the promised request */
+  if (mime_type)
+    http_set_header(&s->h, HTTP_HEADER_CONTENT_TYPE, fiobj_dup(mime_type));
+  if (http_sendfile2(&s->h, p->p.settings->public_folder,
+                     p->p.settings->public_folder_length, path.data,
+                     path.len))
+    http_send_error(&s->h, 404);
+  s->flags &= ~H2S_HANDLER;
+  return 0;
+}
+
+/**
+ * Called befor a pause task,
+ */
+static void http2_on_pause(http_s *h, http_fio_protocol_s *pr) {
+  ++handle2stream(h)->paused;
+  (void)pr;
+}
+
+/**
+ * called after the resume task had completed.
+ */
+static void http2_on_resume(http_s *h, http_fio_protocol_s *pr) {
+  --handle2stream(h)->paused;
+  h2_flush((http2pr_s *)pr);
+}
+
+/** The connection is shared by all streams, it can't be hijacked. */
+static intptr_t http2_hijack(http_s *h, fio_str_info_s *leftover) {
+  if (leftover)
+    *leftover = (fio_str_info_s){.len = 0, .data = NULL};
+  FIO_LOG_WARNING("(HTTP/2) connections can't be hijacked.");
+  return -1;
+  (void)h;
+}
+
+/** WebSockets over HTTP/2 (RFC 8441) are unsupported. */
+static int http2_http2websocket(http_s *h, websocket_settings_s *args) {
+  http_send_error(h, 400);
+  if (args->on_close)
+    args->on_close(0, args->udata);
+  return -1;
+}
+
+/* *****************************************************************************
+EventSource Support (SSE)
+***************************************************************************** */
+
+#undef http_upgrade2sse
+
+typedef struct {
+  /* MUST be the first member, freed by `http_sse_try_free` */
+  http_sse_internal_s sse;
+  /* data written by any thread, waiting for the connection's lock */
+  FIOBJ pending;
+  fio_lock_i lock;
+  uint32_t stream_id;
+  uint8_t scheduled;
+  uint8_t close;
+} h2_sse_s;
+
+/* moves the pending data to the stream (within the connection's lock) */
+static void http2_sse_perform(intptr_t uuid, fio_protocol_s *pr, void *sse_) {
+  h2_sse_s *sse = sse_;
+  http2pr_s *p = (http2pr_s *)pr;
+  fio_lock(&sse->lock);
+  FIOBJ data = sse->pending;
+  uint8_t close = sse->close;
+  sse->pending = FIOBJ_INVALID;
+  sse->scheduled = 0;
+  fio_unlock(&sse->lock);
+  h2stream_s *s = h2_stream_find(p, sse->stream_id);
+  if (s && s->sse == &sse->sse && !(s->flags & H2S_DONE)) {
+    if (data && !s->body) {
+      s->body = data;
+      s->body_pos = 0;
+      data = FIOBJ_INVALID;
+    } else if (data) {
+      fiobj_str_join(s->body, data);
+    }
+    if (close)
+      s->flags |= H2S_END;
+    h2_flush(p);
+  }
+  fiobj_free(data);
+  http_sse_try_free(&sse->sse);
+  (void)uuid;
+}
+
+static void http2_sse_perform_fallback(intptr_t uuid, void *sse_) {
+  h2_sse_s *sse = sse_;
+  fio_lock(&sse->lock);
+  FIOBJ data = sse->pending;
+  sse->pending = FIOBJ_INVALID;
+  sse->scheduled = 0;
+  fio_unlock(&sse->lock);
+  fiobj_free(data);
+  http_sse_try_free(&sse->sse);
+  (void)uuid;
+}
+
+/* queues data (or closure) for the SSE stream, preserving the order */
+static int http2_sse_schedule(h2_sse_s *sse, FIOBJ str, uint8_t close) {
+  uint8_t schedule;
+  fio_lock(&sse->lock);
+  if (str && sse->pending) {
+    fiobj_str_join(sse->pending, str);
+    fiobj_free(str);
+  } else if (str) {
+    sse->pending = str;
+  }
+  sse->close |= close;
+  schedule = !sse->scheduled;
+  sse->scheduled = 1;
+  fio_unlock(&sse->lock);
+  if (schedule) {
+    fio_atomic_add(&sse->sse.ref, 1);
+    fio_defer_io_task(sse->sse.uuid, .udata = sse, .type = FIO_PR_LOCK_TASK,
+                      .task = http2_sse_perform,
+                      .fallback = http2_sse_perform_fallback);
+  }
+  return 0;
+}
+
+/**
+ * Upgrades an HTTP/2 stream to an EventSource (SSE) stream.
+ *
+ * Thie `http_s` handle will be invalid after this call.
+ */
+static int http2_upgrade2sse(http_s *h, http_sse_s *sse) {
+  http2pr_s *p = handle2pr(h);
+  h->status = 200;
+  http_set_header(h, HTTP_HEADER_CONTENT_TYPE, fiobj_dup(HTTP_HVALUE_SSE_MIME));
+  http_set_header(h, HTTP_HEADER_CACHE_CONTROL,
+                  fiobj_dup(HTTP_HVALUE_NO_CACHE));
+  h2stream_s *s = h2_respond(h, 0);
+  if (!s)
+    goto failed;
+  /* the stream remains open until `http_sse_close` */
+  s->flags &= ~H2S_END;
+
+  h2_sse_s *h2sse = fio_malloc(sizeof(*h2sse));
+  if (!h2sse)
+    goto failed;
+  *h2sse = (h2_sse_s){.stream_id = s->id};
+  http_sse_init(&h2sse->sse, p->p.uuid, &HTTP2_VTABLE, sse);
+  s->sse = &h2sse->sse;
+  if (sse->on_open)
+    sse->on_open(&h2sse->sse.sse);
+  h2_flush(p);
+  return 0;
+
+failed:
+  if (s)
+    s->flags |= H2S_END;
+  if (sse->on_close)
+    sse->on_close(sse);
+  return -1;
+}
+
+#undef http_sse_write
+/**
+ * Writes data to an EventSource (SSE) stream. MUST free the FIOBJ.
+ */
+static int http2_sse_write(http_sse_s *sse, FIOBJ str) {
+  return http2_sse_schedule((h2_sse_s *)sse, str, 0);
+}
+
+/**
+ * Closes an EventSource (SSE) stream.
+ */
+static int http2_sse_close(http_sse_s *sse) {
+  return http2_sse_schedule((h2_sse_s *)sse, FIOBJ_INVALID, 1);
+}
+
+/* *****************************************************************************
+Virtual Table Decleration
+***************************************************************************** */
+
+struct http_vtable_s HTTP2_VTABLE = {
+    .http_send_body = http2_send_body,
+    .http_sendfile = http2_sendfile,
+    .http_stream_start = http2_stream_start,
+    .http_stream_write = http2_stream_write,
+    .http_stream_end = http2_stream_end,
+    .http_finish = http2_finish,
+    .http_push_data = http2_push_data,
+    .http_push_file = http2_push_file,
+    .http_on_pause = http2_on_pause,
+    .http_on_resume = http2_on_resume,
+    .http_hijack = http2_hijack,
+    .http2websocket = http2_http2websocket,
+    .http_upgrade2sse = http2_upgrade2sse,
+    .http_sse_write = http2_sse_write,
+    .http_sse_close = http2_sse_close,
+};
+
+void *http2_vtable(void) { return (void *)&HTTP2_VTABLE; }
+
+/* *****************************************************************************
+Request Headers (HPACK callback)
+***************************************************************************** */
+
+typedef struct {
+  http2pr_s *p;
+  /* the stream receiving the headers, NULL to discard */
+  h2stream_s *s;
+  size_t size;
+  uint8_t regular;
+} h2_decoder_s;
+
+#if DEBUG
+static int h2_test_on_header(char *name, size_t name_len, char *value,
+                             size_t value_len);
+#endif
+
+static int hpack_on_header(void *udata, char *name, size_t name_len,
+                           char *value, size_t value_len) {
+  const uint64_t cookie_hash = fiobj_obj2hash(HTTP_HEADER_COOKIE);
+  h2_decoder_s *d = udata;
+#if DEBUG
+  if (!d->p) /* testing, see `http2_tests` */
+    return h2_test_on_header(name, name_len, value, value_len);
+#endif
+  h2stream_s *s = d->s;
+  if (!s || (s->flags & (H2S_TOO_LARGE | H2S_MALFORMED)))
+    return 0; /* keep decoding, the dynamic table must remain valid */
+  d->size += name_len + value_len;
+  if (d->size >= d->p->p.settings->max_header_size ||
+      fiobj_hash_count(s->h.headers) > HTTP_MAX_HEADER_COUNT) {
+    if (d->p->p.settings->log)
+      FIO_LOG_WARNING("(HTTP/2) security alert - header flood detected.");
+    s->flags |= H2S_TOO_LARGE;
+    return 0;
+  }
+  if (name_len && name[0] == ':') {
+    /* pseudo headers, must come before any regular header */
+    if (d->regular)
+      goto malformed;
+    switch (name_len) {
+    case 5:
+      if (memcmp(name, ":path", 5) || s->h.path || !value_len)
+        goto malformed;
+      {
+        size_t i = 0;
+        while (i < value_len && value[i] != '?')
+          ++i;
+        s->h.path = fiobj_str_new(value, i);
+        if (i + 1 < value_len)
+          s->h.query = fiobj_str_new(value + i + 1, value_len - i - 1);
+      }
+      return 0;
+    case 7:
+      if (!memcmp(name, ":method", 7) && !s->h.method) {
+        s->h.method = fiobj_str_new(value, value_len);
+        return 0;
+      }
+      if (!memcmp(name, ":scheme", 7)) {
+        if (value_len == 5 && !memcmp(value, "https", 5))
+          s->flags |= H2S_HTTPS;
+        return 0;
+      }
+      goto malformed;
+    case 10:
+      if (memcmp(name, ":authority", 10))
+        goto malformed;
+      {
+        /* HTTP/2 replaces the Host header with the :authority header */
+        set_header_add(s->h.headers, HTTP_HEADER_HOST,
+                       fiobj_str_new(value, value_len));
+      }
+      return 0;
+    }
+    goto malformed;
+  }
+  d->regular = 1;
+  if (name_len == 6 && !memcmp(name, "cookie", 6)) {
+    /* cookies might be split, they're joined back to a single header */
+    FIOBJ old = fiobj_hash_get2(s->h.headers, cookie_hash);
+    if (old && FIOBJ_TYPE_IS(old, FIOBJ_T_STRING)) {
+      fiobj_str_write(old, "; ", 2);
+      fiobj_str_write(old, value, value_len);
+      return 0;
+    }
+  } else if (name_len == 14 && !memcmp(name, "content-length", 14)) {
+    /* the value isn't NUL terminated, `fio_atol` can't be used */
+    intptr_t len = 0;
+    for (size_t i = 0; i < value_len; ++i) {
+      if (value[i] < '0' || value[i] > '9' || len > (INTPTR_MAX / 10) - 10)
+        goto malformed;
+      len = (len * 10) + (value[i] - '0');
+    }
+    s->content_length = len;
+  }
+  /* common header names are shared, so they aren't allocated */
+  FIOBJ tmp = FIOBJ_INVALID;
+  FIOBJ sym = http_header_intern(name, name_len);
+  if (!sym)
+    sym = tmp = fiobj_str_new(name, name_len);
+  set_header_add(s->h.headers, sym, fiobj_str_new(value, value_len));
+  fiobj_free(tmp);
+  return 0;
+malformed:
+  s->flags |= H2S_MALFORMED;
+  return 0;
+}
+
+/* *****************************************************************************
+Frame Handling
+***************************************************************************** */
+
+/* hands the request to the user, the stream MUST NOT be accessed afterwards */
+static void h2_dispatch(http2pr_s *p, h2stream_s *s) {
+  s->flags |= H2S_DISPATCHED | H2S_HANDLER;
+  http_on_request_handler______internal(&s->h, p->p.settings);
+  if (s->h.method && !s->paused && !(s->flags & H2S_STREAMING))
+    http_finish(&s->h);
+  s->flags &= ~H2S_HANDLER;
+}
+
+/* decodes a complete header block and handles the stream */
+static int h2_on_header_block(http2pr_s *p, uint32_t sid, uint8_t *data,
+                              size_t len, uint8_t end_stream) {
+  h2_decoder_s d = {.p = p};
+  h2stream_s *s = h2_stream_find(p, sid);
+  uint8_t trailers = 0;
+  if (s) {
+    /* trailers (ignored) */
+    if ((s->flags & (H2S_REMOTE_CLOSED | H2S_PUSHED)) || !end_stream)
+      return h2_send_goaway(p, H2_PROTOCOL_ERROR);
+    trailers = 1;
+  } else if (sid > p->last_stream) {
+    p->last_stream = sid;
+    if (p->goaway || p->stream_count >= HTTP2_MAX_STREAMS) {
+      h2_send_rst(p, sid, H2_REFUSED_STREAM);
+    } else {
+      s = h2_stream_new(p, sid, 0);
+      d.s = s;
+    }
+  }
+  /* decode even when the headers are discarded, the table must be updated */
+  {
+    uint8_t *scratch = fio_malloc(hpack_scratch_len(len));
+    FIO_ASSERT_ALLOC(scratch);
+    int r = hpack_decode(&p->hpack, data, len, scratch, hpack_scratch_len(len),
+                         &d);
+    fio_free(scratch);
+    if (r)
+      return h2_send_goaway(p, H2_COMPRESSION_ERROR);
+  }
+  if (!s)
+    return 0;
+  if (trailers) {
+    s->flags |= H2S_REMOTE_CLOSED;
+    if (!(s->flags & H2S_DISPATCHED))
+      h2_dispatch(p, s);
+    return 0;
+  }
+  if (end_stream)
+    s->flags |= H2S_REMOTE_CLOSED;
+  if ((s->flags & H2S_MALFORMED) || !s->h.method || !s->h.path) {
+    h2_send_rst(p, sid, H2_PROTOCOL_ERROR);
+    s->flags |= H2S_DONE | H2S_RESET;
+    return 0;
+  }
+  if ((s->flags & H2S_TOO_LARGE) ||
+      (s->content_length > 0 &&
+       (size_t)s->content_length > p->p.settings->max_body_size)) {
+    s->flags |= H2S_DISPATCHED;
+    http_send_error(&s->h, 413);
+    return 0;
+  }
+  if (end_stream)
+    h2_dispatch(p, s);
+  return 0;
+}
+
+static int h2_on_data_frame(http2pr_s *p, uint8_t flags, uint32_t sid,
+                            uint8_t *data, size_t len) {
+  if (!sid)
+    return h2_send_goaway(p, H2_PROTOCOL_ERROR);
+  p->recv_unacked += len;
+  if (flags & H2_FLAG_PADDED) {
+    if (!len || data[0] >= len)
+      return h2_send_goaway(p, H2_PROTOCOL_ERROR);
+    len -= data[0] + 1;
+    ++data;
+  }
+  h2stream_s *s = h2_stream_find(p, sid);
+  if (!s || (s->flags & (H2S_REMOTE_CLOSED | H2S_DISPATCHED))) {
+    if (sid > p->last_stream)
+      return h2_send_goaway(p, H2_PROTOCOL_ERROR);
+    return 0; /* a reset (or responded) stream, data is discarded */
+  }
+  if (len) {
+    if (!(flags & H2_FLAG_END_STREAM))
+      h2_send_window_update(p, sid, len);
+    if (!s->h.body) {
+      if (s->content_length > 0 && s->content_length <= HTTP_MAX_HEADER_LENGTH)
+        s->h.body = fiobj_data_newstr();
+      else
+        s->h.body = fiobj_data_newtmpfile();
+    }
+    fiobj_data_write(s->h.body, data, len);
+    if ((size_t)fiobj_data_len(s->h.body) > p->p.settings->max_body_size) {
+      s->flags |= H2S_DISPATCHED;
+      http_send_error(&s->h, 413);
+      return 0;
+    }
+  }
+  if (flags & H2_FLAG_END_STREAM) {
+    s->flags |= H2S_REMOTE_CLOSED;
+    h2_dispatch(p, s);
+  }
+  return 0;
+}
+
+static int h2_on_headers_frame(http2pr_s *p, uint8_t flags, uint32_t sid,
+                               uint8_t *data, size_t len) {
+  if (!sid || !(sid & 1))
+    return h2_send_goaway(p, H2_PROTOCOL_ERROR);
+  if (flags & H2_FLAG_PADDED) {
+    if (!len || data[0] >= len)
+      return h2_send_goaway(p, H2_PROTOCOL_ERROR);
+    len -= data[0] + 1;
+    ++data;
+  }
+  if (flags & H2_FLAG_PRIORITY) {
+    if (len < 5)
+      return h2_send_goaway(p, H2_FRAME_SIZE_ERROR);
+    len -= 5;
+    data += 5;
+  }
+  if (!(flags & H2_FLAG_END_HEADERS)) {
+    p->block = fiobj_str_buf(len * 2);
+    fiobj_str_write(p->block, (char *)data, len);
+    p->block_stream = sid;
+    p->block_end_stream = (flags & H2_FLAG_END_STREAM);
+    return 0;
+  }
+  return h2_on_header_block(p, sid, data, len, (flags & H2_FLAG_END_STREAM));
+}
+
+static int h2_on_continuation_frame(http2pr_s *p, uint8_t flags, uint32_t sid,
+                                    uint8_t *data, size_t len) {
+  if (!p->block_stream || sid != p->block_stream)
+    return h2_send_goaway(p, H2_PROTOCOL_ERROR);
+  fiobj_str_write(p->block, (char *)data, len);
+  fio_str_info_s b = fiobj_obj2cstr(p->block);
+  if (b.len > (p->p.settings->max_header_size << 1) + H2_MAX_FRAME)
+    return h2_send_goaway(p, H2_ENHANCE_YOUR_CALM);
+  if (!(flags & H2_FLAG_END_HEADERS))
+    return 0;
+  FIOBJ block = p->block;
+  p->block = FIOBJ_INVALID;
+  p->block_stream = 0;
+  int r = h2_on_header_block(p, sid, (uint8_t *)b.data, b.len,
+                             p->block_end_stream);
+  fiobj_free(block);
+  return r;
+}
+
+static int h2_on_settings_frame(http2pr_s *p, uint8_t flags, uint32_t sid,
+                                uint8_t *data, size_t len) {
+  if (sid)
+    return h2_send_goaway(p, H2_PROTOCOL_ERROR);
+  if (flags & H2_FLAG_ACK) {
+    if (len)
+      return h2_send_goaway(p, H2_FRAME_SIZE_ERROR);
+    return 0;
+  }
+  if (len % 6)
+    return h2_send_goaway(p, H2_FRAME_SIZE_ERROR);
+  for (size_t i = 0; i < len; i += 6) {
+    const uint16_t id = ((uint16_t)data[i] << 8) | data[i + 1];
+    const uint32_t value = h2_u32_read(data + i + 2);
+    switch (id) {
+    case H2_SETTINGS_ENABLE_PUSH:
+      if (value > 1)
+        return h2_send_goaway(p, H2_PROTOCOL_ERROR);
+      p->peer_push = (uint8_t)value;
+      break;
+    case H2_SETTINGS_MAX_CONCURRENT_STREAMS:
+      p->peer_streams = value;
+      break;
+    case H2_SETTINGS_INITIAL_WINDOW_SIZE:
+      if (value > H2_MAX_WINDOW)
+        return h2_send_goaway(p, H2_FLOW_CONTROL_ERROR);
+      FIO_LS_EMBD_FOR(&p->streams, node) {
+        FIO_LS_EMBD_OBJ(h2stream_s, node, node)->window +=
+            (int64_t)value - (int64_t)p->peer_window;
+      }
+      p->peer_window = value;
+      break;
+    case H2_SETTINGS_MAX_FRAME_SIZE:
+      if (value < 16384 || value > 16777215)
+        return h2_send_goaway(p, H2_PROTOCOL_ERROR);
+      p->peer_frame = value;
+      break;
+    default:
+      /* the encoder doesn't index, so the table size is ignored */
+      break;
+    }
+  }
+  h2_send_frame(p, H2_SETTINGS, H2_FLAG_ACK, 0, NULL, 0);
+  return 0;
+}
+
+static int h2_on_window_update_frame(http2pr_s *p, uint32_t sid, uint8_t *data,
+                                     size_t len) {
+  if (len != 4)
+    return h2_send_goaway(p, H2_FRAME_SIZE_ERROR);
+  const uint32_t inc = h2_u32_read(data) & 0x7FFFFFFF;
+  if (!sid) {
+    if (!inc || p->window + inc > H2_MAX_WINDOW)
+      return h2_send_goaway(p,
+                            (inc ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR));
+    p->window += inc;
+    return 0;
+  }
+  h2stream_s *s = h2_stream_find(p, sid);
+  if (!s)
+    return 0;
+  if (!inc || s->window + inc > H2_MAX_WINDOW) {
+    h2_send_rst(p, sid, (inc ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR));
+    s->flags |= H2S_RESET;
+    if (!(s->flags & H2S_DISPATCHED) || (s->flags & H2S_RESPONDED))
+      s->flags |= H2S_DONE;
+    return 0;
+  }
+  s->window += inc;
+  return 0;
+}
+
+static int h2_on_rst_stream_frame(http2pr_s *p, uint32_t sid, size_t len) {
+  if (len != 4)
+    return h2_send_goaway(p, H2_FRAME_SIZE_ERROR);
+  if (!sid)
+    return h2_send_goaway(p, H2_PROTOCOL_ERROR);
+  h2stream_s *s = h2_stream_find(p, sid);
+  if (!s)
+    return 0;
+  s->flags |= H2S_RESET;
+  /* a request handled by the user is freed once the user responds */
+  if (!(s->flags & H2S_DISPATCHED) || (s->flags & H2S_RESPONDED))
+    s->flags |= H2S_DONE;
+  return 0;
+}
+
+/* handles a frame, returns -1 if the connection is no longer valid */
+static int h2_on_frame(http2pr_s *p, uint8_t type, uint8_t flags, uint32_t sid,
+                       uint8_t *data, size_t len) {
+  if (p->block_stream && type != H2_CONTINUATION)
+    return h2_send_goaway(p, H2_PROTOCOL_ERROR);
+  switch (type) {
+  case H2_DATA:
+    return h2_on_data_frame(p, flags, sid, data, len);
+  case H2_HEADERS:
+    return h2_on_headers_frame(p, flags, sid, data, len);
+  case H2_CONTINUATION:
+    return h2_on_continuation_frame(p, flags, sid, data, len);
+  case H2_SETTINGS:
+    return h2_on_settings_frame(p, flags, sid, data, len);
+  case H2_WINDOW_UPDATE:
+    return h2_on_window_update_frame(p, sid, data, len);
+  case H2_RST_STREAM:
+    return h2_on_rst_stream_frame(p, sid, len);
+  case H2_PING:
+    if (len != 8 || sid)
+      return h2_send_goaway(p, (sid ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR));
+    if (!(flags & H2_FLAG_ACK))
+      h2_send_frame(p, H2_PING, H2_FLAG_ACK, 0, data, 8);
+    return 0;
+  case H2_GOAWAY:
+    if (len < 8 || sid)
+      return h2_send_goaway(p, H2_PROTOCOL_ERROR);
+    /* existing streams are completed, no new streams are accepted */
+    p->goaway = 1;
+    return 0;
+  case H2_PUSH_PROMISE:
+    /* clients can't push */
+    return h2_send_goaway(p, H2_PROTOCOL_ERROR);
+  case H2_PRIORITY:
+    /* prioritization is unsupported, streams are served round robin */
+    if (len != 5)
+      h2_send_rst(p, sid, H2_FRAME_SIZE_ERROR);
+    return 0;
+  }
+  return 0; /* unknown frame types are ignored */
+}
+
+/* *****************************************************************************
+Connection Callbacks
+***************************************************************************** */
+
+static void http2_consume_data(http2pr_s *p) {
+  uint8_t *data = (uint8_t *)p->buf->data;
+  size_t len = p->buf->len;
+  size_t pos = 0;
+  if (p->preface) {
+    if (len < HTTP2_PREFACE_LEN)
+      return;
+    if (memcmp(data, HTTP2_PREFACE, HTTP2_PREFACE_LEN)) {
+      FIO_LOG_DEBUG("(HTTP/2) invalid connection preface for %p",
+                    (void *)p->p.uuid);
+      fio_close(p->p.uuid);
+      return;
+    }
+    pos = HTTP2_PREFACE_LEN;
+    p->preface = 0;
+  }
+  while (len - pos >= 9) {
+    const size_t flen = ((size_t)data[pos] << 16) |
+                        ((size_t)data[pos + 1] << 8) | data[pos + 2];
+    if (flen > H2_MAX_FRAME) {
+      h2_send_goaway(p, H2_FRAME_SIZE_ERROR);
+      return;
+    }
+    if (len - pos < flen + 9)
+      break;
+    if (h2_on_frame(p, data[pos + 3], data[pos + 4],
+                    h2_u32_read(data + pos + 5) & 0x7FFFFFFF, data + pos + 9,
+                    flen))
+      return;
+    pos += flen + 9;
+  }
+  fio_rbuf_consume(&p->buf, pos);
+  if (p->recv_unacked) {
+    h2_send_window_update(p, 0, p->recv_unacked);
+    p->recv_unacked = 0;
+  }
+  h2_flush(p);
+}
+
+/** called when a data is available, but will not run concurrently */
+static void http2_on_data(intptr_t uuid, fio_protocol_s *protocol) {
+  http2pr_s *p = (http2pr_s *)protocol;
+  ssize_t i = 0;
+  if (p->buf->capa - p->buf->len)
+    i = fio_read(uuid, p->buf->data + p->buf->len, p->buf->capa - p->buf->len);
+  if (i > 0)
+    p->buf->len += i;
+  http2_consume_data(p);
+}
+
+/** called when the socket's outgoing buffer was drained */
+static void http2_on_ready(intptr_t uuid, fio_protocol_s *protocol) {
+  http2pr_s *p = (http2pr_s *)protocol;
+  uint8_t streamed = 0;
+  h2_flush(p);
+  FIO_LS_EMBD_FOR(&p->streams, node) {
+    h2stream_s *s = FIO_LS_EMBD_OBJ(h2stream_s, node, node);
+    if (s->sse && s->sse->sse.on_ready)
+      s->sse->sse.on_ready(&s->sse->sse);
+    if ((s->flags & (H2S_STREAMING | H2S_RESET | H2S_HANDLER)) ==
+            H2S_STREAMING &&
+        s->stream.on_ready &&
+        h2_stream_buffered(p, s) < HTTP_STREAM_BUFFER_LIMIT) {
+      /* the stream might end during the callback, it's freed afterwards */
+      s->flags |= H2S_HANDLER;
+      s->stream.on_ready(&s->h);
+      s->flags &= ~H2S_HANDLER;
+      streamed = 1;
+    }
+  }
+  if (streamed)
+    h2_flush(p);
+  (void)uuid;
+}
+
+/** called when the server is shutting down */
+static uint8_t http2_on_shutdown(intptr_t uuid, fio_protocol_s *protocol) {
+  http2pr_s *p = (http2pr_s *)protocol;
+  FIO_LS_EMBD_FOR(&p->streams, node) {
+    h2stream_s *s = FIO_LS_EMBD_OBJ(h2stream_s, node, node);
+    if (s->sse && s->sse->sse.on_shutdown)
+      s->sse->sse.on_shutdown(&s->sse->sse);
+  }
+  h2_send_goaway(p, H2_NO_ERROR);
+  return 0;
+  (void)uuid;
+}
+
+/** called when the connection timed out, idle connections are closed */
+static void http2_ping(intptr_t uuid, fio_protocol_s *protocol) {
+  http2pr_s *p = (http2pr_s *)protocol;
+  if (!fio_ls_embd_any(&p->streams)) {
+    h2_send_goaway(p, H2_NO_ERROR);
+    fio_close(uuid);
+    return;
+  }
+  h2_send_frame(p, H2_PING, 0, 0, "facil.io", 8);
+  fio_touch(uuid);
+}
+
+/** called when the connection was closed, but will not run concurrently */
+static void http2_on_close(intptr_t uuid, fio_protocol_s *protocol) {
+  http2_destroy(protocol);
+  (void)uuid;
+}
+
+/* *****************************************************************************
+Public API
+***************************************************************************** */
+
+/** Creates an HTTP/2 protocol object and handles any unread data in the buffer
+ * (if any). The client's connection preface is expected. */
+fio_protocol_s *http2_new(uintptr_t uuid, http_settings_s *settings,
+                          void *unread_data, size_t unread_length) {
+  if (unread_data && unread_length > HTTP2_READ_BUFFER)
+    return NULL;
+  http2pr_s *p = fio_malloc(sizeof(*p));
+  FIO_ASSERT_ALLOC(p);
+  *p = (http2pr_s){
+      .p.protocol =
+          {
+              .on_data = http2_on_data,
+              .on_ready = http2_on_ready,
+              .on_shutdown = http2_on_shutdown,
+              .on_close = http2_on_close,
+              .ping = http2_ping,
+          },
+      .p.uuid = uuid,
+      .p.settings = settings,
+      .streams = FIO_LS_INIT(p->streams),
+      .window = H2_DEFAULT_WINDOW,
+      .peer_window = H2_DEFAULT_WINDOW,
+      .peer_frame = H2_MAX_FRAME,
+      .peer_streams = (uint32_t)-1,
+      .peer_push = 1,
+      .preface = 1,
+      .hpack = HPACK_TABLE_INIT,
+  };
+  p->buf = fio_rbuf_new(HTTP2_READ_BUFFER);
+  if (unread_data && unread_length) {
+    memcpy(p->buf->data, unread_data, unread_length);
+    p->buf->len = unread_length;
+  }
+  /* the server's connection preface is a SETTINGS frame */
+  {
+    uint8_t settings_payload[12];
+    settings_payload[0] = 0;
+    settings_payload[1] = H2_SETTINGS_MAX_CONCURRENT_STREAMS;
+    h2_u32_write(settings_payload + 2, HTTP2_MAX_STREAMS);
+    settings_payload[6] = 0;
+    settings_payload[7] = H2_SETTINGS_MAX_HEADER_LIST_SIZE;
+    h2_u32_write(settings_payload + 8, (uint32_t)settings->max_header_size);
+    h2_send_frame(p, H2_SETTINGS, 0, 0, settings_payload, 12);
+  }
+  fio_attach(uuid, &p->p.protocol);
+  if (unread_data && unread_length) {
+    fio_force_event(uuid, FIO_EVENT_ON_DATA);
+  }
+  return &p->p.protocol;
+}
+
+/** Manually destroys the HTTP/2 protocol object. */
+void http2_destroy(fio_protocol_s *pr) {
+  http2pr_s *p = (http2pr_s *)pr;
+  while (fio_ls_embd_any(&p->streams)) {
+    h2stream_s *s = FIO_LS_EMBD_OBJ(h2stream_s, node, p->streams.next);
+    s->flags |= H2S_RESET;
+    h2_stream_free(p, s);
+  }
+  fiobj_free(p->block);
+  fio_rbuf_free(p->buf);
+  fio_free(p);
+}
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+#if DEBUG
+#include <sys/socket.h>
+
+/* the decoded headers, as "name: value\n" lines */
+static FIOBJ h2_test_headers;
+
+static int h2_test_on_header(char *name, size_t name_len, char *value,
+                             size_t value_len) {
+  fiobj_str_write(h2_test_headers, name, name_len);
+  fiobj_str_write(h2_test_headers, ": ", 2);
+  fiobj_str_write(h2_test_headers, value, value_len);
+  fiobj_str_write(h2_test_headers, "\n", 1);
+  return 0;
+}
+
+/* converts a hex string (spaces are ignored), returns the length */
+static size_t h2_test_unhex(uint8_t *dest, const char *hex) {
+  size_t len = 0;
+  while (*hex) {
+    if (*hex == ' ') {
+      ++hex;
+      continue;
+    }
+    uint8_t c = 0;
+    for (size_t i = 0; i < 2; ++i, ++hex)
+      c = (c << 4) | (uint8_t)(*hex <= '9' ? *hex - '0' : (*hex | 32) - 'a' +
+                                                              10);
+    dest[len++] = c;
+  }
+  return len;
+}
+
+/* decodes a header block into `h2_test_headers`, returns `hpack_decode` */
+static int h2_test_decode(hpack_table_s *t, uint8_t *data, size_t len) {
+  h2_decoder_s d = {.p = NULL};
+  uint8_t scratch[hpack_scratch_len(256)];
+  FIO_ASSERT(len <= 256, "test header block too long\n");
+  fiobj_str_resize(h2_test_headers, 0);
+  return hpack_decode(t, data, len, scratch, sizeof(scratch), &d);
+}
+
+/* lists the dynamic table (newest first) as "name: value\n" lines */
+static void h2_test_table(hpack_table_s *t, char *dest, size_t capa) {
+  size_t len = 0;
+  dest[0] = 0;
+  for (size_t i = 1; i <= t->count; ++i) {
+    char *name, *value;
+    size_t name_len, value_len;
+    FIO_ASSERT(!hpack_table_find(t, 61 + i, &name, &name_len, &value,
+                                 &value_len),
+               "dynamic table entry %zu missing\n", i);
+    len += snprintf(dest + len, capa - len, "%.*s: %.*s\n", (int)name_len,
+                    name, (int)value_len, value);
+    FIO_ASSERT(len < capa, "dynamic table listing overflow\n");
+  }
+}
+
+typedef struct {
+  const char *hex;
+  const char *headers;
+  const char *table;
+  size_t size;
+} h2_test_vector_s;
+
+/* decodes a sequence of header blocks (RFC 7541, Appendix C) */
+static void h2_test_vectors(const char *name, size_t max,
+                            const h2_test_vector_s *v, size_t count,
+                            uint8_t fresh) {
+  hpack_table_s t = HPACK_TABLE_INIT;
+  t.max = max;
+  for (size_t i = 0; i < count; ++i) {
+    uint8_t data[256];
+    char table[512];
+    if (fresh) {
+      t = (hpack_table_s)HPACK_TABLE_INIT;
+      t.max = max;
+    }
+    const size_t len = h2_test_unhex(data, v[i].hex);
+    FIO_ASSERT(!h2_test_decode(&t, data, len), "%s.%zu decoding failed\n",
+               name, i + 1);
+    FIO_ASSERT(!strcmp(fiobj_obj2cstr(h2_test_headers).data, v[i].headers),
+               "%s.%zu headers mismatch:\n%s\n", name, i + 1,
+               fiobj_obj2cstr(h2_test_headers).data);
+    h2_test_table(&t, table, sizeof(table));
+    FIO_ASSERT(!strcmp(table, v[i].table) && t.size == v[i].size,
+               "%s.%zu dynamic table mismatch (%zu):\n%s\n", name, i + 1,
+               t.size, table);
+  }
+}
+
+/* Huffman encodes `src` using the canonical code of the decoding tables */
+static size_t h2_test_huff_encode(uint8_t *dest, const uint8_t *src,
+                                  size_t len) {
+  uint32_t code[257];
+  uint8_t bits[257];
+  for (size_t l = 5; l <= 30; ++l) {
+    const uint32_t count =
+        (uint32_t)(hpack_huff_limit[l] >> (32 - l)) - hpack_huff_first[l];
+    for (uint32_t k = 0; k < count; ++k) {
+      code[hpack_huff_sym[hpack_huff_offset[l] + k]] = hpack_huff_first[l] + k;
+      bits[hpack_huff_sym[hpack_huff_offset[l] + k]] = (uint8_t)l;
+    }
+  }
+  uint64_t acc = 0;
+  size_t pending = 0;
+  size_t out = 0;
+  for (size_t i = 0; i < len; ++i) {
+    acc = (acc << bits[src[i]]) | code[src[i]];
+    pending += bits[src[i]];
+    while (pending >= 8) {
+      pending -= 8;
+      dest[out++] = (uint8_t)(acc >> pending);
+    }
+    acc &= ((uint64_t)1 << pending) - 1;
+  }
+  if (pending) /* pad with the EOS prefix (all set) */
+    dest[out++] = (uint8_t)((acc << (8 - pending)) | (0xFF >> pending));
+  return out;
+}
+
+static char h2_test_request[128];
+
+static void h2_test_on_request(http_s *h) {
+  FIOBJ host = fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_HOST));
+  fio_str_info_s body = {.data = NULL};
+  if (h->body)
+    body = fiobj_data_pread(h->body, 0, fiobj_data_len(h->body));
+  snprintf(h2_test_request, sizeof(h2_test_request), "%s %s %s %zu:%.*s",
+           fiobj_obj2cstr(h->method).data, fiobj_obj2cstr(h->path).data,
+           fiobj_obj2cstr(host).data, body.len, (int)body.len, body.data);
+  http_send_body(h, "ok", 2);
+}
+
+/* attaches the HTTP/2 protocol to a new socket pair (`fd` is the client) */
+static http2pr_s *h2_test_conn(http_settings_s *settings, int *fd) {
+  int fds[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds), "socketpair failed\n");
+  FIO_ASSERT(fio_set_non_block(fds[0]) != -1, "non-blocking mode failed\n");
+  http2pr_s *p =
+      (http2pr_s *)http2_new(fio_fd2uuid(fds[0]), settings, NULL, 0);
+  FIO_ASSERT(p, "http2_new failed\n");
+  *fd = fds[1];
+  return p;
+}
+
+/* appends a frame to `dest` (a String) */
+static void h2_test_frame(FIOBJ dest, uint8_t type, uint8_t flags,
+                          uint32_t sid, const void *payload, size_t len) {
+  uint8_t head[9];
+  h2_frame_header(head, len, type, flags, sid);
+  fiobj_str_write(dest, (char *)head, 9);
+  fiobj_str_write(dest, payload, len);
+}
+
+/* writes the client's data and lets the protocol read it */
+static void h2_test_feed(intptr_t uuid, int fd, FIOBJ data) {
+  fio_str_info_s d = fiobj_obj2cstr(data);
+  FIO_ASSERT(write(fd, d.data, d.len) == (ssize_t)d.len, "test write failed\n");
+  fio_protocol_s *pr = fio_protocol_try_lock(uuid, FIO_PR_LOCK_TASK);
+  FIO_ASSERT(pr, "the HTTP/2 protocol is missing\n");
+  pr->on_data(uuid, pr);
+  fio_protocol_unlock(pr, FIO_PR_LOCK_TASK);
+  fiobj_str_resize(data, 0);
+}
+
+/* flushes the connection, reading up to `capa` bytes into `buf` */
+static size_t h2_test_drain(intptr_t uuid, int fd, uint8_t *buf, size_t capa) {
+  uint8_t tmp[4096];
+  size_t total = 0;
+  ssize_t flushed;
+  do {
+    ssize_t r;
+    flushed = fio_flush(uuid);
+    while ((r = recv(fd, tmp, sizeof(tmp), MSG_DONTWAIT)) > 0) {
+      FIO_ASSERT(total + r <= capa, "test output overflow\n");
+      memcpy(buf + total, tmp, r);
+      total += r;
+    }
+  } while (flushed > 0);
+  return total;
+}
+
+/* returns the payload of the first frame of `type` and `flags` (or NULL) */
+static uint8_t *h2_test_find(uint8_t *buf, size_t len, uint8_t type,
+                             uint8_t flags, size_t *flen) {
+  size_t pos = 0;
+  while (pos + 9 <= len) {
+    *flen = ((size_t)buf[pos] << 16) | ((size_t)buf[pos + 1] << 8) |
+            buf[pos + 2];
+    FIO_ASSERT(pos + 9 + *flen <= len, "incomplete frame in the output\n");
+    if (buf[pos + 3] == type && buf[pos + 4] == flags)
+      return buf + pos + 9;
+    pos += 9 + *flen;
+  }
+  return NULL;
+}
+
+void http2_tests(void) {
+  h2_test_headers = fiobj_str_buf(512);
+  fprintf(stderr, "=== Testing HPACK decoding (RFC 7541, Appendix C)\n");
+  {
+    static const h2_test_vector_s c2[] = {
+        {"400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 6572",
+         "custom-key: custom-header\n", "custom-key: custom-header\n", 55},
+        {"040c 2f73 616d 706c 652f 7061 7468", ":path: /sample/path\n", "", 0},
+        {"1008 7061 7373 776f 7264 0673 6563 7265 74", "password: secret\n",
+         "", 0},
+        {"82", ":method: GET\n", "", 0},
+    };
+#define H2_TEST_REQ1                                                           \
+  ":method: GET\n:scheme: http\n:path: /\n:authority: www.example.com\n"
+#define H2_TEST_REQ3                                                           \
+  ":method: GET\n:scheme: https\n:path: /index.html\n"                         \
+  ":authority: www.example.com\ncustom-key: custom-value\n"
+    static const h2_test_vector_s c3[] = {
+        {"8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d", H2_TEST_REQ1,
+         ":authority: www.example.com\n", 57},
+        {"8286 84be 5808 6e6f 2d63 6163 6865",
+         H2_TEST_REQ1 "cache-control: no-cache\n",
+         "cache-control: no-cache\n:authority: www.example.com\n", 110},
+        {"8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 "
+         "6c75 65",
+         H2_TEST_REQ3,
+         "custom-key: custom-value\ncache-control: no-cache\n"
+         ":authority: www.example.com\n",
+         164},
+    };
+    static const h2_test_vector_s c4[] = {
+        {"8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff", H2_TEST_REQ1,
+         ":authority: www.example.com\n", 57},
+        {"8286 84be 5886 a8eb 1064 9cbf",
+         H2_TEST_REQ1 "cache-control: no-cache\n",
+         "cache-control: no-cache\n:authority: www.example.com\n", 110},
+        {"8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+         H2_TEST_REQ3,
+         "custom-key: custom-value\ncache-control: no-cache\n"
+         ":authority: www.example.com\n",
+         164},
+    };
+#undef H2_TEST_REQ1
+#undef H2_TEST_REQ3
+#define H2_TEST_DATE1 "date: Mon, 21 Oct 2013 20:13:21 GMT\n"
+#define H2_TEST_DATE2 "date: Mon, 21 Oct 2013 20:13:22 GMT\n"
+#define H2_TEST_LOCATION "location: https://www.example.com\n"
+#define H2_TEST_COOKIE                                                         \
+  "set-cookie: foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1\n"
+#define H2_TEST_RES1                                                           \
+  ":status: 302\ncache-control: private\n" H2_TEST_DATE1 H2_TEST_LOCATION,     \
+      H2_TEST_LOCATION H2_TEST_DATE1 "cache-control: private\n:status: 302\n", \
+      222
+#define H2_TEST_RES2                                                           \
+  ":status: 307\ncache-control: private\n" H2_TEST_DATE1 H2_TEST_LOCATION,     \
+      ":status: 307\n" H2_TEST_LOCATION H2_TEST_DATE1                          \
+      "cache-control: private\n",                                              \
+      222
+#define H2_TEST_RES3                                                           \
+  ":status: 200\ncache-control: private\n" H2_TEST_DATE2 H2_TEST_LOCATION      \
+  "content-encoding: gzip\n" H2_TEST_COOKIE,                                   \
+      H2_TEST_COOKIE "content-encoding: gzip\n" H2_TEST_DATE2, 215
+    /* the table size is 256 bytes, so entries are evicted */
+    static const h2_test_vector_s c5[] = {
+        {"4803 3330 3258 0770 7269 7661 7465 611d 4d6f 6e2c 2032 3120 4f63 "
+         "7420 3230 3133 2032 303a 3133 3a32 3120 474d 546e 1768 7474 7073 "
+         "3a2f 2f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+         H2_TEST_RES1},
+        {"4803 3330 37c1 c0bf", H2_TEST_RES2},
+        {"88c1 611d 4d6f 6e2c 2032 3120 4f63 7420 3230 3133 2032 303a 3133 "
+         "3a32 3220 474d 54c0 5a04 677a 6970 7738 666f 6f3d 4153 444a 4b48 "
+         "514b 425a 584f 5157 454f 5049 5541 5851 5745 4f49 553b 206d 6178 "
+         "2d61 6765 3d33 3630 303b 2076 6572 7369 6f6e 3d31",
+         H2_TEST_RES3},
+    };
+    static const h2_test_vector_s c6[] = {
+        {"4882 6402 5885 aec3 771a 4b61 96d0 7abe 9410 54d4 44a8 2005 9504 "
+         "0b81 66e0 82a6 2d1b ff6e 919d 29ad 1718 63c7 8f0b 97c8 e9ae 82ae "
+         "43d3",
+         H2_TEST_RES1},
+        {"4883 640e ffc1 c0bf", H2_TEST_RES2},
+        {"88c1 6196 d07a be94 1054 d444 a820 0595 040b 8166 e084 a62d 1bff "
+         "c05a 839b d9ab 77ad 94e7 821d d7f2 e6c7 b335 dfdf cd5b 3960 d5af "
+         "2708 7f36 72c1 ab27 0fb5 291f 9587 3160 65c0 03ed 4ee5 b106 3d50 07",
+         H2_TEST_RES3},
+    };
+#undef H2_TEST_DATE1
+#undef H2_TEST_DATE2
+#undef H2_TEST_LOCATION
+#undef H2_TEST_COOKIE
+#undef H2_TEST_RES1
+#undef H2_TEST_RES2
+#undef H2_TEST_RES3
+    h2_test_vectors("C.2", HPACK_TABLE_SIZE, c2, 4, 1);
+    h2_test_vectors("C.3", HPACK_TABLE_SIZE, c3, 3, 0);
+    h2_test_vectors("C.4", HPACK_TABLE_SIZE, c4, 3, 0);
+    h2_test_vectors("C.5", 256, c5, 3, 0);
+    h2_test_vectors("C.6", 256, c6, 3, 0);
+  }
+  fprintf(stderr, "=== Testing HPACK table size updates and errors\n");
+  {
+    hpack_table_s t = HPACK_TABLE_INIT;
+    uint8_t data[256];
+    size_t len = h2_test_unhex(
+        data, "400a 6375 7374 6f6d 2d6b 6579 0d63 7573 746f 6d2d 6865 6164 "
+              "6572");
+    FIO_ASSERT(!h2_test_decode(&t, data, len) && t.count == 1,
+               "HPACK indexing failed\n");
+    /* a size update (to 0 and back) evicts the entries */
+    len = h2_test_unhex(data, "20 3fe1 1f 82");
+    FIO_ASSERT(!h2_test_decode(&t, data, len) && !t.count && !t.size &&
+                   t.max == HPACK_TABLE_SIZE,
+               "HPACK size update failed\n");
+    FIO_ASSERT(!strcmp(fiobj_obj2cstr(h2_test_headers).data, ":method: GET\n"),
+               "HPACK size update lost a header\n");
+    /* size updates must come first */
+    len = h2_test_unhex(data, "82 20");
+    FIO_ASSERT(h2_test_decode(&t, data, len) == -1,
+               "HPACK late size update should fail\n");
+    /* above the advertised size */
+    len = h2_test_unhex(data, "3fe2 1f");
+    FIO_ASSERT(h2_test_decode(&t, data, len) == -1,
+               "HPACK size update overflow should fail\n");
+    /* index 0 and indexes beyond the dynamic table */
+    t = (hpack_table_s)HPACK_TABLE_INIT;
+    FIO_ASSERT(h2_test_decode(&t, (uint8_t *)"\x80", 1) == -1 &&
+                   h2_test_decode(&t, (uint8_t *)"\xbe", 1) == -1,
+               "HPACK invalid indexes should fail\n");
+    /* truncated strings */
+    FIO_ASSERT(h2_test_decode(&t, (uint8_t *)"\x04\x0c/sample", 9) == -1,
+               "HPACK truncated strings should fail\n");
+  }
+  fprintf(stderr, "=== Testing HPACK Huffman coding\n");
+  {
+    static const struct {
+      const char *str;
+      const char *hex;
+    } known[] = {
+        {"www.example.com", "f1e3 c2e5 f23a 6ba0 ab90 f4ff"},
+        {"no-cache", "a8eb 1064 9cbf"},
+        {"custom-key", "25a8 49e9 5ba9 7d7f"},
+        {"custom-value", "25a8 49e9 5bb8 e8b4 bf"},
+        {"302", "6402"},
+        {"private", "aec3 771a 4b"},
+    };
+    uint8_t src[512], encoded[2048], decoded[512], expected[64];
+    for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); ++i) {
+      const size_t len = strlen(known[i].str);
+      const size_t elen = h2_test_unhex(expected, known[i].hex);
+      FIO_ASSERT(h2_test_huff_encode(encoded, (uint8_t *)known[i].str, len) ==
+                         elen &&
+                     !memcmp(encoded, expected, elen),
+                 "Huffman code mismatch for %s\n", known[i].str);
+    }
+    /* every symbol (including the 30 bit codes), and random strings */
+    for (size_t round = 0; round < 64; ++round) {
+      size_t len = sizeof(src);
+      if (!round) {
+        len = 256;
+        for (size_t i = 0; i < 256; ++i)
+          src[i] = (uint8_t)i;
+      } else {
+        len = (size_t)(rand() & 511);
+        for (size_t i = 0; i < len; ++i)
+          src[i] = (uint8_t)((round & 1) ? rand() : 'a' + (rand() % 26));
+      }
+      const size_t elen = h2_test_huff_encode(encoded, src, len);
+      const intptr_t dlen =
+          hpack_huff_decode(decoded, sizeof(decoded), encoded, elen);
+      FIO_ASSERT(dlen == (intptr_t)len && !memcmp(decoded, src, len),
+                 "Huffman round trip failed (round %zu)\n", round);
+    }
+    /* padding longer than 7 bits, or that isn't the EOS prefix */
+    FIO_ASSERT(hpack_huff_decode(decoded, sizeof(decoded),
+                                 (uint8_t *)"\x1f\xff", 2) == -1 &&
+                   hpack_huff_decode(decoded, sizeof(decoded),
+                                     (uint8_t *)"\x18", 1) == -1,
+               "Huffman invalid padding should fail\n");
+    FIO_ASSERT(hpack_huff_decode(decoded, sizeof(decoded), (uint8_t *)"\x1f",
+                                 1) == 1 &&
+                   decoded[0] == 'a',
+               "Huffman padding failed\n");
+  }
+  fprintf(stderr, "=== Testing HPACK encoding\n");
+  {
+    static const char *headers[] = {
+        ":method",       "GET",          ":scheme",    "https",
+        ":path",         "/sample/path", ":authority", "www.example.com",
+        "cache-control", "no-cache",     "custom-key", "custom-value",
+    };
+    uint8_t block[256], expected[64];
+    size_t len = hpack_encode(block, ":method", 7, "GET", 3);
+    FIO_ASSERT(len == 1 && block[0] == 0x82, "HPACK indexed encoding failed\n");
+    len = hpack_encode(block, ":path", 5, "/sample/path", 12);
+    FIO_ASSERT(len == h2_test_unhex(expected,
+                                    "040c 2f73 616d 706c 652f 7061 7468") &&
+                   !memcmp(block, expected, len),
+               "HPACK literal (indexed name) encoding failed\n");
+    len = hpack_encode_status(block, 302);
+    FIO_ASSERT(len == h2_test_unhex(expected, "0803 3330 32") &&
+                   !memcmp(block, expected, len),
+               "HPACK status encoding failed\n");
+    len += hpack_encode_status(block + len, 200);
+    for (size_t i = 0; i < sizeof(headers) / sizeof(headers[0]); i += 2)
+      len += hpack_encode(block + len, headers[i], strlen(headers[i]),
+                          headers[i + 1], strlen(headers[i + 1]));
+    hpack_table_s t = HPACK_TABLE_INIT;
+    FIO_ASSERT(!h2_test_decode(&t, block, len) && !t.count,
+               "HPACK encoded block decoding failed\n");
+    FIO_ASSERT(!strcmp(fiobj_obj2cstr(h2_test_headers).data,
+                       ":status: 302\n:status: 200\n:method: GET\n"
+                       ":scheme: https\n:path: /sample/path\n"
+                       ":authority: www.example.com\ncache-control: no-cache\n"
+                       "custom-key: custom-value\n"),
+               "HPACK round trip failed:\n%s\n",
+               fiobj_obj2cstr(h2_test_headers).data);
+  }
+  fprintf(stderr, "=== Testing HTTP/2 frame parsing\n");
+  {
+    http_settings_s settings = {.on_request = h2_test_on_request,
+                                .max_header_size = 8192,
+                                .max_body_size = 1024};
+    FIOBJ out = fiobj_str_buf(1024);
+    uint8_t buf[4096], block[256], payload[64];
+    uint8_t *frame;
+    size_t flen, len;
+    int fd;
+    http2pr_s *p = h2_test_conn(&settings, &fd);
+    const intptr_t uuid = p->p.uuid;
+    /* SETTINGS (acknowledged, values applied) */
+    fiobj_str_write(out, HTTP2_PREFACE, HTTP2_PREFACE_LEN);
+    payload[0] = 0;
+    payload[1] = H2_SETTINGS_INITIAL_WINDOW_SIZE;
+    h2_u32_write(payload + 2, 1000);
+    payload[6] = 0;
+    payload[7] = H2_SETTINGS_MAX_FRAME_SIZE;
+    h2_u32_write(payload + 8, 20000);
+    h2_test_frame(out, H2_SETTINGS, 0, 0, payload, 12);
+    h2_test_feed(uuid, fd, out);
+    len = h2_test_drain(uuid, fd, buf, sizeof(buf));
+    FIO_ASSERT(h2_test_find(buf, len, H2_SETTINGS, 0, &flen) && flen == 12,
+               "HTTP/2 server SETTINGS missing\n");
+    FIO_ASSERT(h2_test_find(buf, len, H2_SETTINGS, H2_FLAG_ACK, &flen) &&
+                   !flen,
+               "HTTP/2 SETTINGS weren't acknowledged\n");
+    FIO_ASSERT(p->peer_window == 1000 && p->peer_frame == 20000,
+               "HTTP/2 SETTINGS weren't applied\n");
+    /* HEADERS + CONTINUATION (the block is split in three) */
+    len = hpack_encode(block, ":method", 7, "GET", 3);
+    len += hpack_encode(block + len, ":scheme", 7, "https", 5);
+    len += hpack_encode(block + len, ":path", 5, "/continued", 10);
+    len += hpack_encode(block + len, ":authority", 10, "example.com", 11);
+    h2_test_frame(out, H2_HEADERS, H2_FLAG_END_STREAM, 1, block, 5);
+    h2_test_frame(out, H2_CONTINUATION, 0, 1, block + 5, 3);
+    h2_test_frame(out, H2_CONTINUATION, H2_FLAG_END_HEADERS, 1, block + 8,
+                  len - 8);
+    h2_test_request[0] = 0;
+    h2_test_feed(uuid, fd, out);
+    FIO_ASSERT(!strcmp(h2_test_request, "GET /continued example.com 0:"),
+               "HTTP/2 CONTINUATION handling failed (%s)\n", h2_test_request);
+    len = h2_test_drain(uuid, fd, buf, sizeof(buf));
+    frame = h2_test_find(buf, len, H2_HEADERS, H2_FLAG_END_HEADERS, &flen);
+    FIO_ASSERT(frame, "HTTP/2 response HEADERS missing\n");
+    {
+      hpack_table_s t = HPACK_TABLE_INIT;
+      FIO_ASSERT(!h2_test_decode(&t, frame, flen) &&
+                     !strncmp(fiobj_obj2cstr(h2_test_headers).data,
+                              ":status: 200\n", 13),
+                 "HTTP/2 response HEADERS can't be decoded\n");
+    }
+    frame = h2_test_find(buf, len, H2_DATA, H2_FLAG_END_STREAM, &flen);
+    FIO_ASSERT(frame && flen == 2 && !memcmp(frame, "ok", 2),
+               "HTTP/2 response DATA missing\n");
+    /* DATA with padding */
+    len = hpack_encode(block, ":method", 7, "POST", 4);
+    len += hpack_encode(block + len, ":scheme", 7, "https", 5);
+    len += hpack_encode(block + len, ":path", 5, "/padded", 7);
+    len += hpack_encode(block + len, ":authority", 10, "example.com", 11);
+    h2_test_frame(out, H2_HEADERS, H2_FLAG_END_HEADERS, 3, block, len);
+    memcpy(payload, "\x04hello\0\0\0\0", 10);
+    h2_test_frame(out, H2_DATA, H2_FLAG_PADDED | H2_FLAG_END_STREAM, 3,
+                  payload, 10);
+    h2_test_request[0] = 0;
+    h2_test_feed(uuid, fd, out);
+    FIO_ASSERT(!strcmp(h2_test_request, "POST /padded example.com 5:hello"),
+               "HTTP/2 padded DATA handling failed (%s)\n", h2_test_request);
+    h2_test_drain(uuid, fd, buf, sizeof(buf));
+    FIO_ASSERT(!fio_is_closed(uuid), "HTTP/2 connection closed unexpectedly\n");
+    fio_force_close(uuid);
+    fio_defer_perform();
+    close(fd);
+
+    /* connection errors (GOAWAY) */
+    for (size_t i = 0; i < 5; ++i) {
+      static const uint32_t expected[] = {
+          H2_FRAME_SIZE_ERROR, H2_FRAME_SIZE_ERROR, H2_PROTOCOL_ERROR,
+          H2_PROTOCOL_ERROR, H2_PROTOCOL_ERROR};
+      p = h2_test_conn(&settings, &fd);
+      fiobj_str_write(out, HTTP2_PREFACE, HTTP2_PREFACE_LEN);
+      switch (i) {
+      case 0: /* a frame longer than the (default) maximum */
+        h2_frame_header(payload, H2_MAX_FRAME + 1, H2_DATA, 0, 1);
+        fiobj_str_write(out, (char *)payload, 9);
+        break;
+      case 1: /* a SETTINGS frame length must be a multiple of 6 */
+        h2_test_frame(out, H2_SETTINGS, 0, 0, "\0\1\0\0\0", 5);
+        break;
+      case 2: /* padding that exceeds the frame */
+        h2_test_frame(out, H2_DATA, H2_FLAG_PADDED, 1, "\x03pad", 3);
+        break;
+      case 3: /* a frame between HEADERS and CONTINUATION */
+        h2_test_frame(out, H2_HEADERS, 0, 1, block, 5);
+        h2_test_frame(out, H2_SETTINGS, 0, 0, NULL, 0);
+        break;
+      case 4: /* a CONTINUATION without HEADERS */
+        h2_test_frame(out, H2_CONTINUATION, H2_FLAG_END_HEADERS, 1, block,
+                      len);
+        break;
+      }
+      h2_test_feed(p->p.uuid, fd, out);
+      FIO_ASSERT(fio_is_closed(p->p.uuid),
+                 "HTTP/2 connection errors should close the connection (%zu)\n",
+                 i);
+      len = h2_test_drain(p->p.uuid, fd, buf, sizeof(buf));
+      frame = h2_test_find(buf, len, H2_GOAWAY, 0, &flen);
+      FIO_ASSERT(frame && flen == 8 && h2_u32_read(frame + 4) == expected[i],
+                 "HTTP/2 GOAWAY error code mismatch (%zu)\n", i);
+      fio_force_close(p->p.uuid);
+      fio_defer_perform();
+      close(fd);
+    }
+    fiobj_free(out);
+  }
+  fiobj_free(h2_test_headers);
+}
+#endif
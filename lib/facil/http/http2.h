@@ -0,0 +1,46 @@
+/*
+Copyright: Boaz Segev, 2019
+License: MIT
+*/
+#ifndef H_HTTP2_H
+#define H_HTTP2_H
+
+#include <http.h>
+
+#ifndef HTTP2_MAX_STREAMS
+/** The number of concurrent (client) streams allowed per connection. */
+#define HTTP2_MAX_STREAMS 100
+#endif
+
+#ifndef HTTP2_READ_BUFFER
+/**
+ * The size of the connection's read buffer, it must fit a whole frame (16Kb
+ * and a 9 byte header).
+ */
+#define HTTP2_READ_BUFFER (32 * 1024) /* ~32kb */
+#endif
+
+#ifndef HTTP2_PENDING_LIMIT
+/**
+ * The number of DATA frames that may be waiting in the socket's outgoing
+ * buffer before the protocol waits for the `on_ready` event.
+ */
+#define HTTP2_PENDING_LIMIT 16
+#endif
+
+/** The client connection preface (prior knowledge connections start with). */
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_LEN 24
+
+/** Creates an HTTP/2 protocol object and handles any unread data in the buffer
+ * (if any). The client's connection preface is expected. */
+fio_protocol_s *http2_new(uintptr_t uuid, http_settings_s *settings,
+                          void *unread_data, size_t unread_length);
+
+/** Manually destroys the HTTP/2 protocol object. */
+void http2_destroy(fio_protocol_s *);
+
+/** returns the HTTP/2 protocol's VTable. */
+void *http2_vtable(void);
+
+#endif
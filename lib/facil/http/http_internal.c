@@ -12,21 +12,14 @@ Feel free to copy, use and enjoy according to the license provided.
 Internal Request / Response Handlers
 ***************************************************************************** */
 
-static uint64_t http_upgrade_hash = 0;
 /** Use this function to handle HTTP requests.*/
 void http_on_request_handler______internal(http_s *h,
                                            http_settings_s *settings) {
-  if (!http_upgrade_hash)
-    http_upgrade_hash = fiobj_hash_string("upgrade", 7);
   h->udata = settings->udata;
 
-  static uint64_t host_hash = 0;
-  if (!host_hash)
-    host_hash = fiobj_hash_string("host", 4);
-
   if (1) {
     /* test for Host header and avoid duplicates */
-    FIOBJ tmp = fiobj_hash_get2(h->headers, host_hash);
+    FIOBJ tmp = fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_HOST));
     if (!tmp)
       goto missing_host;
     if (FIOBJ_TYPE_IS(tmp, FIOBJ_T_ARRAY)) {
@@ -34,7 +27,7 @@ void http_on_request_handler______internal(http_s *h,
     }
   }
 
-  FIOBJ t = fiobj_hash_get2(h->headers, http_upgrade_hash);
+  FIOBJ t = fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_UPGRADE));
   if (t)
     goto upgrade;
 
@@ -42,6 +35,14 @@ void http_on_request_handler______internal(http_s *h,
           fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_ACCEPT)),
           HTTP_HVALUE_SSE_MIME))
     goto eventsource;
+  if (settings->metrics_path) {
+    fio_str_info_s path_str = fiobj_obj2cstr(h->path);
+    if (path_str.len == strlen(settings->metrics_path) &&
+        !memcmp(path_str.data, settings->metrics_path, path_str.len)) {
+      http_send_metrics(h);
+      return;
+    }
+  }
   if (settings->public_folder) {
     fio_str_info_s path_str = fiobj_obj2cstr(h->path);
     if (!http_sendfile2(h, settings->public_folder,
@@ -50,7 +51,11 @@ void http_on_request_handler______internal(http_s *h,
       return;
     }
   }
-  settings->on_request(h);
+  if (settings->cache_ttl) {
+    http_cache_on_request(h, settings);
+    return;
+  }
+  http_coroutine_on_request(h, settings);
   return;
 
 upgrade:
@@ -76,10 +81,8 @@ missing_host:
 
 void http_on_response_handler______internal(http_s *h,
                                             http_settings_s *settings) {
-  if (!http_upgrade_hash)
-    http_upgrade_hash = fiobj_hash_string("upgrade", 7);
   h->udata = settings->udata;
-  FIOBJ t = fiobj_hash_get2(h->headers, http_upgrade_hash);
+  FIOBJ t = fiobj_hash_get2(h->headers, fiobj_obj2hash(HTTP_HEADER_UPGRADE));
   if (t == FIOBJ_INVALID) {
     settings->on_response(h);
     return;
@@ -105,11 +108,166 @@ int http_send_error2(size_t error, intptr_t uuid, http_settings_s *settings) {
   return ret;
 }
 
+/* *****************************************************************************
+Header Name Interning
+***************************************************************************** */
+
+/* common header names, lower case (the order is unimportant) */
+static const char *http_header_names[] = {
+    "accept", "accept-charset", "accept-encoding", "accept-language",
+    "accept-ranges", "access-control-allow-credentials",
+    "access-control-allow-headers", "access-control-allow-methods",
+    "access-control-allow-origin", "access-control-expose-headers",
+    "access-control-max-age", "access-control-request-headers",
+    "access-control-request-method", "age", "allow", "authorization",
+    "cache-control", "connection", "content-disposition", "content-encoding",
+    "content-language", "content-length", "content-location", "content-range",
+    "content-security-policy", "content-type", "cookie", "date", "dnt", "etag",
+    "expect", "expires", "forwarded", "from", "host", "if-match",
+    "if-modified-since", "if-none-match", "if-range", "if-unmodified-since",
+    "keep-alive", "last-modified", "link", "location", "max-forwards", "origin",
+    "pragma", "proxy-authorization", "range", "referer", "retry-after",
+    "sec-websocket-accept", "sec-websocket-extensions", "sec-websocket-key",
+    "sec-websocket-protocol", "sec-websocket-version", "server", "set-cookie",
+    "strict-transport-security", "te", "trailer", "transfer-encoding",
+    "upgrade", "upgrade-insecure-requests", "user-agent", "vary", "via",
+    "www-authenticate", "x-forwarded-for", "x-forwarded-host",
+    "x-forwarded-proto", "x-real-ip", "x-requested-with",
+};
+
+#define HTTP_HEADER_NAMES_COUNT                                                \
+  (sizeof(http_header_names) / sizeof(http_header_names[0]))
+
+/* the number of bits in the perfect hash, the table has a slot per value. */
+#define HTTP_HEADER_INTERN_BITS 9
+
+static struct {
+  /* the name Strings, in `http_header_names` order */
+  FIOBJ names[HTTP_HEADER_NAMES_COUNT];
+  /* maps a hash value to a name's index + 1 (0 == empty) */
+  uint8_t slots[1 << HTTP_HEADER_INTERN_BITS];
+  /* the multiplier (selected during initialization) for a perfect hash */
+  uint32_t seed;
+} http_header_interned;
+
+/*
+ * The length, first and last two letters are unique among the common headers,
+ * so a multiplier that maps them to different slots is a perfect hash.
+ */
+static inline size_t http_header_slot(const char *name, size_t len,
+                                      uint32_t seed) {
+  uint32_t key = (uint32_t)(len & 0xFF) |
+                 ((uint32_t)(((uint8_t *)name)[0] | 32) << 8) |
+                 ((uint32_t)(((uint8_t *)name)[len - 2] | 32) << 16) |
+                 ((uint32_t)(((uint8_t *)name)[len - 1] | 32) << 24);
+  return (size_t)((uint32_t)(key * seed) >> (32 - HTTP_HEADER_INTERN_BITS));
+}
+
+static void http_header_intern_init(void) {
+  uint32_t seed = 0x9E3779B1;
+  for (size_t attempt = 0;; ++attempt) {
+    FIO_ASSERT(attempt < (1 << 16),
+               "(http) couldn't find a perfect hash for the header names.");
+    memset(http_header_interned.slots, 0, sizeof(http_header_interned.slots));
+    size_t i = 0;
+    for (; i < HTTP_HEADER_NAMES_COUNT; ++i) {
+      size_t pos = http_header_slot(http_header_names[i],
+                                    strlen(http_header_names[i]), seed);
+      if (http_header_interned.slots[pos])
+        break;
+      http_header_interned.slots[pos] = (uint8_t)(i + 1);
+    }
+    if (i == HTTP_HEADER_NAMES_COUNT)
+      break;
+    seed += 0x78DDE6E4; /* stays odd */
+  }
+  http_header_interned.seed = seed;
+  for (size_t i = 0; i < HTTP_HEADER_NAMES_COUNT; ++i) {
+    FIOBJ name =
+        fiobj_str_new(http_header_names[i], strlen(http_header_names[i]));
+    fiobj_obj2hash(name);
+    fiobj_str_freeze(name);
+    http_header_interned.names[i] = name;
+  }
+}
+
+static void http_header_intern_cleanup(void) {
+  for (size_t i = 0; i < HTTP_HEADER_NAMES_COUNT; ++i) {
+    fiobj_free(http_header_interned.names[i]);
+    http_header_interned.names[i] = FIOBJ_INVALID;
+  }
+  memset(http_header_interned.slots, 0, sizeof(http_header_interned.slots));
+}
+
+/**
+ * Returns the shared (frozen) String for a common header name, matched case
+ * insensitively, or FIOBJ_INVALID if the header isn't a common one.
+ */
+FIOBJ http_header_intern(const char *name, size_t len) {
+  if (len < 2 || len > 32 || !http_header_interned.seed)
+    return FIOBJ_INVALID;
+  size_t index = http_header_interned
+                     .slots[http_header_slot(name, len,
+                                             http_header_interned.seed)];
+  if (!index--)
+    return FIOBJ_INVALID;
+  const char *known = http_header_names[index];
+  for (size_t i = 0; i < len; ++i) {
+    char c = name[i];
+    if (c >= 'A' && c <= 'Z')
+      c |= 32;
+    if (c != known[i]) /* also stops at the NUL for shorter names */
+      return FIOBJ_INVALID;
+  }
+  if (known[len])
+    return FIOBJ_INVALID;
+  return http_header_interned.names[index];
+}
+
+/* *****************************************************************************
+Retained request Strings
+***************************************************************************** */
+
+/* copies a String that's still referenced (i.e., by the app) */
+static inline void http_s_unpin_str(FIOBJ o) {
+  if (FIOBJ_TYPE_IS(o, FIOBJ_T_STRING) && FIOBJECT2HEAD(o)->ref > 1)
+    fiobj_str_unshare(o);
+}
+
+/* `arg` is set for the values of repeated headers (Arrays) */
+static int http_s_unpin_task(FIOBJ o, void *arg) {
+  if (!arg)
+    http_s_unpin_str(fiobj_hash_key_in_loop());
+  if (FIOBJ_TYPE_IS(o, FIOBJ_T_ARRAY))
+    fiobj_each1(o, 0, http_s_unpin_task, (void *)1);
+  else
+    http_s_unpin_str(o);
+  return 0;
+}
+
+/**
+ * Copies the request Strings that are still referenced when the request is
+ * done (i.e., header values kept by the app), so they don't keep the
+ * connection's read buffer alive (see `fiobj_str_new_rbuf`).
+ */
+void http_s_unpin(http_s *h) {
+  if (h->private_data.arena)
+    return; /* arena objects can't outlive the request anyway */
+  http_s_unpin_str(h->method);
+  http_s_unpin_str(h->status_str);
+  http_s_unpin_str(h->version);
+  http_s_unpin_str(h->path);
+  http_s_unpin_str(h->query);
+  if (h->headers)
+    fiobj_each1(h->headers, 0, http_s_unpin_task, NULL);
+}
+
 /* *****************************************************************************
 Library initialization
 ***************************************************************************** */
 
 FIOBJ HTTP_HEADER_ACCEPT;
+FIOBJ HTTP_HEADER_ACCEPT_ENCODING;
 FIOBJ HTTP_HEADER_ACCEPT_RANGES;
 FIOBJ HTTP_HEADER_CACHE_CONTROL;
 FIOBJ HTTP_HEADER_CONNECTION;
@@ -121,12 +279,16 @@ FIOBJ HTTP_HEADER_COOKIE;
 FIOBJ HTTP_HEADER_DATE;
 FIOBJ HTTP_HEADER_ETAG;
 FIOBJ HTTP_HEADER_HOST;
+FIOBJ HTTP_HEADER_IF_NONE_MATCH;
+FIOBJ HTTP_HEADER_IF_RANGE;
 FIOBJ HTTP_HEADER_LAST_MODIFIED;
 FIOBJ HTTP_HEADER_ORIGIN;
+FIOBJ HTTP_HEADER_RANGE;
 FIOBJ HTTP_HEADER_SET_COOKIE;
 FIOBJ HTTP_HEADER_UPGRADE;
 FIOBJ HTTP_HEADER_WS_SEC_CLIENT_KEY;
 FIOBJ HTTP_HEADER_WS_SEC_KEY;
+FIOBJ HTTP_HEADER_WS_SEC_EXTENSIONS;
 FIOBJ HTTP_HVALUE_BYTES;
 FIOBJ HTTP_HVALUE_CLOSE;
 FIOBJ HTTP_HVALUE_CONTENT_TYPE_DEFAULT;
@@ -145,17 +307,25 @@ static void http_lib_cleanup(void *ignr_);
 static __attribute__((constructor)) void http_lib_constructor(void) {
   fio_state_callback_add(FIO_CALL_ON_INITIALIZE, http_lib_init, NULL);
   fio_state_callback_add(FIO_CALL_AT_EXIT, http_lib_cleanup, NULL);
+  fio_state_callback_add(FIO_CALL_IN_CHILD, http_log_on_fork, NULL);
+  fio_state_callback_add(FIO_CALL_IN_CHILD, http_metrics_on_fork, NULL);
 }
 
 void http_mimetype_stats(void);
 
 static void http_lib_cleanup(void *ignr_) {
   (void)ignr_;
+  http_log_clear();
+  http_metrics_clear();
   http_mimetype_clear();
+  http_static_cache_clear();
+  http_cache_clear(NULL);
+  http_client_pool_clear();
 #define HTTPLIB_RESET(x)                                                       \
   fiobj_free(x);                                                               \
   x = FIOBJ_INVALID;
   HTTPLIB_RESET(HTTP_HEADER_ACCEPT);
+  HTTPLIB_RESET(HTTP_HEADER_ACCEPT_ENCODING);
   HTTPLIB_RESET(HTTP_HEADER_ACCEPT_RANGES);
   HTTPLIB_RESET(HTTP_HEADER_CACHE_CONTROL);
   HTTPLIB_RESET(HTTP_HEADER_CONNECTION);
@@ -167,12 +337,16 @@ static void http_lib_cleanup(void *ignr_) {
   HTTPLIB_RESET(HTTP_HEADER_DATE);
   HTTPLIB_RESET(HTTP_HEADER_ETAG);
   HTTPLIB_RESET(HTTP_HEADER_HOST);
+  HTTPLIB_RESET(HTTP_HEADER_IF_NONE_MATCH);
+  HTTPLIB_RESET(HTTP_HEADER_IF_RANGE);
   HTTPLIB_RESET(HTTP_HEADER_LAST_MODIFIED);
   HTTPLIB_RESET(HTTP_HEADER_ORIGIN);
+  HTTPLIB_RESET(HTTP_HEADER_RANGE);
   HTTPLIB_RESET(HTTP_HEADER_SET_COOKIE);
   HTTPLIB_RESET(HTTP_HEADER_UPGRADE);
   HTTPLIB_RESET(HTTP_HEADER_WS_SEC_CLIENT_KEY);
   HTTPLIB_RESET(HTTP_HEADER_WS_SEC_KEY);
+  HTTPLIB_RESET(HTTP_HEADER_WS_SEC_EXTENSIONS);
   HTTPLIB_RESET(HTTP_HVALUE_BYTES);
   HTTPLIB_RESET(HTTP_HVALUE_CLOSE);
   HTTPLIB_RESET(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
@@ -187,6 +361,7 @@ static void http_lib_cleanup(void *ignr_) {
   HTTPLIB_RESET(HTTP_HVALUE_WS_VERSION);
 
 #undef HTTPLIB_RESET
+  http_header_intern_cleanup();
   http_mimetype_stats();
 }
 
@@ -196,24 +371,32 @@ static void http_lib_init(void *ignr_) {
   (void)ignr_;
   if (HTTP_HEADER_ACCEPT_RANGES)
     return;
-  HTTP_HEADER_ACCEPT = fiobj_str_new("accept", 6);
-  HTTP_HEADER_ACCEPT_RANGES = fiobj_str_new("accept-ranges", 13);
-  HTTP_HEADER_CACHE_CONTROL = fiobj_str_new("cache-control", 13);
-  HTTP_HEADER_CONNECTION = fiobj_str_new("connection", 10);
-  HTTP_HEADER_CONTENT_ENCODING = fiobj_str_new("content-encoding", 16);
-  HTTP_HEADER_CONTENT_LENGTH = fiobj_str_new("content-length", 14);
-  HTTP_HEADER_CONTENT_RANGE = fiobj_str_new("content-range", 13);
-  HTTP_HEADER_CONTENT_TYPE = fiobj_str_new("content-type", 12);
-  HTTP_HEADER_COOKIE = fiobj_str_new("cookie", 6);
-  HTTP_HEADER_DATE = fiobj_str_new("date", 4);
-  HTTP_HEADER_ETAG = fiobj_str_new("etag", 4);
-  HTTP_HEADER_HOST = fiobj_str_new("host", 4);
-  HTTP_HEADER_LAST_MODIFIED = fiobj_str_new("last-modified", 13);
-  HTTP_HEADER_ORIGIN = fiobj_str_new("origin", 6);
-  HTTP_HEADER_SET_COOKIE = fiobj_str_new("set-cookie", 10);
-  HTTP_HEADER_UPGRADE = fiobj_str_new("upgrade", 7);
-  HTTP_HEADER_WS_SEC_CLIENT_KEY = fiobj_str_new("sec-websocket-key", 17);
-  HTTP_HEADER_WS_SEC_KEY = fiobj_str_new("sec-websocket-accept", 20);
+  http_header_intern_init();
+#define HTTPLIB_INTERN(name)                                                   \
+  fiobj_dup(http_header_intern((name), sizeof(name) - 1))
+  HTTP_HEADER_ACCEPT = HTTPLIB_INTERN("accept");
+  HTTP_HEADER_ACCEPT_ENCODING = HTTPLIB_INTERN("accept-encoding");
+  HTTP_HEADER_ACCEPT_RANGES = HTTPLIB_INTERN("accept-ranges");
+  HTTP_HEADER_CACHE_CONTROL = HTTPLIB_INTERN("cache-control");
+  HTTP_HEADER_CONNECTION = HTTPLIB_INTERN("connection");
+  HTTP_HEADER_CONTENT_ENCODING = HTTPLIB_INTERN("content-encoding");
+  HTTP_HEADER_CONTENT_LENGTH = HTTPLIB_INTERN("content-length");
+  HTTP_HEADER_CONTENT_RANGE = HTTPLIB_INTERN("content-range");
+  HTTP_HEADER_CONTENT_TYPE = HTTPLIB_INTERN("content-type");
+  HTTP_HEADER_COOKIE = HTTPLIB_INTERN("cookie");
+  HTTP_HEADER_DATE = HTTPLIB_INTERN("date");
+  HTTP_HEADER_ETAG = HTTPLIB_INTERN("etag");
+  HTTP_HEADER_HOST = HTTPLIB_INTERN("host");
+  HTTP_HEADER_IF_NONE_MATCH = HTTPLIB_INTERN("if-none-match");
+  HTTP_HEADER_IF_RANGE = HTTPLIB_INTERN("if-range");
+  HTTP_HEADER_LAST_MODIFIED = HTTPLIB_INTERN("last-modified");
+  HTTP_HEADER_ORIGIN = HTTPLIB_INTERN("origin");
+  HTTP_HEADER_RANGE = HTTPLIB_INTERN("range");
+  HTTP_HEADER_SET_COOKIE = HTTPLIB_INTERN("set-cookie");
+  HTTP_HEADER_UPGRADE = HTTPLIB_INTERN("upgrade");
+  HTTP_HEADER_WS_SEC_CLIENT_KEY = HTTPLIB_INTERN("sec-websocket-key");
+  HTTP_HEADER_WS_SEC_KEY = HTTPLIB_INTERN("sec-websocket-accept");
+  HTTP_HEADER_WS_SEC_EXTENSIONS = HTTPLIB_INTERN("sec-websocket-extensions");
   HTTP_HVALUE_BYTES = fiobj_str_new("bytes", 5);
   HTTP_HVALUE_CLOSE = fiobj_str_new("close", 5);
   HTTP_HVALUE_CONTENT_TYPE_DEFAULT =
@@ -224,27 +407,11 @@ static void http_lib_init(void *ignr_) {
   HTTP_HVALUE_NO_CACHE = fiobj_str_new("no-cache, max-age=0", 19);
   HTTP_HVALUE_SSE_MIME = fiobj_str_new("text/event-stream", 17);
   HTTP_HVALUE_WEBSOCKET = fiobj_str_new("websocket", 9);
-  HTTP_HVALUE_WS_SEC_VERSION = fiobj_str_new("sec-websocket-version", 21);
+  HTTP_HVALUE_WS_SEC_VERSION = HTTPLIB_INTERN("sec-websocket-version");
   HTTP_HVALUE_WS_UPGRADE = fiobj_str_new("Upgrade", 7);
   HTTP_HVALUE_WS_VERSION = fiobj_str_new("13", 2);
+#undef HTTPLIB_INTERN
 
-  fiobj_obj2hash(HTTP_HEADER_ACCEPT_RANGES);
-  fiobj_obj2hash(HTTP_HEADER_CACHE_CONTROL);
-  fiobj_obj2hash(HTTP_HEADER_CONNECTION);
-  fiobj_obj2hash(HTTP_HEADER_CONTENT_ENCODING);
-  fiobj_obj2hash(HTTP_HEADER_CONTENT_LENGTH);
-  fiobj_obj2hash(HTTP_HEADER_CONTENT_RANGE);
-  fiobj_obj2hash(HTTP_HEADER_CONTENT_TYPE);
-  fiobj_obj2hash(HTTP_HEADER_COOKIE);
-  fiobj_obj2hash(HTTP_HEADER_DATE);
-  fiobj_obj2hash(HTTP_HEADER_ETAG);
-  fiobj_obj2hash(HTTP_HEADER_HOST);
-  fiobj_obj2hash(HTTP_HEADER_LAST_MODIFIED);
-  fiobj_obj2hash(HTTP_HEADER_ORIGIN);
-  fiobj_obj2hash(HTTP_HEADER_SET_COOKIE);
-  fiobj_obj2hash(HTTP_HEADER_UPGRADE);
-  fiobj_obj2hash(HTTP_HEADER_WS_SEC_CLIENT_KEY);
-  fiobj_obj2hash(HTTP_HEADER_WS_SEC_KEY);
   fiobj_obj2hash(HTTP_HVALUE_BYTES);
   fiobj_obj2hash(HTTP_HVALUE_CLOSE);
   fiobj_obj2hash(HTTP_HVALUE_CONTENT_TYPE_DEFAULT);
@@ -254,7 +421,6 @@ static void http_lib_init(void *ignr_) {
   fiobj_obj2hash(HTTP_HVALUE_NO_CACHE);
   fiobj_obj2hash(HTTP_HVALUE_SSE_MIME);
   fiobj_obj2hash(HTTP_HVALUE_WEBSOCKET);
-  fiobj_obj2hash(HTTP_HVALUE_WS_SEC_VERSION);
   fiobj_obj2hash(HTTP_HVALUE_WS_UPGRADE);
   fiobj_obj2hash(HTTP_HVALUE_WS_VERSION);
 
@@ -31,8 +31,12 @@ struct http_vtable_s {
   /** Should send existing headers and file */
   int (*const http_sendfile)(http_s *h, int fd, uintptr_t length,
                              uintptr_t offset);
-  /** Should send existing headers and data and prepare for streaming */
-  int (*const http_stream)(http_s *h, void *data, uintptr_t length);
+  /** Should send existing headers and prepare for streaming */
+  int (*const http_stream_start)(http_s *h, http_stream_args_s *args);
+  /** Should send data as part of a stream */
+  int (*const http_stream_write)(http_s *h, void *data, uintptr_t length);
+  /** Should complete streaming */
+  int (*const http_stream_end)(http_s *h);
   /** Should send existing headers or complete streaming */
   void (*const http_finish)(http_s *h);
   /** Push for data. */
@@ -56,6 +60,27 @@ struct http_vtable_s {
   int (*http_sse_write)(http_sse_s *sse, FIOBJ str);
   /** Closes an EventSource (SSE) connection. */
   int (*http_sse_close)(http_sse_s *sse);
+  /** Sends a response template and data (optional, see `http_send_template`).
+   */
+  int (*http_send_template)(http_s *h, http_response_template_s *t,
+                            void *data, uintptr_t length);
+  /** Sends a response template and a (shared) String (optional). */
+  int (*http_send_cached)(http_s *h, http_response_template_s *t, FIOBJ body);
+  /** Should send existing headers and a String / Rope. MUST free the FIOBJ.
+   * (optional, the body's String value is sent using `http_send_body`). */
+  int (*http_send_fiobj)(http_s *h, FIOBJ body);
+};
+
+struct http_response_template_s {
+  /* the template's headers, used when other headers were set */
+  FIOBJ headers;
+  /* the status line and headers, rendered for HTTP/1.1 */
+  FIOBJ http1;
+  uintptr_t status;
+  /* set if the headers include a `connection` header */
+  uint8_t has_connection;
+  /* set if the `connection` header is set to "close" */
+  uint8_t close;
 };
 
 struct http_fio_protocol_s {
@@ -70,9 +95,14 @@ struct http_fio_protocol_s {
 Constants that shouldn't be accessed by the users (`fiobj_dup` required).
 ***************************************************************************** */
 
+extern FIOBJ HTTP_HEADER_ACCEPT_ENCODING;
 extern FIOBJ HTTP_HEADER_ACCEPT_RANGES;
+extern FIOBJ HTTP_HEADER_IF_NONE_MATCH;
+extern FIOBJ HTTP_HEADER_IF_RANGE;
+extern FIOBJ HTTP_HEADER_RANGE;
 extern FIOBJ HTTP_HEADER_WS_SEC_CLIENT_KEY;
 extern FIOBJ HTTP_HEADER_WS_SEC_KEY;
+extern FIOBJ HTTP_HEADER_WS_SEC_EXTENSIONS;
 extern FIOBJ HTTP_HVALUE_BYTES;
 extern FIOBJ HTTP_HVALUE_CLOSE;
 extern FIOBJ HTTP_HVALUE_CONTENT_TYPE_DEFAULT;
@@ -90,6 +120,24 @@ extern FIOBJ HTTP_HVALUE_WS_VERSION;
 HTTP request/response object management
 ***************************************************************************** */
 
+/** Adds a finished response to the calling thread's metrics. */
+void http_metrics_add(http_s *h);
+
+/**
+ * Copies the request Strings that are still referenced when the request is
+ * done, so they don't keep the connection's read buffer alive.
+ */
+void http_s_unpin(http_s *h);
+
+#if DEBUG
+/** Tests the HTTP/1.x protocol (called by `http_tests`). */
+void http1_tests(void);
+/** Tests the WebSocket protocol (called by `http_tests`). */
+void websocket_tests(void);
+/** Tests HPACK and the HTTP/2 protocol (called by `http_tests`). */
+void http2_tests(void);
+#endif
+
 static inline void http_s_new(http_s *h, http_fio_protocol_s *owner,
                               http_vtable_s *vtbl) {
   *h = (http_s){
@@ -105,10 +153,13 @@ static inline void http_s_new(http_s *h, http_fio_protocol_s *owner,
   };
 }
 
-static inline void http_s_destroy(http_s *h, uint8_t log) {
-  if (log && h->status && !h->status_str) {
-    http_write_log(h);
+static inline void http_s_destroy(http_s *h, uint8_t finished) {
+  if (finished && h->status && !h->status_str) {
+    http_metrics_add(h);
+    if (http2protocol(h)->settings->log)
+      http_write_log(h);
   }
+  http_s_unpin(h);
   fiobj_free(h->method);
   fiobj_free(h->status_str);
   fiobj_free(h->private_data.out_headers);
@@ -119,23 +170,121 @@ static inline void http_s_destroy(http_s *h, uint8_t log) {
   fiobj_free(h->cookies);
   fiobj_free(h->body);
   fiobj_free(h->params);
+  fiobj_free(h->private_data.lazy_params);
+  fiobj_free(h->private_data.lazy_cookies);
+  /* the objects were freed, release their memory in one step */
+  fiobj_arena_reset(h->private_data.arena);
 
   *h = (http_s){
       .private_data.vtbl = h->private_data.vtbl,
       .private_data.flag = h->private_data.flag,
+      .private_data.arena = h->private_data.arena,
   };
 }
 
-static inline void http_s_clear(http_s *h, uint8_t log) {
-  http_s_destroy(h, log);
+static inline void http_s_clear(http_s *h, uint8_t finished) {
+  fiobj_arena_s *arena = h->private_data.arena;
+  http_s_destroy(h, finished);
   http_s_new(h, (http_fio_protocol_s *)h->private_data.flag,
              h->private_data.vtbl);
+  h->private_data.arena = arena;
+}
+
+/**
+ * Activates the request's arena (if any), returning the arena to restore
+ * (using `fiobj_arena_enter`).
+ */
+static inline fiobj_arena_s *http_arena_enter(http_s *h) {
+  if (!h->private_data.arena)
+    return fiobj_arena_active();
+  return fiobj_arena_enter(h->private_data.arena);
 }
 
 /** tests handle validity */
 #define HTTP_INVALID_HANDLE(h)                                                 \
   (!(h) || (!(h)->method && !(h)->status_str && (h)->status))
 
+/**
+ * Returns the shared (frozen) String for a common header name, matched case
+ * insensitively, or FIOBJ_INVALID if the header isn't a common one.
+ *
+ * The String is owned by the library (use `fiobj_dup` to keep a reference).
+ */
+FIOBJ http_header_intern(const char *name, size_t len);
+
+/* *****************************************************************************
+Streaming multipart uploads (see the `stream_uploads` setting)
+***************************************************************************** */
+
+typedef struct http_upload_s http_upload_s;
+
+/**
+ * Returns a streaming parser if the request's body is `multipart/form-data`,
+ * otherwise returns NULL.
+ *
+ * The parser adds the form's fields to the request's `params` as the body is
+ * received. Uploaded files are written directly to temporary files.
+ */
+http_upload_s *http_upload_new(http_s *h);
+
+/**
+ * Parses a chunk of the body, returning -1 on error (invalid multipart data).
+ */
+int http_upload_write(http_upload_s *u, void *data, size_t len);
+
+/**
+ * Parses any remaining data and frees the parser.
+ *
+ * Returns -1 if the body wasn't valid (or complete) multipart data.
+ */
+int http_upload_finish(http_upload_s *u);
+
+/**
+ * Frees the parser without completing the parsing (i.e., the connection was
+ * lost). MUST be called before the request is destroyed.
+ */
+void http_upload_free(http_upload_s *u);
+
+/** Clears the static file caches (open files and compressed data). */
+void http_static_cache_clear(void);
+
+/** Frees the client connection pools (idle connections should be closed). */
+void http_client_pool_clear(void);
+
+/**
+ * Handles a request using the response cache (see `cache_ttl`), calling the
+ * `on_request` callback unless a cached response was sent.
+ */
+void http_cache_on_request(http_s *h, http_settings_s *settings);
+
+/**
+ * Calls the `on_request` callback, within a coroutine if the `coroutines`
+ * setting is set (see `http_await`).
+ */
+void http_coroutine_on_request(http_s *h, http_settings_s *settings);
+/** Removes the responses cached for the `settings` (or all, if NULL). */
+void http_cache_clear(http_settings_s *settings);
+
+/** Formats and writes all the pending access log records. */
+void http_log_flush(void);
+/** Writes the pending access log records and frees the log's buffers. */
+void http_log_clear(void);
+/** Resets the access log's state in a child process (discards records). */
+void http_log_on_fork(void *ignr_);
+
+/** Frees the per-thread metrics. */
+void http_metrics_clear(void);
+/** Resets the metrics in a child process (each worker reports its own). */
+void http_metrics_on_fork(void *ignr_);
+/** Answers the request with the process's metrics (see `metrics_path`). */
+void http_send_metrics(http_s *h);
+
+/**
+ * Closes a file descriptor sent using `http_sendfile`, releasing it if it
+ * belongs to the static file cache (protocols MUST NOT call `close`).
+ */
+void http_sendfile_close(intptr_t fd);
+
 /* *****************************************************************************
 Request / Response Handlers
 ***************************************************************************** */
@@ -148,6 +297,16 @@ void http_on_response_handler______internal(http_s *h,
                                             http_settings_s *settings);
 int http_send_error2(size_t error, intptr_t uuid, http_settings_s *settings);
 
+/**
+ * Called once a client connection's response was handled, if the connection
+ * can be reused (HTTP/1.1 keep-alive).
+ *
+ * When the connection was opened with `reuse_connections`, it's returned to
+ * the origin's pool and the request's settings are freed (`on_finish` is
+ * called). Otherwise nothing happens.
+ */
+void http_client_release(http_fio_protocol_s *pr);
+
 /* *****************************************************************************
 EventSource Support (SSE)
 ***************************************************************************** */
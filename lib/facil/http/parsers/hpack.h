@@ -0,0 +1,616 @@
+/*
+copyright: Boaz Segev, 2019
+license: MIT
+
+Feel free to copy, use and enjoy according to the license specified.
+*/
+#ifndef H_HPACK_H
+/**\file
+
+A single file HPACK (RFC 7541) header block decoder and a (stateless) header
+encoder, decoupled from any IO layer.
+
+The decoder maintains the dynamic table. The encoder never indexes headers, so
+it requires no state (and the peer's dynamic table remains empty).
+
+Notice that this header file library includes a static funnction decleration
+that must be implemented by the including file (the callback).
+
+*/
+#define H_HPACK_H
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef HPACK_TABLE_SIZE
+/**
+ * The dynamic table size supported by the decoder.
+ *
+ * This is the HTTP/2 default for SETTINGS_HEADER_TABLE_SIZE. Larger values
+ * must be advertised by the HTTP/2 layer.
+ */
+#define HPACK_TABLE_SIZE 4096
+#endif
+
+/* *****************************************************************************
+API - Decoding
+***************************************************************************** */
+
+/** A dynamic table entry, the value follows the name in the table's data. */
+typedef struct {
+  uint16_t pos;
+  uint16_t name_len;
+  uint16_t value_len;
+} hpack_entry_s;
+
+/** The decoder's dynamic table (per connection). */
+typedef struct {
+  /** the (RFC 7541) size of the table: the entries' length + 32 bytes each */
+  size_t size;
+  /** the maximum size, as set by the encoder (up to HPACK_TABLE_SIZE) */
+  size_t max;
+  /** the position of the newest entry in the `entries` ring */
+  uint16_t head;
+  /** the number of entries */
+  uint16_t count;
+  /** the data of the oldest entry */
+  uint16_t start;
+  /** the end of the data of the newest entry */
+  uint16_t end;
+  hpack_entry_s entries[HPACK_TABLE_SIZE / 32];
+  uint8_t data[HPACK_TABLE_SIZE];
+} hpack_table_s;
+
+/** Initializes a decoder's dynamic table. */
+#define HPACK_TABLE_INIT                                                       \
+  { .max = HPACK_TABLE_SIZE }
+
+/**
+ * Decodes a complete header block (all the HEADERS / CONTINUATION fragments),
+ * calling `hpack_on_header` for every header.
+ *
+ * The `scratch` buffer is used for Huffman decoded strings and should be at
+ * least `hpack_scratch_len(len)` bytes long.
+ *
+ * Returns 0 on success, -1 on a decoding error (an HTTP/2 COMPRESSION_ERROR,
+ * the dynamic table is no longer valid) or the callback's return value if it
+ * returned a non-zero value (the dynamic table is valid, but the rest of the
+ * block is lost).
+ */
+inline static __attribute__((unused)) int
+hpack_decode(hpack_table_s *t, uint8_t *data, size_t len, uint8_t *scratch,
+             size_t scratch_len, void *udata);
+
+/** The scratch buffer length required for decoding a `len` long block. */
+#define hpack_scratch_len(len) (((len) << 1) + HPACK_TABLE_SIZE + 16)
+
+/* *****************************************************************************
+Callbacks - Required functions that must be inplemented to use this header
+***************************************************************************** */
+
+/**
+ * Called for every decoded header. The strings aren't NUL terminated.
+ *
+ * Pseudo headers (i.e. ":path") are reported like any other header.
+ *
+ * A non-zero return value stops the decoding.
+ */
+static int hpack_on_header(void *udata, char *name, size_t name_len,
+                           char *value, size_t value_len);
+
+/* *****************************************************************************
+API - Encoding
+***************************************************************************** */
+
+/**
+ * Encodes a header, writing it to the target buffer.
+ *
+ * Static table matches are used where possible. Other headers are written as
+ * literals (without indexing, no Huffman encoding).
+ *
+ * The target buffer must have room for `name_len + value_len + 12` bytes.
+ *
+ * Returns the number of bytes written.
+ */
+inline static __attribute__((unused)) size_t
+hpack_encode(uint8_t *target, const char *name, size_t name_len,
+             const char *value, size_t value_len);
+
+/**
+ * Encodes the `:status` pseudo header, writing it to the target buffer.
+ *
+ * The target buffer must have room for 5 bytes.
+ *
+ * Returns the number of bytes written.
+ */
+inline static __attribute__((unused)) size_t
+hpack_encode_status(uint8_t *target, size_t status);
+
+/* *****************************************************************************
+
+                                Implementation
+
+Nothing to see here, please move along ;-)
+
+***************************************************************************** */
+
+/* *****************************************************************************
+The Static Table
+***************************************************************************** */
+
+typedef struct {
+  const char *name;
+  size_t name_len;
+  const char *value;
+  size_t value_len;
+} hpack_static_s;
+
+#define HPACK_STATIC(name, value)                                              \
+  { name, sizeof(name) - 1, value, sizeof(value) - 1 }
+
+static const hpack_static_s hpack_static_table[62] = {
+    HPACK_STATIC("", ""),
+    HPACK_STATIC(":authority", ""),
+    HPACK_STATIC(":method", "GET"),
+    HPACK_STATIC(":method", "POST"),
+    HPACK_STATIC(":path", "/"),
+    HPACK_STATIC(":path", "/index.html"),
+    HPACK_STATIC(":scheme", "http"),
+    HPACK_STATIC(":scheme", "https"),
+    HPACK_STATIC(":status", "200"),
+    HPACK_STATIC(":status", "204"),
+    HPACK_STATIC(":status", "206"),
+    HPACK_STATIC(":status", "304"),
+    HPACK_STATIC(":status", "400"),
+    HPACK_STATIC(":status", "404"),
+    HPACK_STATIC(":status", "500"),
+    HPACK_STATIC("accept-charset", ""),
+    HPACK_STATIC("accept-encoding", "gzip, deflate"),
+    HPACK_STATIC("accept-language", ""),
+    HPACK_STATIC("accept-ranges", ""),
+    HPACK_STATIC("accept", ""),
+    HPACK_STATIC("access-control-allow-origin", ""),
+    HPACK_STATIC("age", ""),
+    HPACK_STATIC("allow", ""),
+    HPACK_STATIC("authorization", ""),
+    HPACK_STATIC("cache-control", ""),
+    HPACK_STATIC("content-disposition", ""),
+    HPACK_STATIC("content-encoding", ""),
+    HPACK_STATIC("content-language", ""),
+    HPACK_STATIC("content-length", ""),
+    HPACK_STATIC("content-location", ""),
+    HPACK_STATIC("content-range", ""),
+    HPACK_STATIC("content-type", ""),
+    HPACK_STATIC("cookie", ""),
+    HPACK_STATIC("date", ""),
+    HPACK_STATIC("etag", ""),
+    HPACK_STATIC("expect", ""),
+    HPACK_STATIC("expires", ""),
+    HPACK_STATIC("from", ""),
+    HPACK_STATIC("host", ""),
+    HPACK_STATIC("if-match", ""),
+    HPACK_STATIC("if-modified-since", ""),
+    HPACK_STATIC("if-none-match", ""),
+    HPACK_STATIC("if-range", ""),
+    HPACK_STATIC("if-unmodified-since", ""),
+    HPACK_STATIC("last-modified", ""),
+    HPACK_STATIC("link", ""),
+    HPACK_STATIC("location", ""),
+    HPACK_STATIC("max-forwards", ""),
+    HPACK_STATIC("proxy-authenticate", ""),
+    HPACK_STATIC("proxy-authorization", ""),
+    HPACK_STATIC("range", ""),
+    HPACK_STATIC("referer", ""),
+    HPACK_STATIC("refresh", ""),
+    HPACK_STATIC("retry-after", ""),
+    HPACK_STATIC("server", ""),
+    HPACK_STATIC("set-cookie", ""),
+    HPACK_STATIC("strict-transport-security", ""),
+    HPACK_STATIC("transfer-encoding", ""),
+    HPACK_STATIC("user-agent", ""),
+    HPACK_STATIC("vary", ""),
+    HPACK_STATIC("via", ""),
+    HPACK_STATIC("www-authenticate", ""),
+};
+
+#undef HPACK_STATIC
+
+/* *****************************************************************************
+Huffman Decoding (the RFC 7541 code is canonical)
+***************************************************************************** */
+
+/* the (exclusive) upper limit of each code length, left aligned to 32 bits */
+static const uint64_t hpack_huff_limit[31] = {
+    0x0ULL, 0x0ULL, 0x0ULL, 0x0ULL,
+    0x0ULL, 0x50000000ULL, 0xB8000000ULL, 0xF8000000ULL,
+    0xFE000000ULL, 0xFE000000ULL, 0xFF400000ULL, 0xFFA00000ULL,
+    0xFFC00000ULL, 0xFFF00000ULL, 0xFFF80000ULL, 0xFFFE0000ULL,
+    0xFFFE0000ULL, 0xFFFE0000ULL, 0xFFFE0000ULL, 0xFFFE6000ULL,
+    0xFFFEE000ULL, 0xFFFF4800ULL, 0xFFFFB000ULL, 0xFFFFEA00ULL,
+    0xFFFFF600ULL, 0xFFFFF800ULL, 0xFFFFFBC0ULL, 0xFFFFFE20ULL,
+    0xFFFFFFF0ULL, 0xFFFFFFF0ULL, 0x100000000ULL,
+};
+/* the first (canonical) code of each code length */
+static const uint32_t hpack_huff_first[31] = {
+    0x0, 0x0, 0x0, 0x0, 0x0, 0x0,
+    0x14, 0x5C, 0xF8, 0x1FC, 0x3F8, 0x7FA,
+    0xFFA, 0x1FF8, 0x3FFC, 0x7FFC, 0xFFFE, 0x1FFFC,
+    0x3FFF8, 0x7FFF0, 0xFFFE6, 0x1FFFDC, 0x3FFFD2, 0x7FFFD8,
+    0xFFFFEA, 0x1FFFFEC, 0x3FFFFE0, 0x7FFFFDE, 0xFFFFFE2, 0x1FFFFFFE,
+    0x3FFFFFFC,
+};
+/* the offset of each code length in the `hpack_huff_sym` table */
+static const uint16_t hpack_huff_offset[31] = {
+    0, 0, 0, 0, 0, 0, 10, 36, 68, 74, 74, 79,
+    82, 84, 90, 92, 95, 95, 95, 95, 98, 106, 119, 145,
+    174, 186, 190, 205, 224, 253, 253,
+};
+/* the symbols, ordered by their (canonical) Huffman code */
+static const uint16_t hpack_huff_sym[257] = {
+    48, 49, 50, 97, 99, 101, 105, 111, 115, 116, 32, 37,
+    45, 46, 47, 51, 52, 53, 54, 55, 56, 57, 61, 65,
+    95, 98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+    58, 66, 67, 68, 69, 70, 71, 72, 73, 74, 75, 76,
+    77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 89,
+    106, 107, 113, 118, 119, 120, 121, 122, 38, 42, 44, 59,
+    88, 90, 33, 34, 40, 41, 63, 39, 43, 124, 35, 62,
+    0, 36, 64, 91, 93, 126, 94, 125, 60, 96, 123, 92,
+    195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+    167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+    132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+    173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+    233, 1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+    151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+    183, 188, 191, 197, 231, 239, 9, 142, 144, 145, 148, 159,
+    171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+    200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+    255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+    246, 247, 248, 250, 251, 252, 253, 254, 2, 3, 4, 5,
+    6, 7, 8, 11, 12, 14, 15, 16, 17, 18, 19, 20,
+    21, 23, 24, 25, 26, 27, 28, 29, 30, 31, 127, 220,
+    249, 10, 13, 22, 256,
+};
+
+/* decodes a Huffman encoded string, returns the decoded length or -1. */
+inline static intptr_t hpack_huff_decode(uint8_t *dest, size_t dest_len,
+                                         const uint8_t *src, size_t len) {
+  const uint8_t *end = src + len;
+  uint8_t *const start = dest;
+  uint8_t *const dest_end = dest + dest_len;
+  uint64_t acc = 0; /* left aligned bits */
+  size_t bits = 0;
+  for (;;) {
+    while (bits <= 56 && src < end) {
+      acc |= (uint64_t)(*src++) << (56 - bits);
+      bits += 8;
+    }
+    if (!bits)
+      break;
+    const uint64_t top = acc >> 32;
+    size_t l = 5;
+    while (top >= hpack_huff_limit[l])
+      ++l;
+    if (l > bits) {
+      /* padding: up to 7 bits of the EOS code (all set) */
+      if (bits > 7 || (acc >> (64 - bits)) != ((uint64_t)1 << bits) - 1)
+        return -1;
+      break;
+    }
+    const uint16_t sym =
+        hpack_huff_sym[hpack_huff_offset[l] +
+                       ((uint32_t)(top >> (32 - l)) - hpack_huff_first[l])];
+    if (sym == 256 || dest >= dest_end)
+      return -1; /* EOS isn't allowed in a string */
+    *(dest++) = (uint8_t)sym;
+    acc <<= l;
+    bits -= l;
+  }
+  return dest - start;
+}
+
+/* *****************************************************************************
+Integers and Strings
+***************************************************************************** */
+
+/* reads an integer with an N bit prefix, returns -1 on error. */
+inline static int64_t hpack_int_read(uint8_t **pos, uint8_t *end,
+                                     uint8_t prefix) {
+  const uint8_t mask = (uint8_t)((1U << prefix) - 1);
+  if (*pos >= end)
+    return -1;
+  uint64_t i = (**pos) & mask;
+  ++(*pos);
+  if (i < mask)
+    return (int64_t)i;
+  size_t shift = 0;
+  uint8_t b;
+  do {
+    if (*pos >= end || shift > 28)
+      return -1;
+    b = **pos;
+    ++(*pos);
+    i += (uint64_t)(b & 127) << shift;
+    shift += 7;
+  } while (b & 128);
+  return (int64_t)i;
+}
+
+/* writes an integer with an N bit prefix, returns the number of bytes */
+inline static size_t hpack_int_write(uint8_t *dest, uint8_t prefix,
+                                     uint8_t flags, uint64_t i) {
+  const uint8_t mask = (uint8_t)((1U << prefix) - 1);
+  if (i < mask) {
+    dest[0] = flags | (uint8_t)i;
+    return 1;
+  }
+  size_t len = 1;
+  dest[0] = flags | mask;
+  i -= mask;
+  while (i >= 128) {
+    dest[len++] = (uint8_t)((i & 127) | 128);
+    i >>= 7;
+  }
+  dest[len++] = (uint8_t)i;
+  return len;
+}
+
+/* reads a string, decoding Huffman encoded strings into the scratch space */
+inline static int hpack_str_read(uint8_t **pos, uint8_t *end, uint8_t **scratch,
+                                 uint8_t *scratch_end, char **str,
+                                 size_t *len) {
+  if (*pos >= end)
+    return -1;
+  const uint8_t huffman = (**pos) & 128;
+  int64_t l = hpack_int_read(pos, end, 7);
+  if (l < 0 || l > end - *pos)
+    return -1;
+  if (!huffman) {
+    *str = (char *)*pos;
+    *len = (size_t)l;
+    *pos += l;
+    return 0;
+  }
+  intptr_t d = hpack_huff_decode(*scratch, scratch_end - *scratch, *pos, l);
+  if (d < 0)
+    return -1;
+  *str = (char *)*scratch;
+  *len = (size_t)d;
+  *scratch += d;
+  *pos += l;
+  return 0;
+}
+
+/* *****************************************************************************
+The Dynamic Table
+***************************************************************************** */
+
+#define HPACK_TABLE_ENTRIES (HPACK_TABLE_SIZE / 32)
+
+/* returns the entry at the (1 based) dynamic index */
+inline static hpack_entry_s *hpack_table_get(hpack_table_s *t, size_t index) {
+  if (!index || index > t->count)
+    return NULL;
+  return t->entries + ((t->head + HPACK_TABLE_ENTRIES - (index - 1)) %
+                       HPACK_TABLE_ENTRIES);
+}
+
+/* evicts entries until the table has room for `size` (RFC 7541) bytes */
+inline static void hpack_table_evict(hpack_table_s *t, size_t size) {
+  while (t->count && t->size + size > t->max) {
+    hpack_entry_s *e = hpack_table_get(t, t->count);
+    t->size -= e->name_len + e->value_len + 32;
+    --t->count;
+    t->start = e->pos + e->name_len + e->value_len;
+  }
+  if (!t->count)
+    t->start = t->end = 0;
+}
+
+/* adds an entry, `name` and `value` must not point into the table */
+inline static void hpack_table_add(hpack_table_s *t, char *name,
+                                   size_t name_len, char *value,
+                                   size_t value_len) {
+  const size_t len = name_len + value_len;
+  if (len + 32 > t->max) {
+    /* not an error, the table is emptied */
+    hpack_table_evict(t, t->max + 1);
+    return;
+  }
+  hpack_table_evict(t, len + 32);
+  if (t->end + len > HPACK_TABLE_SIZE) {
+    /* compact the data to the beginning of the buffer */
+    memmove(t->data, t->data + t->start, t->end - t->start);
+    for (size_t i = 1; i <= t->count; ++i)
+      hpack_table_get(t, i)->pos -= t->start;
+    t->end -= t->start;
+    t->start = 0;
+  }
+  hpack_entry_s *e;
+  if (t->count)
+    t->head = (t->head + 1) % HPACK_TABLE_ENTRIES;
+  e = t->entries + t->head;
+  *e = (hpack_entry_s){
+      .pos = t->end,
+      .name_len = (uint16_t)name_len,
+      .value_len = (uint16_t)value_len,
+  };
+  memcpy(t->data + t->end, name, name_len);
+  memcpy(t->data + t->end + name_len, value, value_len);
+  t->end += len;
+  t->size += len + 32;
+  ++t->count;
+}
+
+/* collects a name (and maybe a value) from either table, 0 on success */
+inline static int hpack_table_find(hpack_table_s *t, size_t index, char **name,
+                                   size_t *name_len, char **value,
+                                   size_t *value_len) {
+  if (!index)
+    return -1;
+  if (index < 62) {
+    *name = (char *)hpack_static_table[index].name;
+    *name_len = hpack_static_table[index].name_len;
+    if (value) {
+      *value = (char *)hpack_static_table[index].value;
+      *value_len = hpack_static_table[index].value_len;
+    }
+    return 0;
+  }
+  hpack_entry_s *e = hpack_table_get(t, index - 61);
+  if (!e)
+    return -1;
+  *name = (char *)t->data + e->pos;
+  *name_len = e->name_len;
+  if (value) {
+    *value = (char *)t->data + e->pos + e->name_len;
+    *value_len = e->value_len;
+  }
+  return 0;
+}
+
+/* *****************************************************************************
+Decoding
+***************************************************************************** */
+
+inline static int hpack_decode(hpack_table_s *t, uint8_t *data, size_t len,
+                               uint8_t *scratch, size_t scratch_len,
+                               void *udata) {
+  uint8_t *pos = data;
+  uint8_t *const end = data + len;
+  uint8_t *const scratch_end = scratch + scratch_len;
+  uint8_t allow_resize = 1;
+  while (pos < end) {
+    uint8_t *s = scratch;
+    char *name, *value;
+    size_t name_len, value_len;
+    int64_t index;
+    int ret;
+    if (*pos & 128) {
+      /* indexed header field */
+      index = hpack_int_read(&pos, end, 7);
+      if (index < 0 || hpack_table_find(t, (size_t)index, &name, &name_len,
+                                        &value, &value_len))
+        return -1;
+      allow_resize = 0;
+      if ((ret = hpack_on_header(udata, name, name_len, value, value_len)))
+        return ret;
+      continue;
+    }
+    if ((*pos & 224) == 32) {
+      /* dynamic table size update (only at the beginning of a block) */
+      index = hpack_int_read(&pos, end, 5);
+      if (!allow_resize || index < 0 || index > HPACK_TABLE_SIZE)
+        return -1;
+      t->max = (size_t)index;
+      hpack_table_evict(t, 0);
+      continue;
+    }
+    allow_resize = 0;
+    /* a literal header field, with incremental indexing (01xxxxxx) or without
+     * indexing (0000xxxx / 0001xxxx) */
+    const uint8_t indexing = ((*pos & 192) == 64);
+    index = hpack_int_read(&pos, end, (indexing ? 6 : 4));
+    if (index < 0)
+      return -1;
+    if (index) {
+      if (hpack_table_find(t, (size_t)index, &name, &name_len, NULL, NULL))
+        return -1;
+    } else if (hpack_str_read(&pos, end, &s, scratch_end, &name, &name_len)) {
+      return -1;
+    }
+    if (hpack_str_read(&pos, end, &s, scratch_end, &value, &value_len))
+      return -1;
+    if (indexing && (uint8_t *)name >= t->data &&
+        (uint8_t *)name < t->data + HPACK_TABLE_SIZE) {
+      /* the table might be reordered when the entry is added */
+      if (name_len > (size_t)(scratch_end - s))
+        return -1;
+      memcpy(s, name, name_len);
+      name = (char *)s;
+    }
+    ret = hpack_on_header(udata, name, name_len, value, value_len);
+    if (indexing)
+      hpack_table_add(t, name, name_len, value, value_len);
+    if (ret)
+      return ret;
+  }
+  return 0;
+}
+
+/* *****************************************************************************
+Encoding
+***************************************************************************** */
+
+/* returns the static index of a header (negative for name only matches) */
+inline static int hpack_static_find(const char *name, size_t name_len,
+                                    const char *value, size_t value_len) {
+  int found = 0;
+  for (int i = 1; i < 62; ++i) {
+    if (hpack_static_table[i].name_len != name_len ||
+        memcmp(hpack_static_table[i].name, name, name_len))
+      continue;
+    if (hpack_static_table[i].value_len == value_len && value_len &&
+        !memcmp(hpack_static_table[i].value, value, value_len))
+      return i;
+    if (!found)
+      found = 0 - i;
+  }
+  return found;
+}
+
+inline static size_t hpack_encode(uint8_t *target, const char *name,
+                                  size_t name_len, const char *value,
+                                  size_t value_len) {
+  size_t len = 0;
+  int index = hpack_static_find(name, name_len, value, value_len);
+  if (index > 0)
+    return hpack_int_write(target, 7, 128, (uint64_t)index);
+  if (index) {
+    len = hpack_int_write(target, 4, 0, (uint64_t)(0 - index));
+  } else {
+    target[0] = 0;
+    len = 1 + hpack_int_write(target + 1, 7, 0, name_len);
+    memcpy(target + len, name, name_len);
+    len += name_len;
+  }
+  len += hpack_int_write(target + len, 7, 0, value_len);
+  memcpy(target + len, value, value_len);
+  return len + value_len;
+}
+
+inline static size_t hpack_encode_status(uint8_t *target, size_t status) {
+  switch (status) {
+  case 200:
+    target[0] = 128 | 8;
+    return 1;
+  case 204:
+    target[0] = 128 | 9;
+    return 1;
+  case 206:
+    target[0] = 128 | 10;
+    return 1;
+  case 304:
+    target[0] = 128 | 11;
+    return 1;
+  case 400:
+    target[0] = 128 | 12;
+    return 1;
+  case 404:
+    target[0] = 128 | 13;
+    return 1;
+  case 500:
+    target[0] = 128 | 14;
+    return 1;
+  }
+  if (status < 100 || status > 999)
+    status = 500;
+  target[0] = 8; /* literal without indexing, name index 8 (:status) */
+  target[1] = 3;
+  target[2] = '0' + (uint8_t)(status / 100);
+  target[3] = '0' + (uint8_t)((status / 10) % 10);
+  target[4] = '0' + (uint8_t)(status % 10);
+  return 5;
+}
+
+#undef HPACK_TABLE_ENTRIES
+#endif
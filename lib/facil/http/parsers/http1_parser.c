@@ -22,6 +22,101 @@ Seeking for characters in a string
 #define ALLOW_UNALIGNED_MEMORY_ACCESS 0
 #endif
 
+/* *****************************************************************************
+Vector scanning (the first HTTP1_SIMD_SPAN bytes of every seek)
+***************************************************************************** */
+
+/* bytes scanned using vector instructions before falling back to memchr */
+#define HTTP1_SIMD_SPAN 64
+
+#if HTTP1_PARSER_SIMD && defined(__GNUC__) && defined(__x86_64__) &&          \
+    defined(__SSE2__)
+#include <immintrin.h>
+#define HTTP1_SIMD 1
+
+#if !defined(__AVX2__)
+/* AVX2 isn't part of the compilation target, detect it during startup */
+static uint8_t http1_simd_avx2;
+static void __attribute__((constructor)) http1_simd_detect(void) {
+  __builtin_cpu_init();
+  http1_simd_avx2 = (__builtin_cpu_supports("avx2") != 0);
+}
+#define HTTP1_SIMD_AVX2_TARGET __attribute__((target("avx2"), noinline))
+#else
+#define http1_simd_avx2 1
+#define HTTP1_SIMD_AVX2_TARGET
+#endif
+
+/* scans 32 bytes at a time, at most HTTP1_SIMD_SPAN bytes. */
+HTTP1_SIMD_AVX2_TARGET static uint8_t
+http1_simd_seek_avx2(uint8_t **pos, uint8_t *const limit, const uint8_t ch) {
+  const __m256i wanted = _mm256_set1_epi8((char)ch);
+  uint8_t *p = *pos;
+  uint8_t *const end = (limit - p > HTTP1_SIMD_SPAN) ? p + HTTP1_SIMD_SPAN
+                                                     : limit;
+  for (; p + 32 <= end; p += 32) {
+    const uint32_t found = (uint32_t)_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i *)p), wanted));
+    if (found) {
+      *pos = p + __builtin_ctz(found);
+      return 1;
+    }
+  }
+  *pos = p;
+  return 0;
+}
+
+/* scans 16 bytes at a time, at most HTTP1_SIMD_SPAN bytes. */
+inline static uint8_t http1_simd_seek(uint8_t **pos, uint8_t *const limit,
+                                      const uint8_t ch) {
+  if (http1_simd_avx2)
+    return http1_simd_seek_avx2(pos, limit, ch);
+  const __m128i wanted = _mm_set1_epi8((char)ch);
+  uint8_t *p = *pos;
+  uint8_t *const end = (limit - p > HTTP1_SIMD_SPAN) ? p + HTTP1_SIMD_SPAN
+                                                     : limit;
+  for (; p + 16 <= end; p += 16) {
+    const uint32_t found = (uint32_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)p), wanted));
+    if (found) {
+      *pos = p + __builtin_ctz(found);
+      return 1;
+    }
+  }
+  *pos = p;
+  return 0;
+}
+
+#elif HTTP1_PARSER_SIMD && defined(__GNUC__) && defined(__aarch64__) &&       \
+    defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HTTP1_SIMD 1
+
+/* scans 16 bytes at a time, at most HTTP1_SIMD_SPAN bytes. */
+inline static uint8_t http1_simd_seek(uint8_t **pos, uint8_t *const limit,
+                                      const uint8_t ch) {
+  const uint8x16_t wanted = vdupq_n_u8(ch);
+  uint8_t *p = *pos;
+  uint8_t *const end = (limit - p > HTTP1_SIMD_SPAN) ? p + HTTP1_SIMD_SPAN
+                                                     : limit;
+  for (; p + 16 <= end; p += 16) {
+    /* narrow the 0x00/0xFF byte mask into a nibble per byte */
+    const uint8x16_t eq = vceqq_u8(vld1q_u8(p), wanted);
+    const uint64_t found = vget_lane_u64(
+        vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+    if (found) {
+      *pos = p + (__builtin_ctzll(found) >> 2);
+      return 1;
+    }
+  }
+  *pos = p;
+  return 0;
+}
+
+#else
+#define HTTP1_SIMD 0
+#endif
+
 #if FIO_MEMCHAR
 
 /**
@@ -95,7 +190,13 @@ inline static uint8_t seek2ch(uint8_t **pos, uint8_t *const limit, uint8_t ch) {
   if (*pos >= limit || **pos == ch) {
     return 0;
   }
+#if HTTP1_SIMD
+  uint8_t *tmp = *pos;
+  if (!http1_simd_seek(&tmp, limit, ch))
+    tmp = memchr(tmp, ch, limit - tmp);
+#else
   uint8_t *tmp = memchr(*pos, ch, limit - (*pos));
+#endif
   if (tmp) {
     *pos = tmp;
 #if HTTP1_PARSER_CONVERT_EOL2NUL
@@ -139,7 +240,7 @@ inline static int consume_response_line(struct http1_fio_parser_args_s *args,
   if (!seek2ch(&tmp, end, ' '))
     return -1;
   if (args->on_status(args->parser, atol((char *)start), (char *)(tmp + 1),
-                      end - tmp))
+                      end - (tmp + 1)))
     return -1;
   return 0;
 }
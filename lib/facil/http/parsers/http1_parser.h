@@ -31,7 +31,13 @@ to maintain and that could be used for an HTTP/1.x client as well.
 #endif
 
 #ifndef HTTP1_PARSER_CONVERT_EOL2NUL
-#define HTTP1_PARSER_CONVERT_EOL2NUL 0
+/**
+ * when defined, the delimiters following the data passed to the callbacks
+ * (spaces, colons, EOL markers) are converted to NUL (in the buffer).
+ *
+ * this allows facil.io to reference the buffer's data, rather than copy it.
+ */
+#define HTTP1_PARSER_CONVERT_EOL2NUL 1
 #endif
 
 #ifndef FIO_MEMCHAR
@@ -39,6 +45,16 @@ to maintain and that could be used for an HTTP/1.x client as well.
 #define FIO_MEMCHAR 0
 #endif
 
+#ifndef HTTP1_PARSER_SIMD
+/**
+ * When available (SSE2 / AVX2 / NEON), the first bytes of every seek are
+ * scanned using vector instructions before falling back to `memchr`.
+ *
+ * Most header lines are short, so this avoids a library call per delimiter.
+ */
+#define HTTP1_PARSER_SIMD 1
+#endif
+
 #if HTTP_HEADERS_LOWERCASE
 
 #define HEADER_NAME_IS_EQ(var_name, const_name, len)                           \
@@ -21,6 +21,14 @@ must be implemented by the including file (the callbacks).
 #if DEBUG
 #include <stdio.h>
 #endif
+
+#ifndef WEBSOCKET_PARSER_SIMD
+/**
+ * When available (SSE2 / AVX2 / NEON), large payloads are masked and unmasked
+ * using vector instructions before falling back to the word-at-a-time loop.
+ */
+#define WEBSOCKET_PARSER_SIMD 1
+#endif
 /* *****************************************************************************
 API - Message Wrapping
 ***************************************************************************** */
@@ -134,17 +142,109 @@ API - Internal Helpers
 /** used internally to mask and unmask client messages. */
 inline static void websocket_xmask(void *msg, uint64_t len, uint32_t mask);
 
+/** the word-at-a-time masking loop (used by `websocket_xmask`). */
+inline static void websocket_xmask_words(void *msg, uint64_t len,
+                                         uint32_t mask);
+
 /* *****************************************************************************
 
                                 Implementation
 
 ***************************************************************************** */
 
+/* *****************************************************************************
+Message masking - vector kernels
+***************************************************************************** */
+
+/* payloads shorter than this are masked using the word-at-a-time loop */
+#define WEBSOCKET_SIMD_MIN_LENGTH 32
+
+/*
+ * The kernels use unaligned loads and stores and only consume multiples of the
+ * vector size, so the mask stays in phase and the tail is left for the
+ * word-at-a-time loop.
+ */
+#if WEBSOCKET_PARSER_SIMD && defined(__GNUC__) && defined(__x86_64__) &&       \
+    defined(__SSE2__)
+#include <immintrin.h>
+#define WEBSOCKET_SIMD 1
+
+#if !defined(__AVX2__)
+/* AVX2 isn't part of the compilation target, detect it during startup */
+static uint8_t websocket_simd_avx2;
+static void __attribute__((constructor)) websocket_simd_detect(void) {
+  __builtin_cpu_init();
+  websocket_simd_avx2 = (__builtin_cpu_supports("avx2") != 0);
+}
+#define WEBSOCKET_SIMD_AVX2_TARGET __attribute__((target("avx2"), noinline))
+#else
+#define websocket_simd_avx2 1
+#define WEBSOCKET_SIMD_AVX2_TARGET
+#endif
+
+/* XORs 32 bytes at a time, returning the number of bytes masked. */
+WEBSOCKET_SIMD_AVX2_TARGET static uint64_t
+websocket_xmask_avx2(uint8_t *msg, uint64_t len, uint32_t mask) {
+  const __m256i xmask = _mm256_set1_epi32((int)mask);
+  uint64_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i *const pos = (__m256i *)(msg + i);
+    _mm256_storeu_si256(pos, _mm256_xor_si256(_mm256_loadu_si256(pos), xmask));
+  }
+  return i;
+}
+
+/* XORs 16 bytes at a time, returning the number of bytes masked. */
+inline static uint64_t websocket_xmask_simd(uint8_t *msg, uint64_t len,
+                                            uint32_t mask) {
+  if (websocket_simd_avx2)
+    return websocket_xmask_avx2(msg, len, mask);
+  const __m128i xmask = _mm_set1_epi32((int)mask);
+  uint64_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i *const pos = (__m128i *)(msg + i);
+    _mm_storeu_si128(pos, _mm_xor_si128(_mm_loadu_si128(pos), xmask));
+  }
+  return i;
+}
+
+#elif WEBSOCKET_PARSER_SIMD && defined(__GNUC__) && defined(__aarch64__) &&    \
+    defined(__ARM_NEON) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#include <arm_neon.h>
+#define WEBSOCKET_SIMD 1
+
+/* XORs 16 bytes at a time, returning the number of bytes masked. */
+inline static uint64_t websocket_xmask_simd(uint8_t *msg, uint64_t len,
+                                            uint32_t mask) {
+  const uint8x16_t xmask = vreinterpretq_u8_u32(vdupq_n_u32(mask));
+  uint64_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    vst1q_u8(msg + i, veorq_u8(vld1q_u8(msg + i), xmask));
+  }
+  return i;
+}
+
+#else
+#define WEBSOCKET_SIMD 0
+#endif
+
 /* *****************************************************************************
 Message masking
 ***************************************************************************** */
 /** used internally to mask and unmask client messages. */
 void websocket_xmask(void *msg, uint64_t len, uint32_t mask) {
+#if WEBSOCKET_SIMD
+  if (len >= WEBSOCKET_SIMD_MIN_LENGTH) {
+    const uint64_t done = websocket_xmask_simd((uint8_t *)msg, len, mask);
+    msg = (void *)((uintptr_t)msg + done);
+    len -= done;
+  }
+#endif
+  websocket_xmask_words(msg, len, mask);
+}
+
+/** the word-at-a-time masking loop (used by `websocket_xmask`). */
+void websocket_xmask_words(void *msg, uint64_t len, uint32_t mask) {
   if (len > 7) {
     { /* XOR any unaligned memory (4 byte alignment) */
       const uintptr_t offset = 4 - ((uintptr_t)msg & 3);
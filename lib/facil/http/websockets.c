@@ -26,6 +26,10 @@ Feel free to copy, use and enjoy according to the license provided.
 
 #include <websocket_parser.h>
 
+#if HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #if !defined(__BIG_ENDIAN__) && !defined(__LITTLE_ENDIAN__)
 #include <endian.h>
 #if !defined(__BIG_ENDIAN__) && !defined(__LITTLE_ENDIAN__) &&                 \
@@ -57,29 +61,42 @@ void free_ws_buffer(ws_s *owner, struct buffer_s);
 /** Sets the initial buffer size. (4Kb)*/
 #define WS_INITIAL_BUFFER_SIZE 4096UL
 
+/** Frames larger than this are streamed (see `on_fragment`). (64Kb)*/
+#define WS_STREAM_BUFFER_SIZE 65536UL
+
 /*******************************************************************************
-Buffer management - simple implementation...
-Since Websocket connections have a long life expectancy, optimizing this part of
-the code probably wouldn't offer a high performance boost.
+Buffer management - pooled implementation...
+
+Buffers are allocated using the facil.io allocator (`fio_malloc`), in power of
+2 size classes (4Kb, 8Kb, 16Kb...), so freed buffers are quickly reused by other
+connections.
+
+Connections only hold a buffer while a partial frame is pending. Idle
+connections read into the stack and hold no buffer at all, and a buffer grown
+for a large frame shrinks back once the frame was consumed.
 */
 
-// buffer increments by 4,096 Bytes (4Kb)
-#define round_up_buffer_size(size) (((size) >> 12) + 1) << 12
+/* rounds the buffer size up to the nearest size class */
+static inline size_t round_up_buffer_size(size_t size) {
+  size_t ret = WS_INITIAL_BUFFER_SIZE;
+  while (ret < size)
+    ret <<= 1;
+  return ret;
+}
 
 struct buffer_s create_ws_buffer(ws_s *owner) {
   (void)(owner);
   struct buffer_s buff;
   buff.size = WS_INITIAL_BUFFER_SIZE;
-  buff.data = malloc(buff.size);
+  buff.data = fio_malloc(buff.size);
   return buff;
 }
 
 struct buffer_s resize_ws_buffer(ws_s *owner, struct buffer_s buff) {
   buff.size = round_up_buffer_size(buff.size);
-  void *tmp = realloc(buff.data, buff.size);
+  void *tmp = fio_realloc(buff.data, buff.size);
   if (!tmp) {
     free_ws_buffer(owner, buff);
-    buff.data = NULL;
     buff.size = 0;
   }
   buff.data = tmp;
@@ -87,11 +104,9 @@ struct buffer_s resize_ws_buffer(ws_s *owner, struct buffer_s buff) {
 }
 void free_ws_buffer(ws_s *owner, struct buffer_s buff) {
   (void)(owner);
-  free(buff.data);
+  fio_free(buff.data);
 }
 
-#undef round_up_buffer_size
-
 /*******************************************************************************
 Create/Destroy the websocket object (prototypes)
 */
@@ -109,6 +124,8 @@ struct ws_s {
   intptr_t fd;
   /** callbacks */
   void (*on_message)(ws_s *ws, fio_str_info_s msg, uint8_t is_text);
+  void (*on_fragment)(ws_s *ws, fio_str_info_s data, uint8_t is_text,
+                      uint8_t first, uint8_t last);
   void (*on_shutdown)(ws_s *ws);
   void (*on_ready)(ws_s *ws);
   void (*on_open)(ws_s *ws);
@@ -126,12 +143,570 @@ struct ws_s {
   size_t length;
   /** message buffer. */
   FIOBJ msg;
+  /** the unread payload of the frame being streamed (see `on_fragment`). */
+  uint64_t stream_left;
+  /** the streamed frame's unmasked length (selects the mask's next byte). */
+  uint64_t stream_pos;
+  /** the streamed frame's mask. */
+  uint8_t stream_mask[4];
+  /** set if the streamed frame is a message's first frame. */
+  uint8_t stream_first;
+  /** set if the streamed frame is a message's last frame. */
+  uint8_t stream_fin;
+  /** set while a fragmented message is received (until its last frame). */
+  uint8_t is_fragmented;
   /** latest text state. */
   uint8_t is_text;
   /** websocket connection type. */
   uint8_t is_client;
+  /** set while receiving a compressed message. */
+  uint8_t is_deflated;
+  /** set when the compression context must be reset before it's used. */
+  uint8_t deflate_reset;
+  /** the negotiated permessage-deflate state. */
+  websocket_deflate_s pmd;
+  /** guards the compression context (message order must match it). */
+  fio_lock_i deflate_lock;
+#if HAVE_ZLIB
+  /** compression context (only when kept between messages). */
+  z_stream *deflate;
+  /** decompression context. */
+  z_stream *inflate;
+#endif
 };
 
+/* *****************************************************************************
+Per-Message Deflate (RFC 7692) - negotiation
+***************************************************************************** */
+
+#if HAVE_ZLIB
+
+/** Extension parameters collected from a permessage-deflate offer/response. */
+typedef struct {
+  uint8_t server_no_context_takeover;
+  uint8_t client_no_context_takeover;
+  /** 0 == missing */
+  uint8_t server_max_window_bits;
+  /** 0 == missing, 1 == present without a value */
+  uint8_t client_max_window_bits;
+} ws_pmd_params_s;
+
+static inline const char *ws_pmd_skip_ws(const char *pos, const char *end) {
+  while (pos < end && (*pos == ' ' || *pos == '\t'))
+    ++pos;
+  return pos;
+}
+
+static inline int ws_pmd_is_delimiter(char c) {
+  return c == ';' || c == ',' || c == '=' || c == ' ' || c == '\t';
+}
+
+/** Adds a parameter to the collection. Returns 0 for invalid parameters. */
+static int ws_pmd_param(ws_pmd_params_s *p, const char *key, size_t key_len,
+                        const char *val, size_t val_len) {
+  uint8_t bits = 0;
+  if (val) {
+    if (!val_len || val_len > 2 || val[0] < '1' || val[0] > '9')
+      return 0;
+    for (size_t i = 0; i < val_len; ++i) {
+      if (val[i] < '0' || val[i] > '9')
+        return 0;
+      bits = (bits * 10) + (val[i] - '0');
+    }
+    if (bits < 8 || bits > 15)
+      return 0;
+  }
+  if (key_len == 26 && !strncasecmp(key, "server_no_context_takeover", 26)) {
+    if (val || p->server_no_context_takeover)
+      return 0;
+    p->server_no_context_takeover = 1;
+    return 1;
+  }
+  if (key_len == 26 && !strncasecmp(key, "client_no_context_takeover", 26)) {
+    if (val || p->client_no_context_takeover)
+      return 0;
+    p->client_no_context_takeover = 1;
+    return 1;
+  }
+  if (key_len == 22 && !strncasecmp(key, "server_max_window_bits", 22)) {
+    if (!val || p->server_max_window_bits)
+      return 0;
+    p->server_max_window_bits = bits;
+    return 1;
+  }
+  if (key_len == 22 && !strncasecmp(key, "client_max_window_bits", 22)) {
+    if (p->client_max_window_bits)
+      return 0;
+    p->client_max_window_bits = (val ? bits : 1);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Parses the next extension in an extension list, advancing `*pos`.
+ *
+ * Returns 1 for a valid permessage-deflate extension, 0 for any other (or
+ * invalid) extension and -1 once the list was consumed.
+ */
+static int ws_pmd_parse_next(const char **pos_, const char *end,
+                             ws_pmd_params_s *p) {
+  const char *pos = ws_pmd_skip_ws(*pos_, end);
+  while (pos < end && *pos == ',')
+    pos = ws_pmd_skip_ws(pos + 1, end);
+  if (pos >= end)
+    return -1;
+  *p = (ws_pmd_params_s){.server_no_context_takeover = 0};
+  const char *name = pos;
+  while (pos < end && !ws_pmd_is_delimiter(*pos))
+    ++pos;
+  int valid =
+      ((pos - name) == 18 && !strncasecmp(name, "permessage-deflate", 18));
+  pos = ws_pmd_skip_ws(pos, end);
+  while (pos < end && *pos == ';') {
+    pos = ws_pmd_skip_ws(pos + 1, end);
+    const char *key = pos;
+    while (pos < end && !ws_pmd_is_delimiter(*pos))
+      ++pos;
+    const size_t key_len = pos - key;
+    const char *val = NULL;
+    size_t val_len = 0;
+    pos = ws_pmd_skip_ws(pos, end);
+    if (pos < end && *pos == '=') {
+      pos = ws_pmd_skip_ws(pos + 1, end);
+      const uint8_t quoted = (pos < end && *pos == '"');
+      pos += quoted;
+      val = pos;
+      while (pos < end && (quoted ? (*pos != '"') : !ws_pmd_is_delimiter(*pos)))
+        ++pos;
+      val_len = pos - val;
+      pos += (quoted && pos < end);
+      pos = ws_pmd_skip_ws(pos, end);
+    }
+    if (valid)
+      valid = ws_pmd_param(p, key, key_len, val, val_len);
+  }
+  /* anything else (up to the next extension) is junk */
+  while (pos < end && *pos != ',') {
+    valid = 0;
+    ++pos;
+  }
+  *pos_ = pos;
+  return valid;
+}
+
+/** Returns the window bits allowed by the settings (9-15). */
+static inline uint8_t websocket_deflate_bits(websocket_settings_s *args) {
+  if (!args->deflate_max_window_bits || args->deflate_max_window_bits > 15)
+    return 15;
+  if (args->deflate_max_window_bits < 9)
+    return 9; /* zlib doesn't support 8 bit (256 byte) windows for deflate */
+  return args->deflate_max_window_bits;
+}
+
+/** Accepts the first valid offer in a header value. */
+static FIOBJ websocket_deflate_accept_str(fio_str_info_s s,
+                                          websocket_settings_s *args,
+                                          websocket_deflate_s *pmd) {
+  const uint8_t bits = websocket_deflate_bits(args);
+  const char *pos = s.data;
+  const char *end = s.data + s.len;
+  ws_pmd_params_s p;
+  int r;
+  while ((r = ws_pmd_parse_next(&pos, end, &p)) >= 0) {
+    if (!r || (p.server_max_window_bits && p.server_max_window_bits < 9))
+      continue;
+    *pmd = (websocket_deflate_s){
+        .enabled = 1,
+        .out_bits = bits,
+        .in_bits = 15,
+        .out_reset = (p.server_no_context_takeover ||
+                      args->deflate_no_context_takeover),
+        .in_reset = (p.client_no_context_takeover ||
+                     args->deflate_no_context_takeover),
+    };
+    if (p.server_max_window_bits && p.server_max_window_bits < bits)
+      pmd->out_bits = p.server_max_window_bits;
+    if (p.client_max_window_bits) {
+      pmd->in_bits = (p.client_max_window_bits > 1) ? p.client_max_window_bits
+                                                     : 15;
+      if (pmd->in_bits > bits)
+        pmd->in_bits = bits;
+    }
+    FIOBJ ret = fiobj_str_buf(128);
+    fiobj_str_write(ret, "permessage-deflate", 18);
+    if (pmd->out_reset)
+      fiobj_str_write(ret, "; server_no_context_takeover", 28);
+    if (pmd->in_reset)
+      fiobj_str_write(ret, "; client_no_context_takeover", 28);
+    if (p.server_max_window_bits || pmd->out_bits < 15)
+      fiobj_str_printf(ret, "; server_max_window_bits=%u",
+                       (unsigned int)pmd->out_bits);
+    if (p.client_max_window_bits && pmd->in_bits < 15)
+      fiobj_str_printf(ret, "; client_max_window_bits=%u",
+                       (unsigned int)pmd->in_bits);
+    if (pmd->in_bits < 9)
+      pmd->in_bits = 9; /* a larger window is always safe for inflate */
+    return ret;
+  }
+  return FIOBJ_INVALID;
+}
+
+/**
+ * used internally: returns the accepted `Sec-WebSocket-Extensions` value for
+ * the client's `offers` (or FIOBJ_INVALID) and sets the negotiated state.
+ */
+FIOBJ websocket_deflate_accept(FIOBJ offers, websocket_settings_s *args,
+                               websocket_deflate_s *pmd) {
+  *pmd = (websocket_deflate_s){.enabled = 0};
+  if (!args->deflate || !offers)
+    return FIOBJ_INVALID;
+  if (!FIOBJ_TYPE_IS(offers, FIOBJ_T_ARRAY))
+    return websocket_deflate_accept_str(fiobj_obj2cstr(offers), args, pmd);
+  const size_t count = fiobj_ary_count(offers);
+  for (size_t i = 0; i < count; ++i) {
+    FIOBJ ret = websocket_deflate_accept_str(
+        fiobj_obj2cstr(fiobj_ary_index(offers, i)), args, pmd);
+    if (ret)
+      return ret;
+  }
+  return FIOBJ_INVALID;
+}
+
+/**
+ * used internally: returns the `Sec-WebSocket-Extensions` value offered by a
+ * client (or FIOBJ_INVALID).
+ */
+FIOBJ websocket_deflate_offer(websocket_settings_s *args) {
+  if (!args->deflate)
+    return FIOBJ_INVALID;
+  const uint8_t bits = websocket_deflate_bits(args);
+  FIOBJ ret = fiobj_str_buf(128);
+  fiobj_str_write(ret, "permessage-deflate", 18);
+  if (args->deflate_no_context_takeover)
+    fiobj_str_write(
+        ret, "; server_no_context_takeover; client_no_context_takeover", 56);
+  if (bits < 15)
+    fiobj_str_printf(ret, "; server_max_window_bits=%u",
+                     (unsigned int)bits);
+  fiobj_str_write(ret, "; client_max_window_bits", 24);
+  if (bits < 15)
+    fiobj_str_printf(ret, "=%u", (unsigned int)bits);
+  return ret;
+}
+
+/**
+ * used internally: validates the server's `Sec-WebSocket-Extensions` response
+ * and sets the negotiated state. Returns -1 if the connection should fail.
+ */
+int websocket_deflate_confirm(FIOBJ response, websocket_settings_s *args,
+                              websocket_deflate_s *pmd) {
+  *pmd = (websocket_deflate_s){.enabled = 0};
+  if (!response)
+    return 0;
+  if (!args->deflate || FIOBJ_TYPE_IS(response, FIOBJ_T_ARRAY))
+    return -1;
+  const uint8_t bits = websocket_deflate_bits(args);
+  fio_str_info_s s = fiobj_obj2cstr(response);
+  const char *pos = s.data;
+  const char *end = s.data + s.len;
+  ws_pmd_params_s p;
+  if (ws_pmd_parse_next(&pos, end, &p) != 1 ||
+      ws_pmd_parse_next(&pos, end, &(ws_pmd_params_s){0}) != -1)
+    return -1;
+  *pmd = (websocket_deflate_s){
+      .enabled = 1,
+      .out_bits = bits,
+      .in_bits = 15,
+      .out_reset = (p.client_no_context_takeover ||
+                    args->deflate_no_context_takeover),
+      .in_reset = p.server_no_context_takeover,
+  };
+  if (p.client_max_window_bits > 1 && p.client_max_window_bits < bits)
+    pmd->out_bits = p.client_max_window_bits;
+  if (pmd->out_bits < 9)
+    pmd->out_bits = 0; /* zlib can't compress using 256 byte windows */
+  if (p.server_max_window_bits)
+    pmd->in_bits =
+        (p.server_max_window_bits < 9) ? 9 : p.server_max_window_bits;
+  return 0;
+}
+
+/* *****************************************************************************
+Per-Message Deflate (RFC 7692) - compression
+***************************************************************************** */
+
+static z_stream *websocket_deflate_new(uint8_t bits) {
+  z_stream *z = malloc(sizeof(*z));
+  FIO_ASSERT_ALLOC(z);
+  *z = (z_stream){.zalloc = Z_NULL};
+  /* negative window bits == raw deflate, memory level scales with the window */
+  if (deflateInit2(z, WEBSOCKET_DEFLATE_LEVEL, Z_DEFLATED, 0 - (int)bits,
+                   bits - 7, Z_DEFAULT_STRATEGY) != Z_OK) {
+    free(z);
+    return NULL;
+  }
+  return z;
+}
+
+static void websocket_deflate_free(z_stream *z) {
+  if (!z)
+    return;
+  deflateEnd(z);
+  free(z);
+}
+
+static z_stream *websocket_inflate_new(uint8_t bits) {
+  z_stream *z = malloc(sizeof(*z));
+  FIO_ASSERT_ALLOC(z);
+  *z = (z_stream){.zalloc = Z_NULL};
+  if (inflateInit2(z, 0 - (int)bits) != Z_OK) {
+    free(z);
+    return NULL;
+  }
+  return z;
+}
+
+static void websocket_inflate_free(z_stream *z) {
+  if (!z)
+    return;
+  inflateEnd(z);
+  free(z);
+}
+
+/*
+ * Compressors shared by all the messages compressed without a context (reset
+ * after each message), indexed by window bits. Connections without context
+ * takeover and broadcasts use these, so they hold no compression memory.
+ */
+static struct {
+  z_stream *z;
+  fio_lock_i lock;
+} websocket_deflate_shared[16];
+
+static void websocket_deflate_shared_clear(void *slot_) {
+  uintptr_t bits = (uintptr_t)slot_;
+  websocket_deflate_free(websocket_deflate_shared[bits].z);
+  websocket_deflate_shared[bits].z = NULL;
+}
+
+/** Locks and returns the shared compressor for `bits` (NULL on error). */
+static z_stream *websocket_deflate_shared_lock(uint8_t bits) {
+  fio_lock(&websocket_deflate_shared[bits].lock);
+  if (!websocket_deflate_shared[bits].z) {
+    websocket_deflate_shared[bits].z = websocket_deflate_new(bits);
+    if (websocket_deflate_shared[bits].z)
+      fio_state_callback_add(FIO_CALL_AT_EXIT, websocket_deflate_shared_clear,
+                             (void *)(uintptr_t)bits);
+  }
+  if (!websocket_deflate_shared[bits].z)
+    fio_unlock(&websocket_deflate_shared[bits].lock);
+  return websocket_deflate_shared[bits].z;
+}
+
+/** Resets and unlocks the shared compressor for `bits`. */
+static void websocket_deflate_shared_unlock(uint8_t bits) {
+  deflateReset(websocket_deflate_shared[bits].z);
+  fio_unlock(&websocket_deflate_shared[bits].lock);
+}
+
+/**
+ * Compresses `msg` into `dest` (at least `msg.len + 4` bytes long), removing
+ * the trailing empty block (`00 00 ff ff`).
+ *
+ * Returns the compressed length, or 0 if compression failed or the result
+ * isn't shorter than the message (the stream must be reset).
+ */
+static size_t websocket_deflate_data(z_stream *z, char *dest,
+                                     fio_str_info_s msg) {
+  z->next_in = (Bytef *)msg.data;
+  z->avail_in = msg.len;
+  z->next_out = (Bytef *)dest;
+  z->avail_out = msg.len + 4;
+  if (deflate(z, Z_SYNC_FLUSH) != Z_OK || z->avail_in || !z->avail_out)
+    return 0;
+  size_t len = (msg.len + 4) - z->avail_out;
+  if (len < 4 || memcmp(dest + len - 4, "\x00\x00\xff\xff", 4))
+    return 0;
+  len -= 4;
+  if (len >= msg.len)
+    return 0;
+  return len;
+}
+
+/**
+ * Decompresses data, appending it to the connection's message buffer.
+ *
+ * Returns -1 on error or if the message exceeds the message size limit.
+ */
+static int websocket_inflate_data(ws_s *ws, void *data, size_t len) {
+  z_stream *z = ws->inflate;
+  z->next_in = (Bytef *)data;
+  z->avail_in = len;
+  do {
+    fio_str_info_s i = fiobj_obj2cstr(ws->msg);
+    size_t capa = fiobj_str_capa(ws->msg);
+    if (capa - i.len < 1024) {
+      capa = fiobj_str_capa_assert(ws->msg, (capa << 1) + 4096);
+      i = fiobj_obj2cstr(ws->msg);
+    }
+    /* resizing a String to its full capacity reallocates (data is lost) */
+    --capa;
+    z->next_out = (Bytef *)i.data + i.len;
+    z->avail_out = capa - i.len;
+    int r = inflate(z, Z_SYNC_FLUSH);
+    fiobj_str_resize(ws->msg, capa - z->avail_out);
+    if (capa - z->avail_out > ws->max_msg_size)
+      return -1;
+    if (r == Z_STREAM_END) {
+      /* the sender may (but shouldn't) end the stream (BFINAL) */
+      inflateReset(z);
+    } else if (r == Z_BUF_ERROR) {
+      if (z->avail_out)
+        break;
+    } else if (r != Z_OK) {
+      return -1;
+    }
+  } while (z->avail_in || !z->avail_out);
+  return 0;
+}
+
+/** Handles a compressed message (or message fragment). */
+static void websocket_on_unwrapped_deflated(ws_s *ws, void *msg, uint64_t len,
+                                            char first, char last) {
+  if (first) {
+    if (ws->msg == FIOBJ_INVALID)
+      ws->msg = fiobj_str_buf(len << 2);
+    fiobj_str_resize(ws->msg, 0);
+    if (!ws->inflate)
+      ws->inflate = websocket_inflate_new(ws->pmd.in_bits);
+  }
+  if (!ws->inflate || websocket_inflate_data(ws, msg, len))
+    goto error;
+  if (last) {
+    if (websocket_inflate_data(ws, (void *)"\x00\x00\xff\xff", 4))
+      goto error;
+    if (ws->pmd.in_reset) {
+      websocket_inflate_free(ws->inflate);
+      ws->inflate = NULL;
+    }
+  }
+  if (ws->on_fragment) {
+    /* each frame's data is delivered once it was decompressed */
+    ws->on_fragment(ws, fiobj_obj2cstr(ws->msg), ws->is_text, (uint8_t)first,
+                    (uint8_t)last);
+    fiobj_str_resize(ws->msg, 0);
+    return;
+  }
+  if (last)
+    ws->on_message(ws, fiobj_obj2cstr(ws->msg), ws->is_text);
+  return;
+error:
+  FIO_LOG_DEBUG("(websocket) permessage-deflate error / message too big.");
+  websocket_close(ws);
+}
+
+/* later */
+static void websocket_write_impl(intptr_t fd, void *data, size_t len, char text,
+                                 char first, char last, char client,
+                                 unsigned char rsv);
+
+/**
+ * Compresses and writes a message.
+ *
+ * Returns -1 if the message should be sent uncompressed.
+ */
+static int websocket_write_deflated(ws_s *ws, fio_str_info_s msg,
+                                    uint8_t is_text) {
+  const uint8_t bits = ws->pmd.out_bits;
+  char *buf = fio_malloc(msg.len + 4);
+  FIO_ASSERT_ALLOC(buf);
+  size_t len = 0;
+  if (ws->pmd.out_reset) {
+    z_stream *z = websocket_deflate_shared_lock(bits);
+    if (!z)
+      goto finish;
+    len = websocket_deflate_data(z, buf, msg);
+    websocket_deflate_shared_unlock(bits);
+    if (len)
+      websocket_write_impl(ws->fd, buf, len, is_text, 1, 1, ws->is_client, 4);
+    goto finish;
+  }
+  fio_lock(&ws->deflate_lock);
+  if (!ws->deflate)
+    ws->deflate = websocket_deflate_new(bits);
+  else if (ws->deflate_reset)
+    deflateReset(ws->deflate);
+  ws->deflate_reset = 0;
+  if (ws->deflate) {
+    len = websocket_deflate_data(ws->deflate, buf, msg);
+    if (len)
+      websocket_write_impl(ws->fd, buf, len, is_text, 1, 1, ws->is_client, 4);
+    else
+      deflateReset(ws->deflate);
+  }
+  fio_unlock(&ws->deflate_lock);
+finish:
+  fio_free(buf);
+  return (len ? 0 : -1);
+}
+
+/**
+ * Writes a broadcast payload, compressed once for all the connections.
+ *
+ * The payload was compressed without a context, so the connection's own
+ * compression context (if any) must be reset before it's used again.
+ */
+static void websocket_write_shared_deflated(ws_s *ws, FIOBJ payload,
+                                            uint8_t is_text) {
+  fio_str_info_s d = fiobj_obj2cstr(payload);
+  uint8_t *buf = fio_malloc(d.len + 10);
+  FIO_ASSERT_ALLOC(buf);
+  size_t head = 2;
+  buf[0] = 0x80 /* fin */ | 0x40 /* rsv1 */ | (is_text ? 1 : 2);
+  if (d.len < 126) {
+    buf[1] = d.len;
+  } else if (d.len < (1UL << 16)) {
+    buf[1] = 126;
+    websocket_u2str16(buf + 2, d.len);
+    head = 4;
+  } else {
+    buf[1] = 127;
+    websocket_u2str64(buf + 2, d.len);
+    head = 10;
+  }
+  memcpy(buf + head, d.data, d.len);
+  fio_lock(&ws->deflate_lock);
+  ws->deflate_reset = 1;
+  fio_write2(ws->fd, .data.buffer = buf, .length = head + d.len,
+             .after.dealloc = fio_free);
+  fio_unlock(&ws->deflate_lock);
+}
+
+#else /* HAVE_ZLIB */
+
+FIOBJ websocket_deflate_accept(FIOBJ offers, websocket_settings_s *args,
+                               websocket_deflate_s *pmd) {
+  *pmd = (websocket_deflate_s){.enabled = 0};
+  return FIOBJ_INVALID;
+  (void)offers;
+  (void)args;
+}
+
+FIOBJ websocket_deflate_offer(websocket_settings_s *args) {
+  return FIOBJ_INVALID;
+  (void)args;
+}
+
+int websocket_deflate_confirm(FIOBJ response, websocket_settings_s *args,
+                              websocket_deflate_s *pmd) {
+  *pmd = (websocket_deflate_s){.enabled = 0};
+  return (response ? -1 : 0);
+  (void)args;
+}
+
+#endif /* HAVE_ZLIB */
+
 /* *****************************************************************************
 Create/Destroy the websocket subscription objects
 ***************************************************************************** */
@@ -152,6 +727,35 @@ static void websocket_on_unwrapped(void *ws_p, void *msg, uint64_t len,
                                    char first, char last, char text,
                                    unsigned char rsv) {
   ws_s *ws = ws_p;
+  /* continuation frames (only) continue a message */
+  if (first == ws->is_fragmented) {
+    websocket_on_protocol_error(ws);
+    return;
+  }
+  ws->is_fragmented = !last;
+  if (first) {
+    /* RSV1 marks a compressed message, other RSV bits are never negotiated */
+    if ((rsv & 3) || ((rsv & 4) && !ws->pmd.enabled)) {
+      websocket_on_protocol_error(ws);
+      return;
+    }
+    ws->is_deflated = ((rsv >> 2) & 1);
+  }
+#if HAVE_ZLIB
+  if (ws->is_deflated) {
+    if (first)
+      ws->is_text = (uint8_t)text;
+    websocket_on_unwrapped_deflated(ws, msg, len, first, last);
+    return;
+  }
+#endif
+  if (ws->on_fragment) {
+    if (first)
+      ws->is_text = (uint8_t)text;
+    ws->on_fragment(ws, (fio_str_info_s){.data = msg, .len = len}, ws->is_text,
+                    (uint8_t)first, (uint8_t)last);
+    return;
+  }
   if (last && first) {
     ws->on_message(ws, (fio_str_info_s){.data = msg, .len = len},
                    (uint8_t)text);
@@ -199,6 +803,14 @@ static void websocket_on_protocol_close(void *ws_p) {
 }
 static void websocket_on_protocol_error(void *ws_p) {
   ws_s *ws = ws_p;
+  /* close with status code 1002 (protocol error) */
+  if (ws->is_client) {
+    fio_write2(ws->fd, .data.buffer = "\x88\x82\x00\x00\x00\x00\x03\xea",
+               .length = 8, .after.dealloc = FIO_DEALLOC_NOOP);
+  } else {
+    fio_write2(ws->fd, .data.buffer = "\x88\x02\x03\xea", .length = 4,
+               .after.dealloc = FIO_DEALLOC_NOOP);
+  }
   fio_close(ws->fd);
 }
 
@@ -244,13 +856,169 @@ static uint8_t on_shutdown(intptr_t fd, fio_protocol_s *ws) {
   return 0;
 }
 
+/* releases (or shrinks) the socket buffer once the pending data was consumed */
+static inline void websocket_buffer_release(ws_s *ws) {
+  if (!ws->length) {
+    free_ws_buffer(ws, ws->buffer);
+    ws->buffer = (struct buffer_s){.data = NULL};
+    return;
+  }
+  if (ws->buffer.size > WS_INITIAL_BUFFER_SIZE) {
+    /* shrink back, unless the pending frame still requires the room */
+    struct websocket_packet_info_s info =
+        websocket_buffer_peek(ws->buffer.data, ws->length);
+    if (info.packet_length + info.head_length > WS_INITIAL_BUFFER_SIZE)
+      return;
+    struct buffer_s tmp = create_ws_buffer(ws);
+    if (!tmp.data)
+      return;
+    memcpy(tmp.data, ws->buffer.data, ws->length);
+    free_ws_buffer(ws, ws->buffer);
+    ws->buffer = tmp;
+  }
+}
+
+/* reads into the stack, storing any partial frame in a new socket buffer */
+static void on_data_idle(intptr_t sockfd, ws_s *ws) {
+  uint8_t tmp[WS_INITIAL_BUFFER_SIZE];
+  const ssize_t len = fio_read(sockfd, tmp, WS_INITIAL_BUFFER_SIZE);
+  if (len <= 0) {
+    return;
+  }
+  const size_t remain =
+      websocket_consume(tmp, len, ws, (~(ws->is_client) & 1));
+  if (remain) {
+    ws->buffer = create_ws_buffer(ws);
+    if (!ws->buffer.data) {
+      // no memory.
+      websocket_close(ws);
+      return;
+    }
+    memcpy(ws->buffer.data, tmp, remain);
+    ws->length = remain;
+  }
+  fio_force_event(sockfd, FIO_EVENT_ON_DATA);
+}
+
+/* delivers the buffered payload of the frame being streamed */
+static void websocket_stream_deliver(ws_s *ws) {
+  const size_t len =
+      (ws->length < ws->stream_left ? ws->length : (size_t)ws->stream_left);
+  if (!len)
+    return;
+  /* unmask, starting at the frame's current mask offset */
+  uint32_t mask;
+  for (size_t i = 0; i < 4; ++i)
+    ((uint8_t *)&mask)[i] = ws->stream_mask[(ws->stream_pos + i) & 3];
+  if (mask)
+    websocket_xmask(ws->buffer.data, len, mask);
+  ws->stream_pos += len;
+  ws->stream_left -= len;
+  const uint8_t first = ws->stream_first;
+  ws->stream_first = 0;
+  ws->on_fragment(ws, (fio_str_info_s){.data = ws->buffer.data, .len = len},
+                  ws->is_text, first, (ws->stream_fin && !ws->stream_left));
+  ws->length -= len;
+  if (ws->length)
+    memmove(ws->buffer.data, (uint8_t *)ws->buffer.data + len, ws->length);
+}
+
+/**
+ * Starts streaming a large data frame (the head must be buffered).
+ *
+ * Returns 0 if the frame should be handled by the parser (i.e., compressed
+ * frames and most protocol errors). Out of order frames close the connection.
+ */
+static int websocket_stream_start(ws_s *ws,
+                                  struct websocket_packet_info_s info) {
+  const uint8_t *head = ws->buffer.data;
+  const uint8_t opcode = head[0] & 15;
+  const uint8_t rsv = (head[0] >> 4) & 7;
+  if (opcode > 2 || rsv || (opcode == 0 && ws->is_deflated) ||
+      (!info.masked && !ws->is_client))
+    return 0;
+  if ((opcode != 0) == ws->is_fragmented) {
+    /* a continuation without a message, or a message within a message */
+    ws->length = 0;
+    websocket_on_protocol_error(ws);
+    return 1;
+  }
+  if (info.masked)
+    memcpy(ws->stream_mask, head + info.head_length - 4, 4);
+  else
+    memset(ws->stream_mask, 0, 4);
+  if (opcode) {
+    ws->is_text = (opcode == 1);
+    ws->is_deflated = 0;
+  }
+  ws->stream_first = (opcode != 0);
+  ws->stream_fin = (head[0] >> 7) & 1;
+  ws->is_fragmented = !ws->stream_fin;
+  ws->stream_left = info.packet_length;
+  ws->stream_pos = 0;
+  ws->length -= info.head_length;
+  memmove(ws->buffer.data, head + info.head_length, ws->length);
+  if (ws->buffer.size < WS_STREAM_BUFFER_SIZE) {
+    ws->buffer.size = WS_STREAM_BUFFER_SIZE;
+    ws->buffer = resize_ws_buffer(ws, ws->buffer);
+    if (!ws->buffer.data) {
+      // no memory.
+      ws->length = 0;
+      ws->stream_left = 0;
+      websocket_close(ws);
+      return 1;
+    }
+  }
+  websocket_stream_deliver(ws);
+  return 1;
+}
+
+/* parses the data that followed a streamed frame, once it was delivered */
+static void websocket_stream_finish(ws_s *ws) {
+  if (ws->stream_left)
+    return;
+  if (ws->length)
+    ws->length = websocket_consume(ws->buffer.data, ws->length, ws,
+                                   (~(ws->is_client) & 1));
+  websocket_buffer_release(ws);
+}
+
+/* reads the payload of the frame being streamed */
+static void on_data_stream(intptr_t sockfd, ws_s *ws) {
+  const ssize_t len = fio_read(sockfd, (uint8_t *)ws->buffer.data + ws->length,
+                               ws->buffer.size - ws->length);
+  if (len <= 0) {
+    return;
+  }
+  ws->length += len;
+  websocket_stream_deliver(ws);
+  websocket_stream_finish(ws);
+  fio_force_event(sockfd, FIO_EVENT_ON_DATA);
+}
+
 static void on_data(intptr_t sockfd, fio_protocol_s *ws_) {
   ws_s *const ws = (ws_s *)ws_;
   if (ws == NULL)
     return;
+  if (ws->stream_left) {
+    on_data_stream(sockfd, ws);
+    return;
+  }
+  if (!ws->length) {
+    on_data_idle(sockfd, ws);
+    return;
+  }
   struct websocket_packet_info_s info =
       websocket_buffer_peek(ws->buffer.data, ws->length);
   const uint64_t raw_length = info.packet_length + info.head_length;
+  /* stream large frames (the head must be complete) */
+  if (ws->on_fragment && ws->length >= info.head_length &&
+      (raw_length > WS_STREAM_BUFFER_SIZE || raw_length > ws->max_msg_size) &&
+      websocket_stream_start(ws, info)) {
+    websocket_stream_finish(ws);
+    fio_force_event(sockfd, FIO_EVENT_ON_DATA);
+    return;
+  }
   /* test expected data amount */
   if (ws->max_msg_size < raw_length) {
     /* too big */
@@ -275,6 +1043,7 @@ static void on_data(intptr_t sockfd, fio_protocol_s *ws_) {
   }
   ws->length = websocket_consume(ws->buffer.data, ws->length + len, ws,
                                  (~(ws->is_client) & 1));
+  websocket_buffer_release(ws);
 
   fio_force_event(sockfd, FIO_EVENT_ON_DATA);
 }
@@ -289,15 +1058,12 @@ static void on_data_first(intptr_t sockfd, fio_protocol_s *ws_) {
   if (ws->length) {
     ws->length = websocket_consume(ws->buffer.data, ws->length, ws,
                                    (~(ws->is_client) & 1));
+    websocket_buffer_release(ws);
   }
   fio_force_event(sockfd, FIO_EVENT_ON_DATA);
   fio_force_event(sockfd, FIO_EVENT_ON_READY);
 }
 
-/* later */
-static void websocket_write_impl(intptr_t fd, void *data, size_t len, char text,
-                                 char first, char last, char client);
-
 /*******************************************************************************
 Create/Destroy the websocket object
 */
@@ -312,6 +1078,7 @@ static ws_s *new_websocket(intptr_t uuid) {
       .protocol.on_ready = NULL /* filled in after `on_open` */,
       .protocol.on_shutdown = on_shutdown,
       .subscriptions = FIO_LS_INIT(ws->subscriptions),
+      .deflate_lock = FIO_LOCK_INIT,
       .is_client = 0,
       .fd = uuid,
   };
@@ -323,20 +1090,26 @@ static void destroy_ws(ws_s *ws) {
   if (ws->msg)
     fiobj_free(ws->msg);
   clear_subscriptions(ws);
+#if HAVE_ZLIB
+  websocket_deflate_free(ws->deflate);
+  websocket_inflate_free(ws->inflate);
+#endif
   free_ws_buffer(ws, ws->buffer);
   free(ws);
 }
 
 void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
-                      websocket_settings_s *args, void *data, size_t length) {
+                      websocket_settings_s *args, websocket_deflate_s *pmd,
+                      void *data, size_t length) {
   ws_s *ws = new_websocket(uuid);
   FIO_ASSERT_ALLOC(ws);
-  // we have an active websocket connection - prep the connection buffer
-  ws->buffer = create_ws_buffer(ws);
+  if (pmd)
+    ws->pmd = *pmd;
   // Setup ws callbacks
   ws->on_open = args->on_open;
   ws->on_close = args->on_close;
   ws->on_message = args->on_message;
+  ws->on_fragment = args->on_fragment;
   ws->on_ready = args->on_ready;
   ws->on_shutdown = args->on_shutdown;
   // setup any user data
@@ -354,15 +1127,14 @@ void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
   }
 
   if (data && length) {
-    if (length > ws->buffer.size) {
-      ws->buffer.size = length;
-      ws->buffer = resize_ws_buffer(ws, ws->buffer);
-      if (!ws->buffer.data) {
-        // no memory.
-        fio_attach(uuid, (fio_protocol_s *)ws);
-        websocket_close(ws);
-        return;
-      }
+    // we have pending data - prep the connection buffer
+    ws->buffer.size = length;
+    ws->buffer = resize_ws_buffer(ws, ws->buffer);
+    if (!ws->buffer.data) {
+      // no memory.
+      fio_attach(uuid, (fio_protocol_s *)ws);
+      websocket_close(ws);
+      return;
     }
     memcpy(ws->buffer.data, data, length);
     ws->length = length;
@@ -380,24 +1152,28 @@ Writing to the Websocket
   (FIO_MEMORY_BLOCK_ALLOC_LIMIT - 4096) // should be less then `unsigned short`
 
 static void websocket_write_impl(intptr_t fd, void *data, size_t len, char text,
-                                 char first, char last, char client) {
+                                 char first, char last, char client,
+                                 unsigned char rsv) {
   if (len <= WS_MAX_FRAME_SIZE) {
     void *buff = fio_malloc(len + 16);
+    /* RSV bits are only set for the first frame of a message */
+    rsv = (first ? rsv : 0);
     len = (client ? websocket_client_wrap(buff, data, len, (text ? 1 : 2),
-                                          first, last, 0)
+                                          first, last, rsv)
                   : websocket_server_wrap(buff, data, len, (text ? 1 : 2),
-                                          first, last, 0));
+                                          first, last, rsv));
     fio_write2(fd, .data.buffer = buff, .length = len,
                .after.dealloc = fio_free);
   } else {
     /* frame fragmentation is better for large data then large frames */
     while (len > WS_MAX_FRAME_SIZE) {
-      websocket_write_impl(fd, data, WS_MAX_FRAME_SIZE, text, first, 0, client);
+      websocket_write_impl(fd, data, WS_MAX_FRAME_SIZE, text, first, 0, client,
+                           rsv);
       data = ((uint8_t *)data) + WS_MAX_FRAME_SIZE;
       first = 0;
       len -= WS_MAX_FRAME_SIZE;
     }
-    websocket_write_impl(fd, data, len, text, first, 1, client);
+    websocket_write_impl(fd, data, len, text, first, 1, client, rsv);
   }
   return;
 }
@@ -459,6 +1235,35 @@ static fio_msg_metadata_s websocket_optimize_binary(fio_str_info_s ch,
   (void)is_json;
 }
 
+#if HAVE_ZLIB
+static fio_msg_metadata_s websocket_optimize_deflate(fio_str_info_s ch,
+                                                     fio_str_info_s msg,
+                                                     uint8_t is_json) {
+  fio_msg_metadata_s ret = {
+      .type_id = WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE,
+      .on_finish = websocket_optimize_free,
+  };
+  if (msg.len < WEBSOCKET_DEFLATE_MIN_LENGTH)
+    return ret;
+  z_stream *z = websocket_deflate_shared_lock(15);
+  if (!z)
+    return ret;
+  FIOBJ out = fiobj_str_buf(msg.len + 4);
+  fiobj_str_capa_assert(out, msg.len + 4);
+  size_t len = websocket_deflate_data(z, fiobj_obj2cstr(out).data, msg);
+  websocket_deflate_shared_unlock(15);
+  if (!len) {
+    fiobj_free(out);
+    return ret;
+  }
+  fiobj_str_resize(out, len);
+  ret.metadata = (void *)out;
+  return ret;
+  (void)ch;
+  (void)is_json;
+}
+#endif
+
 /**
  * Enables (or disables) broadcast optimizations.
  *
@@ -480,6 +1285,8 @@ static fio_msg_metadata_s websocket_optimize_binary(fio_str_info_s ch,
  *                               best attempt to detect Text vs. Binary data.
  * * WEBSOCKET_OPTIMIZE_PUBSUB_TEXT - optimize direct pub/sub text messages.
  * * WEBSOCKET_OPTIMIZE_PUBSUB_BINARY - optimize direct pub/sub binary messages.
+ * * WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE - compress direct pub/sub messages once
+ *                                       for all permessage-deflate clients.
  *
  * Note: to disable an optimization it should be disabled the same amount of
  * times it was enabled - multiple optimization enablements for the same type
@@ -489,6 +1296,9 @@ void websocket_optimize4broadcasts(intptr_t type, int enable) {
   static intptr_t generic = 0;
   static intptr_t text = 0;
   static intptr_t binary = 0;
+#if HAVE_ZLIB
+  static intptr_t deflated = 0;
+#endif
   fio_msg_metadata_s (*callback)(fio_str_info_s, fio_str_info_s, uint8_t);
   intptr_t *counter;
   switch ((0 - type)) {
@@ -504,6 +1314,12 @@ void websocket_optimize4broadcasts(intptr_t type, int enable) {
     counter = &binary;
     callback = websocket_optimize_binary;
     break;
+#if HAVE_ZLIB
+  case (0 - WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE):
+    counter = &deflated;
+    callback = websocket_optimize_deflate;
+    break;
+#endif
   default:
     return;
   }
@@ -527,8 +1343,17 @@ typedef struct {
                      void *udata);
   void (*on_unsubscribe)(void *udata);
   void *udata;
+  /** set if the subscription enabled WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE. */
+  uint8_t deflate;
 } websocket_sub_data_s;
 
+/** Tests for UTF-8 data to detect text messages (when the type is unknown). */
+static inline uint8_t websocket_msg_is_text(fio_msg_s *msg) {
+  fio_str_s tmp =
+      FIO_STR_INIT_STATIC2(msg->msg.data, msg->msg.len); // don't free
+  return (tmp.len >= (2 << 14) ? 0 : fio_str_utf8_valid(&tmp));
+}
+
 static inline void websocket_on_pubsub_message_direct_internal(fio_msg_s *msg,
                                                                uint8_t txt) {
   fio_protocol_s *pr =
@@ -542,6 +1367,23 @@ static inline void websocket_on_pubsub_message_direct_internal(fio_msg_s *msg,
   FIOBJ message = FIOBJ_INVALID;
   FIOBJ pre_wrapped = FIOBJ_INVALID;
   if (!((ws_s *)pr)->is_client) {
+#if HAVE_ZLIB
+    if (((ws_s *)pr)->pmd.out_bits == 15) {
+      /* compressed once, shared by all permessage-deflate clients */
+      FIOBJ deflated =
+          (FIOBJ)fio_message_metadata(msg, WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE);
+      if (deflated) {
+        websocket_write_shared_deflated(
+            (ws_s *)pr, deflated,
+            (txt == 2 ? websocket_msg_is_text(msg) : txt));
+        goto finish;
+      }
+    } else if (((ws_s *)pr)->pmd.out_bits &&
+               msg->msg.len >= WEBSOCKET_DEFLATE_MIN_LENGTH) {
+      /* smaller windows are compressed for each connection */
+      goto write;
+    }
+#endif
     /* pre-wrapping is only for client data */
     switch (txt) {
     case 0:
@@ -565,11 +1407,12 @@ static inline void websocket_on_pubsub_message_direct_internal(fio_msg_s *msg,
       goto finish;
     }
   }
+#if HAVE_ZLIB
+write:
+#endif
   if (txt == 2) {
     /* unknown text state */
-    fio_str_s tmp =
-        FIO_STR_INIT_STATIC2(msg->msg.data, msg->msg.len); // don't free
-    txt = (tmp.len >= (2 << 14) ? 0 : fio_str_utf8_valid(&tmp));
+    txt = websocket_msg_is_text(msg);
   }
   websocket_write((ws_s *)pr, msg->msg, txt & 1);
   fiobj_free(message);
@@ -611,6 +1454,8 @@ static void websocket_on_unsubscribe(void *u1, void *u2) {
     d->on_unsubscribe(d->udata);
   }
 
+  if (d->deflate)
+    websocket_optimize4broadcasts(WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE, 0);
   if ((intptr_t)d->on_message == (intptr_t)WEBSOCKET_OPTIMIZE_PUBSUB) {
     websocket_optimize4broadcasts(WEBSOCKET_OPTIMIZE_PUBSUB, 0);
   } else if ((intptr_t)d->on_message ==
@@ -654,6 +1499,10 @@ uintptr_t websocket_subscribe(struct websocket_subscribe_s args) {
     websocket_optimize4broadcasts(br_type, 1);
     d->on_message =
         (void (*)(ws_s *, fio_str_info_s, fio_str_info_s, void *))br_type;
+    if (!args.ws->is_client && args.ws->pmd.out_bits == 15) {
+      websocket_optimize4broadcasts(WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE, 1);
+      d->deflate = 1;
+    }
   }
   subscription_s *sub =
       fio_subscribe(.channel = args.channel, .match = args.match,
@@ -716,8 +1565,13 @@ uint8_t websocket_is_client(ws_s *ws) { return ws->is_client; }
 /** Writes data to the websocket. Returns -1 on failure (0 on success). */
 int websocket_write(ws_s *ws, fio_str_info_s msg, uint8_t is_text) {
   if (fio_is_valid(ws->fd)) {
+#if HAVE_ZLIB
+    if (ws->pmd.out_bits && msg.len >= WEBSOCKET_DEFLATE_MIN_LENGTH &&
+        !websocket_write_deflated(ws, msg, is_text))
+      return 0;
+#endif
     websocket_write_impl(ws->fd, msg.data, msg.len, is_text, 1, 1,
-                         ws->is_client);
+                         ws->is_client, 0);
     return 0;
   }
   return -1;
@@ -729,3 +1583,206 @@ void websocket_close(ws_s *ws) {
   fio_close(ws->fd);
   return;
 }
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+#if DEBUG
+#include <sys/socket.h>
+
+static char websocket_test_msg[64];
+
+static void websocket_test_on_message(ws_s *ws, fio_str_info_s msg,
+                                      uint8_t is_text) {
+  FIO_ASSERT(msg.len < sizeof(websocket_test_msg),
+             "unexpected websocket message length (%zu)\n", msg.len);
+  memcpy(websocket_test_msg, msg.data, msg.len);
+  websocket_test_msg[msg.len] = 0;
+  (void)ws;
+  (void)is_text;
+}
+
+static FIOBJ websocket_test_messages; /* an Array of the received messages */
+static size_t websocket_test_fragments;
+static uint8_t websocket_test_in_message;
+
+static void websocket_test_on_fragment(ws_s *ws, fio_str_info_s data,
+                                       uint8_t is_text, uint8_t first,
+                                       uint8_t last) {
+  FIO_ASSERT(first == !websocket_test_in_message,
+             "wrong `first` flag for fragment %zu\n", websocket_test_fragments);
+  if (first)
+    fiobj_ary_push(websocket_test_messages, fiobj_str_buf(data.len));
+  fiobj_str_write(fiobj_ary_index(websocket_test_messages, -1), data.data,
+                  data.len);
+  websocket_test_in_message = !last;
+  ++websocket_test_fragments;
+  (void)ws;
+  (void)is_text;
+}
+
+/* attaches a server websocket to a new socket pair (`fd` is the client) */
+static ws_s *websocket_test_conn(websocket_settings_s *args, int *fd) {
+  int fds[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds), "socketpair failed\n");
+  FIO_ASSERT(fio_set_non_block(fds[0]) != -1, "non-blocking mode failed\n");
+  intptr_t uuid = fio_fd2uuid(fds[0]);
+  websocket_attach(uuid, NULL, args, NULL, NULL, 0);
+  ws_s *ws = (ws_s *)fio_protocol_try_lock(uuid, FIO_PR_LOCK_TASK);
+  FIO_ASSERT(ws, "the websocket protocol is missing\n");
+  /* the first event calls `on_open` and sets the `on_data` callback */
+  ws->protocol.on_data(uuid, &ws->protocol);
+  fio_protocol_unlock(&ws->protocol, FIO_PR_LOCK_TASK);
+  *fd = fds[1];
+  return ws;
+}
+
+/* writes the client's data and lets the websocket read all of it */
+static void websocket_test_feed(ws_s *ws, int fd, const void *data,
+                                size_t len) {
+  FIO_ASSERT(write(fd, data, len) == (ssize_t)len, "test write failed\n");
+  char tmp;
+  do {
+    fio_protocol_s *pr = fio_protocol_try_lock(ws->fd, FIO_PR_LOCK_TASK);
+    FIO_ASSERT(pr == &ws->protocol, "the websocket protocol is missing\n");
+    pr->on_data(ws->fd, pr);
+    fio_protocol_unlock(pr, FIO_PR_LOCK_TASK);
+  } while (!fio_is_closed(ws->fd) &&
+           recv(fio_uuid2fd(ws->fd), &tmp, 1, MSG_PEEK | MSG_DONTWAIT) > 0);
+}
+
+/* flushes the connection, reading up to `capa` bytes into `buf` */
+static size_t websocket_test_drain(intptr_t uuid, int fd, char *buf,
+                                   size_t capa) {
+  char tmp[4096];
+  size_t total = 0;
+  ssize_t flushed;
+  do {
+    ssize_t r;
+    flushed = fio_flush(uuid);
+    while ((r = recv(fd, tmp, sizeof(tmp), MSG_DONTWAIT)) > 0) {
+      if (total < capa)
+        memcpy(buf + total, tmp,
+               ((size_t)r < capa - total) ? (size_t)r : capa - total);
+      total += r;
+    }
+  } while (flushed > 0);
+  return total;
+}
+
+void websocket_tests(void) {
+  fprintf(stderr, "=== Testing websocket read buffers (released while idle)\n");
+  {
+    websocket_settings_s args = {.on_message = websocket_test_on_message};
+    char frame[64];
+    const size_t len = websocket_client_wrap(frame, "split frame", 11, 1, 1, 1,
+                                             0);
+    const size_t parts[] = {3, 6, len - 9};
+    int fd;
+    ws_s *ws = websocket_test_conn(&args, &fd);
+    FIO_ASSERT(!ws->buffer.data,
+               "new connections shouldn't hold a read buffer\n");
+    websocket_test_feed(ws, fd, frame, len);
+    FIO_ASSERT(!strcmp(websocket_test_msg, "split frame") && !ws->buffer.data,
+               "complete frames should be read without a buffer\n");
+    for (size_t round = 0; round < 2; ++round) {
+      websocket_test_msg[0] = 0;
+      size_t pos = 0;
+      for (size_t i = 0; i < 2; ++i) {
+        websocket_test_feed(ws, fd, frame + pos, parts[i]);
+        pos += parts[i];
+        FIO_ASSERT(ws->buffer.data && ws->length == pos &&
+                       !websocket_test_msg[0],
+                   "a partial frame should keep the read buffer\n");
+      }
+      websocket_test_feed(ws, fd, frame + pos, parts[2]);
+      FIO_ASSERT(!strcmp(websocket_test_msg, "split frame"),
+                 "data lost between reads (%s)\n", websocket_test_msg);
+      FIO_ASSERT(!ws->buffer.data,
+                 "idle connections should release the buffer\n");
+      /* an `on_data` event without data (i.e., a forced event) */
+      fio_defer_perform();
+      websocket_test_feed(ws, fd, NULL, 0);
+      FIO_ASSERT(!ws->buffer.data,
+                 "the buffer should stay released while idle\n");
+    }
+    fio_force_close(ws->fd);
+    fio_defer_perform();
+    close(fd);
+  }
+  fprintf(stderr, "=== Testing websocket streaming (large frames)\n");
+  const size_t big = WS_STREAM_BUFFER_SIZE + 34567;
+  uint8_t *payload = fio_malloc(big);
+  uint8_t *data = fio_malloc(big + 64);
+  FIO_ASSERT_ALLOC(payload && data);
+  for (size_t i = 0; i < big; ++i)
+    payload[i] = (uint8_t)(i * 7 + (i >> 8));
+  {
+    websocket_settings_s args = {.on_fragment = websocket_test_on_fragment};
+    size_t len = websocket_client_wrap(data, payload, big, 2, 1, 1, 0);
+    len += websocket_client_wrap(data + len, "tail", 4, 1, 1, 1, 0);
+    /* uneven reads (the last one holds the payload's end and the next frame) */
+    const size_t chunks[] = {5, 1001, 7, WS_STREAM_BUFFER_SIZE + 3, 12345, 0};
+    websocket_test_messages = fiobj_ary_new();
+    websocket_test_fragments = 0;
+    websocket_test_in_message = 0;
+    int fd;
+    ws_s *ws = websocket_test_conn(&args, &fd);
+    size_t pos = 0;
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); ++i) {
+      const size_t chunk = (chunks[i] ? chunks[i] : len - pos);
+      websocket_test_feed(ws, fd, data + pos, chunk);
+      pos += chunk;
+    }
+    FIO_ASSERT(fiobj_ary_count(websocket_test_messages) == 2 &&
+                   !websocket_test_in_message,
+               "streamed messages missing (%zu)\n",
+               fiobj_ary_count(websocket_test_messages));
+    FIO_ASSERT(websocket_test_fragments > 3,
+               "large frames should be delivered as they arrive\n");
+    fio_str_info_s msg =
+        fiobj_obj2cstr(fiobj_ary_index(websocket_test_messages, 0));
+    FIO_ASSERT(msg.len == big && !memcmp(msg.data, payload, big),
+               "streamed payload corrupted (mask phase?)\n");
+    msg = fiobj_obj2cstr(fiobj_ary_index(websocket_test_messages, 1));
+    FIO_ASSERT(msg.len == 4 && !memcmp(msg.data, "tail", 4),
+               "the frame following a streamed frame was lost\n");
+    FIO_ASSERT(ws->buffer.size <= WS_INITIAL_BUFFER_SIZE,
+               "the stream buffer should shrink once the frame was read\n");
+    fiobj_free(websocket_test_messages);
+    fio_force_close(ws->fd);
+    fio_defer_perform();
+    close(fd);
+  }
+  fprintf(stderr, "=== Testing websocket fragmentation errors\n");
+  for (size_t i = 0; i < 4; ++i) {
+    /* even: a continuation without a message, odd: a message within a message.
+     * The first two are large (streamed) frames, the rest are parsed. */
+    websocket_settings_s args = {.on_fragment = websocket_test_on_fragment};
+    size_t len = 0;
+    if ((i & 1))
+      len = websocket_client_wrap(data, "frag", 4, 1, 1, 0, 0);
+    len += websocket_client_wrap(data + len, payload, (i < 2 ? big : 8), 2,
+                                 (i & 1), 1, 0);
+    websocket_test_messages = fiobj_ary_new();
+    websocket_test_fragments = 0;
+    websocket_test_in_message = 0;
+    int fd;
+    ws_s *ws = websocket_test_conn(&args, &fd);
+    const intptr_t uuid = ws->fd;
+    websocket_test_feed(ws, fd, data, len);
+    FIO_ASSERT(fio_is_closed(uuid) && websocket_test_fragments == (i & 1),
+               "out of order frames should close the connection (%zu)\n", i);
+    char buf[8];
+    FIO_ASSERT(websocket_test_drain(uuid, fd, buf, sizeof(buf)) == 4 &&
+                   !memcmp(buf, "\x88\x02\x03\xea", 4),
+               "out of order frames should close with 1002 (%zu)\n", i);
+    fiobj_free(websocket_test_messages);
+    fio_force_close(uuid);
+    fio_defer_perform();
+    close(fd);
+  }
+  fio_free(data);
+  fio_free(payload);
+}
+#endif
@@ -14,9 +14,54 @@ Feel free to copy, use and enjoy according to the license provided.
 extern "C" {
 #endif
 
+#ifndef WEBSOCKET_DEFLATE_MIN_LENGTH
+/** Messages shorter than this aren't compressed (permessage-deflate). */
+#define WEBSOCKET_DEFLATE_MIN_LENGTH 64
+#endif
+
+#ifndef WEBSOCKET_DEFLATE_LEVEL
+/** The zlib compression level used for permessage-deflate. */
+#define WEBSOCKET_DEFLATE_LEVEL 6
+#endif
+
+/** used internally: the negotiated permessage-deflate state. */
+typedef struct {
+  /** set once permessage-deflate was negotiated. */
+  uint8_t enabled;
+  /** window bits for outgoing messages (0 == never compress). */
+  uint8_t out_bits;
+  /** window bits for incoming messages. */
+  uint8_t in_bits;
+  /** set if the outgoing compression context is reset after each message. */
+  uint8_t out_reset;
+  /** set if the incoming compression context is reset after each message. */
+  uint8_t in_reset;
+} websocket_deflate_s;
+
+/**
+ * used internally: returns the accepted `Sec-WebSocket-Extensions` value for
+ * the client's `offers` (or FIOBJ_INVALID) and sets the negotiated state.
+ */
+FIOBJ websocket_deflate_accept(FIOBJ offers, websocket_settings_s *args,
+                               websocket_deflate_s *pmd);
+
+/**
+ * used internally: returns the `Sec-WebSocket-Extensions` value offered by a
+ * client (or FIOBJ_INVALID).
+ */
+FIOBJ websocket_deflate_offer(websocket_settings_s *args);
+
+/**
+ * used internally: validates the server's `Sec-WebSocket-Extensions` response
+ * and sets the negotiated state. Returns -1 if the connection should fail.
+ */
+int websocket_deflate_confirm(FIOBJ response, websocket_settings_s *args,
+                              websocket_deflate_s *pmd);
+
 /** used internally: attaches the Websocket protocol to the socket. */
 void websocket_attach(intptr_t uuid, http_settings_s *http_settings,
-                      websocket_settings_s *args, void *data, size_t length);
+                      websocket_settings_s *args, websocket_deflate_s *pmd,
+                      void *data, size_t length);
 
 /* *****************************************************************************
 Websocket information
@@ -148,6 +193,8 @@ void websocket_unsubscribe(ws_s *ws, uintptr_t subscription_id);
 #define WEBSOCKET_OPTIMIZE_PUBSUB_TEXT (-33)
 /** Optimize binary broadcasts, for use in websocket_optimize4broadcasts. */
 #define WEBSOCKET_OPTIMIZE_PUBSUB_BINARY (-34)
+/** Compress broadcasts once (permessage-deflate), see below. */
+#define WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE (-35)
 
 /**
  * Enables (or disables) broadcast optimizations.
@@ -162,6 +209,8 @@ void websocket_unsubscribe(ws_s *ws, uintptr_t subscription_id);
  *                               best attempt to detect Text vs. Binary data.
  * * WEBSOCKET_OPTIMIZE_PUBSUB_TEXT - optimize direct pub/sub text messages.
  * * WEBSOCKET_OPTIMIZE_PUBSUB_BINARY - optimize direct pub/sub binary messages.
+ * * WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE - compress direct pub/sub messages once
+ *                                       for all permessage-deflate clients.
  *
  * Note: to disable an optimization it should be disabled the same amount of
  * times it was enabled - multiple optimization enablements for the same type
@@ -175,6 +224,10 @@ void websocket_unsubscribe(ws_s *ws, uintptr_t subscription_id);
  *     FIOBJ pre_wrapped = (FIOBJ)fio_message_metadata(msg,
  *                               WEBSOCKET_OPTIMIZE_PUBSUB);
  *     fiobj_send_free((intptr_t)msg->udata1, fiobj_dup(pre_wrapped));
+ *
+ * Note3: The `WEBSOCKET_OPTIMIZE_PUBSUB_DEFLATE` metadata (if any) is a FIOBJ
+ * String containing the compressed payload, without the WebSocket header (the
+ * message was compressed without a context, so it's valid for any client).
  */
 void websocket_optimize4broadcasts(intptr_t type, int enable);
 
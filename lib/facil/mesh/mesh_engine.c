@@ -0,0 +1,914 @@
+/*
+Copyright: Boaz segev, 2016-2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+
+#define FIO_INCLUDE_LINKED_LIST
+#define FIO_INCLUDE_STR
+// #define DEBUG 1
+#include <fio.h>
+
+#include <mesh_engine.h>
+
+#include <sys/socket.h>
+
+#define MESH_READ_BUFFER 16384
+/* milliseconds between connection attempts */
+#define MESH_RECONNECT_INTERVAL 1000
+/* the cluster's message header: channel length, data length, type, filter */
+#define MESH_HEADER_LEN 16
+#define MESH_CHANNEL_LIMIT (1024 * 1024 * 16)
+#define MESH_MESSAGE_LIMIT (1024 * 1024 * 64)
+
+/* *****************************************************************************
+The Mesh Engine, Peers and Connections
+***************************************************************************** */
+
+/* message types share the values used by facil.io's cluster messages */
+typedef enum {
+  MESH_MSG_FORWARD = 0,
+  MESH_MSG_JSON = 1,
+  MESH_MSG_SUB = 4,
+  MESH_MSG_UNSUB = 5,
+  MESH_MSG_PATTERN_SUB = 6,
+  MESH_MSG_PATTERN_UNSUB = 7,
+  MESH_MSG_SHUTDOWN = 8,
+  MESH_MSG_PING = 10,
+  /* introduces a node, the data is the node's (random) 64 bit ID */
+  MESH_MSG_HELLO = 11,
+} mesh_msg_type_e;
+
+/* the channels (or patterns) a node is subscribed to */
+#define FIO_SET_NAME mesh_interest
+#define FIO_SET_KEY_TYPE fio_str_s
+#define FIO_SET_KEY_COPY(k1, k2)                                               \
+  (k1) = FIO_STR_INIT;                                                         \
+  fio_str_concat(&(k1), &(k2))
+#define FIO_SET_KEY_COMPARE(k1, k2) fio_str_iseq(&(k1), &(k2))
+#define FIO_SET_KEY_DESTROY(key) fio_str_free(&(key))
+#define FIO_SET_OBJ_TYPE uintptr_t
+#include <fio.h>
+
+typedef struct mesh_engine_s mesh_engine_s;
+
+/** A peer's address (used for outgoing connections). */
+typedef struct {
+  mesh_engine_s *m;
+  char *address;
+  char *port;
+  /** The peer's node ID, once known. */
+  uint64_t id;
+  intptr_t uuid;
+  /** Set when the address belongs to this node. */
+  uint8_t is_self;
+} mesh_peer_s;
+
+/** A connection to another node (incoming or outgoing). */
+typedef struct {
+  fio_protocol_s protocol;
+  fio_ls_embd_s node;
+  mesh_engine_s *m;
+  /** The peer's address for outgoing connections, NULL for incoming ones. */
+  mesh_peer_s *peer;
+  intptr_t uuid;
+  /** The remote node's ID, 0 until the node introduced itself. */
+  uint64_t id;
+  mesh_interest_s channels;
+  mesh_interest_s patterns;
+  fio_str_s buffer;
+} mesh_conn_s;
+
+struct mesh_engine_s {
+  fio_pubsub_engine_s en;
+  fio_protocol_s listener_pr;
+  subscription_s *publication_forwarder;
+  /* this node's channels and patterns */
+  mesh_interest_s channels;
+  mesh_interest_s patterns;
+  fio_ls_embd_s conns;
+  intptr_t listener;
+  uint64_t id;
+  size_t ref;
+  size_t peer_count;
+  char *address;
+  char *port;
+  fio_lock_i lock;
+  uint8_t ping_int;
+  volatile uint8_t flag;
+  mesh_peer_s peers[];
+};
+
+/** converts from the listening protocol to an `mesh_engine_s`. */
+#define listener2mesh(pr) FIO_LS_EMBD_OBJ(mesh_engine_s, listener_pr, (pr))
+
+/** cleans up and frees the engine data. */
+static inline void mesh_free(mesh_engine_s *m) {
+  if (fio_atomic_sub(&m->ref, 1))
+    return;
+  mesh_interest_free(&m->channels);
+  mesh_interest_free(&m->patterns);
+  fio_unsubscribe(m->publication_forwarder);
+  m->publication_forwarder = NULL;
+  fio_free(m);
+}
+
+/* channel names might be long, use the wide Risky Hash (keyed per engine) */
+static inline uint64_t mesh_hash(mesh_engine_s *m, fio_str_info_s s) {
+  return fio_risky_hash_wide(s.data, s.len, (uintptr_t)m);
+}
+
+/* *****************************************************************************
+Message Framing (the cluster's message format)
+***************************************************************************** */
+
+/** Appends a message to `dest`. */
+static void mesh_frame_write(fio_str_s *dest, uint32_t type, fio_str_info_s ch,
+                             fio_str_info_s msg) {
+  const size_t pos = fio_str_len(dest);
+  fio_str_info_s i =
+      fio_str_resize(dest, pos + MESH_HEADER_LEN + ch.len + msg.len);
+  fio_u2str32((uint8_t *)i.data + pos, (uint32_t)ch.len);
+  fio_u2str32((uint8_t *)i.data + pos + 4, (uint32_t)msg.len);
+  fio_u2str32((uint8_t *)i.data + pos + 8, type);
+  fio_u2str32((uint8_t *)i.data + pos + 12, 0);
+  if (ch.len)
+    memcpy(i.data + pos + MESH_HEADER_LEN, ch.data, ch.len);
+  if (msg.len)
+    memcpy(i.data + pos + MESH_HEADER_LEN + ch.len, msg.data, msg.len);
+}
+
+static void mesh_send(intptr_t uuid, uint32_t type, fio_str_info_s ch,
+                      fio_str_info_s msg) {
+  fio_str_s *s = fio_str_new2();
+  mesh_frame_write(s, type, ch, msg);
+  fio_str_send_free2(uuid, s);
+}
+
+/* *****************************************************************************
+Interest Management (called within the engine's lock)
+***************************************************************************** */
+
+/** Tests if the connected node has subscribers for the channel. */
+static int mesh_conn_wants(mesh_conn_s *c, uint64_t hash,
+                           fio_str_info_s channel) {
+  fio_str_s key = FIO_STR_INIT_STATIC2(channel.data, channel.len);
+  if (mesh_interest_find(&c->channels, hash, key))
+    return 1;
+  FIO_SET_FOR_LOOP(&c->patterns, pos) {
+    if (!pos->hash)
+      continue;
+    if (FIO_MATCH_GLOB(fio_str_info(&pos->obj.key), channel))
+      return 1;
+  }
+  return 0;
+}
+
+/** Informs all the connected nodes about a (un)subscription. */
+static void mesh_broadcast(mesh_engine_s *m, uint32_t type,
+                           fio_str_info_s channel) {
+  FIO_LS_EMBD_FOR(&m->conns, node) {
+    mesh_conn_s *c = FIO_LS_EMBD_OBJ(mesh_conn_s, node, node);
+    if (c->id)
+      mesh_send(c->uuid, type, channel, (fio_str_info_s){.len = 0});
+  }
+}
+
+/** Informs a newly connected node about all of this node's subscriptions. */
+static void mesh_share_interest(mesh_conn_s *c) {
+  mesh_engine_s *m = c->m;
+  fio_str_s *s = fio_str_new2();
+  FIO_SET_FOR_LOOP(&m->channels, pos) {
+    if (!pos->hash)
+      continue;
+    mesh_frame_write(s, MESH_MSG_SUB, fio_str_info(&pos->obj.key),
+                     (fio_str_info_s){.len = 0});
+  }
+  FIO_SET_FOR_LOOP(&m->patterns, pos) {
+    if (!pos->hash)
+      continue;
+    mesh_frame_write(s, MESH_MSG_PATTERN_SUB, fio_str_info(&pos->obj.key),
+                     (fio_str_info_s){.len = 0});
+  }
+  if (fio_str_len(s))
+    fio_str_send_free2(c->uuid, s);
+  else
+    fio_str_free2(s);
+}
+
+/** Handles a node's introduction. */
+static void mesh_on_hello(mesh_conn_s *c, uint64_t id) {
+  mesh_engine_s *m = c->m;
+  if (c->id)
+    return;
+  if (id == m->id) {
+    /* the node's own address is listed as a peer */
+    if (c->peer)
+      c->peer->is_self = 1;
+    fio_close(c->uuid);
+    return;
+  }
+  if (c->peer)
+    c->peer->id = id;
+  /*
+   * Nodes listing each other will connect twice, so both nodes keep the
+   * connection started by the node with the lower ID.
+   */
+  const uint64_t initiator = c->peer ? m->id : id;
+  FIO_LS_EMBD_FOR(&m->conns, node) {
+    mesh_conn_s *o = FIO_LS_EMBD_OBJ(mesh_conn_s, node, node);
+    if (o == c || o->id != id)
+      continue;
+    if (initiator > (o->peer ? m->id : id)) {
+      fio_close(c->uuid);
+      return;
+    }
+    o->id = 0;
+    fio_close(o->uuid);
+  }
+  c->id = id;
+  mesh_share_interest(c);
+  FIO_LOG_DEBUG("(mesh %d) connected to node %p", (int)getpid(),
+                (void *)(uintptr_t)id);
+}
+
+/* *****************************************************************************
+Connection Callbacks (fio_protocol_s)
+***************************************************************************** */
+
+/** Handles a message received from another node. */
+static void mesh_on_message(mesh_conn_s *c, uint32_t type, fio_str_info_s ch,
+                            fio_str_info_s msg) {
+  mesh_engine_s *m = c->m;
+  mesh_interest_s *set;
+  fio_str_s key = FIO_STR_INIT_STATIC2(ch.data, ch.len);
+  switch ((mesh_msg_type_e)type) {
+  case MESH_MSG_FORWARD: /* fallthrough */
+  case MESH_MSG_JSON:
+    fio_publish(.engine = FIO_PUBSUB_CLUSTER, .channel = ch, .message = msg,
+                .is_json = (type == MESH_MSG_JSON));
+    break;
+
+  case MESH_MSG_SUB: /* fallthrough */
+  case MESH_MSG_PATTERN_SUB:
+    set = (type == MESH_MSG_SUB) ? &c->channels : &c->patterns;
+    fio_lock(&m->lock);
+    mesh_interest_insert(set, mesh_hash(m, ch), key, 1, NULL);
+    fio_unlock(&m->lock);
+    break;
+
+  case MESH_MSG_UNSUB: /* fallthrough */
+  case MESH_MSG_PATTERN_UNSUB:
+    set = (type == MESH_MSG_UNSUB) ? &c->channels : &c->patterns;
+    fio_lock(&m->lock);
+    mesh_interest_remove(set, mesh_hash(m, ch), key, NULL);
+    fio_unlock(&m->lock);
+    break;
+
+  case MESH_MSG_HELLO:
+    if (msg.len < 8) {
+      fio_close(c->uuid);
+      break;
+    }
+    fio_lock(&m->lock);
+    mesh_on_hello(c, fio_str2u64(msg.data));
+    fio_unlock(&m->lock);
+    break;
+
+  case MESH_MSG_SHUTDOWN: /* fallthrough */
+  case MESH_MSG_PING:     /* fallthrough */
+  default:
+    break;
+  }
+}
+
+/** Called when a data is available, but will not run concurrently */
+static void mesh_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  mesh_conn_s *c = (mesh_conn_s *)pr;
+  const size_t pending = fio_str_len(&c->buffer);
+  fio_str_info_s i =
+      fio_str_capa_assert(&c->buffer, pending + MESH_READ_BUFFER);
+  ssize_t r = fio_read(uuid, i.data + pending, MESH_READ_BUFFER);
+  if (r <= 0)
+    return;
+  i = fio_str_resize(&c->buffer, pending + r);
+  size_t pos = 0;
+  while (i.len - pos >= MESH_HEADER_LEN) {
+    uint8_t *head = (uint8_t *)i.data + pos;
+    const uint32_t ch_len = fio_str2u32(head);
+    const uint32_t msg_len = fio_str2u32(head + 4);
+    if (ch_len >= MESH_CHANNEL_LIMIT || msg_len >= MESH_MESSAGE_LIMIT) {
+      FIO_LOG_ERROR("(mesh) message too long (%u / %u bytes), disconnecting.",
+                    (unsigned int)ch_len, (unsigned int)msg_len);
+      fio_close(uuid);
+      return;
+    }
+    if (i.len - pos < (size_t)MESH_HEADER_LEN + ch_len + msg_len)
+      break;
+    mesh_on_message(
+        c, fio_str2u32(head + 8),
+        (fio_str_info_s){.data = (char *)head + MESH_HEADER_LEN, .len = ch_len},
+        (fio_str_info_s){.data = (char *)head + MESH_HEADER_LEN + ch_len,
+                         .len = msg_len});
+    pos += MESH_HEADER_LEN + ch_len + msg_len;
+  }
+  if (pos) /* remove the handled messages */
+    fio_str_replace(&c->buffer, 0, pos, NULL, 0);
+}
+
+/** defined later - schedules a connection to a peer */
+static void mesh_peer_reconnect(mesh_peer_s *p);
+
+/** Called when the connection was closed, but will not run concurrently */
+static void mesh_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  mesh_conn_s *c = (mesh_conn_s *)pr;
+  mesh_engine_s *m = c->m;
+  fio_lock(&m->lock);
+  fio_ls_embd_remove(&c->node);
+  mesh_interest_free(&c->channels);
+  mesh_interest_free(&c->patterns);
+  fio_unlock(&m->lock);
+  fio_str_free(&c->buffer);
+  if (c->id && m->flag) {
+    FIO_LOG_WARNING("(mesh %d) connection to node %p lost.", (int)getpid(),
+                    (void *)(uintptr_t)c->id);
+  }
+  if (c->peer) {
+    c->peer->uuid = -1;
+    mesh_peer_reconnect(c->peer);
+  }
+  fio_free(c);
+  mesh_free(m);
+  (void)uuid;
+}
+
+/** Called before the facil.io reactor is shut down. */
+static uint8_t mesh_on_shutdown(intptr_t uuid, fio_protocol_s *pr) {
+  mesh_send(uuid, MESH_MSG_SHUTDOWN, (fio_str_info_s){.len = 0},
+            (fio_str_info_s){.len = 0});
+  return 0;
+  (void)pr;
+}
+
+/** Called on connection timeout. */
+static void mesh_ping(intptr_t uuid, fio_protocol_s *pr) {
+  mesh_send(uuid, MESH_MSG_PING, (fio_str_info_s){.len = 0},
+            (fio_str_info_s){.len = 0});
+  (void)pr;
+}
+
+/** Attaches a new connection and introduces this node. */
+static void mesh_conn_attach(mesh_engine_s *m, intptr_t uuid,
+                             mesh_peer_s *peer) {
+  mesh_conn_s *c = fio_malloc(sizeof(*c));
+  FIO_ASSERT_ALLOC(c);
+  *c = (mesh_conn_s){
+      .protocol =
+          {
+              .on_data = mesh_on_data,
+              .on_close = mesh_on_close,
+              .on_shutdown = mesh_on_shutdown,
+              .ping = mesh_ping,
+          },
+      .m = m,
+      .peer = peer,
+      .uuid = uuid,
+      .channels = FIO_SET_INIT,
+      .patterns = FIO_SET_INIT,
+      .buffer = FIO_STR_INIT,
+  };
+  fio_atomic_add(&m->ref, 1);
+  fio_lock(&m->lock);
+  fio_ls_embd_push(&m->conns, &c->node);
+  fio_unlock(&m->lock);
+  char id[8];
+  fio_u2str64(id, m->id);
+  mesh_send(uuid, MESH_MSG_HELLO, (fio_str_info_s){.len = 0},
+            (fio_str_info_s){.data = id, .len = 8});
+  fio_attach(uuid, &c->protocol);
+  fio_timeout_set(uuid, m->ping_int);
+}
+
+/* *****************************************************************************
+Connecting to Peers / Accepting Connections
+***************************************************************************** */
+
+static void mesh_on_connect(intptr_t uuid, void *p_) {
+  mesh_peer_s *p = p_;
+  p->uuid = uuid;
+  mesh_conn_attach(p->m, uuid, p);
+  mesh_free(p->m);
+}
+
+static void mesh_on_connect_failed(intptr_t uuid, void *p_) {
+  mesh_peer_s *p = p_;
+  p->uuid = -1;
+  mesh_peer_reconnect(p);
+  mesh_free(p->m);
+  (void)uuid;
+}
+
+static void mesh_peer_connect(void *p_) {
+  mesh_peer_s *p = p_;
+  mesh_engine_s *m = p->m;
+  if (!m->flag || p->is_self || fio_is_valid(p->uuid))
+    return;
+  if (p->id) {
+    /* the node might be connected using its own (incoming) connection */
+    uint8_t connected = 0;
+    fio_lock(&m->lock);
+    FIO_LS_EMBD_FOR(&m->conns, node) {
+      if (FIO_LS_EMBD_OBJ(mesh_conn_s, node, node)->id == p->id) {
+        connected = 1;
+        break;
+      }
+    }
+    fio_unlock(&m->lock);
+    if (connected) {
+      mesh_peer_reconnect(p);
+      return;
+    }
+  }
+  fio_atomic_add(&m->ref, 1);
+  p->uuid = fio_connect(.address = p->address, .port = p->port,
+                        .on_connect = mesh_on_connect,
+                        .on_fail = mesh_on_connect_failed, .udata = p);
+}
+
+static void mesh_peer_release(void *p_) { mesh_free(((mesh_peer_s *)p_)->m); }
+
+static void mesh_peer_reconnect(mesh_peer_s *p) {
+  if (!p->m->flag || p->is_self)
+    return;
+  fio_atomic_add(&p->m->ref, 1);
+  fio_run_every(MESH_RECONNECT_INTERVAL, 1, mesh_peer_connect, p,
+                mesh_peer_release);
+}
+
+/** Called when a new connection is available */
+static void mesh_on_accept(intptr_t uuid, fio_protocol_s *pr) {
+  mesh_engine_s *m = listener2mesh(pr);
+  intptr_t client;
+  while ((client = fio_accept(uuid)) != -1) {
+    mesh_conn_attach(m, client, NULL);
+  }
+}
+
+static void mesh_listener_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  mesh_engine_s *m = listener2mesh(pr);
+  m->listener = -1;
+  mesh_free(m);
+  (void)uuid;
+}
+
+/** The listening socket never times out. */
+static void mesh_listener_ping(intptr_t uuid, fio_protocol_s *pr) {
+  fio_touch(uuid);
+  (void)pr;
+}
+
+/* *****************************************************************************
+Engine / Bridge Callbacks (Root Process)
+***************************************************************************** */
+
+static void mesh_on_subscribe_root(const fio_pubsub_engine_s *eng,
+                                   fio_str_info_s channel, fio_match_fn match) {
+  mesh_engine_s *m = (mesh_engine_s *)eng;
+  fio_str_s key = FIO_STR_INIT_STATIC2(channel.data, channel.len);
+  fio_lock(&m->lock);
+  if (match == FIO_MATCH_GLOB) {
+    mesh_interest_insert(&m->patterns, mesh_hash(m, channel), key, 1, NULL);
+    mesh_broadcast(m, MESH_MSG_PATTERN_SUB, channel);
+  } else {
+    mesh_interest_insert(&m->channels, mesh_hash(m, channel), key, 1, NULL);
+    mesh_broadcast(m, MESH_MSG_SUB, channel);
+  }
+  fio_unlock(&m->lock);
+}
+
+static void mesh_on_unsubscribe_root(const fio_pubsub_engine_s *eng,
+                                     fio_str_info_s channel,
+                                     fio_match_fn match) {
+  mesh_engine_s *m = (mesh_engine_s *)eng;
+  fio_str_s key = FIO_STR_INIT_STATIC2(channel.data, channel.len);
+  fio_lock(&m->lock);
+  if (match == FIO_MATCH_GLOB) {
+    mesh_interest_remove(&m->patterns, mesh_hash(m, channel), key, NULL);
+    mesh_broadcast(m, MESH_MSG_PATTERN_UNSUB, channel);
+  } else {
+    mesh_interest_remove(&m->channels, mesh_hash(m, channel), key, NULL);
+    mesh_broadcast(m, MESH_MSG_UNSUB, channel);
+  }
+  fio_unlock(&m->lock);
+}
+
+/** Sends the message to every node with matching subscriptions. */
+static void mesh_forward(mesh_engine_s *m, fio_str_info_s channel,
+                         fio_str_info_s msg, uint8_t is_json) {
+  const uint64_t hash = mesh_hash(m, channel);
+  fio_str_s *frame = NULL;
+  fio_lock(&m->lock);
+  FIO_LS_EMBD_FOR(&m->conns, node) {
+    mesh_conn_s *c = FIO_LS_EMBD_OBJ(mesh_conn_s, node, node);
+    if (!c->id || !mesh_conn_wants(c, hash, channel))
+      continue;
+    if (!frame) {
+      frame = fio_str_new2();
+      mesh_frame_write(frame, (is_json ? MESH_MSG_JSON : MESH_MSG_FORWARD),
+                       channel, msg);
+    }
+    fio_str_info_s i = fio_str_info(frame);
+    fio_write(c->uuid, i.data, i.len);
+  }
+  fio_unlock(&m->lock);
+  if (frame)
+    fio_str_free2(frame);
+}
+
+static void mesh_on_publish_root(const fio_pubsub_engine_s *eng,
+                                 fio_str_info_s channel, fio_str_info_s msg,
+                                 uint8_t is_json) {
+  fio_publish(.engine = FIO_PUBSUB_CLUSTER, .channel = channel, .message = msg,
+              .is_json = is_json);
+  mesh_forward((mesh_engine_s *)eng, channel, msg, is_json);
+}
+
+/* *****************************************************************************
+Engine / Bridge Stub Callbacks (Child Process)
+***************************************************************************** */
+
+static void mesh_on_mock_subscribe_child(const fio_pubsub_engine_s *eng,
+                                         fio_str_info_s channel,
+                                         fio_match_fn match) {
+  /* do nothing, root process is notified about (un)subscriptions by facil.io */
+  (void)eng;
+  (void)channel;
+  (void)match;
+}
+
+static void mesh_on_publish_child(const fio_pubsub_engine_s *eng,
+                                  fio_str_info_s channel, fio_str_info_s msg,
+                                  uint8_t is_json) {
+  fio_publish(.engine = FIO_PUBSUB_CLUSTER, .channel = channel, .message = msg,
+              .is_json = is_json);
+  /* attach engine data to channel (prepend) */
+  fio_str_s tmp = FIO_STR_INIT;
+  /* by using fio_str_s, short names are allocated on the stack */
+  fio_str_info_s tmp_info = fio_str_resize(&tmp, channel.len + 8);
+  fio_u2str64(tmp_info.data, (uint64_t)eng);
+  memcpy(tmp_info.data + 8, channel.data, channel.len);
+  /* forward publication request to Root (for the other nodes) */
+  fio_publish(.filter = -1, .channel = tmp_info, .message = msg,
+              .engine = FIO_PUBSUB_ROOT, .is_json = is_json);
+  fio_str_free(&tmp);
+}
+
+/* listens to filter -1 on the Root process (shared with the Redis engine) */
+static void mesh_on_internal_publish(fio_msg_s *msg) {
+  if (msg->channel.len < 8)
+    return; /* internal error, unexpected data */
+  void *en = (void *)fio_str2u64(msg->channel.data);
+  if (en != msg->udata1)
+    return; /* should be delivered by a different engine */
+  /* step after the engine data */
+  msg->channel.len -= 8;
+  msg->channel.data += 8;
+  mesh_forward(msg->udata1, msg->channel, msg->msg, msg->is_json);
+}
+
+/* *****************************************************************************
+Mesh Engine Creation
+***************************************************************************** */
+
+static void mesh_on_facil_start(void *m_) {
+  mesh_engine_s *m = m_;
+  m->flag = 1;
+  if (!fio_is_valid(m->listener)) {
+    m->listener = fio_socket(m->address, m->port, 1);
+    if (m->listener == -1) {
+      FIO_LOG_ERROR("(mesh) couldn't listen for peers on port %s (%s)",
+                    m->port, strerror(errno));
+    } else {
+      fio_atomic_add(&m->ref, 1);
+      fio_attach(m->listener, &m->listener_pr);
+    }
+  }
+  for (size_t i = 0; i < m->peer_count; ++i) {
+    mesh_peer_connect(m->peers + i);
+  }
+}
+
+static void mesh_on_facil_shutdown(void *m_) {
+  mesh_engine_s *m = m_;
+  m->flag = 0;
+}
+
+static void mesh_on_engine_fork(void *m_) {
+  mesh_engine_s *m = m_;
+  /* facil.io closes the connections inherited by the child */
+  m->flag = 0;
+  m->lock = FIO_LOCK_INIT;
+  m->en = (fio_pubsub_engine_s){
+      .subscribe = mesh_on_mock_subscribe_child,
+      .unsubscribe = mesh_on_mock_subscribe_child,
+      .publish = mesh_on_publish_child,
+  };
+  fio_unsubscribe(m->publication_forwarder);
+  m->publication_forwarder = NULL;
+}
+
+fio_pubsub_engine_s *mesh_engine_create
+FIO_IGNORE_MACRO(struct mesh_engine_create_args args) {
+  if (getpid() != fio_parent_pid()) {
+    FIO_LOG_FATAL("(mesh) mesh engine initialization can only "
+                  "be performed in the Root process.");
+    kill(0, SIGINT);
+    fio_stop();
+    return NULL;
+  }
+  if (!args.address.len && args.address.data)
+    args.address.len = strlen(args.address.data);
+  if (!args.port.len && args.port.data)
+    args.port.len = strlen(args.port.data);
+  if (!args.peers.len && args.peers.data)
+    args.peers.len = strlen(args.peers.data);
+  if (!args.port.len) {
+    FIO_LOG_ERROR("(mesh) a port is required for peer connections.");
+    return NULL;
+  }
+  size_t peer_count = 0;
+  for (size_t i = 0; i < args.peers.len; ++i) {
+    if (args.peers.data[i] == ':')
+      ++peer_count;
+  }
+
+  mesh_engine_s *m =
+      fio_malloc(sizeof(*m) + (sizeof(mesh_peer_s) * peer_count) +
+                 args.address.len + 1 + args.port.len + 1 + args.peers.len + 1);
+  FIO_ASSERT_ALLOC(m);
+  *m = (mesh_engine_s){
+      .en =
+          {
+              .subscribe = mesh_on_subscribe_root,
+              .unsubscribe = mesh_on_unsubscribe_root,
+              .publish = mesh_on_publish_root,
+          },
+      .listener_pr =
+          {
+              .on_data = mesh_on_accept,
+              .on_close = mesh_listener_on_close,
+              .ping = mesh_listener_ping,
+          },
+      .publication_forwarder =
+          fio_subscribe(.filter = -1, .udata1 = m,
+                        .on_message = mesh_on_internal_publish),
+      .channels = FIO_SET_INIT,
+      .patterns = FIO_SET_INIT,
+      .conns = FIO_LS_INIT(m->conns),
+      .listener = -1,
+      .ref = 1,
+      .lock = FIO_LOCK_INIT,
+      .ping_int = args.ping_interval,
+      .flag = 1,
+  };
+  while (!m->id)
+    m->id = fio_rand64();
+
+  char *buf = (char *)(m->peers + peer_count);
+  if (args.address.len) {
+    m->address = buf;
+    memcpy(buf, args.address.data, args.address.len);
+    buf += args.address.len;
+    *buf++ = 0;
+  }
+  m->port = buf;
+  memcpy(buf, args.port.data, args.port.len);
+  buf += args.port.len;
+  *buf++ = 0;
+  if (args.peers.len)
+    memcpy(buf, args.peers.data, args.peers.len);
+  buf[args.peers.len] = 0;
+
+  /* split the list ("host:port,host:port") in place */
+  while (*buf) {
+    char *end = buf;
+    while (*end && *end != ',')
+      ++end;
+    char *next = end + (*end != 0);
+    *end = 0;
+    while (*buf == ' ')
+      ++buf;
+    char *port = strrchr(buf, ':');
+    if (!port || port == buf || !port[1]) {
+      if (*buf)
+        FIO_LOG_WARNING("(mesh) invalid peer address ignored: %s", buf);
+      buf = next;
+      continue;
+    }
+    *port++ = 0;
+    if (*buf == '[' && port[-2] == ']') {
+      /* IPv6 addresses, i.e. "[::1]:3001" */
+      port[-2] = 0;
+      ++buf;
+    }
+    m->peers[m->peer_count++] =
+        (mesh_peer_s){.m = m, .address = buf, .port = port, .uuid = -1};
+    buf = next;
+  }
+
+  fio_pubsub_attach(&m->en);
+  fio_state_callback_add(FIO_CALL_IN_CHILD, mesh_on_engine_fork, m);
+  fio_state_callback_add(FIO_CALL_ON_SHUTDOWN, mesh_on_facil_shutdown, m);
+  fio_state_callback_add(FIO_CALL_PRE_START, mesh_on_facil_start, m);
+  if (fio_is_running())
+    mesh_on_facil_start(m);
+
+  FIO_LOG_DEBUG("Mesh engine initialized %p (node %p)", (void *)m,
+                (void *)(uintptr_t)m->id);
+  return &m->en;
+}
+
+/* *****************************************************************************
+Mesh Engine Destruction
+***************************************************************************** */
+
+void mesh_engine_destroy(fio_pubsub_engine_s *engine) {
+  mesh_engine_s *m = (mesh_engine_s *)engine;
+  m->flag = 0;
+  fio_pubsub_detach(&m->en);
+  fio_state_callback_remove(FIO_CALL_IN_CHILD, mesh_on_engine_fork, m);
+  fio_state_callback_remove(FIO_CALL_ON_SHUTDOWN, mesh_on_facil_shutdown, m);
+  fio_state_callback_remove(FIO_CALL_PRE_START, mesh_on_facil_start, m);
+  fio_lock(&m->lock);
+  FIO_LS_EMBD_FOR(&m->conns, node) {
+    fio_close(FIO_LS_EMBD_OBJ(mesh_conn_s, node, node)->uuid);
+  }
+  fio_unlock(&m->lock);
+  if (m->listener != -1)
+    fio_close(m->listener);
+  FIO_LOG_DEBUG("Mesh engine destroyed %p", (void *)m);
+  mesh_free(m);
+}
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+
+#if DEBUG
+
+/* attaches a connection to a new socket pair, `fd` is the peer's end */
+static mesh_conn_s *mesh_test_conn(mesh_engine_s *m, mesh_peer_s *peer,
+                                   int *fd) {
+  int fds[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds), "socketpair failed");
+  FIO_ASSERT(fio_set_non_block(fds[0]) != -1, "non-blocking mode failed");
+  mesh_conn_attach(m, fio_fd2uuid(fds[0]), peer);
+  *fd = fds[1];
+  return FIO_LS_EMBD_OBJ(mesh_conn_s, node, m->conns.prev);
+}
+
+/* writes the data to the peer's end and lets the connection read it */
+static void mesh_test_feed(mesh_conn_s *c, int fd, char *data, size_t len) {
+  FIO_ASSERT(write(fd, data, len) == (ssize_t)len, "(mesh) test write failed");
+  c->protocol.on_data(c->uuid, &c->protocol);
+}
+
+/* writes a HELLO message, introducing node `id` */
+static void mesh_test_hello(mesh_conn_s *c, int fd, uint64_t id) {
+  char buf[8];
+  fio_str_s s = FIO_STR_INIT;
+  fio_u2str64(buf, id);
+  mesh_frame_write(&s, MESH_MSG_HELLO, (fio_str_info_s){.len = 0},
+                   (fio_str_info_s){.data = buf, .len = 8});
+  mesh_test_feed(c, fd, fio_str_data(&s), fio_str_len(&s));
+  fio_str_free(&s);
+}
+
+static int mesh_test_wants(mesh_conn_s *c, char *channel) {
+  fio_str_info_s ch = {.data = channel, .len = strlen(channel)};
+  return mesh_conn_wants(c, mesh_hash(c->m, ch), ch);
+}
+
+void mesh_engine_test(void) {
+  fprintf(stderr, "=== Testing the mesh engine (framing and node handshake)\n");
+  fio_str_s s = FIO_STR_INIT;
+  mesh_frame_write(&s, MESH_MSG_SUB, (fio_str_info_s){.data = "news", .len = 4},
+                   (fio_str_info_s){.len = 0});
+  mesh_frame_write(&s, MESH_MSG_JSON, (fio_str_info_s){.data = "ch", .len = 2},
+                   (fio_str_info_s){.data = "{}", .len = 2});
+  fio_str_info_s i = fio_str_info(&s);
+  uint8_t *head = (uint8_t *)i.data;
+  FIO_ASSERT(i.len == (MESH_HEADER_LEN * 2) + 8, "(mesh) frame length error");
+  FIO_ASSERT(fio_str2u32(head) == 4 && fio_str2u32(head + 4) == 0 &&
+                 fio_str2u32(head + 8) == MESH_MSG_SUB &&
+                 !fio_str2u32(head + 12) &&
+                 !memcmp(head + MESH_HEADER_LEN, "news", 4),
+             "(mesh) frame header error");
+  head += MESH_HEADER_LEN + 4;
+  FIO_ASSERT(fio_str2u32(head) == 2 && fio_str2u32(head + 4) == 2 &&
+                 fio_str2u32(head + 8) == MESH_MSG_JSON &&
+                 !memcmp(head + MESH_HEADER_LEN, "ch{}", 4),
+             "(mesh) frame header error (second frame)");
+  fio_str_free(&s);
+
+  /* a mock engine, `flag` is off, so lost peers aren't reconnected */
+  mesh_engine_s *m = fio_malloc(sizeof(*m) + (sizeof(mesh_peer_s) * 3));
+  FIO_ASSERT_ALLOC(m);
+  *m = (mesh_engine_s){
+      .channels = FIO_SET_INIT,
+      .patterns = FIO_SET_INIT,
+      .conns = FIO_LS_INIT(m->conns),
+      .listener = -1,
+      .id = 2,
+      .ref = 1,
+      .lock = FIO_LOCK_INIT,
+  };
+  m->peers[0] = (mesh_peer_s){.m = m, .uuid = -1};
+  m->peers[1] = (mesh_peer_s){.m = m, .uuid = -1};
+  m->peers[2] = (mesh_peer_s){.m = m, .uuid = -1};
+  intptr_t uuids[6];
+  int fds[6];
+
+  /* messages split between reads */
+  mesh_conn_s *c = mesh_test_conn(m, NULL, fds);
+  uuids[0] = c->uuid;
+  char id[8];
+  fio_u2str64(id, 7);
+  mesh_frame_write(&s, MESH_MSG_HELLO, (fio_str_info_s){.len = 0},
+                   (fio_str_info_s){.data = id, .len = 8});
+  mesh_frame_write(&s, MESH_MSG_SUB, (fio_str_info_s){.data = "news", .len = 4},
+                   (fio_str_info_s){.len = 0});
+  mesh_frame_write(&s, MESH_MSG_PATTERN_SUB,
+                   (fio_str_info_s){.data = "user/*", .len = 6},
+                   (fio_str_info_s){.len = 0});
+  i = fio_str_info(&s);
+  mesh_test_feed(c, fds[0], i.data, 5);
+  FIO_ASSERT(!c->id && fio_str_len(&c->buffer) == 5,
+             "(mesh) a partial header should be kept for the next read");
+  mesh_test_feed(c, fds[0], i.data + 5, MESH_HEADER_LEN + 8 + 9);
+  FIO_ASSERT(c->id == 7 && fio_str_len(&c->buffer) == 14 &&
+                 !mesh_test_wants(c, "news"),
+             "(mesh) HELLO message error");
+  mesh_test_feed(c, fds[0], i.data + MESH_HEADER_LEN + 22,
+                 i.len - (MESH_HEADER_LEN + 22));
+  FIO_ASSERT(!fio_str_len(&c->buffer) && mesh_test_wants(c, "news") &&
+                 mesh_test_wants(c, "user/42") && !mesh_test_wants(c, "other"),
+             "(mesh) subscription messages error");
+  fio_str_free(&s);
+  mesh_frame_write(&s, MESH_MSG_UNSUB, (fio_str_info_s){.data = "news", .len = 4},
+                   (fio_str_info_s){.len = 0});
+  mesh_test_feed(c, fds[0], fio_str_data(&s), fio_str_len(&s));
+  FIO_ASSERT(!mesh_test_wants(c, "news") && mesh_test_wants(c, "user/42"),
+             "(mesh) unsubscribe message error");
+  fio_str_free(&s);
+  char oversized[MESH_HEADER_LEN] = {0};
+  fio_u2str32((uint8_t *)oversized, MESH_CHANNEL_LIMIT);
+  mesh_test_feed(c, fds[0], oversized, MESH_HEADER_LEN);
+  FIO_ASSERT(fio_is_closed(uuids[0]),
+             "(mesh) oversized messages should close the connection");
+
+  /*
+   * Duplicate connections (both nodes listing each other), the connection
+   * started by the node with the lower ID (this node's ID is 2) is kept.
+   */
+  mesh_conn_s *out = mesh_test_conn(m, m->peers, fds + 1);
+  mesh_conn_s *in = mesh_test_conn(m, NULL, fds + 2);
+  uuids[1] = out->uuid;
+  uuids[2] = in->uuid;
+  mesh_test_hello(out, fds[1], 1);
+  FIO_ASSERT(out->id == 1 && m->peers[0].id == 1, "(mesh) peer ID error");
+  mesh_test_hello(in, fds[2], 1);
+  FIO_ASSERT(in->id == 1 && !out->id && fio_is_closed(uuids[1]) &&
+                 !fio_is_closed(uuids[2]),
+             "(mesh) the connection started by node 1 should be kept");
+  out = mesh_test_conn(m, m->peers + 1, fds + 3);
+  in = mesh_test_conn(m, NULL, fds + 4);
+  uuids[3] = out->uuid;
+  uuids[4] = in->uuid;
+  mesh_test_hello(out, fds[3], 5);
+  mesh_test_hello(in, fds[4], 5);
+  FIO_ASSERT(out->id == 5 && !in->id && fio_is_closed(uuids[4]) &&
+                 !fio_is_closed(uuids[3]),
+             "(mesh) the connection started by node 2 should be kept");
+  mesh_test_hello(out, fds[3], 1);
+  FIO_ASSERT(out->id == 5, "(mesh) a second HELLO should be ignored");
+  /* a node listing its own address */
+  out = mesh_test_conn(m, m->peers + 2, fds + 5);
+  uuids[5] = out->uuid;
+  mesh_test_hello(out, fds[5], m->id);
+  FIO_ASSERT(!out->id && m->peers[2].is_self && fio_is_closed(uuids[5]),
+             "(mesh) connections to this node should be closed");
+
+  for (size_t j = 0; j < 6; ++j)
+    fio_force_close(uuids[j]);
+  fio_defer_perform();
+  for (size_t j = 0; j < 6; ++j)
+    close(fds[j]);
+  FIO_ASSERT(m->ref == 1 && fio_ls_embd_is_empty(&m->conns),
+             "(mesh) connections weren't released");
+  mesh_free(m);
+  fprintf(stderr, "* passed.\n");
+}
+
+#endif
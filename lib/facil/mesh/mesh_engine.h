@@ -0,0 +1,79 @@
+/*
+Copyright: Boaz segev, 2016-2019
+License: MIT
+
+Feel free to copy, use and enjoy according to the license provided.
+*/
+#ifndef H_MESH_ENGINE_H
+#define H_MESH_ENGINE_H
+
+#include <fio.h>
+
+/* support C++ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** possible arguments for the `mesh_engine_create` function call */
+struct mesh_engine_create_args {
+  /** The address to listen to for peer connections, defaults to all. */
+  fio_str_info_s address;
+  /** The port to listen to for peer connections (required). */
+  fio_str_info_s port;
+  /**
+   * A comma separated list of peers ("host:port"), i.e.:
+   *
+   *     "10.0.0.1:3001,10.0.0.2:3001,10.0.0.3:3001"
+   *
+   * The list may include the node's own address, so all the nodes can share
+   * the same list.
+   */
+  fio_str_info_s peers;
+  /** A `ping` will be sent every `ping_interval` interval or inactivity. */
+  uint8_t ping_interval;
+};
+
+/**
+ * See the {fio.h} file for documentation about engines.
+ *
+ * The mesh engine connects facil.io clusters (nodes) directly, over TCP/IP,
+ * without an external Pub/Sub service.
+ *
+ * Nodes exchange their subscriptions, so a node only receives the messages
+ * published to channels (or patterns) it has subscribers for. Messages aren't
+ * relayed, so every node should be connected to every other node (this
+ * happens when each node lists all the others, or all nodes share a list).
+ *
+ * Only the Root process connects to other nodes. Publishing through the engine
+ * sends the message to the local cluster as well as to the other nodes.
+ *
+ * Custom pattern matching functions can't be sent to other nodes. Patterns
+ * that don't use `FIO_MATCH_GLOB` are treated as channel names.
+ *
+ * Note: connections aren't authenticated or encrypted, the port should only
+ * be reachable on a private network.
+ *
+ * Note: The mesh engine assumes it will stay alive until all the messages and
+ * callbacks have been called (or facil.io exits)... If the engine is destroyed
+ * midway, memory leaks might occur.
+ */
+fio_pubsub_engine_s *mesh_engine_create(struct mesh_engine_create_args);
+#define mesh_engine_create(...)                                                \
+  mesh_engine_create((struct mesh_engine_create_args){__VA_ARGS__})
+
+/**
+ * Detaches the engine, closes its connections and frees it (once the pending
+ * callbacks are done).
+ */
+void mesh_engine_destroy(fio_pubsub_engine_s *engine);
+
+#if DEBUG
+void mesh_engine_test(void);
+#endif
+
+/* support C++ */
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* H_MESH_ENGINE_H */
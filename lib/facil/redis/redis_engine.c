@@ -16,50 +16,138 @@ Feel free to copy, use and enjoy according to the license provided.
 #include <resp_parser.h>
 
 #define REDIS_READ_BUFFER 8192
+/* the number of hash slots in a Redis Cluster */
+#define REDIS_CLUSTER_SLOTS 16384
+/* the number of times a command can be redirected (MOVED / ASK) */
+#define REDIS_MAX_REDIRECTS 16
 /* *****************************************************************************
 The Redis Engine and Callbacks Object
 ***************************************************************************** */
 
+typedef struct redis_engine_s redis_engine_s;
+
+struct redis_engine_internal_s {
+  fio_protocol_s protocol;
+  intptr_t uuid;
+  resp_parser_s parser;
+  void (*on_message)(struct redis_engine_internal_s *parser, FIOBJ msg);
+  char *address;
+  char *port;
+  FIOBJ str;
+  FIOBJ ary;
+  uint32_t ary_count;
+  uint16_t buf_pos;
+  uint16_t nesting;
+  uint8_t flat;
+};
+
+/*
+ * A flat reply arena, reused by the publishing connection.
+ *
+ * Reply elements are stored by order of appearance (an Array is followed by
+ * its members) and String elements point to the `strings` buffer using an
+ * offset (rather than a pointer) until the reply is delivered.
+ */
+typedef struct {
+  redis_reply_s *elements;
+  char *strings;
+  size_t count;
+  size_t capa;
+  size_t len;
+  size_t str_capa;
+  uint32_t replies;
+} redis_arena_s;
+
+/* a publishing (command) connection, one of the node's connection pool */
+typedef struct {
+  struct redis_engine_internal_s data;
+  redis_engine_s *r;
+  fio_ls_embd_s queue;
+  fio_str_s *pending;
+  redis_arena_s arena;
+  size_t outstanding;
+  fio_lock_i lock;
+  uint8_t pub_send;
+  uint8_t flush_scheduled;
+  uint8_t buf[REDIS_READ_BUFFER];
+} redis_pub_s;
+
+/* a Redis server (a shard, when in cluster mode) and its connection pool */
+typedef struct {
+  char *address;
+  char *port;
+  size_t count;
+  redis_pub_s pool[];
+} redis_node_s;
+
+/* a client side cache entry: the replies of the read commands for a key */
+typedef struct {
+  fio_ls_embd_s node;
+  /* the tracked key */
+  FIOBJ key;
+  /* a Hash mapping the (RESP formatted) commands to their replies */
+  FIOBJ replies;
+  uint64_t hash;
+  /* replies are only cached by the entry that existed when they were sent */
+  uint64_t generation;
+  size_t size;
+} redis_cache_entry_s;
+
+#define FIO_SET_NAME redis_cache_set
+#define FIO_SET_OBJ_TYPE redis_cache_entry_s *
+#define FIO_SET_OBJ_COMPARE(o1, o2) fiobj_iseq((o1)->key, (o2)->key)
+#include <fio.h>
+
+/* the client side cache (per process, see `cache_limit`) */
 typedef struct {
+  redis_cache_set_s set;
+  fio_ls_embd_s lru;
+  size_t total;
+  size_t limit;
+  uint64_t generation;
+  fio_lock_i lock;
+} redis_cache_s;
+
+struct redis_engine_s {
   fio_pubsub_engine_s en;
-  struct redis_engine_internal_s {
-    fio_protocol_s protocol;
-    intptr_t uuid;
-    resp_parser_s parser;
-    void (*on_message)(struct redis_engine_internal_s *parser, FIOBJ msg);
-    FIOBJ str;
-    FIOBJ ary;
-    uint32_t ary_count;
-    uint16_t buf_pos;
-    uint16_t nesting;
-  } pub_data, sub_data;
+  struct redis_engine_internal_s sub_data;
   subscription_s *publication_forwarder;
   subscription_s *cmd_forwarder;
   subscription_s *cmd_reply;
+  subscription_s *cache_invalidation;
+  redis_cache_s cache;
+  /* the subscription connection's id (invalidation messages are sent to it) */
+  int64_t sub_id;
   char *address;
   char *port;
   char *auth;
   FIOBJ last_ch;
   size_t auth_len;
   size_t ref;
-  fio_ls_embd_s queue;
+  redis_node_s **nodes;
+  size_t node_count;
+  uint16_t *slots;
   fio_lock_i lock;
   uint8_t ping_int;
-  uint8_t pub_send;
+  uint8_t pool_size;
   volatile uint8_t flag;
+  /* set while waiting for the subscription connection's id */
+  uint8_t sub_id_pending;
   uint8_t buf[];
-} redis_engine_s;
+};
 
 typedef struct {
   fio_ls_embd_s node;
-  void (*callback)(fio_pubsub_engine_s *e, FIOBJ reply, void *udata);
+  void (*callback)(fio_pubsub_engine_s *e, redis_arena_s *reply, void *udata);
   void *udata;
   size_t cmd_len;
+  uint32_t expected;
+  uint8_t redirects;
   uint8_t cmd[];
 } redis_commands_s;
 
-/** converts from a publishing protocol to an `redis_engine_s`. */
-#define pub2redis(pr) FIO_LS_EMBD_OBJ(redis_engine_s, pub_data, (pr))
+/** converts from a publishing protocol to a `redis_pub_s` connection. */
+#define pub2conn(pr) FIO_LS_EMBD_OBJ(redis_pub_s, data, (pr))
 /** converts from a subscribing protocol to an `redis_engine_s`. */
 #define sub2redis(pr) FIO_LS_EMBD_OBJ(redis_engine_s, sub_data, (pr))
 
@@ -67,6 +155,119 @@ typedef struct {
 #define parser2data(prsr)                                                      \
   FIO_LS_EMBD_OBJ(struct redis_engine_internal_s, parser, (prsr))
 
+/* *****************************************************************************
+Client Side Cache (per process)
+***************************************************************************** */
+
+static inline size_t redis_cache_entry_size(redis_cache_entry_s *e) {
+  return sizeof(*e) + fiobj_obj2cstr(e->key).len;
+}
+
+/* removes an entry from the cache (the lock must be held) */
+static void redis_cache_remove_unsafe(redis_cache_s *c, redis_cache_entry_s *e) {
+  redis_cache_set_remove(&c->set, e->hash, e, NULL);
+  fio_ls_embd_remove(&e->node);
+  c->total -= e->size;
+  fiobj_free(e->key);
+  fiobj_free(e->replies);
+  fio_free(e);
+}
+
+/* removes all the cached replies */
+static void redis_cache_clear(redis_cache_s *c) {
+  fio_lock(&c->lock);
+  while (fio_ls_embd_any(&c->lru)) {
+    redis_cache_remove_unsafe(
+        c, FIO_LS_EMBD_OBJ(redis_cache_entry_s, node, c->lru.next));
+  }
+  redis_cache_set_free(&c->set);
+  fio_unlock(&c->lock);
+}
+
+/* finds an entry (the lock must be held) */
+static redis_cache_entry_s *redis_cache_find_unsafe(redis_cache_s *c, FIOBJ key,
+                                                   uint64_t hash) {
+  redis_cache_entry_s tmp = {.key = key};
+  return redis_cache_set_find(&c->set, hash, &tmp);
+}
+
+/* evicts the least recently used entries (the lock must be held) */
+static void redis_cache_evict_unsafe(redis_cache_s *c) {
+  while (c->total > c->limit && fio_ls_embd_any(&c->lru)) {
+    redis_cache_remove_unsafe(
+        c, FIO_LS_EMBD_OBJ(redis_cache_entry_s, node, c->lru.next));
+  }
+}
+
+/**
+ * Returns a cached reply (a new reference) or FIOBJ_INVALID.
+ *
+ * On a cache miss, the key's entry is created (if missing) and `generation` is
+ * set, so the reply can be cached once it arrives (see `redis_cache_store`).
+ */
+static FIOBJ redis_cache_get(redis_cache_s *c, FIOBJ key, FIOBJ cmd,
+                             uint64_t *generation) {
+  const uint64_t hash = fiobj_obj2hash(key);
+  FIOBJ reply = FIOBJ_INVALID;
+  fio_lock(&c->lock);
+  redis_cache_entry_s *e = redis_cache_find_unsafe(c, key, hash);
+  if (e) {
+    fio_ls_embd_remove(&e->node);
+    fio_ls_embd_push(&c->lru, &e->node);
+    reply = fiobj_dup(fiobj_hash_get(e->replies, cmd));
+    *generation = e->generation;
+    fio_unlock(&c->lock);
+    return reply;
+  }
+  e = fio_malloc(sizeof(*e));
+  FIO_ASSERT_ALLOC(e);
+  *e = (redis_cache_entry_s){
+      .key = fiobj_dup(key),
+      .replies = fiobj_hash_new(),
+      .hash = hash,
+      .generation = ++c->generation,
+  };
+  e->size = redis_cache_entry_size(e);
+  c->total += e->size;
+  redis_cache_set_insert(&c->set, hash, e);
+  fio_ls_embd_push(&c->lru, &e->node);
+  *generation = e->generation;
+  redis_cache_evict_unsafe(c);
+  fio_unlock(&c->lock);
+  return reply;
+}
+
+/* caches a reply, unless the key was invalidated since the command was sent */
+static void redis_cache_store(redis_cache_s *c, FIOBJ key, uint64_t generation,
+                              FIOBJ cmd, FIOBJ reply, size_t size) {
+  const uint64_t hash = fiobj_obj2hash(key);
+  size += fiobj_obj2cstr(cmd).len;
+  if (size > (c->limit >> 1))
+    return;
+  fio_lock(&c->lock);
+  redis_cache_entry_s *e = redis_cache_find_unsafe(c, key, hash);
+  if (e && e->generation == generation &&
+      !fiobj_hash_get(e->replies, cmd)) {
+    fiobj_hash_set(e->replies, cmd, fiobj_dup(reply));
+    e->size += size;
+    c->total += size;
+    redis_cache_evict_unsafe(c);
+  }
+  fio_unlock(&c->lock);
+}
+
+/* removes the replies cached for a key */
+static void redis_cache_invalidate(redis_cache_s *c, fio_str_info_s key) {
+  FIOBJ tmp = fiobj_str_new(key.data, key.len);
+  const uint64_t hash = fiobj_obj2hash(tmp);
+  fio_lock(&c->lock);
+  redis_cache_entry_s *e = redis_cache_find_unsafe(c, tmp, hash);
+  if (e)
+    redis_cache_remove_unsafe(c, e);
+  fio_unlock(&c->lock);
+  fiobj_free(tmp);
+}
+
 /* releases any resources used by an internal engine*/
 static inline void redis_internal_reset(struct redis_engine_internal_s *i) {
   i->buf_pos = 0;
@@ -80,23 +281,57 @@ static inline void redis_internal_reset(struct redis_engine_internal_s *i) {
   i->uuid = -1;
 }
 
+/* clears the reply arena, releasing oversized buffers */
+static inline void redis_arena_reset(redis_arena_s *a, uint8_t release) {
+  if (release || a->capa * sizeof(*a->elements) + a->str_capa >
+                     (REDIS_READ_BUFFER << 5)) {
+    fio_free(a->elements);
+    fio_free(a->strings);
+    *a = (redis_arena_s){.elements = NULL};
+    return;
+  }
+  a->count = 0;
+  a->len = 0;
+  a->replies = 0;
+}
+
+/* releases the resources used by a publishing connection */
+static inline void redis_pub_clear(redis_pub_s *c) {
+  redis_internal_reset(&c->data);
+  while (fio_ls_embd_any(&c->queue)) {
+    fio_free(
+        FIO_LS_EMBD_OBJ(redis_commands_s, node, fio_ls_embd_pop(&c->queue)));
+  }
+  fio_str_free2(c->pending);
+  c->pending = NULL;
+  redis_arena_reset(&c->arena, 1);
+  c->outstanding = 0;
+  c->pub_send = 0;
+}
+
 /** cleans up and frees the engine data. */
 static inline void redis_free(redis_engine_s *r) {
   if (fio_atomic_sub(&r->ref, 1))
     return;
-  redis_internal_reset(&r->pub_data);
   redis_internal_reset(&r->sub_data);
   fiobj_free(r->last_ch);
-  while (fio_ls_embd_any(&r->queue)) {
-    fio_free(
-        FIO_LS_EMBD_OBJ(redis_commands_s, node, fio_ls_embd_pop(&r->queue)));
+  for (size_t n = 0; n < r->node_count; ++n) {
+    for (size_t i = 0; i < r->nodes[n]->count; ++i) {
+      redis_pub_clear(r->nodes[n]->pool + i);
+    }
+    fio_free(r->nodes[n]);
   }
+  fio_free(r->nodes);
+  fio_free(r->slots);
   fio_unsubscribe(r->publication_forwarder);
   r->publication_forwarder = NULL;
   fio_unsubscribe(r->cmd_forwarder);
   r->cmd_forwarder = NULL;
   fio_unsubscribe(r->cmd_reply);
   r->cmd_reply = NULL;
+  fio_unsubscribe(r->cache_invalidation);
+  r->cache_invalidation = NULL;
+  redis_cache_clear(&r->cache);
   fio_free(r);
 }
 
@@ -104,36 +339,36 @@ static inline void redis_free(redis_engine_s *r) {
 Simple RESP formatting
 ***************************************************************************** */
 
-inline static void fiobj2resp2(FIOBJ dest, FIOBJ obj) {
+inline static void fiobj2resp2(fio_str_s *dest, FIOBJ obj) {
   if (fiobj_hash_key_in_loop())
     fiobj2resp2(dest, fiobj_hash_key_in_loop());
   fio_str_info_s s;
   switch (FIOBJ_TYPE(obj)) {
   case FIOBJ_T_NULL:
-    fiobj_str_write(dest, "$-1\r\n", 5);
+    fio_str_write(dest, "$-1\r\n", 5);
     break;
   case FIOBJ_T_ARRAY:
-    fiobj_str_write(dest, "*", 1);
-    fiobj_str_write_i(dest, fiobj_ary_count(obj));
-    fiobj_str_write(dest, "\r\n", 2);
+    fio_str_write(dest, "*", 1);
+    fio_str_write_i(dest, fiobj_ary_count(obj));
+    fio_str_write(dest, "\r\n", 2);
     break;
   case FIOBJ_T_HASH:
-    fiobj_str_write(dest, "*", 1);
-    fiobj_str_write_i(dest, fiobj_hash_count(obj) * 2);
-    fiobj_str_write(dest, "\r\n", 2);
+    fio_str_write(dest, "*", 1);
+    fio_str_write_i(dest, fiobj_hash_count(obj) * 2);
+    fio_str_write(dest, "\r\n", 2);
     break;
   case FIOBJ_T_TRUE:
-    fiobj_str_write(dest, "$4\r\ntrue\r\n", 10);
+    fio_str_write(dest, "$4\r\ntrue\r\n", 10);
     break;
   case FIOBJ_T_FALSE:
-    fiobj_str_write(dest, "$4\r\nfalse\r\n", 11);
+    fio_str_write(dest, "$4\r\nfalse\r\n", 11);
     break;
 #if 0
     /* Numbers aren't as good for commands as one might think... */
   case FIOBJ_T_NUMBER:
-    fiobj_str_write(dest, ":", 1);
-    fiobj_str_write_i(dest, fiobj_obj2num(obj));
-    fiobj_str_write(dest, "\r\n", 2);
+    fio_str_write(dest, ":", 1);
+    fio_str_write_i(dest, fiobj_obj2num(obj));
+    fio_str_write(dest, "\r\n", 2);
     break;
 #else
   case FIOBJ_T_NUMBER: /* overflow */
@@ -141,43 +376,145 @@ inline static void fiobj2resp2(FIOBJ dest, FIOBJ obj) {
   case FIOBJ_T_FLOAT:   /* overflow */
   case FIOBJ_T_UNKNOWN: /* overflow */
   case FIOBJ_T_STRING:  /* overflow */
+  case FIOBJ_T_ROPE:    /* overflow */
   case FIOBJ_T_DATA:
     s = fiobj_obj2cstr(obj);
-    fiobj_str_write(dest, "$", 1);
-    fiobj_str_write_i(dest, s.len);
-    fiobj_str_write(dest, "\r\n", 2);
-    fiobj_str_write(dest, s.data, s.len);
-    fiobj_str_write(dest, "\r\n", 2);
+    fio_str_capa_assert(dest, fio_str_len(dest) + s.len + 32);
+    fio_str_write(dest, "$", 1);
+    fio_str_write_i(dest, s.len);
+    fio_str_write(dest, "\r\n", 2);
+    fio_str_write(dest, s.data, s.len);
+    fio_str_write(dest, "\r\n", 2);
     break;
   }
 }
 
 static int fiobj2resp_task(FIOBJ o, void *dest_) {
-  fiobj2resp2((FIOBJ)dest_, o);
+  fiobj2resp2((fio_str_s *)dest_, o);
   return 0;
 }
 
 /**
- * Converts FIOBJ objects into a RESP string (client mode).
+ * Appends the RESP representation of a FIOBJ object (client mode) to `dest`.
+ *
+ * The data is written directly to the (memory pool allocated) string buffer,
+ * no intermediate FIOBJ String objects are created.
  */
-static FIOBJ fiobj2resp(FIOBJ dest, FIOBJ obj) {
+static void fiobj2resp(fio_str_s *dest, FIOBJ obj) {
   fiobj_each2(obj, fiobj2resp_task, (void *)dest);
-  return dest;
 }
 
-/**
- * Converts FIOBJ objects into a RESP string (client mode).
- *
- * Don't call `fiobj_free`, object will self-destruct.
- */
-static inline FIOBJ fiobj2resp_tmp(FIOBJ obj) {
-  return fiobj2resp(fiobj_str_tmp(), obj);
+/* *****************************************************************************
+Flat Reply Arena
+***************************************************************************** */
+
+/* adds an element to the arena */
+static redis_reply_s *redis_arena_push(redis_arena_s *a, uint8_t type) {
+  if (a->count == a->capa) {
+    const size_t capa = a->capa ? (a->capa << 1) : 32;
+    redis_reply_s *tmp =
+        fio_realloc2(a->elements, sizeof(*tmp) * capa, sizeof(*tmp) * a->count);
+    FIO_ASSERT_ALLOC(tmp);
+    a->elements = tmp;
+    a->capa = capa;
+  }
+  redis_reply_s *e = a->elements + a->count++;
+  *e = (redis_reply_s){.type = type};
+  return e;
+}
+
+/* makes sure there's room for `len` more bytes in the strings buffer */
+static void redis_arena_reserve(redis_arena_s *a, size_t len) {
+  if (a->len + len <= a->str_capa)
+    return;
+  size_t capa = a->str_capa ? a->str_capa : 1024;
+  while (capa < a->len + len)
+    capa <<= 1;
+  char *tmp = fio_realloc2(a->strings, capa, a->len);
+  FIO_ASSERT_ALLOC(tmp);
+  a->strings = tmp;
+  a->str_capa = capa;
+}
+
+/* adds a String (or error) element, the data is added by the caller */
+static redis_reply_s *redis_arena_push_str(redis_arena_s *a, uint8_t type,
+                                           size_t len) {
+  redis_reply_s *e = redis_arena_push(a, type);
+  e->data = (const char *)(uintptr_t)a->len;
+  redis_arena_reserve(a, len + 1);
+  return e;
+}
+
+/* copies String data to the arena */
+static void redis_arena_write(redis_arena_s *a, const void *data, size_t len) {
+  redis_arena_reserve(a, len + 1);
+  memcpy(a->strings + a->len, data, len);
+  a->len += len;
+}
+
+/* finishes the last String element (sets the length and a NUL byte) */
+static void redis_arena_end_str(redis_arena_s *a) {
+  redis_reply_s *e = a->elements + a->count - 1;
+  e->len = a->len - (uintptr_t)e->data;
+  redis_arena_reserve(a, 1);
+  a->strings[a->len++] = 0;
+}
+
+/* converts String offsets to pointers (the elements must be writable) */
+static void redis_reply_fixup(redis_reply_s *e, size_t count, char *strings) {
+  for (size_t i = 0; i < count; ++i) {
+    if (e[i].type == REDIS_REPLY_STRING || e[i].type == REDIS_REPLY_ERROR)
+      e[i].data = strings + (uintptr_t)e[i].data;
+  }
+}
+
+/** Returns the element that follows `element` (and its Array members). */
+const redis_reply_s *redis_reply_next(const redis_reply_s *element) {
+  size_t pending = 1;
+  while (pending) {
+    if (element->type == REDIS_REPLY_ARRAY)
+      pending += element->len;
+    --pending;
+    ++element;
+  }
+  return element;
+}
+
+/* converts a (fixed) flat reply to a FIOBJ object (starting at `*pos`) */
+static FIOBJ redis_reply2fiobj(const redis_reply_s **pos) {
+  const redis_reply_s *e = (*pos)++;
+  FIOBJ o;
+  switch ((redis_reply_type_e)e->type) {
+  case REDIS_REPLY_OK:
+    return fiobj_true();
+  case REDIS_REPLY_NUMBER:
+    return fiobj_num_new(e->num);
+  case REDIS_REPLY_STRING:
+    return fiobj_str_new(e->data, e->len);
+  case REDIS_REPLY_ERROR:
+    o = fiobj_str_buf(e->len + 1);
+    fiobj_str_write(o, "-", 1);
+    fiobj_str_write(o, e->data, e->len);
+    return o;
+  case REDIS_REPLY_ARRAY:
+    o = fiobj_ary_new2(e->len);
+    for (size_t i = 0; i < e->len; ++i) {
+      fiobj_ary_push(o, redis_reply2fiobj(pos));
+    }
+    return o;
+  case REDIS_REPLY_NULL:
+    break;
+  }
+  return fiobj_null();
 }
 
 /* *****************************************************************************
 RESP parser callbacks
 ***************************************************************************** */
 
+/* publishing connections decode replies into a flat arena */
+#define resp_arena(i) (&FIO_LS_EMBD_OBJ(redis_pub_s, data, (i))->arena)
+
 /** a local static callback, called when a parser / protocol error occurs. */
 static int resp_on_parser_error(resp_parser_s *parser) {
   struct redis_engine_internal_s *i = parser2data(parser);
@@ -189,6 +526,10 @@ static int resp_on_parser_error(resp_parser_s *parser) {
 /** a local static callback, called when the RESP message is complete. */
 static int resp_on_message(resp_parser_s *parser) {
   struct redis_engine_internal_s *i = parser2data(parser);
+  if (i->flat) {
+    i->on_message(i, FIOBJ_INVALID);
+    return 0;
+  }
   FIOBJ msg = i->ary ? i->ary : i->str;
   i->on_message(i, msg);
   /* cleanup */
@@ -203,12 +544,16 @@ static inline void resp_add_obj(struct redis_engine_internal_s *dest, FIOBJ o) {
   if (dest->ary) {
     fiobj_ary_push(dest->ary, o);
     --dest->ary_count;
-    if (!dest->ary_count && dest->nesting) {
-      FIOBJ tmp = fiobj_ary_shift(dest->ary);
+    /* a nested Array is complete, it's added to its parent */
+    while (!dest->ary_count && dest->nesting) {
+      FIOBJ child = dest->ary;
+      FIOBJ tmp = fiobj_ary_shift(child);
       dest->ary_count = fiobj_obj2num(tmp);
       fiobj_free(tmp);
-      dest->ary = fiobj_ary_shift(dest->ary);
+      dest->ary = fiobj_ary_shift(child);
       --dest->nesting;
+      fiobj_ary_push(dest->ary, child);
+      --dest->ary_count;
     }
   }
   dest->str = o;
@@ -217,18 +562,30 @@ static inline void resp_add_obj(struct redis_engine_internal_s *dest, FIOBJ o) {
 /** a local static callback, called when a Number object is parsed. */
 static int resp_on_number(resp_parser_s *parser, int64_t num) {
   struct redis_engine_internal_s *data = parser2data(parser);
+  if (data->flat) {
+    redis_arena_push(resp_arena(data), REDIS_REPLY_NUMBER)->num = num;
+    return 0;
+  }
   resp_add_obj(data, fiobj_num_new(num));
   return 0;
 }
 /** a local static callback, called when a OK message is received. */
 static int resp_on_okay(resp_parser_s *parser) {
   struct redis_engine_internal_s *data = parser2data(parser);
+  if (data->flat) {
+    redis_arena_push(resp_arena(data), REDIS_REPLY_OK);
+    return 0;
+  }
   resp_add_obj(data, fiobj_true());
   return 0;
 }
 /** a local static callback, called when NULL is received. */
 static int resp_on_null(resp_parser_s *parser) {
   struct redis_engine_internal_s *data = parser2data(parser);
+  if (data->flat) {
+    redis_arena_push(resp_arena(data), REDIS_REPLY_NULL);
+    return 0;
+  }
   resp_add_obj(data, fiobj_null());
   return 0;
 }
@@ -243,12 +600,20 @@ static int resp_on_null(resp_parser_s *parser) {
  */
 static int resp_on_start_string(resp_parser_s *parser, size_t str_len) {
   struct redis_engine_internal_s *data = parser2data(parser);
+  if (data->flat) {
+    redis_arena_push_str(resp_arena(data), REDIS_REPLY_STRING, str_len);
+    return 0;
+  }
   resp_add_obj(data, fiobj_str_buf(str_len));
   return 0;
 }
 /** a local static callback, called as String objects are streamed. */
 static int resp_on_string_chunk(resp_parser_s *parser, void *data, size_t len) {
   struct redis_engine_internal_s *i = parser2data(parser);
+  if (i->flat) {
+    redis_arena_write(resp_arena(i), data, len);
+    return 0;
+  }
   fiobj_str_write(i->str, data, len);
   return 0;
 }
@@ -256,13 +621,22 @@ static int resp_on_string_chunk(resp_parser_s *parser, void *data, size_t len) {
  * streaming.
  */
 static int resp_on_end_string(resp_parser_s *parser) {
+  struct redis_engine_internal_s *i = parser2data(parser);
+  if (i->flat)
+    redis_arena_end_str(resp_arena(i));
   return 0;
-  (void)parser;
 }
 
 /** a local static callback, called an error message is received. */
 static int resp_on_err_msg(resp_parser_s *parser, void *data, size_t len) {
   struct redis_engine_internal_s *i = parser2data(parser);
+  if (i->flat) {
+    /* skip the '-' marker */
+    redis_arena_push_str(resp_arena(i), REDIS_REPLY_ERROR, len);
+    redis_arena_write(resp_arena(i), (char *)data + 1, len - 1);
+    redis_arena_end_str(resp_arena(i));
+    return 0;
+  }
   resp_add_obj(i, fiobj_str_new(data, len));
   return 0;
 }
@@ -282,11 +656,20 @@ static int resp_on_err_msg(resp_parser_s *parser, void *data, size_t len) {
  */
 static int resp_on_start_array(resp_parser_s *parser, size_t array_len) {
   struct redis_engine_internal_s *i = parser2data(parser);
+  if (i->flat) {
+    redis_arena_push(resp_arena(i), REDIS_REPLY_ARRAY)->len = array_len;
+    return 0;
+  }
   if (i->ary) {
+    if (!array_len) {
+      resp_add_obj(i, fiobj_ary_new());
+      return 0;
+    }
+    /* the nested Array starts with its parent's state (count, parent) */
     ++i->nesting;
     FIOBJ tmp = fiobj_ary_new2(array_len + 2);
     fiobj_ary_push(tmp, fiobj_num_new(i->ary_count));
-    fiobj_ary_push(tmp, fiobj_num_new(i->ary));
+    fiobj_ary_push(tmp, i->ary);
     i->ary = tmp;
   } else {
     i->ary = fiobj_ary_new2(array_len + 2);
@@ -299,51 +682,383 @@ static int resp_on_start_array(resp_parser_s *parser, size_t array_len) {
 Publication and Command Handling
 ***************************************************************************** */
 
-/* the deferred callback handler */
-static void redis_perform_callback(void *e, void *cmd_) {
-  redis_commands_s *cmd = cmd_;
-  FIOBJ reply = (FIOBJ)cmd->node.next;
-  if (cmd->callback)
-    cmd->callback(e, reply, cmd->udata);
-  fiobj_free(reply);
-  FIO_LOG_DEBUG("Handled: %s\n", cmd->cmd);
-  fio_free(cmd);
+/* writes the commands collected during the reactor cycle (pipelining) */
+static void redis_flush_cmd(void *c_, void *ignr_) {
+  redis_pub_s *c = c_;
+  fio_lock(&c->lock);
+  c->flush_scheduled = 0;
+  if (c->pending && c->pub_send) {
+    FIO_LOG_DEBUG("(%d) Sending (%zu bytes):\n%s\n", getpid(),
+                  fio_str_len(c->pending), fio_str_data(c->pending));
+    fio_str_send_free2(c->data.uuid, c->pending);
+  } else {
+    fio_str_free2(c->pending);
+  }
+  c->pending = NULL;
+  fio_unlock(&c->lock);
+  redis_free(c->r);
+  (void)ignr_;
+}
+
+/* attach a command to the connection's queue (the lock must be held) */
+static void redis_attach_cmd_unsafe(redis_pub_s *c, redis_commands_s *cmd) {
+  fio_ls_embd_push(&c->queue, &cmd->node);
+  ++c->outstanding;
+  if (c->pub_send) {
+    if (!c->pending)
+      c->pending = fio_str_new2();
+    fio_str_write(c->pending, cmd->cmd, cmd->cmd_len);
+    if (!c->flush_scheduled) {
+      c->flush_scheduled = 1;
+      fio_atomic_add(&c->r->ref, 1);
+      fio_defer(redis_flush_cmd, c, NULL);
+    }
+  }
+}
+
+/*
+ * attach a command to the connection's queue.
+ *
+ * Commands are collected and written together once the current task is done,
+ * so the commands sent during a reactor cycle share a single `write`.
+ */
+static void redis_attach_cmd(redis_pub_s *c, redis_commands_s *cmd) {
+  fio_lock(&c->lock);
+  redis_attach_cmd_unsafe(c, cmd);
+  fio_unlock(&c->lock);
+}
+
+/* picks the connection with the least outstanding commands (if connected) */
+static redis_pub_s *redis_node_pick(redis_node_s *n) {
+  redis_pub_s *c = n->pool;
+  for (size_t i = 1; i < n->count; ++i) {
+    redis_pub_s *o = n->pool + i;
+    if ((o->pub_send && !c->pub_send) ||
+        (o->pub_send == c->pub_send && o->outstanding < c->outstanding))
+      c = o;
+  }
+  return c;
+}
+
+/* *****************************************************************************
+Cluster Slot Routing
+***************************************************************************** */
+
+/* CRC16 (XMODEM), as used by Redis Cluster for key hashing */
+static uint16_t redis_crc16(const uint8_t *data, size_t len) {
+  uint16_t crc = 0;
+  while (len--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for (int i = 0; i < 8; ++i) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021)
+                           : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+/* computes a key's hash slot (honoring `{hash tags}`) */
+static uint16_t redis_key_slot(fio_str_info_s key) {
+  char *start = memchr(key.data, '{', key.len);
+  if (start) {
+    ++start;
+    char *end = memchr(start, '}', key.len - (start - key.data));
+    if (end && end != start) {
+      key.len = end - start;
+      key.data = start;
+    }
+  }
+  return redis_crc16((uint8_t *)key.data, key.len) & (REDIS_CLUSTER_SLOTS - 1);
+}
+
+/* reads a RESP formatted command's argument (0 is the command's name) */
+static fio_str_info_s redis_cmd_arg(uint8_t *cmd, size_t len, size_t index) {
+  fio_str_info_s key = {.data = NULL};
+  char *pos = (char *)cmd + 1;
+  char *end = (char *)cmd + len;
+  if (len < 4 || cmd[0] != '*' || fio_atol(&pos) <= (int64_t)index)
+    return key;
+  for (size_t i = 0; i <= index; ++i) {
+    pos = memchr(pos, '\n', end - pos);
+    if (!pos || ++pos >= end || *pos != '$')
+      return key;
+    char *num = pos + 1;
+    size_t l = (size_t)fio_atol(&num);
+    pos = memchr(pos, '\n', end - pos);
+    if (!pos || (size_t)(end - ++pos) < l)
+      return key;
+    key = (fio_str_info_s){.data = pos, .len = l};
+    pos += l;
+  }
+  return key;
 }
 
-/* attach a command to the queue */
-static void redis_attach_cmd(redis_engine_s *r, redis_commands_s *cmd) {
+/* reads a RESP formatted command's first argument (the key, for most) */
+static inline fio_str_info_s redis_cmd_key(uint8_t *cmd, size_t len) {
+  return redis_cmd_arg(cmd, len, 1);
+}
+
+/* (defined later) finds or adds a node, returning its index (lock held) */
+static size_t redis_node_get_unsafe(redis_engine_s *r, fio_str_info_s address,
+                                    fio_str_info_s port);
+
+/* routes a command to a connection (by slot, when in cluster mode) */
+static void redis_route_cmd(redis_engine_s *r, redis_commands_s *cmd) {
+  size_t index = 0;
+  size_t slot = REDIS_CLUSTER_SLOTS;
+  if (r->slots) {
+    fio_str_info_s key = redis_cmd_key(cmd->cmd, cmd->cmd_len);
+    if (key.data)
+      slot = redis_key_slot(key);
+  }
   fio_lock(&r->lock);
-  fio_ls_embd_push(&r->queue, &cmd->node);
-  if (r->pub_send) {
-    fio_write2(r->pub_data.uuid, .data.buffer = cmd->cmd,
-               .length = cmd->cmd_len, .after.dealloc = FIO_DEALLOC_NOOP);
-    FIO_LOG_DEBUG("(%d) Sending (%zu bytes):\n%s\n", getpid(), cmd->cmd_len,
-                  cmd->cmd);
+  /* the slot map is updated (under the lock) by `redis_cluster_redirect` */
+  if (slot < REDIS_CLUSTER_SLOTS)
+    index = r->slots[slot];
+  redis_node_s *n = r->nodes[index];
+  fio_unlock(&r->lock);
+  redis_attach_cmd(redis_node_pick(n), cmd);
+}
+
+/* handles MOVED / ASK errors, returns 1 if the command was redirected */
+static int redis_cluster_redirect(redis_engine_s *r, redis_commands_s *cmd,
+                                  fio_str_info_s err) {
+  uint8_t ask;
+  char *pos;
+  if (err.len > 6 && !memcmp(err.data, "MOVED ", 6)) {
+    ask = 0;
+    pos = err.data + 6;
+  } else if (err.len > 4 && !memcmp(err.data, "ASK ", 4)) {
+    ask = 1;
+    pos = err.data + 4;
+  } else {
+    return 0;
+  }
+  if (cmd->redirects >= REDIS_MAX_REDIRECTS) {
+    FIO_LOG_WARNING("(redis) too many cluster redirections: %s", err.data);
+    return 0;
   }
+  const uint64_t slot = fio_atol(&pos);
+  char *end = err.data + err.len;
+  char *colon = end;
+  while (colon > pos && colon[-1] != ':')
+    --colon;
+  if (slot >= REDIS_CLUSTER_SLOTS || *pos != ' ' || colon <= pos + 2 ||
+      colon == end)
+    return 0;
+  ++pos;
+  fio_str_info_s address = {.data = pos, .len = (colon - 1) - pos};
+  fio_str_info_s port = {.data = colon, .len = end - colon};
+  fio_lock(&r->lock);
+  size_t index = redis_node_get_unsafe(r, address, port);
+  if (index >= r->node_count) {
+    fio_unlock(&r->lock);
+    return 0;
+  }
+  if (!ask)
+    r->slots[slot] = (uint16_t)index;
+  redis_pub_s *c = redis_node_pick(r->nodes[index]);
   fio_unlock(&r->lock);
+  ++cmd->redirects;
+  FIO_LOG_DEBUG("(redis) slot %zu redirected to %s", (size_t)slot, pos);
+  if (!ask) {
+    redis_attach_cmd(c, cmd);
+    return 1;
+  }
+  /* ASK redirections require an ASKING command before the actual command */
+  redis_commands_s *asking = fio_malloc(sizeof(*asking) + 17);
+  FIO_ASSERT_ALLOC(asking);
+  *asking = (redis_commands_s){.cmd_len = 16};
+  memcpy(asking->cmd, "*1\r\n$6\r\nASKING\r\n\0", 17);
+  fio_lock(&c->lock);
+  redis_attach_cmd_unsafe(c, asking);
+  redis_attach_cmd_unsafe(c, cmd);
+  fio_unlock(&c->lock);
+  return 1;
 }
 
+/* *****************************************************************************
+Command Replies
+***************************************************************************** */
+
 /** a local static callback, called when the RESP message is complete. */
 static void resp_on_pub_message(struct redis_engine_internal_s *i, FIOBJ msg) {
-  redis_engine_s *r = pub2redis(i);
-#if DEBUG
-  FIOBJ json = fiobj_obj2json(msg, 1);
-  FIO_LOG_DEBUG("Redis reply:\n%s\n", fiobj_obj2cstr(json).data);
-  fiobj_free(json);
-#endif
+  redis_pub_s *c = pub2conn(i);
+  redis_engine_s *r = c->r;
+  redis_arena_s *a = &c->arena;
   /* publishing / command parser */
-  fio_lock(&r->lock);
-  fio_ls_embd_s *node = fio_ls_embd_shift(&r->queue);
-  fio_unlock(&r->lock);
-  if (!node) {
+  redis_commands_s *cmd = NULL;
+  ++a->replies;
+  fio_lock(&c->lock);
+  if (fio_ls_embd_any(&c->queue)) {
+    cmd = FIO_LS_EMBD_OBJ(redis_commands_s, node, c->queue.next);
+    if (a->replies < cmd->expected) {
+      /* a pipelined group of commands (`redis_engine_send_many`) */
+      fio_unlock(&c->lock);
+      return;
+    }
+    fio_ls_embd_shift(&c->queue);
+    --c->outstanding;
+  }
+  fio_unlock(&c->lock);
+  if (!cmd) {
     /* TODO: possible ping? from server?! not likely... */
     FIO_LOG_WARNING("(redis %d) received a reply when no command was sent.",
                     getpid());
+    redis_arena_reset(a, 0);
+    return;
+  }
+  if (cmd->expected) {
+    /* the group's replies are wrapped in an Array */
+    redis_arena_push(a, REDIS_REPLY_NULL);
+    memmove(a->elements + 1, a->elements,
+            sizeof(*a->elements) * (a->count - 1));
+    a->elements[0] = (redis_reply_s){.type = REDIS_REPLY_ARRAY,
+                                     .len = cmd->expected};
+  } else if (r->slots && a->elements[0].type == REDIS_REPLY_ERROR &&
+             redis_cluster_redirect(
+                 r, cmd,
+                 (fio_str_info_s){
+                     .data = a->strings + (uintptr_t)a->elements[0].data,
+                     .len = a->elements[0].len})) {
+    redis_arena_reset(a, 0);
+    return;
+  }
+  if (cmd->callback)
+    cmd->callback(&r->en, a, cmd->udata);
+  FIO_LOG_DEBUG("Handled: %s\n", cmd->cmd);
+  fio_free(cmd);
+  redis_arena_reset(a, 0);
+  (void)msg;
+}
+
+/* *****************************************************************************
+Client Side Cache Tracking (Root Process)
+***************************************************************************** */
+
+/* (defined later) connects the seed node's connections (that aren't open) */
+static void redis_pool_connect(redis_engine_s *r);
+
+/*
+ * Publishes a cache operation to all processes (filter -3).
+ *
+ * The channel is the engine's pointer followed by the operation: 'i'
+ * (invalidate the keys in the message), 'f' (flush) or 'd' (disable).
+ */
+static void redis_cache_publish(redis_engine_s *r, char op,
+                                fio_str_info_s keys) {
+  char meta[9];
+  fio_u2str64(meta, (uint64_t)r);
+  meta[8] = op;
+  fio_publish(.filter = -3, .channel.data = meta, .channel.len = 9,
+              .message = keys, .engine = FIO_PUBSUB_CLUSTER, .is_json = 0);
+}
+
+/* callback for the CLIENT TRACKING command (publication connections) */
+static void redis_on_tracking(fio_pubsub_engine_s *e, redis_arena_s *reply,
+                              void *udata) {
+  if (reply->elements[0].type == REDIS_REPLY_ERROR) {
+    FIO_LOG_WARNING("(redis) client side caching disabled, "
+                    "CLIENT TRACKING failed: %.*s",
+                    (int)reply->elements[0].len,
+                    reply->strings + (uintptr_t)reply->elements[0].data);
+    redis_cache_publish((redis_engine_s *)e, 'd', (fio_str_info_s){.len = 0});
+    return;
+  }
+  /* replies read before tracking started might never be invalidated */
+  redis_cache_publish((redis_engine_s *)e, 'f', (fio_str_info_s){.len = 0});
+  (void)udata;
+}
+
+/* creates a CLIENT TRACKING command, redirecting to the subscription */
+static redis_commands_s *redis_tracking_cmd_new(redis_engine_s *r) {
+  static const char head[] = "*5\r\n$6\r\nCLIENT\r\n$8\r\nTRACKING\r\n"
+                             "$2\r\non\r\n$8\r\nREDIRECT\r\n$";
+  char id[24];
+  char id_len[8];
+  const size_t ilen = fio_ltoa(id, r->sub_id, 10);
+  const size_t llen = fio_ltoa(id_len, ilen, 10);
+  const size_t len = sizeof(head) - 1 + llen + 2 + ilen + 2;
+  redis_commands_s *cmd = fio_malloc(sizeof(*cmd) + len + 1);
+  FIO_ASSERT_ALLOC(cmd);
+  *cmd = (redis_commands_s){.cmd_len = len, .callback = redis_on_tracking};
+  uint8_t *pos = cmd->cmd;
+  memcpy(pos, head, sizeof(head) - 1);
+  pos += sizeof(head) - 1;
+  memcpy(pos, id_len, llen);
+  pos += llen;
+  *pos++ = '\r';
+  *pos++ = '\n';
+  memcpy(pos, id, ilen);
+  pos += ilen;
+  *pos++ = '\r';
+  *pos++ = '\n';
+  *pos = 0;
+  return cmd;
+}
+
+/* called once the subscription connection's id is known */
+static void redis_tracking_start(redis_engine_s *r, int64_t id) {
+  r->sub_id = id;
+  r->sub_id_pending = 0;
+  fio_write2(r->sub_data.uuid,
+             .data.buffer = "*2\r\n$9\r\nSUBSCRIBE\r\n"
+                            "$20\r\n__redis__:invalidate\r\n",
+             .length = 46, .after.dealloc = FIO_DEALLOC_NOOP);
+  fio_lock(&r->lock);
+  redis_node_s *n = r->nodes[0];
+  fio_unlock(&r->lock);
+  /* open connections are redirected, new ones do so when connecting */
+  for (size_t p = 0; p < n->count; ++p) {
+    if (n->pool[p].data.uuid != -1)
+      redis_attach_cmd(n->pool + p, redis_tracking_cmd_new(r));
+  }
+  redis_pool_connect(r);
+}
+
+/* handles an invalidation message (a list of keys or NULL for a flush) */
+static void redis_tracking_on_message(redis_engine_s *r, FIOBJ keys) {
+  if (!FIOBJ_TYPE_IS(keys, FIOBJ_T_ARRAY)) {
+    redis_cache_publish(r, 'f', (fio_str_info_s){.len = 0});
     return;
   }
-  node->next = (void *)fiobj_dup(msg);
-  fio_defer(redis_perform_callback, &r->en,
-            FIO_LS_EMBD_OBJ(redis_commands_s, node, node));
+  /* message layout: [key length (4 bytes)][key]... */
+  fio_str_s msg = FIO_STR_INIT;
+  const size_t count = fiobj_ary_count(keys);
+  for (size_t i = 0; i < count; ++i) {
+    fio_str_info_s key = fiobj_obj2cstr(fiobj_ary_index(keys, i));
+    char len[4];
+    fio_u2str32(len, (uint32_t)key.len);
+    fio_str_write(&msg, len, 4);
+    fio_str_write(&msg, key.data, key.len);
+  }
+  redis_cache_publish(r, 'i', fio_str_info(&msg));
+  fio_str_free(&msg);
+}
+
+/* listens to filter -3 for cache invalidation (all processes) */
+static void redis_on_cache_invalidate(fio_msg_s *msg) {
+  redis_engine_s *r = msg->udata1;
+  if (msg->channel.len != 9 ||
+      (void *)fio_str2u64(msg->channel.data) != (void *)r)
+    return;
+  const char op = msg->channel.data[8];
+  if (op == 'd') {
+    r->cache.limit = 0;
+    redis_cache_clear(&r->cache);
+  } else if (op == 'f') {
+    redis_cache_clear(&r->cache);
+  } else if (op == 'i') {
+    char *pos = msg->msg.data;
+    char *end = msg->msg.data + msg->msg.len;
+    while (pos + 4 <= end) {
+      fio_str_info_s key = {.data = pos + 4, .len = fio_str2u32(pos)};
+      if (key.data + key.len > end)
+        return;
+      redis_cache_invalidate(&r->cache, key);
+      pos = key.data + key.len;
+    }
+  }
 }
 
 /* *****************************************************************************
@@ -355,6 +1070,22 @@ static void resp_on_sub_message(struct redis_engine_internal_s *i, FIOBJ msg) {
   redis_engine_s *r = sub2redis(i);
   /* subscriotion parser */
   if (FIOBJ_TYPE(msg) != FIOBJ_T_ARRAY) {
+    if (r->sub_id_pending) {
+      /* the CLIENT ID reply (client side caching) */
+      if (FIOBJ_TYPE_IS(msg, FIOBJ_T_NUMBER)) {
+        redis_tracking_start(r, fiobj_obj2num(msg));
+        return;
+      }
+      if (FIOBJ_TYPE(msg) == FIOBJ_T_STRING &&
+          fiobj_obj2cstr(msg).data[0] == '-') {
+        FIO_LOG_WARNING("(redis) client side caching disabled: %s",
+                        fiobj_obj2cstr(msg).data);
+        r->sub_id_pending = 0;
+        redis_cache_publish(r, 'd', (fio_str_info_s){.len = 0});
+        redis_pool_connect(r);
+        return;
+      }
+    }
     if (FIOBJ_TYPE(msg) != FIOBJ_T_STRING || fiobj_obj2cstr(msg).len != 4 ||
         fiobj_obj2cstr(msg).data[0] != 'P') {
       FIO_LOG_WARNING("(redis) unexpected data format in "
@@ -369,6 +1100,11 @@ static void resp_on_sub_message(struct redis_engine_internal_s *i, FIOBJ msg) {
     // }
     fio_str_info_s tmp = fiobj_obj2cstr(fiobj_ary_index(msg, 0));
     if (tmp.len == 7) { /* "message"  */
+      fio_str_info_s ch = fiobj_obj2cstr(fiobj_ary_index(msg, 1));
+      if (ch.len == 20 && !memcmp(ch.data, "__redis__:invalidate", 20)) {
+        redis_tracking_on_message(r, fiobj_ary_index(msg, 2));
+        return;
+      }
       fiobj_free(r->last_ch);
       r->last_ch = fiobj_dup(fiobj_ary_index(msg, 1));
       fio_publish(.channel = fiobj_obj2cstr(r->last_ch),
@@ -402,9 +1138,9 @@ static void redis_on_data(intptr_t uuid, fio_protocol_s *pr) {
       (struct redis_engine_internal_s *)pr;
   uint8_t *buf;
   if (internal->on_message == resp_on_sub_message) {
-    buf = sub2redis(pr)->buf + REDIS_READ_BUFFER;
+    buf = sub2redis(pr)->buf;
   } else {
-    buf = pub2redis(pr)->buf;
+    buf = pub2conn(pr)->buf;
   }
   ssize_t i = fio_read(uuid, buf + internal->buf_pos,
                        REDIS_READ_BUFFER - internal->buf_pos);
@@ -428,6 +1164,11 @@ static void redis_on_close(intptr_t uuid, fio_protocol_s *pr) {
     r = sub2redis(pr);
     fiobj_free(r->last_ch);
     r->last_ch = FIOBJ_INVALID;
+    r->sub_id_pending = 0;
+    if (r->cache.limit) {
+      /* invalidation messages are lost until the connection is restored */
+      redis_cache_publish(r, 'f', (fio_str_info_s){.len = 0});
+    }
     if (r->flag) {
       /* reconnection for subscription connection. */
       if (uuid != -1) {
@@ -441,15 +1182,28 @@ static void redis_on_close(intptr_t uuid, fio_protocol_s *pr) {
       redis_free(r);
     }
   } else {
-    r = pub2redis(pr);
+    redis_pub_s *c = pub2conn(pr);
+    r = c->r;
     if (r->flag && uuid != -1) {
       FIO_LOG_WARNING("(redis %d) publication connection lost. "
                       "Reconnecting...",
                       (int)getpid());
     }
-    r->pub_send = 0;
-    fio_close(r->sub_data.uuid);
-    redis_free(r);
+    c->pub_send = 0;
+    fio_lock(&r->lock);
+    const uint8_t is_seed = (c->data.address == r->nodes[0]->address);
+    fio_unlock(&r->lock);
+    if (is_seed) {
+      /* reconnects once the subscription connection is established */
+      fio_close(r->sub_data.uuid);
+      redis_free(r);
+    } else if (r->flag) {
+      /* a cluster node (discovered through a redirection) */
+      fio_atomic_sub(&r->ref, 1);
+      defer_redis_connect(r, internal);
+    } else {
+      redis_free(r);
+    }
   }
   (void)uuid;
 }
@@ -471,8 +1225,8 @@ static void redis_sub_ping(intptr_t uuid, fio_protocol_s *pr) {
 
 /** Called on connection timeout. */
 static void redis_pub_ping(intptr_t uuid, fio_protocol_s *pr) {
-  redis_engine_s *r = pub2redis(pr);
-  if (fio_ls_embd_any(&r->queue)) {
+  redis_pub_s *c = pub2conn(pr);
+  if (fio_ls_embd_any(&c->queue)) {
     FIO_LOG_WARNING("(redis) Redis server unresponsive, disconnecting.");
     fio_close(uuid);
     return;
@@ -480,19 +1234,20 @@ static void redis_pub_ping(intptr_t uuid, fio_protocol_s *pr) {
   redis_commands_s *cmd = fio_malloc(sizeof(*cmd) + 15);
   *cmd = (redis_commands_s){.cmd_len = 14};
   memcpy(cmd->cmd, "*1\r\n$4\r\nPING\r\n\0", 15);
-  redis_attach_cmd(r, cmd);
+  redis_attach_cmd(c, cmd);
 }
 
 /* *****************************************************************************
 Connecting to Redis
 ***************************************************************************** */
 
-static void redis_on_auth(fio_pubsub_engine_s *e, FIOBJ reply, void *udata) {
-  if (FIOBJ_TYPE_IS(reply, FIOBJ_T_TRUE)) {
-    fio_str_info_s s = fiobj_obj2cstr(reply);
+static void redis_on_auth(fio_pubsub_engine_s *e, redis_arena_s *reply,
+                          void *udata) {
+  if (reply->elements[0].type == REDIS_REPLY_ERROR) {
     FIO_LOG_WARNING("(redis) Authentication FAILED."
                     "        %.*s",
-                    (int)s.len, s.data);
+                    (int)reply->elements[0].len,
+                    reply->strings + (uintptr_t)reply->elements[0].data);
   }
   (void)e;
   (void)udata;
@@ -509,35 +1264,53 @@ static void redis_on_connect(intptr_t uuid, void *i_) {
       fio_write2(uuid, .data.buffer = r->auth, .length = r->auth_len,
                  .after.dealloc = FIO_DEALLOC_NOOP);
     }
-    fio_pubsub_reattach(&r->en);
-    if (r->pub_data.uuid == -1) {
-      defer_redis_connect(r, &r->pub_data);
+    if (r->cache.limit) {
+      /* the pool connects once the id is known (see redis_tracking_start) */
+      r->sub_id_pending = 1;
+      fio_write2(uuid, .data.buffer = "*2\r\n$6\r\nCLIENT\r\n$2\r\nID\r\n",
+                 .length = 24, .after.dealloc = FIO_DEALLOC_NOOP);
     }
+    fio_pubsub_reattach(&r->en);
+    if (!r->cache.limit)
+      redis_pool_connect(r);
     FIO_LOG_INFO("(redis %d) subscription connection established.",
                  (int)getpid());
   } else {
-    r = pub2redis(i);
+    redis_pub_s *c = pub2conn(i);
+    r = c->r;
+    fio_lock(&c->lock);
+    if (r->cache.limit && r->sub_id) {
+      redis_commands_s *cmd = redis_tracking_cmd_new(r);
+      fio_ls_embd_unshift(&c->queue, &cmd->node);
+      ++c->outstanding;
+    }
     if (r->auth_len) {
       redis_commands_s *cmd = fio_malloc(sizeof(*cmd) + r->auth_len);
       *cmd =
           (redis_commands_s){.cmd_len = r->auth_len, .callback = redis_on_auth};
       memcpy(cmd->cmd, r->auth, r->auth_len);
-      fio_lock(&r->lock);
-      fio_ls_embd_unshift(&r->queue, &cmd->node);
-      fio_unlock(&r->lock);
+      fio_ls_embd_unshift(&c->queue, &cmd->node);
+      ++c->outstanding;
     }
-    fio_lock(&r->lock);
-    FIO_LS_EMBD_FOR(&r->queue, node) {
+    /* the whole queue is resent (pipelined), pending writes are included */
+    fio_str_free2(c->pending);
+    c->pending = NULL;
+    redis_arena_reset(&c->arena, 0);
+    fio_str_s *out = fio_str_new2();
+    FIO_LS_EMBD_FOR(&c->queue, node) {
       redis_commands_s *cmd = FIO_LS_EMBD_OBJ(redis_commands_s, node, node);
       FIO_LOG_DEBUG("(%d) Sending (%zu bytes):\n%s\n", getpid(), cmd->cmd_len,
                     cmd->cmd);
-      fio_write2(uuid, .data.buffer = cmd->cmd, .length = cmd->cmd_len,
-                 .after.dealloc = FIO_DEALLOC_NOOP);
+      fio_str_write(out, cmd->cmd, cmd->cmd_len);
     }
-    r->pub_send = 1;
-    fio_unlock(&r->lock);
-    FIO_LOG_INFO("(redis %d) publication connection established.",
-                 (int)getpid());
+    if (fio_str_len(out))
+      fio_str_send_free2(uuid, out);
+    else
+      fio_str_free2(out);
+    c->pub_send = 1;
+    fio_unlock(&c->lock);
+    FIO_LOG_INFO("(redis %d) publication connection established (%s:%s).",
+                 (int)getpid(), i->address, i->port);
   }
 
   i->protocol.rsv = 0;
@@ -547,6 +1320,17 @@ static void redis_on_connect(intptr_t uuid, void *i_) {
   return;
 }
 
+static void redis_pool_connect(redis_engine_s *r) {
+  fio_lock(&r->lock);
+  redis_node_s *n = r->nodes[0];
+  fio_unlock(&r->lock);
+  for (size_t p = 0; p < n->count; ++p) {
+    if (n->pool[p].data.uuid == -1) {
+      defer_redis_connect(r, &n->pool[p].data);
+    }
+  }
+}
+
 static void redis_on_connect_failed(intptr_t uuid, void *i_) {
   struct redis_engine_internal_s *i = i_;
   i->uuid = -1;
@@ -562,11 +1346,79 @@ static void redis_connect(void *r_, void *i_) {
     return;
   }
   // fio_atomic_add(&r->ref, 1);
-  i->uuid = fio_connect(.address = r->address, .port = r->port,
+  i->uuid = fio_connect(.address = i->address, .port = i->port,
                         .on_connect = redis_on_connect, .udata = i,
                         .on_fail = redis_on_connect_failed);
 }
 
+/* allocates a node (a Redis server) and its connection pool */
+static redis_node_s *redis_node_new(redis_engine_s *r, fio_str_info_s address,
+                                    fio_str_info_s port) {
+  const size_t count = r->pool_size;
+  redis_node_s *n = fio_malloc(sizeof(*n) + (sizeof(n->pool[0]) * count) +
+                               address.len + 1 + port.len + 1);
+  FIO_ASSERT_ALLOC(n);
+  n->count = count;
+  n->address = (char *)(n->pool + count);
+  n->port = n->address + address.len + 1;
+  memcpy(n->address, address.data, address.len);
+  n->address[address.len] = 0;
+  memcpy(n->port, port.data, port.len);
+  n->port[port.len] = 0;
+  for (size_t i = 0; i < count; ++i) {
+    redis_pub_s *c = n->pool + i;
+    *c = (redis_pub_s){
+        .data =
+            {
+                .protocol =
+                    {
+                        .on_data = redis_on_data,
+                        .on_close = redis_on_close,
+                        .on_shutdown = redis_on_shutdown,
+                        .ping = redis_pub_ping,
+                    },
+                .uuid = -1,
+                .on_message = resp_on_pub_message,
+                .flat = 1,
+                .address = n->address,
+                .port = n->port,
+            },
+        .r = r,
+        .lock = FIO_LOCK_INIT,
+    };
+    c->queue = (fio_ls_embd_s)FIO_LS_INIT(c->queue);
+  }
+  return n;
+}
+
+/* finds or adds a node, returning its index (the engine's lock is held) */
+static size_t redis_node_get_unsafe(redis_engine_s *r, fio_str_info_s address,
+                                    fio_str_info_s port) {
+  for (size_t i = 0; i < r->node_count; ++i) {
+    redis_node_s *n = r->nodes[i];
+    if (!strncmp(n->address, address.data, address.len) &&
+        !n->address[address.len] && !strncmp(n->port, port.data, port.len) &&
+        !n->port[port.len])
+      return i;
+  }
+  if (r->node_count >= REDIS_CLUSTER_SLOTS || !r->flag)
+    return (size_t)-1;
+  redis_node_s **tmp = fio_realloc2(r->nodes,
+                                    sizeof(*r->nodes) * (r->node_count + 1),
+                                    sizeof(*r->nodes) * r->node_count);
+  FIO_ASSERT_ALLOC(tmp);
+  r->nodes = tmp;
+  r->nodes[r->node_count] = redis_node_new(r, address, port);
+  /* nodes discovered through redirections connect immediately */
+  if (r->node_count) {
+    redis_node_s *n = r->nodes[r->node_count];
+    for (size_t i = 0; i < n->count; ++i) {
+      defer_redis_connect(r, &n->pool[i].data);
+    }
+  }
+  return r->node_count++;
+}
+
 /* *****************************************************************************
 Engine / Bridge Callbacks (Root Process)
 ***************************************************************************** */
@@ -644,7 +1496,7 @@ static void redis_on_publish_root(const fio_pubsub_engine_s *eng,
   *buf = 0;
   FIO_LOG_DEBUG("(%d) Publishing:\n%s", getpid(), cmd->cmd);
   cmd->cmd_len = (uintptr_t)buf - (uintptr_t)(cmd + 1);
-  redis_attach_cmd(r, cmd);
+  redis_route_cmd(r, cmd);
   return;
   (void)is_json;
 }
@@ -702,8 +1554,8 @@ static void redis_on_internal_publish(fio_msg_s *msg) {
 Sending commands using the Root connection
 ***************************************************************************** */
 
-/* callback from the Redis reply */
-static void redis_forward_reply(fio_pubsub_engine_s *e, FIOBJ reply,
+/* callback from the Redis reply (forwards the flat reply as is) */
+static void redis_forward_reply(fio_pubsub_engine_s *e, redis_arena_s *reply,
                                 void *udata) {
   uint8_t *data = udata;
   fio_pubsub_engine_s *engine = (fio_pubsub_engine_s *)fio_str2u64(data + 0);
@@ -713,10 +1565,18 @@ static void redis_forward_reply(fio_pubsub_engine_s *e, FIOBJ reply,
     return;
   }
   int32_t pid = (int32_t)fio_str2u32(data + 24);
-  FIOBJ rp = fiobj_obj2json(reply, 0);
+  /* message layout: element count (8 bytes), elements, strings */
+  const size_t el_len = sizeof(*reply->elements) * reply->count;
+  fio_str_s rp = FIO_STR_INIT;
+  fio_str_capa_assert(&rp, 8 + el_len + reply->len);
+  char count[8] = {0};
+  fio_u2str64(count, (uint64_t)reply->count);
+  fio_str_write(&rp, count, 8);
+  fio_str_write(&rp, reply->elements, el_len);
+  fio_str_write(&rp, reply->strings, reply->len);
   fio_publish(.filter = (-10 - pid), .channel.data = (char *)data,
-              .channel.len = 28, .message = fiobj_obj2cstr(rp), .is_json = 1);
-  fiobj_free(rp);
+              .channel.len = 33, .message = fio_str_info(&rp), .is_json = 0);
+  fio_str_free(&rp);
 }
 
 /* listens to channel -2 for commands that need to be sent (only ROOT) */
@@ -724,17 +1584,18 @@ static void redis_on_internal_cmd(fio_msg_s *msg) {
   // void*(void *)fio_str2u64(msg->msg.data);
   fio_pubsub_engine_s *engine =
       (fio_pubsub_engine_s *)fio_str2u64(msg->channel.data + 0);
-  if (engine != msg->udata1) {
+  if (engine != msg->udata1 || msg->channel.len < 33) {
     return;
   }
-  redis_commands_s *cmd = fio_malloc(sizeof(*cmd) + msg->msg.len + 1 + 28);
+  redis_commands_s *cmd = fio_malloc(sizeof(*cmd) + msg->msg.len + 1 + 33);
   FIO_ASSERT_ALLOC(cmd);
   *cmd = (redis_commands_s){.callback = redis_forward_reply,
                             .udata = (cmd->cmd + msg->msg.len + 1),
                             .cmd_len = msg->msg.len};
+  cmd->expected = fio_str2u32(msg->channel.data + 28);
   memcpy(cmd->cmd, msg->msg.data, msg->msg.len);
-  memcpy(cmd->cmd + msg->msg.len + 1, msg->channel.data, 28);
-  redis_attach_cmd((redis_engine_s *)engine, cmd);
+  memcpy(cmd->cmd + msg->msg.len + 1, msg->channel.data, 33);
+  redis_route_cmd((redis_engine_s *)engine, cmd);
   // fprintf(stderr, " *** Attached CMD (%d) ***\n%s\n", getpid(), cmd->cmd);
 }
 
@@ -747,13 +1608,144 @@ static void redis_on_internal_reply(fio_msg_s *msg) {
                   (void *)engine, msg->udata1);
     return;
   }
-  FIOBJ reply;
-  fiobj_json2obj(&reply, msg->msg.data, msg->msg.len);
-  void (*callback)(fio_pubsub_engine_s *, FIOBJ, void *) = (void (*)(
-      fio_pubsub_engine_s *, FIOBJ, void *))fio_str2u64(msg->channel.data + 8);
+  const size_t count = (size_t)fio_str2u64(msg->msg.data);
+  const size_t el_len = sizeof(redis_reply_s) * count;
+  if (msg->msg.len < 8 + el_len || !count || msg->channel.len < 33) {
+    FIO_LOG_ERROR("(redis) internal error, bad reply data.");
+    return;
+  }
+  /* a single (aligned) copy, the offsets are converted to pointers */
+  redis_reply_s *reply = fio_malloc(msg->msg.len);
+  FIO_ASSERT_ALLOC(reply);
+  memcpy(reply, msg->msg.data + 8, msg->msg.len - 8);
+  redis_reply_fixup(reply, count, (char *)reply + el_len);
+  const uint64_t callback = fio_str2u64(msg->channel.data + 8);
   void *udata = (void *)fio_str2u64(msg->channel.data + 16);
-  callback(engine, reply, udata);
-  fiobj_free(reply);
+  if (msg->channel.data[32]) {
+    ((void (*)(fio_pubsub_engine_s *, const redis_reply_s *, void *))callback)(
+        engine, reply, udata);
+  } else {
+    const redis_reply_s *pos = reply;
+    FIOBJ o = redis_reply2fiobj(&pos);
+    ((void (*)(fio_pubsub_engine_s *, FIOBJ, void *))callback)(engine, o,
+                                                               udata);
+    fiobj_free(o);
+  }
+  fio_free(reply);
+}
+
+/* publishes RESP formatted command(s) to Root's filter -2 */
+static void redis_forward_cmd(fio_pubsub_engine_s *engine, fio_str_s *cmd,
+                              uint32_t count, uint8_t flat, uint64_t callback,
+                              void *udata) {
+  char meta[33];
+  /* combine metadata */
+  fio_u2str64(meta + 0, (uint64_t)engine);
+  fio_u2str64(meta + 8, callback);
+  fio_u2str64(meta + 16, (uint64_t)udata);
+  fio_u2str32(meta + 24, (uint32_t)getpid());
+  fio_u2str32(meta + 28, count);
+  meta[32] = (char)flat;
+  fio_publish(.filter = -2, .channel.data = meta, .channel.len = 33,
+              .message = fio_str_info(cmd), .engine = FIO_PUBSUB_ROOT,
+              .is_json = 0);
+}
+
+/* a cached command's details, used until the reply is delivered */
+typedef struct {
+  void (*callback)(fio_pubsub_engine_s *e, FIOBJ reply, void *udata);
+  void *udata;
+  FIOBJ key;
+  FIOBJ cmd;
+  FIOBJ reply;
+  uint64_t generation;
+} redis_cache_request_s;
+
+static void redis_cache_request_free(redis_cache_request_s *req) {
+  fiobj_free(req->key);
+  fiobj_free(req->cmd);
+  fiobj_free(req->reply);
+  fio_free(req);
+}
+
+/* tests for the read only (single key) commands that are cached */
+static int redis_cache_is_read(uint8_t *cmd, size_t len) {
+  static const char *names[] = {
+      "GET",    "STRLEN", "GETRANGE", "HGET",   "HMGET",     "HGETALL",
+      "HEXISTS", "HLEN",  "HKEYS",    "HVALS",  "LINDEX",    "LLEN",
+      "LRANGE", "SCARD",  "SISMEMBER", "SMEMBERS", "ZCARD",  "ZRANGE",
+      "ZSCORE", NULL};
+  fio_str_info_s name = redis_cmd_arg(cmd, len, 0);
+  char tmp[16];
+  if (!name.data || name.len >= sizeof(tmp))
+    return 0;
+  for (size_t i = 0; i < name.len; ++i) {
+    tmp[i] = name.data[i];
+    if (tmp[i] >= 'a' && tmp[i] <= 'z')
+      tmp[i] -= ('a' - 'A');
+  }
+  tmp[name.len] = 0;
+  for (size_t i = 0; names[i]; ++i) {
+    if (!strcmp(names[i], tmp))
+      return 1;
+  }
+  return 0;
+}
+
+/* delivers a cached reply */
+static void redis_cache_deliver(void *e, void *req_) {
+  redis_cache_request_s *req = req_;
+  if (req->callback)
+    req->callback(e, req->reply, req->udata);
+  redis_cache_request_free(req);
+}
+
+/* callback from the Redis reply (caches the reply) */
+static void redis_cache_on_reply(fio_pubsub_engine_s *e,
+                                 const redis_reply_s *reply, void *udata) {
+  redis_engine_s *r = (redis_engine_s *)e;
+  redis_cache_request_s *req = udata;
+  const redis_reply_s *pos = reply;
+  req->reply = redis_reply2fiobj(&pos);
+  if (reply->type != REDIS_REPLY_ERROR && r->cache.limit) {
+    size_t size = 0;
+    for (const redis_reply_s *i = reply; i < pos; ++i) {
+      size += sizeof(*i) + (i->type == REDIS_REPLY_ARRAY ? 0 : i->len);
+    }
+    redis_cache_store(&r->cache, req->key, req->generation, req->cmd,
+                      req->reply, size);
+  }
+  redis_cache_deliver(e, req);
+}
+
+/* returns -1 if the command isn't cached, otherwise it's handled */
+static int redis_cache_send(redis_engine_s *r, fio_str_s *cmd,
+                            void (*callback)(fio_pubsub_engine_s *e,
+                                             FIOBJ reply, void *udata),
+                            void *udata) {
+  if (!r->cache.limit)
+    return -1;
+  fio_str_info_s c = fio_str_info(cmd);
+  if (!redis_cache_is_read((uint8_t *)c.data, c.len))
+    return -1;
+  fio_str_info_s key = redis_cmd_key((uint8_t *)c.data, c.len);
+  if (!key.data)
+    return -1;
+  redis_cache_request_s *req = fio_malloc(sizeof(*req));
+  FIO_ASSERT_ALLOC(req);
+  *req = (redis_cache_request_s){
+      .callback = callback,
+      .udata = udata,
+      .key = fiobj_str_new(key.data, key.len),
+      .cmd = fiobj_str_new(c.data, c.len),
+  };
+  req->reply = redis_cache_get(&r->cache, req->key, req->cmd, &req->generation);
+  if (req->reply) {
+    fio_defer(redis_cache_deliver, r, req);
+    return 0;
+  }
+  redis_forward_cmd(&r->en, cmd, 0, 1, (uint64_t)redis_cache_on_reply, req);
+  return 0;
 }
 
 /* publishes a Redis command to Root's filter -2 */
@@ -765,23 +1757,54 @@ intptr_t redis_engine_send(fio_pubsub_engine_s *engine, FIOBJ command,
     FIO_LOG_WARNING("(redis send) trying to use one of the core engines");
     return -1;
   }
-  // if(fio_is_master()) {
-  // FIOBJ resp = fiobj2resp_tmp(fio_str_info_s obj1, FIOBJ obj2);
-  // TODO...
-  // } else {
   /* forward publication request to Root */
-  fio_str_s tmp = FIO_STR_INIT;
-  fio_str_info_s ti = fio_str_resize(&tmp, 28);
-  /* combine metadata */
-  fio_u2str64(ti.data + 0, (uint64_t)engine);
-  fio_u2str64(ti.data + 8, (uint64_t)callback);
-  fio_u2str64(ti.data + 16, (uint64_t)udata);
-  fio_u2str32(ti.data + 24, (uint32_t)getpid());
-  FIOBJ cmd = fiobj2resp_tmp(command);
-  fio_publish(.filter = -2, .channel = ti, .message = fiobj_obj2cstr(cmd),
-              .engine = FIO_PUBSUB_ROOT, .is_json = 0);
-  fio_str_free(&tmp);
-  // }
+  fio_str_s cmd = FIO_STR_INIT;
+  fiobj2resp(&cmd, command);
+  if (redis_cache_send((redis_engine_s *)engine, &cmd, callback, udata))
+    redis_forward_cmd(engine, &cmd, 0, 0, (uint64_t)callback, udata);
+  fio_str_free(&cmd);
+  return 0;
+}
+
+/* publishes a Redis command to Root's filter -2 (flat reply) */
+intptr_t redis_engine_send_flat(fio_pubsub_engine_s *engine, FIOBJ command,
+                                void (*callback)(fio_pubsub_engine_s *e,
+                                                 const redis_reply_s *reply,
+                                                 void *udata),
+                                void *udata) {
+  if ((uintptr_t)engine < 4) {
+    FIO_LOG_WARNING("(redis send) trying to use one of the core engines");
+    return -1;
+  }
+  fio_str_s cmd = FIO_STR_INIT;
+  fiobj2resp(&cmd, command);
+  redis_forward_cmd(engine, &cmd, 0, 1, (uint64_t)callback, udata);
+  fio_str_free(&cmd);
+  return 0;
+}
+
+/* publishes a group of Redis commands to Root's filter -2 */
+intptr_t redis_engine_send_many(fio_pubsub_engine_s *engine, FIOBJ commands,
+                                void (*callback)(fio_pubsub_engine_s *e,
+                                                 FIOBJ replies, void *udata),
+                                void *udata) {
+  if ((uintptr_t)engine < 4) {
+    FIO_LOG_WARNING("(redis send) trying to use one of the core engines");
+    return -1;
+  }
+  if (!FIOBJ_TYPE_IS(commands, FIOBJ_T_ARRAY) || !fiobj_ary_count(commands) ||
+      fiobj_ary_count(commands) > UINT32_MAX) {
+    FIO_LOG_WARNING("(redis send) expecting a non-empty Array of commands");
+    return -1;
+  }
+  const size_t count = fiobj_ary_count(commands);
+  fio_str_s cmd = FIO_STR_INIT;
+  for (size_t i = 0; i < count; ++i) {
+    fiobj2resp(&cmd, fiobj_ary_index(commands, (int64_t)i));
+  }
+  redis_forward_cmd(engine, &cmd, (uint32_t)count, 0, (uint64_t)callback,
+                    udata);
+  fio_str_free(&cmd);
   return 0;
 }
 
@@ -807,12 +1830,13 @@ static void redis_on_engine_fork(void *r_) {
   r->lock = FIO_LOCK_INIT;
   fio_force_close(r->sub_data.uuid);
   r->sub_data.uuid = -1;
-  fio_force_close(r->pub_data.uuid);
-  r->pub_data.uuid = -1;
-  while (fio_ls_embd_any(&r->queue)) {
-    redis_commands_s *cmd =
-        FIO_LS_EMBD_OBJ(redis_commands_s, node, fio_ls_embd_pop(&r->queue));
-    fio_free(cmd);
+  for (size_t n = 0; n < r->node_count; ++n) {
+    for (size_t i = 0; i < r->nodes[n]->count; ++i) {
+      redis_pub_s *c = r->nodes[n]->pool + i;
+      c->lock = FIO_LOCK_INIT;
+      fio_force_close(c->data.uuid);
+      redis_pub_clear(c);
+    }
   }
   r->en = (fio_pubsub_engine_s){
       .subscribe = redis_on_mock_subscribe_child,
@@ -823,6 +1847,8 @@ static void redis_on_engine_fork(void *r_) {
   r->publication_forwarder = NULL;
   fio_unsubscribe(r->cmd_forwarder);
   r->cmd_forwarder = NULL;
+  r->cache.lock = FIO_LOCK_INIT;
+  redis_cache_clear(&r->cache);
   fio_unsubscribe(r->cmd_reply);
   r->cmd_reply =
       fio_subscribe(.filter = -10 - (int32_t)getpid(),
@@ -852,9 +1878,11 @@ FIO_IGNORE_MACRO(struct redis_engine_create_args args) {
   if (!args.port.data || !args.port.len) {
     args.port = (fio_str_info_s){.len = 4, .data = (char *)"6379"};
   }
+  if (!args.pool_size)
+    args.pool_size = 1;
   redis_engine_s *r =
       fio_malloc(sizeof(*r) + args.port.len + 1 + args.address.len + 1 +
-                 args.auth.len + 1 + (REDIS_READ_BUFFER * 2));
+                 args.auth.len + 1 + REDIS_READ_BUFFER);
   FIO_ASSERT_ALLOC(r);
   *r = (redis_engine_s){
       .en =
@@ -863,18 +1891,6 @@ FIO_IGNORE_MACRO(struct redis_engine_create_args args) {
               .unsubscribe = redis_on_unsubscribe_root,
               .publish = redis_on_publish_root,
           },
-      .pub_data =
-          {
-              .protocol =
-                  {
-                      .on_data = redis_on_data,
-                      .on_close = redis_on_close,
-                      .on_shutdown = redis_on_shutdown,
-                      .ping = redis_pub_ping,
-                  },
-              .uuid = -1,
-              .on_message = resp_on_pub_message,
-          },
       .sub_data =
           {
               .protocol =
@@ -887,6 +1903,10 @@ FIO_IGNORE_MACRO(struct redis_engine_create_args args) {
               .on_message = resp_on_sub_message,
               .uuid = -1,
           },
+      .address = ((char *)(r->buf + REDIS_READ_BUFFER) + 0),
+      .port = ((char *)(r->buf + REDIS_READ_BUFFER) + args.address.len + 1),
+      .auth = ((char *)(r->buf + REDIS_READ_BUFFER) + args.address.len +
+               args.port.len + 2),
       .publication_forwarder =
           fio_subscribe(.filter = -1, .udata1 = r,
                         .on_message = redis_on_internal_publish),
@@ -895,20 +1915,44 @@ FIO_IGNORE_MACRO(struct redis_engine_create_args args) {
       .cmd_reply =
           fio_subscribe(.filter = -10 - (uint32_t)getpid(), .udata1 = r,
                         .on_message = redis_on_internal_reply),
-      .address = ((char *)(r + 1) + 0),
-      .port = ((char *)(r + 1) + args.address.len + 1),
-      .auth = ((char *)(r + 1) + args.address.len + args.port.len + 2),
+      .cache_invalidation =
+          fio_subscribe(.filter = -3, .udata1 = r,
+                        .on_message = redis_on_cache_invalidate),
+      .cache =
+          {
+              .set = FIO_SET_INIT,
+              .limit = args.cache_limit,
+              .lock = FIO_LOCK_INIT,
+          },
       .auth_len = args.auth.len,
       .ref = 1,
-      .queue = FIO_LS_INIT(r->queue),
       .lock = FIO_LOCK_INIT,
       .ping_int = args.ping_interval,
+      .pool_size = args.pool_size,
       .flag = 1,
   };
   memcpy(r->address, args.address.data, args.address.len);
+  r->address[args.address.len] = 0;
   memcpy(r->port, args.port.data, args.port.len);
+  r->port[args.port.len] = 0;
   if (args.auth.len)
     memcpy(r->auth, args.auth.data, args.auth.len);
+  r->auth[args.auth.len] = 0;
+  r->sub_data.address = r->address;
+  r->sub_data.port = r->port;
+  r->cache.lru = (fio_ls_embd_s)FIO_LS_INIT(r->cache.lru);
+  /* the first node (the seed) is connected once the subscription connects */
+  redis_node_get_unsafe(r, args.address, args.port);
+  if (args.cluster) {
+    r->slots = fio_malloc(sizeof(*r->slots) * REDIS_CLUSTER_SLOTS);
+    FIO_ASSERT_ALLOC(r->slots);
+    memset(r->slots, 0, sizeof(*r->slots) * REDIS_CLUSTER_SLOTS);
+    if (r->cache.limit) {
+      FIO_LOG_WARNING("(redis) client side caching isn't supported in "
+                      "cluster mode, disabled.");
+      r->cache.limit = 0;
+    }
+  }
   fio_pubsub_attach(&r->en);
   redis_on_facil_start(r);
   fio_state_callback_add(FIO_CALL_IN_CHILD, redis_on_engine_fork, r);
@@ -934,3 +1978,192 @@ void redis_engine_destroy(fio_pubsub_engine_s *engine) {
   FIO_LOG_DEBUG("Redis engine destroyed %p", (void *)r);
   redis_free(r);
 }
+
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+
+#if DEBUG
+#include <sys/socket.h>
+
+/* the callbacks append their label and reply (as JSON) to the log */
+static char redis_test_log[256];
+
+static void redis_test_log_reply(void *label, FIOBJ reply) {
+  const size_t len = strlen(redis_test_log);
+  fio_str_info_s json = fiobj_obj2cstr(reply);
+  FIOBJ tmp = FIOBJ_INVALID;
+  if (FIOBJ_TYPE_IS(reply, FIOBJ_T_ARRAY)) {
+    tmp = fiobj_obj2json(reply, 0);
+    json = fiobj_obj2cstr(tmp);
+  }
+  snprintf(redis_test_log + len, sizeof(redis_test_log) - len, "%s=%s;",
+           (char *)label, json.data);
+  fiobj_free(tmp);
+}
+
+static void redis_test_on_reply(fio_pubsub_engine_s *e, FIOBJ reply,
+                                void *udata) {
+  redis_test_log_reply(udata, reply);
+  (void)e;
+}
+
+static void redis_test_on_flat(fio_pubsub_engine_s *e,
+                               const redis_reply_s *reply, void *udata) {
+  const redis_reply_s *pos = reply;
+  FIOBJ o = redis_reply2fiobj(&pos);
+  redis_test_log_reply(udata, o);
+  fiobj_free(o);
+  (void)e;
+}
+
+static void redis_test_on_arena(fio_pubsub_engine_s *e, redis_arena_s *reply,
+                                void *udata) {
+  /* String elements use offsets until the reply is delivered */
+  redis_reply_fixup(reply->elements, reply->count, reply->strings);
+  redis_test_on_flat(e, reply->elements, udata);
+}
+
+/* a command with a callback that's called with the reply arena */
+static redis_commands_s *redis_test_cmd(char *resp, char *label) {
+  const size_t len = strlen(resp);
+  redis_commands_s *cmd = fio_malloc(sizeof(*cmd) + len + 1);
+  FIO_ASSERT_ALLOC(cmd);
+  *cmd = (redis_commands_s){
+      .callback = redis_test_on_arena, .udata = label, .cmd_len = len};
+  memcpy(cmd->cmd, resp, len + 1);
+  return cmd;
+}
+
+/* flushes the connection and reads whatever the peer's end received */
+static size_t redis_test_drain(intptr_t uuid, int fd, char *buf, size_t capa) {
+  size_t total = 0;
+  for (size_t i = 0; i < 64; ++i) {
+    fio_flush(uuid);
+    ssize_t r = recv(fd, buf + total, capa - 1 - total, MSG_DONTWAIT);
+    if (r > 0)
+      total += r;
+    else if (total)
+      break;
+  }
+  buf[total] = 0;
+  return total;
+}
+
+/* writes the replies to the peer's end and lets the connection read them */
+static void redis_test_feed(redis_pub_s *c, int fd, char *data) {
+  const size_t len = strlen(data);
+  FIO_ASSERT(write(fd, data, len) == (ssize_t)len, "(redis) test write failed");
+  c->data.protocol.on_data(c->data.uuid, &c->data.protocol);
+  fio_defer_perform();
+}
+
+void redis_engine_test(void) {
+  fprintf(stderr, "=== Testing the Redis engine (command pipelining)\n");
+  char buf[1024];
+  /* the engine can't connect (the reactor isn't running) */
+  redis_engine_s *r = (redis_engine_s *)redis_engine_create(.pool_size = 1);
+  fio_defer_perform();
+  FIO_ASSERT(r->ref == 1 && r->node_count == 1 && r->nodes[0]->count == 1,
+             "(redis) engine setup error");
+  redis_pub_s *c = r->nodes[0]->pool;
+
+  /* commands attached before the connection is established are queued */
+  redis_attach_cmd(c, redis_test_cmd("*1\r\n$4\r\nPING\r\n", "ping"));
+  FIO_ASSERT(!c->pending && !c->flush_scheduled && c->outstanding == 1,
+             "(redis) commands shouldn't be written before connecting");
+  int fds[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds), "socketpair failed");
+  FIO_ASSERT(fio_set_non_block(fds[0]) != -1, "non-blocking mode failed");
+  fio_atomic_add(&r->ref, 1); /* held by the connection (see redis_connect) */
+  c->data.uuid = fio_fd2uuid(fds[0]);
+  redis_on_connect(c->data.uuid, &c->data);
+  FIO_ASSERT(redis_test_drain(c->data.uuid, fds[1], buf, sizeof(buf)) == 14 &&
+                 !strcmp(buf, "*1\r\n$4\r\nPING\r\n"),
+             "(redis) queued commands should be sent once connected");
+
+  /* commands attached during a task are collected and written together */
+  redis_route_cmd(r, redis_test_cmd("*2\r\n$3\r\nGET\r\n$1\r\na\r\n", "a"));
+  redis_route_cmd(r, redis_test_cmd("*2\r\n$3\r\nGET\r\n$1\r\nb\r\n", "b"));
+  FIO_ASSERT(c->pending && c->flush_scheduled && r->ref == 3 &&
+                 c->outstanding == 3 &&
+                 !strcmp(fio_str_data(c->pending),
+                         "*2\r\n$3\r\nGET\r\n$1\r\na\r\n"
+                         "*2\r\n$3\r\nGET\r\n$1\r\nb\r\n"),
+             "(redis) pending commands should share a single buffer");
+  fio_defer_perform();
+  FIO_ASSERT(!c->pending && !c->flush_scheduled && r->ref == 2,
+             "(redis) the pending buffer should be flushed once");
+  FIO_ASSERT(redis_test_drain(c->data.uuid, fds[1], buf, sizeof(buf)) == 40 &&
+                 !strcmp(buf, "*2\r\n$3\r\nGET\r\n$1\r\na\r\n"
+                              "*2\r\n$3\r\nGET\r\n$1\r\nb\r\n"),
+             "(redis) pipelined write error: %s", buf);
+
+  /* replies are matched by order (a reply may be split between reads) */
+  redis_test_log[0] = 0;
+  redis_test_feed(c, fds[1], "+PONG\r\n$1\r\n1\r");
+  FIO_ASSERT(!strcmp(redis_test_log, "ping=PONG;") && c->outstanding == 2,
+             "(redis) reply order error: %s", redis_test_log);
+  redis_test_feed(c, fds[1], "\n$-1\r\n");
+  FIO_ASSERT(!strcmp(redis_test_log, "ping=PONG;a=1;b=null;") &&
+                 !c->outstanding && fio_ls_embd_is_empty(&c->queue),
+             "(redis) reply order error: %s", redis_test_log);
+
+  /*
+   * A group of commands is a single queue entry, expecting all the replies.
+   * The public API forwards the replies using pub/sub (since the cluster isn't
+   * running, an error is logged for every reply).
+   */
+  FIOBJ cmd = fiobj_ary_new();
+  fiobj_ary_push(cmd, fiobj_str_new("GET", 3));
+  fiobj_ary_push(cmd, fiobj_str_new("x", 1));
+  FIOBJ group = fiobj_ary_new();
+  for (size_t i = 0; i < 3; ++i) {
+    FIOBJ incr = fiobj_ary_new();
+    fiobj_ary_push(incr, fiobj_str_new("INCR", 4));
+    fiobj_ary_push(incr, fiobj_str_new("n", 1));
+    fiobj_ary_push(group, incr);
+  }
+  FIO_ASSERT(redis_engine_send_many(&r->en, fiobj_ary_new(),
+                                    redis_test_on_reply, "none") == -1,
+             "(redis) an empty group should be rejected");
+  redis_engine_send(&r->en, cmd, redis_test_on_reply, "x");
+  redis_engine_send_many(&r->en, group, redis_test_on_reply, "many");
+  redis_engine_send_flat(&r->en, cmd, redis_test_on_flat, "flat");
+  fiobj_free(cmd);
+  fiobj_free(group);
+  fio_defer_perform();
+  FIO_ASSERT(c->outstanding == 3 && r->ref == 2,
+             "(redis) the group should be queued as a single command");
+  {
+    redis_commands_s *many = FIO_LS_EMBD_OBJ(
+        redis_commands_s, node, c->queue.next->next);
+    FIO_ASSERT(many->expected == 3 && !strcmp((char *)many->cmd,
+                                              "*2\r\n$4\r\nINCR\r\n$1\r\nn\r\n"
+                                              "*2\r\n$4\r\nINCR\r\n$1\r\nn\r\n"
+                                              "*2\r\n$4\r\nINCR\r\n$1\r\nn\r\n"),
+               "(redis) the group's commands should be concatenated");
+  }
+  FIO_ASSERT(redis_test_drain(c->data.uuid, fds[1], buf, sizeof(buf)) ==
+                 (20 * 2) + (21 * 3),
+             "(redis) the commands should be written together: %s", buf);
+  redis_test_log[0] = 0;
+  redis_test_feed(c, fds[1], "$1\r\nX\r\n:1\r\n:2\r\n");
+  FIO_ASSERT(!strcmp(redis_test_log, "x=X;") && c->outstanding == 2,
+             "(redis) a partial group shouldn't be delivered: %s",
+             redis_test_log);
+  redis_test_feed(c, fds[1], ":3\r\n$1\r\nY\r\n");
+  FIO_ASSERT(!strcmp(redis_test_log, "x=X;many=[1,2,3];flat=Y;") &&
+                 !c->outstanding,
+             "(redis) group reply error: %s", redis_test_log);
+
+  fio_force_close(c->data.uuid);
+  fio_defer_perform();
+  close(fds[1]);
+  FIO_ASSERT(r->ref == 1, "(redis) the connection wasn't released");
+  redis_engine_destroy(&r->en);
+  fio_defer_perform();
+  fprintf(stderr, "* passed.\n");
+}
+
+#endif
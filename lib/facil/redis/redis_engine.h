@@ -15,6 +15,34 @@ Feel free to copy, use and enjoy according to the license provided.
 extern "C" {
 #endif
 
+/** The possible types of a Redis reply element (see `redis_reply_s`). */
+typedef enum {
+  REDIS_REPLY_NULL = 0,
+  REDIS_REPLY_OK,
+  REDIS_REPLY_NUMBER,
+  REDIS_REPLY_STRING,
+  REDIS_REPLY_ERROR,
+  REDIS_REPLY_ARRAY,
+} redis_reply_type_e;
+
+/**
+ * A flat Redis reply element.
+ *
+ * Replies are delivered as a single block of elements, ordered by appearance.
+ * An Array element is followed by its `len` members (which might be Arrays,
+ * followed by their own members).
+ */
+typedef struct {
+  /** String data (NUL terminated) for Strings and errors, otherwise NULL. */
+  const char *data;
+  /** The String length or the number of members in an Array. */
+  size_t len;
+  /** The value of a Number element. */
+  int64_t num;
+  /** The element's type (see `redis_reply_type_e`). */
+  uint8_t type;
+} redis_reply_s;
+
 /** possible arguments for the `redis_engine_create` function call */
 struct redis_engine_create_args {
   /** Redis server's address, defaults to localhost. */
@@ -25,6 +53,12 @@ struct redis_engine_create_args {
   fio_str_info_s auth;
   /** A `ping` will be sent every `ping_interval` interval or inactivity. */
   uint8_t ping_interval;
+  /** The number of command connections per Redis server, defaults to 1. */
+  uint8_t pool_size;
+  /** If set, commands are routed to Redis Cluster shards by hash slot. */
+  uint8_t cluster;
+  /** The client side cache's size limit (per process, in bytes), 0 = off. */
+  size_t cache_limit;
 };
 
 /**
@@ -36,6 +70,24 @@ struct redis_engine_create_args {
  * default value (0) will fallback to facil.io's maximum time of inactivity (5
  * minutes) before polling on the connection's protocol.
  *
+ * Commands are sent using a pool of `pool_size` connections (the connection
+ * with the least outstanding commands is used), so a slow reply doesn't block
+ * the commands that follow. The Pub/Sub subscriptions use a separate
+ * connection.
+ *
+ * When `cluster` is set, commands are routed to the Redis Cluster shard that
+ * owns the command's key (the first argument). The shards are discovered
+ * through `MOVED` and `ASK` redirections, starting with the server at
+ * `address`. Commands sent using `redis_engine_send_many` are routed by the
+ * first command's key, so grouped commands should share a `{hash tag}`.
+ *
+ * When `cache_limit` is set, the replies to read only, single key commands
+ * (i.e., `GET`, `HGETALL`, `LRANGE`, `SMEMBERS`, etc') sent using
+ * `redis_engine_send` are cached by each process (up to `cache_limit` bytes
+ * per process, least recently used replies are evicted first). Redis (6.0 or
+ * later) tracks the keys and the cached replies are invalidated when the keys
+ * change. Client side caching isn't available in cluster mode.
+ *
  * function names speak for themselves ;-)
  *
  * Note: The Redis engine assumes it will stay alive until all the messages and
@@ -58,12 +110,62 @@ fio_pubsub_engine_s *redis_engine_create(struct redis_engine_create_args);
  * Note: NEVER call Pub/Sub commands using this function, as it will violate the
  * Redis connection's protocol (best case scenario, a disconnection will occur
  * before and messages are lost).
+ *
+ * Note: when the reply is cached (see `cache_limit`), the same reply object is
+ * shared by all the callbacks and MUST NOT be edited (use `fiobj_dup` to keep
+ * it).
  */
 intptr_t redis_engine_send(fio_pubsub_engine_s *engine, FIOBJ command,
                            void (*callback)(fio_pubsub_engine_s *e, FIOBJ reply,
                                             void *udata),
                            void *udata);
 
+/**
+ * Sends a group of Redis commands through the engine's connection.
+ *
+ * `commands` is an Array of commands (each command is an Array, same as the
+ * `command` argument for `redis_engine_send`). The commands are pipelined and
+ * the callback is called once, with an Array containing all the replies (in
+ * order).
+ *
+ * The same notes and limitations as `redis_engine_send` apply.
+ *
+ * Returns -1 on error (i.e., when `commands` isn't a non-empty Array).
+ */
+intptr_t redis_engine_send_many(fio_pubsub_engine_s *engine, FIOBJ commands,
+                                void (*callback)(fio_pubsub_engine_s *e,
+                                                 FIOBJ replies, void *udata),
+                                void *udata);
+
+/**
+ * Sends a Redis command through the engine's connection, the reply is
+ * delivered as a flat block of elements (see `redis_reply_s`).
+ *
+ * The reply is decoded without creating any objects (a single allocation per
+ * reply), which is faster for large replies (i.e., `MGET` or `HGETALL`). The
+ * reply data is only valid during the callback.
+ *
+ * The same notes and limitations as `redis_engine_send` apply.
+ */
+intptr_t redis_engine_send_flat(fio_pubsub_engine_s *engine, FIOBJ command,
+                                void (*callback)(fio_pubsub_engine_s *e,
+                                                 const redis_reply_s *reply,
+                                                 void *udata),
+                                void *udata);
+
+/**
+ * Returns the element that follows `element` (skipping any Array members).
+ *
+ * i.e., to walk the members of an Array element:
+ *
+ *      const redis_reply_s *pos = reply + 1;
+ *      for (size_t i = 0; i < reply->len; ++i) {
+ *        // ... use `pos`
+ *        pos = redis_reply_next(pos);
+ *      }
+ */
+const redis_reply_s *redis_reply_next(const redis_reply_s *element);
+
 /**
  * See the {pubsub.h} file for documentation about engines.
  *
@@ -71,6 +173,10 @@ intptr_t redis_engine_send(fio_pubsub_engine_s *engine, FIOBJ command,
  */
 void redis_engine_destroy(fio_pubsub_engine_s *engine);
 
+#if DEBUG
+void redis_engine_test(void);
+#endif
+
 /* support C++ */
 #ifdef __cplusplus
 }
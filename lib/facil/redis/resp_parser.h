@@ -230,7 +230,7 @@ static size_t resp_parse(resp_parser_s *parser, const void *buffer,
         goto finish;
       }
       resp_on_string_chunk(parser, (void *)(pos + 1),
-                           (size_t)((uintptr_t)eol - (uintptr_t)pos - 1));
+                           (size_t)((uintptr_t)eol - (uintptr_t)pos - 2));
       resp_on_end_string(parser);
       --parser->obj_countdown;
       break;
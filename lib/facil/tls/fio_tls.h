@@ -18,6 +18,33 @@ Feel free to copy, use and enjoy according to the license provided.
 #define FIO_TLS_PRINT_SECRET 0
 #endif
 
+#ifndef FIO_TLS_KTLS
+/**
+ * If true, kernel TLS is used when both the TLS library and the kernel support
+ * it (OpenSSL 3.x). Once the kernel handles both directions of a connection,
+ * the connection reverts to the default read/write hooks, so files are sent
+ * using `sendfile` and no user space encryption (or copy) is performed.
+ */
+#define FIO_TLS_KTLS 1
+#endif
+
+#ifndef FIO_TLS_SESSION_LIFETIME
+/**
+ * The default lifetime (in seconds) of a resumable TLS session. Session ticket
+ * keys rotate at this interval. See `fio_tls_session_lifetime`.
+ */
+#define FIO_TLS_SESSION_LIFETIME 7200
+#endif
+
+#ifndef FIO_TLS_HANDSHAKE_OFFLOAD
+/**
+ * If true, new TLS objects perform the handshake's cryptography using the
+ * blocking task pool (see `fio_defer_blocking`) rather than the thread that
+ * handles the connection's IO events. See `fio_tls_handshake_offload`.
+ */
+#define FIO_TLS_HANDSHAKE_OFFLOAD 0
+#endif
+
 /** An opaque type used for the SSL/TLS functions. */
 typedef struct fio_tls_s fio_tls_s;
 
@@ -78,6 +105,32 @@ void fio_tls_alpn_add(fio_tls_s *tls, const char *protocol_name,
  */
 uintptr_t fio_tls_alpn_count(fio_tls_s *tls);
 
+/**
+ * Sets the lifetime (in seconds) of resumable TLS sessions, which is also the
+ * session ticket key rotation interval. Zero (0) disables session resumption.
+ *
+ * The default is `FIO_TLS_SESSION_LIFETIME`.
+ *
+ * Ticket keys are derived from a secret shared by all the worker processes, so
+ * a session can be resumed on any worker. For this to work, the TLS object
+ * must be created by the root process (before `fio_start` is called).
+ */
+void fio_tls_session_lifetime(fio_tls_s *tls, uint32_t seconds);
+
+/**
+ * Enables (or disables) handshake offloading for new connections.
+ *
+ * When enabled, the handshake steps (`SSL_accept` / `SSL_connect`, including
+ * the key exchange and certificate signing) run on the blocking task pool and
+ * the connection resumes on the IO thread pool once a step is complete. This
+ * keeps the IO threads responsive during connection storms, at the price of a
+ * context switch per handshake step and an extra file descriptor for each
+ * connection that is still performing its handshake.
+ *
+ * The default is `FIO_TLS_HANDSHAKE_OFFLOAD`.
+ */
+void fio_tls_handshake_offload(fio_tls_s *tls, uint8_t enable);
+
 /**
  * Adds a certificate to the "trust" list, which automatically adds a peer
  * verification requirement.
@@ -126,4 +179,9 @@ void fio_tls_dup(fio_tls_s *tls);
  */
 void fio_tls_destroy(fio_tls_s *tls);
 
+#if DEBUG
+/** Tests the SSL/TLS implementation (if a library is available). */
+void fio_tls_test(void);
+#endif
+
 #endif
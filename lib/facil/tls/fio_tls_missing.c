@@ -554,6 +554,27 @@ uintptr_t FIO_TLS_WEAK fio_tls_alpn_count(fio_tls_s *tls) {
   return tls ? alpn_list_count(&tls->alpn) : 0;
 }
 
+/**
+ * Sets the lifetime (in seconds) of resumable TLS sessions, which is also the
+ * session ticket key rotation interval. Zero (0) disables session resumption.
+ */
+void FIO_TLS_WEAK fio_tls_session_lifetime(fio_tls_s *tls, uint32_t seconds) {
+  REQUIRE_LIBRARY();
+  /* TODO: Library specific implementation */
+  (void)tls;
+  (void)seconds;
+}
+
+/**
+ * Enables (or disables) handshake offloading for new connections.
+ */
+void FIO_TLS_WEAK fio_tls_handshake_offload(fio_tls_s *tls, uint8_t enable) {
+  REQUIRE_LIBRARY();
+  /* TODO: Library specific implementation */
+  (void)tls;
+  (void)enable;
+}
+
 /**
  * Adds a certificate to the "trust" list, which automatically adds a peer
  * verification requirement.
@@ -631,4 +652,9 @@ void FIO_TLS_WEAK fio_tls_destroy(fio_tls_s *tls) {
   free(tls);
 }
 
+#if DEBUG
+/** Tests the SSL/TLS implementation (nothing to test). */
+void FIO_TLS_WEAK fio_tls_test(void) {}
+#endif
+
 #endif /* Library compiler flags */
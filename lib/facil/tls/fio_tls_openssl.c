@@ -17,11 +17,22 @@ Feel free to copy, use and enjoy according to the license provided.
 #if HAVE_OPENSSL
 #include <openssl/bio.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
 #include <openssl/ssl.h>
+#include <sys/socket.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
 
 #define REQUIRE_LIBRARY()
 #define FIO_TLS_WEAK
 
+#if FIO_TLS_KTLS && (!defined(SSL_OP_ENABLE_KTLS) || defined(OPENSSL_NO_KTLS))
+#undef FIO_TLS_KTLS
+#define FIO_TLS_KTLS 0
+#endif
+
 /* *****************************************************************************
 The SSL/TLS helper data types (can be left as is)
 ***************************************************************************** */
@@ -139,6 +150,8 @@ struct fio_tls_s {
   SSL_CTX *ctx;            /* The Open SSL context (updated each time). */
   unsigned char *alpn_str; /* the computed server-format ALPN string */
   int alpn_len;
+  uint32_t ticket_lifetime; /* session lifetime / ticket key rotation */
+  uint8_t handshake_offload; /* handshakes run on the blocking task pool */
 };
 
 /* *****************************************************************************
@@ -289,6 +302,133 @@ static X509 *fio_tls_create_self_signed(char *server_name) {
   return cert;
 }
 
+/* *****************************************************************************
+Session Resumption (ticket keys shared by all workers)
+***************************************************************************** */
+
+/*
+ * Ticket keys are derived from a random secret and the current rotation epoch
+ * (`time / lifetime`). The secret is created by the root process (when the
+ * first context is built) and inherited by the workers, so every worker
+ * derives the same keys without any IPC and the keys rotate once per lifetime.
+ *
+ * Tickets sealed with the previous epoch's key are still accepted (and
+ * renewed), so a ticket remains usable for at least one full lifetime.
+ */
+
+static uint8_t fio_tls_ticket_secret[32];
+static volatile uint8_t fio_tls_ticket_secret_ready = 0;
+
+static void fio_tls_clear_ticket_secret(void *ignr_) {
+  OPENSSL_cleanse(fio_tls_ticket_secret, sizeof(fio_tls_ticket_secret));
+  fio_tls_ticket_secret_ready = 0;
+  (void)ignr_;
+}
+
+static void fio_tls_make_ticket_secret(void) {
+  static fio_lock_i lock = FIO_LOCK_INIT;
+  if (fio_tls_ticket_secret_ready)
+    return;
+  fio_lock(&lock);
+  if (fio_tls_ticket_secret_ready)
+    goto finish;
+  FIO_ASSERT(RAND_priv_bytes(fio_tls_ticket_secret,
+                             sizeof(fio_tls_ticket_secret)) == 1,
+             "OpenSSL failed to create the session ticket secret.");
+  fio_tls_ticket_secret_ready = 1;
+  fio_state_callback_add(FIO_CALL_AT_EXIT, fio_tls_clear_ticket_secret, NULL);
+finish:
+  fio_unlock(&lock);
+}
+
+/** Derives the AES (first 32 bytes) and HMAC keys for a rotation epoch. */
+static int fio_tls_ticket_keys(uint8_t keys[64], uint32_t lifetime,
+                               uint64_t epoch) {
+  uint8_t src[sizeof(fio_tls_ticket_secret) + 12];
+  unsigned int len = 64;
+  memcpy(src, fio_tls_ticket_secret, sizeof(fio_tls_ticket_secret));
+  fio_u2str32(src + sizeof(fio_tls_ticket_secret), lifetime);
+  fio_u2str64(src + sizeof(fio_tls_ticket_secret) + 4, epoch);
+  int ret = EVP_Digest(src, sizeof(src), keys, &len, EVP_sha512(), NULL);
+  OPENSSL_cleanse(src, sizeof(src));
+  return ret == 1 && len == 64;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+typedef EVP_MAC_CTX fio_tls_ticket_mac_s;
+static int fio_tls_ticket_mac_init(fio_tls_ticket_mac_s *hctx, uint8_t *key) {
+  OSSL_PARAM params[2] = {
+      OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "SHA256", 0),
+      OSSL_PARAM_construct_end(),
+  };
+  return EVP_MAC_init(hctx, key, 32, params);
+}
+#define fio_tls_ticket_set_cb SSL_CTX_set_tlsext_ticket_key_evp_cb
+#else
+typedef HMAC_CTX fio_tls_ticket_mac_s;
+static int fio_tls_ticket_mac_init(fio_tls_ticket_mac_s *hctx, uint8_t *key) {
+  return HMAC_Init_ex(hctx, key, 32, EVP_sha256(), NULL);
+}
+#define fio_tls_ticket_set_cb SSL_CTX_set_tlsext_ticket_key_cb
+#endif
+
+/**
+ * The ticket key callback. The key name holds the lifetime and the epoch.
+ *
+ * Returns 1 for a valid key, 2 for a valid key that should be renewed, 0 for an
+ * unknown key (full handshake) and -1 on error.
+ */
+static int fio_tls_ticket_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+                             EVP_CIPHER_CTX *ectx, fio_tls_ticket_mac_s *hctx,
+                             int enc) {
+  fio_tls_s *tls = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  uint8_t keys[64];
+  int ret = 1;
+  if (!tls || !tls->ticket_lifetime)
+    return enc ? -1 : 0;
+  uint64_t epoch = (uint64_t)fio_last_tick().tv_sec / tls->ticket_lifetime;
+  if (enc) {
+    memset(name, 0, 16);
+    fio_u2str32(name, tls->ticket_lifetime);
+    fio_u2str64(name + 4, epoch);
+    if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+      return -1;
+  } else {
+    uint64_t ticket_epoch = fio_str2u64(name + 4);
+    if (fio_str2u32(name) != tls->ticket_lifetime)
+      return 0;
+    if (ticket_epoch + 1 == epoch)
+      ret = 2; /* previous key, issue a fresh ticket */
+    else if (ticket_epoch != epoch)
+      return 0;
+    epoch = ticket_epoch;
+  }
+  if (!fio_tls_ticket_keys(keys, tls->ticket_lifetime, epoch) ||
+      fio_tls_ticket_mac_init(hctx, keys + 32) != 1 ||
+      (enc ? EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, keys, iv)
+           : EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL, keys, iv)) !=
+          1)
+    ret = -1;
+  OPENSSL_cleanse(keys, sizeof(keys));
+  return ret;
+}
+
+/** Sets up (or disables) session resumption for the context. */
+static void fio_tls_setup_tickets(fio_tls_s *tls) {
+  if (!tls->ticket_lifetime) {
+    SSL_CTX_set_options(tls->ctx, SSL_OP_NO_TICKET);
+    SSL_CTX_set_num_tickets(tls->ctx, 0);
+    SSL_CTX_set_session_cache_mode(tls->ctx, SSL_SESS_CACHE_OFF);
+    return;
+  }
+  fio_tls_make_ticket_secret();
+  /* the per-worker session ID cache is left as is, tickets are shared */
+  SSL_CTX_set_app_data(tls->ctx, tls);
+  SSL_CTX_set_timeout(tls->ctx, tls->ticket_lifetime);
+  SSL_CTX_set_session_id_context(tls->ctx, (unsigned char *)"facil.io", 8);
+  fio_tls_ticket_set_cb(tls->ctx, fio_tls_ticket_cb);
+}
+
 /* *****************************************************************************
 SSL/TLS Context (re)-building
 ***************************************************************************** */
@@ -299,6 +439,12 @@ typedef struct {
   fio_tls_s *tls;
   void *alpn_arg;
   intptr_t uuid;
+  size_t ref;    /* an offloaded handshake step holds a reference */
+  int hs_fd;     /* the socket's duplicate, used by offloaded handshakes */
+  int hs_error;  /* the last `SSL_get_error` value of an incomplete step */
+  volatile int8_t hs_result; /* the offloaded step's result (1 / 0 / -1) */
+  volatile uint8_t hs_busy;  /* set while a step runs on the blocking pool */
+  fio_lock_i lock; /* the read and write hooks might run concurrently */
   uint8_t is_server;
   volatile uint8_t alpn_ok;
 } fio_tls_connection_s;
@@ -388,6 +534,11 @@ static void fio_tls_build_context(fio_tls_s *tls) {
   /* see: https://caniuse.com/#search=tls */
   SSL_CTX_set_min_proto_version(tls->ctx, TLS1_2_VERSION);
   SSL_CTX_set_options(tls->ctx, SSL_OP_NO_COMPRESSION);
+#if FIO_TLS_KTLS
+  /* OpenSSL tests the kernel's support once the handshake is complete */
+  SSL_CTX_set_options(tls->ctx, SSL_OP_ENABLE_KTLS);
+#endif
+  fio_tls_setup_tickets(tls);
 
   /* attach certificates */
   FIO_ARY_FOR(&tls->sni, pos) {
@@ -529,10 +680,12 @@ static void fio_tls_delayed_close(void *uuid, void *ignr_) {
 static ssize_t fio_tls_read(intptr_t uuid, void *udata, void *buf,
                             size_t count) {
   fio_tls_connection_s *c = udata;
+  fio_lock(&c->lock);
   ssize_t ret = SSL_read(c->ssl, buf, count);
   if (ret > 0)
-    return ret;
+    goto finish;
   ret = SSL_get_error(c->ssl, ret);
+  fio_unlock(&c->lock);
   switch (ret) {
   case SSL_ERROR_SSL: /* overflow */
   case SSL_ERROR_ZERO_RETURN:
@@ -551,6 +704,9 @@ static ssize_t fio_tls_read(intptr_t uuid, void *udata, void *buf,
   }
   errno = EWOULDBLOCK;
   return -1;
+finish:
+  fio_unlock(&c->lock);
+  return ret;
   (void)uuid;
 }
 
@@ -583,10 +739,12 @@ static ssize_t fio_tls_flush(intptr_t uuid, void *udata) {
 static ssize_t fio_tls_write(intptr_t uuid, void *udata, const void *buf,
                              size_t count) {
   fio_tls_connection_s *c = udata;
+  fio_lock(&c->lock);
   ssize_t ret = SSL_write(c->ssl, buf, count);
   if (ret > 0)
-    return ret;
+    goto finish;
   ret = SSL_get_error(c->ssl, ret);
+  fio_unlock(&c->lock);
   switch (ret) {
   case SSL_ERROR_SSL: /* overflow */
   case SSL_ERROR_ZERO_RETURN:
@@ -605,6 +763,9 @@ static ssize_t fio_tls_write(intptr_t uuid, void *udata, const void *buf,
   }
   errno = EWOULDBLOCK;
   return -1;
+finish:
+  fio_unlock(&c->lock);
+  return ret;
   (void)uuid;
 }
 
@@ -619,22 +780,47 @@ static ssize_t fio_tls_write(intptr_t uuid, void *udata, const void *buf,
  * */
 static ssize_t fio_tls_before_close(intptr_t uuid, void *udata) {
   fio_tls_connection_s *c = udata;
-  SSL_shutdown(c->ssl);
+  fio_lock(&c->lock);
+  if (!c->hs_busy) /* an offloaded handshake step might be using the object */
+    SSL_shutdown(c->ssl);
+  fio_unlock(&c->lock);
   return 1;
   (void)uuid;
 }
 /**
- * Called to perform cleanup after the socket was closed.
- * */
-static void fio_tls_cleanup(void *udata) {
-  fio_tls_connection_s *c = udata;
+ * Releases a reference to the connection's data, freeing it once it's no
+ * longer used by the socket or by an offloaded handshake step.
+ *
+ * Returns 1 if the data was freed.
+ */
+static int fio_tls_connection_release(fio_tls_connection_s *c) {
+  if (fio_atomic_sub(&c->ref, 1))
+    return 0;
   if (!c->alpn_ok) {
     alpn_select(alpn_default(c->tls), -1, c->alpn_arg);
   }
   SSL_free(c->ssl);
+  if (c->hs_fd != -1)
+    close(c->hs_fd);
   FIO_LOG_DEBUG("TLS cleanup for %p", (void *)c->uuid);
   fio_tls_destroy(c->tls); /* manage reference count */
-  free(udata);
+  free(c);
+  return 1;
+}
+
+static void fio_tls_cleanup_task(void *c, void *ignr_) {
+  fio_tls_connection_release(c);
+  (void)ignr_;
+}
+
+/**
+ * Called to perform cleanup after the socket was closed.
+ *
+ * The socket might be closed by the reactor while another thread is still
+ * running a read / write hook, so the data is released by a deferred task.
+ * */
+static void fio_tls_cleanup(void *udata) {
+  fio_defer(fio_tls_cleanup_task, udata, NULL);
 }
 
 static fio_rw_hook_s FIO_TLS_HOOKS = {
@@ -645,79 +831,179 @@ static fio_rw_hook_s FIO_TLS_HOOKS = {
     .cleanup = fio_tls_cleanup,
 };
 
-static size_t fio_tls_handshake(intptr_t uuid, void *udata) {
-  fio_tls_connection_s *c = udata;
+#if FIO_TLS_KTLS
+/**
+ * Reverts to the default read/write hooks if the kernel handles encryption in
+ * both directions and OpenSSL has no buffered data.
+ *
+ * On success the connection's data is released and 1 is returned.
+ */
+static int fio_tls_ktls_offload(intptr_t uuid, fio_tls_connection_s *c) {
+  if (!BIO_get_ktls_send(SSL_get_wbio(c->ssl)) ||
+      !BIO_get_ktls_recv(SSL_get_rbio(c->ssl)) || SSL_has_pending(c->ssl))
+    return 0;
+  if (fio_rw_hook_replace_unsafe(uuid, (fio_rw_hook_s *)&FIO_DEFAULT_RW_HOOKS,
+                                 NULL))
+    return 0;
+  FIO_LOG_DEBUG("Kernel TLS offload for %p", (void *)uuid);
+  /* the socket isn't closed by the BIO, and the kernel keeps the TLS state */
+  fio_tls_connection_release(c);
+  return 1;
+}
+#else
+#define fio_tls_ktls_offload(uuid, c) 0
+#endif
+
+/**
+ * Performs a single handshake step. Returns 1 once the handshake is complete,
+ * 0 while incomplete and -1 on error.
+ */
+static int fio_tls_handshake_step(intptr_t uuid, fio_tls_connection_s *c) {
   int ri;
   if (c->is_server) {
     ri = SSL_accept(c->ssl);
   } else {
     ri = SSL_connect(c->ssl);
   }
-  if (ri != 1) {
-    ri = SSL_get_error(c->ssl, ri);
-    switch (ri) {
-    case SSL_ERROR_NONE:
-      // FIO_LOG_DEBUG("SSL_accept/SSL_connect %p state: SSL_ERROR_NONE",
-      //               (void *)uuid);
-      return 0;
-    case SSL_ERROR_WANT_WRITE:
-      // FIO_LOG_DEBUG("SSL_accept/SSL_connect %p state: SSL_ERROR_WANT_WRITE",
-      //               (void *)uuid);
-      //   fio_force_event(uuid, FIO_EVENT_ON_READY);
-      return 0;
-    case SSL_ERROR_WANT_READ:
-      // FIO_LOG_DEBUG("SSL_accept/SSL_connect %p state: SSL_ERROR_WANT_READ",
-      //               (void *)uuid);
-      // fio_force_event(uuid, FIO_EVENT_ON_DATA);
-      return 0;
-    case SSL_ERROR_SYSCALL:
-      FIO_LOG_DEBUG(
-          "SSL_accept/SSL_connect %p error: SSL_ERROR_SYSCALL, errno: %s",
-          (void *)uuid, strerror(errno));
-      // fio_force_event(uuid, FIO_EVENT_ON_DATA);
-      return 0;
-    case SSL_ERROR_SSL:
-      FIO_LOG_DEBUG("SSL_accept/SSL_connect %p error: SSL_ERROR_SSL",
-                    (void *)uuid);
-      break;
-    case SSL_ERROR_ZERO_RETURN:
-      FIO_LOG_DEBUG("SSL_accept/SSL_connect %p error: SSL_ERROR_ZERO_RETURN",
-                    (void *)uuid);
-      break;
-    case SSL_ERROR_WANT_CONNECT:
-      FIO_LOG_DEBUG("SSL_accept/SSL_connect %p error: SSL_ERROR_WANT_CONNECT",
-                    (void *)uuid);
-      break;
-    case SSL_ERROR_WANT_ACCEPT:
-      FIO_LOG_DEBUG("SSL_accept/SSL_connect %p error: SSL_ERROR_WANT_ACCEPT",
-                    (void *)uuid);
-      break;
-    case SSL_ERROR_WANT_X509_LOOKUP:
-      FIO_LOG_DEBUG(
-          "SSL_accept/SSL_connect %p error: SSL_ERROR_WANT_X509_LOOKUP",
-          (void *)uuid);
-      break;
+  if (ri == 1)
+    return 1;
+  ri = c->hs_error = SSL_get_error(c->ssl, ri);
+  switch (ri) {
+  case SSL_ERROR_NONE:
+    // FIO_LOG_DEBUG("SSL_accept/SSL_connect %p state: SSL_ERROR_NONE",
+    //               (void *)uuid);
+    return 0;
+  case SSL_ERROR_WANT_WRITE:
+    // FIO_LOG_DEBUG("SSL_accept/SSL_connect %p state: SSL_ERROR_WANT_WRITE",
+    //               (void *)uuid);
+    //   fio_force_event(uuid, FIO_EVENT_ON_READY);
+    return 0;
+  case SSL_ERROR_WANT_READ:
+    // FIO_LOG_DEBUG("SSL_accept/SSL_connect %p state: SSL_ERROR_WANT_READ",
+    //               (void *)uuid);
+    // fio_force_event(uuid, FIO_EVENT_ON_DATA);
+    return 0;
+  case SSL_ERROR_SYSCALL:
+    FIO_LOG_DEBUG(
+        "SSL_accept/SSL_connect %p error: SSL_ERROR_SYSCALL, errno: %s",
+        (void *)uuid, strerror(errno));
+    // fio_force_event(uuid, FIO_EVENT_ON_DATA);
+    return 0;
+  case SSL_ERROR_SSL:
+    FIO_LOG_DEBUG("SSL_accept/SSL_connect %p error: SSL_ERROR_SSL",
+                  (void *)uuid);
+    break;
+  case SSL_ERROR_ZERO_RETURN:
+    FIO_LOG_DEBUG("SSL_accept/SSL_connect %p error: SSL_ERROR_ZERO_RETURN",
+                  (void *)uuid);
+    break;
+  case SSL_ERROR_WANT_CONNECT:
+    FIO_LOG_DEBUG("SSL_accept/SSL_connect %p error: SSL_ERROR_WANT_CONNECT",
+                  (void *)uuid);
+    break;
+  case SSL_ERROR_WANT_ACCEPT:
+    FIO_LOG_DEBUG("SSL_accept/SSL_connect %p error: SSL_ERROR_WANT_ACCEPT",
+                  (void *)uuid);
+    break;
+  case SSL_ERROR_WANT_X509_LOOKUP:
+    FIO_LOG_DEBUG(
+        "SSL_accept/SSL_connect %p error: SSL_ERROR_WANT_X509_LOOKUP",
+        (void *)uuid);
+    break;
 #ifdef SSL_ERROR_WANT_ASYNC
-    case SSL_ERROR_WANT_ASYNC:
-      FIO_LOG_DEBUG("SSL_accept/SSL_connect %p error: SSL_ERROR_WANT_ASYNC",
-                    (void *)uuid);
-      break;
+  case SSL_ERROR_WANT_ASYNC:
+    FIO_LOG_DEBUG("SSL_accept/SSL_connect %p error: SSL_ERROR_WANT_ASYNC",
+                  (void *)uuid);
+    break;
 #endif
 #ifdef SSL_ERROR_WANT_CLIENT_HELLO_CB
-    case SSL_ERROR_WANT_CLIENT_HELLO_CB:
-      FIO_LOG_DEBUG(
-          "SSL_accept/SSL_connect %p error: SSL_ERROR_WANT_CLIENT_HELLO_CB",
-          (void *)uuid);
-      break;
+  case SSL_ERROR_WANT_CLIENT_HELLO_CB:
+    FIO_LOG_DEBUG(
+        "SSL_accept/SSL_connect %p error: SSL_ERROR_WANT_CLIENT_HELLO_CB",
+        (void *)uuid);
+    break;
 #endif
-    default:
-      FIO_LOG_DEBUG("SSL_accept/SSL_connect %p error: unknown (%d).",
-                    (void *)uuid, ri);
-      break;
-    }
-    fio_defer(fio_tls_delayed_close, (void *)uuid, NULL);
+  default:
+    FIO_LOG_DEBUG("SSL_accept/SSL_connect %p error: unknown (%d).",
+                  (void *)uuid, ri);
+    break;
+  }
+  return -1;
+}
+
+/* *****************************************************************************
+Handshake Offloading (the blocking task pool)
+***************************************************************************** */
+
+/*
+ * An offloaded step runs on the blocking task pool while the IO threads treat
+ * the connection as if it were waiting for the peer. The SSL object uses a
+ * duplicate of the socket, so closing the connection mid-step never exposes a
+ * reused file descriptor, and the step holds a reference to the connection's
+ * data. Once the step is done, an `on_ready` event resumes the connection and
+ * the handshake hooks collect the result.
+ */
+
+/** Runs a handshake step on the blocking task pool. */
+static void fio_tls_handshake_task(void *c_, void *ignr_) {
+  fio_tls_connection_s *c = c_;
+  intptr_t uuid = c->uuid;
+  ERR_clear_error();
+  c->hs_result = fio_tls_handshake_step(uuid, c);
+  fio_atomic_sub(&c->hs_busy, 1);
+  if (fio_tls_connection_release(c))
+    return;
+  fio_force_event(uuid, FIO_EVENT_ON_READY);
+  (void)ignr_;
+}
+
+/** Tests if the peer sent any data the handshake could consume. */
+static int fio_tls_handshake_has_input(fio_tls_connection_s *c) {
+  char tmp;
+  if (recv(c->hs_fd, &tmp, 1, MSG_PEEK | MSG_DONTWAIT) >= 0)
+    return 1; /* data (or EOF) */
+  return errno != EAGAIN && errno != EWOULDBLOCK;
+}
+
+/**
+ * Collects an offloaded step's result or schedules the next step. Returns the
+ * same values as `fio_tls_handshake_step`.
+ */
+static int fio_tls_handshake_offload_step(intptr_t uuid,
+                                          fio_tls_connection_s *c) {
+  if (c->hs_busy)
     return 0;
+  if (c->hs_result) {
+    if (c->hs_result == 1 && c->hs_fd != -1) {
+      /* continue using the connection's socket (keeps any kTLS state) */
+      BIO_set_fd(SSL_get_rbio(c->ssl), fio_uuid2fd(uuid), BIO_NOCLOSE);
+      close(c->hs_fd);
+      c->hs_fd = -1;
+    }
+    return c->hs_result;
   }
+  if (c->hs_error == SSL_ERROR_WANT_READ && !fio_tls_handshake_has_input(c))
+    return 0;
+  fio_atomic_add(&c->ref, 1);
+  fio_atomic_add(&c->hs_busy, 1);
+  if (!fio_defer_blocking(fio_tls_handshake_task, c, NULL))
+    return 0;
+  fio_atomic_sub(&c->hs_busy, 1);
+  fio_atomic_sub(&c->ref, 1);
+  return fio_tls_handshake_step(uuid, c);
+}
+
+/* *****************************************************************************
+SSL/TLS Handshake RW Hooks
+***************************************************************************** */
+
+/**
+ * Activates the TLS hooks once the handshake is complete. Returns 1 once the
+ * TLS hooks are active and 2 if the connection reverted to the default hooks
+ * (kernel TLS).
+ */
+static size_t fio_tls_handshake_finish(intptr_t uuid,
+                                       fio_tls_connection_s *c) {
   if (!c->alpn_ok) {
     c->alpn_ok = 1;
     if (c->is_server) {
@@ -740,7 +1026,11 @@ static size_t fio_tls_handshake(intptr_t uuid, void *udata) {
       alpn_select(alpn, c->uuid, c->alpn_arg);
     }
   }
-  if (fio_rw_hook_replace_unsafe(uuid, &FIO_TLS_HOOKS, udata) == 0) {
+  if (fio_tls_ktls_offload(uuid, c)) {
+    fio_force_event(uuid, FIO_EVENT_ON_DATA);
+    return 2;
+  }
+  if (fio_rw_hook_replace_unsafe(uuid, &FIO_TLS_HOOKS, c) == 0) {
     FIO_LOG_DEBUG("Completed TLS handshake for %p", (void *)uuid);
   } else {
     FIO_LOG_DEBUG("Something went wrong during TLS handshake for %p",
@@ -771,11 +1061,42 @@ static size_t fio_tls_handshake(intptr_t uuid, void *udata) {
   return 1;
 }
 
+/**
+ * Performs the handshake. Returns 0 while incomplete, 1 once the TLS hooks are
+ * active and 2 if the connection reverted to the default hooks (kernel TLS).
+ */
+static size_t fio_tls_handshake(intptr_t uuid, void *udata) {
+  fio_tls_connection_s *c = udata;
+  size_t ret;
+  if (fio_trylock(&c->lock))
+    return 0; /* the handshake is performed by another thread */
+  switch (c->hs_fd == -1 ? fio_tls_handshake_step(uuid, c)
+                         : fio_tls_handshake_offload_step(uuid, c)) {
+  case 0:
+    ret = 0;
+    break;
+  case -1:
+    fio_defer(fio_tls_delayed_close, (void *)uuid, NULL);
+    ret = 0;
+    break;
+  default:
+    ret = fio_tls_handshake_finish(uuid, c);
+    if (ret == 2)
+      return ret; /* the connection's data was released (kernel TLS) */
+  }
+  fio_unlock(&c->lock);
+  return ret;
+}
+
 static ssize_t fio_tls_read4handshake(intptr_t uuid, void *udata, void *buf,
                                       size_t count) {
   // FIO_LOG_DEBUG("TLS handshake from read %p", (void *)uuid);
-  if (fio_tls_handshake(uuid, udata))
+  switch (fio_tls_handshake(uuid, udata)) {
+  case 1:
     return fio_tls_read(uuid, udata, buf, count);
+  case 2:
+    return FIO_DEFAULT_RW_HOOKS.read(uuid, NULL, buf, count);
+  }
   errno = EWOULDBLOCK;
   return -1;
 }
@@ -783,19 +1104,27 @@ static ssize_t fio_tls_read4handshake(intptr_t uuid, void *udata, void *buf,
 static ssize_t fio_tls_write4handshake(intptr_t uuid, void *udata,
                                        const void *buf, size_t count) {
   // FIO_LOG_DEBUG("TLS handshake from write %p", (void *)uuid);
-  if (fio_tls_handshake(uuid, udata))
+  switch (fio_tls_handshake(uuid, udata)) {
+  case 1:
     return fio_tls_write(uuid, udata, buf, count);
+  case 2:
+    return FIO_DEFAULT_RW_HOOKS.write(uuid, NULL, buf, count);
+  }
   errno = EWOULDBLOCK;
   return -1;
 }
 
 static ssize_t fio_tls_flush4handshake(intptr_t uuid, void *udata) {
   // FIO_LOG_DEBUG("TLS handshake from flush %p", (void *)uuid);
-  if (fio_tls_handshake(uuid, udata)) {
+  switch (fio_tls_handshake(uuid, udata)) {
+  case 1:
     return fio_tls_flush(uuid, udata);
+  case 2:
+    return FIO_DEFAULT_RW_HOOKS.flush(uuid, NULL);
   }
   errno = 0;
-  return 1;
+  /* an offloaded step resumes the connection once it's done */
+  return !((fio_tls_connection_s *)udata)->hs_busy;
 }
 static fio_rw_hook_s FIO_TLS_HANDSHAKE_HOOKS = {
     .read = fio_tls_read4handshake,
@@ -815,14 +1144,20 @@ static inline void fio_tls_attach2uuid(intptr_t uuid, fio_tls_s *tls,
       .tls = tls,
       .uuid = uuid,
       .ssl = SSL_new(tls->ctx),
+      .ref = 1,
+      .hs_fd = -1,
       .is_server = is_server,
       .alpn_ok = 0,
   };
   FIO_ASSERT_ALLOC(c->ssl);
   /* set facil.io data in the SSL object */
   SSL_set_ex_data(c->ssl, 0, (void *)c);
+  /* offloaded handshakes use a duplicate socket (see `hs_fd`) */
+  if (tls->handshake_offload)
+    c->hs_fd = fcntl(fio_uuid2fd(uuid), F_DUPFD_CLOEXEC, 0);
   /* attach socket - TODO: Switch to BIO socket */
-  BIO *bio = BIO_new_socket(fio_uuid2fd(uuid), 0);
+  BIO *bio = BIO_new_socket(
+      (c->hs_fd == -1 ? (int)fio_uuid2fd(uuid) : c->hs_fd), BIO_NOCLOSE);
   BIO_up_ref(bio);
   SSL_set0_rbio(c->ssl, bio);
   SSL_set0_wbio(c->ssl, bio);
@@ -855,6 +1190,8 @@ fio_tls_s *FIO_TLS_WEAK fio_tls_new(const char *server_name, const char *cert,
   REQUIRE_LIBRARY();
   fio_tls_s *tls = calloc(sizeof(*tls), 1);
   tls->ref = 1;
+  tls->ticket_lifetime = FIO_TLS_SESSION_LIFETIME;
+  tls->handshake_offload = FIO_TLS_HANDSHAKE_OFFLOAD;
   fio_tls_cert_add(tls, server_name, key, cert, pk_password);
   return tls;
 }
@@ -931,6 +1268,33 @@ uintptr_t FIO_TLS_WEAK fio_tls_alpn_count(fio_tls_s *tls) {
   return tls ? alpn_list_count(&tls->alpn) : 0;
 }
 
+/**
+ * Sets the lifetime (in seconds) of resumable TLS sessions, which is also the
+ * session ticket key rotation interval. Zero (0) disables session resumption.
+ *
+ * Ticket keys are derived from a secret shared by all the worker processes, so
+ * a session can be resumed on any worker. For this to work, the TLS object
+ * must be created by the root process (before `fio_start` is called).
+ */
+void FIO_TLS_WEAK fio_tls_session_lifetime(fio_tls_s *tls, uint32_t seconds) {
+  REQUIRE_LIBRARY();
+  if (!tls)
+    return;
+  tls->ticket_lifetime = seconds;
+  fio_tls_build_context(tls);
+}
+
+/**
+ * Enables (or disables) handshake offloading for new connections, so the
+ * handshake's cryptography runs on the blocking task pool.
+ */
+void FIO_TLS_WEAK fio_tls_handshake_offload(fio_tls_s *tls, uint8_t enable) {
+  REQUIRE_LIBRARY();
+  if (!tls)
+    return;
+  tls->handshake_offload = !!enable;
+}
+
 /**
  * Adds a certificate to the "trust" list, which automatically adds a peer
  * verification requirement.
@@ -1008,4 +1372,116 @@ void FIO_TLS_WEAK fio_tls_destroy(fio_tls_s *tls) {
   free(tls);
 }
 
+/* *****************************************************************************
+Testing
+***************************************************************************** */
+#if DEBUG
+
+static size_t fio_tls_test_selected;
+
+static void fio_tls_test_on_selected(intptr_t uuid, void *udata_connection,
+                                     void *udata_tls) {
+  ++fio_tls_test_selected;
+  (void)uuid;
+  (void)udata_connection;
+  (void)udata_tls;
+}
+
+/* connects a socket pair, returns the file descriptor `dup` would return */
+static int fio_tls_test_pair(intptr_t *server, intptr_t *client) {
+  int fds[2];
+  FIO_ASSERT(!socketpair(AF_UNIX, SOCK_STREAM, 0, fds), "socketpair failed\n");
+  FIO_ASSERT(fio_set_non_block(fds[0]) != -1 &&
+                 fio_set_non_block(fds[1]) != -1,
+             "non-blocking mode failed\n");
+  *server = fio_fd2uuid(fds[0]);
+  *client = fio_fd2uuid(fds[1]);
+  const int next = fcntl(fds[0], F_DUPFD_CLOEXEC, 0);
+  close(next);
+  return next;
+}
+
+/* closes both ends (`before_close` postpones the first attempt to close) */
+static void fio_tls_test_close(intptr_t s, intptr_t c) {
+  /* both ends send their close_notify before either socket is closed */
+  fio_force_close(s);
+  fio_force_close(c);
+  fio_force_close(s);
+  fio_force_close(c);
+  fio_defer_perform();
+}
+
+/* flushes both ends until `reader` reads data (or the attempts run out) */
+static ssize_t fio_tls_test_read(intptr_t reader, intptr_t writer, char *buf,
+                                 size_t capa) {
+  ssize_t got = 0;
+  for (size_t i = 0; i < 1024 && got <= 0; ++i) {
+    fio_flush(writer);
+    fio_flush(reader);
+    fio_defer_perform();
+    got = fio_read(reader, buf, capa);
+  }
+  return got;
+}
+
+void fio_tls_test(void) {
+  fio_tls_s *server = fio_tls_new("localhost", NULL, NULL, NULL);
+  fio_tls_s *client = fio_tls_new(NULL, NULL, NULL, NULL);
+  fio_tls_alpn_add(server, "test", fio_tls_test_on_selected, NULL, NULL);
+  fio_tls_handshake_offload(server, 1);
+  fio_tls_handshake_offload(client, 1);
+  fprintf(stderr, "=== Testing OpenSSL handshake offloading (loopback)\n");
+  {
+    intptr_t s, c;
+    char buf[16];
+    const int hs_fd = fio_tls_test_pair(&s, &c);
+    fio_tls_accept(s, server, NULL);
+    fio_tls_connect(c, client, NULL);
+    FIO_ASSERT(fcntl(hs_fd, F_GETFD) != -1 && fcntl(hs_fd + 1, F_GETFD) != -1,
+               "offloaded handshakes should use a duplicate socket\n");
+    FIO_ASSERT(server->ref == 2 && client->ref == 2,
+               "TLS connections should hold a context reference\n");
+    fio_tls_test_selected = 0;
+    fio_write(c, "hello", 5);
+    FIO_ASSERT(fio_tls_test_read(s, c, buf, sizeof(buf)) == 5 &&
+                   !memcmp(buf, "hello", 5),
+               "offloaded TLS handshake failed (client to server)\n");
+    fio_write(s, "world", 5);
+    FIO_ASSERT(fio_tls_test_read(c, s, buf, sizeof(buf)) == 5 &&
+                   !memcmp(buf, "world", 5),
+               "offloaded TLS handshake failed (server to client)\n");
+    FIO_ASSERT(fcntl(hs_fd, F_GETFD) == -1 && fcntl(hs_fd + 1, F_GETFD) == -1,
+               "the duplicate sockets should be closed after the handshake\n");
+    FIO_ASSERT(fio_tls_test_selected == 1,
+               "the ALPN callback should be called once (%zu)\n",
+               fio_tls_test_selected);
+    fio_tls_test_close(s, c);
+    FIO_ASSERT(server->ref == 1 && client->ref == 1,
+               "TLS connection data wasn't released\n");
+  }
+  fprintf(stderr, "=== Testing OpenSSL handshake offloading (closed mid-step)\n");
+  {
+    intptr_t s, c;
+    const int hs_fd = fio_tls_test_pair(&s, &c);
+    fio_tls_accept(s, server, NULL);
+    /* the pool isn't running, so the step is queued and the connection is
+     * closed before the step is performed (the peer didn't send anything) */
+    fio_flush(s);
+    FIO_ASSERT(fio_defer_has_queue(), "the server's handshake step is missing\n");
+    fio_force_close(s);
+    fio_force_close(s);
+    FIO_ASSERT(fcntl(fio_uuid2fd(s), F_GETFD) == -1 &&
+                   fcntl(hs_fd, F_GETFD) != -1 && server->ref == 2,
+               "an offloaded step should keep its socket until it's done\n");
+    fio_defer_perform();
+    FIO_ASSERT(fcntl(hs_fd, F_GETFD) == -1 && server->ref == 1,
+               "the connection should be released once the step is done\n");
+    fio_force_close(c);
+    fio_defer_perform();
+  }
+  fio_tls_destroy(server);
+  fio_tls_destroy(client);
+}
+#endif
+
 #endif /* Library compiler flags */
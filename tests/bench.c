@@ -0,0 +1,791 @@
+/*
+The facil.io benchmark suite (micro and loopback benchmarks).
+
+Results are printed to `stdout` as JSON and progress is printed to `stderr`, so
+results can be stored and compared between releases:
+
+    make bench                          # writes the results to bench.json
+    make bench BENCH_JSON=v0.7.0.json   # writes the results to v0.7.0.json
+    make bench BENCH="http websocket"   # only runs the matching benchmarks
+
+The program can also be compiled and run directly, benchmark name prefixes
+can be passed as arguments (i.e., `fioapp defer json`). Using CMake, the
+program is built by the `facil.io.bench` target and run by the `bench` target.
+
+Every micro benchmark uses fixed workloads and a fixed pseudo-random seed. Each
+one runs `BENCH_RUNS` times and reports the fastest run.
+
+The loopback benchmarks (pub/sub fan-out, HTTP and WebSocket load) run inside
+the reactor, using a single thread and worker process. The client side is
+built on `fio_connect` and `websocket_connect`, so the results include the
+cost of both peers. The port defaults to 3997 and can be set using the
+`BENCH_PORT` environment variable.
+*/
+#include <fio.h>
+
+#include <fiobj.h>
+#include <fiobj_mustache.h>
+#include <http.h>
+#include <http1_parser.h>
+#include <websocket_parser.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_RUNS 5
+#define BENCH_SEED 0x2F0B3C5A9D7E1F31ULL
+/* the reactor stages are stopped (and marked as failed) after 60 seconds */
+#define BENCH_TIMEOUT 60000
+
+/* *****************************************************************************
+Results and reporting
+***************************************************************************** */
+
+typedef struct {
+  const char *name;
+  size_t ops;
+  size_t bytes;
+  size_t runs;
+  double seconds;
+} bench_result_s;
+
+static bench_result_s bench_results[64];
+static size_t bench_count;
+static int bench_failed;
+static int bench_argc;
+static char **bench_argv;
+
+/** Monotonic time in nanoseconds. */
+static uint64_t bench_now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return ((uint64_t)t.tv_sec * 1000000000ULL) + (uint64_t)t.tv_nsec;
+}
+
+/** A deterministic pseudo-random sequence (xorshift64*). */
+static uint64_t bench_rand_state = BENCH_SEED;
+static uint64_t bench_rand(void) {
+  bench_rand_state ^= bench_rand_state >> 12;
+  bench_rand_state ^= bench_rand_state << 25;
+  bench_rand_state ^= bench_rand_state >> 27;
+  return bench_rand_state * 0x2545F4914F6CDD1DULL;
+}
+
+/** Tests if a benchmark was selected (prefix match on the arguments). */
+static int bench_selected(const char *name) {
+  if (bench_argc < 2)
+    return 1;
+  for (int i = 1; i < bench_argc; ++i) {
+    if (!strncmp(name, bench_argv[i], strlen(bench_argv[i])))
+      return 1;
+  }
+  return 0;
+}
+
+/** Records a result, `ns` is the (best) run's duration. */
+static void bench_add(const char *name, size_t ops, size_t bytes, size_t runs,
+                      uint64_t ns) {
+  if (bench_count >= sizeof(bench_results) / sizeof(bench_results[0]))
+    return;
+  bench_results[bench_count++] = (bench_result_s){
+      .name = name,
+      .ops = ops,
+      .bytes = bytes,
+      .runs = runs,
+      .seconds = ns / 1e9,
+  };
+  fprintf(stderr, "* %-24s %12.0lf ops/sec (%.2lf ns/op)\n", name,
+          ns ? (ops * 1e9) / ns : 0.0, ops ? (double)ns / ops : 0.0);
+}
+
+/** Reports a failed benchmark. */
+static void bench_fail(const char *name, const char *reason) {
+  fprintf(stderr, "ERROR: benchmark %s failed: %s\n", name, reason);
+  bench_failed = 1;
+}
+
+static void bench_print(void) {
+  fprintf(stdout, "{\n  \"facil.io\": \"%s\",\n  \"runs\": %d,\n",
+          FIO_VERSION_STRING, BENCH_RUNS);
+  fprintf(stdout, "  \"results\": [");
+  for (size_t i = 0; i < bench_count; ++i) {
+    bench_result_s *r = bench_results + i;
+    fprintf(stdout,
+            "%s\n    {\"name\": \"%s\", \"ops\": %zu, \"bytes\": %zu, "
+            "\"runs\": %zu, \"seconds\": %.9lf, \"ops_per_sec\": %.2lf, "
+            "\"ns_per_op\": %.3lf, \"mb_per_sec\": %.3lf}",
+            (i ? "," : ""), r->name, r->ops, r->bytes, r->runs, r->seconds,
+            (r->seconds ? r->ops / r->seconds : 0.0),
+            (r->ops ? (r->seconds * 1e9) / r->ops : 0.0),
+            (r->seconds ? r->bytes / (r->seconds * 1e6) : 0.0));
+  }
+  fprintf(stdout, "\n  ],\n  \"failed\": %s\n}\n",
+          (bench_failed ? "true" : "false"));
+}
+
+/**
+ * Runs `code` `BENCH_RUNS` times and records the fastest run.
+ *
+ * `setup` is performed before each run, outside the measured time.
+ */
+#define BENCH_MICRO(name, ops, bytes, setup, code)                             \
+  do {                                                                         \
+    if (!bench_selected((name)))                                               \
+      break;                                                                   \
+    uint64_t bench_best_ = (uint64_t)-1;                                       \
+    for (size_t bench_run_ = 0; bench_run_ < BENCH_RUNS; ++bench_run_) {       \
+      setup;                                                                   \
+      uint64_t bench_start_ = bench_now();                                     \
+      code;                                                                    \
+      uint64_t bench_end_ = bench_now() - bench_start_;                        \
+      if (bench_end_ < bench_best_)                                            \
+        bench_best_ = bench_end_;                                              \
+    }                                                                          \
+    bench_add((name), (ops), (bytes), BENCH_RUNS, bench_best_);                \
+  } while (0)
+
+/* *****************************************************************************
+Task queue and timers
+***************************************************************************** */
+
+#define BENCH_TASKS (1024 * 1024)
+#define BENCH_TIMERS (64 * 1024)
+
+static size_t bench_task_counter;
+static void bench_task(void *a, void *b) {
+  ++bench_task_counter;
+  (void)a, (void)b;
+}
+static void bench_timer_task(void *a) { (void)a; }
+
+static void bench_defer(void) {
+  BENCH_MICRO("defer.push_perform", BENCH_TASKS, 0, bench_task_counter = 0, {
+    for (size_t i = 0; i < BENCH_TASKS; ++i)
+      fio_defer(bench_task, NULL, NULL);
+    fio_defer_perform();
+  });
+  if (bench_selected("defer") && bench_task_counter != BENCH_TASKS)
+    bench_fail("defer.push_perform", "task count mismatch");
+
+  static fio_timer_s *timers[BENCH_TIMERS];
+  BENCH_MICRO("timers.schedule_cancel", BENCH_TIMERS, 0,
+              bench_rand_state = BENCH_SEED, {
+                for (size_t i = 0; i < BENCH_TIMERS; ++i)
+                  timers[i] = fio_run_every2(60000 + (bench_rand() & 65535), 1,
+                                             bench_timer_task, NULL, NULL);
+                for (size_t i = 0; i < BENCH_TIMERS; ++i)
+                  fio_timer_cancel(timers[i]);
+                fio_defer_perform();
+              });
+}
+
+/* *****************************************************************************
+Memory allocator
+***************************************************************************** */
+
+#define BENCH_ALLOCATIONS 4096
+#define BENCH_ALLOCATION_ROUNDS 64
+#define BENCH_ALLOCATION_OPS (BENCH_ALLOCATIONS * BENCH_ALLOCATION_ROUNDS)
+
+static void *bench_pointers[BENCH_ALLOCATIONS];
+static size_t bench_sizes[BENCH_ALLOCATIONS];
+
+#define BENCH_ALLOCATOR(name, malloc_func, free_func)                          \
+  BENCH_MICRO(name, BENCH_ALLOCATION_OPS, 0, (void)0, {                       \
+    for (size_t r = 0; r < BENCH_ALLOCATION_ROUNDS; ++r) {                     \
+      for (size_t i = 0; i < BENCH_ALLOCATIONS; ++i)                           \
+        bench_pointers[i] = malloc_func(bench_sizes[i]);                       \
+      for (size_t i = 0; i < BENCH_ALLOCATIONS; i += 2)                        \
+        free_func(bench_pointers[i]);                                          \
+      for (size_t i = 1; i < BENCH_ALLOCATIONS; i += 2)                        \
+        free_func(bench_pointers[i]);                                          \
+    }                                                                          \
+  })
+
+static void bench_malloc(void) {
+  bench_rand_state = BENCH_SEED;
+  for (size_t i = 0; i < BENCH_ALLOCATIONS; ++i)
+    bench_sizes[i] = 16 + (bench_rand() & 4095);
+  BENCH_ALLOCATOR("malloc.fio", fio_malloc, fio_free);
+  BENCH_ALLOCATOR("malloc.system", malloc, free);
+}
+
+/* *****************************************************************************
+Hash maps (fio_set)
+***************************************************************************** */
+
+#define FIO_SET_NAME bench_set
+#define FIO_SET_OBJ_TYPE uint64_t
+#include <fio.h>
+
+#define BENCH_SET_ITEMS (256 * 1024)
+
+static uint64_t bench_hash(uint64_t i) {
+  i ^= i >> 33;
+  i *= 0xFF51AFD7ED558CCDULL;
+  i ^= i >> 33;
+  return i;
+}
+
+static void bench_fio_set(void) {
+  bench_set_s s = FIO_SET_INIT;
+  size_t found = 0;
+  BENCH_MICRO("set.insert", BENCH_SET_ITEMS, 0, bench_set_free(&s), {
+    for (uint64_t i = 1; i <= BENCH_SET_ITEMS; ++i)
+      bench_set_insert(&s, bench_hash(i), i);
+  });
+  if (!bench_set_count(&s)) {
+    for (uint64_t i = 1; i <= BENCH_SET_ITEMS; ++i)
+      bench_set_insert(&s, bench_hash(i), i);
+  }
+  BENCH_MICRO("set.find", BENCH_SET_ITEMS, 0, found = 0, {
+    for (uint64_t i = 1; i <= BENCH_SET_ITEMS; ++i)
+      found += (bench_set_find(&s, bench_hash(i), i) == i);
+  });
+  if (bench_selected("set.find") && found != BENCH_SET_ITEMS)
+    bench_fail("set.find", "missing items");
+  BENCH_MICRO(
+      "set.remove", BENCH_SET_ITEMS, 0,
+      {
+        for (uint64_t i = 1; i <= BENCH_SET_ITEMS; ++i)
+          bench_set_insert(&s, bench_hash(i), i);
+      },
+      {
+        for (uint64_t i = 1; i <= BENCH_SET_ITEMS; ++i)
+          bench_set_remove(&s, bench_hash(i), i, NULL);
+      });
+  bench_set_free(&s);
+}
+
+/* *****************************************************************************
+HTTP/1.1 parsing
+***************************************************************************** */
+
+#define BENCH_HTTP_REQUESTS (16 * 1024)
+
+static size_t bench_http_requests;
+static int bench_http1_on_request(http1_parser_s *p) {
+  ++bench_http_requests;
+  return (void)p, 0;
+}
+static int bench_http1_on_response(http1_parser_s *p) { return (void)p, 0; }
+static int bench_http1_on_method(http1_parser_s *p, char *m, size_t l) {
+  return (void)p, (void)m, (void)l, 0;
+}
+static int bench_http1_on_status(http1_parser_s *p, size_t s, char *str,
+                                 size_t l) {
+  return (void)p, (void)s, (void)str, (void)l, 0;
+}
+static int bench_http1_on_path(http1_parser_s *p, char *path, size_t l) {
+  return (void)p, (void)path, (void)l, 0;
+}
+static int bench_http1_on_query(http1_parser_s *p, char *q, size_t l) {
+  return (void)p, (void)q, (void)l, 0;
+}
+static int bench_http1_on_version(http1_parser_s *p, char *v, size_t l) {
+  return (void)p, (void)v, (void)l, 0;
+}
+static int bench_http1_on_header(http1_parser_s *p, char *n, size_t nl,
+                                 char *d, size_t dl) {
+  return (void)p, (void)n, (void)nl, (void)d, (void)dl, 0;
+}
+static int bench_http1_on_body_chunk(http1_parser_s *p, char *d, size_t l) {
+  return (void)p, (void)d, (void)l, 0;
+}
+static int bench_http1_on_error(http1_parser_s *p) {
+  return (void)p, -1;
+}
+
+static void bench_http1(void) {
+  static const char request[] =
+      "GET /users/42/profile?fields=name,email&format=json HTTP/1.1\r\n"
+      "Host: www.example.com\r\n"
+      "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:68.0) Gecko/20100101\r\n"
+      "Accept: text/html,application/xhtml+xml,application/xml;q=0.9\r\n"
+      "Accept-Language: en-US,en;q=0.5\r\n"
+      "Accept-Encoding: gzip, deflate\r\n"
+      "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark\r\n"
+      "Connection: keep-alive\r\n"
+      "\r\n";
+  const size_t len = sizeof(request) - 1;
+  if (!bench_selected("http1.parse"))
+    return;
+  char *source = malloc(len * BENCH_HTTP_REQUESTS);
+  char *data = malloc(len * BENCH_HTTP_REQUESTS);
+  FIO_ASSERT_ALLOC(source && data);
+  for (size_t i = 0; i < BENCH_HTTP_REQUESTS; ++i)
+    memcpy(source + (i * len), request, len);
+  BENCH_MICRO(
+      "http1.parse", BENCH_HTTP_REQUESTS, len * BENCH_HTTP_REQUESTS,
+      {
+        /* the parser writes NUL bytes into the buffer */
+        memcpy(data, source, len * BENCH_HTTP_REQUESTS);
+        bench_http_requests = 0;
+      },
+      {
+        http1_parser_s parser = {.udata = NULL};
+        size_t pos = 0;
+        while (pos < len * BENCH_HTTP_REQUESTS) {
+          size_t consumed = http1_fio_parser(
+              .parser = &parser, .buffer = data + pos,
+              .length = (len * BENCH_HTTP_REQUESTS) - pos,
+              .on_request = bench_http1_on_request,
+              .on_response = bench_http1_on_response,
+              .on_method = bench_http1_on_method,
+              .on_status = bench_http1_on_status,
+              .on_path = bench_http1_on_path,
+              .on_query = bench_http1_on_query,
+              .on_http_version = bench_http1_on_version,
+              .on_header = bench_http1_on_header,
+              .on_body_chunk = bench_http1_on_body_chunk,
+              .on_error = bench_http1_on_error);
+          if (!consumed)
+            break;
+          pos += consumed;
+        }
+      });
+  if (bench_http_requests != BENCH_HTTP_REQUESTS)
+    bench_fail("http1.parse", "request count mismatch");
+  free(data);
+  free(source);
+}
+
+/* *****************************************************************************
+WebSocket framing
+***************************************************************************** */
+
+#define BENCH_WS_MESSAGES (64 * 1024)
+#define BENCH_WS_MESSAGE_LENGTH 512
+
+static size_t bench_ws_messages;
+static void websocket_on_unwrapped(void *udata, void *msg, uint64_t len,
+                                   char first, char last, char text,
+                                   unsigned char rsv) {
+  ++bench_ws_messages;
+  (void)udata, (void)msg, (void)len, (void)first, (void)last, (void)text,
+      (void)rsv;
+}
+static void websocket_on_protocol_ping(void *udata, void *msg, uint64_t len) {
+  (void)udata, (void)msg, (void)len;
+}
+static void websocket_on_protocol_pong(void *udata, void *msg, uint64_t len) {
+  (void)udata, (void)msg, (void)len;
+}
+static void websocket_on_protocol_close(void *udata) { (void)udata; }
+static void websocket_on_protocol_error(void *udata) { (void)udata; }
+
+static void bench_websocket(void) {
+  if (!bench_selected("ws."))
+    return;
+  const size_t frame = websocket_wrapped_len(BENCH_WS_MESSAGE_LENGTH) + 4;
+  const size_t total = BENCH_WS_MESSAGE_LENGTH * BENCH_WS_MESSAGES;
+  char message[BENCH_WS_MESSAGE_LENGTH];
+  char *data = malloc(frame * BENCH_WS_MESSAGES);
+  FIO_ASSERT_ALLOC(data);
+  for (size_t i = 0; i < BENCH_WS_MESSAGE_LENGTH; ++i)
+    message[i] = 'a' + (i % 26);
+  size_t len = 0;
+  BENCH_MICRO("ws.server_wrap", BENCH_WS_MESSAGES, total, len = 0, {
+    for (size_t i = 0; i < BENCH_WS_MESSAGES; ++i)
+      len += websocket_server_wrap(data + len, message,
+                                   BENCH_WS_MESSAGE_LENGTH, 1, 1, 1, 0);
+  });
+  BENCH_MICRO("ws.client_wrap", BENCH_WS_MESSAGES, total, len = 0, {
+    for (size_t i = 0; i < BENCH_WS_MESSAGES; ++i)
+      len += websocket_client_wrap(data + len, message,
+                                   BENCH_WS_MESSAGE_LENGTH, 1, 1, 1, 0);
+  });
+  if (!bench_selected("ws.client_wrap")) {
+    len = 0;
+    for (size_t i = 0; i < BENCH_WS_MESSAGES; ++i)
+      len += websocket_client_wrap(data + len, message,
+                                   BENCH_WS_MESSAGE_LENGTH, 1, 1, 1, 0);
+  }
+  /* unmasking twice restores the masked data, so the frames can be reused */
+  BENCH_MICRO("ws.consume", BENCH_WS_MESSAGES, total, bench_ws_messages = 0,
+              websocket_consume(data, len, NULL, 1));
+  if (bench_selected("ws.consume") && bench_ws_messages != BENCH_WS_MESSAGES)
+    bench_fail("ws.consume", "message count mismatch");
+  free(data);
+}
+
+/* *****************************************************************************
+JSON and mustache (fiobj)
+***************************************************************************** */
+
+#define BENCH_JSON_RECORDS 4096
+#define BENCH_MUSTACHE_ROUNDS 16
+
+static FIOBJ bench_json_document(void) {
+  FIOBJ ary = fiobj_ary_new2(BENCH_JSON_RECORDS);
+  FIOBJ k_id = fiobj_str_new("id", 2), k_name = fiobj_str_new("name", 4),
+        k_email = fiobj_str_new("email", 5),
+        k_active = fiobj_str_new("active", 6),
+        k_score = fiobj_str_new("score", 5), k_tags = fiobj_str_new("tags", 4);
+  for (size_t i = 0; i < BENCH_JSON_RECORDS; ++i) {
+    FIOBJ h = fiobj_hash_new();
+    FIOBJ tags = fiobj_ary_new2(3);
+    fiobj_ary_push(tags, fiobj_str_new("alpha", 5));
+    fiobj_ary_push(tags, fiobj_str_new("beta \"b\"", 8));
+    fiobj_ary_push(tags, fiobj_str_new("gamma", 5));
+    fiobj_hash_set(h, k_id, fiobj_num_new(i));
+    FIOBJ name = fiobj_str_buf(16), email = fiobj_str_buf(32);
+    fiobj_str_printf(name, "User %zu", i);
+    fiobj_str_printf(email, "user%zu@example.com", i);
+    fiobj_hash_set(h, k_name, name);
+    fiobj_hash_set(h, k_email, email);
+    fiobj_hash_set(h, k_active, ((i & 1) ? fiobj_true() : fiobj_false()));
+    fiobj_hash_set(h, k_score, fiobj_float_new(i + 0.5));
+    fiobj_hash_set(h, k_tags, tags);
+    fiobj_ary_push(ary, h);
+  }
+  fiobj_free(k_id);
+  fiobj_free(k_name);
+  fiobj_free(k_email);
+  fiobj_free(k_active);
+  fiobj_free(k_score);
+  fiobj_free(k_tags);
+  return ary;
+}
+
+static void bench_fiobj(void) {
+  if (!bench_selected("json.") && !bench_selected("mustache."))
+    return;
+  FIOBJ doc = bench_json_document();
+  FIOBJ json = fiobj_obj2json(doc, 0);
+  fio_str_info_s s = fiobj_obj2cstr(json);
+  FIOBJ tmp = FIOBJ_INVALID;
+
+  BENCH_MICRO("json.parse", 1, s.len, (void)0, {
+    fiobj_json2obj(&tmp, s.data, s.len);
+    fiobj_free(tmp);
+  });
+  BENCH_MICRO("json.format", 1, s.len, (void)0, {
+    tmp = fiobj_obj2json(doc, 0);
+    fiobj_free(tmp);
+  });
+
+  static const char template[] =
+      "<ul>{{#users}}<li id=\"{{id}}\">{{name}} &lt;{{email}}&gt; "
+      "{{#active}}(active){{/active}}{{^active}}(inactive){{/active}} "
+      "{{#tags}}<b>{{.}}</b>{{/tags}}</li>\n{{/users}}</ul>";
+  mustache_s *m = fiobj_mustache_new(.data = template,
+                                     .data_len = sizeof(template) - 1);
+  FIOBJ data = fiobj_hash_new();
+  FIOBJ key = fiobj_str_new("users", 5);
+  fiobj_hash_set(data, key, fiobj_dup(doc));
+  fiobj_free(key);
+  size_t rendered = 0;
+  if (m) {
+    tmp = fiobj_mustache_build(m, data);
+    rendered = fiobj_obj2cstr(tmp).len * BENCH_MUSTACHE_ROUNDS;
+    fiobj_free(tmp);
+    BENCH_MICRO("mustache.build", BENCH_MUSTACHE_ROUNDS, rendered, (void)0, {
+      for (size_t i = 0; i < BENCH_MUSTACHE_ROUNDS; ++i) {
+        tmp = fiobj_mustache_build(m, data);
+        fiobj_free(tmp);
+      }
+    });
+  } else if (bench_selected("mustache.")) {
+    bench_fail("mustache.build", "template error");
+  }
+  fiobj_mustache_free(m);
+  fiobj_free(data);
+  fiobj_free(json);
+  fiobj_free(doc);
+}
+
+/* *****************************************************************************
+Reactor stages (pub/sub fan-out, HTTP and WebSocket loopback load)
+***************************************************************************** */
+
+#define BENCH_PUBSUB_SUBSCRIBERS 1024
+#define BENCH_PUBSUB_MESSAGES 1024
+#define BENCH_HTTP_CLIENTS 16
+#define BENCH_HTTP_PIPELINE 16
+#define BENCH_HTTP_LOAD (256 * 1024)
+#define BENCH_WS_CLIENTS 16
+#define BENCH_WS_LOAD (128 * 1024)
+
+static const char *bench_port = "3997";
+static uint64_t bench_stage_start;
+static size_t bench_stage_counter;
+static size_t bench_stage_pending;
+static void bench_stage_next(void *ignr1, void *ignr2);
+
+/** Records the stage's result and moves to the next stage. */
+static void bench_stage_done(const char *name, size_t ops, size_t bytes) {
+  bench_add(name, ops, bytes, 1, bench_now() - bench_stage_start);
+  fio_defer(bench_stage_next, NULL, NULL);
+}
+
+/* pub/sub fan-out: every message is delivered to every subscriber */
+
+static subscription_s *bench_subscriptions[BENCH_PUBSUB_SUBSCRIBERS];
+
+/* subscriptions can't be canceled from within their own `on_message` */
+static void bench_pubsub_unsubscribe(void *ignr1, void *ignr2) {
+  for (size_t i = 0; i < BENCH_PUBSUB_SUBSCRIBERS; ++i)
+    fio_unsubscribe(bench_subscriptions[i]);
+  (void)ignr1, (void)ignr2;
+}
+
+static void bench_pubsub_on_message(fio_msg_s *msg) {
+  if (++bench_stage_counter !=
+      BENCH_PUBSUB_SUBSCRIBERS * BENCH_PUBSUB_MESSAGES)
+    return;
+  fio_defer(bench_pubsub_unsubscribe, NULL, NULL);
+  bench_stage_done("pubsub.fanout",
+                   BENCH_PUBSUB_SUBSCRIBERS * BENCH_PUBSUB_MESSAGES,
+                   BENCH_PUBSUB_SUBSCRIBERS * BENCH_PUBSUB_MESSAGES *
+                       msg->msg.len);
+}
+
+static void bench_pubsub_start(void) {
+  for (size_t i = 0; i < BENCH_PUBSUB_SUBSCRIBERS; ++i)
+    bench_subscriptions[i] =
+        fio_subscribe(.channel = {.data = "bench", .len = 5},
+                      .on_message = bench_pubsub_on_message);
+  bench_stage_start = bench_now();
+  for (size_t i = 0; i < BENCH_PUBSUB_MESSAGES; ++i)
+    fio_publish(.engine = FIO_PUBSUB_PROCESS,
+                .channel = {.data = "bench", .len = 5},
+                .message = {.data = "Hello World!", .len = 12});
+}
+
+/* HTTP loopback: pipelined keep-alive requests over `fio_connect` */
+
+static const char bench_http_request[] =
+    "GET / HTTP/1.1\r\nHost: localhost\r\nUser-Agent: fio-bench\r\n\r\n";
+static size_t bench_http_bytes;
+
+typedef struct {
+  fio_protocol_s pr;
+  size_t sent;
+  size_t received;
+} bench_client_s;
+
+static void bench_client_send(intptr_t uuid, bench_client_s *c) {
+  char buf[sizeof(bench_http_request) * BENCH_HTTP_PIPELINE];
+  size_t len = 0;
+  for (size_t i = 0; i < BENCH_HTTP_PIPELINE &&
+                     c->sent < BENCH_HTTP_LOAD / BENCH_HTTP_CLIENTS;
+       ++i, ++c->sent) {
+    memcpy(buf + len, bench_http_request, sizeof(bench_http_request) - 1);
+    len += sizeof(bench_http_request) - 1;
+  }
+  fio_write(uuid, buf, len);
+}
+
+static void bench_client_on_data(intptr_t uuid, fio_protocol_s *pr) {
+  bench_client_s *c = (bench_client_s *)pr;
+  char buf[16384];
+  ssize_t len;
+  while ((len = fio_read(uuid, buf, sizeof(buf))) > 0) {
+    bench_http_bytes += len;
+    /* the response body ("Hello World!") is the only place '!' appears */
+    for (char *pos = buf; (pos = memchr(pos, '!', buf + len - pos)); ++pos)
+      ++c->received;
+  }
+  if (c->received < c->sent)
+    return;
+  if (c->sent < BENCH_HTTP_LOAD / BENCH_HTTP_CLIENTS) {
+    bench_client_send(uuid, c);
+    return;
+  }
+  fio_close(uuid);
+}
+
+static void bench_client_on_close(intptr_t uuid, fio_protocol_s *pr) {
+  bench_client_s *c = (bench_client_s *)pr;
+  bench_stage_counter += c->received;
+  free(c);
+  if (--bench_stage_pending)
+    return;
+  if (bench_stage_counter != BENCH_HTTP_LOAD) {
+    bench_fail("http.loopback", "missing responses");
+    fio_stop();
+    return;
+  }
+  bench_stage_done("http.loopback", BENCH_HTTP_LOAD, bench_http_bytes);
+  (void)uuid;
+}
+
+static void bench_client_on_connect(intptr_t uuid, void *udata) {
+  bench_client_s *c = malloc(sizeof(*c));
+  FIO_ASSERT_ALLOC(c);
+  *c = (bench_client_s){
+      .pr =
+          {
+              .on_data = bench_client_on_data,
+              .on_close = bench_client_on_close,
+          },
+  };
+  fio_attach(uuid, &c->pr);
+  bench_client_send(uuid, c);
+  (void)udata;
+}
+
+static void bench_client_on_fail(intptr_t uuid, void *udata) {
+  bench_fail("http.loopback", "couldn't connect");
+  fio_stop();
+  (void)uuid, (void)udata;
+}
+
+static void bench_http_start(void) {
+  bench_stage_pending = BENCH_HTTP_CLIENTS;
+  bench_http_bytes = 0;
+  bench_stage_start = bench_now();
+  for (size_t i = 0; i < BENCH_HTTP_CLIENTS; ++i) {
+    fio_connect(.address = "127.0.0.1", .port = bench_port,
+                .on_connect = bench_client_on_connect,
+                .on_fail = bench_client_on_fail);
+  }
+}
+
+/* WebSocket loopback: ping-pong echo messages over `websocket_connect` */
+
+static void bench_ws_client_send(ws_s *ws) {
+  static const char msg[] = "{\"event\":\"bench\",\"data\":\"Hello World!\"}";
+  websocket_write(ws, (fio_str_info_s){.data = (char *)msg,
+                                       .len = sizeof(msg) - 1},
+                  1);
+}
+
+static void bench_ws_client_on_message(ws_s *ws, fio_str_info_s msg,
+                                       uint8_t is_text) {
+  uintptr_t count = (uintptr_t)websocket_udata_get(ws) + 1;
+  websocket_udata_set(ws, (void *)count);
+  bench_http_bytes += msg.len;
+  if (count < BENCH_WS_LOAD / BENCH_WS_CLIENTS)
+    bench_ws_client_send(ws);
+  else
+    websocket_close(ws);
+  (void)is_text;
+}
+
+static void bench_ws_client_on_close(intptr_t uuid, void *udata) {
+  bench_stage_counter += (uintptr_t)udata;
+  if (!uuid)
+    bench_fail("websocket.loopback", "couldn't connect");
+  if (--bench_stage_pending)
+    return;
+  if (bench_stage_counter != BENCH_WS_LOAD) {
+    bench_fail("websocket.loopback", "missing messages");
+    fio_stop();
+    return;
+  }
+  bench_stage_done("websocket.loopback", BENCH_WS_LOAD, bench_http_bytes);
+}
+
+static void bench_ws_start(void) {
+  char url[64];
+  snprintf(url, sizeof(url), "ws://127.0.0.1:%s/", bench_port);
+  bench_stage_pending = BENCH_WS_CLIENTS;
+  bench_http_bytes = 0;
+  bench_stage_start = bench_now();
+  for (size_t i = 0; i < BENCH_WS_CLIENTS; ++i) {
+    websocket_connect(url, .on_open = bench_ws_client_send,
+                      .on_message = bench_ws_client_on_message,
+                      .on_close = bench_ws_client_on_close);
+  }
+}
+
+/* the server side */
+
+static void bench_server_on_request(http_s *h) {
+  http_send_body(h, "Hello World!", 12);
+}
+
+static void bench_server_ws_on_message(ws_s *ws, fio_str_info_s msg,
+                                       uint8_t is_text) {
+  websocket_write(ws, msg, is_text);
+}
+
+static void bench_server_on_upgrade(http_s *h, char *protocol, size_t len) {
+  if (len != 9 || memcmp(protocol, "websocket", 9)) {
+    http_send_error(h, 400);
+    return;
+  }
+  http_upgrade2ws(h, .on_message = bench_server_ws_on_message);
+}
+
+/* stage sequencing */
+
+static const struct {
+  const char *name;
+  void (*start)(void);
+} bench_stages[] = {
+    {.name = "pubsub.fanout", .start = bench_pubsub_start},
+    {.name = "http.loopback", .start = bench_http_start},
+    {.name = "websocket.loopback", .start = bench_ws_start},
+    {.name = NULL},
+};
+static size_t bench_stage;
+
+static void bench_stage_next(void *ignr1, void *ignr2) {
+  while (bench_stages[bench_stage].name &&
+         !bench_selected(bench_stages[bench_stage].name))
+    ++bench_stage;
+  if (!bench_stages[bench_stage].name) {
+    fio_stop();
+    return;
+  }
+  bench_stage_counter = 0;
+  bench_stages[bench_stage++].start();
+  (void)ignr1, (void)ignr2;
+}
+
+static void bench_on_start(void *ignr) {
+  fio_defer(bench_stage_next, NULL, NULL);
+  (void)ignr;
+}
+
+static void bench_timeout(void *ignr) {
+  bench_fail(bench_stages[bench_stage ? bench_stage - 1 : 0].name,
+             "timed out");
+  fio_stop();
+  (void)ignr;
+}
+
+static void bench_reactor(void) {
+  int selected = 0;
+  for (size_t i = 0; bench_stages[i].name; ++i)
+    selected |= bench_selected(bench_stages[i].name);
+  if (!selected)
+    return;
+  if (getenv("BENCH_PORT"))
+    bench_port = getenv("BENCH_PORT");
+  if (http_listen(bench_port, "127.0.0.1",
+                  .on_request = bench_server_on_request,
+                  .on_upgrade = bench_server_on_upgrade,
+                  .max_body_size = 1024) == -1) {
+    bench_fail("loopback", "couldn't listen");
+    return;
+  }
+  fio_state_callback_add(FIO_CALL_ON_START, bench_on_start, NULL);
+  fio_run_every(BENCH_TIMEOUT, 1, bench_timeout, NULL, NULL);
+  fio_start(.threads = 1, .workers = 1);
+}
+
+/* *****************************************************************************
+Main
+***************************************************************************** */
+
+int main(int argc, char **argv) {
+  bench_argc = argc;
+  bench_argv = argv;
+  fprintf(stderr, "=== facil.io %s benchmarks\n", FIO_VERSION_STRING);
+  bench_defer();
+  bench_malloc();
+  bench_fio_set();
+  bench_http1();
+  bench_websocket();
+  bench_fiobj();
+  bench_reactor();
+  bench_print();
+  return bench_failed;
+}
@@ -105,6 +105,7 @@ static void initialize_cli(int argc, char const *argv[]) {
       FIO_CLI_PRINT("\t\tsha1"),
       FIO_CLI_PRINT("\t\trisky (fio_str_hash_risky)"),
       FIO_CLI_PRINT("\t\trisky2 (fio_str_hash_risky alternative)"),
+      FIO_CLI_PRINT("\t\trisky_wide (fio_risky_hash_wide)"),
       // FIO_CLI_PRINT("\t\txor (xor all bytes and length)"),
       FIO_CLI_STRING(
           "-dictionary -d a text file containing words separated by an "
@@ -268,6 +269,10 @@ inline FIO_FUNC uintptr_t risky(char *data, size_t len) {
   return fio_risky_hash(data, len, 0);
 }
 
+inline FIO_FUNC uintptr_t risky_wide(char *data, size_t len) {
+  return fio_risky_hash_wide(data, len, 0);
+}
+
 /* *****************************************************************************
 Hash setup and testing...
 ***************************************************************************** */
@@ -285,6 +290,7 @@ struct hash_fn_names_s {
 #endif
     {"risky", risky},
     {"risky2", risky2},
+    {"risky_wide", risky_wide},
     {NULL, NULL},
 };
 
@@ -0,0 +1,106 @@
+/*
+Tests the JSON parser's speed (vector scanning vs. the scalar loops).
+
+Compile twice and compare (add `-mavx2` or `-march=native` to test AVX2):
+
+    gcc -O2 -I lib/facil/fiobj tests/json_speed.c -o json_simd
+    gcc -O2 -DJSON_PARSER_SIMD=0 -I lib/facil/fiobj tests/json_speed.c \
+        -o json_scalar
+*/
+#include <fio_json_parser.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* the parser's callbacks (counting events) */
+static size_t json_events;
+static char json_buffer[4096];
+
+static void fio_json_on_null(json_parser_s *p) { (void)p, ++json_events; }
+static void fio_json_on_true(json_parser_s *p) { (void)p, ++json_events; }
+static void fio_json_on_false(json_parser_s *p) { (void)p, ++json_events; }
+static void fio_json_on_number(json_parser_s *p, long long i) {
+  (void)p, (void)i, ++json_events;
+}
+static void fio_json_on_float(json_parser_s *p, double f) {
+  (void)p, (void)f, ++json_events;
+}
+static void fio_json_on_string(json_parser_s *p, void *start, size_t length) {
+  (void)p, ++json_events;
+  if (length < sizeof(json_buffer))
+    fio_json_unescape_str(json_buffer, start, length);
+}
+static int fio_json_on_start_object(json_parser_s *p) {
+  (void)p, ++json_events;
+  return 0;
+}
+static void fio_json_on_end_object(json_parser_s *p) { (void)p; }
+static int fio_json_on_start_array(json_parser_s *p) {
+  (void)p, ++json_events;
+  return 0;
+}
+static void fio_json_on_end_array(json_parser_s *p) { (void)p; }
+static void fio_json_on_json(json_parser_s *p) { (void)p; }
+static void fio_json_on_error(json_parser_s *p) {
+  (void)p;
+  fprintf(stderr, "ERROR: JSON parsing failed\n");
+  exit(-1);
+}
+
+#define RUNS 8
+#define RECORDS (1024 * 64)
+
+/* a pretty REST style document, Strings make up most of the data */
+static size_t json_document(char *dest) {
+  static const char bio[] =
+      "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do "
+      "eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad "
+      "minim veniam, quis \\\"nostrud\\\" exercitation ullamco laboris.";
+  size_t len = 0;
+  len += sprintf(dest + len, "[\n");
+  for (size_t i = 0; i < RECORDS; ++i) {
+    len += sprintf(dest + len,
+                   "%s  {\n    \"id\": %zu,\n    \"name\": \"User %zu\",\n"
+                   "    \"email\": \"user%zu@example.com\",\n"
+                   "    \"active\": %s,\n    \"score\": %zu.5,\n"
+                   "    \"tags\": [\"alpha\", \"beta\", \"gamma\"],\n"
+                   "    \"bio\": \"%s\"\n  }",
+                   (i ? ",\n" : ""), i, i, i, ((i & 1) ? "true" : "false"), i,
+                   bio);
+  }
+  len += sprintf(dest + len, "\n]\n");
+  return len;
+}
+
+int main(void) {
+  char *data = malloc(RECORDS * 512);
+  if (!data) {
+    perror("ERROR: couldn't allocate memory");
+    exit(-1);
+  }
+  const size_t len = json_document(data);
+  size_t events = 0;
+  clock_t avrg = 0;
+  for (size_t i = 0; i < RUNS; ++i) {
+    json_parser_s parser = {.dict = 0};
+    json_events = 0;
+    const clock_t start = clock();
+    size_t consumed = fio_json_parse(&parser, data, len);
+    avrg += clock() - start;
+    if (consumed + 1 != len) {
+      fprintf(stderr, "ERROR: consumed %zu / %zu bytes\n", consumed, len);
+      exit(-1);
+    }
+    events = json_events;
+  }
+  const double seconds = (avrg / RUNS) / (1.0 * CLOCKS_PER_SEC);
+  fprintf(stderr, " === JSON parsing (%s): %zu bytes, %zu events\n",
+          (JSON_SIMD ? "vector scanning" : "scalar"), len, events);
+  fprintf(stderr, "     %lfs (%.2lf MB/s)\n", seconds,
+          seconds ? (double)len / (seconds * 1e6) : 0.0);
+  free(data);
+  return 0;
+}
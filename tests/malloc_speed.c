@@ -10,6 +10,8 @@
 #define TEST_CYCLES_END 256
 #define TEST_CYCLES_REPEAT 3
 #define REPEAT_LIB_TEST 0
+#define TEST_THREADS 16
+#define TEST_THREAD_ROUNDS 512
 
 static size_t test_mem_functions(void *(*malloc_func)(size_t),
                                  void *(*calloc_func)(size_t, size_t),
@@ -133,6 +135,105 @@ static size_t test_mem_functions(void *(*malloc_func)(size_t),
   return clock_alloc + clock_realloc + clock_free + clock_calloc + clock_free2;
 }
 
+/* small allocations from many threads, freed (mostly) by other threads */
+struct test_threads_s {
+  void *(*malloc_func)(size_t);
+  void (*free_func)(void *);
+  void *volatile *exchange;
+};
+
+static void *test_threads_task(void *args_) {
+  struct test_threads_s *args = args_;
+  void *pointers[256];
+  size_t errors = 0;
+  const size_t id = (size_t)fio_rand64() & 255;
+  for (size_t r = 0; r < TEST_THREAD_ROUNDS; ++r) {
+    for (size_t i = 0; i < 256; ++i) {
+      pointers[i] = args->malloc_func(16 + ((i & 7) << 4));
+      if (!pointers[i])
+        ++errors;
+      else
+        ((char *)pointers[i])[0] = '1';
+    }
+    for (size_t i = 0; i < 256; ++i) {
+      /* swap every other pointer with another thread's */
+      if ((i & 1))
+        pointers[i] = (void *)fio_atomic_xchange(
+            &args->exchange[(id + i) & 255], pointers[i]);
+      args->free_func(pointers[i]);
+    }
+  }
+  return (void *)errors;
+}
+
+static void test_threads(const char *name, void *(*malloc_func)(size_t),
+                         void (*free_func)(void *)) {
+  void *volatile exchange[256] = {NULL};
+  struct test_threads_s args = {.malloc_func = malloc_func,
+                                .free_func = free_func,
+                                .exchange = exchange};
+  pthread_t threads[TEST_THREADS];
+  size_t errors = 0;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (size_t i = 0; i < TEST_THREADS; ++i) {
+    FIO_ASSERT(pthread_create(threads + i, NULL, test_threads_task, &args) ==
+                   0,
+               "Couldn't spawn thread.");
+  }
+  for (size_t i = 0; i < TEST_THREADS; ++i) {
+    void *thrd_result;
+    FIO_ASSERT(pthread_join(threads[i], &thrd_result) == 0,
+               "Couldn't join thread");
+    errors += (uintptr_t)thrd_result;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  for (size_t i = 0; i < 256; ++i) {
+    free_func(exchange[i]);
+  }
+  fprintf(stderr,
+          "* %s: %d threads X %d allocations: %.2lfms (%zu errors)\n", name,
+          TEST_THREADS, TEST_THREAD_ROUNDS * 256,
+          (double)((end.tv_sec - start.tv_sec) * 1000) +
+              ((double)(end.tv_nsec - start.tv_nsec) / 1000000.0),
+          errors);
+}
+
+/* long-lived objects scattered between short-lived ones, over time */
+static void test_fragmentation(void) {
+  const size_t rounds = 8;
+  const size_t count = 1 << 14;
+  void **pointers = fio_malloc(rounds * count * sizeof(*pointers));
+  FIO_ASSERT(pointers, "Memory allocation error.");
+  size_t live = 0;
+  for (size_t r = 0; r < rounds; ++r) {
+    void **round = pointers + (r * count);
+    for (size_t i = 0; i < count; ++i) {
+      round[i] = fio_malloc(16 + ((i % 15) << 4));
+    }
+    /* keep 1 out of 64 objects alive */
+    for (size_t i = 0; i < count; ++i) {
+      if ((i & 63)) {
+        fio_free(round[i]);
+        round[i] = NULL;
+      } else {
+        live += 16 + ((i % 15) << 4);
+      }
+    }
+    fio_malloc_stats_s stats = fio_malloc_stats();
+    fprintf(stderr,
+            "* round %zu: %zu live bytes, %zu blocks (%zu bytes) in use, %zu "
+            "slab blocks (%zu bytes used).\n",
+            r, live, stats.blocks,
+            (size_t)(stats.blocks * FIO_MEMORY_BLOCK_SIZE), stats.slabs,
+            stats.slab_bytes);
+  }
+  for (size_t i = 0; i < rounds * count; ++i) {
+    fio_free(pointers[i]);
+  }
+  fio_free(pointers);
+}
+
 void *test_system_malloc(void *ignr) {
   (void)ignr;
   uintptr_t result = test_mem_functions(malloc, calloc, realloc, free);
@@ -174,5 +275,17 @@ int main(void) {
   fio += (uintptr_t)thrd_result;
   fprintf(stderr, "Total Cycles: %zu\n", fio);
 
+  /* test concurrency */
+  fprintf(stderr, "\n===== Performance Testing concurrent allocations "
+                  "(please wait):\n");
+  test_threads("system", malloc, free);
+  test_threads("facil.io", fio_malloc, fio_free);
+
+  /* test fragmentation */
+  fprintf(stderr, "\n===== Testing facil.io memory fragmentation "
+                  "(FIO_MEMORY_SLABS == %d):\n",
+          FIO_MEMORY_SLABS);
+  test_fragmentation();
+
   return 0; // fio > system;
 }
@@ -135,6 +135,64 @@ static inline int seek4(register uint8_t **buffer,
 #endif
 }
 
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <immintrin.h>
+#define SEEK_SIMD 1
+/* returns a bitmask of the bytes equal to `c` in a 16 byte block */
+static inline uint64_t seek_simd_block(uint8_t *pos, const uint8_t c) {
+  return (uint64_t)_mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_loadu_si128((__m128i *)pos), _mm_set1_epi8((char)c)));
+}
+#define SEEK_SIMD_INDEX(mask) __builtin_ctzll((mask))
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SEEK_SIMD 1
+/* returns a nibble-per-byte mask of the bytes equal to `c` in a 16 byte block */
+static inline uint64_t seek_simd_block(uint8_t *pos, const uint8_t c) {
+  const uint8x16_t eq = vceqq_u8(vld1q_u8(pos), vdupq_n_u8(c));
+  return vget_lane_u64(
+      vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+}
+#define SEEK_SIMD_INDEX(mask) (__builtin_ctzll((mask)) >> 2)
+#endif
+
+#if SEEK_SIMD
+/** 16 bytes at a time, using vector instructions (SSE2 / NEON). */
+static inline int seek5(uint8_t **buffer, uint8_t *const limit,
+                        const uint8_t c) {
+  for (; *buffer + 16 <= limit; *buffer += 16) {
+    uint64_t mask = seek_simd_block(*buffer, c);
+    if (mask) {
+      *buffer += SEEK_SIMD_INDEX(mask);
+      return 1;
+    }
+  }
+  while (*buffer < limit) {
+    if (**buffer == c)
+      return 1;
+    (*buffer)++;
+  }
+  return 0;
+}
+
+/**
+ * The HTTP/1 parser's approach: vector scan the first 64 bytes (most lines are
+ * short), then fall back to `memchr`.
+ */
+static inline int seek6(uint8_t **buffer, uint8_t *const limit,
+                        const uint8_t c) {
+  uint8_t *end = (limit - *buffer > 64) ? *buffer + 64 : limit;
+  for (; *buffer + 16 <= end; *buffer += 16) {
+    uint64_t mask = seek_simd_block(*buffer, c);
+    if (mask) {
+      *buffer += SEEK_SIMD_INDEX(mask);
+      return 1;
+    }
+  }
+  return seek_memchr(buffer, limit, c);
+}
+#endif
+
 #define RUNS 8
 int main(int argc, char const **argv) {
 
@@ -168,6 +226,10 @@ int main(int argc, char const **argv) {
       {.func = seek3, .name = "seek3 (64 bit word at a time)"},
 #ifdef __SIZEOF_INT128__
       {.func = seek4, .name = "seek4 (128 bit word at a time)"},
+#endif
+#if SEEK_SIMD
+      {.func = seek5, .name = "seek5 (SIMD, 16 bytes at a time)"},
+      {.func = seek6, .name = "seek6 (SIMD for 64 bytes, then memchr)"},
 #endif
       {.func = NULL, .name = NULL},
   };
@@ -2,8 +2,11 @@
 #include "tests/mustache.c.h"
 
 #include <fio.h>
+#include <fio_tls.h>
 #include <fiobj.h>
 #include <http.h>
+#include <mesh_engine.h>
+#include <redis_engine.h>
 
 #include "resp_parser.h"
 
@@ -15,6 +18,9 @@ int main(void) {
   fiobj_test();
   http_tests();
   resp_test();
+  mesh_engine_test();
+  redis_engine_test();
+  fio_tls_test();
 }
 
 void resp_test(void) {
@@ -0,0 +1,100 @@
+/*
+Tests the WebSocket masking speed (vector kernels vs. the word-at-a-time loop).
+
+Compile with (add `-mavx2` or `-march=native` to test the AVX2 kernel):
+
+    gcc -O2 -I lib/facil/http/parsers tests/websocket_mask_speed.c
+*/
+#include <websocket_parser.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* the parser's callbacks (unused) */
+static void websocket_on_unwrapped(void *udata, void *msg, uint64_t len,
+                                   char first, char last, char text,
+                                   unsigned char rsv) {
+  (void)udata, (void)msg, (void)len, (void)first, (void)last, (void)text,
+      (void)rsv;
+}
+static void websocket_on_protocol_ping(void *udata, void *msg, uint64_t len) {
+  (void)udata, (void)msg, (void)len;
+}
+static void websocket_on_protocol_pong(void *udata, void *msg, uint64_t len) {
+  (void)udata, (void)msg, (void)len;
+}
+static void websocket_on_protocol_close(void *udata) { (void)udata; }
+static void websocket_on_protocol_error(void *udata) { (void)udata; }
+
+static void xmask_bytes(void *msg, uint64_t len, uint32_t mask) {
+  for (uint64_t i = 0; i < len; ++i)
+    ((uint8_t *)msg)[i] ^= ((uint8_t *)&mask)[i & 3];
+}
+
+#define RUNS 8
+#define TEST_LENGTH (1024 * 1024)
+#define TEST_REPEAT 256
+
+int main(void) {
+  struct {
+    void (*func)(void *msg, uint64_t len, uint32_t mask);
+    const char *name;
+  } mask_funcs[] = {
+      {.func = xmask_bytes, .name = "byte at a time"},
+      {.func = websocket_xmask_words, .name = "word at a time (scalar)"},
+#if WEBSOCKET_SIMD
+      {.func = websocket_xmask, .name = "vector kernels (SIMD)"},
+#endif
+      {.func = NULL, .name = NULL},
+  };
+  const uint32_t mask = 0x9A3C51E7;
+  uint8_t *const data = malloc(TEST_LENGTH + 64);
+  uint8_t *const expected = malloc(TEST_LENGTH + 64);
+  if (!data || !expected) {
+    perror("ERROR: couldn't allocate memory");
+    exit(-1);
+  }
+  for (size_t i = 0; i < TEST_LENGTH + 64; ++i)
+    data[i] = (uint8_t)(i * 7);
+
+  /* test unaligned heads and tails against the byte at a time loop */
+  for (size_t f = 1; mask_funcs[f].func; ++f) {
+    for (size_t offset = 0; offset < 32; ++offset) {
+      for (size_t len = 0; len < 200; ++len) {
+        memcpy(expected, data, 256);
+        xmask_bytes(expected + offset, len, mask);
+        mask_funcs[f].func(data + offset, len, mask);
+        if (memcmp(expected, data, 256)) {
+          fprintf(stderr, "ERROR: %s failed (offset %zu, length %zu)\n",
+                  mask_funcs[f].name, offset, len);
+          exit(-1);
+        }
+        xmask_bytes(data + offset, len, mask);
+      }
+    }
+  }
+
+  fprintf(stderr, "Masking %d x %d bytes (%d runs):\n", TEST_REPEAT,
+          TEST_LENGTH, RUNS);
+  for (size_t f = 0; mask_funcs[f].func; ++f) {
+    clock_t avrg = 0;
+    for (size_t i = 0; i < RUNS; ++i) {
+      /* an unaligned payload, as found after a WebSocket header */
+      const clock_t start = clock();
+      for (size_t r = 0; r < TEST_REPEAT; ++r)
+        mask_funcs[f].func(data + 6, TEST_LENGTH, mask);
+      avrg += clock() - start;
+    }
+    const double seconds = (avrg / RUNS) / (1.0 * CLOCKS_PER_SEC);
+    fprintf(stderr, " === %s: %lfs (%.2lf GB/s)\n", mask_funcs[f].name,
+            seconds,
+            seconds ? ((double)TEST_LENGTH * TEST_REPEAT) / (seconds * 1e9)
+                    : 0.0);
+  }
+  free(data);
+  free(expected);
+  return 0;
+}